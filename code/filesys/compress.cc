@@ -0,0 +1,192 @@
+// compress.cc
+//	Routines to compress and decompress a buffer.  See compress.h.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "compress.h"
+#include "utility.h"
+#include "sysdep.h"
+
+//----------------------------------------------------------------------
+// HashMatch
+// 	Return the match table slot for the four bytes at "p".
+//----------------------------------------------------------------------
+
+static int
+HashMatch(char *p)
+{
+    unsigned int v = (unsigned char) p[0] | ((unsigned char) p[1] << 8) |
+		((unsigned char) p[2] << 16) | ((unsigned int) (unsigned char) p[3] << 24);
+
+    return (int) ((v * 2654435761u) >> (32 - MatchHashBits));
+}
+
+//----------------------------------------------------------------------
+// PutLength
+// 	Append the length bytes for "n", the part of a length beyond the
+//	15 its token can hold.  Return FALSE if there is no room.
+//----------------------------------------------------------------------
+
+static bool
+PutLength(char *into, int *out, int room, int n)
+{
+    for (; n >= 255; n -= 255) {
+	if (*out >= room)
+	    return FALSE;
+	into[(*out)++] = (char) 255;
+    }
+    if (*out >= room)
+	return FALSE;
+    into[(*out)++] = (char) n;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// PutSequence
+// 	Append one sequence: the "count" literals at "literals", then,
+//	unless "length" is 0 (the last sequence), a match of "length"
+//	bytes "offset" back.  Return FALSE if there is no room.
+//----------------------------------------------------------------------
+
+static bool
+PutSequence(char *into, int *out, int room, char *literals, int count,
+		int offset, int length)
+{
+    int matchCode = (length > 0) ? length - MinMatch : 0;
+
+    if (*out >= room)
+	return FALSE;
+    into[(*out)++] = (char) ((min(count, 15) << 4) | min(matchCode, 15));
+    if (count >= 15 && !PutLength(into, out, room, count - 15))
+	return FALSE;
+    if (*out + count > room)
+	return FALSE;
+    bcopy(literals, &into[*out], count);
+    *out += count;
+    if (length == 0)
+	return TRUE;
+
+    if (*out + 2 > room)
+	return FALSE;
+    into[(*out)++] = (char) (offset & 0xff);
+    into[(*out)++] = (char) (offset >> 8);
+    if (matchCode >= 15 && !PutLength(into, out, room, matchCode - 15))
+	return FALSE;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Compress
+// 	Compress the "size" bytes at "from" into "into", which has room
+//	for "room" bytes.  Return how many it took, or -1 if the result
+//	would not fit, so the caller keeps the bytes as they are.
+//
+//	At each position, the table says where the same four bytes (as
+//	far as their hash tells) were seen last; if they really are the
+//	same, the match is stretched as far as it goes and emitted, with
+//	the literals before it, and the search goes on after it.
+//----------------------------------------------------------------------
+
+int
+Compress(char *from, int size, char *into, int room)
+{
+    int table[1 << MatchHashBits];
+    int anchor = 0;			// first literal not yet emitted
+    int out = 0;
+    int i = 0;
+
+    for (int h = 0; h < (1 << MatchHashBits); h++)
+	table[h] = -1;
+
+    while (i + MinMatch <= size) {
+	int h = HashMatch(&from[i]);
+	int candidate = table[h];
+	int length;
+
+	table[h] = i;
+	if (candidate == -1 || i - candidate > 0xffff ||
+		memcmp(&from[candidate], &from[i], MinMatch) != 0) {
+	    i++;
+	    continue;
+	}
+	length = MinMatch;
+	while (i + length < size && from[candidate + length] == from[i + length])
+	    length++;
+	if (!PutSequence(into, &out, room, &from[anchor], i - anchor,
+				i - candidate, length))
+	    return -1;
+	i += length;
+	anchor = i;
+    }
+    if (!PutSequence(into, &out, room, &from[anchor], size - anchor, 0, 0))
+	return -1;
+    return out;
+}
+
+//----------------------------------------------------------------------
+// GetLength
+// 	Add the length bytes at "from[*in]" to "*n".  Return FALSE if
+//	they run past "length".
+//----------------------------------------------------------------------
+
+static bool
+GetLength(char *from, int *in, int length, int *n)
+{
+    int b;
+
+    do {
+	if (*in >= length)
+	    return FALSE;
+	b = (unsigned char) from[(*in)++];
+	*n += b;
+    } while (b == 255);
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Decompress
+// 	Expand the "length" bytes at "from", made by Compress, into
+//	"into", which has room for "room" bytes.  Return how many bytes
+//	that made, or -1 if "from" is damaged: a length runs past either
+//	buffer, or a match reaches back before the start.
+//----------------------------------------------------------------------
+
+int
+Decompress(char *from, int length, char *into, int room)
+{
+    int in = 0;
+    int out = 0;
+
+    while (in < length) {
+	int token = (unsigned char) from[in++];
+	int count = token >> 4;
+	int matchLength = token & 15;
+	int offset;
+
+	if (count == 15 && !GetLength(from, &in, length, &count))
+	    return -1;
+	if (in + count > length || out + count > room)
+	    return -1;
+	bcopy(&from[in], &into[out], count);
+	in += count;
+	out += count;
+	if (in == length)
+	    break;			// the last sequence
+
+	if (in + 2 > length)
+	    return -1;
+	offset = (unsigned char) from[in] | ((unsigned char) from[in + 1] << 8);
+	in += 2;
+	if (matchLength == 15 && !GetLength(from, &in, length, &matchLength))
+	    return -1;
+	matchLength += MinMatch;
+	if (offset == 0 || offset > out || out + matchLength > room)
+	    return -1;
+	for (int k = 0; k < matchLength; k++, out++)
+	    into[out] = into[out - offset];	// may overlap itself
+    }
+    return out;
+}
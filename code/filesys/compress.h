@@ -0,0 +1,40 @@
+// compress.h
+//	Routines to compress and decompress a small buffer, for files
+//	stored compressed (see filehdr.h).
+//
+//	The format is that of LZ4: a sequence of literal bytes, copied as
+//	they are, then a match, a copy of bytes seen before; and so on.
+//	Each sequence starts with a token byte, whose high half is the
+//	number of literals and low half the match length less MinMatch;
+//	a half of 15 means more length bytes follow (each adds up to 255,
+//	ending at one that is less).  The literals come next, then the
+//	match as a two byte offset back from the current position, least
+//	significant byte first, then the match length bytes.  The last
+//	sequence has literals only.
+//
+//	Matches are found through a table of where each four byte string
+//	was last seen, so a buffer of SectorSize or so compresses in one
+//	quick pass, which the simulated CPU does for far less than the
+//	disk takes to move a sector.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "copyright.h"
+
+#define MinMatch	4		// shortest match worth a sequence
+#define MatchHashBits	10		// log2 of the match table size
+
+extern int Compress(char *from, int size, char *into, int room);
+					// Compress "size" bytes into at most
+					// "room"; return the bytes used, or
+					// -1 if they don't fit
+extern int Decompress(char *from, int length, char *into, int room);
+					// Undo it; return the bytes produced,
+					// or -1 if "from" is not well formed
+
+#endif // COMPRESS_H
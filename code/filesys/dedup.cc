@@ -0,0 +1,169 @@
+// dedup.cc
+//	Routines to keep track of the data sectors that deduplicated
+//	files share.  See dedup.h.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "dedup.h"
+#include "debug.h"
+#include "synchdisk.h"
+#include "main.h"
+
+//----------------------------------------------------------------------
+// DedupTable::DedupTable
+// 	Initialize the table: no sector is shared, and no contents are
+//	known.  The counts are written out by the first WriteDirty with
+//	"all" set, as for a disk just formatted.
+//----------------------------------------------------------------------
+
+DedupTable::DedupTable()
+{
+    for (int i = 0; i < NumSectors; i++) {
+	shares[i] = 0;
+	hashOf[i] = 0;
+    }
+    for (int i = 0; i < divRoundUp(ShareTableSize, SectorSize); i++)
+	dirty[i] = FALSE;
+    for (int i = 0; i < DedupSlots; i++)
+	slot[i] = -1;
+}
+
+//----------------------------------------------------------------------
+// DedupTable::FetchFrom
+// 	Read the share counts from "file", starting at "offset".
+//----------------------------------------------------------------------
+
+void
+DedupTable::FetchFrom(OpenFile *file, int offset)
+{
+    file->ReadAt((char *) shares, ShareTableSize, offset);
+    for (int i = 0; i < divRoundUp(ShareTableSize, SectorSize); i++)
+	dirty[i] = FALSE;
+}
+
+//----------------------------------------------------------------------
+// DedupTable::WriteDirty
+// 	Write back the sectors' worth of share counts that changed since
+//	they were last read or written, or all of them if "all".
+//----------------------------------------------------------------------
+
+void
+DedupTable::WriteDirty(OpenFile *file, int offset, bool all)
+{
+    for (int i = 0; i < divRoundUp(ShareTableSize, SectorSize); i++) {
+	if (dirty[i] || all) {
+	    int start = i * SectorSize;
+	    int len = min(SectorSize, ShareTableSize - start);
+
+	    file->WriteAt((char *) &shares[start], len, offset + start);
+	    dirty[i] = FALSE;
+	}
+    }
+}
+
+//----------------------------------------------------------------------
+// DedupTable::Hash
+// 	Return a hash of the SectorSize bytes at "data" (FNV-1a).
+//----------------------------------------------------------------------
+
+unsigned
+DedupTable::Hash(char *data)
+{
+    unsigned h = 2166136261u;
+
+    for (int i = 0; i < SectorSize; i++) {
+	h ^= (unsigned char) data[i];
+	h *= 16777619u;
+    }
+    return h;
+}
+
+//----------------------------------------------------------------------
+// DedupTable::Find
+// 	Return a sector of some deduplicated file that holds the same
+//	SectorSize bytes as "data", whose hash is "hash", or -1 if none
+//	is known to.  The sector is read and compared before it is
+//	trusted; it is usually still in the cache, since it was written
+//	not long ago.
+//----------------------------------------------------------------------
+
+int
+DedupTable::Find(char *data, unsigned hash)
+{
+    int sector = slot[hash % DedupSlots];
+    char buf[SectorSize];
+
+    if (sector == -1 || hashOf[sector] != hash)
+	return -1;
+    kernel->synchDisk->ReadSector(sector, buf);
+    if (memcmp(buf, data, SectorSize) != 0)
+	return -1;			// a collision
+    return sector;
+}
+
+//----------------------------------------------------------------------
+// DedupTable::Insert
+// 	Note that "sector" now holds data whose hash is "hash", so later
+//	blocks with the same contents can share it.  It takes the slot
+//	from any sector there before.
+//----------------------------------------------------------------------
+
+void
+DedupTable::Insert(int sector, unsigned hash)
+{
+    slot[hash % DedupSlots] = sector;
+    hashOf[sector] = hash;
+}
+
+//----------------------------------------------------------------------
+// DedupTable::Forget
+// 	"sector" is about to be written over, or freed; no block should
+//	be given it for its present contents any more.
+//----------------------------------------------------------------------
+
+void
+DedupTable::Forget(int sector)
+{
+    int *s = &slot[hashOf[sector] % DedupSlots];
+
+    if (*s == sector)
+	*s = -1;
+}
+
+//----------------------------------------------------------------------
+// DedupTable::Share
+// 	One more block is to point at "sector".  Return FALSE, leaving
+//	the count alone, if it already serves as many as it can count;
+//	the block then gets a sector of its own.
+//----------------------------------------------------------------------
+
+bool
+DedupTable::Share(int sector)
+{
+    if (shares[sector] == MaxShares)
+	return FALSE;
+    shares[sector]++;
+    Changed(sector);
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// DedupTable::Release
+// 	One block less points at "sector".  If it was the last one, the
+//	sector is forgotten and cleared in "freeMap".
+//----------------------------------------------------------------------
+
+void
+DedupTable::Release(PersistentBitmap *freeMap, int sector)
+{
+    if (shares[sector] > 0) {
+	shares[sector]--;
+	Changed(sector);
+	return;
+    }
+    Forget(sector);
+    freeMap->Clear(sector);
+}
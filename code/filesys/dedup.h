@@ -0,0 +1,80 @@
+// dedup.h
+//	Data structures for sharing identical data sectors between files.
+//
+//	A file created deduplicated (see FileSystem::Create) has each of
+//	its blocks hashed as it is written.  If a block of some
+//	deduplicated file already holds the same bytes, the new block
+//	just points at that sector too, instead of taking one of its own;
+//	copies of the same program, or the same fixture, then take the
+//	disk space of one, and since the sector cache is indexed by
+//	sector, a cached copy serves them all.  A write to a shared block
+//	gives it a sector of its own first (copy on write), so the
+//	others never see it.
+//
+//	How many more blocks than one point at each sector is kept in a
+//	table of share counts, stored in the free map file between the
+//	bitmap and the superblock, and written back with the bitmap.
+//	A sector with a count of 0 belongs to one block, as usual;
+//	removing a block only frees its sector once the count is 0.
+//
+//	The index from contents to sector is in memory only, and holds
+//	only sectors of deduplicated files written since boot.  It has
+//	one slot per hash value, so a newer sector replaces an older one
+//	with the same hash; and the bytes are always compared before a
+//	sector is shared, so a hash collision costs a read, never data.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include "copyright.h"
+#include "disk.h"
+#include "openfile.h"
+#include "pbitmap.h"
+
+#define ShareTableSize	NumSectors	// bytes of share counts on disk
+#define MaxShares	255		// most extra blocks one sector serves
+#define DedupSlots	NumSectors	// slots in the contents index
+
+// The following class defines the share counts and the contents
+// index of the deduplicated sectors on a disk.
+
+class DedupTable {
+  public:
+    DedupTable();			// No sector shared, nothing indexed
+
+    void FetchFrom(OpenFile *file, int offset);
+    					// Read the share counts from "file"
+    void WriteDirty(OpenFile *file, int offset, bool all);
+    					// Write back the counts that changed,
+					// or "all" of them
+
+    static unsigned Hash(char *data);	// Hash a sector's contents
+    int Find(char *data, unsigned hash);
+    					// Sector of a deduplicated file that
+					// holds "data", or -1
+    void Insert(int sector, unsigned hash);
+    					// "sector" now holds data with "hash"
+    void Forget(int sector);		// It is about to change, or be freed
+
+    int Shares(int sector) { return shares[sector]; }
+    					// Extra blocks pointing at "sector"
+    bool Share(int sector);		// One more; FALSE if it can't be
+    void Release(PersistentBitmap *freeMap, int sector);
+    					// One block less points at "sector";
+					// the last one frees it
+
+  private:
+    unsigned char shares[NumSectors];	// share counts, as on disk
+    bool dirty[divRoundUp(ShareTableSize, SectorSize)];
+    					// which sectors of them changed
+    int slot[DedupSlots];		// sector with each hash, or -1
+    unsigned hashOf[NumSectors];	// hash of each indexed sector
+
+    void Changed(int sector) { dirty[sector / SectorSize] = TRUE; }
+};
+
+#endif // DEDUP_H
@@ -0,0 +1,544 @@
+// dirbtree.cc
+//	Routines to manage an indexed directory, stored as a B-tree of
+//	name hashes in the directory's file.
+//
+//	Each node is read and written with a single ReadAt or WriteAt, so
+//	it goes to the disk as one request through the cache (a leaf is
+//	written only as far as its records go).  Splits propagate up the
+//	path noted on the way down; a full root grows the tree by a level.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+#ifndef FILESYS_STUB
+
+#include "copyright.h"
+#include "debug.h"
+#include "pbitmap.h"
+#include "directory.h"
+#include "dirbtree.h"
+
+// where node "n" starts in the directory file
+#define NodeOffset(n)	(SectorSize + (n) * NodeSize)
+
+// the bytes of a node in front of the records or keys
+#define NodeHeaderSize	(NodeSize - LeafBytes)
+
+//----------------------------------------------------------------------
+// DirectoryBTree::DirectoryBTree
+// 	Open an indexed directory, reading its header sector.
+//
+//	"sector" -- the location of the directory file's header
+//----------------------------------------------------------------------
+
+DirectoryBTree::DirectoryBTree(int sector)
+{
+    ASSERT(sizeof(BTreeNode) == NodeSize);
+    file = new OpenFile(sector);
+    (void) file->ReadAt((char *)&header, sizeof(header), 0);
+    ASSERT(header.magic == BTreeMagic);
+    scanNode = NULL;
+    scanOffset = 0;
+}
+
+//----------------------------------------------------------------------
+// DirectoryBTree::~DirectoryBTree
+// 	Close the directory.  Every change is already in the file.
+//----------------------------------------------------------------------
+
+DirectoryBTree::~DirectoryBTree()
+{
+    delete scanNode;
+    delete file;
+}
+
+//----------------------------------------------------------------------
+// DirectoryBTree::Format
+// 	Write an empty indexed directory to "file": the header sector,
+//	and a root that is an empty leaf.
+//
+//	"file" -- the new directory's file
+//----------------------------------------------------------------------
+
+void
+DirectoryBTree::Format(OpenFile *file)
+{
+    char buf[SectorSize];
+    BTreeHeader *hdr = (BTreeHeader *) buf;
+    BTreeNode *root = new BTreeNode;
+
+    bzero(buf, SectorSize);
+    hdr->magic = BTreeMagic;
+    hdr->root = 0;
+    hdr->numNodes = 1;
+    hdr->numEntries = 0;
+    (void) file->WriteAt(buf, SectorSize, 0);
+
+    bzero((char *) root, NodeSize);
+    root->isLeaf = TRUE;
+    root->next = -1;
+    (void) file->WriteAt((char *) root, NodeHeaderSize, NodeOffset(0));
+    delete root;
+}
+
+//----------------------------------------------------------------------
+// DirectoryBTree::ReadNode, DirectoryBTree::WriteNode
+// 	Move node "n" between the file and "node".  Only the records a
+//	leaf actually holds are written.
+//----------------------------------------------------------------------
+
+void
+DirectoryBTree::ReadNode(int n, BTreeNode *node)
+{
+    ASSERT(n >= 0 && n < header.numNodes);
+    bzero((char *) node, NodeSize);
+    (void) file->ReadAt((char *) node, NodeSize, NodeOffset(n));
+}
+
+void
+DirectoryBTree::WriteNode(int n, BTreeNode *node)
+{
+    int length = node->isLeaf ? NodeHeaderSize + node->used : NodeSize;
+
+    (void) file->WriteAt((char *) node, length, NodeOffset(n));
+}
+
+//----------------------------------------------------------------------
+// DirectoryBTree::WriteHeader
+// 	Write our copy of the header back to the first sector.
+//----------------------------------------------------------------------
+
+void
+DirectoryBTree::WriteHeader()
+{
+    (void) file->WriteAt((char *)&header, sizeof(header), 0);
+}
+
+//----------------------------------------------------------------------
+// DirectoryBTree::FindLeaf
+// 	Walk from the root to the leaf that holds (or would hold) "hash".
+//	Return its node number, with the leaf itself in "node".
+//
+//	"path" -- gets the node numbers from the root down to the leaf
+//	"depth" -- gets the number of nodes on the path
+//----------------------------------------------------------------------
+
+int
+DirectoryBTree::FindLeaf(unsigned hash, BTreeNode *node, int *path, int *depth)
+{
+    int n = header.root;
+
+    *depth = 0;
+    for (;;) {
+	ASSERT(*depth < MaxDepth);
+	path[(*depth)++] = n;
+	ReadNode(n, node);
+	if (node->isLeaf)
+	    return n;
+
+	int i = 0;
+	while (i < node->count && node->inner.key[i] <= hash)
+	    i++;
+	n = node->inner.child[i];
+    }
+}
+
+//----------------------------------------------------------------------
+// DirectoryBTree::FindRecord
+// 	Return the offset of the record for "name" among the records of
+//	"leaf", or -1 if it is not there.  Hashes are compared first.
+//----------------------------------------------------------------------
+
+int
+DirectoryBTree::FindRecord(BTreeNode *leaf, char *name, unsigned hash)
+{
+    int len = strlen(name);
+    int offset = 0;
+
+    while (offset < leaf->used) {
+	DirectoryRecord *rec = (DirectoryRecord *) &leaf->records[offset];
+
+	if (rec->hash == hash && rec->nameLen == len &&
+		!memcmp(&leaf->records[offset + sizeof(DirectoryRecord)],
+			name, len))
+	    return offset;
+	if (rec->hash > hash)
+	    break;			// records are in hash order
+	offset += RecordSize(rec->nameLen);
+    }
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// DirectoryBTree::Find
+// 	Look up "name", and return the sector of its file header, or -1
+//	if it is not in the directory.
+//
+//	"hash" -- HashName(name)
+//	"type" -- gets DIR or FILE, if the name is found
+//----------------------------------------------------------------------
+
+int
+DirectoryBTree::Find(char *name, unsigned hash, int *type)
+{
+    BTreeNode *leaf = new BTreeNode;
+    int path[MaxDepth];
+    int depth, offset, sector = -1;
+
+    FindLeaf(hash, leaf, path, &depth);
+    offset = FindRecord(leaf, name, hash);
+    if (offset != -1) {
+	DirectoryRecord *rec = (DirectoryRecord *) &leaf->records[offset];
+
+	sector = rec->sector;
+	*type = rec->type;
+    }
+    delete leaf;
+    return sector;
+}
+
+//----------------------------------------------------------------------
+// DirectoryBTree::Insert
+// 	Add "name" to the directory, keeping its leaf in hash order, and
+//	splitting the leaf if it has no room.  Return FALSE if the name
+//	is already there, or (practically never) the leaf is so full of
+//	one hash value that it cannot be split.
+//
+//	"hash" -- HashName(name)
+//	"sector" -- the sector of the file's header
+//	"type" -- DIR or FILE
+//----------------------------------------------------------------------
+
+bool
+DirectoryBTree::Insert(char *name, unsigned hash, int sector, int type)
+{
+    BTreeNode *leaf = new BTreeNode;
+    char record[RecordSize(FileNameMaxLen)];
+    DirectoryRecord *rec = (DirectoryRecord *) record;
+    int len = strlen(name);
+    int size = RecordSize(len);
+    int path[MaxDepth];
+    int n, depth, offset;
+    bool success = TRUE;
+
+    n = FindLeaf(hash, leaf, path, &depth);
+    if (FindRecord(leaf, name, hash) != -1) {
+	delete leaf;
+	return FALSE;			// already there
+    }
+
+    bzero(record, size);
+    rec->sector = sector;
+    rec->hash = hash;
+    rec->type = type;
+    rec->nameLen = len;
+    bcopy(name, &record[sizeof(DirectoryRecord)], len);
+
+    // the new record goes after every record with a hash <= its own
+    offset = 0;
+    while (offset < leaf->used) {
+	DirectoryRecord *r = (DirectoryRecord *) &leaf->records[offset];
+
+	if (r->hash > hash)
+	    break;
+	offset += RecordSize(r->nameLen);
+    }
+
+    if (leaf->used + size <= LeafBytes) {
+	memmove(&leaf->records[offset + size], &leaf->records[offset],
+			leaf->used - offset);
+	bcopy(record, &leaf->records[offset], size);
+	leaf->count++;
+	leaf->used += size;
+	WriteNode(n, leaf);
+    } else {
+	success = SplitLeaf(leaf, n, record, offset, path, depth);
+    }
+    if (success) {
+	header.numEntries++;
+	WriteHeader();
+    }
+    delete leaf;
+    return success;
+}
+
+//----------------------------------------------------------------------
+// DirectoryBTree::SplitLeaf
+// 	Insert "record" at "offset" in the full leaf "n", by dividing the
+//	records between it and a new leaf that follows it in the chain.
+//	The split is made as even as possible (in bytes), but never
+//	between two records with the same hash.
+//
+//	"path", "depth" -- the path to "n", from FindLeaf
+//----------------------------------------------------------------------
+
+bool
+DirectoryBTree::SplitLeaf(BTreeNode *leaf, int n, char *record, int offset,
+			int *path, int depth)
+{
+    int size = RecordSize(((DirectoryRecord *) record)->nameLen);
+    int total = leaf->used + size;
+    int count = leaf->count + 1;
+    char *buf = new char[total];
+    int *starts = new int[count + 1];
+    int best = -1, split = 0;
+    int i, pos;
+
+    bcopy(leaf->records, buf, offset);
+    bcopy(record, &buf[offset], size);
+    bcopy(&leaf->records[offset], &buf[offset + size], leaf->used - offset);
+
+    for (i = 0, pos = 0; i < count; i++) {
+	starts[i] = pos;
+	pos += RecordSize(((DirectoryRecord *) &buf[pos])->nameLen);
+    }
+    starts[count] = total;
+
+    for (i = 1; i < count; i++) {
+	unsigned before = ((DirectoryRecord *) &buf[starts[i - 1]])->hash;
+	unsigned after = ((DirectoryRecord *) &buf[starts[i]])->hash;
+	int left = starts[i], right = total - starts[i];
+
+	if (before == after || left > LeafBytes || right > LeafBytes)
+	    continue;
+	if (best == -1 || abs(left - right) < best) {
+	    best = abs(left - right);
+	    split = i;
+	}
+    }
+    if (best == -1) {
+	delete [] starts;
+	delete [] buf;
+	return FALSE;
+    }
+
+    BTreeNode *right = new BTreeNode;
+    int r = header.numNodes++;
+    unsigned key = ((DirectoryRecord *) &buf[starts[split]])->hash;
+
+    DEBUG(dbgFile, "Splitting directory leaf " << n << " into " << r);
+    bzero((char *) right, NodeSize);
+    right->isLeaf = TRUE;
+    right->count = count - split;
+    right->used = total - starts[split];
+    right->next = leaf->next;
+    bcopy(&buf[starts[split]], right->records, right->used);
+
+    leaf->count = split;
+    leaf->used = starts[split];
+    leaf->next = r;
+    bcopy(buf, leaf->records, leaf->used);
+
+    WriteNode(r, right);		// before anything points to it
+    WriteNode(n, leaf);
+    InsertInParent(path, depth - 2, key, r);
+
+    delete right;
+    delete [] starts;
+    delete [] buf;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// DirectoryBTree::InsertInParent
+// 	Add separator "key", with the new node "child" to its right, to
+//	the inner node path[level], splitting that in turn if it is full.
+//	A level of -1 means the root itself was split, so a new root is
+//	made above it.
+//----------------------------------------------------------------------
+
+void
+DirectoryBTree::InsertInParent(int *path, int level, unsigned key, int child)
+{
+    BTreeNode *node = new BTreeNode;
+    int i, pos;
+
+    if (level < 0) {
+	int n = header.numNodes++;
+
+	bzero((char *) node, NodeSize);
+	node->isLeaf = FALSE;
+	node->count = 1;
+	node->next = -1;
+	node->inner.key[0] = key;
+	node->inner.child[0] = header.root;
+	node->inner.child[1] = child;
+	WriteNode(n, node);
+	header.root = n;
+	WriteHeader();
+	delete node;
+	return;
+    }
+
+    ReadNode(path[level], node);
+    for (pos = 0; pos < node->count && node->inner.key[pos] < key; pos++)
+	;
+
+    if (node->count < MaxKeys) {
+	for (i = node->count; i > pos; i--) {
+	    node->inner.key[i] = node->inner.key[i - 1];
+	    node->inner.child[i + 1] = node->inner.child[i];
+	}
+	node->inner.key[pos] = key;
+	node->inner.child[pos + 1] = child;
+	node->count++;
+	WriteNode(path[level], node);
+	delete node;
+	return;
+    }
+
+    // full: gather MaxKeys + 1 keys, keep the lower half here, move
+    // the upper half to a new node, and push the middle key up
+    unsigned keys[MaxKeys + 1];
+    int children[MaxKeys + 2];
+    int mid = (MaxKeys + 1) / 2;
+    BTreeNode *right = new BTreeNode;
+    int r = header.numNodes++;
+
+    for (i = 0; i < MaxKeys + 1; i++) {
+	if (i < pos)
+	    keys[i] = node->inner.key[i];
+	else if (i == pos)
+	    keys[i] = key;
+	else
+	    keys[i] = node->inner.key[i - 1];
+    }
+    for (i = 0; i < MaxKeys + 2; i++) {
+	if (i <= pos)
+	    children[i] = node->inner.child[i];
+	else if (i == pos + 1)
+	    children[i] = child;
+	else
+	    children[i] = node->inner.child[i - 1];
+    }
+
+    bzero((char *) right, NodeSize);
+    right->isLeaf = FALSE;
+    right->next = -1;
+    right->count = MaxKeys - mid;
+    for (i = 0; i < right->count; i++)
+	right->inner.key[i] = keys[mid + 1 + i];
+    for (i = 0; i <= right->count; i++)
+	right->inner.child[i] = children[mid + 1 + i];
+
+    node->count = mid;
+    for (i = 0; i < mid; i++)
+	node->inner.key[i] = keys[i];
+    for (i = 0; i <= mid; i++)
+	node->inner.child[i] = children[i];
+
+    WriteNode(r, right);
+    WriteNode(path[level], node);
+    InsertInParent(path, level - 1, keys[mid], r);
+    delete right;
+    delete node;
+}
+
+//----------------------------------------------------------------------
+// DirectoryBTree::Remove
+// 	Remove "name" from its leaf.  Return FALSE if it is not there.
+//	Leaves are never merged, so this writes just the one leaf (and
+//	the header).
+//
+//	"hash" -- HashName(name)
+//----------------------------------------------------------------------
+
+bool
+DirectoryBTree::Remove(char *name, unsigned hash)
+{
+    BTreeNode *leaf = new BTreeNode;
+    int path[MaxDepth];
+    int n, depth, offset, size;
+
+    n = FindLeaf(hash, leaf, path, &depth);
+    offset = FindRecord(leaf, name, hash);
+    if (offset == -1) {
+	delete leaf;
+	return FALSE;
+    }
+    size = RecordSize(((DirectoryRecord *) &leaf->records[offset])->nameLen);
+    memmove(&leaf->records[offset], &leaf->records[offset + size],
+			leaf->used - offset - size);
+    leaf->count--;
+    leaf->used -= size;
+    WriteNode(n, leaf);
+
+    header.numEntries--;
+    WriteHeader();
+    delete leaf;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// DirectoryBTree::Clear
+// 	Remove every name, by formatting the directory afresh.  The file
+//	keeps its length; the old nodes are simply no longer reachable.
+//----------------------------------------------------------------------
+
+void
+DirectoryBTree::Clear()
+{
+    Format(file);
+    (void) file->ReadAt((char *)&header, sizeof(header), 0);
+    delete scanNode;
+    scanNode = NULL;
+}
+
+//----------------------------------------------------------------------
+// DirectoryBTree::StartScan
+// 	Get ready to stream the entries, starting from the leftmost leaf.
+//----------------------------------------------------------------------
+
+void
+DirectoryBTree::StartScan()
+{
+    int n = header.root;
+
+    if (scanNode == NULL)
+	scanNode = new BTreeNode;
+    for (;;) {
+	ReadNode(n, scanNode);
+	if (scanNode->isLeaf)
+	    break;
+	n = scanNode->inner.child[0];
+    }
+    scanOffset = 0;
+}
+
+//----------------------------------------------------------------------
+// DirectoryBTree::NextEntry
+// 	Return the next entry of the scan, following the leaf chain, one
+//	leaf read at a time.  Return FALSE when there are no more.
+//
+//	"name" -- gets the name; must have room for FileNameMaxLen + 1
+//	"sector", "type" -- get the header sector and DIR or FILE
+//----------------------------------------------------------------------
+
+bool
+DirectoryBTree::NextEntry(char *name, int *sector, int *type)
+{
+    while (scanNode != NULL) {
+	if (scanOffset < scanNode->used) {
+	    DirectoryRecord *rec =
+		(DirectoryRecord *) &scanNode->records[scanOffset];
+
+	    bcopy(&scanNode->records[scanOffset + sizeof(DirectoryRecord)],
+			name, rec->nameLen);
+	    name[rec->nameLen] = '\0';
+	    *sector = rec->sector;
+	    *type = rec->type;
+	    scanOffset += RecordSize(rec->nameLen);
+	    return TRUE;
+	}
+	if (scanNode->next == -1) {
+	    delete scanNode;
+	    scanNode = NULL;
+	    break;
+	}
+	ReadNode(scanNode->next, scanNode);
+	scanOffset = 0;
+    }
+    return FALSE;
+}
+
+#endif //FILESYS_STUB
@@ -0,0 +1,117 @@
+// dirbtree.h
+//	Data structures for an indexed directory: a B-tree, keyed by the
+//	hash of the file name, stored in the directory's own file.
+//
+//	A directory created this way is never read into memory as a
+//	whole.  Looking up, adding or removing a name reads one node per
+//	level of the tree, and writes back only the nodes it changes.
+//
+//	We assume mutual exclusion is provided by the caller.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef DIRBTREE_H
+#define DIRBTREE_H
+
+#include "copyright.h"
+#include "disk.h"
+#include "openfile.h"
+
+#define BTreeMagic	((int) 0xb7ee0d1e)	// first word of an indexed
+						// directory; never a count
+#define NodeSize	(8 * SectorSize)	// bytes in a node
+#define LeafBytes	(NodeSize - 4 * (int) sizeof(int))
+						// record space in a leaf
+#define MaxKeys		((LeafBytes - (int) sizeof(int)) / (2 * (int) sizeof(int)))
+						// keys in an inner node
+#define MaxDepth	8			// far more than NumSectors allows
+
+// The first sector of the directory file.  Node "n" is stored at
+// offset SectorSize + n * NodeSize, so every node starts on a sector.
+
+class BTreeHeader {
+  public:
+    int magic;				// BTreeMagic
+    int root;				// node number of the root
+    int numNodes;			// nodes in the file
+    int numEntries;			// names in the directory
+};
+
+// One node of the tree, as stored on disk.  A leaf holds directory
+// records (see DirectoryRecord) packed in hash order; an inner node
+// holds "count" keys and count + 1 children, where child[i] holds the
+// hashes from key[i - 1] up to, but not including, key[i].  All the
+// names with the same hash are always in the same leaf.
+//
+// Leaves are chained in hash order, so the whole directory can be
+// listed by reading each leaf once.  A remove never merges nodes;
+// an emptied leaf just stays in the chain.
+
+class BTreeNode {
+  public:
+    int isLeaf;				// TRUE for a leaf
+    int count;				// records in a leaf, keys otherwise
+    int next;				// next leaf, -1 if last (leaves only)
+    int used;				// bytes of records (leaves only)
+    union {
+	char records[LeafBytes];	// a leaf's packed records
+	struct {
+	    unsigned key[MaxKeys];
+	    int child[MaxKeys + 1];
+	} inner;			// an inner node's keys and children
+    };
+};
+
+// The following class operates on one indexed directory.  The caller
+// hashes the names (see Directory), so both directory formats store
+// the same hash.
+
+class DirectoryBTree {
+  public:
+    DirectoryBTree(int sector);		// Open the indexed directory whose
+					// header is at "sector"
+    ~DirectoryBTree();
+
+    static void Format(OpenFile *file);	// Make "file" an empty indexed
+					// directory
+
+    int Find(char *name, unsigned hash, int *type);
+    					// Header sector of "name", and its
+					// type; -1 if not there
+    bool Insert(char *name, unsigned hash, int sector, int type);
+    					// Add "name"; FALSE if already there
+					// or the leaf cannot be split
+    bool Remove(char *name, unsigned hash);
+    					// Remove "name"; FALSE if not there
+    void Clear();			// Remove every name
+
+    void StartScan();			// Stream the entries in hash order:
+    bool NextEntry(char *name, int *sector, int *type);
+    					// FALSE once there are no more;
+					// "name" holds FileNameMaxLen + 1
+
+  private:
+    OpenFile *file;			// the directory file
+    BTreeHeader header;			// copy of its first sector
+
+    BTreeNode *scanNode;		// leaf being streamed, NULL if none
+    int scanOffset;			// next record in it
+
+    void ReadNode(int n, BTreeNode *node);
+    void WriteNode(int n, BTreeNode *node);
+    void WriteHeader();
+    int FindLeaf(unsigned hash, BTreeNode *node, int *path, int *depth);
+    					// Read the leaf for "hash" into
+					// "node", noting the path to it
+    int FindRecord(BTreeNode *leaf, char *name, unsigned hash);
+    					// Offset of "name" in "leaf", or -1
+    bool SplitLeaf(BTreeNode *leaf, int n, char *record, int offset,
+		int *path, int depth);	// Insert "record" at "offset" in
+					// the full leaf "n", splitting it
+    void InsertInParent(int *path, int level, unsigned key, int child);
+    					// Add a separator for a new node
+};
+
+#endif // DIRBTREE_H
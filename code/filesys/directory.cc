@@ -1,19 +1,27 @@
 // directory.cc 
 //	Routines to manage a directory of file names.
 //
-//	The directory is a table of fixed length entries; each
-//	entry represents a single file, and contains the file name,
-//	and the location of the file header on disk.  The fixed size
-//	of each directory entry means that we have the restriction
-//	of a fixed maximum size for file names.
+//	The directory is a table of entries; each entry represents a
+//	single file, and contains the file name, and the location of
+//	the file header on disk.
 //
 //	The constructor initializes an empty directory of a certain size;
 //	we use ReadFrom/WriteBack to fetch the contents of the directory
 //	from disk, and to write back any modifications back to disk.
 //
-//	Also, this implementation has the restriction that the size
-//	of the directory cannot expand.  In other words, once all the
-//	entries in the directory are used, no more files can be created.
+//	MP4 MODIFIED
+//	Names are looked up through an in-core hash index that is built
+//	by FetchFrom and kept up to date by Add and Remove.  Subdirectories
+//	visited by a recursive Find are kept in core for the lifetime of
+//	this Directory object, so each is read from disk only once.
+//
+//	On disk the entries in use are packed as variable length records
+//	(see DirectoryRecord), so names can be long and an almost empty
+//	directory takes almost no space.  The in-core table doubles
+//	whenever it fills up; the directory file grows with it.
+//
+//	An indexed directory is never loaded: each operation is passed
+//	on to its DirectoryBTree, which reads only the nodes it needs.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
@@ -21,10 +29,14 @@
 
 #include "copyright.h"
 #include "utility.h"
+#include "debug.h"
 #include "filehdr.h"
 #include "directory.h"
-
-#define NumDirEntries	64	//MP4 MODIFIED
+#include "dirbtree.h"
+#include "iotrace.h"
+#include "main.h"
+#include "slab.h"
+#include "geometry.h"
 
 //----------------------------------------------------------------------
 // Directory::Directory
@@ -38,7 +50,7 @@
 
 Directory::Directory(int size)
 {
-	table = new DirectoryEntry[size];
+	table = (DirectoryEntry *) KernelAlloc(sizeof(DirectoryEntry) * size, MemFilesys);
 	
 	// MP4 mod tag
 	memset(table, 0, sizeof(DirectoryEntry) * size);  // dummy operation to keep valgrind happy
@@ -46,6 +58,104 @@ Directory::Directory(int size)
 	tableSize = size;
 	for (int i = 0; i < tableSize; i++)
 	table[i].inUse = FALSE;
+
+	hashHead = (int *) KernelAlloc(sizeof(int) * tableSize, MemFilesys);
+	hashNext = (int *) KernelAlloc(sizeof(int) * tableSize, MemFilesys);
+	children = (Directory **) KernelAlloc(sizeof(Directory *) * tableSize, MemFilesys);
+	for (int i = 0; i < tableSize; i++)
+		children[i] = NULL;
+	btree = NULL;
+	scanIndex = 0;
+	BuildIndex();
+}
+
+//----------------------------------------------------------------------
+// Directory::Grow
+//	MP4 MODIFIED
+// 	Enlarge the in-core table to "newSize" entries, keeping the
+//	entries (and the subdirectories read in) at the same indices.
+//----------------------------------------------------------------------
+
+void
+Directory::Grow(int newSize)
+{
+	DirectoryEntry *newTable =
+		(DirectoryEntry *) KernelAlloc(sizeof(DirectoryEntry) * newSize, MemFilesys);
+	Directory **newChildren =
+		(Directory **) KernelAlloc(sizeof(Directory *) * newSize, MemFilesys);
+
+	ASSERT(newSize > tableSize);
+	memset(newTable, 0, sizeof(DirectoryEntry) * newSize);
+	for (int i = 0; i < newSize; i++) {
+		if (i < tableSize) {
+			newTable[i] = table[i];
+			newChildren[i] = children[i];
+		} else {
+			newTable[i].inUse = FALSE;
+			newChildren[i] = NULL;
+		}
+	}
+	FreeTables();
+	table = newTable;
+	children = newChildren;
+	tableSize = newSize;
+	hashHead = (int *) KernelAlloc(sizeof(int) * tableSize, MemFilesys);
+	hashNext = (int *) KernelAlloc(sizeof(int) * tableSize, MemFilesys);
+	BuildIndex();
+}
+
+//----------------------------------------------------------------------
+// Directory::FreeEntry
+//	MP4 MODIFIED
+// 	Mark entry "i" unused, and free its name.  The caller takes care
+//	of the hash index.
+//----------------------------------------------------------------------
+
+void
+Directory::FreeEntry(int i)
+{
+	DropChild(i);
+	table[i].inUse = FALSE;
+	if (table[i].name != NULL)
+		KernelFree(table[i].name, strlen(table[i].name) + 1, MemFilesys);
+	table[i].name = NULL;
+}
+
+//----------------------------------------------------------------------
+// Directory::FreeTables
+//	MP4 MODIFIED
+// 	Give back the in-core table, and the arrays alongside it.
+//----------------------------------------------------------------------
+
+void
+Directory::FreeTables()
+{
+	KernelFree(table, sizeof(DirectoryEntry) * tableSize, MemFilesys);
+	KernelFree(children, sizeof(Directory *) * tableSize, MemFilesys);
+	KernelFree(hashHead, sizeof(int) * tableSize, MemFilesys);
+	KernelFree(hashNext, sizeof(int) * tableSize, MemFilesys);
+}
+
+//----------------------------------------------------------------------
+// Directory::operator new, Directory::operator delete
+//	MP4 MODIFIED
+// 	Directories are read in and thrown away on every file system
+//	operation, so they come from a cache of their own (see slab.h).
+//----------------------------------------------------------------------
+
+static SlabCache directoryCache(sizeof(Directory), MemFilesys);
+
+void *
+Directory::operator new(size_t size)
+{
+	ASSERT(size == sizeof(Directory));
+	return directoryCache.Alloc();
+}
+
+void
+Directory::operator delete(void *p)
+{
+	directoryCache.Free(p);
 }
 
 //----------------------------------------------------------------------
@@ -55,12 +165,114 @@ Directory::Directory(int size)
 
 Directory::~Directory()
 { 
-	delete [] table;
+	for (int i = 0; i < tableSize; i++)
+		FreeEntry(i);
+	delete btree;
+	FreeTables();
 } 
 
+//----------------------------------------------------------------------
+// HashName
+// 	Hash a file name; the result is stored with each entry.
+//----------------------------------------------------------------------
+
+static unsigned
+HashName(char *name)
+{
+	unsigned h = 0;
+
+	for (int i = 0; name[i] != '\0'; i++)
+		h = h * 31 + (unsigned char) name[i];
+	return h;
+}
+
+//----------------------------------------------------------------------
+// Directory::BuildIndex
+// 	Rebuild the in-core hash index from the entries in use.
+//----------------------------------------------------------------------
+
+void
+Directory::BuildIndex()
+{
+	for (int i = 0; i < tableSize; i++) {
+		hashHead[i] = -1;
+		hashNext[i] = -1;
+	}
+	for (int i = 0; i < tableSize; i++) {
+		if (table[i].inUse)
+			IndexInsert(i);
+	}
+}
+
+//----------------------------------------------------------------------
+// Directory::IndexInsert, Directory::IndexRemove
+// 	Add entry "i" to, or unlink it from, its hash chain.
+//----------------------------------------------------------------------
+
+void
+Directory::IndexInsert(int i)
+{
+	int bucket = table[i].hash % tableSize;
+
+	hashNext[i] = hashHead[bucket];
+	hashHead[bucket] = i;
+}
+
+void
+Directory::IndexRemove(int i)
+{
+	int *link = &hashHead[table[i].hash % tableSize];
+
+	while (*link != -1) {
+		if (*link == i) {
+			*link = hashNext[i];
+			hashNext[i] = -1;
+			return;
+		}
+		link = &hashNext[*link];
+	}
+}
+
+//----------------------------------------------------------------------
+// Directory::GetChild
+// 	Return the in-core copy of the subdirectory in entry "i",
+//	reading it from disk the first time it is asked for.
+//----------------------------------------------------------------------
+
+Directory *
+Directory::GetChild(int i)
+{
+	ASSERT(table[i].inUse && table[i].type == DIR);
+	if (children[i] == NULL) {
+		OpenFile *childDirectoryFile = new OpenFile(table[i].sector);
+
+		children[i] = new Directory(NumDirEntries);
+		children[i]->FetchFrom(childDirectoryFile);
+		delete childDirectoryFile;
+	}
+	return children[i];
+}
+
+//----------------------------------------------------------------------
+// Directory::DropChild
+// 	Forget the in-core copy of subdirectory "i", if there is one.
+//----------------------------------------------------------------------
+
+void
+Directory::DropChild(int i)
+{
+	if (children[i] != NULL) {
+		delete children[i];
+		children[i] = NULL;
+	}
+}
+
 //----------------------------------------------------------------------
 // Directory::FetchFrom
-// 	Read the contents of the directory from disk.
+//	MP4 MODIFIED
+// 	Read the contents of the directory from disk, unpacking the
+//	records into the table (which grows if need be).  For an indexed
+//	directory, just open its B-tree.
 //
 //	"file" -- file containing the directory contents
 //----------------------------------------------------------------------
@@ -68,12 +280,60 @@ Directory::~Directory()
 void
 Directory::FetchFrom(OpenFile *file)
 {
-	(void) file->ReadAt((char *)table, tableSize * sizeof(DirectoryEntry), 0);
+	int length = file->Length();
+	char *buf;
+	int bufSize, count, offset;
+
+	for (int i = 0; i < tableSize; i++)
+		FreeEntry(i);
+	delete btree;
+	btree = NULL;
+
+#ifndef FILESYS_STUB
+	if (kernel->ioTrace != NULL)
+		kernel->ioTrace->TagFile(file->HeaderSector(), TraceDirectory);
+	if (file->ReadAt((char *)&count, sizeof(int), 0) == sizeof(int) &&
+			count == BTreeMagic) {
+		btree = new DirectoryBTree(file->HeaderSector());
+		BuildIndex();
+		return;
+	}
+#endif
+
+	bufSize = max(length, (int) EmptyDirectorySize);
+	buf = (char *) KernelAlloc(bufSize, MemFilesys);
+	if (file->ReadAt(buf, length, 0) < (int) EmptyDirectorySize)
+		*(int *) buf = 0;
+	count = *(int *) buf;
+
+	if (count > tableSize)
+		Grow(count);
+
+	offset = EmptyDirectorySize;
+	for (int i = 0; i < count; i++) {
+		DirectoryRecord *rec = (DirectoryRecord *) &buf[offset];
+
+		ASSERT(offset + (int) RecordSize(rec->nameLen) <= length);
+		table[i].inUse = TRUE;
+		table[i].sector = rec->sector;
+		table[i].type = rec->type;
+		table[i].hash = rec->hash;
+		table[i].name = (char *) KernelAlloc(rec->nameLen + 1, MemFilesys);
+		bcopy(&buf[offset + sizeof(DirectoryRecord)], table[i].name, 
+				rec->nameLen);
+		table[i].name[rec->nameLen] = '\0';
+		offset += RecordSize(rec->nameLen);
+	}
+	KernelFree(buf, bufSize, MemFilesys);
+	BuildIndex();
 }
 
 //----------------------------------------------------------------------
 // Directory::WriteBack
-// 	Write any modifications to the directory back to disk
+//	MP4 MODIFIED
+// 	Write any modifications to the directory back to disk, packing
+//	the entries in use.  Writing past the end grows the file.
+//	An indexed directory is already up to date.
 //
 //	"file" -- file to contain the new directory contents
 //----------------------------------------------------------------------
@@ -81,13 +341,70 @@ Directory::FetchFrom(OpenFile *file)
 void
 Directory::WriteBack(OpenFile *file)
 {
-	(void) file->WriteAt((char *)table, tableSize * sizeof(DirectoryEntry), 0);
+	int length = EmptyDirectorySize;
+	int count = 0;
+	int offset;
+	char *buf;
+
+	if (btree != NULL)
+		return;
+#ifndef FILESYS_STUB
+	if (kernel->ioTrace != NULL)
+		kernel->ioTrace->TagFile(file->HeaderSector(), TraceDirectory);
+#endif
+
+	for (int i = 0; i < tableSize; i++) {
+		if (table[i].inUse)
+			length += RecordSize(strlen(table[i].name));
+	}
+	buf = (char *) KernelAlloc(length, MemFilesys);
+	bzero(buf, length);
+
+	offset = EmptyDirectorySize;
+	for (int i = 0; i < tableSize; i++) {
+		if (table[i].inUse) {
+			DirectoryRecord *rec = (DirectoryRecord *) &buf[offset];
+			int len = strlen(table[i].name);
+
+			rec->sector = table[i].sector;
+			rec->hash = table[i].hash;
+			rec->type = table[i].type;
+			rec->nameLen = len;
+			bcopy(table[i].name, &buf[offset + sizeof(DirectoryRecord)], len);
+			offset += RecordSize(len);
+			count++;
+		}
+	}
+	*(int *) buf = count;
+
+	(void) file->WriteAt(buf, length, 0);
+	KernelFree(buf, length, MemFilesys);
+}
+
+//----------------------------------------------------------------------
+// Directory::FormatIndexed
+//	MP4 MODIFIED
+// 	Write an empty indexed directory to the new directory file
+//	"file"; used in place of WriteBack of an empty Directory.
+//----------------------------------------------------------------------
+
+void
+Directory::FormatIndexed(OpenFile *file)
+{
+#ifndef FILESYS_STUB
+	if (kernel->ioTrace != NULL)
+		kernel->ioTrace->TagFile(file->HeaderSector(), TraceDirectory);
+#endif
+	DirectoryBTree::Format(file);
 }
 
 //----------------------------------------------------------------------
 // Directory::FindIndex
+//	MP4 MODIFIED
 // 	Look up file name in directory, and return its location in the table of
 //	directory entries.  Return -1 if the name isn't in the directory.
+//	Only the entries in the name's hash bucket are compared, and
+//	only those with the same hash have their names compared.
 //
 //	"name" -- the file name to look up
 //----------------------------------------------------------------------
@@ -95,10 +412,15 @@ Directory::WriteBack(OpenFile *file)
 int
 Directory::FindIndex(char *name)
 {
-	for (int i = 0; i < tableSize; i++){
-		if (table[i].inUse && !strncmp(table[i].name, name, FileNameMaxLen)){
+	unsigned hash = HashName(name);
+	int i = hashHead[hash % tableSize];
+
+	while (i != -1){
+		if (table[i].inUse && table[i].hash == hash && 
+				!strcmp(table[i].name, name)){
 			return i;
 		}
+		i = hashNext[i];
 	}
 	return -1;		// name not in directory
 }
@@ -116,6 +438,30 @@ Directory::FindIndex(char *name)
 int
 Directory::Find(char *name, bool recursively)
 {
+	if (btree != NULL) {
+		int type;
+		int result = btree->Find(name, HashName(name), &type);
+
+		if (result == -1 && recursively) {
+			char entryName[FileNameMaxLen + 1];
+			int sector;
+
+			btree->StartScan();
+			while (result == -1 && btree->NextEntry(entryName, &sector, &type)) {
+				if (type == DIR) {
+					Directory *child = new Directory(NumDirEntries);
+					OpenFile *childFile = new OpenFile(sector);
+
+					child->FetchFrom(childFile);
+					result = child->Find(name, true);
+					delete child;
+					delete childFile;
+				}
+			}
+		}
+		return result;
+	}
+
 	int i = FindIndex(name);
 
 	if (i == -1){
@@ -123,14 +469,7 @@ Directory::Find(char *name, bool recursively)
 			int result = -1;
 			for(int j=0; j<tableSize; j++){
 				if(table[j].inUse && (table[j].type==DIR)){
-					Directory *childDirectory = new Directory(NumDirEntries);
-					OpenFile *childDirectoryFile = new OpenFile(table[j].sector);
-					childDirectory->FetchFrom(childDirectoryFile);
-
-					result = childDirectory->Find(name, true);
-
-					delete childDirectory;
-					delete childDirectoryFile;
+					result = GetChild(j)->Find(name, true);
 				}
 				if(result != -1){
 					return result;
@@ -144,13 +483,39 @@ Directory::Find(char *name, bool recursively)
 	}
 }
 
+//----------------------------------------------------------------------
+// Directory::FindDirectory
+//	MP4 MODIFIED
+// 	Look up "name" in this directory only, and return the sector of
+//	its header if it is a subdirectory.  Return -1 if the name isn't
+//	in the directory, or names a plain file.
+//
+//	"name" -- the directory name to look up
+//----------------------------------------------------------------------
+
+int
+Directory::FindDirectory(char *name)
+{
+	if (btree != NULL) {
+		int type;
+		int sector = btree->Find(name, HashName(name), &type);
+
+		return (sector != -1 && type == DIR) ? sector : -1;
+	}
+
+	int i = FindIndex(name);
+
+	if (i == -1 || table[i].type != DIR)
+		return -1;
+	return table[i].sector;
+}
+
 //----------------------------------------------------------------------
 // Directory::Add
 // 	MP4 MODIFIED
 // 	Add a file into the directory.  Return TRUE if successful;
-//	return FALSE if the file name is already in the directory, or if
-//	the directory is completely full, and has no more space for
-//	additional file names.
+//	return FALSE if the file name is already in the directory, or
+//	is too long.  A full table is doubled.
 //
 //	"name" -- the name of the file being added
 //	"newSector" -- the disk sector containing the added file's header
@@ -159,20 +524,34 @@ Directory::Find(char *name, bool recursively)
 bool
 Directory::Add(char *name, int newSector, int fileType)
 { 
+	int i;
+
+	if (strlen(name) > FileNameMaxLen){
+		return FALSE;
+	}
+	if (btree != NULL){
+		return btree->Insert(name, HashName(name), newSector, fileType);
+	}
 	if (FindIndex(name) != -1){
 		return FALSE;
 	}
 
-	for (int i = 0; i < tableSize; i++){
-		if (!table[i].inUse) {
-			table[i].inUse = TRUE;
-			strncpy(table[i].name, name, FileNameMaxLen); 
-			table[i].sector = newSector;
-			table[i].type = fileType;
-			return TRUE;
-		}
+	for (i = 0; i < tableSize; i++){
+		if (!table[i].inUse)
+			break;
 	}
-	return FALSE;	// no space.  Fix when we have extensible files.
+	if (i == tableSize)
+		Grow(tableSize * 2);	// i is now the first new entry
+
+	table[i].inUse = TRUE;
+	table[i].name = (char *) KernelAlloc(strlen(name) + 1, MemFilesys);
+	strcpy(table[i].name, name); 
+	table[i].hash = HashName(name);
+	table[i].sector = newSector;
+	table[i].type = fileType;
+	DropChild(i);
+	IndexInsert(i);
+	return TRUE;
 }
 
 //----------------------------------------------------------------------
@@ -186,77 +565,56 @@ Directory::Add(char *name, int newSector, int fileType)
 bool
 Directory::Remove(char *name)
 { 
+	if (btree != NULL)
+		return btree->Remove(name, HashName(name));
+
 	int i = FindIndex(name);
 
 	if (i == -1)
 	return FALSE; 		// name not in directory
-	table[i].inUse = FALSE;
+	IndexRemove(i);
+	FreeEntry(i);
 	return TRUE;	
 }
 
 //----------------------------------------------------------------------
-// Directory::RemoveAll
-//	MP4 MODIFIED
-// 	Remove the inner files of a given directory. 
+// Directory::StartScan
+//  MP4 MODIFIED
+// 	Start streaming the entries of the directory, in either format,
+//	for callers that must see every entry (like the checker in
+//	fsck.cc) without caring how the directory is stored.
 //----------------------------------------------------------------------
 
-bool
-Directory::RemoveAll(PersistentBitmap* freeMap, OpenFile *op){
-	for(int i=0; i<tableSize; i++){
-		if(table[i].inUse){
-			// If the file is a directory, remove the files under.
-			if(table[i].type == DIR){
-				Directory *directory = new Directory(NumDirEntries);
-				OpenFile *directoryFile = new OpenFile(table[i].sector);
-				directory->FetchFrom(directoryFile);
-				directory->RemoveAll(freeMap, directoryFile);
-				delete directory;
-				delete directoryFile;
-			}
-			FileHeader *hdr = new FileHeader;
-			hdr->FetchFrom(table[i].sector);
-			table[i].inUse = FALSE;
-			hdr->Deallocate(freeMap);
-			freeMap->Clear(table[i].sector);
-			delete hdr;
-		}
-	}
-	this->WriteBack(op);
+void
+Directory::StartScan()
+{
+	if (btree != NULL)
+		btree->StartScan();
+	scanIndex = 0;
 }
 
 //----------------------------------------------------------------------
-// Directory::List
+// Directory::NextEntry
 //  MP4 MODIFIED
-// 	List all the file names in the directory. 
+// 	Return the next entry of the scan begun by StartScan: its name,
+//	header sector and type.  FALSE once every entry has been seen.
 //----------------------------------------------------------------------
 
-void
-Directory::List(int level, bool recursively)
+bool
+Directory::NextEntry(char *name, int *sector, int *type)
 {
-	for(int i=0; i<tableSize; i++){
-		if(table[i].inUse){
-			if(table[i].type == DIR){
-				for(int j=0; j<level; j++){
-					cout << "\t";
-				}
-				cout << "[" << i << "] " << table[i].name << " D" << endl;
-				if(recursively){
-					Directory *childDirectory = new Directory(NumDirEntries);
-					OpenFile *childDirectoryFile = new OpenFile(table[i].sector);
-					childDirectory->FetchFrom(childDirectoryFile);
-					childDirectory->List(level+1, recursively);
-					delete childDirectory;
-					delete childDirectoryFile;
-				}
-			}
-			else if(table[i].type == FILE){
-				for(int j=0; j<level; j++){
-					cout << "\t";
-				}
-				cout << "[" << i << "] " << table[i].name << " F" << endl;
-			}
+	if (btree != NULL)
+		return btree->NextEntry(name, sector, type);
+	while (scanIndex < tableSize) {
+		DirectoryEntry *entry = &table[scanIndex++];
+		if (entry->inUse) {
+			strcpy(name, entry->name);
+			*sector = entry->sector;
+			*type = entry->type;
+			return TRUE;
 		}
 	}
+	return FALSE;
 }
 
 //----------------------------------------------------------------------
@@ -271,6 +629,17 @@ Directory::Print()
 	FileHeader *hdr = new FileHeader;
 
 	printf("Directory contents:\n");
+	if (btree != NULL) {
+		char name[FileNameMaxLen + 1];
+		int sector, type;
+
+		btree->StartScan();
+		while (btree->NextEntry(name, &sector, &type)) {
+			printf("Name: %s, Sector: %d\n", name, sector);
+			hdr->FetchFrom(sector);
+			hdr->Print();
+		}
+	}
 	for (int i = 0; i < tableSize; i++)
 	if (table[i].inUse) {
 		printf("Name: %s, Sector: %d\n", table[i].name, table[i].sector);
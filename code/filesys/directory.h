@@ -8,6 +8,15 @@
 //
 //      We assume mutual exclusion is provided by the caller.
 //
+//	MP4 MODIFIED
+//	Names may be up to FileNameMaxLen characters.  On disk only the
+//	entries in use are stored, packed with their exact name lengths,
+//	and the directory grows as files are added.
+//
+//	A directory can instead be created indexed (see dirbtree.h), for
+//	directories too big to read in as a whole.  The choice is made
+//	per directory, when it is created; Directory hides the difference.
+//
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
 // of liability and disclaimer of warranty provisions.
@@ -19,8 +28,10 @@
 
 #include "openfile.h"
 
-#define FileNameMaxLen 		9	// for simplicity, we assume 
-					// file names are <= 9 characters long
+class DirectoryBTree;
+
+#define FileNameMaxLen 		255	// MP4 MODIFIED: longest file name;
+					// the length must fit in a byte
 
 #define DIR 0
 #define FILE 1
@@ -38,10 +49,30 @@ class DirectoryEntry {
     int sector;				// Location on disk to find the 
     int type;               // MP4 MODIFIED.
 					//   FileHeader for this file 
-    char name[FileNameMaxLen + 1];	// Text name for file, with +1 for 
-					// the trailing '\0'
+    unsigned hash;			// MP4 MODIFIED: HashName(name)
+    char *name;				// Text name for file, with the 
+					// trailing '\0'; NULL if not in use
+};
+
+// MP4 MODIFIED
+// The on-disk form of a directory: an int count of entries, then that
+// many records, each a DirectoryRecord followed by the name's bytes
+// (without the '\0'), padded to a multiple of sizeof(int).  The hash is
+// stored so a lookup compares hashes before names.
+
+class DirectoryRecord {
+  public:
+    int sector;				// Location of the file's header
+    unsigned hash;			// HashName of the name
+    unsigned char type;			// DIR or FILE
+    unsigned char nameLen;		// bytes of name that follow
+    short unused;			// keep the record int-aligned
 };
 
+#define RecordSize(nameLen) \
+	(sizeof(DirectoryRecord) + divRoundUp(nameLen, sizeof(int)) * sizeof(int))
+#define EmptyDirectorySize	sizeof(int)	// just the count
+
 // The following class defines a UNIX-like "directory".  Each entry in
 // the directory describes a file, and where to find it on disk.
 //
@@ -51,47 +82,88 @@ class DirectoryEntry {
 // The constructor initializes a directory structure in memory; the
 // FetchFrom/WriteBack operations shuffle the directory information
 // from/to disk. 
+//
+// MP4 MODIFIED
+// If FetchFrom finds an indexed directory, the table stays empty and
+// every operation goes straight to the B-tree on disk instead;
+// WriteBack then has nothing left to do.
 
 class Directory {
   public:
     Directory(int size); 		// Initialize an empty directory
-					// with space for "size" files
+					// with room for "size" files,
+					// to grow as needed
     ~Directory();			// De-allocate the directory
 
+    static void *operator new(size_t size);
+    static void operator delete(void *p);
+    					// MP4 MODIFIED: from a SlabCache
+
     void FetchFrom(OpenFile *file);  	// Init directory contents from disk
     void WriteBack(OpenFile *file);	// Write modifications to 
 					// directory contents back to disk
+    static void FormatIndexed(OpenFile *file);
+    					// Make "file" an empty indexed
+					// directory, instead of WriteBack
 
     int Find(char *name, bool recursively);		// Find the sector number of the 
 					// FileHeader for file: "name"
 
+    int FindDirectory(char *name);	// As Find(name, false), but only
+					// if "name" is a directory
+
     bool Add(char *name, int newSector, int fileType);  // MP4 MODIFIED. Add a file name into the directory
 
-    bool RemoveAll(PersistentBitmap* freeMap, OpenFile *op);
 
     bool Remove(char *name);		// Remove a file from the directory
 
-    void List(int level, bool recursively);			// Print the names of all the files
-					//  in the directory
     void Print();			// Verbose print of the contents
 					//  of the directory -- all the file
 					//  names and their contents.
 
+    void StartScan();			// MP4 MODIFIED: stream the entries
+    bool NextEntry(char *name, int *sector, int *type);
+    					// FALSE once there are no more;
+					// "name" holds FileNameMaxLen + 1
+
   private:
   
 	/*
 		MP4 Hint:
 		Directory is actually a "file", be careful of how it works with OpenFile and FileHdr.
 		Disk part: table
-		In-core part: tableSize
+		In-core part: tableSize, hashHead, hashNext, children
 	*/
   
     int tableSize;			// Number of directory entries
     DirectoryEntry *table;		// Table of pairs: 
 					// <file name, file header location> 
+					// (in core only; on disk the
+					// records are packed)
+
+    // in-core hash index over the names in table, chained through
+    // entry indices; -1 ends a chain
+    int *hashHead;			// first entry of each bucket
+    int *hashNext;			// next entry in the same bucket
+
+    Directory **children;		// subdirectories already read in by
+					// a recursive Find, NULL if not yet
+
+    DirectoryBTree *btree;		// MP4 MODIFIED: the index of an
+					// indexed directory, else NULL
+    int scanIndex;			// next table entry NextEntry looks at
 
     int FindIndex(char *name);		// Find the index into the directory 
 					//  table corresponding to "name"
+    void Grow(int newSize);		// Make room for "newSize" entries
+    void FreeEntry(int i);		// Mark entry "i" unused
+    void FreeTables();			// Give back table and the arrays
+    					// alongside it
+    void BuildIndex();			// Rebuild the hash index from table
+    void IndexInsert(int i);		// Hash entry "i" into the index
+    void IndexRemove(int i);		// Unlink entry "i" from the index
+    Directory *GetChild(int i);		// In-core copy of subdirectory "i"
+    void DropChild(int i);		// Forget the copy of subdirectory "i"
 };
 
 #endif // DIRECTORY_H
@@ -0,0 +1,185 @@
+// diriter.cc
+//	Routines to walk a tree of directories an entry at a time.
+//	See diriter.h.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+#ifndef FILESYS_STUB
+
+#include "copyright.h"
+#include "debug.h"
+#include "diriter.h"
+#include "synchdisk.h"
+#include "main.h"
+#include "geometry.h"			// NumDirEntries, the initial table
+					// of each frame
+
+//----------------------------------------------------------------------
+// DirIterator::DirIterator
+// 	Initialize an iterator; Start gives it a directory to walk.
+//
+//	"depthFirst" -- walk each subdirectory right after its entry
+//		(depth first), or after the rest of its level
+//	"allHeaders" -- prefetch the header of every entry of a
+//		directory when it is opened, not just of subdirectories
+//----------------------------------------------------------------------
+
+DirIterator::DirIterator(bool depthFirst, bool allHeaders)
+{
+    this->depthFirst = depthFirst;
+    this->allHeaders = allHeaders;
+    for (int i = 0; i < MaxWalkDepth; i++) {
+	frames[i].directory = NULL;
+	frames[i].file = NULL;
+    }
+    numFrames = 0;
+    queue = depthFirst ? NULL : new int[NumSectors];
+    queueDepth = depthFirst ? NULL : new int[NumSectors];
+    queueHead = queueTail = 0;
+    descend = FALSE;
+    name[0] = '\0';
+    sector = type = -1;
+    depth = index = 0;
+}
+
+//----------------------------------------------------------------------
+// DirIterator::~DirIterator
+// 	Close whatever the walk still has open, and free the frames.
+//----------------------------------------------------------------------
+
+DirIterator::~DirIterator()
+{
+    while (numFrames > 0)
+	Close();
+    for (int i = 0; i < MaxWalkDepth; i++)
+	delete frames[i].directory;
+    delete [] queue;
+    delete [] queueDepth;
+}
+
+//----------------------------------------------------------------------
+// DirIterator::Start
+// 	Abandon any walk in progress and start walking the directory
+//	whose header is at "dirSector".  Its entries have depth 0.
+//----------------------------------------------------------------------
+
+void
+DirIterator::Start(int dirSector)
+{
+    while (numFrames > 0)
+	Close();
+    queueHead = queueTail = 0;
+    descend = FALSE;
+    Open(dirSector, 0);
+}
+
+//----------------------------------------------------------------------
+// DirIterator::Next
+// 	Move to the next entry of the walk.  If the caller asked to
+//	Descend into the current one, it is pushed on the stack first
+//	(so its entries come next), or queued behind the current level.
+//	Returns FALSE once every entry has been returned.
+//----------------------------------------------------------------------
+
+bool
+DirIterator::Next()
+{
+    DirFrame *frame;
+
+    if (descend) {
+	descend = FALSE;
+	if (depthFirst) {
+	    Open(sector, depth + 1);
+	} else {
+	    queue[queueTail] = sector;
+	    queueDepth[queueTail] = depth + 1;
+	    queueTail = (queueTail + 1) % NumSectors;
+	    ASSERT(queueTail != queueHead);	// each directory once
+	}
+    }
+
+    for (;;) {
+	if (numFrames == 0) {
+	    if (depthFirst || queueHead == queueTail)
+		return FALSE;
+	    Open(queue[queueHead], queueDepth[queueHead]);
+	    queueHead = (queueHead + 1) % NumSectors;
+	    continue;
+	}
+	frame = &frames[numFrames - 1];
+	if (frame->directory->NextEntry(name, &sector, &type)) {
+	    depth = frame->depth;
+	    index = frame->index++;
+	    return TRUE;
+	}
+	Close();
+    }
+}
+
+//----------------------------------------------------------------------
+// DirIterator::Descend
+// 	Have the walk go into the current entry, a directory, when the
+//	caller moves on.  A directory deeper than the stack allows is
+//	left out.
+//----------------------------------------------------------------------
+
+void
+DirIterator::Descend()
+{
+    ASSERT(type == DIR);
+    if (depthFirst && numFrames == MaxWalkDepth) {
+	DEBUG(dbgFile, "Directory " << name << " is too deep to walk");
+	return;
+    }
+    descend = TRUE;
+}
+
+//----------------------------------------------------------------------
+// DirIterator::Open
+// 	Push a frame for the directory whose header is at "dirSector",
+//	reusing the frame's Directory, and prefetch the headers its
+//	entries will need.
+//
+//	"dirDepth" -- the depth its entries are reported at
+//----------------------------------------------------------------------
+
+void
+DirIterator::Open(int dirSector, int dirDepth)
+{
+    DirFrame *frame = &frames[numFrames++];
+    char entryName[FileNameMaxLen + 1];
+    int entrySector, entryType;
+
+    ASSERT(numFrames <= MaxWalkDepth);
+    if (frame->directory == NULL)
+	frame->directory = new Directory(NumDirEntries);
+    frame->file = new OpenFile(dirSector);
+    frame->directory->FetchFrom(frame->file);
+    frame->depth = dirDepth;
+    frame->index = 0;
+
+    frame->directory->StartScan();
+    while (frame->directory->NextEntry(entryName, &entrySector, &entryType)) {
+	if ((allHeaders || entryType == DIR) &&
+		entrySector >= 0 && entrySector < NumSectors)
+	    kernel->synchDisk->Prefetch(entrySector);
+    }
+    frame->directory->StartScan();
+}
+
+//----------------------------------------------------------------------
+// DirIterator::Close
+// 	Pop the top frame.  Its Directory stays allocated for reuse.
+//----------------------------------------------------------------------
+
+void
+DirIterator::Close()
+{
+    DirFrame *frame = &frames[--numFrames];
+
+    delete frame->file;
+    frame->file = NULL;
+}
+
+#endif //FILESYS_STUB
@@ -0,0 +1,91 @@
+// diriter.h
+//	Data structures for walking a tree of directories one entry at a
+//	time, without recursion.
+//
+//	A DirIterator keeps the directories it is inside of on a bounded
+//	stack (depth first), or the directories still to visit in a queue
+//	(breadth first).  The caller decides, entry by entry, which
+//	subdirectories are walked too.
+//
+//	The in-core Directory of each stack level is kept and reused for
+//	the next directory at that level, so a walk allocates a little
+//	per directory and nothing per entry.  When a directory is opened,
+//	the headers of its subdirectories (or of all its entries) are
+//	prefetched at once, so they are in the cache before they are
+//	needed.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef DIRITER_H
+#define DIRITER_H
+
+#include "copyright.h"
+#include "directory.h"
+#include "openfile.h"
+
+#define MaxWalkDepth	128		// a path of PathMaxLen characters has
+					// at most this many components
+
+// One directory the walk is inside of.
+
+class DirFrame {
+  public:
+    Directory *directory;		// its entries; kept for reuse
+    OpenFile *file;			// the directory file, NULL if none
+    int depth;				// depth of its entries
+    int index;				// entries returned so far
+};
+
+// The following class walks a tree of directories.  After Start,
+// each Next moves to the next entry, whose name, header sector and
+// type can then be asked for.  Nothing below an entry is walked
+// unless Descend is called before the following Next.
+//
+// Both directory formats are walked the same way (see
+// Directory::NextEntry); a directory must not change during the walk.
+
+class DirIterator {
+  public:
+    DirIterator(bool depthFirst, bool allHeaders);
+    					// An iterator walking depth or
+					// breadth first, prefetching all
+					// headers or just directories'
+    ~DirIterator();
+
+    void Start(int sector);		// Walk the directory whose header
+					// is at "sector", from scratch
+    bool Next();			// Move to the next entry; FALSE
+					// once the walk is over
+    void Descend();			// Walk the current entry too; it
+					// must be a directory
+
+    char *Name() { return name; }	// The current entry: its name,
+    int Sector() { return sector; }	// header sector,
+    int Type() { return type; }		// DIR or FILE,
+    int Depth() { return depth; }	// 0 in the starting directory,
+    int Index() { return index; }	// and position in its directory
+
+  private:
+    bool depthFirst;			// stack, rather than queue?
+    bool allHeaders;			// prefetch every entry's header?
+
+    DirFrame frames[MaxWalkDepth];	// the stack; only frames[0] is
+					// used breadth first
+    int numFrames;			// frames open
+
+    int *queue;				// breadth first: directories to
+    int *queueDepth;			// visit, and their depths; a ring
+    int queueHead, queueTail;		// of NumSectors slots
+
+    bool descend;			// Descend was called
+    char name[FileNameMaxLen + 1];	// the current entry
+    int sector, type, depth, index;
+
+    void Open(int dirSector, int dirDepth);
+    					// Push a frame for a directory
+    void Close();			// Pop the top frame
+};
+
+#endif // DIRITER_H
@@ -10,6 +10,11 @@
 //	blocks). The table size is chosen so that the file header
 //	will be just big enough to fit in one disk sector, 
 //
+//	MP4 MODIFIED
+//	The last two entries of the table are now a single and a
+//	double indirect index sector, and small files keep their data
+//	in the table itself; see filehdr.h.
+//
 //      Unlike in a real system, we do not keep track of file permissions, 
 //	ownership, last modification date, etc., in the file header. 
 //
@@ -27,7 +32,11 @@
 #include "filehdr.h"
 #include "debug.h"
 #include "synchdisk.h"
+#include "iotrace.h"
 #include "main.h"
+#include "slab.h"
+#include "compress.h"
+#include "dedup.h"
 
 //----------------------------------------------------------------------
 // MP4 mod tag
@@ -41,18 +50,343 @@ FileHeader::FileHeader()
 	numBytes = -1;
 	numSectors = -1;
 	memset(dataSectors, -1, sizeof(dataSectors));
+	sectorTable = NULL;
+	tableValid = FALSE;
+	hdrSector = -1;
+	refCount = 0;
+	numWrites = 0;
+	rwLock = NULL;
+	numDelayed = 0;
+	delayedData = NULL;
+	compressed = FALSE;
+	deduplicated = FALSE;
+	loadedChunk = -1;
+	chunkData = NULL;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::operator new, FileHeader::operator delete
+//	MP4 MODIFIED
+// 	Headers are made and deleted on every file system operation, so
+//	they come from a cache of their own (see slab.h).
+//----------------------------------------------------------------------
+
+static SlabCache headerCache(sizeof(FileHeader), MemFilesys);
+
+void *
+FileHeader::operator new(size_t size)
+{
+	ASSERT(size == sizeof(FileHeader));
+	return headerCache.Alloc();
+}
+
+void
+FileHeader::operator delete(void *p)
+{
+	headerCache.Free(p);
 }
 
 //----------------------------------------------------------------------
 // MP4 mod tag
 // FileHeader::~FileHeader
-//	Currently, there is not need to do anything in destructor function.
-//	However, if you decide to add some "in-core" data in header
-//	Always remember to deallocate their space or you will leak memory
+//	Free the in-core copy of the index sectors.
 //----------------------------------------------------------------------
 FileHeader::~FileHeader()
 {
-	// nothing to do now
+	if (sectorTable != NULL)
+		delete [] sectorTable;
+	if (rwLock != NULL)
+		delete rwLock;
+	ASSERT(numDelayed == 0);
+	if (delayedData != NULL)
+		KernelFree(delayedData, DelayedBlocks * SectorSize, MemFilesys);
+	if (chunkData != NULL)
+		KernelFree(chunkData, ChunkSize, MemFilesys);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::GetLock
+//	MP4 MODIFIED
+// 	Return the reader-writer lock of the file, made on first use:
+//	only shared headers are locked, and most never are.  Held for
+//	reading while the file (or directory) is read, and for writing
+//	while it, or the header, is changed.
+//----------------------------------------------------------------------
+
+RWLock *
+FileHeader::GetLock()
+{
+	if (rwLock == NULL)
+		rwLock = new RWLock("file header");
+	return rwLock;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Acquire
+//	MP4 MODIFIED
+// 	Return the in-core header for the file whose header is stored in
+//	"sector", shared by everyone who has that file open.  The header
+//	is read from disk only by the first Acquire.
+//----------------------------------------------------------------------
+
+HostThreadLocal OpenHashTable<int, FileHeader *> *FileHeader::openHeaders
+								= NULL;
+HostThreadLocal int FileHeader::heat[NumSectors];
+
+static int HeaderKey(FileHeader *hdr) { return hdr->GetSector(); }
+static unsigned HashSector(int sector) { return (unsigned) sector; }
+
+FileHeader *
+FileHeader::Acquire(int sector)
+{
+	FileHeader *hdr;
+
+	if (openHeaders == NULL)
+		openHeaders = new OpenHashTable<int, FileHeader *>(HeaderKey,
+								 HashSector);
+
+	if (openHeaders->Find(sector, &hdr)) {
+		DEBUG(dbgFile, "Sharing in-core header for sector " << sector);
+	} else {
+		hdr = new FileHeader;
+		hdr->FetchFrom(sector);
+		hdr->hdrSector = sector;
+		openHeaders->Insert(hdr);
+	}
+	hdr->refCount++;
+	return hdr;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Release
+//	MP4 MODIFIED
+// 	Drop one reference to a header returned by Acquire.  When the
+//	last reference goes away, the header leaves the table and is freed,
+//	once any blocks it holds back have been written.
+//----------------------------------------------------------------------
+
+void
+FileHeader::Release(FileHeader *hdr)
+{
+	ASSERT(hdr->refCount > 0);
+#ifndef FILESYS_STUB
+	if (hdr->refCount == 1 && hdr->numDelayed > 0) {
+		hdr->GetLock()->AcquireWrite();
+		kernel->fileSystem->FlushDelayed(hdr);
+		hdr->GetLock()->ReleaseWrite();
+	}
+#endif
+	if (--hdr->refCount == 0) {
+		if (hdr->hdrSector != -1)
+			openHeaders->Remove(hdr->hdrSector);
+		delete hdr;
+	}
+}
+
+//----------------------------------------------------------------------
+// FileHeader::FlushAllDelayed
+//	MP4 MODIFIED
+// 	Have every open file write the blocks it holds back; called by
+//	the disk's flush task, so they don't stay only in memory for
+//	long.  The headers are held while we wait for each one's lock,
+//	so none goes away meanwhile.
+//----------------------------------------------------------------------
+
+void
+FileHeader::FlushAllDelayed()
+{
+#ifndef FILESYS_STUB
+	FileHeader **held;
+	FileHeader *hdr;
+	int count = 0;
+
+	if (openHeaders == NULL)
+		return;
+	OpenHashIterator<int, FileHeader *> iter(openHeaders);
+	for (; !iter.IsDone(); iter.Next()) {
+		if (iter.Item()->numDelayed > 0)
+			count++;
+	}
+	if (count == 0)
+		return;
+
+	held = new FileHeader *[count];
+	count = 0;
+	OpenHashIterator<int, FileHeader *> again(openHeaders);
+	for (; !again.IsDone(); again.Next()) {
+		hdr = again.Item();
+		if (hdr->numDelayed > 0) {
+			hdr->refCount++;
+			held[count++] = hdr;
+		}
+	}
+	for (int i = 0; i < count; i++) {
+		held[i]->GetLock()->AcquireWrite();
+		kernel->fileSystem->FlushDelayed(held[i]);
+		held[i]->GetLock()->ReleaseWrite();
+		Release(held[i]);
+	}
+	delete [] held;
+#endif
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Detach
+//	MP4 MODIFIED
+// 	Take a shared header out of the table because its file is being
+//	removed, so that a new file created in the same sector gets a
+//	fresh header.  Whoever still holds it keeps a private copy.
+//----------------------------------------------------------------------
+
+void
+FileHeader::Detach(FileHeader *hdr)
+{
+	if (hdr->hdrSector != -1) {
+		openHeaders->Remove(hdr->hdrSector);
+		hdr->hdrSector = -1;
+	}
+}
+
+//----------------------------------------------------------------------
+// TraceTag
+//	MP4 MODIFIED
+// 	Tell the disk trace, if there is one, what "sector" holds.
+//----------------------------------------------------------------------
+
+static void
+TraceTag(int sector, TraceKind kind, int owner)
+{
+	if (kernel->ioTrace != NULL)
+		kernel->ioTrace->Tag(sector, kind, owner);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::TagSectors
+//	MP4 MODIFIED
+// 	Tell the disk trace, if there is one, that the header, the
+//	"numIndex" index sectors in "index", and the data blocks in
+//	sectorTable belong to the file whose header is at "owner".
+//----------------------------------------------------------------------
+
+void
+FileHeader::TagSectors(int owner, int *index, int numIndex)
+{
+	if (kernel->ioTrace == NULL || owner == -1)
+		return;
+	TraceTag(owner, TraceHeader, owner);
+	for (int i = 0; i < numIndex; i++)
+		TraceTag(index[i], TraceIndex, owner);
+	for (int i = 0; i < numSectors && sectorTable != NULL; i++)
+		TraceTag(sectorTable[i], TraceData, owner);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::LoadSectorTable
+//	MP4 MODIFIED
+// 	Gather the data sector numbers of every block in the file into
+//	the in-core sectorTable, so that ByteToSector no longer has to go
+//	to disk.  Only the index sectors the file actually uses are read.
+//----------------------------------------------------------------------
+
+void
+FileHeader::LoadSectorTable()
+{
+	int index[NumIndirect];
+	int top[NumIndirect];
+	int i, block;
+
+	if (sectorTable != NULL)
+		delete [] sectorTable;
+	sectorTable = new int[numSectors > 0 ? numSectors : 1];
+
+	for (block = 0; block < numSectors && block < NumDirectBlocks; block++)
+		sectorTable[block] = dataSectors[block];
+
+	if (block < numSectors) {
+		TraceTag(dataSectors[SingleIndirect], TraceIndex, hdrSector);
+		kernel->synchDisk->ReadSector(dataSectors[SingleIndirect], (char*)index);
+		for (i = 0; i < NumIndirect && block < numSectors; i++)
+			sectorTable[block++] = index[i];
+	}
+
+	if (block < numSectors) {
+		TraceTag(dataSectors[DoubleIndirect], TraceIndex, hdrSector);
+		kernel->synchDisk->ReadSector(dataSectors[DoubleIndirect], (char*)top);
+	}
+	for (int j = 0; block < numSectors; j++) {
+		TraceTag(top[j], TraceIndex, hdrSector);
+		kernel->synchDisk->ReadSector(top[j], (char*)index);
+		for (i = 0; i < NumIndirect && block < numSectors; i++)
+			sectorTable[block++] = index[i];
+	}
+	tableValid = TRUE;
+	TagSectors(hdrSector, NULL, 0);
+	DEBUG(dbgFile, "Loaded " << numSectors << " sector numbers into header cache");
+}
+
+//----------------------------------------------------------------------
+// FileHeader::NumIndexSectors
+//	MP4 MODIFIED
+// 	Return how many index sectors a file of "blocks" data blocks needs:
+//	none while the direct pointers suffice, then the single indirect
+//	sector, then the double indirect one and its second level.
+//----------------------------------------------------------------------
+
+int
+FileHeader::NumIndexSectors(int blocks)
+{
+	int numIndex = 0;
+
+	blocks -= NumDirectBlocks;
+	if (blocks > 0)
+		numIndex++;			// single indirect
+	blocks -= NumIndirect;
+	if (blocks > 0)
+		numIndex += 1 + divRoundUp(blocks, NumIndirect);
+	return numIndex;
+}
+//----------------------------------------------------------------------
+// AllocateRun
+//	MP4 MODIFIED
+// 	Take "count" sectors out of the free map in as few contiguous runs
+//	as possible, on the nearest track to "*hint" with room, and store
+//	their numbers in order in "sectors".  "*hint" is left just past
+//	the last run, so the next call continues from there.
+//----------------------------------------------------------------------
+
+static void
+AllocateRun(PersistentBitmap *freeMap, int count, int *hint, int *sectors)
+{
+	int done = 0;
+
+	while (done < count) {
+		int length;
+		int start = freeMap->FindRunNear(count - done, *hint, &length);
+
+		ASSERT(start != -1);	// caller checked there is room
+		for (int i = 0; i < length; i++) {
+			freeMap->Mark(start + i);
+			sectors[done++] = start + i;
+		}
+		*hint = start + length;
+	}
+}
+
+//----------------------------------------------------------------------
+// WriteIndex
+//	MP4 MODIFIED
+// 	Write an index sector holding the "count" sector numbers in
+//	"entries"; the rest of its pointers are -1.
+//----------------------------------------------------------------------
+
+static void
+WriteIndex(int sector, int *entries, int count)
+{
+	int index[NumIndirect];
+
+	for (int i = 0; i < NumIndirect; i++)
+		index[i] = (i < count) ? entries[i] : -1;
+	kernel->synchDisk->WriteSector(sector, (char*)index);
 }
 
 //----------------------------------------------------------------------
@@ -63,36 +397,866 @@ FileHeader::~FileHeader()
 //	Return FALSE if there are not enough free blocks to accomodate
 //	the new file.
 //
+//	Blocks are taken as contiguous extents, starting right after the
+//	header sector when it is known, so that the header, then all the
+//	index sectors, then all the data sectors sit together on disk.
+//
+//	A sparse file gets its index sectors only: every block starts
+//	as a hole, which reads as zeros and is given a data block when
+//	first written (FillHoles).  So does a compressed one, whose
+//	chunks get sectors as they are written (WriteChunk), and a
+//	deduplicated one, whose blocks do (StoreBlock).
+//
 //	"freeMap" is the bit map of free disk sectors
 //	"fileSize" is the bit map of free disk sectors
+//	"hdrSector" is where the header itself lives, or -1 if unknown
+//	"sparse" is whether to leave the data blocks unallocated
 //----------------------------------------------------------------------
 
 bool
-FileHeader::Allocate(PersistentBitmap *freeMap, int fileSize)
+FileHeader::Allocate(PersistentBitmap *freeMap, int fileSize, int hdrSector,
+			bool sparse)
 { 
+	if (fileSize <= MaxInlineSize) {	// small enough to live inline
+		numBytes = fileSize;
+		numSectors = 0;
+		memset(dataSectors, 0, sizeof(dataSectors));
+		if (sectorTable != NULL)
+			delete [] sectorTable;
+		sectorTable = NULL;
+		tableValid = FALSE;
+		return TRUE;
+	}
+
 	numBytes = fileSize;
 	numSectors  = divRoundUp(fileSize, SectorSize);
-	if (freeMap->NumClear() < numSectors)
+	if (compressed) {
+		numSectors = divRoundUp(numSectors, ChunkBlocks) * ChunkBlocks;
+		sparse = TRUE;
+	}
+	if (deduplicated)
+		sparse = TRUE;
+	loadedChunk = -1;
+	int numIndex = NumIndexSectors(numSectors);
+	int numData = sparse ? 0 : numSectors;
+	int index[2 + NumIndirect];		// single, double, second level
+
+	if (numSectors > MaxFileBlocks)
+	return FALSE;		// file too big
+	if (freeMap->NumClear() < numData + numIndex)
 	return FALSE;		// not enough space
 
-	int j=0;
-	int num = numSectors;
+	int hint = (hdrSector == -1) ? 0 : hdrSector + 1;
+
+	// the index sectors as one group, then the data after them
+	AllocateRun(freeMap, numIndex, &hint, index);
+
+	if (sectorTable != NULL)
+		delete [] sectorTable;
+	sectorTable = new int[numSectors > 0 ? numSectors : 1];
+	if (sparse) {
+		for (int i = 0; i < numSectors; i++)
+			sectorTable[i] = -1;	// all holes
+	} else {
+		AllocateRun(freeMap, numSectors, &hint, sectorTable);
+	}
+
+	// the pointers we write are also the new in-core table
+	for (int i = 0; i < NumDirect; i++)
+		dataSectors[i] = -1;
+	WriteIndexSectors(0, numSectors, index);
+	tableValid = TRUE;
+	TagSectors(hdrSector, index, numIndex);
+
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Extend
+//	MP4 MODIFIED
+// 	Make the file "newSize" bytes long.  Blocks are added a chunk at a
+//	time, at least PreallocBlocks past what is needed (as far as the
+//	disk allows), so a file written a little at a time allocates and
+//	rewrites its index sectors only once per chunk.  Writes within
+//	the preallocated blocks just update the length.
+//	With "delay", the new blocks are left as holes, to be given
+//	sectors when they are written and flushed (see FlushDelayed);
+//	only the index sectors are allocated now.  A compressed file
+//	grows a whole chunk at a time, and always by holes; if it was
+//	inline, its bytes become the first chunk.  A deduplicated file
+//	grows by holes too, for StoreBlock to fill.
+//	The header is written back; the caller writes back the free map.
+//	Return FALSE, changing nothing, if the disk is too full or the
+//	header is not a shared one.
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"newSize" is the new length of the file in bytes
+//----------------------------------------------------------------------
+
+bool
+FileHeader::Extend(PersistentBitmap *freeMap, int newSize, bool delay)
+{
+	int need = divRoundUp(newSize, SectorSize);
+	int step = compressed ? ChunkBlocks : 1;
+	int blocks, numIndex, old, hint;
+	int index[2 + NumIndirect];
+	char inlineData[MaxInlineSize];
+	bool wasInline = IsInline();
+
+	if (newSize <= numBytes)
+		return TRUE;
+	need = divRoundUp(need, step) * step;
+	if (hdrSector == -1 || need > MaxFileBlocks)
+		return FALSE;
+
+	if (wasInline && newSize <= MaxInlineSize) {
+		numBytes = newSize;		// still fits in the header
+		WriteBack(hdrSector);
+		return TRUE;
+	}
+
+	if (need > numSectors) {
+		blocks = min(max(need, numSectors + PreallocBlocks), MaxFileBlocks);
+		numIndex = NumIndexSectors(blocks) - NumIndexSectors(numSectors);
+		while (blocks > need && freeMap->NumClear() < 
+					blocks - numSectors + numIndex) {
+			blocks -= step;		// little room left, preallocate less
+			numIndex = NumIndexSectors(blocks) - NumIndexSectors(numSectors);
+		}
+		if (freeMap->NumClear() < blocks - numSectors + numIndex)
+			return FALSE;		// not enough space
+
+		if (wasInline) {		// the table holds data, not pointers
+			memcpy(inlineData, dataSectors, MaxInlineSize);
+			memset(dataSectors, -1, sizeof(dataSectors));
+		}
+		if (!tableValid)
+			LoadSectorTable();
+		DEBUG(dbgFile, "Extending file from " << numSectors << " to " << blocks << " blocks");
+
+		int *table = new int[blocks];
+		old = numSectors;
+		for (int i = 0; i < old; i++)
+			table[i] = sectorTable[i];
+		delete [] sectorTable;
+		sectorTable = table;
+
+		// continue right after the last block, as Allocate would have
+		hint = (old > 0 && sectorTable[old - 1] != -1) ? 
+				sectorTable[old - 1] + 1 : hdrSector + 1;
+		AllocateRun(freeMap, numIndex, &hint, index);
+		if (((delay || deduplicated) && !wasInline) || compressed) {
+			for (int i = old; i < blocks; i++)
+				sectorTable[i] = -1;
+		} else {
+			AllocateRun(freeMap, blocks - old, &hint, &sectorTable[old]);
+		}
+		numSectors = blocks;
+		WriteIndexSectors(old, numSectors, index);
+		TagSectors(hdrSector, index, numIndex);
+
+		if (wasInline && compressed) {	// move them to the first chunk
+			char *data = LoadChunk(0, TRUE);
+
+			bzero(data, ChunkSize);
+			memcpy(data, inlineData, numBytes);
+			WriteChunk(freeMap, 0);
+		} else if (wasInline) {		// move the bytes to the first block
+			char buf[SectorSize];
+
+			memset(buf, 0, sizeof(buf));
+			memcpy(buf, inlineData, numBytes);
+			kernel->synchDisk->WriteSector(sectorTable[0], buf);
+		}
+	}
+	numBytes = newSize;
+	WriteBack(hdrSector);
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::WriteIndexSectors
+//	MP4 MODIFIED
+// 	Bring the header's pointers and the index sectors up to date
+//	with sectorTable, for blocks "from" up to "to".  Index sectors
+//	that were not needed before are taken in order from "newIndex":
+//	the single indirect, the double indirect, then the second level
+//	ones.
+//
+//	"from", "to" -- the range of blocks whose pointers changed
+//	"newIndex" holds freshly allocated sectors for new index sectors
+//----------------------------------------------------------------------
+
+void
+FileHeader::WriteIndexSectors(int from, int to, int *newIndex)
+{
+	int base = NumDirectBlocks + NumIndirect;	// first double block
+	int next = 0;
+	int top[NumIndirect];
+
+	for (int block = from; block < to && block < NumDirectBlocks; block++)
+		dataSectors[block] = sectorTable[block];
+
+	if (to > NumDirectBlocks && from < base) {
+		if (dataSectors[SingleIndirect] == -1)
+			dataSectors[SingleIndirect] = newIndex[next++];
+		WriteIndex(dataSectors[SingleIndirect], &sectorTable[NumDirectBlocks],
+				min(NumIndirect, numSectors - NumDirectBlocks));
+	}
+
+	if (to > base) {
+		bool topChanged = FALSE;
+
+		if (dataSectors[DoubleIndirect] == -1) {
+			dataSectors[DoubleIndirect] = newIndex[next++];
+			for (int i = 0; i < NumIndirect; i++)
+				top[i] = -1;
+			topChanged = TRUE;
+		} else {
+			kernel->synchDisk->ReadSector(dataSectors[DoubleIndirect], (char*)top);
+		}
+		for (int j = max(0, from - base) / NumIndirect; 
+				j <= (to - 1 - base) / NumIndirect; j++) {
+			int first = base + j * NumIndirect;
+
+			if (top[j] == -1) {
+				top[j] = newIndex[next++];
+				topChanged = TRUE;
+			}
+			WriteIndex(top[j], &sectorTable[first],
+					min(NumIndirect, numSectors - first));
+		}
+		if (topChanged)
+			WriteIndex(dataSectors[DoubleIndirect], top, NumIndirect);
+	}
+}
+
+//----------------------------------------------------------------------
+// FileHeader::FillHoles
+//	MP4 MODIFIED
+// 	Give every hole among blocks "from" to "to" a data block, because
+//	they are about to be written.  Up to PreallocBlocks holes right
+//	after "to" are filled too, so a file written sequentially does
+//	this once per chunk.  New blocks are zeroed (in the cache, where
+//	the coming write usually overwrites them) and taken as one run
+//	following the block before "from".
+//	The affected index sectors and the header are written back; the
+//	caller writes back the free map.  Return FALSE if the disk is full.
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"from", "to" -- the first and last block about to be written
+//----------------------------------------------------------------------
+
+bool
+FileHeader::FillHoles(PersistentBitmap *freeMap, int from, int to)
+{
+	int last = to;
+	int count = 0;
+	int i, hint, *fresh;
+	char zeros[SectorSize];
+
+	if (!tableValid)
+		LoadSectorTable();
+	while (last + 1 < numSectors && last - to < PreallocBlocks 
+				&& sectorTable[last + 1] == -1)
+		last++;
+	for (i = from; i <= last; i++)
+		if (sectorTable[i] == -1)
+			count++;
+	if (count == 0)
+		return TRUE;
+	if (freeMap->NumClear() < count) {
+		last = to;			// no room to fill ahead
+		for (count = 0, i = from; i <= last; i++)
+			if (sectorTable[i] == -1)
+				count++;
+		if (freeMap->NumClear() < count)
+			return FALSE;
+	}
+	DEBUG(dbgFile, "Filling " << count << " holes in blocks " << from << " to " << last);
+
+	hint = HintBefore(from);
+	fresh = new int[count];
+	AllocateRun(freeMap, count, &hint, fresh);
+
+	bzero(zeros, sizeof(zeros));
+	for (count = 0, i = from; i <= last; i++) {
+		if (sectorTable[i] == -1) {
+			sectorTable[i] = fresh[count++];
+			kernel->synchDisk->WriteSector(sectorTable[i], zeros);
+		}
+	}
+	delete [] fresh;
+
+	WriteIndexSectors(from, last + 1, NULL);	// index sectors exist
+	TagSectors(hdrSector, NULL, 0);
+	if (from < NumDirectBlocks && hdrSector != -1)
+		WriteBack(hdrSector);
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::HintBefore
+//	MP4 MODIFIED
+// 	Return where new sectors for "block" should go: just past the
+//	sector of the last block before it that has one, or past the
+//	header if none does.  The caller has loaded sectorTable.
+//----------------------------------------------------------------------
+
+int
+FileHeader::HintBefore(int block)
+{
+	for (int i = block - 1; i >= 0; i--) {
+		if (sectorTable[i] != -1)
+			return sectorTable[i] + 1;
+	}
+	return (hdrSector == -1) ? 0 : hdrSector + 1;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::ChunkSectors
+//	MP4 MODIFIED
+// 	Return how many sectors chunk "chunk" of a compressed file is
+//	stored in: the blocks of the chunk that have them, which are
+//	always its first ones.
+//----------------------------------------------------------------------
+
+int
+FileHeader::ChunkSectors(int chunk)
+{
+	int first = chunk * ChunkBlocks;
+	int count = 0;
+
+	if (!tableValid)
+		LoadSectorTable();
+	while (count < ChunkBlocks && sectorTable[first + count] != -1)
+		count++;
+	return count;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::LoadChunk
+//	MP4 MODIFIED
+// 	Return the contents of chunk "chunk" of a compressed file, in
+//	chunkData: read its sectors and decompress them, unless it is
+//	the chunk already there.  With "overwrite", the caller is about
+//	to fill in the whole chunk, so nothing is read.
+//
+//	Readers of the file share chunkData.  The sectors are read into
+//	a buffer of our own, and chunkData is only filled in once they
+//	are here, so a reader copying out of it, which doesn't wait for
+//	anything meanwhile, can't find it changing under it.
+//----------------------------------------------------------------------
+
+char *
+FileHeader::LoadChunk(int chunk, bool overwrite)
+{
+	int sectors[ChunkBlocks];
+	char packed[ChunkSize];
+	int count, length;
+
+	ASSERT(compressed && (chunk + 1) * ChunkBlocks <= numSectors);
+	if (chunkData == NULL)
+		chunkData = (char *) KernelAlloc(ChunkSize, MemFilesys);
+	if (chunk == loadedChunk || overwrite) {
+		loadedChunk = chunk;
+		return chunkData;
+	}
+
+	count = ChunkSectors(chunk);
+	for (int i = 0; i < count; i++)
+		sectors[i] = sectorTable[chunk * ChunkBlocks + i];
+	if (count > 0)
+		kernel->synchDisk->ReadSectors(sectors, count, packed);
+
+	if (count == 0) {
+		bzero(chunkData, ChunkSize);	// a hole
+	} else if (count == ChunkBlocks) {
+		bcopy(packed, chunkData, ChunkSize);	// stored as is
+	} else {
+		length = ((unsigned char) packed[0] << 8) | (unsigned char) packed[1];
+		ASSERT(length <= count * SectorSize - 2);
+		length = Decompress(&packed[2], length, chunkData, ChunkSize);
+		ASSERT(length == ChunkSize);
+	}
+	loadedChunk = chunk;
+	return chunkData;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::WriteChunk
+//	MP4 MODIFIED
+// 	Store chunk "chunk" of a compressed file, which the caller has
+//	just changed in chunkData (see LoadChunk).  It is compressed, and
+//	given as many sectors as that takes: fewer than ChunkBlocks, or
+//	if it doesn't compress that well, ChunkBlocks to keep it as it
+//	is, or none at all if it is all zeros.  Sectors it no longer
+//	needs are freed, and any more it needs are taken right after the
+//	ones before.  The affected index sectors and the header are
+//	written back; the caller writes back the free map.
+//	Return FALSE, storing nothing, if the disk is full.
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"chunk" is the chunk to store
+//----------------------------------------------------------------------
+
+bool
+FileHeader::WriteChunk(PersistentBitmap *freeMap, int chunk)
+{
+	int first = chunk * ChunkBlocks;
+	int have = ChunkSectors(chunk);
+	char packed[ChunkSize];
+	int count, length, hint, i;
 
-	while(num>0){
-		int sector = freeMap->FindAndSet();
-		dataSectors[j] = sector;
-		int index[32];
-		memset(index,-1,sizeof(index));
+	ASSERT(chunk == loadedChunk);
+	for (i = 0; i < ChunkSize && chunkData[i] == 0; i++)
+		;
+	if (i == ChunkSize) {
+		count = 0;
+	} else {
+		length = Compress(chunkData, ChunkSize, &packed[2], ChunkSize - 2);
+		count = (length == -1) ? ChunkBlocks : divRoundUp(length + 2, SectorSize);
+		if (count < ChunkBlocks) {
+			packed[0] = (char) (length >> 8);
+			packed[1] = (char) (length & 0xff);
+		} else {
+			count = ChunkBlocks;
+			bcopy(chunkData, packed, ChunkSize);
+		}
+	}
 
-		for(int i=0; i<32 && num>0; i++){
-			index[i] = freeMap->FindAndSet();
-			num--;
+	if (count > have) {
+		if (freeMap->NumClear() < count - have) {
+			loadedChunk = -1;	// chunkData isn't what's on disk
+			return FALSE;
 		}
+		hint = HintBefore(first + have);
+		AllocateRun(freeMap, count - have, &hint, &sectorTable[first + have]);
+	}
+	for (i = count; i < have; i++) {
+		freeMap->Clear(sectorTable[first + i]);
+		sectorTable[first + i] = -1;
+	}
+	DEBUG(dbgFile, "Chunk " << chunk << " stored in " << count << " sectors");
+	if (count > 0)
+		kernel->synchDisk->WriteSectors(&sectorTable[first], count, packed);
+
+	if (count != have) {
+		WriteIndexSectors(first, first + ChunkBlocks, NULL);
+		TagSectors(hdrSector, NULL, 0);
+		if (first < NumDirectBlocks && hdrSector != -1)
+			WriteBack(hdrSector);
+	}
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::StoreBlock
+//	MP4 MODIFIED
+// 	Make block "block" of a deduplicated file hold the SectorSize
+//	bytes at "data".  If some sector of a deduplicated file holds
+//	them already, the block is pointed at it; otherwise they are
+//	written to the block's own sector, or, if it has none or shares
+//	it, to a new one, taken right after the block before.  Either
+//	way, the sector the block had is released.  The affected index
+//	sectors and the header are written back if the block moved; the
+//	caller writes back the free map and the share counts.
+//	Return FALSE, storing nothing, if the disk is full.
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"dedup" is the table of shared sectors
+//	"block" is the block to store
+//	"data" is what it is to hold
+//----------------------------------------------------------------------
+
+bool
+FileHeader::StoreBlock(PersistentBitmap *freeMap, DedupTable *dedup,
+			int block, char *data)
+{
+	unsigned hash = DedupTable::Hash(data);
+	int old, match, hint;
+
+	ASSERT(deduplicated && block < numSectors);
+	if (!tableValid)
+		LoadSectorTable();
+	old = sectorTable[block];
+	match = dedup->Find(data, hash);
+	if (match != -1 && match == old)
+		return TRUE;			// it holds them already
+
+	if (match != -1 && dedup->Share(match)) {
+		DEBUG(dbgFile, "Block " << block << " shares sector " << match);
+		sectorTable[block] = match;
+	} else if (old == -1 || dedup->Shares(old) > 0) {
+		if (freeMap->NumClear() < 1)
+			return FALSE;		// not enough space
+		hint = HintBefore(block);
+		AllocateRun(freeMap, 1, &hint, &sectorTable[block]);
+		kernel->synchDisk->WriteSector(sectorTable[block], data);
+		dedup->Insert(sectorTable[block], hash);
+	} else {			// ours alone: write it in place
+		dedup->Forget(old);
+		kernel->synchDisk->WriteSector(old, data);
+		dedup->Insert(old, hash);
+		return TRUE;
+	}
+	if (old != -1)
+		dedup->Release(freeMap, old);
+
+	WriteIndexSectors(block, block + 1, NULL);
+	TagSectors(hdrSector, NULL, 0);
+	if (block < NumDirectBlocks && hdrSector != -1)
+		WriteBack(hdrSector);
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::DelayedBlock
+//	MP4 MODIFIED
+// 	Return the held back contents of "block", or NULL if it isn't
+//	held back.
+//----------------------------------------------------------------------
+
+char *
+FileHeader::DelayedBlock(int block)
+{
+	for (int i = 0; i < numDelayed; i++) {
+		if (delayedBlock[i] == block)
+			return &delayedData[i * SectorSize];
+	}
+	return NULL;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::AddDelayed
+//	MP4 MODIFIED
+// 	Start holding back "block", a hole about to be written, instead
+//	of giving it a sector now.  Return its contents, all zeros, for
+//	the caller to write into; or NULL if DelayedBlocks are held
+//	already, and FlushDelayed must be called first.  The caller has
+//	reserved a free sector for it.
+//
+//	The blocks are kept in file order, so FlushDelayed can write
+//	them out as they are.
+//----------------------------------------------------------------------
+
+char *
+FileHeader::AddDelayed(int block)
+{
+	int i;
+
+	ASSERT(DelayedBlock(block) == NULL);
+	if (numDelayed == DelayedBlocks)
+		return NULL;
+	if (delayedData == NULL)
+		delayedData = (char *) KernelAlloc(DelayedBlocks * SectorSize, MemFilesys);
+
+	for (i = numDelayed; i > 0 && delayedBlock[i - 1] > block; i--) {
+		delayedBlock[i] = delayedBlock[i - 1];
+		memcpy(&delayedData[i * SectorSize],
+				&delayedData[(i - 1) * SectorSize], SectorSize);
+	}
+	delayedBlock[i] = block;
+	numDelayed++;
+	bzero(&delayedData[i * SectorSize], SectorSize);
+	return &delayedData[i * SectorSize];
+}
+
+//----------------------------------------------------------------------
+// FileHeader::FlushDelayed
+//	MP4 MODIFIED
+// 	Give every held back block a sector, all of them as one run
+//	following the block before the first of them, and write them
+//	there with one request.  By now the file has been written as far
+//	as it will be for a while, so a file written sequentially gets
+//	contiguous sectors, and its index sectors are written once per
+//	flush rather than once per chunk.
+//	The affected index sectors and the header are written back; the
+//	caller writes back the free map.  If the file has been removed
+//	meanwhile, the blocks are just dropped.
+//
+//	"freeMap" is the bit map of free disk sectors; it has the sectors
+//	reserved already
+//----------------------------------------------------------------------
+
+void
+FileHeader::FlushDelayed(PersistentBitmap *freeMap)
+{
+	int first, last, hint, *fresh;
+
+	if (numDelayed == 0)
+		return;
+	freeMap->Unreserve(numDelayed);
+	if (hdrSector == -1) {
+		numDelayed = 0;
+		return;
+	}
+	if (!tableValid)
+		LoadSectorTable();
+	first = delayedBlock[0];
+	last = delayedBlock[numDelayed - 1];
+	DEBUG(dbgFile, "Flushing " << numDelayed << " held back blocks in " << first << " to " << last);
+
+	hint = HintBefore(first);
+	fresh = new int[numDelayed];
+	AllocateRun(freeMap, numDelayed, &hint, fresh);
+	for (int i = 0; i < numDelayed; i++) {
+		ASSERT(sectorTable[delayedBlock[i]] == -1);
+		sectorTable[delayedBlock[i]] = fresh[i];
+	}
+	kernel->synchDisk->WriteSectors(fresh, numDelayed, delayedData);
+	delete [] fresh;
+	numDelayed = 0;
+
+	WriteIndexSectors(first, last + 1, NULL);	// index sectors exist
+	TagSectors(hdrSector, NULL, 0);
+	if (first < NumDirectBlocks)
+		WriteBack(hdrSector);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::OwnedSectors
+//	MP4 MODIFIED
+// 	Store every sector the file owns besides its header in "sectors",
+//	in the order Allocate lays them out: the single indirect, the
+//	double indirect and the second level index sectors, then the data
+//	blocks in file order (holes own nothing).  Return how many.
+//
+//	"sectors" has room for NumIndexSectors(numSectors) + numSectors
+//----------------------------------------------------------------------
+
+int
+FileHeader::OwnedSectors(int *sectors)
+{
+	int top[NumIndirect];
+	int count = 0;
+	int base = NumDirectBlocks + NumIndirect;
+
+	if (IsInline())
+		return 0;
+	if (!tableValid)
+		LoadSectorTable();
+	if (numSectors > NumDirectBlocks)
+		sectors[count++] = dataSectors[SingleIndirect];
+	if (numSectors > base) {
+		sectors[count++] = dataSectors[DoubleIndirect];
+		kernel->synchDisk->ReadSector(dataSectors[DoubleIndirect], (char*)top);
+		for (int j = 0; j < divRoundUp(numSectors - base, NumIndirect); j++)
+			sectors[count++] = top[j];
+	}
+	for (int i = 0; i < numSectors; i++) {
+		if (sectorTable[i] != -1)
+			sectors[count++] = sectorTable[i];
+	}
+	return count;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::MarkSectors
+//	MP4 MODIFIED
+// 	Mark every sector the file owns, except its header, in "set",
+//	so that a whole tree of files can be freed at once (see
+//	Directory::RemoveAll).  Like Deallocate, but nothing changes.
+//----------------------------------------------------------------------
+
+void
+FileHeader::MarkSectors(Bitmap *set)
+{
+	int *sectors = new int[NumIndexSectors(numSectors) + numSectors + 1];
+	int count = OwnedSectors(sectors);
+
+	for (int i = 0; i < count; i++)
+		set->Mark(sectors[i]);
+	delete [] sectors;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::CountFragments
+//	MP4 MODIFIED
+// 	Return how many separate runs of sectors the file's index sectors
+//	and data blocks are in, taken in layout order; 1 is contiguous.
+//	Also return the first of them in "*first" (-1 if none), and how
+//	many there are in "*size".
+//----------------------------------------------------------------------
+
+int
+FileHeader::CountFragments(int *first, int *size)
+{
+	int *sectors = new int[NumIndexSectors(numSectors) + numSectors + 1];
+	int count = OwnedSectors(sectors);
+	int fragments = (count > 0) ? 1 : 0;
 
-		kernel->synchDisk->WriteSector(sector,(char*)index);
-		j++;
+	for (int i = 1; i < count; i++) {
+		if (sectors[i] != sectors[i - 1] + 1)
+			fragments++;
 	}
+	*first = (count > 0) ? sectors[0] : -1;
+	*size = count;
+	delete [] sectors;
+	return fragments;
+}
+
+//----------------------------------------------------------------------
+// CopySectors
+//	MP4 MODIFIED
+// 	Copy sector "from[i]" to sector "to[i]" for each of "count"
+//	sectors, RelocateChunk at a time: every read of a chunk is queued
+//	at once, then every write.  The writes go straight to the disk,
+//	not through the journal; the caller only commits the new pointers
+//	once they are done.
+//----------------------------------------------------------------------
+
+static void
+CopySectors(int *from, int *to, int count)
+{
+	char *buf = new char[RelocateChunk * SectorSize];
+	DiskRequest *requests[RelocateChunk];
+
+	for (int done = 0; done < count; done += RelocateChunk) {
+		int n = min(RelocateChunk, count - done);
+		int i;
+
+		for (i = 0; i < n; i++)
+			requests[i] = kernel->synchDisk->ReadSectorAsync(
+						from[done + i], &buf[i * SectorSize]);
+		for (i = 0; i < n; i++)
+			kernel->synchDisk->WaitFor(requests[i]);
+		for (i = 0; i < n; i++)
+			requests[i] = kernel->synchDisk->WriteSectorAsync(
+						to[done + i], &buf[i * SectorSize]);
+		for (i = 0; i < n; i++)
+			kernel->synchDisk->WaitFor(requests[i]);
+	}
+	delete [] buf;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::ReserveRun
+//	MP4 MODIFIED
+// 	Set aside the "size" free sectors starting at "start" to move the
+//	file to, by marking them in use, so nothing else is given them
+//	while CopyToRun fills them.  Only the in-core free map changes:
+//	if a later transaction writes the marks and Nachos stops before
+//	Relocate, they are just a leak.  The caller holds the free map.
+//	Return FALSE, marking nothing, if the file can't be moved, or no
+//	longer owns "size" sectors, or the run isn't free any more.
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"start", "size" -- the run, as found from CountFragments
+//----------------------------------------------------------------------
 
+bool
+FileHeader::ReserveRun(PersistentBitmap *freeMap, int start, int size)
+{
+	int *sectors;
+	int count, i;
+
+	if (hdrSector == -1 || IsInline() || deduplicated)
+		return FALSE;			// removed, nothing to move, or
+						// sectors other files share
+	sectors = new int[NumIndexSectors(numSectors) + numSectors + 1];
+	count = OwnedSectors(sectors);
+	delete [] sectors;
+	if (count != size)
+		return FALSE;			// the file grew or shrank
+	for (i = 0; i < size; i++) {
+		if (start + i >= freeMap->NumBits() || freeMap->Test(start + i))
+			return FALSE;
+	}
+	for (i = 0; i < size; i++)
+		freeMap->Mark(start + i);
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::CopyToRun
+//	MP4 MODIFIED
+// 	Copy the file's data blocks to the run ReserveRun set aside, laid
+//	out as Allocate would: room for the index sectors, then the data
+//	blocks in file order.  Nothing is locked and no transaction is
+//	open, so other operations go on meanwhile; a write to the file
+//	racing with the copy makes Relocate give the run back.  If the
+//	file no longer owns "size" sectors, nothing is copied.
+//
+//	"start", "size" -- the run
+//----------------------------------------------------------------------
+
+void
+FileHeader::CopyToRun(int start, int size)
+{
+	int numIndex = NumIndexSectors(numSectors);
+	int *oldSectors = new int[numIndex + numSectors + 1];
+	int *newSectors = new int[size + 1];
+
+	if (OwnedSectors(oldSectors) == size) {
+		for (int i = 0; i < size; i++)
+			newSectors[i] = start + i;
+		DEBUG(dbgFile, "Copying file at " << hdrSector << ": " << size << " sectors to " << start);
+		CopySectors(&oldSectors[numIndex], &newSectors[numIndex],
+				size - numIndex);
+	}
+	delete [] oldSectors;
+	delete [] newSectors;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Relocate
+//	MP4 MODIFIED
+// 	Switch the file to the run CopyToRun filled: the in-core table,
+//	the index sectors and the header now point at the new sectors,
+//	and the old ones are freed.  Only these few metadata sectors are
+//	written, so the caller's transaction and hold on the free map are
+//	short.  The caller writes back the free map.
+//
+//	If the file was written or removed since the caller looked at it
+//	("writes" is NumWrites then), the move is abandoned: the run is
+//	freed again and FALSE returned.  The caller makes sure nobody
+//	else had the file open to begin with.
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"start", "size" -- the run
+//	"writes" -- NumWrites() before ReserveRun
+//----------------------------------------------------------------------
+
+bool
+FileHeader::Relocate(PersistentBitmap *freeMap, int start, int size,
+			int writes)
+{
+	int numIndex, count, i, next;
+	int *oldSectors, *newSectors;
+
+	numIndex = NumIndexSectors(numSectors);
+	oldSectors = new int[numIndex + numSectors + 1];
+	count = (hdrSector == -1) ? -1 : OwnedSectors(oldSectors);
+	if (numWrites != writes || count != size) {	// give up
+		DEBUG(dbgFile, "File was changed while moving it, not moved");
+		for (i = 0; i < size; i++)
+			freeMap->Clear(start + i);
+		delete [] oldSectors;
+		return FALSE;
+	}
+	newSectors = new int[size + 1];
+	for (i = 0; i < size; i++)
+		newSectors[i] = start + i;
+	DEBUG(dbgFile, "Relocating file at " << hdrSector << ": " << size << " sectors to " << start);
+
+	// switch the in-core table before writing anything, so that any
+	// write from now on goes to the new blocks
+	next = start + numIndex;
+	for (i = 0; i < numSectors; i++) {
+		if (sectorTable[i] != -1)
+			sectorTable[i] = next++;
+	}
+	dataSectors[SingleIndirect] = -1;	// all index sectors are new
+	dataSectors[DoubleIndirect] = -1;
+	WriteIndexSectors(0, numSectors, newSectors);
+	TagSectors(hdrSector, newSectors, numIndex);
+	WriteBack(hdrSector);
+
+	for (i = 0; i < size; i++)
+		freeMap->Clear(oldSectors[i]);
+	delete [] oldSectors;
+	delete [] newSectors;
 	return TRUE;
 }
 
@@ -100,25 +1264,46 @@ FileHeader::Allocate(PersistentBitmap *freeMap, int fileSize)
 // FileHeader::Deallocate
 //	MP4 MODIFIED
 // 	De-allocate all the space allocated for data blocks for this file.
+//	Only the index sectors the file uses are read; the data blocks
+//	come from the in-core table.  A deduplicated file's data blocks
+//	are released through "dedup", which only frees the sectors no
+//	other block points at.
 //
 //	"freeMap" is the bit map of free disk sectors
+//	"dedup" is the table of shared sectors, for a deduplicated file
 //----------------------------------------------------------------------
 
 void 
-FileHeader::Deallocate(PersistentBitmap *freeMap)
-{
-	int index[32];
-	for( int i=0; i<divRoundUp(numSectors,32); i++){
-		kernel->synchDisk->ReadSector(dataSectors[i],(char*)index);
-		for(int j=0; j<32; j++){
-			if (index[j]!=-1)
-				freeMap->Clear((int)index[j]);
+FileHeader::Deallocate(PersistentBitmap *freeMap, DedupTable *dedup)
+{
+	int top[NumIndirect];
+
+	if (IsInline())
+		return;			// nothing outside the header
+	if (!tableValid)
+		LoadSectorTable();
+	for (int i = 0; i < numSectors; i++) {
+		if (sectorTable[i] != -1) {
+			ASSERT(freeMap->Test(sectorTable[i]));  // ought to be marked!
+			if (deduplicated) {
+				ASSERT(dedup != NULL);
+				dedup->Release(freeMap, sectorTable[i]);
+			} else {
+				freeMap->Clear(sectorTable[i]);
+			}
 		}
-		ASSERT(freeMap->Test((int) dataSectors[i]));  // ought to be marked!
-		freeMap->Clear((int) dataSectors[i]);
 	}
-}
 
+	if (dataSectors[SingleIndirect] != -1)
+		freeMap->Clear(dataSectors[SingleIndirect]);
+	if (dataSectors[DoubleIndirect] != -1) {
+		kernel->synchDisk->ReadSector(dataSectors[DoubleIndirect], (char*)top);
+		for (int j = 0; j < NumIndirect && top[j] != -1; j++)
+			freeMap->Clear(top[j]);
+		freeMap->Clear(dataSectors[DoubleIndirect]);
+	}
+	tableValid = FALSE;	// the blocks in sectorTable are gone
+}
 //----------------------------------------------------------------------
 // FileHeader::FetchFrom
 // 	Fetch contents of file header from disk. 
@@ -129,13 +1314,35 @@ FileHeader::Deallocate(PersistentBitmap *freeMap)
 void
 FileHeader::FetchFrom(int sector)
 {
-	kernel->synchDisk->ReadSector(sector, (char *)this);
-	
-	/*
-		MP4 Hint:
-		After you add some in-core informations, you will need to rebuild the header's structure
-	*/
-	
+	char buf[SectorSize];
+
+	TraceTag(sector, TraceHeader, sector);
+	kernel->synchDisk->ReadSector(sector, buf);
+	Unpack(buf);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Unpack
+//	MP4 MODIFIED
+// 	Initialize the file header from a copy of its sector that the
+//	caller has already read.
+//
+//	"buf" is the contents of the header sector
+//----------------------------------------------------------------------
+
+void
+FileHeader::Unpack(char *buf)
+{
+	memcpy(&numBytes, buf, sizeof(numBytes));
+	memcpy(&numSectors, buf + sizeof(int), sizeof(numSectors));
+	memcpy(dataSectors, buf + 2 * sizeof(int), sizeof(dataSectors));
+	compressed = (numSectors & CompressedFlag) != 0;
+	deduplicated = (numSectors & DedupFlag) != 0;
+	numSectors &= ~(CompressedFlag | DedupFlag);
+
+	// the in-core table is rebuilt on the first ByteToSector
+	tableValid = FALSE;
+	loadedChunk = -1;
 }
 
 //----------------------------------------------------------------------
@@ -148,17 +1355,21 @@ FileHeader::FetchFrom(int sector)
 void
 FileHeader::WriteBack(int sector)
 {
-	kernel->synchDisk->WriteSector(sector, (char *)this); 
-	
-	/*
-		MP4 Hint:
-		After you add some in-core informations, you may not want to write all fields into disk.
-		Use this instead:
-		char buf[SectorSize];
-		memcpy(buf + offset, &dataToBeWritten, sizeof(dataToBeWritten));
-		...
-	*/
-	
+	char buf[SectorSize];
+	int sectors = numSectors;
+
+	if (compressed)
+		sectors |= CompressedFlag;
+	if (deduplicated)
+		sectors |= DedupFlag;
+
+	// only the disk part goes out; the in-core table stays in memory
+	TraceTag(sector, TraceHeader, sector);
+	memset(buf, 0, sizeof(buf));
+	memcpy(buf, &numBytes, sizeof(numBytes));
+	memcpy(buf + sizeof(int), &sectors, sizeof(sectors));
+	memcpy(buf + 2 * sizeof(int), dataSectors, sizeof(dataSectors));
+	kernel->synchDisk->WriteSector(sector, buf); 
 }
 
 //----------------------------------------------------------------------
@@ -167,7 +1378,7 @@ FileHeader::WriteBack(int sector)
 // 	Return which disk sector is storing a particular byte within the file.
 //      This is essentially a translation from a virtual address (the
 //	offset in the file) to a physical address (the sector where the
-//	data at the offset is stored).
+//	data at the offset is stored).  -1 means the byte is in a hole.
 //
 //	"offset" is the location within the file of the byte in question
 //----------------------------------------------------------------------
@@ -176,9 +1387,38 @@ int
 FileHeader::ByteToSector(int offset)
 {
 	int target = offset/SectorSize;
-	int index[32];
-	kernel->synchDisk->ReadSector(dataSectors[target/32], (char*)index);
-	return (index[target%32]);
+
+	if (!tableValid)
+		LoadSectorTable();
+	ASSERT(target >= 0 && target < numSectors);
+	return (sectorTable[target]);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::ReadInline, FileHeader::WriteInline
+//	MP4 MODIFIED
+// 	Copy bytes out of, or into, an inline file.  The caller has
+//	already checked the range against the file length.  A write
+//	goes straight back to the header sector.
+//
+//	"numBytes" -- the number of bytes to transfer
+//	"position" -- the offset within the file of the first byte
+//----------------------------------------------------------------------
+
+void
+FileHeader::ReadInline(char *into, int numBytes, int position)
+{
+	ASSERT(IsInline() && position + numBytes <= MaxInlineSize);
+	memcpy(into, (char *)dataSectors + position, numBytes);
+}
+
+void
+FileHeader::WriteInline(char *from, int numBytes, int position)
+{
+	ASSERT(IsInline() && position + numBytes <= MaxInlineSize);
+	memcpy((char *)dataSectors + position, from, numBytes);
+	if (hdrSector != -1)
+		WriteBack(hdrSector);
 }
 
 //----------------------------------------------------------------------
@@ -202,32 +1442,41 @@ FileHeader::FileLength()
 void
 FileHeader::Print()
 {
-	int i, j, k=0;
+	int i, j, k = 0;
 	char *data = new char[SectorSize];
-	int index[32];
 
-	printf("FileHeader contents.  File size: %d.  File blocks:\n", numBytes);
-	for (i = 0; i < numSectors; i++){
-		printf("%d ", dataSectors[i]);
+	if (IsInline()) {
+		printf("FileHeader contents.  File size: %d.  Inline:\n", numBytes);
+		for (j = 0; j < numBytes; j++) {
+			char c = ((char *)dataSectors)[j];
+
+			if ('\040' <= c && c <= '\176')
+				printf("%c", c);
+			else
+				printf("\\%x", (unsigned char)c);
+		}
+		printf("\n");
+		delete [] data;
+		return;
 	}
+	if (!tableValid)
+		LoadSectorTable();
+	printf("FileHeader contents.  File size: %d.  File blocks:\n", numBytes);
+	for (i = 0; i < numSectors; i++)
+		printf("%d ", sectorTable[i]);
 	printf("\nFile contents:\n");
-	for (i=0; i<divRoundUp(numSectors,32); i++){
-		kernel->synchDisk->ReadSector(dataSectors[i], (char*)index);
-		for (int l=0; l<32; l++){
-			if(index[l]!=-1){
-				kernel->synchDisk->ReadSector(index[l], data);
-				for (j = 0; (j < SectorSize) && (k < numBytes); j++, k++){
-					if ('\040' <= data[j] && data[j] <= '\176'){
-						printf("%c", data[j]);
-					}
-					else{
-						printf("\\%x", (unsigned char)data[j]);
-					}
-				}
-				printf("\n"); 
-			}
-			delete [] data;
-		}	
+	for (i = 0; i < numSectors; i++) {
+		if (sectorTable[i] == -1)
+			memset(data, 0, SectorSize);	// a hole
+		else
+			kernel->synchDisk->ReadSector(sectorTable[i], data);
+		for (j = 0; (j < SectorSize) && (k < numBytes); j++, k++) {
+			if ('\040' <= data[j] && data[j] <= '\176')
+				printf("%c", data[j]);
+			else
+				printf("\\%x", (unsigned char)data[j]);
+		}
+		printf("\n"); 
 	}
-	
-}
+	delete [] data;
+}
\ No newline at end of file
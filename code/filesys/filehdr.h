@@ -15,10 +15,26 @@
 #define FILEHDR_H
 
 #include "disk.h"
+#include "geometry.h"
 #include "pbitmap.h"
+#include "openhash.h"
 
-#define NumDirect 	((SectorSize - 2 * sizeof(int)) / sizeof(int))
-#define MaxFileSize 	(NumDirect * SectorSize)
+class RWLock;
+class DedupTable;
+
+// The header's layout -- NumDirect, NumIndirect, MaxFileSize and the
+// rest -- is in geometry.h.
+
+#define PreallocBlocks	8		// blocks a growing file gets at once
+#define RelocateChunk	32		// blocks CopyToRun copies at once
+#define DelayedBlocks	16		// written blocks a file may hold
+					// before they are given sectors
+#define ChunkBlocks	4		// blocks a compressed file packs
+					// together
+#define ChunkSize	(ChunkBlocks * SectorSize)
+#define CompressedFlag	0x40000000	// set in numSectors on disk for a
+					// compressed file
+#define DedupFlag	0x20000000	// and for a deduplicated one
 
 // The following class defines the Nachos "file header" (in UNIX terms,  
 // the "i-node"), describing where on disk to find all of the data in the file.
@@ -31,6 +47,57 @@
 // as one disk sector.  Without indirect addressing, this
 // limits the maximum file length to just under 4K bytes.
 //
+// MP4 MODIFIED
+// As in UNIX, the first NumDirectBlocks entries of dataSectors point
+// straight at data blocks; the next one points at a single indirect
+// sector of NumIndirect data pointers, and the last at a double
+// indirect sector of NumIndirect pointers to such sectors.  Small files
+// need no index sector at all, and the largest covers the whole disk.
+// Unused pointers are -1.
+//
+// A file can grow with Extend.  It may then own more blocks
+// (numSectors) than its length needs, kept for the next writes.
+//
+// A file of at most MaxInlineSize bytes is stored "inline": it has no
+// blocks at all (numSectors is 0) and its bytes sit where dataSectors
+// would be, so reading it costs just the header sector.  It moves to
+// blocks as soon as it grows past that.
+//
+// A data pointer of -1 inside the file is a hole: it reads as zeros,
+// and gets a block when it is first written.  Index sectors are never
+// holes.
+//
+// Blocks a user writes into holes need not get sectors at once: the
+// shared in-core header can hold up to DelayedBlocks of them (space
+// for them is reserved in the free map), and FlushDelayed later gives
+// them all one run of sectors, in file order.  Until then they are
+// still holes on disk, and readers find them with DelayedBlock.
+// Extend can leave the blocks it adds as holes for this.
+//
+// A compressed file is stored ChunkSize bytes at a time.  Each chunk
+// has ChunkBlocks consecutive entries in the block table (numSectors
+// is always a multiple of ChunkBlocks), and how many of them have
+// sectors tells how it is stored: none, it is all zeros; all, it is
+// stored as is; fewer, those sectors hold a two byte length and then
+// the chunk compressed (see compress.h).  WriteChunk gives a chunk just
+// the sectors it needs every time it is written, so the file takes
+// less of the disk, and fewer sectors are read and written.  Chunks
+// are read through LoadChunk, which keeps the last one decompressed.
+// The header has no spare word, so whether a file is compressed is a
+// bit (CompressedFlag) of numSectors on disk.
+//
+// A deduplicated file is written a block at a time through StoreBlock,
+// which points the block at any sector with the same contents instead
+// of writing it (see dedup.h), and gives a shared block a sector of
+// its own before changing it.  It is marked by DedupFlag, the same way.
+// Its sectors may be some other file's too, so they are never moved,
+// and are freed through the DedupTable.
+//
+// A file's blocks can be moved, for defragmenting: ReserveRun sets
+// aside the sectors, CopyToRun copies the data, and Relocate switches
+// the file to them.  The in-core part counts the writes to the file,
+// so that a move racing with one is abandoned rather than losing it.
+//
 // There is no constructor; rather the file header can be initialized
 // by allocating blocks for the file (if it is a new file), or by
 // reading it from disk.
@@ -40,14 +107,73 @@ class FileHeader {
 	// MP4 mod tag
 	FileHeader(); // dummy constructor to keep valgrind happy
 	~FileHeader();
+
+    static void *operator new(size_t size);
+    static void operator delete(void *p);
+    					// MP4 MODIFIED: from a SlabCache
 	
-    bool Allocate(PersistentBitmap *bitMap, int fileSize);// Initialize a file header, 
+    bool Allocate(PersistentBitmap *bitMap, int fileSize,
+		int hdrSector = -1, bool sparse = FALSE);
+						// Initialize a file header, 
 						//  including allocating space 
-						//  on disk for the file data
-    void Deallocate(PersistentBitmap *bitMap);  // De-allocate this file's 
-						//  data blocks
+						//  on disk for the file data,
+						//  near "hdrSector" if given,
+						//  unless "sparse"
+    void Deallocate(PersistentBitmap *bitMap, DedupTable *dedup = NULL);
+    						// De-allocate this file's 
+						//  data blocks; "dedup" is
+						//  needed if it is deduplicated
+    bool Extend(PersistentBitmap *bitMap, int newSize, bool delay = FALSE);
+    						// Grow the file to "newSize"
+						//  bytes, allocating blocks
+						//  a chunk at a time, or
+						//  leaving holes if "delay"
+    bool FillHoles(PersistentBitmap *bitMap, int from, int to);
+    						// Allocate the holes among
+						//  blocks "from".."to"
+    bool ReserveRun(PersistentBitmap *bitMap, int start, int size);
+    						// Set aside the free run at
+						//  "start" to move the file to
+    void CopyToRun(int start, int size);	// Copy its data blocks there
+    bool Relocate(PersistentBitmap *bitMap, int start, int size,
+		int writes);			// Switch it to the copy, if
+						//  not written since "writes"
+    char *DelayedBlock(int block);		// Held back copy of "block",
+						//  or NULL
+    char *AddDelayed(int block);		// Hold back "block", zeroed;
+						//  NULL if there's no room
+    int NumDelayed() { return numDelayed; }	// Blocks held back
+    void FlushDelayed(PersistentBitmap *bitMap);
+    						// Give them sectors, as one
+						//  run, and write them
+    void SetCompressed() { compressed = TRUE; }
+    					// Store the file compressed; only
+					// before Allocate
+    bool IsCompressed() { return compressed; }
+    char *LoadChunk(int chunk, bool overwrite = FALSE);
+    						// Contents of "chunk",
+						//  decompressed; not read
+						//  if "overwrite"
+    bool WriteChunk(PersistentBitmap *bitMap, int chunk);
+    						// Store what the caller put
+						//  there, compressed
+    void SetDeduplicated() { deduplicated = TRUE; }
+    					// Share sectors with other such
+					// files; only before Allocate
+    bool IsDeduplicated() { return deduplicated; }
+    bool StoreBlock(PersistentBitmap *bitMap, DedupTable *dedup, int block,
+		char *data);			// Write "data" to "block", or
+						//  share a sector holding it
+    void MarkSectors(Bitmap *set);	// Mark the sectors the file owns,
+						//  but not its header, in "set"
+    int CountFragments(int *first, int *size);
+    						// Runs the file's sectors are
+						//  in; also its first sector
+						//  and how many it owns
 
     void FetchFrom(int sectorNumber); 	// Initialize file header from disk
+    void Unpack(char *buf);		// Initialize it from a copy of its
+					//  sector already in memory
     void WriteBack(int sectorNumber); 	// Write modifications to file header
 					//  back to disk
 
@@ -57,9 +183,57 @@ class FileHeader {
 
     int FileLength();			// Return the length of the file 
 					// in bytes
+    int AllocatedLength() { return IsInline() ? MaxInlineSize :
+					numSectors * SectorSize; }
+    					// Bytes the file can hold without
+					// allocating more blocks
+
+    bool IsInline() { return numSectors == 0; }
+    					// Are the bytes in the header?
+    void ReadInline(char *into, int numBytes, int position);
+    void WriteInline(char *from, int numBytes, int position);
+    					// Transfer bytes of an inline file;
+					// writes go back to the header sector
 
     void Print();			// Print the contents of the file.
 
+    // MP4 MODIFIED
+    // Open files share one in-core header per header sector, found
+    // through a kernel-wide, reference-counted table.
+    static FileHeader *Acquire(int sector);	// Shared header for "sector",
+					// read from disk on first use
+    static void Release(FileHeader *hdr);	// Drop a reference; the last
+					// one frees the header
+    static void Detach(FileHeader *hdr);	// File is being removed:
+					// later Acquires must not find it
+    static void FlushAllDelayed();	// Every open file writes the
+					// blocks it holds back
+    static int NumOpen()		// Headers in the table
+	{ return openHeaders == NULL ? 0 : openHeaders->NumItems(); }
+
+    int GetSector() { return hdrSector; }	// Sector this header lives in
+    RWLock *GetLock();			// Readers and writers of the file,
+					// or of the directory it holds
+    bool IsShared() { return refCount > 1; }	// Open more than once?
+    void NoteWrite() { numWrites++; }	// A write to the file is starting
+    int NumWrites() { return numWrites; }
+    void SetLength(int newSize) { numBytes = newSize; }
+    					// Grow the file within the blocks
+					// it has, in core only; the caller
+					// writes the header back later
+    void NoteAccess() { if (hdrSector != -1) heat[hdrSector]++; }
+    					// Count a read or write of the file
+    static int Heat(int sector) { return heat[sector]; }
+    					// Accesses to the file whose header
+					// is in "sector", since boot
+    static void ResetHeat(int sector) { heat[sector] = 0; }
+    					// "sector" holds a new file now
+
+    // MP4 MODIFIED: the raw disk part, for the checker in fsck.cc
+    int NumBlocks() { return numSectors; }	// blocks owned, or 0 if inline
+    int DataPointer(int slot) { return dataSectors[slot]; }
+    					// entry "slot" of dataSectors
+
   private:
 	
 	/*
@@ -73,14 +247,56 @@ class FileHeader {
 		
 		Disk Part - numBytes, numSectors, dataSectors occupy exactly 128 bytes and will be
 		written to a sector on disk.
-		In-core part - none
+		In-core part - sectorTable, tableValid
 		
 	*/
 	
+    void LoadSectorTable();		// Read the index sectors into sectorTable
+    static int NumIndexSectors(int blocks);	// index sectors needed
+					// to map "blocks" data blocks
+    void WriteIndexSectors(int from, int to, int *newIndex);
+    					// store sectorTable[from..to) in the
+					// header and index sectors
+    int HintBefore(int block);		// where to put new sectors for
+					// "block": after the one before it
+    int ChunkSectors(int chunk);	// sectors "chunk" is stored in
+    int OwnedSectors(int *sectors);	// list the index sectors, then the
+					// data blocks; return how many
+    void TagSectors(int owner, int *index, int numIndex);
+    					// tell the disk trace which
+					// sectors are the file's
+
     int numBytes;			// Number of bytes in the file
     int numSectors;			// Number of data sectors in the file
+					// (may be more than numBytes needs)
     int dataSectors[NumDirect];		// Disk sector numbers for each data 
 					// block in the file
+    bool compressed;			// Stored a chunk at a time? (on disk,
+					// part of numSectors)
+    bool deduplicated;			// Sharing identical sectors? (the same)
+
+    // in-core part, never written to disk
+    int *sectorTable;			// Data sector of every block in the file,
+					// gathered from the index sectors
+    bool tableValid;			// Is sectorTable in sync with the disk?
+
+    int hdrSector;			// Sector of a shared header, -1 if
+					// not (or no longer) in the table
+    int refCount;			// OpenFiles using a shared header
+    int numWrites;			// writes started, see Relocate
+    RWLock *rwLock;			// made by GetLock, or NULL
+    int numDelayed;			// blocks held back, see AddDelayed
+    int delayedBlock[DelayedBlocks];	// which they are, in file order
+    char *delayedData;			// and their contents, in the same
+					// order; made on first use
+    int loadedChunk;			// chunk in chunkData, -1 if none
+    char *chunkData;			// it, decompressed; made on first use
+    static HostThreadLocal OpenHashTable<int, FileHeader *> *openHeaders;
+    					// shared headers, keyed by sector
+    static HostThreadLocal int heat[NumSectors];
+    					// accesses, by header sector; kept
+					// here as headers come and go (one
+					// set per host thread's kernel)
 };
 
 #endif // FILEHDR_H
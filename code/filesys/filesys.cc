@@ -39,6 +39,17 @@
 //	    (if Nachos exits in the middle of an operation that modifies
 //	    the file system, it may corrupt the disk)
 //
+//	MP4 MODIFIED
+//	Create, Remove and CreateDirectory now write their metadata
+//	through a journal (journal.h), committed as one sequential log
+//	write, and the log is replayed at mount; so an interrupted
+//	operation either happened completely or not at all.
+//	Files are no longer fixed in size: writing past the end grows
+//	them (ExtendFile).  A new file is sparse, so its initial size
+//	costs nothing until it is written (FillHoles).  Blocks users
+//	write into holes get their sectors later still, all together,
+//	when the file flushes them (FlushDelayed).
+//
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
 // of liability and disclaimer of warranty provisions.
@@ -51,6 +62,17 @@
 #include "directory.h"
 #include "filehdr.h"
 #include "filesys.h"
+#include "synchdisk.h"
+#include "journal.h"
+#include "fsck.h"
+#include "verify.h"
+#include "diriter.h"
+#include "iotrace.h"
+#include "superblock.h"
+#include "dedup.h"
+#include "snapshot.h"
+#include "kregion.h"
+#include "main.h"
 
 // Sectors containing the file headers for the bitmap of free sectors,
 // and the directory of files.  These file headers are placed in well-known 
@@ -58,12 +80,21 @@
 #define FreeMapSector 		0
 #define DirectorySector 	1
 
-// Initial file sizes for the bitmap and directory; until the file system
-// supports extensible files, the directory size sets the maximum number 
-// of files that can be loaded onto the disk.
-#define FreeMapFileSize 	(NumSectors / BitsInByte)
-#define NumDirEntries 		64	// MP4 MODIFIED
-#define DirectoryFileSize 	(sizeof(DirectoryEntry) * NumDirEntries)
+// Initial file sizes for the bitmap and directory.  MP4 MODIFIED: a new
+// directory is empty and grows as files are added; NumDirEntries (see
+// geometry.h) is just the in-core table size it starts with.  The free
+// map file is FreeMapFileSize bytes of bitmap, for the sectors the
+// file system covers; the share counts of deduplicated sectors
+// follow, then the superblock.
+#define ShareTableOffset	FreeMapFileSize(numSectors)
+#define SuperBlockOffset	(ShareTableOffset + ShareTableSize)
+#define DirectoryFileSize 	EmptyDirectorySize
+
+// Output buffering for List: lines are gathered into one buffer and
+// written when it fills, rather than flushed one by one.
+#define ListBufferSize		4096
+#define ListLineSize		(MaxWalkDepth + FileNameMaxLen + 16)
+					// longest line List prints
 
 //----------------------------------------------------------------------
 // FileSystem::FileSystem
@@ -75,14 +106,41 @@
 //	If format = FALSE, we just have to open the files
 //	representing the bitmap and the directory.
 //
+//	Either way the free map stays resident until the file system
+//	is deleted.  A format covers the first "sectors" sectors of the
+//	disk (all of it, unless -fsize says otherwise),
+//	reserves the journal's log region and records the layout in the
+//	superblock; a mount first checks the superblock, so a disk
+//	formatted for another geometry is refused, sizes the free map
+//	from it, then replays the log, before anything else is read.
+//
+//	A format writes as little as it can, so it takes the same time
+//	whatever the size of the disk: the headers, the log header and
+//	the superblock.  The bitmap is left for WriteFreeMap to write
+//	with the first change to it, and the root directory, being
+//	empty, is inline: its header is all there is.
+//
 //	"format" -- should we initialize the disk?
+//	"sectors" -- how much of it, if so
 //----------------------------------------------------------------------
 
-FileSystem::FileSystem(bool format)
+FileSystem::FileSystem(bool format, int sectors)
 { 
 	DEBUG(dbgFile, "Initializing the file system.");
+	if (kernel->ioTrace != NULL) {
+		kernel->ioTrace->TagFile(FreeMapSector, TraceBitmap);
+		kernel->ioTrace->TagFile(DirectorySector, TraceDirectory);
+	}
+	journal = new Journal;
 	if (format) {
-		PersistentBitmap *freeMap = new PersistentBitmap(NumSectors);
+		numSectors = sectors;
+		if (numSectors <= LogSector + LogSize || numSectors > NumSectors) {
+			printf("Can't format %d sectors: the disk has %d, and the "
+				"log alone needs %d\n", numSectors, NumSectors,
+				LogSector + LogSize);
+			Abort();
+		}
+		freeMap = new PersistentBitmap(numSectors);
 		Directory *directory = new Directory(NumDirEntries);
 		FileHeader *mapHdr = new FileHeader;
 		FileHeader *dirHdr = new FileHeader;
@@ -93,17 +151,20 @@ FileSystem::FileSystem(bool format)
 		// (make sure no one else grabs these!)
 		freeMap->Mark(FreeMapSector);	    
 		freeMap->Mark(DirectorySector);
+		journal->Format(freeMap);
 
 		// Second, allocate space for the data blocks containing the contents
 		// of the directory and bitmap files.  There better be enough space!
 
-		ASSERT(mapHdr->Allocate(freeMap, FreeMapFileSize));
-		ASSERT(dirHdr->Allocate(freeMap, DirectoryFileSize));
+		ASSERT(mapHdr->Allocate(freeMap, SuperBlockOffset + sizeof(SuperBlock),
+				FreeMapSector));
+		ASSERT(dirHdr->Allocate(freeMap, DirectoryFileSize, DirectorySector));
 
 		// Flush the bitmap and directory FileHeaders back to disk
 		// We need to do this before we can "Open" the file, since open
 		// reads the file header off of disk (and currently the disk has garbage
-		// on it!).
+		// on it!).  The directory's header, all zeros inline, is
+		// already an empty directory.
 
 		DEBUG(dbgFile, "Writing headers back to disk.");
 		mapHdr->WriteBack(FreeMapSector);    
@@ -116,30 +177,58 @@ FileSystem::FileSystem(bool format)
 		freeMapFile = new OpenFile(FreeMapSector);
 		directoryFile = new OpenFile(DirectorySector);
 	 
-		// Once we have the files "open", we can write the initial version
-		// of each file back to disk.  The directory at this point is completely
-		// empty; but the bitmap has been changed to reflect the fact that
-		// sectors on the disk have been allocated for the file headers and
-		// to hold the file data for the directory and bitmap.
+		// Once we have the files "open", we can write the superblock.
+		// The bitmap only records the sectors allocated above, so a
+		// mount can work it out again (RebuildFreeMap); it stays
+		// dirty, and is written with the first change to it.
 
-		DEBUG(dbgFile, "Writing bitmap and directory back to disk.");
-		freeMap->WriteBack(freeMapFile);	 // flush changes to disk
-		directory->WriteBack(directoryFile);
+		DEBUG(dbgFile, "Writing the superblock back to disk.");
+		SuperBlock super(numSectors);
+
+		super.SetMapUnwritten();
+		super.WriteBack(freeMapFile, SuperBlockOffset);
+		mapUnwritten = TRUE;
+		dedup = new DedupTable;
 
 		if (debug->IsEnabled('f')) {
 			freeMap->Print();
 			directory->Print();
 		}
-		delete freeMap; 
 		delete directory; 
 		delete mapHdr; 
 		delete dirHdr;
 	} else {
 		// if we are not formatting the disk, just open the files representing
 		// the bitmap and directory; these are left open while Nachos is running
+		SuperBlock super;
+
+		freeMapFile = new OpenFile(FreeMapSector);
+		if (super.FetchFrom(freeMapFile) && !super.Matches()) {
+			printf("Can't use this disk; format it again with -f\n");
+			Abort();
+		}
+		delete freeMapFile;		// the log may change it
+
+		journal->Recover();
 		freeMapFile = new OpenFile(FreeMapSector);
 		directoryFile = new OpenFile(DirectorySector);
+		numSectors = super.DiskSectors();
+		mapUnwritten = super.MapUnwritten();
+		if (mapUnwritten) {
+			freeMap = new PersistentBitmap(numSectors);
+			RebuildFreeMap();
+		} else {
+			freeMap = new PersistentBitmap(freeMapFile, numSectors);
+		}
+		dedup = new DedupTable;		// nothing shared yet if unwritten
+		if (!mapUnwritten)
+			dedup->FetchFrom(freeMapFile, ShareTableOffset);
 	}
+
+	ForgetPaths();
+	snapshot = NULL;
+	allocLock = new Lock("free map");
+	kernel->synchDisk->SetJournal(journal);
 }
 
 //----------------------------------------------------------------------
@@ -148,8 +237,179 @@ FileSystem::FileSystem(bool format)
 //----------------------------------------------------------------------
 FileSystem::~FileSystem()
 {
+	DropSnapshot();			// what it froze stays as it is now
+	WriteFreeMap();
+	freeMap->Discard(kernel->synchDisk);	// nothing is open any more
+	delete freeMap;
+	delete dedup;
 	delete freeMapFile;
 	delete directoryFile;
+	kernel->synchDisk->Flush();	// push cached metadata to disk
+	journal->Checkpoint();		// and leave the log empty
+	kernel->synchDisk->SetJournal(NULL);
+	delete journal;
+	delete allocLock;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::WriteFreeMap
+//  MP4 MODIFIED
+//	Write the changed sectors of the free map, and of the share
+//	counts, back to disk.  The first time after a format, that is
+//	all of them; the superblock then stops saying the bitmap is
+//	unwritten, in the same transaction.
+//----------------------------------------------------------------------
+
+void
+FileSystem::WriteFreeMap()
+{
+	freeMap->WriteDirty(freeMapFile);
+	dedup->WriteDirty(freeMapFile, ShareTableOffset, mapUnwritten);
+	if (mapUnwritten) {
+		SuperBlock(numSectors).WriteBack(freeMapFile, SuperBlockOffset);
+		mapUnwritten = FALSE;
+	}
+}
+
+//----------------------------------------------------------------------
+// FileSystem::EndOperation
+//	End a file system operation, and once DiscardBatch sectors or
+//	more have been freed, tell the disk about them.  That waits until
+//	the free map saying they are free is committed, i.e. no other
+//	operation is open; a crash can't then leave a file pointing at a
+//	discarded sector.  An operation nested in another that holds the
+//	free map leaves it to that one.  While a snapshot is held, the
+//	sectors it froze may be needed again, so nothing is discarded.
+//----------------------------------------------------------------------
+
+void
+FileSystem::EndOperation()
+{
+	journal->End();
+	if (freeMap->NumFreed() < DiscardBatch || snapshot != NULL
+			|| allocLock->IsHeldByCurrentThread())
+		return;
+	allocLock->Acquire();
+	if (journal->Idle())
+		freeMap->Discard(kernel->synchDisk);
+	allocLock->Release();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::TakeSnapshot
+//  MP4 MODIFIED
+//	Freeze the disk as it is now, so that Rollback can bring it back:
+//	the free map goes to disk, and then the sectors it has in use are
+//	kept from being lost (see snapshot.h).  No sector is copied yet.
+//	Must be called between file system operations; return FALSE if
+//	one is under way, or a snapshot is held already.
+//----------------------------------------------------------------------
+
+bool
+FileSystem::TakeSnapshot()
+{
+	bool taken = FALSE;
+
+	allocLock->Acquire();
+	if (snapshot == NULL && journal->Idle()) {
+		WriteFreeMap();
+		snapshot = new Snapshot(freeMap);
+		kernel->synchDisk->SetSnapshot(snapshot);
+		taken = TRUE;
+	}
+	allocLock->Release();
+	return taken;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Rollback
+//  MP4 MODIFIED
+//	Put back every sector the snapshot kept, so the disk is as it was
+//	when it was taken, and drop the snapshot.  What is in memory is
+//	read again from the disk: the free map and its file, the share
+//	counts, the root directory file, and the paths cached.  Open
+//	files would still see the newer headers, so return FALSE, doing
+//	nothing, if any file is open but those two, or an operation is
+//	under way.  The sectors are put back through the cache, not as
+//	one transaction: a crash part way leaves a mix.
+//----------------------------------------------------------------------
+
+bool
+FileSystem::Rollback()
+{
+	if (snapshot == NULL || FileHeader::NumOpen() > 2)
+		return FALSE;
+	allocLock->Acquire();
+	if (!journal->Idle()) {
+		allocLock->Release();
+		return FALSE;
+	}
+	kernel->synchDisk->SetSnapshot(NULL);
+	journal->Checkpoint();		// so a replay can't bring back what
+					// the log holds from since
+	snapshot->Restore(kernel->synchDisk);
+	delete snapshot;
+	snapshot = NULL;
+
+	delete freeMapFile;		// their headers may have changed
+	delete directoryFile;
+	freeMapFile = new OpenFile(FreeMapSector);
+	directoryFile = new OpenFile(DirectorySector);
+	freeMap->FetchFrom(freeMapFile);
+	delete dedup;			// and its index of contents with it
+	dedup = new DedupTable;
+	dedup->FetchFrom(freeMapFile, ShareTableOffset);
+	ForgetPaths();
+	allocLock->Release();
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::DropSnapshot
+//  MP4 MODIFIED
+//	Keep the disk as it is, and stop keeping sectors for the snapshot.
+//----------------------------------------------------------------------
+
+void
+FileSystem::DropSnapshot()
+{
+	if (snapshot == NULL)
+		return;
+	kernel->synchDisk->SetSnapshot(NULL);
+	delete snapshot;
+	snapshot = NULL;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::RebuildFreeMap
+//  MP4 MODIFIED
+//	Work out the free map of a disk whose bitmap was never written:
+//	nothing has changed since the format, so only the well-known
+//	headers, the log and the two files' own sectors are in use.
+//----------------------------------------------------------------------
+
+void
+FileSystem::RebuildFreeMap()
+{
+	Bitmap *used = new Bitmap(numSectors);
+	FileHeader *hdr;
+
+	DEBUG(dbgFile, "Free map was never written, rebuilding it.");
+	used->Mark(FreeMapSector);
+	used->Mark(DirectorySector);
+	hdr = FileHeader::Acquire(FreeMapSector);
+	hdr->MarkSectors(used);
+	FileHeader::Release(hdr);
+	hdr = FileHeader::Acquire(DirectorySector);
+	hdr->MarkSectors(used);
+	FileHeader::Release(hdr);
+
+	for (int i = 0; i < numSectors; i++) {
+		if (used->Test(i))
+			freeMap->Mark(i);
+	}
+	journal->Reserve(freeMap);
+	delete used;
 }
 
 //----------------------------------------------------------------------
@@ -175,22 +435,32 @@ FileSystem::~FileSystem()
 //	 	no free entry for file in directory
 //	 	no free space for data blocks for the file 
 //
-// 	Note that this implementation assumes there is no concurrent access
-//	to the file system!
+//	The parent directory is locked for writing throughout, so no one
+//	reads it half changed, and the free map is locked while blocks
+//	are taken from it.  Other directories can be used meanwhile.
 //
 //	"name" -- name of file to be created
 //	"initialSize" -- size of file to be created
+//	"preallocate" -- allocate the data blocks now, as contiguously as
+//		possible, instead of leaving the file sparse
+//	"compress" -- store the file compressed, a chunk at a time (see
+//		filehdr.h); it is then never preallocated
+//	"deduplicate" -- have the file share sectors with the same contents
+//		(see dedup.h), unless it is compressed; it is never
+//		preallocated either
 //----------------------------------------------------------------------
 
-bool FileSystem::Create(char *name, int initialSize)
+bool FileSystem::Create(char *name, int initialSize, bool preallocate,
+			bool compress, bool deduplicate)
 {
+	KernelRegion region("FileSystem::Create");
+
 	if(!CheckFileLength(name)){
 		return FALSE;
 	}
 	OpenFile *parentDirectoryFile;
 
 	Directory *parentDirectory;
-	PersistentBitmap *freeMap;
 	FileHeader *hdr;
 	int sector;
 	bool success;
@@ -198,52 +468,67 @@ bool FileSystem::Create(char *name, int initialSize)
 	DEBUG(dbgFile, "[FileSystem::Create]\tCreating file " << name << " size " << initialSize);
 
 	char *fileName = GetFileName(name);
-	char *dirName = GetDirectoryName(name);
+	int parentSector = ResolveParent(name);
+	if(parentSector == -1){
+		return FALSE;			// parent directory does not exist
+	}
 	
-	// Default root dir as parent
 	parentDirectory = new Directory(NumDirEntries);
-	parentDirectoryFile = directoryFile;
-	// If not in root dir, change the parent directory
-	if(dirName!=NULL){
-		Directory *rootDirectory = new Directory(NumDirEntries);
-		rootDirectory->FetchFrom(directoryFile);
-		int parentDirectoryFileSector = rootDirectory->Find(dirName, true);
-		if(parentDirectoryFileSector == -1){
-			return FALSE;
-		}
-		parentDirectoryFile = new OpenFile(parentDirectoryFileSector);
-		delete rootDirectory;
+	if(parentSector == DirectorySector){
+		parentDirectoryFile = directoryFile;
 	}
+	else{
+		parentDirectoryFile = new OpenFile(parentSector);
+	}
+	parentDirectoryFile->GetLock()->AcquireWrite();
 	parentDirectory->FetchFrom(parentDirectoryFile);
 	
 	if (parentDirectory->Find(fileName, false) != -1){
 		success = FALSE;			// file is already in directory
 	}
 	else {	
-		freeMap = new PersistentBitmap(freeMapFile,NumSectors);
-		sector = freeMap->FindAndSet();	// find a sector to hold the file header
+		// the free map is resident, so a failed create has to give
+		// back what it took instead of just discarding a copy.  An
+		// indexed directory is changed on disk by Add itself, so the
+		// transaction starts here.
+		journal->Begin();
+		allocLock->Acquire();
+		sector = freeMap->FindAndSetNear(parentSector);
+					// a sector for the file header, on
+					// the directory's track if there's room
 		if (sector == -1) {
 			success = FALSE;		// no free block for file header 
 		}		
 		else if (!parentDirectory->Add(fileName, sector, FILE)){
+			freeMap->Clear(sector);
 			success = FALSE;	// no space in directory
 		}
 		else {
 			hdr = new FileHeader;
-			if (!hdr->Allocate(freeMap, initialSize)){
+			if (compress)
+				hdr->SetCompressed();
+			else if (deduplicate)
+				hdr->SetDeduplicated();
+			if (!hdr->Allocate(freeMap, initialSize, sector, !preallocate)){
+				parentDirectory->Remove(fileName);
+				freeMap->Clear(sector);
 				success = FALSE;	// no space on disk for data
 			}
 			else {	
 				success = TRUE;
 				// everthing worked, flush all changes back to disk
+				// as a single transaction
 				hdr->WriteBack(sector);
+				FileHeader::ResetHeat(sector);
 				parentDirectory->WriteBack(parentDirectoryFile);
-				freeMap->WriteBack(freeMapFile);
+				WriteFreeMap();
+				ForgetMissing(parentSector, fileName);
 				DEBUG(dbgFile, "[FileSystem::Create]\tFile Created Success");
 			}
 			delete hdr;
 		}
-		delete freeMap;
+		allocLock->Release();
+		EndOperation();
 	}
 	if(success){
 		ASSERT(parentDirectory->Find(fileName, false) != -1);
@@ -252,12 +537,12 @@ bool FileSystem::Create(char *name, int initialSize)
 		cout << "File creation not success" << endl;
 		success = FALSE;
 	}
+	parentDirectoryFile->GetLock()->ReleaseWrite();
 	//cout << "[FileSystem::Create]\tName after: " << name << endl;
 	delete parentDirectory;
-	if(dirName!=NULL){
+	if(parentDirectoryFile != directoryFile){
 		delete parentDirectoryFile;
 	}
-	delete dirName;
 	return success;
 }
 
@@ -269,36 +554,60 @@ bool FileSystem::Create(char *name, int initialSize)
 //	  Find the location of the file's header, using the directory 
 //	  Bring the header into memory
 //
+//	The directory is only locked for reading, so opens in it can go
+//	on together.  The file opened is locked by its reads and writes.
+//
+//	A name that is not found is remembered in the miss cache, so
+//	probing for it again doesn't read the directory again -- until
+//	something by that name is created there.  The miss is noted
+//	before the directory is unlocked, so no Create can slip in
+//	between and leave it stale.
+//
 //	"name" -- the text name of the file to be opened
 //----------------------------------------------------------------------
 
 OpenFile *
 FileSystem::Open(char *name)
 { 
-	Directory *parentDirectory = new Directory(NumDirEntries);
+	KernelRegion region("FileSystem::Open");
+	Directory *parentDirectory;
+	OpenFile *parentDirectoryFile;
 	OpenFile *openFile = NULL;
 
 	char *fileName = GetFileName(name);
-	char *dirName = GetDirectoryName(name);
 
 	DEBUG(dbgFile, "Opening file" << name);
 
-	// Default root dir as parent
-	parentDirectory->FetchFrom(directoryFile);
-	// If not in root dir, change the parent directory
-	if(dirName != NULL){
-		int parentDirectoryFileSector = parentDirectory->Find(dirName, true);
-		OpenFile *parentDirectoryFile = new OpenFile(parentDirectoryFileSector);
-		parentDirectory->FetchFrom(parentDirectoryFile);
-		delete parentDirectoryFile;
+	int parentSector = ResolveParent(name);
+	if(parentSector == -1){
+		return NULL;			// parent directory does not exist
+	}
+	if(IsMissing(parentSector, fileName)){
+		return NULL;			// looked for already, and not there
 	}
+	parentDirectory = new Directory(NumDirEntries);
+	if(parentSector == DirectorySector){
+		parentDirectoryFile = directoryFile;
+	}
+	else{
+		parentDirectoryFile = new OpenFile(parentSector);
+	}
+	parentDirectoryFile->GetLock()->AcquireRead();
+	parentDirectory->FetchFrom(parentDirectoryFile);
 
 	int sector = parentDirectory->Find(fileName, false); 
 	if (sector >= 0){
 		openFile = new OpenFile(sector);	// name was found in directory 
+		openFile->SetLocking();
+	}
+	else{
+		NoteMissing(parentSector, fileName);
+	}
+	parentDirectoryFile->GetLock()->ReleaseRead();
+	if(parentDirectoryFile != directoryFile){
+		delete parentDirectoryFile;
 	}
 	delete parentDirectory;
-	delete dirName;
 	return openFile;				// return NULL if not found
 }
 
@@ -314,81 +623,81 @@ FileSystem::Open(char *name)
 //	Return TRUE if the file was deleted, FALSE if the file wasn't
 //	in the file system.
 //
+//	As for Create, the parent directory is locked for writing, and
+//	the free map while the file's sectors go back to it.
+//
 //	"name" -- the text name of the file to be removed
 //----------------------------------------------------------------------
 
 bool
 FileSystem::Remove(char *name, bool recursiveflag)
 { 
+	KernelRegion region("FileSystem::Remove");
 	Directory *directory;
-	PersistentBitmap *freeMap;
 	FileHeader *fileHdr;
 	OpenFile *of;
 	int sector;
 	
-	directory = new Directory(NumDirEntries);
-	directory->FetchFrom(directoryFile);
 	char *fileName = GetFileName(name);
-	char *dirName = GetDirectoryName(name);
-	of = directoryFile;
-	if (recursiveflag==false){
-		if(dirName != NULL){
-			of = new OpenFile(directory->Find(dirName,true));
-			directory->FetchFrom(of);
-		}
+	int parentSector = ResolveParent(name);
+	if (parentSector == -1) {
+		return FALSE;			// parent directory not found
+	}
+
+	directory = new Directory(NumDirEntries);
+	if (parentSector == DirectorySector) {
+		of = directoryFile;
+	} else {
+		of = new OpenFile(parentSector);
+	}
+	of->GetLock()->AcquireWrite();
+	directory->FetchFrom(of);
+
 	sector = directory->Find(fileName, false);
 	if (sector == -1) {
-	   delete directory;
-	   return FALSE;			 // file not found 
+		of->GetLock()->ReleaseWrite();
+		delete directory;
+		if (of != directoryFile)
+			delete of;
+		return FALSE;			 // file not found 
 	}
-	fileHdr = new FileHeader;
-	fileHdr->FetchFrom(sector);
 
-	freeMap = new PersistentBitmap(freeMapFile,NumSectors);
+	journal->Begin();
+	allocLock->Acquire();
 
-	fileHdr->Deallocate(freeMap);  		// remove data blocks
-	freeMap->Clear(sector);			// remove header block
-	directory->Remove(fileName);
+	// a recursive remove first gathers every sector below the
+	// directory being removed, and frees them as one batch: the free
+	// map and the parent are still written only once, below
+	if (recursiveflag && directory->FindDirectory(fileName) != -1) {
+		Bitmap *doomed = new Bitmap(numSectors);
 
-	freeMap->WriteBack(freeMapFile);		// flush to disk
-	directory->WriteBack(of);        // flush to disk
-	}
-		else{
-		freeMap = new PersistentBitmap(freeMapFile, NumSectors);
-		sector = directory->Find(fileName,true);
-		if (sector == -1) {
-		   delete directory;
-		   return FALSE;             // file not found 
-		}
-		Directory *dirtemp = new Directory(NumDirEntries);
-		OpenFile *temp = directoryFile;
-		dirtemp->FetchFrom(directoryFile);
-		if(dirName != NULL){
-			of = new OpenFile(directory->Find(dirName,true));
-			directory->FetchFrom(temp);
+		CollectTree(sector, doomed);
+		for (int i = 0; i < numSectors; i++) {
+			if (doomed->Test(i))
+				freeMap->Clear(i);
 		}
+		delete doomed;
+	}
 
-		of = new OpenFile(sector);
-		directory->FetchFrom(of);
-		directory->RemoveAll(freeMap,of);
+	fileHdr = FileHeader::Acquire(sector);
+	FileHeader::Detach(fileHdr);		// open copies must not be reused
 
-		fileHdr = new FileHeader;
-		fileHdr->FetchFrom(sector);
+	fileHdr->Deallocate(freeMap, dedup);	// remove data blocks
+	freeMap->Clear(sector);			// remove header block
+	directory->Remove(fileName);
 
-		fileHdr->Deallocate(freeMap);
-		freeMap->Clear(sector);
+	WriteFreeMap();		// flush to disk
+	allocLock->Release();
+	directory->WriteBack(of);        // flush to disk
+	EndOperation();
 
-		dirtemp->Remove(fileName);
+	InvalidatePath(name);
+	of->GetLock()->ReleaseWrite();
 
-		freeMap->WriteBack(freeMapFile);
-		dirtemp->WriteBack(temp);
-		delete dirtemp;
-	}
-	delete fileHdr;
+	FileHeader::Release(fileHdr);
 	delete directory;
-	delete freeMap;
-	delete of;
-	delete dirName;
+	if (of != directoryFile)
+		delete of;
 	return TRUE;
 } 
 
@@ -400,28 +709,69 @@ FileSystem::Remove(char *name, bool recursiveflag)
 
 void FileSystem::List(char *name, bool recursively)
 {
-	Directory *rootDirectory = new Directory(NumDirEntries);
-	rootDirectory->FetchFrom(directoryFile);
+	int sector = ResolveDirectory(name);
+	if(sector == -1){
+		cout << "Invalid path" << endl;
+		return;
+	}
 
-	char *dirName = name;
+	// walked depth first with a DirIterator, each line indented by
+	// its depth; the lines go out in ListBufferSize writes
+	DirIterator *iter = new DirIterator(TRUE, FALSE);
+	char *out = new char[ListBufferSize];
+	int used = 0;
+
+	iter->Start(sector);
+	while (iter->Next()) {
+		if (used + ListLineSize > ListBufferSize) {
+			cout.write(out, used);
+			used = 0;
+		}
+		for (int j = 0; j < iter->Depth(); j++)
+			out[used++] = '\t';
+		used += sprintf(&out[used], "[%d] %s %c\n", iter->Index(),
+				iter->Name(), (iter->Type() == DIR) ? 'D' : 'F');
+		if (recursively && iter->Type() == DIR)
+			iter->Descend();
+	}
+	cout.write(out, used);
+	cout.flush();
 
-	// If not listing for root directory
-	if(strlen(name)>1){
-		dirName = GetFileName(name);
-		OpenFile *childDirectoryFile = new OpenFile(rootDirectory->Find(dirName, true));
-		Directory *childDirectory = new Directory(NumDirEntries);
-		childDirectory->FetchFrom(childDirectoryFile);
-		childDirectory->List(0, recursively);
+	delete [] out;
+	delete iter;
+}
 
-		delete childDirectory;
-		delete childDirectoryFile;
-	}
-	// If listing for root directory
-	else{
-		rootDirectory->List(0, recursively);
-	}
+//----------------------------------------------------------------------
+// FileSystem::CollectTree
+//  MP4 MODIFIED
+// 	Mark every sector owned by the files below the directory whose
+//	header is at "sector" (headers included, but not its own) in
+//	"doomed", for a recursive Remove to free as one batch.  Nothing
+//	changes on disk: the emptied directories are not written back,
+//	since they go away too.  Every header below is prefetched as its
+//	directory is opened.  A deduplicated file's blocks are released
+//	at once instead, since other files may still use its sectors.
+//----------------------------------------------------------------------
 
-	delete rootDirectory;
+void
+FileSystem::CollectTree(int sector, Bitmap *doomed)
+{
+	DirIterator *iter = new DirIterator(TRUE, TRUE);
+
+	iter->Start(sector);
+	while (iter->Next()) {
+		if (iter->Type() == DIR)
+			iter->Descend();
+		FileHeader *hdr = FileHeader::Acquire(iter->Sector());
+		FileHeader::Detach(hdr);	// open copies must not be reused
+		if (hdr->IsDeduplicated())
+			hdr->Deallocate(freeMap, dedup);
+		else
+			hdr->MarkSectors(doomed);
+		doomed->Mark(iter->Sector());
+		FileHeader::Release(hdr);
+	}
+	delete iter;
 }
 
 //----------------------------------------------------------------------
@@ -439,7 +789,6 @@ FileSystem::Print()
 {
 	FileHeader *bitHdr = new FileHeader;
 	FileHeader *dirHdr = new FileHeader;
-	PersistentBitmap *freeMap = new PersistentBitmap(freeMapFile,NumSectors);
 	Directory *directory = new Directory(NumDirEntries);
 
 	printf("Bit map file header:\n");
@@ -457,10 +806,165 @@ FileSystem::Print()
 
 	delete bitHdr;
 	delete dirHdr;
-	delete freeMap;
 	delete directory;
 } 
 
+//----------------------------------------------------------------------
+// FileSystem::Check
+//  MP4 MODIFIED
+// 	Check that the disk is consistent (see fsck.h): every sector
+//	reachable from the free map file and the root directory belongs
+//	to one file and is marked in use, and no other sector is.
+//	Prints each problem found; returns TRUE if there are none.
+//	Its reads are idle I/O, so they don't hold up anyone else's.
+//----------------------------------------------------------------------
+
+bool
+FileSystem::Check()
+{
+	FileSystemChecker *checker =
+		new FileSystemChecker(freeMap, dedup, journal->IsEnabled());
+	IOClass old = kernel->currentThread->SetIOClass(IOIdle);
+	bool clean;
+
+	checker->AddRoot(FreeMapSector, "<free map>", FILE);
+	checker->AddRoot(DirectorySector, "/", DIR);
+	clean = checker->Check();
+	(void) kernel->currentThread->SetIOClass(old);
+	delete checker;
+	return clean;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Verify
+//  MP4 MODIFIED
+// 	Checksum every file below the directory "name", several files at
+//	a time, and print the checksums (see verify.h).  If "hostDir" is
+//	not NULL, each file is compared with the host file of the same
+//	name below it.  Returns TRUE if they all match.
+//----------------------------------------------------------------------
+
+bool
+FileSystem::Verify(char *name, char *hostDir)
+{
+	int sector = ResolveDirectory(name);
+	if (sector == -1) {
+		cout << "Invalid path" << endl;
+		return FALSE;
+	}
+
+	TreeVerifier *verifier = new TreeVerifier(hostDir);
+	bool matched = verifier->Verify(sector, name);
+
+	delete verifier;
+	return matched;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Defragment
+//  MP4 MODIFIED
+// 	Move every file whose sectors are scattered into one contiguous
+//	run.  The files go in order of access heat (FileHeader::Heat),
+//	and a file that has been used looks for its run from the start
+//	of the disk, so the hottest files end up next to the free map,
+//	the root directory and the journal, shortening the seeks between
+//	them.  A used file already in one piece is moved too once a run
+//	closer to the start has freed up.
+//
+//	Each file is moved by its own transaction, and the thread yields
+//	between files, so this can run in a thread of its own beside the
+//	foreground I/O.  The free map file and the root directory, which
+//	stay open, are not moved, nor is any file someone has open.
+//----------------------------------------------------------------------
+
+void
+FileSystem::Defragment()
+{
+	int *files = new int[numSectors];
+	int *heat = new int[numSectors];
+	DirIterator *iter = new DirIterator(FALSE, FALSE);
+	int numFiles = 0, moved = 0;
+	int sector, i, j;
+
+	// the walk itself reads the directories; don't count that
+	for (i = 0; i < numSectors; i++)
+		heat[i] = FileHeader::Heat(i);
+
+	// every file below the root, breadth first
+	files[numFiles++] = DirectorySector;
+	iter->Start(DirectorySector);
+	while (numFiles < numSectors && iter->Next()) {
+		files[numFiles++] = iter->Sector();
+		if (iter->Type() == DIR)
+			iter->Descend();
+	}
+	delete iter;
+
+	// hottest first; the root stays in slot 0 and is not moved
+	for (i = 2; i < numFiles; i++) {
+		sector = files[i];
+		for (j = i; j > 1 && heat[files[j - 1]] < heat[sector]; j--)
+			files[j] = files[j - 1];
+		files[j] = sector;
+	}
+
+	for (i = 1; i < numFiles; i++) {
+		if (DefragmentFile(files[i], heat[files[i]] > 0))
+			moved++;
+		kernel->currentThread->Yield();
+	}
+	printf("Defragmented the disk: moved %d of %d files\n",
+		moved, numFiles - 1);
+
+	delete [] files;
+	delete [] heat;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::DefragmentFile
+//  MP4 MODIFIED
+// 	Move the file whose header is in "sector" to a contiguous run of
+//	free sectors, if it is not in one yet, or if it is "hot" and a
+//	run nearer the start of the disk is free.  Returns TRUE if the
+//	file was moved.
+//
+//	The free map is only held to set the run aside, and then to
+//	switch the file over to it, in a transaction of a few sectors;
+//	the data is copied in between, so foreground allocation and
+//	commits aren't held up behind the copy.
+//----------------------------------------------------------------------
+
+bool
+FileSystem::DefragmentFile(int sector, bool hot)
+{
+	FileHeader *hdr = FileHeader::Acquire(sector);
+	int fragments, first, size, start, length, writes;
+	bool moved = FALSE, reserved;
+
+	if (!hdr->IsShared()) {
+		fragments = hdr->CountFragments(&first, &size);
+		start = (size > 0) ? freeMap->FindRun(size, hot ? 0 : first, &length) : -1;
+		if (start != -1 && length == size &&
+				(fragments > 1 || (hot && start < first))) {
+			writes = hdr->NumWrites();
+			allocLock->Acquire();
+			reserved = hdr->ReserveRun(freeMap, start, size);
+			allocLock->Release();
+			if (reserved) {
+				hdr->CopyToRun(start, size);
+				journal->Begin();
+				allocLock->Acquire();
+				moved = hdr->Relocate(freeMap, start, size, writes);
+				WriteFreeMap();
+				allocLock->Release();
+				EndOperation();
+			}
+		}
+	}
+	FileHeader::Release(hdr);
+	return moved;
+}
+
 //----------------------------------------------------------------------
 // FileSystem::GetFileName
 //  MP4 MODIFIED
@@ -509,6 +1013,262 @@ char* FileSystem::GetDirectoryName(char *fullpath)
 	return parent;
 }
 
+//----------------------------------------------------------------------
+// FileSystem::ResolveDirectory
+//  MP4 MODIFIED
+//	Return the header sector of the directory named by the absolute
+//	path "path" (for example "/a/b"), or -1 if some component is
+//	missing or is not a directory.  "/" and "" name the root.
+//
+//	The path is walked one component at a time, and the result is
+//	remembered in a small LRU cache of resolved paths.  The walk
+//	starts from the longest cached directory above "path", or from
+//	the root if none is cached, and stops early at a component the
+//	miss cache knows is not there.  Each directory on the way is
+//	locked for reading while it is searched, one at a time; the
+//	header of the next one is handed to SynchDisk::Prefetch as soon
+//	as it is found, so it is on its way while this one is let go.
+//----------------------------------------------------------------------
+
+int FileSystem::ResolveDirectory(char *path)
+{
+	if(path[0] == '\0' || strcmp(path, "/") == 0){
+		return DirectorySector;
+	}
+	if(strlen(path) > PathMaxLen){
+		return -1;
+	}
+
+	int sector = DirectorySector;
+	char *p = path;
+	PathCacheEntry *ancestor = NULL;
+	int ancestorLen = 0;
+
+	for(int i = 0; i < NumPathCacheEntries; i++){
+		char *cached = pathCache[i].path;
+		if(cached[0] == '\0'){
+			continue;
+		}
+		if(strcmp(cached, path) == 0){
+			pathCache[i].lastUsed = ++pathClock;
+			DEBUG(dbgFile, "Path cache hit " << path << " -> " << pathCache[i].sector);
+			return pathCache[i].sector;
+		}
+		int len = strlen(cached);
+		if(len > ancestorLen && strncmp(cached, path, len) == 0 &&
+			path[len] == '/'){
+			ancestor = &pathCache[i];
+			ancestorLen = len;
+		}
+	}
+	if(ancestor != NULL){
+		ancestor->lastUsed = ++pathClock;
+		sector = ancestor->sector;
+		p = path + ancestorLen;
+	}
+
+	Directory *directory = new Directory(NumDirEntries);
+	char component[FileNameMaxLen + 1];
+
+	while(sector != -1){
+		while(*p == '/'){
+			p++;
+		}
+		if(*p == '\0'){
+			break;
+		}
+		char *end = strchr(p, '/');
+		int len = (end == NULL) ? strlen(p) : end - p;
+		if(len > FileNameMaxLen){
+			sector = -1;
+			break;
+		}
+		memcpy(component, p, len);
+		component[len] = '\0';
+		p += len;
+		if(IsMissing(sector, component)){
+			sector = -1;
+			break;
+		}
+
+		OpenFile *componentFile = (sector == DirectorySector) ?
+			directoryFile : new OpenFile(sector);
+		componentFile->GetLock()->AcquireRead();
+		directory->FetchFrom(componentFile);
+		sector = directory->FindDirectory(component);
+		if(sector != -1){
+			kernel->synchDisk->Prefetch(sector);
+		}
+		componentFile->GetLock()->ReleaseRead();
+		if(componentFile != directoryFile){
+			delete componentFile;
+		}
+	}
+	delete directory;
+
+	if(sector != -1){
+		CachePath(path, sector);
+	}
+	return sector;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::CachePath
+//  MP4 MODIFIED
+//	Remember that directory "path" has its header at "sector", in a
+//	free entry of the path cache, or else the least recently used.
+//----------------------------------------------------------------------
+
+void FileSystem::CachePath(char *path, int sector)
+{
+	PathCacheEntry *victim = &pathCache[0];
+
+	for(int i = 0; i < NumPathCacheEntries; i++){
+		if(pathCache[i].path[0] == '\0'){
+			victim = &pathCache[i];
+			break;
+		}
+		if(pathCache[i].lastUsed < victim->lastUsed){
+			victim = &pathCache[i];
+		}
+	}
+	strcpy(victim->path, path);
+	victim->sector = sector;
+	victim->lastUsed = ++pathClock;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::ResolveParent
+//  MP4 MODIFIED
+//	Return the header sector of the directory that holds "fullpath",
+//	or -1 if that directory does not exist.
+//----------------------------------------------------------------------
+
+int FileSystem::ResolveParent(char *fullpath)
+{
+	char parentPath[PathMaxLen + 1];
+	char *slash = strrchr(fullpath, '/');
+
+	if(slash == NULL || slash == fullpath){
+		return DirectorySector;
+	}
+	int len = slash - fullpath;
+	if(len > PathMaxLen){
+		return -1;
+	}
+	memcpy(parentPath, fullpath, len);
+	parentPath[len] = '\0';
+	return ResolveDirectory(parentPath);
+}
+
+//----------------------------------------------------------------------
+// FileSystem::InvalidatePath
+//  MP4 MODIFIED
+//	Drop "path", and every cached path below it, from the path cache.
+//	Called whenever the directory tree under "path" changes shape.
+//----------------------------------------------------------------------
+
+void FileSystem::InvalidatePath(char *path)
+{
+	int len = strlen(path);
+
+	for(int i = 0; i < NumPathCacheEntries; i++){
+		char *cached = pathCache[i].path;
+		if(strncmp(cached, path, len) == 0 &&
+			(cached[len] == '\0' || cached[len] == '/')){
+			cached[0] = '\0';
+			pathCache[i].sector = -1;
+		}
+	}
+}
+
+//----------------------------------------------------------------------
+// FileSystem::IsMissing
+//  MP4 MODIFIED
+//	Return TRUE if "name" was looked for in the directory with its
+//	header at "parent", and not found, since it was last created there.
+//----------------------------------------------------------------------
+
+bool FileSystem::IsMissing(int parent, char *name)
+{
+	for(int i = 0; i < NumMissCacheEntries; i++){
+		if(missCache[i].parent == parent &&
+			strcmp(missCache[i].name, name) == 0){
+			missCache[i].lastUsed = ++pathClock;
+			DEBUG(dbgFile, "Miss cache hit " << name << " in " << parent);
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::NoteMissing
+//  MP4 MODIFIED
+//	Remember that "name" is not in the directory with its header at
+//	"parent", in a free entry of the miss cache, or else the least
+//	recently used.  The caller holds the directory's lock.
+//----------------------------------------------------------------------
+
+void FileSystem::NoteMissing(int parent, char *name)
+{
+	MissCacheEntry *victim = &missCache[0];
+
+	if(strlen(name) > FileNameMaxLen || IsMissing(parent, name)){
+		return;
+	}
+	for(int i = 0; i < NumMissCacheEntries; i++){
+		if(missCache[i].parent == -1){
+			victim = &missCache[i];
+			break;
+		}
+		if(missCache[i].lastUsed < victim->lastUsed){
+			victim = &missCache[i];
+		}
+	}
+	victim->parent = parent;
+	strcpy(victim->name, name);
+	victim->lastUsed = ++pathClock;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::ForgetMissing
+//  MP4 MODIFIED
+//	"name" has just been added to the directory with its header at
+//	"parent": drop the miss cache entry saying it isn't there.
+//----------------------------------------------------------------------
+
+void FileSystem::ForgetMissing(int parent, char *name)
+{
+	for(int i = 0; i < NumMissCacheEntries; i++){
+		if(missCache[i].parent == parent &&
+			strcmp(missCache[i].name, name) == 0){
+			missCache[i].parent = -1;
+		}
+	}
+}
+
+//----------------------------------------------------------------------
+// FileSystem::ForgetPaths
+//  MP4 MODIFIED
+//	Empty the path and miss caches, when nothing in them can be
+//	trusted: at mount, and after a rollback.
+//----------------------------------------------------------------------
+
+void FileSystem::ForgetPaths()
+{
+	for (int i = 0; i < NumPathCacheEntries; i++) {
+		pathCache[i].path[0] = '\0';
+		pathCache[i].sector = -1;
+		pathCache[i].lastUsed = 0;
+	}
+	for (int i = 0; i < NumMissCacheEntries; i++) {
+		missCache[i].parent = -1;
+		missCache[i].lastUsed = 0;
+	}
+	pathClock = 0;
+}
+
 //----------------------------------------------------------------------
 // FileSystem::CheckFileLength
 //  MP4 MODIFIED
@@ -519,7 +1279,7 @@ bool FileSystem::CheckFileLength(char *fullpath)
 {
 	char *filename = GetFileName(fullpath);
 
-	if(strlen(filename)>9){
+	if(strlen(filename)>FileNameMaxLen){
 		cout << "File name too long." << endl;
 		return FALSE;
 	}
@@ -534,120 +1294,257 @@ bool FileSystem::CheckFileLength(char *fullpath)
 // FileSystem::CreateDirectory
 //  MP4 MODIFIED
 //	Check if the length of the path and filename satisfies the work request.
+//	An "indexed" directory is kept as a B-tree (see dirbtree.h), for
+//	directories expected to hold many files.
 //----------------------------------------------------------------------
 
-void FileSystem::CreateDirectory(char *fullpath)
+void FileSystem::CreateDirectory(char *fullpath, bool indexed)
 {
 	if(!CheckFileLength(fullpath)){
 		return;
 	}
-	PersistentBitmap *freeMap = new PersistentBitmap(freeMapFile, NumSectors);
-	OpenFile *freeMapFile = new OpenFile(FreeMapSector);
-	
 	char *fileName = GetFileName(fullpath);
-	char *dirName = GetDirectoryName(fullpath);
+	int parentSector = ResolveParent(fullpath);
 
-	FileHeader *hdr = new FileHeader;
-	hdr->Allocate(freeMap, DirectoryFileSize);
-
-	Directory *rootDirectory = new Directory(NumDirEntries);
-	rootDirectory->FetchFrom(directoryFile);
-	Directory *newDirectory = new Directory(NumDirEntries);
-
-	// Creating directory in root
-	if(dirName == NULL){
-		int sector = freeMap->FindAndSet();
-		hdr->WriteBack(sector);
-		OpenFile *newDirectoryFile = new OpenFile(sector);
-		newDirectory->WriteBack(newDirectoryFile);
-		rootDirectory->Add(fileName, sector, DIR);
-		rootDirectory->WriteBack(directoryFile);
+	// If cannot find parent dir, then return
+	if(parentSector == -1){
+		cout << "Invalid path" << endl;
+		return;
+	}
 
-		delete newDirectoryFile;
+	Directory *parentDirectory = new Directory(NumDirEntries);
+	OpenFile *parentDirectoryFile;
+	if(parentSector == DirectorySector){
+		parentDirectoryFile = directoryFile;
 	}
-	// Creating directory in a directory
 	else{
-		int parentDirectoryFileSector = rootDirectory->Find(dirName, true);
-		// If cannot find parent dir, then return
-		if(parentDirectoryFileSector == -1){
-			cout << "Invalid path" << endl;
-			return;
-		}
-		else{
-			Directory *parentDirectory = new Directory(NumDirEntries);
-			OpenFile *parentDirectoryFile = new OpenFile(parentDirectoryFileSector);
-			parentDirectory->FetchFrom(parentDirectoryFile);
+		parentDirectoryFile = new OpenFile(parentSector);
+	}
+	parentDirectoryFile->GetLock()->AcquireWrite();
+	parentDirectory->FetchFrom(parentDirectoryFile);
 
-			int sector = freeMap->FindAndSet();
+	// as in Create, the sectors are taken inside the transaction, and
+	// given back if the directory can't be made
+	journal->Begin();
+	allocLock->Acquire();
+	bool success = FALSE;
+	int sector = freeMap->FindAndSetNear(parentSector);
+	if (sector == -1) {
+		// no free block for the directory's header
+	}
+	else if (!parentDirectory->Add(fileName, sector, DIR)) {
+		freeMap->Clear(sector);		// no space in the parent
+	}
+	else {
+		FileHeader *hdr = new FileHeader;
+		if (!hdr->Allocate(freeMap, DirectoryFileSize, sector)) {
+			parentDirectory->Remove(fileName);
+			freeMap->Clear(sector);	// no space for its table
+		}
+		else {
+			success = TRUE;
 			hdr->WriteBack(sector);
+			FileHeader::ResetHeat(sector);
 			OpenFile *newDirectoryFile = new OpenFile(sector);
-			newDirectory->WriteBack(newDirectoryFile);
-
-			parentDirectory->Add(fileName, sector, DIR);
-			parentDirectory->WriteBack(parentDirectoryFile);
-
-			delete parentDirectory;
-			delete parentDirectoryFile;
+			if(indexed){
+				Directory::FormatIndexed(newDirectoryFile);
+			}
+			else{
+				Directory *newDirectory = new Directory(NumDirEntries);
+				newDirectory->WriteBack(newDirectoryFile);
+				delete newDirectory;
+			}
 			delete newDirectoryFile;
+			parentDirectory->WriteBack(parentDirectoryFile);
+			WriteFreeMap();
+			ForgetMissing(parentSector, fileName);
 		}
+		delete hdr;
 	}
+	allocLock->Release();
+	EndOperation();
 
-	delete rootDirectory;
-	delete newDirectory;
+	if(success){
+		InvalidatePath(fullpath);
+	}
+	else{
+		cout << "Directory creation not success" << endl;
+	}
+	parentDirectoryFile->GetLock()->ReleaseWrite();
 
-	freeMap->WriteBack(freeMapFile);
-	delete freeMapFile;
-	delete freeMap;
-	delete hdr;
-	delete dirName;
+	if(parentDirectoryFile != directoryFile){
+		delete parentDirectoryFile;
+	}
+	delete parentDirectory;
 }
 
 //----------------------------------------------------------------------
-// FileSystem::Write
+// FileSystem::ExtendFile
 //  MP4 MODIFIED
-//	Copied from Previous Works
+//	Grow an open file to "newSize" bytes, taking any new blocks from
+//	the free map; called by OpenFile::WriteAt when writing past the
+//	end.  When new blocks are needed, the header and free map changes
+//	form one transaction; a write into blocks the file already owns
+//	just updates the length in the (cached) header.
+//	Return FALSE if the disk is full.
+//
+//	"hdr" -- the open file's header
+//	"newSize" -- the new length of the file
+//	"delay" -- leave the new blocks as holes, for delayed allocation
 //----------------------------------------------------------------------
-	
-int FileSystem::Write(char *buf, int len, int id){
-	OpenFile* of;
-	if(fileDescriptorTable[id-1]==NULL||(id-1)<0||(id-1)>=20){
-		return -1;
-	}
-	of = fileDescriptorTable[id-1];
-	int result;
-	result = of->Write(buf,len);
-	return result;
+
+bool FileSystem::ExtendFile(FileHeader *hdr, int newSize, bool delay)
+{
+	bool success;
+	bool nested = allocLock->IsHeldByCurrentThread();
+						// a directory growing inside
+						// Create, say
+
+	if (newSize <= hdr->AllocatedLength())
+		return hdr->Extend(freeMap, newSize);
+
+	journal->Begin();
+	if (!nested)
+		allocLock->Acquire();
+	success = hdr->Extend(freeMap, newSize, delay);
+	WriteFreeMap();
+	if (!nested)
+		allocLock->Release();
+	EndOperation();
+	return success;
 }
 
 //----------------------------------------------------------------------
-// FileSystem::Read
+// FileSystem::FillHoles
 //  MP4 MODIFIED
-//	Copied from Previous Works
+//	Give data blocks to the holes among blocks "from" to "to" of an
+//	open sparse file; called by OpenFile::WriteAt before writing
+//	them.  The header, index and free map changes form one
+//	transaction.  Return FALSE if the disk is full.
+//
+//	"hdr" -- the open file's header
+//	"from", "to" -- the first and last block about to be written
 //----------------------------------------------------------------------
 
-int FileSystem::Read(char *buf, int len, int id){
-	OpenFile* of;
-	if(fileDescriptorTable[id-1]==NULL||(id-1)<0||(id-1)>=20){
-		return -1;
-	}
-	of = fileDescriptorTable[id-1];
-	int result;
-	result = of->Read(buf,len);
-	return result;
+bool FileSystem::FillHoles(FileHeader *hdr, int from, int to)
+{
+	bool success;
+	bool nested = allocLock->IsHeldByCurrentThread();
+
+	journal->Begin();
+	if (!nested)
+		allocLock->Acquire();
+	success = hdr->FillHoles(freeMap, from, to);
+	WriteFreeMap();
+	if (!nested)
+		allocLock->Release();
+	EndOperation();
+	return success;
 }
 
 //----------------------------------------------------------------------
-// FileSystem::Close
+// FileSystem::ReserveBlocks
 //  MP4 MODIFIED
-//	Copied from Previous Works
+//	Set aside "count" free sectors for blocks an open file is holding
+//	back instead of allocating (see FileHeader::AddDelayed), so they
+//	are sure to get sectors when flushed.  Return FALSE if the disk
+//	is too full.
 //----------------------------------------------------------------------
 
-int FileSystem::Close(int id){
-	if(fileDescriptorTable[id-1]==NULL||(id-1)<0||(id-1)>=20){
-		return 0;
-	}
-	fileDescriptorTable[id-1]==NULL;
-	return 1;
+bool FileSystem::ReserveBlocks(int count)
+{
+	bool success;
+	bool nested = allocLock->IsHeldByCurrentThread();
+
+	if (!nested)
+		allocLock->Acquire();
+	success = freeMap->Reserve(count);
+	if (!nested)
+		allocLock->Release();
+	return success;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::FlushDelayed
+//  MP4 MODIFIED
+//	Give the blocks an open file is holding back their sectors, and
+//	write them.  As with FillHoles, the header, index and free map
+//	changes form one transaction.  The caller holds the file's lock.
+//
+//	"hdr" -- the open file's header
+//----------------------------------------------------------------------
+
+void FileSystem::FlushDelayed(FileHeader *hdr)
+{
+	bool nested = allocLock->IsHeldByCurrentThread();
+
+	if (hdr->NumDelayed() == 0)
+		return;
+	journal->Begin();
+	if (!nested)
+		allocLock->Acquire();
+	hdr->FlushDelayed(freeMap);
+	WriteFreeMap();
+	if (!nested)
+		allocLock->Release();
+	EndOperation();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::WriteChunk
+//  MP4 MODIFIED
+//	Store chunk "chunk" of an open compressed file, once OpenFile has
+//	changed it, in as many sectors as it now takes.  As with
+//	FillHoles, the data, header, index and free map changes form one
+//	transaction.  Return FALSE if the disk is full.
+//
+//	"hdr" -- the open file's header
+//	"chunk" -- the chunk changed
+//----------------------------------------------------------------------
+
+bool FileSystem::WriteChunk(FileHeader *hdr, int chunk)
+{
+	bool success;
+	bool nested = allocLock->IsHeldByCurrentThread();
+
+	journal->Begin();
+	if (!nested)
+		allocLock->Acquire();
+	success = hdr->WriteChunk(freeMap, chunk);
+	WriteFreeMap();
+	if (!nested)
+		allocLock->Release();
+	EndOperation();
+	return success;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::StoreBlock
+//  MP4 MODIFIED
+//	Store block "block" of an open deduplicated file, sharing a sector
+//	that holds the same bytes if there is one.  As with WriteChunk,
+//	the data, header, index, free map and share count changes form
+//	one transaction.  Return FALSE if the disk is full.
+//
+//	"hdr" -- the open file's header
+//	"block" -- the block written
+//	"data" -- its new contents
+//----------------------------------------------------------------------
+
+bool FileSystem::StoreBlock(FileHeader *hdr, int block, char *data)
+{
+	bool success;
+	bool nested = allocLock->IsHeldByCurrentThread();
+
+	journal->Begin();
+	if (!nested)
+		allocLock->Acquire();
+	success = hdr->StoreBlock(freeMap, dedup, block, data);
+	WriteFreeMap();
+	if (!nested)
+		allocLock->Release();
+	EndOperation();
+	return success;
 }
 
 #endif // FILESYS_STUB
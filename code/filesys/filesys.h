@@ -36,13 +36,21 @@
 #include "copyright.h"
 #include "sysdep.h"
 #include "openfile.h"
+#include "pbitmap.h"
+#include "directory.h"
+
+class Journal;
+class FileHeader;
+class DedupTable;
+class Lock;
+class Snapshot;
 
 #ifdef FILESYS_STUB 		// Temporarily implement file system calls as 
 				// calls to UNIX, until the real file system
 				// implementation is available
 class FileSystem {
   public:
-    FileSystem() { for (int i = 0; i < 20; i++) fileDescriptorTable[i] = NULL; }
+    FileSystem() {}
 
     bool Create(char *name) {
 	int fileDescriptor = OpenForWrite(name);
@@ -52,36 +60,6 @@ class FileSystem {
 	return TRUE; 
 	}
 	
-	int Write(char *buf, int len, int id){
-		OpenFile* of;
-		if(fileDescriptorTable[id-1]==NULL||(id-1)<0||(id-1)>=20){
-			return -1;
-		}
-		of = fileDescriptorTable[id-1];
-		int result;
-		result = of->Write(buf,len);
-		return result;
-	}
-
-	int Read(char *buf, int len, int id){
-		OpenFile* of;
-		if(fileDescriptorTable[id-1]==NULL||(id-1)<0||(id-1)>=20){
-			return -1;
-		}
-		of = fileDescriptorTable[id-1];
-		int result;
-		result = of->Read(buf,len);
-		return result;
-	}
-
-	int Close(int id){
-		if(fileDescriptorTable[id-1]==NULL||(id-1)<0||(id-1)>=20){
-			return 0;
-		}
-		fileDescriptorTable[id-1]==NULL;
-		return 1;
-	}
-
     OpenFile* Open(char *name) {
 	  int fileDescriptor = OpenForReadWrite(name, FALSE);
 
@@ -90,25 +68,60 @@ class FileSystem {
       }
 
     bool Remove(char *name) { return Unlink(name) == 0; }
-
-	OpenFile *fileDescriptorTable[20];
-	
 };
 
 #else // FILESYS
+
+#define PathMaxLen		255	// longest full path we accept
+#define NumPathCacheEntries	16	// directory paths kept resolved
+#define NumMissCacheEntries	16	// names known not to exist
+
+// An entry of the path cache: a directory path that has already been
+// resolved, and the sector holding that directory's file header.
+
+class PathCacheEntry {
+  public:
+    char path[PathMaxLen + 1];		// full path, "" if the entry is free
+    int sector;				// header sector of the directory
+    int lastUsed;			// for LRU replacement
+};
+
+// An entry of the miss cache: a name looked up in a directory and not
+// found there.  It is kept by the directory's header sector rather than
+// by path, so however the name is spelled, the Create or CreateDirectory
+// that adds it finds the entry to drop.  A directory that is removed
+// needs nothing dropped: if its sector is ever a directory again, that
+// directory starts out empty.
+
+class MissCacheEntry {
+  public:
+    int parent;				// header sector of the directory
+    					// searched, -1 if the entry is free
+    char name[FileNameMaxLen + 1];	// the name missing from it
+    int lastUsed;			// for LRU replacement
+};
+
 class FileSystem {
   public:
-    FileSystem(bool format);		// Initialize the file system.
+    FileSystem(bool format, int sectors = NumSectors);
+    					// Initialize the file system.
 					// Must be called *after* "synchDisk" 
 					// has been initialized.
     					// If "format", there is nothing on
 					// the disk, so initialize the directory
-    					// and the bitmap of free blocks.
+    					// and the bitmap of free blocks, for
+					// the first "sectors" of it.
 	// MP4 mod tag
 	~FileSystem();
 
-    bool Create(char *name, int initialSize);  	
-					// Create a file (UNIX creat)
+    bool Create(char *name, int initialSize, bool preallocate = FALSE,
+		bool compress = FALSE, bool deduplicate = FALSE);
+					// Create a file (UNIX creat);
+					//  "preallocate" gives it all its
+					//  blocks now, in one run;
+					//  "compress" stores it compressed;
+					//  "deduplicate" shares its sectors
+					//  with identical ones
 
     OpenFile* Open(char *name); 	// Open a file (UNIX open)
 
@@ -118,27 +131,96 @@ class FileSystem {
 
     void Print();			// List all the files and their contents
 
+    bool Check();			// Check the disk is consistent,
+					//  printing what is not
+    bool Verify(char *name, char *hostDir);
+    					// Checksum the files below directory
+					//  "name", comparing them with the
+					//  host files below "hostDir"
+    void Defragment();			// Move files into contiguous runs,
+					//  the most used nearest the start
+
     char* GetFileName(char *fullpath);
 
 	char* GetDirectoryName(char *fullpath);
 
 	bool CheckFileLength(char *fullpath);
 
-	void CreateDirectory(char *fullpath);
-
-	int Close(int id);
-
-	int Read(char *buf, int len, int id);
-
-	int Write(char *buf, int len, int id);
-
-	OpenFile *fileDescriptorTable[20];
+	void CreateDirectory(char *fullpath, bool indexed = FALSE);
+
+	bool ExtendFile(FileHeader *hdr, int newSize, bool delay = FALSE);
+					// Grow an open file, for OpenFile
+	bool FillHoles(FileHeader *hdr, int from, int to);
+					// Allocate blocks for the holes
+					//  an OpenFile is writing into
+	bool ReserveBlocks(int count);	// Promise free sectors to blocks
+					//  an OpenFile holds back
+	void FlushDelayed(FileHeader *hdr);
+					// Give those blocks sectors
+	bool WriteChunk(FileHeader *hdr, int chunk);
+					// Store a chunk of a compressed
+					//  file that an OpenFile changed
+	bool StoreBlock(FileHeader *hdr, int block, char *data);
+					// Store a block of a deduplicated
+					//  file that an OpenFile changed
+
+	bool TakeSnapshot();		// Freeze the disk as it is, to
+					//  roll back to (see snapshot.h)
+	bool Rollback();		// Put it back so, and drop the
+					//  snapshot; only with no file open
+	void DropSnapshot();		// Keep the changes, and drop it
 
   private:
    OpenFile* freeMapFile;		// Bit map of free disk blocks,
 					// represented as a file
    OpenFile* directoryFile;		// "Root" directory -- list of 
 					// file names, represented as a file
+   PersistentBitmap *freeMap;		// Resident copy of the free map,
+					// loaded once at mount; only its
+					// dirty sectors are written back
+   int numSectors;			// sectors the file system covers,
+   					// as the superblock records
+   Journal *journal;			// makes each operation's metadata
+   					// writes atomic
+   Lock *allocLock;			// held while the free map changes
+   bool mapUnwritten;			// is the bitmap on disk still the
+   					// garbage a format left there?
+   DedupTable *dedup;			// sectors deduplicated files share,
+   					// kept with the free map
+   Snapshot *snapshot;			// to roll back to, or NULL
+
+   PathCacheEntry pathCache[NumPathCacheEntries];
+   					// recently resolved directory paths
+   MissCacheEntry missCache[NumMissCacheEntries];
+   					// recent lookups that found nothing
+   int pathClock;			// bumped on every path or miss
+   					// cache access
+
+   int ResolveDirectory(char *path);	// Header sector of directory "path",
+					// walking it one component at a time
+   int ResolveParent(char *fullpath);	// Header sector of the directory
+					// holding "fullpath"
+   void InvalidatePath(char *path);	// Drop "path" and everything
+					// below it from the path cache
+   void CachePath(char *path, int sector);
+   					// Remember a resolved path
+   bool IsMissing(int parent, char *name);
+   					// Is "name" known not to be there?
+   void NoteMissing(int parent, char *name);
+   					// Remember that it isn't
+   void ForgetMissing(int parent, char *name);
+   					// It has just been added
+   void ForgetPaths();			// Empty the path and miss caches
+   void WriteFreeMap();			// Write the changed part of the
+   					// free map back to disk
+   void EndOperation();			// journal->End, then discard the
+   					// sectors freed, once committed
+   void RebuildFreeMap();		// Work out an unwritten free map
+   bool DefragmentFile(int sector, bool hot);
+   					// Move one file, if that helps
+   void CollectTree(int sector, Bitmap *doomed);
+   					// Mark all below a directory, for
+					// a recursive Remove to free
 };
 
 #endif // FILESYS
@@ -0,0 +1,322 @@
+// fsbench.cc
+//	Routines to benchmark the file system with a fixed set of
+//	workloads.  See fsbench.h.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+#ifndef FILESYS_STUB
+
+#include "copyright.h"
+#include "debug.h"
+#include "sysdep.h"
+#include "fsbench.h"
+#include "filesys.h"
+#include "openfile.h"
+#include "synchdisk.h"
+#include "main.h"
+
+#define BenchDir	"/bench"
+#define BenchFile	"/bench/seq"
+
+//----------------------------------------------------------------------
+// FileSystemBench::FileSystemBench
+// 	Initialize the benchmark; nothing is measured until Run.
+//----------------------------------------------------------------------
+
+FileSystemBench::FileSystemBench()
+{
+    name = NULL;
+    startTicks = startReads = startWrites = 0;
+    startHits = startMisses = 0;
+    startTime = 0;
+}
+
+//----------------------------------------------------------------------
+// FileSystemBench::Run
+// 	Run one workload, or all of them, in a fresh /bench directory,
+//	and remove the directory again.
+//
+//	"which" -- seqwrite, seqread, randread, smallfiles, deeppath,
+//		tree, or all
+//----------------------------------------------------------------------
+
+void
+FileSystemBench::Run(char *which)
+{
+    bool all = (strcmp(which, "all") == 0);
+    bool found = all;
+    bool snapped;
+
+    (void) kernel->fileSystem->Remove(BenchDir, TRUE);	// an old run's
+    snapped = kernel->fileSystem->TakeSnapshot();
+    kernel->fileSystem->CreateDirectory(BenchDir);
+    RandomInit(1);		// every run reads the same random offsets
+
+    printf("%-10s %10s %7s %7s %6s %9s\n", "workload", "ticks", "reads",
+		"writes", "hits", "host secs");
+    if (all || strcmp(which, "seqwrite") == 0) {
+	SequentialWrite();
+	found = TRUE;
+    }
+    if (all || strcmp(which, "seqread") == 0) {
+	SequentialRead();
+	found = TRUE;
+    }
+    if (all || strcmp(which, "randread") == 0) {
+	RandomRead();
+	found = TRUE;
+    }
+    if (all || strcmp(which, "smallfiles") == 0) {
+	SmallFiles();
+	found = TRUE;
+    }
+    if (all || strcmp(which, "deeppath") == 0) {
+	DeepPath();
+	found = TRUE;
+    }
+    if (all || strcmp(which, "tree") == 0) {
+	Tree();
+	found = TRUE;
+    }
+    if (!found)
+	printf("Bench: no workload %s\n", which);
+
+    if (!snapped || !kernel->fileSystem->Rollback()) {
+	kernel->fileSystem->DropSnapshot();
+	(void) kernel->fileSystem->Remove(BenchDir, TRUE);
+    }
+    kernel->synchDisk->Flush();
+}
+
+//----------------------------------------------------------------------
+// FileSystemBench::Start
+// 	Flush what earlier work left in the cache, then note the
+//	counters at the start of "workload".
+//----------------------------------------------------------------------
+
+void
+FileSystemBench::Start(char *workload)
+{
+    kernel->synchDisk->Flush();
+    name = workload;
+    startTicks = kernel->stats->totalTicks;
+    startReads = kernel->stats->numDiskReads;
+    startWrites = kernel->stats->numDiskWrites;
+    startHits = kernel->stats->numCacheHits;
+    startMisses = kernel->stats->numCacheMisses;
+    startTime = WallClock();
+}
+
+//----------------------------------------------------------------------
+// FileSystemBench::Stop
+// 	Flush the workload's writes, and print what it took.
+//----------------------------------------------------------------------
+
+void
+FileSystemBench::Stop()
+{
+    int hits, lookups;
+
+    kernel->synchDisk->Flush();
+    hits = kernel->stats->numCacheHits - startHits;
+    lookups = hits + kernel->stats->numCacheMisses - startMisses;
+    printf("%-10s %10d %7d %7d %5.1f%% %9.3f\n", name,
+		kernel->stats->totalTicks - startTicks,
+		kernel->stats->numDiskReads - startReads,
+		kernel->stats->numDiskWrites - startWrites,
+		lookups > 0 ? 100.0 * hits / lookups : 0.0,
+		WallClock() - startTime);
+}
+
+//----------------------------------------------------------------------
+// FileSystemBench::MakeFile
+// 	Write the file the read workloads read, unless seqwrite already
+//	has.  This is not measured.
+//----------------------------------------------------------------------
+
+void
+FileSystemBench::MakeFile()
+{
+    OpenFile *file = kernel->fileSystem->Open(BenchFile);
+    char buf[BenchChunkSize];
+
+    if (file != NULL) {
+	delete file;
+	return;
+    }
+    bzero(buf, sizeof(buf));
+    ASSERT(kernel->fileSystem->Create(BenchFile, 0));
+    file = kernel->fileSystem->Open(BenchFile);
+    for (int done = 0; done < BenchFileSize; done += BenchChunkSize)
+	(void) file->Write(buf, BenchChunkSize);
+    delete file;
+}
+
+//----------------------------------------------------------------------
+// FileSystemBench::SequentialWrite
+// 	Create an empty file and append BenchFileSize bytes to it, a
+//	chunk at a time.
+//----------------------------------------------------------------------
+
+void
+FileSystemBench::SequentialWrite()
+{
+    char buf[BenchChunkSize];
+    OpenFile *file;
+
+    for (int i = 0; i < BenchChunkSize; i++)
+	buf[i] = 'a' + i % 26;
+    (void) kernel->fileSystem->Remove(BenchFile, FALSE);
+
+    Start("seqwrite");
+    if (!kernel->fileSystem->Create(BenchFile, 0)) {
+	printf("Bench: couldn't create %s\n", BenchFile);
+	return;
+    }
+    file = kernel->fileSystem->Open(BenchFile);
+    for (int done = 0; done < BenchFileSize; done += BenchChunkSize)
+	(void) file->Write(buf, BenchChunkSize);
+    delete file;
+    Stop();
+}
+
+//----------------------------------------------------------------------
+// FileSystemBench::SequentialRead
+// 	Read the whole file back, a chunk at a time.
+//----------------------------------------------------------------------
+
+void
+FileSystemBench::SequentialRead()
+{
+    char buf[BenchChunkSize];
+    OpenFile *file;
+
+    MakeFile();
+    Start("seqread");
+    file = kernel->fileSystem->Open(BenchFile);
+    while (file->Read(buf, BenchChunkSize) > 0)
+	;
+    delete file;
+    Stop();
+}
+
+//----------------------------------------------------------------------
+// FileSystemBench::RandomRead
+// 	Read BenchSmallSize bytes at BenchSmallReads random offsets of
+//	the file.
+//----------------------------------------------------------------------
+
+void
+FileSystemBench::RandomRead()
+{
+    char buf[BenchSmallSize];
+    OpenFile *file;
+
+    MakeFile();
+    Start("randread");
+    file = kernel->fileSystem->Open(BenchFile);
+    for (int i = 0; i < BenchSmallReads; i++) {
+	int offset = RandomNumber() % (BenchFileSize - BenchSmallSize);
+
+	(void) file->ReadAt(buf, BenchSmallSize, offset);
+    }
+    delete file;
+    Stop();
+}
+
+//----------------------------------------------------------------------
+// FileSystemBench::SmallFiles
+// 	Create, write and remove BenchSmallFiles small files in one
+//	directory, BenchSmallRounds times over.
+//----------------------------------------------------------------------
+
+void
+FileSystemBench::SmallFiles()
+{
+    char path[32], buf[BenchSmallSize];
+    OpenFile *file;
+
+    memset(buf, 'x', sizeof(buf));
+    Start("smallfiles");
+    for (int round = 0; round < BenchSmallRounds; round++) {
+	for (int i = 0; i < BenchSmallFiles; i++) {
+	    sprintf(path, "%s/s%d", BenchDir, i);
+	    if (!kernel->fileSystem->Create(path, 0))
+		continue;
+	    file = kernel->fileSystem->Open(path);
+	    (void) file->Write(buf, sizeof(buf));
+	    delete file;
+	}
+	for (int i = 0; i < BenchSmallFiles; i++) {
+	    sprintf(path, "%s/s%d", BenchDir, i);
+	    (void) kernel->fileSystem->Remove(path, FALSE);
+	}
+    }
+    Stop();
+}
+
+//----------------------------------------------------------------------
+// FileSystemBench::DeepPath
+// 	Open a file BenchDepth directories down, BenchLookups times.
+//	Making the directories is not measured.
+//----------------------------------------------------------------------
+
+void
+FileSystemBench::DeepPath()
+{
+    char path[BenchDepth * 4 + 16];
+    int length;
+
+    strcpy(path, BenchDir);
+    for (int i = 0; i < BenchDepth; i++) {
+	length = strlen(path);
+	sprintf(&path[length], "/p%d", i);
+	kernel->fileSystem->CreateDirectory(path);
+    }
+    strcat(path, "/f");
+    (void) kernel->fileSystem->Create(path, 0);
+
+    Start("deeppath");
+    for (int i = 0; i < BenchLookups; i++) {
+	OpenFile *file = kernel->fileSystem->Open(path);
+
+	ASSERT(file != NULL);
+	delete file;
+    }
+    Stop();
+}
+
+//----------------------------------------------------------------------
+// FileSystemBench::Tree
+// 	Make a tree two levels deep, BenchFanout directories wide, with
+//	a file in every leaf; list it recursively, then remove it
+//	recursively.  Only the list and the remove are measured.
+//----------------------------------------------------------------------
+
+void
+FileSystemBench::Tree()
+{
+    char path[64];
+
+    sprintf(path, "%s/t", BenchDir);
+    kernel->fileSystem->CreateDirectory(path);
+    for (int i = 0; i < BenchFanout; i++) {
+	sprintf(path, "%s/t/a%d", BenchDir, i);
+	kernel->fileSystem->CreateDirectory(path);
+	for (int j = 0; j < BenchFanout; j++) {
+	    sprintf(path, "%s/t/a%d/b%d", BenchDir, i, j);
+	    kernel->fileSystem->CreateDirectory(path);
+	    strcat(path, "/f");
+	    (void) kernel->fileSystem->Create(path, 0);
+	}
+    }
+
+    sprintf(path, "%s/t", BenchDir);
+    Start("tree");
+    kernel->fileSystem->List(path, TRUE);
+    (void) kernel->fileSystem->Remove(path, TRUE);
+    Stop();
+}
+
+#endif //FILESYS_STUB
@@ -0,0 +1,70 @@
+// fsbench.h
+//	Data structures for benchmarking the file system with a fixed
+//	set of workloads (nachos -B), so that changes to the file system
+//	can be compared against a baseline.
+//
+//	Each workload goes through the FileSystem and OpenFile interface,
+//	like a user program would, and is reported as the simulated
+//	ticks it took, the disk reads and writes it caused, the cache
+//	hit rate, and the host time Nachos needed to simulate it.  The
+//	cache is flushed before and after each workload, so every write
+//	it makes is counted against it.
+//
+//	The workloads run in the directory /bench, which is created for
+//	the run; the disk needs that much room.  Afterwards the disk is
+//	rolled back to a snapshot taken before (see snapshot.h), so a run
+//	leaves even the free map as it found it, and the next run lays
+//	its files out the same way.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef FSBENCH_H
+#define FSBENCH_H
+
+#include "copyright.h"
+
+#define BenchFileSize		(32 * 1024)	// file for the sequential and
+						// random workloads
+#define BenchChunkSize		1024		// bytes per sequential transfer
+#define BenchSmallReads		512		// random reads
+#define BenchSmallSize		128		// bytes per random read
+#define BenchSmallFiles		32		// files per create/delete round
+#define BenchSmallRounds	4
+#define BenchDepth		8		// directories in the deep path
+#define BenchLookups		256		// opens of the deep path
+#define BenchFanout		3		// subdirectories per directory
+						// in the tree workload
+
+// The following class runs the workloads and prints one line of
+// results for each.
+
+class FileSystemBench {
+  public:
+    FileSystemBench();
+
+    void Run(char *which);		// Run the workload named "which",
+					// or all of them if "all"
+
+  private:
+    char *name;				// the workload being measured
+    int startTicks;			// and the counters when it began
+    int startReads, startWrites;
+    int startHits, startMisses;
+    double startTime;
+
+    void Start(char *workload);		// Begin measuring a workload
+    void Stop();			// Print what it took
+
+    void MakeFile();			// Create the sequential file, if
+					// it is not there
+    void SequentialWrite();
+    void SequentialRead();
+    void RandomRead();
+    void SmallFiles();
+    void DeepPath();
+    void Tree();
+};
+
+#endif // FSBENCH_H
@@ -0,0 +1,466 @@
+// fsck.cc
+//	Routines to check the consistency of a Nachos disk: walk the
+//	directory tree reading only header and index sectors, in sweeps
+//	of ascending sector order, claim every sector a file uses, and
+//	compare the claims with the free map.
+//
+//	Problems reported:
+//	   a header whose sizes make no sense
+//	   a pointer (or a directory entry) to a sector off the disk
+//	   a sector claimed twice, by two files or twice by one
+//	   a sector in use but marked free in the free map
+//	   a sector marked in use that no file owns (a leak)
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+#ifndef FILESYS_STUB
+
+#include "copyright.h"
+#include "debug.h"
+#include "fsck.h"
+#include "directory.h"
+#include "diriter.h"
+#include "synchdisk.h"
+#include "journal.h"
+#include "dedup.h"
+#include "main.h"
+
+//----------------------------------------------------------------------
+// CheckedFile::CheckedFile
+// 	Remember a file found by the walk.  Its header is read later.
+//
+//	"headerSector" -- where its header should be
+//	"fullPath" -- its name, allocated by the caller; we free it
+//	"fileType" -- DIR or FILE, according to its directory entry
+//----------------------------------------------------------------------
+
+CheckedFile::CheckedFile(int headerSector, char *fullPath, int fileType)
+{
+    sector = headerSector;
+    path = fullPath;
+    type = fileType;
+    ok = TRUE;
+}
+
+CheckedFile::~CheckedFile()
+{
+    delete [] path;
+}
+
+//----------------------------------------------------------------------
+// FileSystemChecker::FileSystemChecker
+// 	Initialize a checker: nothing claimed, nothing read.
+//
+//	"freeMap" -- the free map the claims are compared with
+//	"dedup" -- the share counts they are compared with
+//	"hasJournal" -- does the disk have a log region?
+//----------------------------------------------------------------------
+
+FileSystemChecker::FileSystemChecker(PersistentBitmap *freeMap,
+					DedupTable *dedup, bool hasJournal)
+{
+    this->freeMap = freeMap;
+    this->dedup = dedup;
+    this->hasJournal = hasJournal;
+    image = new char[NumSectors * SectorSize];
+    for (int i = 0; i < NumSectors; i++) {
+	wanted[i] = FALSE;
+	owner[i] = NoOwner;
+	sharers[i] = 0;
+	pathOf[i] = NULL;
+    }
+    level = new List<CheckedFile *>;
+    nextLevel = new List<CheckedFile *>;
+    checked = new List<CheckedFile *>;
+    numProblems = 0;
+    numFiles = 0;
+    numDirectories = 0;
+    numRead = 0;
+    walker = new DirIterator(TRUE, FALSE);
+}
+
+//----------------------------------------------------------------------
+// FileSystemChecker::~FileSystemChecker
+// 	De-allocate the checker, and every file it found.
+//----------------------------------------------------------------------
+
+FileSystemChecker::~FileSystemChecker()
+{
+    while (!checked->IsEmpty())
+	delete checked->RemoveFront();
+    delete checked;
+    delete walker;
+    delete nextLevel;
+    delete level;
+    delete [] image;
+}
+
+//----------------------------------------------------------------------
+// FileSystemChecker::AddRoot
+// 	Start the walk at a file whose header is in a well-known sector.
+//
+//	"sector" -- its header sector
+//	"path" -- its name in the report
+//	"type" -- DIR to check what it lists too, FILE otherwise
+//----------------------------------------------------------------------
+
+void
+FileSystemChecker::AddRoot(int sector, char *path, int type)
+{
+    char *copy = new char[strlen(path) + 1];
+
+    strcpy(copy, path);
+    nextLevel->Append(new CheckedFile(sector, copy, type));
+}
+
+//----------------------------------------------------------------------
+// FileSystemChecker::Check
+// 	Check every level of the directory tree, then the log region,
+//	then compare what was found with the free map.  Prints each
+//	problem and a summary.
+//----------------------------------------------------------------------
+
+bool
+FileSystemChecker::Check()
+{
+    List<CheckedFile *> *swap;
+
+    while (!nextLevel->IsEmpty()) {
+	swap = level;
+	level = nextLevel;
+	nextLevel = swap;
+	CheckLevel();
+    }
+
+    if (hasJournal) {
+	for (int i = LogSector; i < LogSector + LogSize; i++) {
+	    if (owner[i] != NoOwner) {
+		printf("Sector %d of the journal is also used by %s\n",
+			i, pathOf[owner[i]]);
+		numProblems++;
+	    } else
+		owner[i] = LogOwner;
+	}
+    }
+    CompareFreeMap();
+
+    printf("Checked %d files and %d directories, reading %d sectors: ",
+		numFiles, numDirectories, numRead);
+    if (numProblems == 0)
+	printf("no problems\n");
+    else
+	printf("%d problems\n", numProblems);
+    return numProblems == 0;
+}
+
+//----------------------------------------------------------------------
+// FileSystemChecker::ReadWanted
+// 	Read every wanted sector into "image".  The requests are queued
+//	in ascending sector order before waiting for any of them, so the
+//	disk serves them in one sweep.
+//----------------------------------------------------------------------
+
+void
+FileSystemChecker::ReadWanted()
+{
+    DiskRequest **requests = new DiskRequest *[NumSectors];
+    int n = 0;
+
+    for (int i = 0; i < NumSectors; i++) {
+	if (wanted[i]) {
+	    wanted[i] = FALSE;
+	    requests[n++] = kernel->synchDisk->ReadSectorAsync(i,
+						&image[i * SectorSize]);
+	}
+    }
+    for (int i = 0; i < n; i++)
+	kernel->synchDisk->WaitFor(requests[i]);
+    DEBUG(dbgFile, "Checker read " << n << " sectors in one sweep");
+    numRead += n;
+    delete [] requests;
+}
+
+//----------------------------------------------------------------------
+// FileSystemChecker::Claim
+// 	Record that "sector" belongs to "file".  Reports a sector off
+//	the disk, or one that already belongs to someone.
+//
+//	"what" -- what the sector is to the file, for the report
+//----------------------------------------------------------------------
+
+bool
+FileSystemChecker::Claim(int sector, CheckedFile *file, char *what)
+{
+    if (sector < 0 || sector >= freeMap->NumBits()) {
+	printf("%s: %s %d is not on the disk\n", file->path, what, sector);
+	numProblems++;
+	return FALSE;
+    }
+    if (owner[sector] != NoOwner) {
+	printf("%s: %s %d is also used by %s\n", file->path, what, sector,
+		OwnerName(owner[sector]));
+	numProblems++;
+	return FALSE;
+    }
+    owner[sector] = file->sector;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileSystemChecker::ClaimBlock
+// 	Record that data block "sector" belongs to "file".  A block of a
+//	deduplicated file may point at a sector that already belongs to
+//	someone, as long as the share count allows one more.
+//----------------------------------------------------------------------
+
+bool
+FileSystemChecker::ClaimBlock(int sector, CheckedFile *file)
+{
+    if (file->hdr.IsDeduplicated() && sector >= 0 && sector < NumSectors &&
+		owner[sector] != NoOwner && sharers[sector] < dedup->Shares(sector)) {
+	sharers[sector]++;
+	return TRUE;
+    }
+    return Claim(sector, file, "block");
+}
+
+//----------------------------------------------------------------------
+// FileSystemChecker::OwnerName
+// 	Return a printable name for the owner of a claimed sector.
+//----------------------------------------------------------------------
+
+char *
+FileSystemChecker::OwnerName(int who)
+{
+    if (who == LogOwner)
+	return "the journal";
+    return pathOf[who];
+}
+
+//----------------------------------------------------------------------
+// FileSystemChecker::CheckLevel
+// 	Check the files of one level of the tree, in three sweeps: their
+//	headers, then their single and double indirect sectors, then the
+//	second level of the double indirect ones.  Then claim their data
+//	blocks and queue what the sound directories list.
+//----------------------------------------------------------------------
+
+void
+FileSystemChecker::CheckLevel()
+{
+    ListIterator<CheckedFile *> *iter;
+    CheckedFile *file;
+    int blocks, j;
+
+    iter = new ListIterator<CheckedFile *>(level);
+    for (; !iter->IsDone(); iter->Next())
+	wanted[iter->Item()->sector] = TRUE;
+    delete iter;
+    ReadWanted();
+
+    iter = new ListIterator<CheckedFile *>(level);
+    for (; !iter->IsDone(); iter->Next()) {
+	file = iter->Item();
+	if (!Claim(file->sector, file, "header")) {
+	    file->ok = FALSE;		// a second name for a file,
+	    continue;			// or a loop: check it only once
+	}
+	pathOf[file->sector] = file->path;
+	file->hdr.Unpack(&image[file->sector * SectorSize]);
+	file->ok = CheckHeader(file);
+	if (file->type == DIR)
+	    numDirectories++;
+	else
+	    numFiles++;
+	if (!file->ok)
+	    continue;
+
+	blocks = file->hdr.NumBlocks();
+	if (blocks > NumDirectBlocks) {
+	    if (Claim(file->hdr.DataPointer(SingleIndirect), file,
+			"single indirect sector"))
+		wanted[file->hdr.DataPointer(SingleIndirect)] = TRUE;
+	    else
+		file->ok = FALSE;
+	}
+	if (blocks > NumDirectBlocks + NumIndirect) {
+	    if (Claim(file->hdr.DataPointer(DoubleIndirect), file,
+			"double indirect sector"))
+		wanted[file->hdr.DataPointer(DoubleIndirect)] = TRUE;
+	    else
+		file->ok = FALSE;
+	}
+    }
+    delete iter;
+    ReadWanted();
+
+    iter = new ListIterator<CheckedFile *>(level);
+    for (; !iter->IsDone(); iter->Next()) {
+	file = iter->Item();
+	blocks = file->hdr.NumBlocks() - NumDirectBlocks - NumIndirect;
+	if (!file->ok || blocks <= 0)
+	    continue;
+	int *top = Sector(file->hdr.DataPointer(DoubleIndirect));
+	for (j = 0; j < divRoundUp(blocks, NumIndirect); j++) {
+	    if (Claim(top[j], file, "index sector"))
+		wanted[top[j]] = TRUE;
+	    else
+		file->ok = FALSE;
+	}
+    }
+    delete iter;
+    ReadWanted();
+
+    while (!level->IsEmpty()) {
+	file = level->RemoveFront();
+	checked->Append(file);
+	if (file->ok)
+	    ClaimBlocks(file);
+	if (file->ok && file->type == DIR)
+	    ScanDirectory(file);
+    }
+}
+
+//----------------------------------------------------------------------
+// FileSystemChecker::CheckHeader
+// 	Check that the sizes in a header agree with each other and with
+//	the layout described in filehdr.h.
+//----------------------------------------------------------------------
+
+bool
+FileSystemChecker::CheckHeader(CheckedFile *file)
+{
+    int length = file->hdr.FileLength();
+    int blocks = file->hdr.NumBlocks();
+
+    if (length < 0 || length > MaxFileSize ||
+		blocks < 0 || blocks > MaxFileBlocks ||
+		(blocks == 0 && length > MaxInlineSize) ||
+		(blocks > 0 && length > blocks * SectorSize)) {
+	printf("%s: bad header in sector %d (%d bytes in %d blocks)\n",
+		file->path, file->sector, length, blocks);
+	numProblems++;
+	return FALSE;
+    }
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileSystemChecker::ClaimBlocks
+// 	Claim every data block of a file, from its header and from the
+//	index sectors read by the sweeps.  Holes (-1) own nothing.
+//----------------------------------------------------------------------
+
+void
+FileSystemChecker::ClaimBlocks(CheckedFile *file)
+{
+    int blocks = file->hdr.NumBlocks();
+    int block, i;
+    int *index, *top = NULL;
+
+    for (block = 0; block < blocks && block < NumDirectBlocks; block++) {
+	if (file->hdr.DataPointer(block) != -1 &&
+		!ClaimBlock(file->hdr.DataPointer(block), file))
+	    file->ok = FALSE;
+    }
+    if (block < blocks) {
+	index = Sector(file->hdr.DataPointer(SingleIndirect));
+	for (i = 0; i < NumIndirect && block < blocks; i++, block++) {
+	    if (index[i] != -1 && !ClaimBlock(index[i], file))
+		file->ok = FALSE;
+	}
+    }
+    if (block < blocks)
+	top = Sector(file->hdr.DataPointer(DoubleIndirect));
+    for (int j = 0; block < blocks; j++) {
+	index = Sector(top[j]);
+	for (i = 0; i < NumIndirect && block < blocks; i++, block++) {
+	    if (index[i] != -1 && !ClaimBlock(index[i], file))
+		file->ok = FALSE;
+	}
+    }
+}
+
+//----------------------------------------------------------------------
+// FileSystemChecker::ScanDirectory
+// 	Read a sound directory and queue every entry it lists for the
+//	next level.  The contents are read with a DirIterator, so both
+//	formats are understood; their blocks have already been claimed.
+//	The checker does its own descending, a level at a time, so the
+//	iterator is only ever asked for one directory.
+//----------------------------------------------------------------------
+
+void
+FileSystemChecker::ScanDirectory(CheckedFile *dir)
+{
+    char *name;
+    int sector, type;
+    char *path;
+
+    walker->Start(dir->sector);
+    while (walker->Next()) {
+	name = walker->Name();
+	sector = walker->Sector();
+	type = walker->Type();
+	path = new char[strlen(dir->path) + strlen(name) + 2];
+	strcpy(path, dir->path);
+	if (strcmp(dir->path, "/") != 0)
+	    strcat(path, "/");
+	strcat(path, name);
+
+	if ((type != DIR && type != FILE) ||
+		sector < 0 || sector >= freeMap->NumBits()) {
+	    printf("%s: orphaned entry (type %d, header sector %d)\n",
+			path, type, sector);
+	    numProblems++;
+	    delete [] path;
+	    continue;
+	}
+	nextLevel->Append(new CheckedFile(sector, path, type));
+    }
+}
+
+//----------------------------------------------------------------------
+// FileSystemChecker::CompareFreeMap
+// 	Compare the sectors claimed with those the free map marks in use,
+//	and the blocks sharing each sector with its share count.  Leaked
+//	sectors are reported a run at a time.
+//----------------------------------------------------------------------
+
+void
+FileSystemChecker::CompareFreeMap()
+{
+    int leakStart = -1;
+
+    for (int i = 0; i <= NumSectors; i++) {
+	bool used = i < NumSectors && owner[i] != NoOwner;
+	bool marked = i < freeMap->NumBits() && freeMap->Test(i);
+
+	if (used && !marked) {
+	    printf("Sector %d is used by %s but marked free\n",
+			i, OwnerName(owner[i]));
+	    numProblems++;
+	}
+	if (i < NumSectors && sharers[i] != dedup->Shares(i)) {
+	    printf("Sector %d is shared by %d more blocks, but counted as %d\n",
+			i, sharers[i], dedup->Shares(i));
+	    numProblems++;
+	}
+	if (!used && marked) {
+	    if (leakStart == -1)
+		leakStart = i;
+	} else if (leakStart != -1) {
+	    if (leakStart == i - 1)
+		printf("Sector %d is marked in use but owned by no file\n",
+			leakStart);
+	    else
+		printf("Sectors %d-%d are marked in use but owned by no file\n",
+			leakStart, i - 1);
+	    numProblems++;
+	    leakStart = -1;
+	}
+    }
+}
+
+#endif //FILESYS_STUB
@@ -0,0 +1,111 @@
+// fsck.h
+//	Data structures for checking the consistency of a Nachos disk:
+//	every sector must belong to exactly one file (or to the journal)
+//	and be marked in use in the free map, or belong to nothing and be
+//	marked free.  The exception is a data sector deduplicated files
+//	share (see dedup.h), which must have as many more blocks pointing
+//	at it as its share count says.
+//
+//	The checker walks the directory tree one level at a time.  For
+//	each level it gathers the header sectors it must read, then the
+//	index sectors those headers point at, and reads each batch as a
+//	single ascending sweep of the disk, all requests queued at once.
+//	Data blocks are never read, only claimed; the expected free map
+//	built from the claims is then compared with the stored one.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef FSCK_H
+#define FSCK_H
+
+#include "copyright.h"
+#include "disk.h"
+#include "list.h"
+#include "pbitmap.h"
+#include "filehdr.h"
+
+class DirIterator;
+class DedupTable;
+
+#define NoOwner		-1		// sector claimed by nothing so far
+#define LogOwner	-2		// sector of the journal's log region
+
+// A file (or directory) found by the walk, waiting to be checked.
+
+class CheckedFile {
+  public:
+    CheckedFile(int headerSector, char *fullPath, int fileType);
+    ~CheckedFile();
+
+    int sector;				// its header sector
+    int type;				// DIR or FILE
+    char *path;				// its full name, for the report
+    bool ok;				// nothing wrong with it found yet
+    FileHeader hdr;			// its header, once read
+};
+
+// The following class checks a whole disk.  The caller names the
+// files the walk starts from (the free map and the root directory),
+// since their headers are in well-known sectors, then calls Check.
+
+class FileSystemChecker {
+  public:
+    FileSystemChecker(PersistentBitmap *freeMap, DedupTable *dedup,
+		bool hasJournal);
+    					// Check against "freeMap" and the
+					// share counts in "dedup"; the
+					// log region is in use if
+					// "hasJournal"
+    ~FileSystemChecker();
+
+    void AddRoot(int sector, char *path, int type);
+    					// Start the walk at this file
+    bool Check();			// Walk the disk and print every
+					// problem; TRUE if there is none
+
+  private:
+    PersistentBitmap *freeMap;		// the free map being checked
+    DedupTable *dedup;			// and the share counts
+    bool hasJournal;			// is the log region in use?
+    char *image;			// a copy of every sector read
+    bool wanted[NumSectors];		// sectors the next sweep reads
+    int owner[NumSectors];		// header sector of the file each
+					// sector belongs to, or NoOwner,
+					// or LogOwner
+    int sharers[NumSectors];		// blocks of deduplicated files
+					// claiming each sector after its
+					// owner did
+    char *pathOf[NumSectors];		// name of the file whose header
+					// is in each sector, else NULL
+    List<CheckedFile *> *level;		// files of the level being checked
+    List<CheckedFile *> *nextLevel;	// files they list, for the next one
+    List<CheckedFile *> *checked;	// every file seen, freed at the end
+    int numProblems;
+    int numFiles, numDirectories;
+    int numRead;			// sectors read by the sweeps
+    DirIterator *walker;		// reads each directory's entries
+
+    int *Sector(int n) { return (int *) &image[n * SectorSize]; }
+    void ReadWanted();			// Sweep: read every wanted sector
+    bool Claim(int sector, CheckedFile *file, char *what);
+    					// Make "sector" part of "file";
+					// FALSE (and report) if it can't be
+    bool ClaimBlock(int sector, CheckedFile *file);
+    					// The same for a data block, which
+					// may be shared
+    char *OwnerName(int who);		// For the report
+    void CheckLevel();			// Check every file in "level"
+    bool CheckHeader(CheckedFile *file);
+    					// Are the header's sizes sane?
+    void ClaimBlocks(CheckedFile *file);
+    					// Claim the file's data blocks
+    void ScanDirectory(CheckedFile *dir);
+    					// Queue its entries for nextLevel
+    void CompareFreeMap();		// Report the differences between
+					// the claims and the free map, or
+					// the share counts
+};
+
+#endif // FSCK_H
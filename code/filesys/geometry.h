@@ -0,0 +1,88 @@
+// geometry.h
+//	The layout of the Nachos file system on disk, in one place: how
+//	a file header maps blocks, how big a file can be, how big the
+//	free map is, and how many entries a directory table starts with.
+//
+//	The header layout follows from the sector size alone (SectorSize,
+//	in disk.h): a header is one sector, and every in-core copy of a
+//	sector, header or not, is an array of that size.  So it is fixed
+//	when Nachos is compiled, and array bounds and loops over index
+//	sectors are sized by the compiler.  Whether it holds together is
+//	checked at compile time too (GeometryCheck), not at the first
+//	format.
+//
+//	The size of the file system is not: a format can leave out the
+//	end of the disk (nachos -fsize), and the sector count it chose
+//	is kept in the superblock.  The free map is sized from that at
+//	mount, by FreeMapFileSize.  NumSectors is only the most a disk
+//	can have.  A disk formatted for another sector size or header
+//	layout is refused at mount (see superblock.h).
+//
+//	A few choices are left to a profile, picked by defining one of
+//	these when compiling:
+//
+//		(none)		the default: 64 entry directory tables
+//		FS_MANY_FILES	directories of hundreds of files: larger
+//				tables, so a big directory isn't grown a
+//				few entries at a time
+//
+//	The sector size is not a profile: it is the disk's, and the MIPS
+//	page size is the same, so it can only change with both.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include "copyright.h"
+#include "disk.h"
+#include "bitmap.h"
+
+// A file header is one sector: its length, its block count, and the
+// rest of the sector as sector pointers.  The first NumDirectBlocks
+// point at data, the last two at a single and a double indirect index
+// sector (see filehdr.h).
+
+const int NumDirect = (SectorSize - 2 * (int) sizeof(int)) / (int) sizeof(int);
+					// sector pointers in the header
+const int NumIndirect = SectorSize / (int) sizeof(int);
+					// sector pointers in an index sector
+const int NumDirectBlocks = NumDirect - 2;
+					// blocks the header points at itself
+const int SingleIndirect = NumDirect - 2;	// dataSectors[] slot of the
+const int DoubleIndirect = NumDirect - 1;	// single and double indirect
+						// index sectors
+const int MaxFileBlocks = NumDirectBlocks + NumIndirect
+			    + NumIndirect * NumIndirect;
+const int MaxFileSize = MaxFileBlocks * SectorSize;
+const int MaxInlineSize = NumDirect * (int) sizeof(int);
+					// bytes kept in the header itself
+
+// The free map file starts with one bit per sector of the file
+// system, in whole words, as the bitmap is kept in core.
+
+inline int FreeMapFileSize(int sectors)
+	{ return divRoundUp(sectors, BitsInWord) * (int) sizeof(unsigned int); }
+
+// A directory's in-core table starts this big, and grows as files are
+// added to it.
+
+#ifdef FS_MANY_FILES
+const int NumDirEntries = 512;
+#else
+const int NumDirEntries = 64;
+#endif
+
+// GeometryCheck fails to compile, naming "name", if "cond" is false.
+
+#define GeometryCheck(name, cond)	typedef char name[(cond) ? 1 : -1]
+
+GeometryCheck(HeaderFillsSector,
+	(2 + NumDirect) * (int) sizeof(int) == SectorSize);
+GeometryCheck(HeaderHasIndirects, NumDirectBlocks > 0);
+GeometryCheck(FileCanSpanDisk, MaxFileBlocks >= NumSectors);
+GeometryCheck(DirectoryTableNotEmpty, NumDirEntries > 0);
+
+#endif // GEOMETRY_H
@@ -0,0 +1,212 @@
+// iotrace.cc
+//	Routines to trace the requests that reach the disk, and to
+//	replay a trace.  See iotrace.h.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "debug.h"
+#include "sysdep.h"
+#include "iotrace.h"
+#include "synchdisk.h"
+#include "synch.h"
+#include "main.h"
+
+//----------------------------------------------------------------------
+// IOTrace::IOTrace
+// 	Create the trace file "fileName" and write its header.  Until
+//	the file system tags them, sectors are of unknown kind and
+//	belong to no file.
+//----------------------------------------------------------------------
+
+IOTrace::IOTrace(char *fileName)
+{
+    TraceFileHeader header;
+
+    fd = OpenForWrite(fileName);
+    header.magic = TraceMagic;
+    header.numSectors = NumSectors;
+    header.sectorSize = SectorSize;
+    header.numRecords = 0;			// filled in at the end
+    WriteFile(fd, (char *) &header, sizeof(header));
+
+    for (int i = 0; i < NumSectors; i++) {
+	kindOf[i] = TraceUnknown;
+	ownerOf[i] = -1;
+	fileKind[i] = TraceData;
+    }
+    numBuffered = 0;
+    numRecords = 0;
+}
+
+//----------------------------------------------------------------------
+// IOTrace::~IOTrace
+// 	Write out the buffered records and the final record count, and
+//	close the trace file.
+//----------------------------------------------------------------------
+
+IOTrace::~IOTrace()
+{
+    WriteBuffer();
+    Lseek(fd, 3 * sizeof(int), 0);		// header.numRecords
+    WriteFile(fd, (char *) &numRecords, sizeof(int));
+    Close(fd);
+    DEBUG(dbgDisk, "Wrote a trace of " << numRecords << " disk requests");
+}
+
+//----------------------------------------------------------------------
+// IOTrace::Tag
+// 	Note what "sector" holds, so later requests for it are
+//	attributed to the right file and kind.
+//
+//	"kind" -- data, header, index, or log
+//	"owner" -- the header sector of the file it belongs to, or -1
+//----------------------------------------------------------------------
+
+void
+IOTrace::Tag(int sector, TraceKind kind, int owner)
+{
+    if (sector < 0 || sector >= NumSectors)
+	return;				// a hole, or garbage
+    kindOf[sector] = kind;
+    ownerOf[sector] = owner;
+}
+
+//----------------------------------------------------------------------
+// IOTrace::TagFile
+// 	Note that the data blocks of the file whose header is at
+//	"hdrSector" hold "kind": a directory or the free map.
+//----------------------------------------------------------------------
+
+void
+IOTrace::TagFile(int hdrSector, TraceKind kind)
+{
+    if (hdrSector >= 0 && hdrSector < NumSectors)
+	fileKind[hdrSector] = kind;
+}
+
+//----------------------------------------------------------------------
+// IOTrace::Record
+// 	Log a request that is being sent to the disk.  A data block is
+//	reported as the kind of data its file holds.
+//
+//	"latency" -- how long the disk will take, from Disk::ComputeLatency
+//----------------------------------------------------------------------
+
+void
+IOTrace::Record(int sector, bool writing, int latency)
+{
+    TraceRecord *rec = &buffer[numBuffered++];
+    int owner = ownerOf[sector];
+
+    rec->tick = kernel->stats->totalTicks;
+    rec->latency = latency;
+    rec->sector = sector;
+    rec->owner = owner;
+    rec->writing = writing;
+    rec->kind = kindOf[sector];
+    if (rec->kind == TraceData && owner >= 0)
+	rec->kind = fileKind[owner];
+    rec->unused = 0;
+    numRecords++;
+
+    if (numBuffered == TraceBufferSize)
+	WriteBuffer();
+}
+
+//----------------------------------------------------------------------
+// IOTrace::WriteBuffer
+// 	Append the buffered records to the trace file.
+//----------------------------------------------------------------------
+
+void
+IOTrace::WriteBuffer()
+{
+    if (numBuffered > 0)
+	WriteFile(fd, (char *) buffer, numBuffered * sizeof(TraceRecord));
+    numBuffered = 0;
+}
+
+//----------------------------------------------------------------------
+// Replay
+//	A trace being replayed, shared by the threads issuing it.  Each
+//	thread issues every ReplayThreads'th record, one at a time, so
+//	up to ReplayThreads requests are pending at once, as they were
+//	when the trace was taken by several threads.
+//----------------------------------------------------------------------
+
+static TraceRecord *replayRecords;
+static int replayCount;
+static Semaphore *replayDone;
+
+static void
+ReplayWorker(void *arg)
+{
+    int first = (int) (long) arg;
+    char data[SectorSize];
+
+    bzero(data, sizeof(data));
+    for (int i = first; i < replayCount; i += ReplayThreads) {
+	TraceRecord *rec = &replayRecords[i];
+
+	if (rec->writing)
+	    kernel->synchDisk->WriteSector(rec->sector, data);
+	else
+	    kernel->synchDisk->ReadSector(rec->sector, data);
+    }
+    replayDone->V();
+}
+
+//----------------------------------------------------------------------
+// IOTrace::Replay
+// 	Issue the requests of the trace in "fileName" again, through the
+//	SynchDisk cache and request scheduler in use now, and print how
+//	long they took and how many went to the disk.
+//
+//	Written sectors get zeros, so this is for a scratch disk
+//	(pick one with -m).
+//----------------------------------------------------------------------
+
+void
+IOTrace::Replay(char *fileName)
+{
+    TraceFileHeader header;
+    int fd, startTicks, startReads, startWrites;
+
+    if ((fd = OpenForReadWrite(fileName, FALSE)) < 0) {
+	printf("Replay: couldn't open trace %s\n", fileName);
+	return;
+    }
+    Read(fd, (char *) &header, sizeof(header));
+    if (header.magic != TraceMagic || header.numSectors != NumSectors ||
+		header.sectorSize != SectorSize) {
+	printf("Replay: %s is not a trace of this disk\n", fileName);
+	Close(fd);
+	return;
+    }
+    replayCount = header.numRecords;
+    replayRecords = new TraceRecord[replayCount > 0 ? replayCount : 1];
+    Read(fd, (char *) replayRecords, replayCount * sizeof(TraceRecord));
+    Close(fd);
+
+    startTicks = kernel->stats->totalTicks;
+    startReads = kernel->stats->numDiskReads;
+    startWrites = kernel->stats->numDiskWrites;
+    replayDone = new Semaphore("replay", 0);
+    for (int i = 0; i < ReplayThreads; i++) {
+	Thread *t = new Thread("replay", 1);
+	t->Fork(ReplayWorker, (void *) (long) i);
+    }
+    for (int i = 0; i < ReplayThreads; i++)
+	replayDone->P();
+    kernel->synchDisk->Flush();
+
+    printf("Replayed %d requests in %d ticks: %d disk reads, %d disk writes\n",
+	    replayCount, kernel->stats->totalTicks - startTicks,
+	    kernel->stats->numDiskReads - startReads,
+	    kernel->stats->numDiskWrites - startWrites);
+    delete replayDone;
+    delete [] replayRecords;
+}
@@ -0,0 +1,94 @@
+// iotrace.h
+//	Data structures for tracing every request that reaches the disk,
+//	and for replaying a trace.
+//
+//	With -trace, each request SynchDisk sends to the disk is logged
+//	as a fixed size binary record: the tick it was started at, the
+//	sector, read or write, how long the disk will take (as the disk
+//	itself computes it), and where the sector came from: the header
+//	sector of the file it belongs to, and what kind of sector it is
+//	(data, header, index, directory, free map or log).
+//
+//	Requests reach the disk long after the code that caused them has
+//	moved on (write-behind, the flusher, prefetching), so nobody says
+//	where a request came from when it is made.  Instead the file
+//	system tags sectors as it learns what they hold, and the trace
+//	looks the tags up when the request goes out.
+//
+//	A trace can be replayed with -replay: its requests are issued
+//	again, in order, through SynchDisk, so the cache and the request
+//	scheduler can be compared on the same workload.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef IOTRACE_H
+#define IOTRACE_H
+
+#include "copyright.h"
+#include "disk.h"
+
+#define TraceMagic		0x54524143	// "TRAC", first word of a trace
+#define TraceBufferSize		256		// records written at a time
+#define ReplayThreads		4		// threads issuing a replay
+
+// What a sector holds, as far as the file system has told the trace.
+
+enum TraceKind { TraceUnknown, TraceData, TraceHeader, TraceIndex,
+		 TraceDirectory, TraceBitmap, TraceLog };
+
+// The trace file is a TraceFileHeader followed by one TraceRecord
+// per request, in the host's byte order.
+
+class TraceFileHeader {
+  public:
+    int magic;				// TraceMagic
+    int numSectors;			// the geometry traced
+    int sectorSize;
+    int numRecords;			// records that follow
+};
+
+class TraceRecord {
+  public:
+    int tick;				// when the request was started
+    int latency;			// ticks the disk took for it
+    short sector;			// the sector transferred
+    short owner;			// header sector of its file, or -1
+    char writing;			// TRUE for a write
+    char kind;				// a TraceKind
+    short unused;
+};
+
+// The following class writes a trace.  SynchDisk calls Record for
+// every request it starts; the file system calls Tag and TagFile.
+
+class IOTrace {
+  public:
+    IOTrace(char *fileName);		// Start a trace in "fileName"
+    ~IOTrace();				// Write out the rest and close it
+
+    void Tag(int sector, TraceKind kind, int owner);
+    					// "sector" holds "kind", for the
+					// file whose header is at "owner"
+    void TagFile(int hdrSector, TraceKind kind);
+    					// The data of the file whose header
+					// is at "hdrSector" is "kind"
+    void Record(int sector, bool writing, int latency);
+    					// A request is going to the disk
+
+    static void Replay(char *fileName);	// Issue the requests of a trace
+
+  private:
+    int fd;				// the trace file
+    char kindOf[NumSectors];		// TraceKind of each sector
+    short ownerOf[NumSectors];		// header sector of its file
+    char fileKind[NumSectors];		// kind of data, by header sector
+    TraceRecord buffer[TraceBufferSize];	// records not written yet
+    int numBuffered;
+    int numRecords;			// records in the whole trace
+
+    void WriteBuffer();			// Write out the buffered records
+};
+
+#endif // IOTRACE_H
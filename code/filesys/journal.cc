@@ -0,0 +1,365 @@
+// journal.cc
+//	Routines to manage the metadata journal: collect the sectors
+//	written by a group of file system operations, commit them to
+//	the log region in one sequential burst, install them lazily,
+//	and replay committed but uninstalled sectors at mount time.
+//
+//	The commit point is the write of the first header sector, which
+//	holds the count of log slots in use; the second header sector is
+//	always written before it.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "journal.h"
+#include "synchdisk.h"
+#include "iotrace.h"
+#include "main.h"
+
+//----------------------------------------------------------------------
+// Journal::Journal
+// 	Initialize a journal.  Nothing is logged until Format or Recover
+//	finds (or makes) a log region on the disk.
+//----------------------------------------------------------------------
+
+Journal::Journal()
+{
+    enabled = FALSE;
+    lock = new Lock("journal lock");
+    commitDone = new Condition("journal commit");
+    outstanding = 0;
+    committing = FALSE;
+    used = 0;
+    for (unsigned int i = 0; i < sizeof(header) / sizeof(int); i++)
+	header[i] = 0;
+    numPending = 0;
+    pendingData = new char[NumLogSlots * SectorSize];
+}
+
+//----------------------------------------------------------------------
+// Journal::~Journal
+// 	De-allocate the journal.  The caller checkpoints it first.
+//----------------------------------------------------------------------
+
+Journal::~Journal()
+{
+    ASSERT(outstanding == 0 && numPending == 0);
+    delete [] pendingData;
+    delete commitDone;
+    delete lock;
+}
+
+//----------------------------------------------------------------------
+// Journal::Format
+// 	Reserve the log region in the free map of a new disk, write an
+//	empty log header, and start logging.
+//
+//	"freeMap" -- the free map being built by the format
+//----------------------------------------------------------------------
+
+void
+Journal::Format(PersistentBitmap *freeMap)
+{
+    Reserve(freeMap);
+    header[0] = LogMagic;
+    header[1] = 0;
+    WriteHeader();
+    used = 0;
+    enabled = TRUE;
+}
+
+//----------------------------------------------------------------------
+// Journal::Reserve
+// 	Mark the log region in use in "freeMap", without touching the
+//	disk: by Format, or when a free map that was never written is
+//	worked out again at mount.
+//----------------------------------------------------------------------
+
+void
+Journal::Reserve(PersistentBitmap *freeMap)
+{
+    for (int i = LogSector; i < LogSector + LogSize; i++) {
+	freeMap->Mark(i);
+	if (kernel->ioTrace != NULL)
+	    kernel->ioTrace->Tag(i, TraceLog, -1);
+    }
+}
+
+//----------------------------------------------------------------------
+// Journal::Recover
+// 	Read the log header.  Copy every sector it lists to its home
+//	sector, in log order so the latest copy wins, flush them, and
+//	empty the log.  A disk formatted without a log is left alone,
+//	and the journal stays disabled.
+//----------------------------------------------------------------------
+
+void
+Journal::Recover()
+{
+    char data[SectorSize];
+
+    // if the disk has no log, the files using these sectors tag
+    // them again
+    for (int i = LogSector; i < LogSector + LogSize; i++) {
+	if (kernel->ioTrace != NULL)
+	    kernel->ioTrace->Tag(i, TraceLog, -1);
+    }
+    kernel->synchDisk->ReadSector(LogSector, (char *)header);
+    kernel->synchDisk->ReadSector(LogSector + 1, (char *)header + SectorSize);
+    if (header[0] != LogMagic) {
+	DEBUG(dbgFile, "Disk has no journal, not logging");
+	return;
+    }
+    ASSERT(header[1] >= 0 && header[1] <= NumLogSlots);
+
+    DEBUG(dbgFile, "Replaying " << header[1] << " logged sectors");
+    for (int i = 0; i < header[1]; i++) {
+	kernel->synchDisk->ReadSector(LogSector + LogHeaderSectors + i, data);
+	kernel->synchDisk->WriteSector(header[2 + i], data);
+    }
+    enabled = TRUE;
+    Checkpoint();
+}
+
+//----------------------------------------------------------------------
+// Journal::Begin
+// 	Start a file system operation.  The calling thread's sector
+//	writes are recorded until the matching End.  Waits if a commit
+//	is being written, or if the log hasn't MaxOpSectors free slots
+//	for each open operation and this one; the commit once they end
+//	makes room.  An operation nested in another the thread has open
+//	shares its slots, so it doesn't wait.
+//----------------------------------------------------------------------
+
+void
+Journal::Begin()
+{
+    if (!enabled)
+	return;
+    if (kernel->currentThread->fsOps++ > 0)
+	return;				// nested
+    lock->Acquire();
+    while (committing ||
+	    numPending + (outstanding + 1) * MaxOpSectors > NumLogSlots)
+	commitDone->Wait(lock);
+    outstanding++;
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// Journal::End
+// 	Finish a file system operation.  If no other operation is open,
+//	commit everything recorded so far, as one transaction.
+//----------------------------------------------------------------------
+
+void
+Journal::End()
+{
+    if (!enabled)
+	return;
+    ASSERT(kernel->currentThread->fsOps > 0);
+    if (--kernel->currentThread->fsOps > 0)
+	return;				// nested
+    lock->Acquire();
+    ASSERT(outstanding > 0);
+    outstanding--;
+    if (outstanding == 0 && numPending > 0)
+	Commit();
+    else
+	commitDone->Broadcast(lock);	// its slots are free again
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// Journal::Idle
+// 	Return TRUE if no operation is open and no commit is under way,
+//	so every change recorded so far is in the log (or there is no
+//	log at all).
+//----------------------------------------------------------------------
+
+bool
+Journal::Idle()
+{
+    bool idle;
+
+    if (!enabled)
+	return TRUE;
+    lock->Acquire();
+    idle = (outstanding == 0 && !committing);
+    lock->Release();
+    return idle;
+}
+
+//----------------------------------------------------------------------
+// Journal::Record
+// 	Called by SynchDisk for every sector write.  If the calling
+//	thread has an operation open, keep the new contents here instead;
+//	writing the same sector again just replaces the recorded copy.
+//
+//	Begin left room for the operation, so the log is only full if it
+//	has changed more than MaxOpSectors sectors while others were open.
+//	Writing the sector around the log would break the transaction, so
+//	that is fatal.
+//
+//	"sectorNumber" -- the home sector being written
+//	"data" -- its new contents
+//----------------------------------------------------------------------
+
+bool
+Journal::Record(int sectorNumber, char *data)
+{
+    int i;
+
+    if (!enabled || kernel->currentThread->fsOps == 0)
+	return FALSE;
+    lock->Acquire();
+    ASSERT(outstanding > 0);
+    for (i = 0; i < numPending; i++) {
+	if (pendingSector[i] == sectorNumber)
+	    break;
+    }
+    if (i == numPending) {
+	ASSERT(numPending < NumLogSlots);	// too big an operation
+	pendingSector[i] = sectorNumber;
+	numPending++;
+    }
+    bcopy(data, &pendingData[i * SectorSize], SectorSize);
+    lock->Release();
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Journal::Update
+// 	Called by SynchDisk for a sector written straight to the disk by
+//	a thread with no operation open.  If the sector is recorded, the
+//	recorded copy is now stale: replace it, or the commit would put
+//	the old contents back over the new.
+//
+//	"sectorNumber" -- the home sector being written
+//	"data" -- its new contents
+//----------------------------------------------------------------------
+
+void
+Journal::Update(int sectorNumber, char *data)
+{
+    if (numPending == 0)
+	return;				// the usual case, no locking
+    lock->Acquire();
+    for (int i = 0; i < numPending; i++) {
+	if (pendingSector[i] == sectorNumber) {
+	    bcopy(data, &pendingData[i * SectorSize], SectorSize);
+	    break;
+	}
+    }
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// Journal::Lookup
+// 	Called by SynchDisk for every sector read, so that reads see
+//	sectors recorded but not yet installed.
+//
+//	"sectorNumber" -- the sector being read
+//	"data" -- where to put its contents, if we have them
+//----------------------------------------------------------------------
+
+bool
+Journal::Lookup(int sectorNumber, char *data)
+{
+    bool found = FALSE;
+
+    if (numPending == 0)
+	return FALSE;			// the usual case, no locking
+    lock->Acquire();
+    for (int i = 0; i < numPending; i++) {
+	if (pendingSector[i] == sectorNumber) {
+	    bcopy(&pendingData[i * SectorSize], data, SectorSize);
+	    found = TRUE;
+	    break;
+	}
+    }
+    lock->Release();
+    return found;
+}
+
+//----------------------------------------------------------------------
+// Journal::Commit
+// 	Write the recorded sectors to the next free log slots, all queued
+//	at once so they go out as one sequential burst, then commit them
+//	by rewriting the header.  Only then are they handed to the cache
+//	for their home sectors.  Checkpoints first if they do not fit.
+//
+//	Called by End with the lock held; the lock is dropped during the
+//	disk I/O, and "committing" keeps new operations out meanwhile.
+//----------------------------------------------------------------------
+
+void
+Journal::Commit()
+{
+    DiskRequest *requests[NumLogSlots];
+    int i;
+
+    committing = TRUE;
+    lock->Release();
+
+    if (used + numPending > NumLogSlots)
+	Checkpoint();
+
+    DEBUG(dbgFile, "Committing " << numPending << " sectors to the journal");
+    for (i = 0; i < numPending; i++)
+	requests[i] = kernel->synchDisk->WriteSectorAsync(
+			LogSector + LogHeaderSectors + used + i,
+			&pendingData[i * SectorSize]);
+    for (i = 0; i < numPending; i++)
+	kernel->synchDisk->WaitFor(requests[i]);
+
+    for (i = 0; i < numPending; i++)
+	header[2 + used + i] = pendingSector[i];
+    header[1] = used + numPending;
+    WriteHeader();			// the commit point
+    used += numPending;
+
+    for (i = 0; i < numPending; i++)	// install lazily, via the cache
+	kernel->synchDisk->WriteSector(pendingSector[i],
+					&pendingData[i * SectorSize]);
+
+    lock->Acquire();
+    numPending = 0;
+    committing = FALSE;
+    commitDone->Broadcast(lock);
+}
+
+//----------------------------------------------------------------------
+// Journal::Checkpoint
+// 	Flush the disk cache, so every logged sector has reached its home
+//	sector, and then mark the log empty.
+//----------------------------------------------------------------------
+
+void
+Journal::Checkpoint()
+{
+    if (!enabled)
+	return;
+    kernel->synchDisk->Flush();
+    header[1] = 0;
+    WriteHeader();
+    used = 0;
+}
+
+//----------------------------------------------------------------------
+// Journal::WriteHeader
+// 	Write the log header to disk, bypassing the cache: the second
+//	sector first, then the first, whose slot count commits it.
+//----------------------------------------------------------------------
+
+void
+Journal::WriteHeader()
+{
+    SynchDisk *disk = kernel->synchDisk;
+
+    disk->WaitFor(disk->WriteSectorAsync(LogSector + 1,
+					(char *)header + SectorSize));
+    disk->WaitFor(disk->WriteSectorAsync(LogSector, (char *)header));
+}
@@ -0,0 +1,116 @@
+// journal.h
+//	Data structures for a metadata journal (write-ahead log), so that
+//	the several sectors changed by one file system operation reach
+//	the disk atomically.
+//
+//	A fixed region of the disk, reserved when the disk is formatted,
+//	holds the log: a two-sector header followed by NumLogSlots
+//	sectors of logged data.  The header lists, for each log slot in
+//	use, the home sector its contents belong to.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "copyright.h"
+#include "disk.h"
+#include "synch.h"
+#include "pbitmap.h"
+
+#define LogSector	2		// first sector of the log region
+#define LogHeaderSectors 2		// the header takes two sectors
+#define NumLogSlots	((int) (LogHeaderSectors * SectorSize / sizeof(int)) - 2)
+					// logged sectors the region holds
+#define LogSize		(LogHeaderSectors + NumLogSlots)
+					// sectors in the log region
+#define LogMagic	0x4a524e4c	// marks a disk formatted with a log
+#define MaxOpSectors	(NumLogSlots / 2)
+					// log slots set aside for each open
+					// operation
+
+// The following class defines the journal.
+//
+// File system operations bracket their metadata writes with Begin()
+// and End().  Between the two, SynchDisk hands every sector write the
+// thread makes to Record() instead of the cache, and reads see the
+// recorded copies.  Other threads' writes are not recorded; one that
+// goes straight to the disk replaces any recorded copy (Update), so
+// the commit doesn't install an older one over it.
+// When the last open operation ends, the recorded sectors are
+// appended to the log region in one sequential burst, then the header
+// is rewritten to commit them, and only then do they go to their home
+// sectors (through the write-back cache, i.e. lazily).
+//
+// When the log region fills up, it is checkpointed: the cache is
+// flushed, so every logged sector is safely home, and the log is
+// emptied.  Mounting replays whatever the header still lists.
+//
+// Begin waits until the log has MaxOpSectors free slots for the new
+// operation, as well as for each one already open, so the log can't
+// fill up part way through an operation.  One that changes more
+// sectors than that can only run out if others are open; it is not
+// written around the log, Nachos stops instead.  None of the regular
+// operations come close.
+
+class Journal {
+  public:
+    Journal();				// Initialize an unused journal
+    ~Journal();
+
+    void Format(PersistentBitmap *freeMap);
+    					// Reserve the log region on a
+					// freshly formatted disk and
+					// start logging
+    void Reserve(PersistentBitmap *freeMap);
+    					// Just mark the log region in use
+    void Recover();			// At mount: replay committed
+					// transactions, then start logging
+					// (if the disk has a log at all)
+
+    void Begin();			// Start a file system operation,
+					// once the log has room for it
+    void End();				// Finish it; commit if it was the
+					// last one open
+    void Checkpoint();			// Get every logged sector home and
+					// empty the log
+
+    bool Record(int sectorNumber, char *data);
+    					// Log a sector write; FALSE if the
+					// thread has no operation open
+    void Update(int sectorNumber, char *data);
+    					// A write made outside any
+					// operation: replace the recorded
+					// copy, if there is one
+    bool Lookup(int sectorNumber, char *data);
+    					// Copy out a recorded, not yet
+					// installed sector; FALSE if none
+    bool IsEnabled() { return enabled; }
+    					// Does the disk have a log region?
+    bool Idle();			// No operation open, and everything
+					// recorded committed?
+
+  private:
+    bool enabled;			// does the disk have a log?
+    Lock *lock;				// protects the fields below
+    Condition *commitDone;		// Begin waits here during a commit,
+					// or for room in the log
+    int outstanding;			// operations between Begin and End,
+					// not counting nested ones
+    bool committing;			// is a commit in progress?
+    int used;				// log slots holding committed data
+    int header[LogHeaderSectors * SectorSize / sizeof(int)];
+    					// [0] magic, [1] slots in use,
+					// then a home sector for each slot
+
+    int numPending;			// sectors recorded but not committed
+    int pendingSector[NumLogSlots];	// their home sectors
+    char *pendingData;			// and their contents
+
+    void Commit();			// write the pending sectors out
+    void WriteHeader();			// write "header" to the disk
+};
+
+#endif // JOURNAL_H
@@ -17,20 +17,32 @@
 #include "filehdr.h"
 #include "openfile.h"
 #include "synchdisk.h"
+#include "slab.h"
 
 //----------------------------------------------------------------------
 // OpenFile::OpenFile
 // 	Open a Nachos file for reading and writing.  Bring the file header
-//	into memory while the file is open.
+//	into memory while the file is open.  All opens of the same file
+//	share one in-core header, so only the first one reads the disk.
 //
 //	"sector" -- the location on disk of the file header for this file
 //----------------------------------------------------------------------
 
 OpenFile::OpenFile(int sector)
 { 
-    hdr = new FileHeader;
-    hdr->FetchFrom(sector);
+    hdr = FileHeader::Acquire(sector);
     seekPosition = 0;
+    nextReadPosition = 0;
+    readAheadWindow = 0;
+    prefetchedUpTo = -1;
+    inFlight = new List<DiskRequest *>;
+    locking = FALSE;
+    appending = FALSE;
+    tail = NULL;
+    tailBlock = -1;
+    tailSector = -1;
+    tailWrites = 0;
+    lengthDirty = FALSE;
 }
 
 //----------------------------------------------------------------------
@@ -40,7 +52,33 @@ OpenFile::OpenFile(int sector)
 
 OpenFile::~OpenFile()
 {
-    delete hdr;
+    WaitWrites();
+    FlushAppend();
+    delete [] tail;
+    delete inFlight;
+    FileHeader::Release(hdr);
+}
+
+//----------------------------------------------------------------------
+// OpenFile::operator new, OpenFile::operator delete
+// 	Files are opened and closed on every file system operation (the
+//	directories along a path, and the free map), so they come from
+//	a cache of their own (see slab.h).
+//----------------------------------------------------------------------
+
+static SlabCache openFileCache(sizeof(OpenFile), MemFilesys);
+
+void *
+OpenFile::operator new(size_t size)
+{
+    ASSERT(size == sizeof(OpenFile));
+    return openFileCache.Alloc();
+}
+
+void
+OpenFile::operator delete(void *p)
+{
+    openFileCache.Free(p);
 }
 
 //----------------------------------------------------------------------
@@ -81,11 +119,257 @@ OpenFile::Read(char *into, int numBytes)
 int
 OpenFile::Write(char *into, int numBytes)
 {
-   int result = WriteAt(into, numBytes, seekPosition);
+   int result;
+
+   if (appending) {
+	result = Append(into, numBytes);
+	seekPosition = Length();
+	return result;
+   }
+   result = WriteAt(into, numBytes, seekPosition);
    seekPosition += result;
    return result;
 }
 
+//----------------------------------------------------------------------
+// OpenFile::SetAppend
+//	MP4 MODIFIED
+// 	Open the file for appending, as with O_APPEND: every Write goes at
+//	the end of the file, wherever the seek position is, and leaves it
+//	there.  ReadAt and WriteAt are not affected.
+//----------------------------------------------------------------------
+
+void
+OpenFile::SetAppend()
+{
+    appending = TRUE;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::Append
+//	MP4 MODIFIED
+// 	Write "numBytes" at the end of the file, for Write in append mode.
+//
+//	A log grows a few bytes at a time, and as WriteAt it would cost a
+//	read of the partial last sector, a sector lookup, and a write of
+//	the header, every time.  Instead, while the bytes fit in blocks
+//	the file already has (Extend leaves PreallocBlocks spare as it
+//	grows it), the last block is kept here in "tail": the bytes are
+//	copied into it, it goes to the disk cache, which holds it dirty
+//	(see SynchDisk), and only the in-core header's length is moved
+//	on.  The header goes back to disk once, in FlushAppend, when the
+//	file is closed; until then, a crash loses the new length, though
+//	not the blocks.  Anything else -- growing the file, a hole, an
+//	inline, compressed or deduplicated file -- is an ordinary WriteAt
+//	at the end.
+//
+//	The tail is read again if anyone else wrote to the file since,
+//	or the block has moved (see FileHeader::Relocate).
+//
+//	"from" -- the buffer containing the data to be written
+//	"numBytes" -- the number of bytes to transfer
+//----------------------------------------------------------------------
+
+int
+OpenFile::Append(char *from, int numBytes)
+{
+    int length, done;
+
+    if (numBytes <= 0)
+	return 0;
+    if (locking)
+	hdr->GetLock()->AcquireWrite();
+    length = hdr->FileLength();
+    if (!CanAppendFast(length, numBytes)) {
+	done = WriteUnlocked(from, numBytes, length);
+	tailBlock = -1;
+    } else {
+	if (tail == NULL)
+	    tail = new char[SectorSize];
+	if (hdr->NumWrites() != tailWrites)
+	    tailBlock = -1;			// someone else wrote
+	hdr->NoteWrite();
+	hdr->NoteAccess();
+	for (done = 0; done < numBytes; ) {
+	    int position = length + done;
+	    int block = position / SectorSize;
+	    int offset = position % SectorSize;
+	    int n = min(SectorSize - offset, numBytes - done);
+	    int sector = hdr->ByteToSector(position);
+
+	    if (block != tailBlock || sector != tailSector) {
+		if (offset == 0)
+		    bzero(tail, SectorSize);	// nothing there yet
+		else
+		    kernel->synchDisk->ReadSector(sector, tail);
+		tailBlock = block;
+		tailSector = sector;
+	    }
+	    bcopy(&from[done], &tail[offset], n);
+	    kernel->synchDisk->WriteSector(sector, tail);
+	    done += n;
+	}
+	hdr->SetLength(length + numBytes);
+	lengthDirty = TRUE;
+	tailWrites = hdr->NumWrites();
+    }
+    if (locking)
+	hdr->GetLock()->ReleaseWrite();
+    return done;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::CanAppendFast
+//	MP4 MODIFIED
+// 	Can "numBytes" be appended to the file, now "length" bytes long,
+//	in the tail (see Append): do the blocks they go in have sectors
+//	already?
+//----------------------------------------------------------------------
+
+bool
+OpenFile::CanAppendFast(int length, int numBytes)
+{
+    if (hdr->IsInline() || hdr->IsCompressed() || hdr->IsDeduplicated()
+	|| length + numBytes > hdr->AllocatedLength())
+	return FALSE;
+    for (int i = length / SectorSize; i <= (length + numBytes - 1) / SectorSize;
+	 i++) {
+	if (hdr->ByteToSector(i * SectorSize) == -1)
+	    return FALSE;			// a hole, or held back
+    }
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::FlushAppend
+//	MP4 MODIFIED
+// 	Write the header back, if appends have left its length ahead of
+//	the disk's (see Append).  The blocks are already in the cache.
+//----------------------------------------------------------------------
+
+void
+OpenFile::FlushAppend()
+{
+    if (!lengthDirty)
+	return;
+    if (locking)
+	hdr->GetLock()->AcquireWrite();
+    hdr->WriteBack(hdr->GetSector());
+    lengthDirty = FALSE;
+    if (locking)
+	hdr->GetLock()->ReleaseWrite();
+}
+
+//----------------------------------------------------------------------
+// OpenFile::WriteBehind
+//	MP4 MODIFIED
+// 	Write a portion of the file at seekPosition, as Write does, but
+//	without waiting for the whole sectors: they are all queued to the
+//	disk at once (see SynchDisk::WriteSectorAsync), so the caller can
+//	get its next buffer ready while the disk works.  The caller must
+//	not touch "from" until WaitWrites returns.
+//
+//	Only a sector-aligned write into blocks the file already has is
+//	queued; anything else, and a partial last sector, go through
+//	WriteAt as usual, as does any write to a compressed or
+//	deduplicated file.
+//
+//	"from" -- the buffer containing the data to be written to disk
+//	"numBytes" -- the number of bytes to transfer
+//----------------------------------------------------------------------
+
+int
+OpenFile::WriteBehind(char *from, int numBytes)
+{
+    int whole = numBytes / SectorSize;
+    int i, sector;
+
+    if (numBytes <= 0 || seekPosition % SectorSize != 0 || hdr->IsInline() ||
+		hdr->IsCompressed() || hdr->IsDeduplicated() ||
+		seekPosition + numBytes > hdr->FileLength())
+	return Write(from, numBytes);
+    hdr->NoteWrite();
+    for (i = 0; i < whole; i++) {
+	if (hdr->ByteToSector(seekPosition + i * SectorSize) == -1)
+	    return Write(from, numBytes);	// a hole, needs filling
+    }
+
+    DEBUG(dbgFile, "Queueing " << whole << " sectors at " << seekPosition);
+    for (i = 0; i < whole; i++) {
+	sector = hdr->ByteToSector(seekPosition + i * SectorSize);
+	inFlight->Append(kernel->synchDisk->WriteSectorAsync(sector,
+						&from[i * SectorSize]));
+    }
+    seekPosition += whole * SectorSize;
+    if (numBytes > whole * SectorSize)
+	Write(&from[whole * SectorSize], numBytes - whole * SectorSize);
+    return numBytes;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::ReadBehind
+//	MP4 MODIFIED
+// 	Read a portion of the file at seekPosition, as Read does, but
+//	without waiting for the whole sectors: they are all queued to the
+//	disk at once (see SynchDisk::ReadSectorAsync), so a reader going
+//	through a large file keeps the disk busy with a whole batch, and
+//	the disk scheduler can sweep it with other readers' batches.  The
+//	sectors are not cached.  The caller must not look at "into" until
+//	WaitReads returns.  Returns the number of bytes read, as Read.
+//
+//	Only a sector-aligned read of blocks the file has on disk is
+//	queued; anything else, and a partial last sector, go through
+//	ReadAt as usual, as does any read of an inline or compressed
+//	file.
+//
+//	"into" -- the buffer to hold the data
+//	"numBytes" -- the number of bytes to transfer
+//----------------------------------------------------------------------
+
+int
+OpenFile::ReadBehind(char *into, int numBytes)
+{
+    int fileLength = hdr->FileLength();
+    int i, whole, sector;
+
+    if (numBytes > fileLength - seekPosition)
+	numBytes = fileLength - seekPosition;
+    if (numBytes <= 0 || seekPosition % SectorSize != 0 || hdr->IsInline() ||
+		hdr->IsCompressed())
+	return Read(into, numBytes);
+    whole = numBytes / SectorSize;
+    for (i = 0; i < whole; i++) {
+	if (hdr->ByteToSector(seekPosition + i * SectorSize) == -1)
+	    return Read(into, numBytes);	// a hole, or held back
+    }
+    hdr->NoteAccess();
+
+    DEBUG(dbgFile, "Queueing reads of " << whole << " sectors at " << seekPosition);
+    for (i = 0; i < whole; i++) {
+	sector = hdr->ByteToSector(seekPosition + i * SectorSize);
+	inFlight->Append(kernel->synchDisk->ReadSectorAsync(sector,
+						&into[i * SectorSize]));
+    }
+    seekPosition += whole * SectorSize;
+    if (numBytes > whole * SectorSize)
+	Read(&into[whole * SectorSize], numBytes - whole * SectorSize);
+    return numBytes;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::WaitWrites
+//	MP4 MODIFIED
+// 	Wait until every write queued by WriteBehind (or read queued by
+//	ReadBehind) is done.
+//----------------------------------------------------------------------
+
+void
+OpenFile::WaitWrites()
+{
+    while (!inFlight->IsEmpty())
+	kernel->synchDisk->WaitFor(inFlight->RemoveFront());
+}
+
 //----------------------------------------------------------------------
 // OpenFile::ReadAt/WriteAt
 // 	Read/write a portion of a file, starting at "position".
@@ -97,13 +381,34 @@ OpenFile::Write(char *into, int numBytes)
 //	sector at a time.  Thus:
 //
 //	For ReadAt:
-//	   We read in all of the full or partial sectors that are part of the
-//	   request, but we only copy the part we are interested in.
+//	   A partial first or last sector is read into a one-sector buffer
+//	   and only the part we are interested in is copied out.
 //	For WriteAt:
-//	   We must first read in any sectors that will be partially written,
-//	   so that we don't overwrite the unmodified portion.  We then copy
-//	   in the data that will be modified, and write back all the full
-//	   or partial sectors that are part of the request.
+//	   A partial first or last sector is read in first, so that we
+//	   don't overwrite the unmodified portion, then patched and
+//	   written back.
+//
+//	MP4 MODIFIED
+//	The whole sectors in between go to or from the caller's buffer
+//	directly, as one vectored SynchDisk request.
+//
+//	A write past the end of the file grows it (see FileHeader::Extend);
+//	any gap between the old end and "position" reads back as zeros.
+//	Only if the disk is full is the write cut short at the end.
+//
+//	Holes in a sparse file (sector -1) read as zeros without any
+//	disk I/O, and are given blocks just before they are written.
+//
+//	A compressed file is read and written a chunk at a time instead
+//	(see ReadChunks, WriteChunks), and a deduplicated one is written
+//	a block at a time (see WriteBlocks).
+//
+//	Every call counts towards the file's access heat, which orders
+//	the files for FileSystem::Defragment.
+//
+//	A file opened by FileSystem::Open is locked (see SetLocking):
+//	reads of it go ahead together, but a write waits for them and
+//	has the file to itself, since it may grow the header.
 //
 //	"into" -- the buffer to contain the data to be read from disk 
 //	"from" -- the buffer containing the data to be written to disk 
@@ -114,77 +419,424 @@ OpenFile::Write(char *into, int numBytes)
 
 int
 OpenFile::ReadAt(char *into, int numBytes, int position)
+{
+    int result;
+
+    if (!locking)
+	return ReadUnlocked(into, numBytes, position);
+    hdr->GetLock()->AcquireRead();
+    result = ReadUnlocked(into, numBytes, position);
+    hdr->GetLock()->ReleaseRead();
+    return result;
+}
+
+int
+OpenFile::WriteAt(char *from, int numBytes, int position)
+{
+    int result;
+
+    if (!locking)
+	return WriteUnlocked(from, numBytes, position);
+    hdr->GetLock()->AcquireWrite();
+    result = WriteUnlocked(from, numBytes, position);
+    hdr->GetLock()->ReleaseWrite();
+    return result;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::ReadUnlocked, OpenFile::WriteUnlocked
+//	MP4 MODIFIED
+// 	ReadAt and WriteAt themselves, once the file's lock is held (or
+//	if the file isn't locked).
+//----------------------------------------------------------------------
+
+int
+OpenFile::ReadUnlocked(char *into, int numBytes, int position)
 {
     int fileLength = hdr->FileLength();
     int i, firstSector, lastSector, numSectors;
-    char *buf;
+    int *sectors, start, done, whole;
+    char buf[SectorSize];
 
     if ((numBytes <= 0) || (position >= fileLength))
     	return 0; 				// check request
     if ((position + numBytes) > fileLength)		
 	numBytes = fileLength - position;
+    hdr->NoteAccess();
     DEBUG(dbgFile, "Reading " << numBytes << " bytes at " << position << " from file of length " << fileLength);
 
+    if (hdr->IsInline()) {		// the bytes are in the header
+	hdr->ReadInline(into, numBytes, position);
+	return numBytes;
+    }
+    if (hdr->IsCompressed()) {
+	ReadChunks(into, numBytes, position);
+	return numBytes;
+    }
+
     firstSector = divRoundDown(position, SectorSize);
     lastSector = divRoundDown(position + numBytes - 1, SectorSize);
     numSectors = 1 + lastSector - firstSector;
 
-    // read in all the full and partial sectors that we need
-    buf = new char[numSectors * SectorSize];
-    for (i = firstSector; i <= lastSector; i++)	
-        kernel->synchDisk->ReadSector(hdr->ByteToSector(i * SectorSize), 
-					&buf[(i - firstSector) * SectorSize]);
+    sectors = new int[numSectors];
+    for (i = firstSector; i <= lastSector; i++)
+	sectors[i - firstSector] = hdr->ByteToSector(i * SectorSize);
+
+    start = position - (firstSector * SectorSize);
+    done = 0;
+    i = 0;
+
+    // partial first sector
+    if (start != 0 || numBytes < SectorSize) {
+	ReadBlock(firstSector, sectors[0], buf);
+	done = min(SectorSize - start, numBytes);
+	bcopy(&buf[start], into, done);
+	i = 1;
+    }
+
+    // whole sectors, straight into the caller's buffer, one request
+    // per run of allocated sectors; holes are just cleared, unless
+    // they are being held back
+    whole = (numBytes - done) / SectorSize;
+    while (whole > 0) {
+	int run = 1;
+
+	if (sectors[i] == -1) {
+	    while (run < whole && sectors[i + run] == -1)
+		run++;
+	    for (int k = 0; k < run; k++)
+		ReadBlock(firstSector + i + k, -1, &into[done + k * SectorSize]);
+	} else {
+	    while (run < whole && sectors[i + run] != -1)
+		run++;
+	    kernel->synchDisk->ReadSectors(&sectors[i], run, &into[done]);
+	}
+	done += run * SectorSize;
+	i += run;
+	whole -= run;
+    }
+
+    // partial last sector
+    if (done < numBytes) {
+	ReadBlock(firstSector + i, sectors[i], buf);
+	bcopy(buf, &into[done], numBytes - done);
+    }
 
-    // copy the part we want
-    bcopy(&buf[position - (firstSector * SectorSize)], into, numBytes);
-    delete [] buf;
+    // a read that picks up where the last one ended grows the
+    // read-ahead window; anything else is a seek and resets it
+    if (position == nextReadPosition) {
+	readAheadWindow = (readAheadWindow == 0) ? 1 : 
+				min(readAheadWindow * 2, MaxReadAhead);
+    } else {
+	readAheadWindow = 0;
+	prefetchedUpTo = -1;
+    }
+    nextReadPosition = position + numBytes;
+    ReadAhead(lastSector);
+
+    delete [] sectors;
     return numBytes;
 }
 
+//----------------------------------------------------------------------
+// OpenFile::ReadAhead
+//	MP4 MODIFIED
+// 	Hand the next readAheadWindow sectors after "lastSector" to the
+//	disk's prefetcher, skipping any we already asked for, so a
+//	sequential reader finds them in the cache.
+//
+//	"lastSector" -- the last file sector the current read touched
+//----------------------------------------------------------------------
+
+void
+OpenFile::ReadAhead(int lastSector)
+{
+    int fileSectors = divRoundUp(hdr->FileLength(), SectorSize);
+    int from = max(lastSector + 1, prefetchedUpTo + 1);
+    int to = min(lastSector + readAheadWindow, fileSectors - 1);
+
+    for (int i = from; i <= to; i++) {
+	int sector = hdr->ByteToSector(i * SectorSize);
+
+	if (sector != -1)		// nothing to fetch for a hole
+	    kernel->synchDisk->Prefetch(sector);
+	prefetchedUpTo = i;
+    }
+}
+
+//----------------------------------------------------------------------
+// OpenFile::ReadBlock
+//	MP4 MODIFIED
+// 	Read one block of the file into "buf"; a hole reads as zeros,
+//	or as what has been written to it, if that is being held back.
+//
+//	"block" -- which block of the file
+//	"sector" -- its disk sector, or -1 for a hole
+//----------------------------------------------------------------------
+
+void
+OpenFile::ReadBlock(int block, int sector, char *buf)
+{
+    char *delayed;
+
+    if (sector != -1)
+	kernel->synchDisk->ReadSector(sector, buf);
+    else if ((delayed = hdr->DelayedBlock(block)) != NULL)
+	bcopy(delayed, buf, SectorSize);
+    else
+	bzero(buf, SectorSize);
+}
+
 int
-OpenFile::WriteAt(char *from, int numBytes, int position)
+OpenFile::WriteUnlocked(char *from, int numBytes, int position)
 {
     int fileLength = hdr->FileLength();
     int i, firstSector, lastSector, numSectors;
-    bool firstAligned, lastAligned;
-    char *buf;
+    int *sectors, start, done, whole;
+    char buf[SectorSize];
 
-    if ((numBytes <= 0) || (position >= fileLength))
+    if ((numBytes <= 0) || (position < 0))
 	return 0;				// check request
-    if ((position + numBytes) > fileLength)
-	numBytes = fileLength - position;
+    hdr->NoteWrite();
+    hdr->NoteAccess();
+    if ((position + numBytes) > fileLength) {
+	if (kernel->fileSystem->ExtendFile(hdr, position + numBytes, locking)) {
+	    ZeroFill(fileLength, position);
+	    fileLength = hdr->FileLength();
+	} else if (position >= fileLength) {
+	    return 0;				// disk full
+	} else {
+	    numBytes = fileLength - position;
+	}
+    }
     DEBUG(dbgFile, "Writing " << numBytes << " bytes at " << position << " from file of length " << fileLength);
 
+    if (hdr->IsInline()) {
+	hdr->WriteInline(from, numBytes, position);
+	return numBytes;
+    }
+    if (hdr->IsCompressed())
+	return WriteChunks(from, numBytes, position);
+    if (hdr->IsDeduplicated())
+	return WriteBlocks(from, numBytes, position);
+
     firstSector = divRoundDown(position, SectorSize);
     lastSector = divRoundDown(position + numBytes - 1, SectorSize);
     numSectors = 1 + lastSector - firstSector;
 
-    buf = new char[numSectors * SectorSize];
-	
-	// Mp4 mod tag
-	memset(buf, 0, sizeof(char) * numSectors * SectorSize); // dummy operation to keep valgrind happy
-
-    firstAligned = (position == (firstSector * SectorSize));
-    lastAligned = ((position + numBytes) == ((lastSector + 1) * SectorSize));
-
-// read in first and last sector, if they are to be partially modified
-    if (!firstAligned)
-        ReadAt(buf, SectorSize, firstSector * SectorSize);	
-    if (!lastAligned && ((firstSector != lastSector) || firstAligned))
-        ReadAt(&buf[(lastSector - firstSector) * SectorSize], 
-				SectorSize, lastSector * SectorSize);	
-
-// copy in the bytes we want to change 
-    bcopy(from, &buf[position - (firstSector * SectorSize)], numBytes);
-
-// write modified sectors back
-    for (i = firstSector; i <= lastSector; i++)	
-        kernel->synchDisk->WriteSector(hdr->ByteToSector(i * SectorSize), 
-					&buf[(i - firstSector) * SectorSize]);
-    delete [] buf;
+    sectors = new int[numSectors];
+    for (i = firstSector; i <= lastSector; i++)
+	sectors[i - firstSector] = hdr->ByteToSector(i * SectorSize);
+
+    // a user file holds back writes that land only in holes; in any
+    // other write, the holes are filled, after giving those it holds
+    // back their sectors
+    for (i = 0; i < numSectors; i++) {
+	if (sectors[i] != -1)
+	    break;
+    }
+    if (locking && i == numSectors) {
+	delete [] sectors;
+	return WriteDelayed(from, numBytes, position);
+    }
+    for (i = 0; i < numSectors; i++) {
+	if (sectors[i] == -1)
+	    break;
+    }
+    if (i < numSectors) {
+	kernel->fileSystem->FlushDelayed(hdr);
+	if (!kernel->fileSystem->FillHoles(hdr, firstSector, lastSector)) {
+	    delete [] sectors;
+	    return 0;				// disk full
+	}
+	for (i = firstSector; i <= lastSector; i++)
+	    sectors[i - firstSector] = hdr->ByteToSector(i * SectorSize);
+    }
+
+    start = position - (firstSector * SectorSize);
+    done = 0;
+    i = 0;
+
+    // partial first sector: read, patch, write back
+    if (start != 0 || numBytes < SectorSize) {
+	kernel->synchDisk->ReadSector(sectors[0], buf);
+	done = min(SectorSize - start, numBytes);
+	bcopy(from, &buf[start], done);
+	kernel->synchDisk->WriteSector(sectors[0], buf);
+	i = 1;
+    }
+
+    // whole sectors, straight from the caller's buffer
+    whole = (numBytes - done) / SectorSize;
+    if (whole > 0) {
+	kernel->synchDisk->WriteSectors(&sectors[i], whole, &from[done]);
+	done += whole * SectorSize;
+	i += whole;
+    }
+
+    // partial last sector: read, patch, write back
+    if (done < numBytes) {
+	kernel->synchDisk->ReadSector(sectors[i], buf);
+	bcopy(&from[done], buf, numBytes - done);
+	kernel->synchDisk->WriteSector(sectors[i], buf);
+    }
+
+    delete [] sectors;
     return numBytes;
 }
 
+//----------------------------------------------------------------------
+// OpenFile::WriteDelayed
+//	MP4 MODIFIED
+// 	Write into blocks that have no sectors yet by having the header
+//	hold them back (see FileHeader::AddDelayed), instead of giving
+//	them sectors now.  They get sectors all together, and so
+//	contiguous ones, when the header has no room for more, when the
+//	file is closed, or when the disk is flushed.  Return the number
+//	of bytes written, short only if the disk is full.
+//
+//	Making room may give sectors to blocks further on in this write;
+//	the rest of it is then an ordinary write.
+//
+//	"from" -- the buffer containing the data to be written
+//	"numBytes" -- the number of bytes to transfer
+//	"position" -- the offset within the file of the first byte
+//----------------------------------------------------------------------
+
+int
+OpenFile::WriteDelayed(char *from, int numBytes, int position)
+{
+    int done = 0;
+
+    while (done < numBytes) {
+	int block = (position + done) / SectorSize;
+	int offset = (position + done) % SectorSize;
+	int n = min(SectorSize - offset, numBytes - done);
+	char *data = hdr->DelayedBlock(block);
+
+	if (data == NULL && hdr->ByteToSector(block * SectorSize) != -1)
+	    return done + WriteUnlocked(&from[done], numBytes - done,
+						position + done);
+	if (data == NULL) {
+	    if (!kernel->fileSystem->ReserveBlocks(1))
+		break;				// disk full
+	    if (hdr->NumDelayed() == DelayedBlocks)
+		kernel->fileSystem->FlushDelayed(hdr);
+	    data = hdr->AddDelayed(block);
+	}
+	bcopy(&from[done], &data[offset], n);
+	done += n;
+    }
+    return done;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::ReadChunks, OpenFile::WriteChunks
+//	MP4 MODIFIED
+// 	Read/write part of a compressed file, a chunk at a time.  A
+//	chunk is decompressed once however many reads it takes (see
+//	FileHeader::LoadChunk); a write patches the chunk and stores it
+//	compressed again (FileSystem::WriteChunk), without reading it
+//	first if it is all overwritten.  The write is cut short only
+//	if the disk is full.
+//
+//	"into" -- the buffer to contain the data read
+//	"from" -- the buffer containing the data to be written
+//	"numBytes" -- the number of bytes to transfer, all in the file
+//	"position" -- the offset within the file of the first byte
+//----------------------------------------------------------------------
+
+void
+OpenFile::ReadChunks(char *into, int numBytes, int position)
+{
+    int done = 0;
+
+    while (done < numBytes) {
+	int chunk = (position + done) / ChunkSize;
+	int offset = (position + done) % ChunkSize;
+	int n = min(ChunkSize - offset, numBytes - done);
+
+	bcopy(&hdr->LoadChunk(chunk)[offset], &into[done], n);
+	done += n;
+    }
+}
+
+int
+OpenFile::WriteChunks(char *from, int numBytes, int position)
+{
+    int done = 0;
+
+    while (done < numBytes) {
+	int chunk = (position + done) / ChunkSize;
+	int offset = (position + done) % ChunkSize;
+	int n = min(ChunkSize - offset, numBytes - done);
+
+	bcopy(&from[done], &hdr->LoadChunk(chunk, n == ChunkSize)[offset], n);
+	if (!kernel->fileSystem->WriteChunk(hdr, chunk))
+	    break;				// disk full
+	done += n;
+    }
+    return done;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::WriteBlocks
+//	MP4 MODIFIED
+// 	Write part of a deduplicated file, a block at a time: each block
+//	is patched (read first, unless it is all overwritten) and handed
+//	to FileSystem::StoreBlock, which may point it at a sector holding
+//	the same bytes instead of writing it.  The write is cut short
+//	only if the disk is full.
+//
+//	"from" -- the buffer containing the data to be written
+//	"numBytes" -- the number of bytes to transfer, all in the file
+//	"position" -- the offset within the file of the first byte
+//----------------------------------------------------------------------
+
+int
+OpenFile::WriteBlocks(char *from, int numBytes, int position)
+{
+    char buf[SectorSize];
+    int done = 0;
+
+    while (done < numBytes) {
+	int block = (position + done) / SectorSize;
+	int offset = (position + done) % SectorSize;
+	int n = min(SectorSize - offset, numBytes - done);
+
+	if (n < SectorSize)
+	    ReadBlock(block, hdr->ByteToSector(block * SectorSize), buf);
+	bcopy(&from[done], &buf[offset], n);
+	if (!kernel->fileSystem->StoreBlock(hdr, block, buf))
+	    break;				// disk full
+	done += n;
+    }
+    return done;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::ZeroFill
+//	MP4 MODIFIED
+// 	Clear the bytes from "start" up to "end" of a file that has just
+//	grown past a gap, so that the old contents of its new blocks
+//	never show through.  Called by WriteUnlocked, which already has
+//	the file's lock if it takes one.
+//----------------------------------------------------------------------
+
+void
+OpenFile::ZeroFill(int start, int end)
+{
+    char zeros[SectorSize];
+
+    bzero(zeros, SectorSize);
+    while (start < end) {
+	int len = min(SectorSize - start % SectorSize, end - start);
+
+	WriteUnlocked(zeros, len, start);
+	start += len;
+    }
+}
+
 //----------------------------------------------------------------------
 // OpenFile::Length
 // 	Return the number of bytes in the file.
@@ -196,4 +848,29 @@ OpenFile::Length()
     return hdr->FileLength(); 
 }
 
+//----------------------------------------------------------------------
+// OpenFile::HeaderSector
+//	MP4 MODIFIED
+// 	Return the sector holding the file's header.
+//----------------------------------------------------------------------
+
+int
+OpenFile::HeaderSector() 
+{ 
+    return hdr->GetSector(); 
+}
+
+//----------------------------------------------------------------------
+// OpenFile::GetLock
+//	MP4 MODIFIED
+// 	Return the reader-writer lock of the file, shared by every open
+//	of it since they share the header.
+//----------------------------------------------------------------------
+
+RWLock *
+OpenFile::GetLock() 
+{ 
+    return hdr->GetLock(); 
+}
+
 #endif //FILESYS_STUB
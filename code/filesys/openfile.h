@@ -23,13 +23,15 @@
 #include "copyright.h"
 #include "utility.h"
 #include "sysdep.h"
+#include "list.h"
 
 #ifdef FILESYS_STUB			// Temporarily implement calls to 
 					// Nachos file system as calls to UNIX!
 					// See definitions listed under #else
 class OpenFile {
   public:
-    OpenFile(int f) { file = f; currentOffset = 0; }	// open the file
+    OpenFile(int f) { file = f; currentOffset = 0; appending = FALSE; }
+    							// open the file
     ~OpenFile() { Close(file); }			// close the file
 
     int ReadAt(char *into, int numBytes, int position) { 
@@ -47,20 +49,30 @@ class OpenFile {
 		return numRead;
     		}
     int Write(char *from, int numBytes) {
+		if (appending)
+		    currentOffset = Length();
 		int numWritten = WriteAt(from, numBytes, currentOffset); 
 		currentOffset += numWritten;
 		return numWritten;
 		}
 
     int Length() { Lseek(file, 0, 2); return Tell(file); }
+    void Seek(int position) { currentOffset = position; }
+    void SetAppend() { appending = TRUE; }	// Write at the end
+    void FlushAppend() {}
     
   private:
     int file;
     int currentOffset;
+    bool appending;
 };
 
 #else // FILESYS
 class FileHeader;
+class DiskRequest;
+class RWLock;
+
+#define MaxReadAhead	8		// largest read-ahead window, in sectors
 
 class OpenFile {
   public:
@@ -68,6 +80,10 @@ class OpenFile {
 					// at "sector" on the disk
     ~OpenFile();			// Close the file
 
+    static void *operator new(size_t size);
+    static void operator delete(void *p);
+    					// MP4 MODIFIED: from a SlabCache
+
     void Seek(int position); 		// Set the position from which to 
 					// start reading/writing -- UNIX lseek
 
@@ -76,6 +92,18 @@ class OpenFile {
 					// Return the # actually read/written,
 					// and increment position in file.
     int Write(char *from, int numBytes);
+    int WriteBehind(char *from, int numBytes);
+    					// MP4 MODIFIED: as Write, but whole
+					// sectors are only queued to the
+					// disk; "from" must be left alone
+					// until WaitWrites
+    void WaitWrites();			// Wait for every queued write
+    int ReadBehind(char *into, int numBytes);
+    					// MP4 MODIFIED: as Read, but whole
+					// sectors are only queued to the
+					// disk; "into" must be left alone
+					// until WaitReads
+    void WaitReads() { WaitWrites(); }	// Wait for every queued read
 
     int ReadAt(char *into, int numBytes, int position);
     					// Read/write bytes from the file,
@@ -86,10 +114,64 @@ class OpenFile {
 					// file (this interface is simpler 
 					// than the UNIX idiom -- lseek to 
 					// end of file, tell, lseek back 
+    int HeaderSector();			// MP4 MODIFIED: where the file's
+					// header is on disk
+    RWLock *GetLock();			// MP4 MODIFIED: the lock shared by
+    					// all opens of the file
+    void SetLocking() { locking = TRUE; }
+    					// Take that lock in ReadAt and
+					// WriteAt, as files opened for
+					// users do; the file system's own
+					// directory files hold it around
+					// whole operations instead
+    void SetAppend();			// Make every Write go at the end of
+					// the file, as with O_APPEND
+    void FlushAppend();			// Write the length appends left in
+					// the in-core header back to disk
     
   private:
     FileHeader *hdr;			// Header for this file 
     int seekPosition;			// Current position within the file
+
+    // MP4 MODIFIED: append mode (see Append)
+    bool appending;			// set by SetAppend
+    char *tail;				// copy of the last block written, made
+					// on the first append
+    int tailBlock;			// which block it is, or -1
+    int tailSector;			// and its sector
+    int tailWrites;			// the header's write count just after
+					// it was last written; any other
+					// write since may have changed it
+    bool lengthDirty;			// the header's length is ahead of
+					// the disk's
+    int Append(char *from, int numBytes);	// Write, in append mode
+    bool CanAppendFast(int length, int numBytes);
+    					// could it be done in the tail?
+
+    // MP4 MODIFIED: sequential read-ahead
+    int nextReadPosition;		// where a sequential read would start
+    int readAheadWindow;		// sectors to prefetch past each read
+    int prefetchedUpTo;			// last sector already handed to
+					// SynchDisk::Prefetch, -1 if none
+    void ReadAhead(int lastSector);	// prefetch past "lastSector"
+    void ZeroFill(int start, int end);	// clear a gap left by growth
+    void ReadBlock(int block, int sector, char *buf);
+					// read a sector, or a hole
+    List<DiskRequest *> *inFlight;	// writes queued by WriteBehind
+    bool locking;			// ReadAt/WriteAt take hdr's lock
+    int ReadUnlocked(char *into, int numBytes, int position);
+    int WriteUnlocked(char *from, int numBytes, int position);
+    					// ReadAt/WriteAt, with the lock
+					// held if there is one
+    int WriteDelayed(char *from, int numBytes, int position);
+    					// write into holes by having the
+					// header hold the blocks back
+    void ReadChunks(char *into, int numBytes, int position);
+    int WriteChunks(char *from, int numBytes, int position);
+    					// ReadAt/WriteAt, for a compressed
+					// file
+    int WriteBlocks(char *from, int numBytes, int position);
+    					// WriteAt, for a deduplicated file
 };
 
 #endif // FILESYS
@@ -8,6 +8,7 @@
 
 #include "copyright.h"
 #include "pbitmap.h"
+#include "synchdisk.h"
 
 //----------------------------------------------------------------------
 // PersistentBitmap::PersistentBitmap(int)
@@ -21,6 +22,20 @@
 
 PersistentBitmap::PersistentBitmap(int numItems):Bitmap(numItems) 
 { 
+    numMapSectors = divRoundUp(numWords * sizeof(unsigned), SectorSize);
+    dirty = new bool[numMapSectors];
+    for (int i = 0; i < numMapSectors; i++)
+	dirty[i] = TRUE;		// nothing is on disk yet
+
+    numGroups = divRoundUp(numBits, SectorsPerGroup);
+    groupFree = new int[numGroups];
+    groupRun = new int[numGroups];
+    RecountGroups();
+    numReserved = 0;
+    freed = new bool[numBits];
+    for (int i = 0; i < numBits; i++)
+	freed[i] = FALSE;
+    numFreed = 0;
 }
 
 //----------------------------------------------------------------------
@@ -41,6 +56,22 @@ PersistentBitmap::PersistentBitmap(OpenFile *file, int numItems):Bitmap(numItems
     // but we will just overwrite that with the contents of the
     // map found in the file
     file->ReadAt((char *)map, numWords * sizeof(unsigned), 0);
+    Recount();
+
+    numMapSectors = divRoundUp(numWords * sizeof(unsigned), SectorSize);
+    dirty = new bool[numMapSectors];
+    for (int i = 0; i < numMapSectors; i++)
+	dirty[i] = FALSE;
+
+    numGroups = divRoundUp(numBits, SectorsPerGroup);
+    groupFree = new int[numGroups];
+    groupRun = new int[numGroups];
+    RecountGroups();
+    numReserved = 0;
+    freed = new bool[numBits];
+    for (int i = 0; i < numBits; i++)
+	freed[i] = FALSE;
+    numFreed = 0;
 }
 
 //----------------------------------------------------------------------
@@ -50,6 +81,246 @@ PersistentBitmap::PersistentBitmap(OpenFile *file, int numItems):Bitmap(numItems
 
 PersistentBitmap::~PersistentBitmap()
 { 
+    delete [] dirty;
+    delete [] groupFree;
+    delete [] groupRun;
+    delete [] freed;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::SetDirty
+// 	Remember that the sector of the bitmap file holding bit "which"
+//	no longer matches the disk.
+//----------------------------------------------------------------------
+
+void
+PersistentBitmap::SetDirty(int which)
+{
+    dirty[(which / BitsInByte) / SectorSize] = TRUE;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::RecountGroup
+// 	Recompute how many bits of allocation group "group" are clear,
+//	and the longest run of them.  A group is only a track's worth of
+//	bits, so this is done after every change to one of them.
+//----------------------------------------------------------------------
+
+void
+PersistentBitmap::RecountGroup(int group)
+{
+    int first = group * SectorsPerGroup;
+    int last = min(first + SectorsPerGroup, numBits);
+    int run = 0;
+
+    groupFree[group] = 0;
+    groupRun[group] = 0;
+    for (int i = first; i < last; i++) {
+	if (Test(i)) {
+	    run = 0;
+	    continue;
+	}
+	groupFree[group]++;
+	if (++run > groupRun[group])
+	    groupRun[group] = run;
+    }
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::RecountGroups
+// 	Recompute the summary of every group, after the whole map has
+//	been loaded.  The summaries are not stored on disk: they follow
+//	from the bits, so they can never disagree with them.
+//----------------------------------------------------------------------
+
+void
+PersistentBitmap::RecountGroups()
+{
+    for (int g = 0; g < numGroups; g++)
+	RecountGroup(g);
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::NearestGroup
+// 	Return the group closest to group "home" (home itself, then
+//	one on either side, and so on) that has a run of at least "run"
+//	clear bits, or -1 if none does.  Only the summaries are looked at.
+//----------------------------------------------------------------------
+
+int
+PersistentBitmap::NearestGroup(int home, int run) const
+{
+    for (int d = 0; d < numGroups; d++) {
+	if (home + d < numGroups && groupRun[home + d] >= run)
+	    return home + d;
+	if (d > 0 && home - d >= 0 && groupRun[home - d] >= run)
+	    return home - d;
+    }
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::Mark, PersistentBitmap::Clear
+// 	Set or clear the "nth" bit, as in Bitmap, and note that its
+//	sector must be written back.  A cleared bit's sector is also
+//	noted for Discard.
+//----------------------------------------------------------------------
+
+void
+PersistentBitmap::Mark(int which)
+{
+    Bitmap::Mark(which);
+    SetDirty(which);
+    RecountGroup(which / SectorsPerGroup);
+}
+
+void
+PersistentBitmap::Clear(int which)
+{
+    Bitmap::Clear(which);
+    SetDirty(which);
+    RecountGroup(which / SectorsPerGroup);
+    if (!freed[which]) {
+	freed[which] = TRUE;
+	numFreed++;
+    }
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::Discard
+// 	Tell "disk" which of the sectors freed since the last call are
+//	still free, a run of them at a time; one taken again meanwhile
+//	holds live data, and is left out.  The caller makes sure the
+//	free map saying they are free is safely on disk, and that no
+//	one changes the map while this runs.
+//----------------------------------------------------------------------
+
+void
+PersistentBitmap::Discard(SynchDisk *disk)
+{
+    int start = -1;
+
+    for (int i = 0; i <= numBits; i++) {
+	bool dead = (i < numBits && freed[i] && !Test(i));
+
+	if (dead && start == -1)
+	    start = i;
+	else if (!dead && start != -1) {
+	    disk->Discard(start, i - start);
+	    start = -1;
+	}
+	if (i < numBits)
+	    freed[i] = FALSE;
+    }
+    numFreed = 0;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::FindAndSet
+// 	As Bitmap::FindAndSet, but also note the changed sector.
+//----------------------------------------------------------------------
+
+int
+PersistentBitmap::FindAndSet()
+{
+    int which = Bitmap::FindAndSet();
+
+    if (which != -1) {
+	SetDirty(which);
+	RecountGroup(which / SectorsPerGroup);
+    }
+    return which;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::FindAndSetNear
+// 	Set the clear bit nearest to bit "near", looking only in the
+//	closest group to it that has any, and return its number; -1 if
+//	no bits are clear.  Used to put a new file header on the same
+//	track as its directory, or as few tracks away as there is room.
+//
+//	"near" is the bit to be close to
+//----------------------------------------------------------------------
+
+int
+PersistentBitmap::FindAndSetNear(int near)
+{
+    int group, first, last, best = -1;
+
+    if (near < 0 || near >= numBits)
+	near = 0;
+    group = NearestGroup(near / SectorsPerGroup, 1);
+    if (group == -1)
+	return -1;
+
+    first = group * SectorsPerGroup;
+    last = min(first + SectorsPerGroup, numBits);
+    for (int i = first; i < last; i++) {
+	if (!Test(i) && (best == -1 || abs(i - near) < abs(best - near)))
+	    best = i;
+    }
+    ASSERT(best != -1);
+    Mark(best);
+    return best;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::FindRunNear
+// 	As Bitmap::FindRun, but start in the closest group to bit "near"
+//	that has a long enough run, or, for runs longer than a group, is
+//	entirely clear; the summaries say which that is without reading
+//	the bits of the groups in between.  In the group holding "near",
+//	the search starts at "near" itself, so what follows it is used
+//	first.  No bits are changed.
+//
+//	"n" is the number of clear bits wanted
+//	"near" is the bit to be close to
+//	"length" is where to put the length of the run found
+//----------------------------------------------------------------------
+
+int
+PersistentBitmap::FindRunNear(int n, int near, int *length)
+{
+    int home, group, start;
+
+    if (near < 0 || near >= numBits)
+	near = 0;
+    home = near / SectorsPerGroup;
+    group = NearestGroup(home, min(n, SectorsPerGroup));
+    if (group == -1)
+	return FindRun(n, near, length);	// take the longest there is
+
+    if (group == home) {
+	start = FindRun(n, near, length);
+	if (*length == n && start / SectorsPerGroup == home)
+	    return start;
+	// the run in this group is before "near"
+    }
+    return FindRun(n, group * SectorsPerGroup, length);
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::Reserve, PersistentBitmap::Unreserve
+// 	Promise "n" clear bits to someone who will set them later, or
+//	give back such a promise, once the bits are set or no longer
+//	needed.  Reserve returns FALSE, promising nothing, if there are
+//	not that many clear bits left unpromised.
+//----------------------------------------------------------------------
+
+bool
+PersistentBitmap::Reserve(int n)
+{
+    if (NumClear() < n)
+	return FALSE;
+    numReserved += n;
+    return TRUE;
+}
+
+void
+PersistentBitmap::Unreserve(int n)
+{
+    ASSERT(n <= numReserved);
+    numReserved -= n;
 }
 
 //----------------------------------------------------------------------
@@ -63,6 +334,10 @@ void
 PersistentBitmap::FetchFrom(OpenFile *file) 
 {
     file->ReadAt((char *)map, numWords * sizeof(unsigned), 0);
+    Recount();
+    RecountGroups();
+    for (int i = 0; i < numMapSectors; i++)
+	dirty[i] = FALSE;
 }
 
 //----------------------------------------------------------------------
@@ -76,4 +351,30 @@ void
 PersistentBitmap::WriteBack(OpenFile *file)
 {
    file->WriteAt((char *)map, numWords * sizeof(unsigned), 0);
+   for (int i = 0; i < numMapSectors; i++)
+	dirty[i] = FALSE;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::WriteDirty
+// 	Store only the sectors of the bitmap that changed since they
+//	were last read or written.
+//
+//	"file" is the place to write the bitmap to
+//----------------------------------------------------------------------
+
+void
+PersistentBitmap::WriteDirty(OpenFile *file)
+{
+    int mapBytes = numWords * sizeof(unsigned);
+
+    for (int i = 0; i < numMapSectors; i++) {
+	if (dirty[i]) {
+	    int offset = i * SectorSize;
+	    int len = min(SectorSize, mapBytes - offset);
+
+	    file->WriteAt((char *)map + offset, len, offset);
+	    dirty[i] = FALSE;
+	}
+    }
 }
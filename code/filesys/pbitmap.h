@@ -16,10 +16,36 @@
 #include "copyright.h"
 #include "bitmap.h"
 #include "openfile.h"
+#include "disk.h"
+
+#define SectorsPerGroup	SectorsPerTrack	// bits in one allocation group
+#define DiscardBatch	8		// freed sectors worth telling the
+					// disk about
+
+class SynchDisk;
 
 // The following class defines a persistent bitmap.  It inherits all
 // the behavior of a bitmap (see bitmap.h), adding the ability to
 // be read from and stored to the disk.
+//
+// MP4 MODIFIED
+// The bitmap also remembers which sectors of its backing file have
+// been changed since the last write, so that a resident bitmap can
+// write back only those with WriteDirty().
+//
+// It also keeps, for each allocation group (one disk track), how many
+// of its sectors are free and the longest run of them, so that
+// FindAndSetNear() and FindRunNear() can pick the nearest track with
+// room without scanning the bits of the full ones.  The summaries are
+// recomputed from the bits whenever the map is read from disk.
+//
+// Bits can be reserved without choosing which ones, for data that will
+// only be given sectors later (see FileHeader::FlushDelayed); NumClear()
+// leaves them out, so no one else can take the space meanwhile.
+//
+// The sectors cleared are remembered too, until Discard() passes the
+// ones still clear on to the disk, in runs, so that it can forget
+// their contents (see SynchDisk::Discard).
 
 class PersistentBitmap : public Bitmap {
   public:
@@ -28,8 +54,48 @@ class PersistentBitmap : public Bitmap {
 
     ~PersistentBitmap(); 			// deallocate bitmap
 
+    void Mark(int which);		// Set/clear the "nth" bit, and
+    void Clear(int which);		// remember its sector is dirty
+    int FindAndSet();			// as Bitmap::FindAndSet, and dirty
+    int FindAndSetNear(int near);	// set the clear bit nearest "near",
+					// in the closest group with one
+    int FindRunNear(int n, int near, int *length);
+					// as FindRun, but in the closest group
+					// to "near" with a long enough run
+
+    int NumClear() const { return numClear - numReserved; }
+    					// clear bits not already promised
+    bool Reserve(int n);		// promise "n" clear bits to blocks
+    void Unreserve(int n);		// not yet allocated, or take back
+
     void FetchFrom(OpenFile *file);     // read bitmap from the disk
     void WriteBack(OpenFile *file); 	// write bitmap contents to disk 
+    void WriteDirty(OpenFile *file);	// write only the changed sectors
+
+    int NumFreed() const { return numFreed; }
+    					// sectors cleared since Discard
+    void Discard(SynchDisk *disk);	// tell "disk" of those still clear
+
+  private:
+    void SetDirty(int which);		// mark the sector holding bit "which"
+    void RecountGroup(int group);	// recompute one group's summary
+    void RecountGroups();		// and every group's
+    int NearestGroup(int home, int run) const;
+					// closest group to "home" with a free
+					// run of "run" bits, or -1
+
+    int numMapSectors;			// sectors the bitmap occupies on disk
+    bool *dirty;			// dirty[i]: sector i changed since
+					// the last write to disk
+
+    int numGroups;			// allocation groups, one per track
+    int *groupFree;			// groupFree[g]: clear bits in group g
+    int *groupRun;			// groupRun[g]: longest run of them
+    int numReserved;			// clear bits promised by Reserve
+
+    bool *freed;			// freed[i]: bit i cleared since the
+					// last Discard
+    int numFreed;			// how many are
 };
 
 #endif // PBITMAP_H
@@ -0,0 +1,74 @@
+// snapshot.cc
+//	Routines to take a snapshot of the file system and roll back to
+//	it.  See snapshot.h.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "debug.h"
+#include "snapshot.h"
+#include "synchdisk.h"
+#include "journal.h"
+#include "slab.h"
+
+//----------------------------------------------------------------------
+// Snapshot::Snapshot
+// 	Freeze the sectors set in "inUse", the free map when the snapshot
+//	is taken; but for the log region, any of them written from now
+//	on is kept first.
+//----------------------------------------------------------------------
+
+Snapshot::Snapshot(Bitmap *inUse)
+{
+    frozen = new Bitmap(NumSectors);
+    for (int i = 0; i < NumSectors; i++) {
+	if (i < inUse->NumBits() && inUse->Test(i) &&
+		(i < LogSector || i >= LogSector + LogSize))
+	    frozen->Mark(i);
+	saved[i] = NULL;
+    }
+    numKept = 0;
+}
+
+Snapshot::~Snapshot()
+{
+    for (int i = 0; i < NumSectors; i++)
+	KernelFree(saved[i], SectorSize, MemFilesys);
+    delete frozen;
+}
+
+//----------------------------------------------------------------------
+// Snapshot::Keep
+// 	Keep "data", the contents of "sector" when the snapshot was
+//	taken, before it is first overwritten.  Two writers may both
+//	have read it; the first copy kept is the one.
+//----------------------------------------------------------------------
+
+void
+Snapshot::Keep(int sector, char *data)
+{
+    if (!NeedsCopy(sector))
+	return;
+    DEBUG(dbgFile, "Snapshot keeping sector " << sector);
+    saved[sector] = (char *) KernelAlloc(SectorSize, MemFilesys);
+    bcopy(data, saved[sector], SectorSize);
+    numKept++;
+}
+
+//----------------------------------------------------------------------
+// Snapshot::Restore
+// 	Write the kept sectors back to "disk", through its cache.  The
+//	caller has stopped the disk keeping copies for us first.
+//----------------------------------------------------------------------
+
+void
+Snapshot::Restore(SynchDisk *disk)
+{
+    DEBUG(dbgFile, "Rolling back " << numKept << " sectors");
+    for (int i = 0; i < NumSectors; i++) {
+	if (saved[i] != NULL)
+	    disk->WriteSector(i, saved[i]);
+    }
+}
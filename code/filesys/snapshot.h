@@ -0,0 +1,55 @@
+// snapshot.h
+//	Data structures for a point-in-time snapshot of the file system,
+//	to roll back to, so a test can leave the disk as it found it.
+//
+//	Taking a snapshot copies no sector: it only notes which sectors
+//	are in use (a copy of the free map's bits).  From then on, the
+//	first write to one of those sectors first keeps its old contents
+//	aside (copy on write, see SynchDisk::CachedWrite); sectors that
+//	were free are written as usual, since the snapshot has nothing
+//	in them.  Rolling back puts the kept sectors back, free map file
+//	included, so everything taken since is free again; that costs
+//	what the snapshot's user changed, not the size of the disk.
+//
+//	The kept copies are in memory, not on the disk: a snapshot is for
+//	the phases of one run, and does not survive a crash or a reboot.
+//	The log region is left out; it is the journal's own business.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "copyright.h"
+#include "disk.h"
+#include "bitmap.h"
+
+class SynchDisk;
+
+// The following class defines one snapshot.  Nothing here can be
+// interrupted; SynchDisk calls it with its lock held.
+
+class Snapshot {
+  public:
+    Snapshot(Bitmap *inUse);		// Freeze the sectors set in "inUse"
+    ~Snapshot();			// Forget the kept copies
+
+    bool NeedsCopy(int sector)		// Must "sector" be kept before it
+	{ return frozen->Test(sector) && saved[sector] == NULL; }
+					// is first written?
+    void Keep(int sector, char *data);	// Keep "data" as its contents
+    bool IsFrozen(int sector) { return frozen->Test(sector); }
+    int NumKept() { return numKept; }
+
+    void Restore(SynchDisk *disk);	// Write every kept sector back
+
+  private:
+    Bitmap *frozen;			// sectors in use when it was taken
+    char *saved[NumSectors];		// kept contents of each, or NULL
+    					// if it hasn't been written since
+    int numKept;			// how many are kept
+};
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,109 @@
+// superblock.cc
+//	Routines to record and check the layout a disk was formatted
+//	with.  See superblock.h.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+#ifndef FILESYS_STUB
+
+#include "copyright.h"
+#include "debug.h"
+#include "superblock.h"
+#include "filehdr.h"
+#include "journal.h"
+
+//----------------------------------------------------------------------
+// SuperBlock::SuperBlock
+// 	Initialize a superblock describing the layout this kernel was
+//	compiled for; a format writes it out as is.
+//
+//	"sectors" -- how much of the disk the file system covers
+//----------------------------------------------------------------------
+
+SuperBlock::SuperBlock(int sectors)
+{
+    magic = SuperMagic;
+    version = SuperVersion;
+    sectorSize = SectorSize;
+    sectorsPerTrack = SectorsPerTrack;
+    numSectors = sectors;
+    numDirect = NumDirect;
+    logSector = LogSector;
+    logSize = LogSize;
+    flags = 0;
+}
+
+//----------------------------------------------------------------------
+// SuperBlock::FetchFrom
+// 	Read the superblock from the last bytes of the free map file.
+//	Return FALSE, leaving this kernel's layout in place, if the disk
+//	was formatted without one.
+//
+//	"file" -- the free map file
+//----------------------------------------------------------------------
+
+bool
+SuperBlock::FetchFrom(OpenFile *file)
+{
+    SuperBlock stored;
+    int offset = file->Length() - (int) sizeof(SuperBlock);
+
+    if (offset < 0 || file->ReadAt((char *) &stored, sizeof(SuperBlock),
+				offset) != sizeof(SuperBlock) ||
+		stored.magic != SuperMagic) {
+	DEBUG(dbgFile, "Disk has no superblock, assuming this kernel's layout");
+	return FALSE;
+    }
+    *this = stored;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// SuperBlock::WriteBack
+// 	Write the superblock into the free map file.
+//
+//	"file" -- the free map file
+//	"offset" -- where the share counts end
+//----------------------------------------------------------------------
+
+void
+SuperBlock::WriteBack(OpenFile *file, int offset)
+{
+    (void) file->WriteAt((char *) this, sizeof(SuperBlock), offset);
+}
+
+//----------------------------------------------------------------------
+// SuperBlock::Matches
+// 	Return TRUE if the disk was formatted for the geometry and
+//	layout this kernel uses, on no more sectors than its disk has;
+//	otherwise print the first difference.
+//----------------------------------------------------------------------
+
+bool
+SuperBlock::Matches()
+{
+    if (version != SuperVersion) {
+	printf("Disk layout is version %d, this kernel reads version %d\n",
+		version, SuperVersion);
+	return FALSE;
+    }
+    if (sectorSize != SectorSize || sectorsPerTrack != SectorsPerTrack ||
+		numSectors > NumSectors) {
+	printf("Disk was formatted for %d sectors of %d bytes (%d per track), "
+		"this kernel has at most %d of %d bytes (%d per track)\n",
+		numSectors, sectorSize, sectorsPerTrack,
+		NumSectors, SectorSize, SectorsPerTrack);
+	return FALSE;
+    }
+    if (numDirect != NumDirect || logSector != LogSector ||
+		logSize != LogSize) {
+	printf("Disk was formatted with %d header pointers and a %d sector "
+		"log at %d, this kernel uses %d, %d and %d\n",
+		numDirect, logSize, logSector, NumDirect, LogSize, LogSector);
+	return FALSE;
+    }
+    return TRUE;
+}
+
+#endif //FILESYS_STUB
@@ -0,0 +1,79 @@
+// superblock.h
+//	Data structures for the superblock: a record, written when the
+//	disk is formatted, of the geometry and layout the file system on
+//	it was built for.
+//
+//	The superblock is kept at the end of the free map file, after
+//	the bitmap and the share counts of deduplicated sectors (see
+//	dedup.h), so it is found through the free map's header in its
+//	well-known sector, and needs no sector of its own.  A disk
+//	formatted before there was a superblock has a free map file that
+//	is just the bitmap, and is taken to match the kernel.
+//
+//	The sector count is the one thing a format chooses (nachos
+//	-fsize): the file system can leave out the end of the disk, and
+//	the free map is sized from the count recorded here.  The sector
+//	size, and the header layout that follows from it, are fixed when
+//	the kernel is compiled, so a disk formatted for others, or for
+//	more sectors than this kernel's disk has, is refused at mount,
+//	before anything on it is misread.
+//
+//	A format writes only the superblock, the two well-known headers
+//	and the log header.  The bitmap itself is left unwritten, marked
+//	so in the superblock, since it holds nothing but what the format
+//	allocated; a mount works it out again, and it first reaches the
+//	disk with the first change to it.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef SUPERBLOCK_H
+#define SUPERBLOCK_H
+
+#include "copyright.h"
+#include "disk.h"
+#include "openfile.h"
+
+#define SuperMagic	0x53555052	// "SUPR", marks a superblock
+#define SuperVersion	3		// of the on-disk layout
+#define SuperMapUnwritten 0x1		// flag: the bitmap was never
+					// written since the format
+
+// The following class defines the superblock.  Only the fields are
+// stored on disk, in the host's byte order.
+
+class SuperBlock {
+  public:
+    SuperBlock(int sectors = NumSectors);
+    					// Describe this kernel's layout,
+					// on a file system of "sectors"
+
+    bool FetchFrom(OpenFile *file);	// Read it from the end of the free
+					// map file; FALSE if there is none
+    void WriteBack(OpenFile *file, int offset);
+    					// Write it at "offset" of the free
+					// map file, just after the share
+					// counts
+    bool Matches();			// Can this kernel use the disk?
+					// Prints why not
+
+    int DiskSectors() { return numSectors; }	// sectors the file
+						// system, and so the free
+						// map, covers
+    bool MapUnwritten() { return (flags & SuperMapUnwritten) != 0; }
+    					// Is the bitmap on disk garbage?
+    void SetMapUnwritten() { flags |= SuperMapUnwritten; }
+
+  private:
+    int magic;				// SuperMagic
+    int version;			// SuperVersion
+    int sectorSize;			// bytes per sector
+    int sectorsPerTrack;
+    int numSectors;			// sectors on the disk
+    int numDirect;			// pointers in a file header
+    int logSector, logSize;		// the journal's region
+    int flags;				// SuperMapUnwritten, or 0
+};
+
+#endif // SUPERBLOCK_H
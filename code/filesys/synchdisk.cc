@@ -7,8 +7,24 @@
 //
 //	Use a semaphore to synchronize the interrupt handlers with the
 //	pending requests.  And, because the physical disk can only
-//	handle one operation at a time, use a lock to enforce mutual
-//	exclusion.
+//	handle one operation at a time, requests queue up until the
+//	interrupt handler starts them.
+//
+//	MP4 MODIFIED
+//	Sectors pass through a small LRU write-back cache, so repeated
+//	access to the free map, directory and file headers does not go
+//	to the disk every time.  The cache lock is dropped while a
+//	request is at the disk, so several threads can have requests
+//	pending, and they are served in elevator order.  Threads wait
+//	for a busy entry on that entry alone, so a hit is never held up
+//	by a miss on another sector.  With the
+//	sectors striped across several disks, each disk has a queue of
+//	its own and they all work at once.
+//
+//	An offline SynchDisk has no simulated Disk at all: each request
+//	is done at once on the disk image, which is mapped into memory
+//	so a sector is just copied in or out.  It is used to build an
+//	image (nachos -build), which then takes no simulated disk time.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
@@ -16,39 +32,851 @@
 
 #include "copyright.h"
 #include "synchdisk.h"
+#include "journal.h"
+#include "snapshot.h"
+#include "filehdr.h"
+#include "iotrace.h"
+#include "workpool.h"
+#include "kregion.h"
+#include "main.h"
+
+
+static char *policyNames[] = { "fifo", "sstf", "cscan" };
+
+static int EntrySector(CacheEntry *entry) { return entry->sector; }
+static unsigned HashSector(int sector) { return (unsigned) sector; }
+
+//----------------------------------------------------------------------
+// DiskRequest::DiskRequest, DiskRequest::~DiskRequest
+// 	A single sector transfer waiting for the disk.
+//
+//	"toCall" -- if not NULL, called back when the transfer is done,
+//		instead of waking up a waiting thread
+//
+//	The request is of the I/O class of the thread making it.
+//----------------------------------------------------------------------
 
+DiskRequest::DiskRequest(int sectorNumber, char* buffer, bool isWrite,
+				CallBackObj *toCall)
+{
+    sector = sectorNumber;
+    data = buffer;
+    writing = isWrite;
+    passedOver = 0;
+    ioClass = kernel->currentThread->ioClass;
+    finished = FALSE;
+    callWhenDone = toCall;
+    rider = NULL;
+    adjacent = NULL;
+    submitted = 0;
+    done = new Semaphore("disk request", 0);
+}
+
+DiskRequest::~DiskRequest()
+{
+    delete done;
+}
 
 //----------------------------------------------------------------------
 // SynchDisk::SynchDisk
 // 	Initialize the synchronous interface to the physical disk, in turn
 //	initializing the physical disk.
 //
+//	"policyName" -- how to order pending requests: "fifo", "sstf",
+//		or "cscan"; NULL means "cscan"
+//	"window" -- how many ticks a written sector may stay dirty in
+//		the cache before the flusher writes it back
+//	"offline" -- create a fresh disk image and access it directly,
+//		rather than through the simulated disk
+//	"disks" -- how many disks to stripe the sectors across
 //----------------------------------------------------------------------
 
-SynchDisk::SynchDisk()
+SynchDisk::SynchDisk(char *policyName, int window, bool offline, int disks)
 {
-    semaphore = new Semaphore("synch disk", 0);
+    int hostName = kernel->hostName;
+
+    ASSERT(disks >= 1 && disks <= MaxDisks);
+    // an overlay (-db) is only put together by the raw Disk
+    ASSERT(kernel->diskBase == NULL || !offline);
     lock = new Lock("synch disk lock");
-    disk = new Disk(this);
+    entryIdle = new Condition("synch disk idle entry");
+    numDisks = disks;
+    this->offline = offline;
+    for (int i = 0; i < numDisks; i++) {
+	Spindle *s = &spindles[i];
+
+	s->owner = this;
+	s->pending = new List<DiskRequest *>;
+	s->active = NULL;
+	s->headSector = 0;
+	if (offline) {
+	    char imageName[32];
+	    int magicNum = ImageMagicNumber;
+	    int tmp = 0;
+
+	    sprintf(imageName, "DISK_%d", hostName + i);
+	    DEBUG(dbgDisk, "Building disk image " << imageName << " offline");
+	    s->disk = NULL;
+	    s->imageFd = OpenForWrite(imageName);
+	    WriteFile(s->imageFd, (char *) &magicNum, ImageMagicSize);
+	    Lseek(s->imageFd, ImageSize - sizeof(int), 0);
+	    WriteFile(s->imageFd, (char *) &tmp, sizeof(int));
+	    s->image = MapFile(s->imageFd, ImageSize);
+	} else {
+	    kernel->hostName = hostName + i;	// Disk names its file
+	    s->disk = new Disk(s);		// after the host id
+	    s->imageFd = -1;
+	    s->image = NULL;
+	}
+    }
+    kernel->hostName = hostName;
+
+    policy = DiskCSCAN;
+    if (policyName != NULL) {
+	if (strcmp(policyName, "fifo") == 0)
+	    policy = DiskFIFO;
+	else if (strcmp(policyName, "sstf") == 0)
+	    policy = DiskSSTF;
+	else
+	    ASSERT(strcmp(policyName, "cscan") == 0);
+    }
+    kernel->stats->diskPolicy = policyNames[policy];
+    journal = NULL;
+    snapshot = NULL;
+
+    for (int i = 0; i < NumCacheEntries; i++) {
+	cache[i].sector = -1;
+	cache[i].valid = FALSE;
+	cache[i].dirty = FALSE;
+	cache[i].busy = FALSE;
+	cache[i].waiters = new Condition("cache entry");
+	cache[i].dirtySince = 0;
+	cache[i].lastUsed = 0;
+    }
+    cached = new OpenHashTable<int, CacheEntry *>(EntrySector, HashSector);
+    useClock = 0;
+
+    prefetchQueue = new BoundedSynchList<int>(PrefetchQueueSize);
+    flushWindow = window;
+    flushPending = FALSE;
 }
 
 //----------------------------------------------------------------------
 // SynchDisk::~SynchDisk
 // 	De-allocate data structures needed for the synchronous disk
 //	abstraction.
+//
+//	A prefetch task may still be queued for a worker, so we don't
+//	deallocate prefetchQueue.
 //----------------------------------------------------------------------
 
 SynchDisk::~SynchDisk()
 {
-    delete disk;
+    Flush();
+    for (int i = 0; i < numDisks; i++) {
+	Spindle *s = &spindles[i];
+
+	if (s->disk != NULL) {
+	    delete s->disk;
+	} else {
+	    if (s->image != NULL)
+		UnmapFile(s->image, ImageSize);	// the image is complete
+	    Close(s->imageFd);
+	}
+	delete s->pending;
+    }
+    for (int i = 0; i < NumCacheEntries; i++) {
+	if (cache[i].sector != -1)
+	    cached->Remove(cache[i].sector);
+	delete cache[i].waiters;
+    }
+    delete cached;
+    delete entryIdle;
     delete lock;
-    delete semaphore;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::DiskRead, SynchDisk::DiskWrite
+// 	Send a single request to the raw disk and wait for it to finish.
+//	The caller must hold the lock, and must have marked the cache
+//	entry owning "data" busy: the lock is released while we wait.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::DiskRead(int sectorNumber, char* data)
+{
+    DiskRequestWait(sectorNumber, data, FALSE);
+}
+
+void
+SynchDisk::DiskWrite(int sectorNumber, char* data)
+{
+    DiskRequestWait(sectorNumber, data, TRUE);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::DiskRequestWait
+// 	Submit a request and sleep until it is done.  The caller holds
+//	the lock, which is released meanwhile.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::DiskRequestWait(int sectorNumber, char* data, bool writing)
+{
+    DiskRequest *request = new DiskRequest(sectorNumber, data, writing);
+
+    ASSERT(lock->IsHeldByCurrentThread());
+    lock->Release();
+    WaitFor(Submit(request));
+    AcquireLock();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Submit
+// 	Start "request" at once if the disk is idle, otherwise queue
+//	it for the interrupt handler.  Returns the handle the caller
+//	should get back: NULL if the request will be freed once its
+//	callback has run.
+//----------------------------------------------------------------------
+
+DiskRequest *
+SynchDisk::Submit(DiskRequest *request)
+{
+    DiskRequest *handle = (request->callWhenDone == NULL) ? request : NULL;
+    Spindle *spindle = SpindleOf(request->sector);
+    IntStatus oldLevel;
+    int depth;
+
+    if (offline) {			// no queue, no waiting
+	HostTransfer(spindle, request);
+	return Complete(request);
+    }
+    oldLevel = kernel->interrupt->SetLevel(IntOff);
+
+    request->submitted = kernel->stats->totalTicks;
+    depth = spindle->pending->NumInList() + (spindle->active != NULL);
+    kernel->stats->diskQueueSum += depth;
+    kernel->stats->diskQueueSamples++;
+    if (depth > kernel->stats->diskQueueMax)
+	kernel->stats->diskQueueMax = depth;
+    if (spindle->active == NULL)
+	StartRequest(spindle, request);
+    else if (!Combine(spindle, request))
+	spindle->pending->Append(request);
+    (void) kernel->interrupt->SetLevel(oldLevel);
+    return handle;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Combine
+// 	Serve "request" together with the last request waiting for the
+//	same sector, if there is one and the two can be merged:
+//	    write after write -- the waiting write takes the new data,
+//		and finishes both
+//	    read after write -- the read is satisfied at once from the
+//		data being written
+//	    read after read -- the waiting read finishes both
+//	Only the last waiting request for the sector is looked at, so
+//	nothing moves past another request for that sector.  The waiting
+//	request takes the more urgent of the two I/O classes.  Returns
+//	FALSE if "request" must be queued on its own.
+//	Called with interrupts off.
+//----------------------------------------------------------------------
+
+bool
+SynchDisk::Combine(Spindle *spindle, DiskRequest *request)
+{
+    ListIterator<DiskRequest *> it(spindle->pending);
+    DiskRequest *last = NULL;
+
+    for (; !it.IsDone(); it.Next()) {
+	if (it.Item()->sector == request->sector)
+	    last = it.Item();
+    }
+    if (last == NULL || (request->writing && !last->writing))
+	return FALSE;
+
+    kernel->stats->numDiskCombined++;
+    if (request->ioClass < last->ioClass)
+	last->ioClass = request->ioClass;
+    if (request->writing)
+	last->data = request->data;	// only the newest copy goes out
+    if (last->writing && !request->writing) {
+	bcopy(last->data, request->data, SectorSize);
+	(void) Complete(request);
+	return TRUE;
+    }
+    while (last->rider != NULL)
+	last = last->rider;
+    last->rider = request;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Complete
+// 	Finish "request" without going to the disk, because the cache
+//	(or the journal) already satisfied it.  Returns the handle as Submit does.
+//----------------------------------------------------------------------
+
+DiskRequest *
+SynchDisk::Complete(DiskRequest *request)
+{
+    request->finished = TRUE;
+    if (request->callWhenDone != NULL) {
+	request->callWhenDone->CallBack();
+	delete request;
+	return NULL;
+    }
+    request->done->V();
+    return request;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::AcquireLock
+// 	Acquire the lock, and count how long we had to wait for it.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::AcquireLock()
+{
+    int start = kernel->stats->totalTicks;
+
+    lock->Acquire();
+    kernel->stats->diskLockTicks += kernel->stats->totalTicks - start;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::ReadSectorAsync
+// 	Start reading a sector into "data" and return without waiting.
+//	A cached copy satisfies the request immediately.  Otherwise the
+//	sector goes to the disk and, unlike ReadSector, is not cached.
+//	May sleep briefly if the sector's cache entry is being read in.
+//
+//	"sectorNumber" -- the disk sector to read
+//	"data" -- the buffer; must stay valid until the request is done
+//	"callWhenDone" -- called from the interrupt handler when the
+//		transfer is done (at once, on a cache hit), or NULL to
+//		use WaitFor
+//----------------------------------------------------------------------
+
+DiskRequest *
+SynchDisk::ReadSectorAsync(int sectorNumber, char* data,
+				CallBackObj *callWhenDone)
+{
+    DiskRequest *request = 
+	new DiskRequest(sectorNumber, data, FALSE, callWhenDone);
+    CacheEntry *entry;
+    WaitScope wait(WaitDisk);
+
+    if (journal != NULL && journal->Lookup(sectorNumber, data))
+	return Complete(request);
+    AcquireLock();
+    entry = FindUsable(sectorNumber, FALSE);
+    if (entry != NULL) {
+	kernel->stats->numCacheHits++;
+	entry->lastUsed = ++useClock;
+	bcopy(entry->data, data, SectorSize);
+	lock->Release();
+	return Complete(request);
+    }
+    lock->Release();
+    return Submit(request);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WriteSectorAsync
+// 	Start writing "data" to a sector and return without waiting.
+//	The write goes to the disk straight away; a cached copy of the
+//	sector is updated too, and is clean once the write is issued.
+//	As with WriteSector, a write made inside a file system operation
+//	is recorded by the journal instead, and done at once; any other
+//	write replaces the journal's copy, if it has one.
+//
+//	"sectorNumber" -- the disk sector to write
+//	"data" -- the new contents; must stay valid until done
+//	"callWhenDone" -- as for ReadSectorAsync
+//----------------------------------------------------------------------
+
+DiskRequest *
+SynchDisk::WriteSectorAsync(int sectorNumber, char* data,
+				CallBackObj *callWhenDone)
+{
+    DiskRequest *request = 
+	new DiskRequest(sectorNumber, data, TRUE, callWhenDone);
+    CacheEntry *entry;
+    WaitScope wait(WaitDisk);
+
+    AcquireLock();
+    KeepOld(sectorNumber);
+    if (journal != NULL) {
+	if (journal->Record(sectorNumber, data)) {
+	    lock->Release();		// part of a transaction
+	    return Complete(request);
+	}
+	journal->Update(sectorNumber, data);
+    }
+    entry = FindUsable(sectorNumber, TRUE);
+    if (entry != NULL) {
+	bcopy(data, entry->data, SectorSize);
+	entry->dirty = FALSE;
+	entry->lastUsed = ++useClock;
+    }
+    request = Submit(request);		// queued before anyone can
+    lock->Release();			// touch the entry again
+    return request;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WaitFor
+// 	Sleep until an asynchronous request is done, then free it.
+//
+//	"request" -- a handle returned by ReadSectorAsync/WriteSectorAsync
+//----------------------------------------------------------------------
+
+void
+SynchDisk::WaitFor(DiskRequest *request)
+{
+    WaitScope wait(WaitDisk);
+
+    ASSERT(request != NULL && request->callWhenDone == NULL);
+    request->done->P();			// wait for interrupt
+    delete request;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::FirstPending
+// 	Return the oldest request waiting on "spindle" for "sectorNumber",
+//	or NULL if there is none.
+//----------------------------------------------------------------------
+
+DiskRequest *
+SynchDisk::FirstPending(Spindle *spindle, int sectorNumber)
+{
+    ListIterator<DiskRequest *> it(spindle->pending);
+
+    for (; !it.IsDone(); it.Next()) {
+	if (it.Item()->sector == sectorNumber)
+	    return it.Item();
+    }
+    return NULL;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Gather
+// 	"request" has just been taken off the pending queue of "spindle":
+//	take off with it the requests going the same way (all reads or
+//	all writes) for the sectors next to it on that disk, on either
+//	side, up to MaxTransferSectors in all, so they go to the disk as
+//	one transfer.  A neighbour only joins if it is the oldest request
+//	for its sector, so nothing is served ahead of an earlier request
+//	for the same sector.  Returns the request for the lowest sector,
+//	with the others linked after it through "adjacent", and sets
+//	"*count" to how many there are.
+//	Called with interrupts off.
+//----------------------------------------------------------------------
+
+DiskRequest *
+SynchDisk::Gather(Spindle *spindle, DiskRequest *request, int *count)
+{
+    DiskRequest *first = request, *last = request, *r;
+    int n = 1;
+
+    request->adjacent = NULL;
+    while (n < MaxTransferSectors 
+		&& PhysicalSector(last->sector) + 1 < NumSectors
+		&& (r = FirstPending(spindle, last->sector + numDisks)) != NULL
+		&& r->writing == request->writing) {
+	spindle->pending->Remove(r);
+	r->adjacent = NULL;
+	last->adjacent = r;
+	last = r;
+	n++;
+    }
+    while (n < MaxTransferSectors && PhysicalSector(first->sector) > 0
+		&& (r = FirstPending(spindle, first->sector - numDisks)) != NULL
+		&& r->writing == request->writing) {
+	spindle->pending->Remove(r);
+	r->adjacent = first;
+	first = r;
+	n++;
+    }
+    *count = n;
+    return first;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::StartRequest
+// 	Hand "request", and the waiting requests for the sectors next to
+//	it (see Gather), to the raw disk of "spindle" as one transfer,
+//	and account for the seek (and trace it, with the time the disk
+//	will take).  The data of a transfer of several requests goes
+//	through the spindle's buffer.
+//
+//	The disk only reports its whole latency; the seek is what the
+//	head has to cross, to the first sector and onto each further
+//	track the transfer runs onto, the transfer one sector's rotation
+//	per sector, and the rest is waiting for the sectors to come
+//	round.  (A read from the track buffer is all transfer.)  A
+//	modelled device neither seeks nor rotates: it is all transfer.
+//	Called with interrupts off.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::StartRequest(Spindle *spindle, DiskRequest *request)
+{
+    int count;
+    DiskRequest *first = Gather(spindle, request, &count);
+    int sector = PhysicalSector(first->sector);
+    int lastSector = sector + count - 1;
+    int tracks = 
+	abs(sector / SectorsPerTrack - spindle->headSector / SectorsPerTrack)
+	+ (lastSector / SectorsPerTrack - sector / SectorsPerTrack);
+    int latency = 
+	spindle->disk->ComputeLatency(sector, first->writing, count);
+    char *data = first->data;
+
+    if (spindle->disk->Rotates()) {
+	kernel->stats->numSeekTracks += tracks;
+	kernel->stats->diskSeekTicks += tracks * SeekTime;
+	kernel->stats->diskTransferTicks += count * RotationTime;
+	kernel->stats->diskRotationTicks += 
+	    latency - tracks * SeekTime - count * RotationTime;
+    } else
+	kernel->stats->diskTransferTicks += latency;
+    kernel->stats->numDiskCombined += count - 1;
+    spindle->headSector = lastSector;
+    spindle->active = first;
+    if (kernel->ioTrace != NULL)
+	kernel->ioTrace->Record(first->sector, first->writing, latency);
+    if (count > 1) {
+	DEBUG(dbgDisk, "Merged " << count << " requests from sector "
+		<< first->sector);
+	data = spindle->buffer;
+	if (first->writing) {
+	    int i = 0;
+
+	    for (DiskRequest *r = first; r != NULL; r = r->adjacent)
+		bcopy(r->data, &data[SectorSize * i++], SectorSize);
+	}
+    }
+    if (first->writing)
+	spindle->disk->WriteRequest(sector, data, count);
+    else
+	spindle->disk->ReadRequest(sector, data, count);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::HostTransfer
+// 	Do "request" straight away on the disk image, for an offline
+//	SynchDisk: a copy to or from the mapped image, or UNIX I/O on
+//	it if it could not be mapped.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::HostTransfer(Spindle *spindle, DiskRequest *request)
+{
+    int sector = PhysicalSector(request->sector);
+
+    ASSERT(request->sector >= 0 && request->sector < NumSectors);
+    if (spindle->image != NULL) {
+	char *where = &spindle->image[sector * SectorSize + ImageMagicSize];
+
+	if (request->writing)
+	    bcopy(request->data, where, SectorSize);
+	else
+	    bcopy(where, request->data, SectorSize);
+	return;
+    }
+    Lseek(spindle->imageFd, sector * SectorSize + ImageMagicSize, 0);
+    if (request->writing)
+	WriteFile(spindle->imageFd, request->data, SectorSize);
+    else
+	Read(spindle->imageFd, request->data, SectorSize);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::NextRequest
+// 	Remove and return the request pending for "spindle" to serve
+//	next.  Only the requests of the most urgent I/O class pending
+//	are considered; among those, the oldest realtime one goes,
+//	otherwise the scheduling policy chooses.  A request that has
+//	been passed over MaxPassOver times wins outright, oldest first,
+//	and an idle one passed over MaxIdlePassOver times counts as
+//	foreground from then on.
+//	Called with interrupts off, and only if something is pending.
+//
+//	Sector numbers are compared as they are on the disk: striping
+//	keeps their order, so the logical ones will do.
+//----------------------------------------------------------------------
+
+DiskRequest *
+SynchDisk::NextRequest(Spindle *spindle)
+{
+    List<DiskRequest *> *pending = spindle->pending;
+    int headSector = spindle->headSector * numDisks + (spindle - spindles);
+    					// as a logical sector number
+    DiskRequest *best = NULL;
+    DiskRequest *lowest = NULL;
+    IOClass urgent = IOIdle;
+    ListIterator<DiskRequest *> scan(pending);
+    ListIterator<DiskRequest *> it(pending);
+    ListIterator<DiskRequest *> same(pending);
+
+    for (; !scan.IsDone(); scan.Next()) {
+	DiskRequest *r = scan.Item();
+
+	if (r->ioClass == IOIdle && r->passedOver >= MaxIdlePassOver)
+	    r->ioClass = IOForeground;	// waited long enough
+	if (r->ioClass < urgent)
+	    urgent = r->ioClass;
+    }
+
+    for (; !it.IsDone(); it.Next()) {
+	DiskRequest *r = it.Item();
+
+	if (r->ioClass != urgent)
+	    continue;
+	if (urgent == IORealtime || r->passedOver >= MaxPassOver) {
+	    best = r;			// pending is in arrival order
+	    break;
+	}
+	switch (policy) {
+	  case DiskFIFO:
+	    if (best == NULL)
+		best = r;
+	    break;
+	  case DiskSSTF:
+	    if (best == NULL || abs(r->sector - headSector) 
+				< abs(best->sector - headSector))
+		best = r;
+	    break;
+	  case DiskCSCAN:
+	    if (r->sector >= headSector 
+			&& (best == NULL || r->sector < best->sector))
+		best = r;
+	    if (lowest == NULL || r->sector < lowest->sector)
+		lowest = r;
+	    break;
+	}
+    }
+    if (best == NULL)
+	best = lowest;			// C-SCAN: nothing above, wrap around
+    ASSERT(best != NULL);
+
+    // an older request for the same sector must go first
+    for (; same.Item() != best; same.Next()) {
+	if (same.Item()->sector == best->sector) {
+	    best = same.Item();
+	    break;
+	}
+    }
+
+    pending->Remove(best);
+    ListIterator<DiskRequest *> rest(pending);
+    for (; !rest.IsDone(); rest.Next())
+	rest.Item()->passedOver++;
+    return best;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::FindEntry
+// 	Return the cache entry holding "sectorNumber", or NULL if the
+//	sector is not cached.
+//----------------------------------------------------------------------
+
+CacheEntry *
+SynchDisk::FindEntry(int sectorNumber)
+{
+    CacheEntry *entry;
+
+    cached->Find(sectorNumber, &entry);
+    return entry;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::FindUsable
+// 	Return the cache entry holding "sectorNumber", or NULL if the
+//	sector is not cached, once it can be used: for a read, once it
+//	has been read in; for a write, once it is not at the disk at all.
+//	While it can't, sleep on its own waiters; it may have been given
+//	to another sector by the time we wake, so look it up again.
+//	The caller holds the lock.
+//----------------------------------------------------------------------
+
+CacheEntry *
+SynchDisk::FindUsable(int sectorNumber, bool writing)
+{
+    CacheEntry *entry;
+
+    while ((entry = FindEntry(sectorNumber)) != NULL &&
+		(!entry->valid || (writing && entry->busy)))
+	entry->waiters->Wait(lock);
+    return entry;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::EndTransfer
+// 	"entry" is back from the disk, and holds its sector: wake the
+//	threads waiting for it, and one that found every entry busy.
+//	The caller holds the lock.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::EndTransfer(CacheEntry *entry)
+{
+    entry->busy = FALSE;
+    entry->valid = TRUE;
+    entry->waiters->Broadcast(lock);
+    entryIdle->Signal(lock);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::GetFreeEntry
+// 	Return an unused cache entry.  If the cache is full, evict the
+//	least recently used entry, writing it back first if it is dirty.
+//----------------------------------------------------------------------
+
+CacheEntry *
+SynchDisk::GetFreeEntry()
+{
+    CacheEntry *victim = NULL;
+
+    for (int i = 0; i < NumCacheEntries; i++) {
+	if (cache[i].busy)
+	    continue;
+	if (cache[i].sector == -1)
+	    return &cache[i];
+	if (victim == NULL || cache[i].lastUsed < victim->lastUsed)
+	    victim = &cache[i];
+    }
+    if (victim == NULL) {		// everything is at the disk
+	entryIdle->Wait(lock);
+	return GetFreeEntry();
+    }
+
+    DEBUG(dbgDisk, "Cache evicting sector " << victim->sector);
+    kernel->stats->numCacheEvictions++;
+    if (victim->dirty) {
+	victim->busy = TRUE;		// still readable meanwhile
+	DiskWrite(victim->sector, victim->data);
+	EndTransfer(victim);
+    }
+    cached->Remove(victim->sector);
+    victim->sector = -1;
+    victim->valid = FALSE;
+    victim->dirty = FALSE;
+    return victim;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::GetEntry
+// 	Return the cache entry for "sectorNumber", once it can be read,
+//	if "fill", or overwritten, if not (see FindUsable).  On a miss,
+//	take a free entry for it and, if "fill", read the sector in;
+//	otherwise the caller fills it in before letting go of the lock.
+//	Because getting a free entry may drop the lock, we look again
+//	afterwards in case another thread cached it first.
+//	The caller holds the lock.
+//----------------------------------------------------------------------
+
+CacheEntry *
+SynchDisk::GetEntry(int sectorNumber, bool fill)
+{
+    for (;;) {
+	CacheEntry *entry = FindUsable(sectorNumber, !fill);
+
+	if (entry != NULL) {
+	    kernel->stats->numCacheHits++;
+	    return entry;
+	}
+
+	entry = GetFreeEntry();
+	if (FindEntry(sectorNumber) != NULL)
+	    continue;			// lost the race; entry stays free
+
+	kernel->stats->numCacheMisses++;
+	entry->sector = sectorNumber;
+	cached->Insert(entry);
+	if (fill) {
+	    entry->busy = TRUE;
+	    DiskRead(sectorNumber, entry->data);
+	    EndTransfer(entry);
+	} else {
+	    entry->valid = TRUE;
+	}
+	return entry;
+    }
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::CachedRead
+// 	Copy one sector into "data", from the cache if it is there,
+//	otherwise reading it in (and caching it).  The caller holds the lock.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::CachedRead(int sectorNumber, char* data)
+{
+    CacheEntry *entry;
+
+    if (journal != NULL && journal->Lookup(sectorNumber, data))
+	return;				// logged, not yet installed
+    entry = GetEntry(sectorNumber, TRUE);
+
+    entry->lastUsed = ++useClock;
+    bcopy(entry->data, data, SectorSize);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::CachedWrite
+// 	Copy "data" into the cached copy of one sector and mark it dirty.
+//	The whole sector is overwritten, so a miss needs no disk read.
+//	The caller holds the lock.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::CachedWrite(int sectorNumber, char* data)
+{
+    CacheEntry *entry;
+
+    KeepOld(sectorNumber);
+    if (journal != NULL && journal->Record(sectorNumber, data))
+	return;				// part of a transaction
+    entry = GetEntry(sectorNumber, FALSE);
+
+    bcopy(data, entry->data, SectorSize);
+    if (!entry->dirty)
+	entry->dirtySince = kernel->stats->totalTicks;
+    entry->dirty = TRUE;
+    entry->lastUsed = ++useClock;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::KeepOld
+// 	If the snapshot being kept froze "sectorNumber", and hasn't a copy
+//	of it yet, read what it holds now and give it to the snapshot,
+//	before it is overwritten.  The read may drop the lock; if another
+//	writer gets in meanwhile, it keeps the copy, and ours is ignored.
+//	The caller holds the lock.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::KeepOld(int sectorNumber)
+{
+    char old[SectorSize];
+
+    if (snapshot == NULL || !snapshot->NeedsCopy(sectorNumber))
+	return;
+    CachedRead(sectorNumber, old);
+    if (snapshot != NULL)		// (dropped meanwhile?)
+	snapshot->Keep(sectorNumber, old);
 }
 
 //----------------------------------------------------------------------
 // SynchDisk::ReadSector
 // 	Read the contents of a disk sector into a buffer.  Return only
-//	after the data has been read.
+//	after the data has been read.  A cached copy is used if there
+//	is one; otherwise the sector is read in and cached.
 //
 //	"sectorNumber" -- the disk sector to read
 //	"data" -- the buffer to hold the contents of the disk sector
@@ -57,16 +885,19 @@ SynchDisk::~SynchDisk()
 void
 SynchDisk::ReadSector(int sectorNumber, char* data)
 {
-    lock->Acquire();			// only one disk I/O at a time
-    disk->ReadRequest(sectorNumber, data);
-    semaphore->P();			// wait for interrupt
+    KernelRegion region("SynchDisk::ReadSector");
+    WaitScope wait(WaitDisk);
+
+    AcquireLock();			// only one disk I/O at a time
+    CachedRead(sectorNumber, data);
     lock->Release();
 }
 
 //----------------------------------------------------------------------
 // SynchDisk::WriteSector
-// 	Write the contents of a buffer into a disk sector.  Return only
-//	after the data has been written.
+// 	Write the contents of a buffer into a disk sector.  The data
+//	only goes into the cache; it reaches the disk when the entry
+//	is evicted or Flush() is called.
 //
 //	"sectorNumber" -- the disk sector to be written
 //	"data" -- the new contents of the disk sector
@@ -75,20 +906,335 @@ SynchDisk::ReadSector(int sectorNumber, char* data)
 void
 SynchDisk::WriteSector(int sectorNumber, char* data)
 {
-    lock->Acquire();			// only one disk I/O at a time
-    disk->WriteRequest(sectorNumber, data);
-    semaphore->P();			// wait for interrupt
+    KernelRegion region("SynchDisk::WriteSector");
+    WaitScope wait(WaitDisk);
+
+    AcquireLock();			// only one disk I/O at a time
+    CachedWrite(sectorNumber, data);
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::ReadSectors
+// 	Read a run of sectors into consecutive pieces of "data" as a
+//	single request: the lock is taken once, and every miss is sent
+//	to the disk back to back.
+//
+//	"sectorNumbers" -- the disk sectors to read, in order
+//	"count" -- how many sectors
+//	"data" -- buffer of count * SectorSize bytes
+//----------------------------------------------------------------------
+
+void
+SynchDisk::ReadSectors(int *sectorNumbers, int count, char* data)
+{
+    WaitScope wait(WaitDisk);
+
+    AcquireLock();
+    for (int i = 0; i < count; i++)
+	CachedRead(sectorNumbers[i], data + i * SectorSize);
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WriteSectors
+// 	Write consecutive pieces of "data" to a run of sectors as a
+//	single request.
+//
+//	"sectorNumbers" -- the disk sectors to write, in order
+//	"count" -- how many sectors
+//	"data" -- buffer of count * SectorSize bytes
+//----------------------------------------------------------------------
+
+void
+SynchDisk::WriteSectors(int *sectorNumbers, int count, char* data)
+{
+    WaitScope wait(WaitDisk);
+
+    AcquireLock();
+    for (int i = 0; i < count; i++)
+	CachedWrite(sectorNumbers[i], data + i * SectorSize);
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Flush
+// 	Write every dirty sector in the cache back to disk.  The
+//	sectors stay cached (and clean).
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Flush()
+{
+    WaitScope wait(WaitDisk);
+
+    AcquireLock();
+    for (int i = 0; i < NumCacheEntries; i++) {
+	while (cache[i].busy)		// wait out writes already going
+	    cache[i].waiters->Wait(lock);
+    }
+    WriteDirty();
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WriteDirty
+// 	Write back every dirty entry that is not already at the disk, in
+//	one sweep: the entries are sorted by sector number and all their
+//	writes are queued together, so the scheduler can serve them in
+//	a single pass of the head.  The caller holds the lock, which is
+//	released while the writes are in progress; the entries can still
+//	be read meanwhile, but not written.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::WriteDirty()
+{
+    CacheEntry *sweep[NumCacheEntries];
+    DiskRequest *requests[NumCacheEntries];
+    int count = 0;
+    int i, j;
+
+    for (i = 0; i < NumCacheEntries; i++) {
+	CacheEntry *entry = &cache[i];
+
+	if (entry->sector == -1 || !entry->dirty || entry->busy)
+	    continue;
+	for (j = count; j > 0 && sweep[j - 1]->sector > entry->sector; j--)
+	    sweep[j] = sweep[j - 1];	// insertion sort by sector
+	sweep[j] = entry;
+	count++;
+	entry->busy = TRUE;
+    }
+    if (count == 0)
+	return;
+
+    DEBUG(dbgDisk, "Flushing " << count << " dirty sectors");
+    for (i = 0; i < count; i++)
+	requests[i] = Submit(new DiskRequest(sweep[i]->sector, 
+						sweep[i]->data, TRUE));
+    lock->Release();
+    for (i = 0; i < count; i++)
+	WaitFor(requests[i]);
+    AcquireLock();
+
+    for (i = 0; i < count; i++) {
+	sweep[i]->dirty = FALSE;
+	EndTransfer(sweep[i]);
+    }
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::CheckFlush
+// 	Called from the timer interrupt handler, with interrupts off.
+//	Have a worker flush the cache if some sector has been dirty
+//	longer than the flush window, or too many sectors are dirty.  Only looks at the
+//	cache, so it does not need the lock.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::CheckFlush()
+{
+    int numDirty = 0;
+    bool expired = FALSE;
+
+    if (flushPending)
+	return;
+    for (int i = 0; i < NumCacheEntries; i++) {
+	if (cache[i].sector != -1 && cache[i].dirty && !cache[i].busy) {
+	    numDirty++;
+	    if (kernel->stats->totalTicks - cache[i].dirtySince >= flushWindow)
+		expired = TRUE;
+	}
+    }
+    if (expired || numDirty > FlushHighWater) {
+	flushPending = TRUE;
+	kernel->workers->Submit(SynchDisk::FlushTask, this);
+    }
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::FlushTask
+// 	Task submitted by CheckFlush: write the dirty sectors back in
+//	one sweep, as idle I/O.  Open files first give the blocks they are holding
+//	back their sectors (see FileHeader::FlushDelayed), so those go
+//	out in the same sweep.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::FlushTask(void* data)
+{
+    SynchDisk* _this = (SynchDisk*)data;
+    IOClass old = kernel->currentThread->SetIOClass(IOIdle);
+
+    FileHeader::FlushAllDelayed();
+    _this->AcquireLock();
+    _this->WriteDirty();
+    _this->flushPending = FALSE;
+    _this->lock->Release();
+    (void) kernel->currentThread->SetIOClass(old);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Prefetch
+// 	Ask a worker to bring "sectorNumber" into the cache.
+//	Returns without waiting for the disk.  If the workers are
+//	already that far behind, the read ahead is skipped -- it would
+//	probably come too late to help.
+//
+//	"sectorNumber" -- the disk sector that will probably be read soon
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Prefetch(int sectorNumber)
+{
+    if (FindEntry(sectorNumber) == NULL) {
+	if (prefetchQueue->Append(sectorNumber, FALSE))
+	    kernel->workers->Submit(SynchDisk::PrefetchTask, this);
+    }
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Discard
+// 	The file system has freed "count" sectors from "sectorNumber", and
+//	the free map saying so is committed.  Their cached copies are
+//	dropped, so a dirty one is not written back over nothing; one at
+//	the disk just now is left to finish.  Then the device is told:
+//	a striped run is split into its sectors, since they are on
+//	different disks.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Discard(int sectorNumber, int count)
+{
+    AcquireLock();
+    for (int s = sectorNumber; s < sectorNumber + count; s++) {
+	CacheEntry *entry = FindEntry(s);
+
+	if (entry != NULL && !entry->busy) {
+	    cached->Remove(s);
+	    entry->sector = -1;
+	    entry->valid = FALSE;
+	    entry->dirty = FALSE;
+	}
+	if (numDisks > 1 && SpindleOf(s)->disk != NULL)
+	    SpindleOf(s)->disk->Discard(PhysicalSector(s), 1);
+    }
+    if (numDisks == 1 && spindles[0].disk != NULL)
+	spindles[0].disk->Discard(sectorNumber, count);
+    kernel->stats->numDiscards++;
+    kernel->stats->numDiscardedSectors += count;
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::PrefetchTask
+// 	Task submitted by Prefetch: take the first sector on
+//	prefetchQueue and read it into the cache, as idle I/O, unless
+//	someone already has.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::PrefetchTask(void* data)
+{
+    SynchDisk* _this = (SynchDisk*)data;
+    int sector = _this->prefetchQueue->RemoveFront();
+    IOClass old = kernel->currentThread->SetIOClass(IOIdle);
+
+    _this->AcquireLock();
+    if (_this->FindEntry(sector) == NULL) {
+	CacheEntry *entry = _this->GetFreeEntry();
+
+	if (_this->FindEntry(sector) == NULL) {
+	    DEBUG(dbgDisk, "Prefetching sector " << sector);
+	    entry->sector = sector;
+	    _this->cached->Insert(entry);
+	    entry->busy = TRUE;
+	    _this->DiskRead(sector, entry->data);
+	    entry->lastUsed = ++_this->useClock;
+	    kernel->stats->numCachePrefetches++;
+	    _this->EndTransfer(entry);
+	}
+    }
+    _this->lock->Release();
+    (void) kernel->currentThread->SetIOClass(old);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::SetJournal
+// 	From now on, hand sector writes to "log" while it has an
+//	operation open, and let reads see what it has recorded.
+//
+//	"log" -- the file system's journal
+//----------------------------------------------------------------------
+
+void
+SynchDisk::SetJournal(Journal *log)
+{
+    journal = log;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::SetSnapshot
+// 	From now on, keep the old contents of the sectors "snap" froze
+//	for it, before they are overwritten; NULL stops that.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::SetSnapshot(Snapshot *snap)
+{
+    AcquireLock();
+    snapshot = snap;
     lock->Release();
 }
 
 //----------------------------------------------------------------------
-// SynchDisk::CallBack
-// 	Disk interrupt handler.  Wake up any thread waiting for the disk
-//	request to finish.
+// Spindle::CallBack
+// 	Disk interrupt handler; see SynchDisk::RequestDone.
+//----------------------------------------------------------------------
+
+void
+Spindle::CallBack()
+{
+    owner->RequestDone(this);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::RequestDone
+// 	Disk interrupt handler.  Wake up the threads waiting for the
+//	requests of the transfer to finish (and those of the requests
+//	combined with them), and start the next one pending for that
+//	disk.
 //----------------------------------------------------------------------
 
 void
-SynchDisk::CallBack()
+SynchDisk::RequestDone(Spindle *spindle)
 { 
-    semaphore->V();
+    DiskRequest *finished = spindle->active;
+    DiskRequest *rider, *next, *adjacent;
+    int i = 0;
+
+    ASSERT(finished != NULL);
+    spindle->active = NULL;
+    if (!finished->writing && finished->adjacent != NULL) {
+	for (DiskRequest *r = finished; r != NULL; r = r->adjacent)
+	    bcopy(&spindle->buffer[SectorSize * i++], r->data, SectorSize);
+    }					// before the buffer is reused
+    if (!spindle->pending->IsEmpty())
+	StartRequest(spindle, NextRequest(spindle));
+
+    for (; finished != NULL; finished = adjacent) {
+	adjacent = finished->adjacent;
+	for (rider = finished->rider; rider != NULL; rider = next) {
+	    next = rider->rider;
+	    if (!rider->writing)
+		bcopy(finished->data, rider->data, SectorSize);
+	    kernel->stats->RecordDiskLatency(rider->writing,
+			kernel->stats->totalTicks - rider->submitted);
+	    (void) Complete(rider);
+	}
+	kernel->stats->RecordDiskLatency(finished->writing,
+			kernel->stats->totalTicks - finished->submitted);
+	(void) Complete(finished);
+    }
 }
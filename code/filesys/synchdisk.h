@@ -13,7 +13,12 @@
 
 #include "disk.h"
 #include "synch.h"
+#include "synchlist.h"
 #include "callback.h"
+#include "openhash.h"
+
+class Journal;
+class Snapshot;
 
 // The following class defines a "synchronous" disk abstraction.
 // As with other I/O devices, the raw physical disk is an asynchronous device --
@@ -25,11 +30,167 @@
 // This class provides the abstraction that for any individual thread
 // making a request, it waits around until the operation finishes before
 // returning.
+//
+// MP4 MODIFIED
+// SynchDisk also keeps a small write-back cache of recently used sectors.
+// Reads that hit the cache are a memory copy; writes only dirty the
+// cached copy, which goes to disk when it is evicted (least recently
+// used first) or when Flush() is called.  A flush task, run by one of
+// the kernel's worker threads (see workpool.h), also writes the dirty
+// sectors back, in one sweep sorted by sector number,
+// once the oldest of them has been dirty for "flushWindow" ticks or
+// more than FlushHighWater entries are dirty.  So a sector written
+// many times in a row (the root directory, say) reaches the disk once.
+//
+// The lock only guards the hash table and the state of each entry, and
+// is never held while a request is at the disk.  Each entry says
+// whether its data is valid and whether it is busy at the disk, and
+// has its own queue of threads waiting for it: a thread waits only for
+// the entry it wants, and is woken only by that entry's transfer.  A
+// read waits only while an entry is being read in; one being written
+// back can still be copied from.  So a hit never waits for another
+// thread's miss.
+//
+// Requests from
+// different threads wait on a pending queue, and each time the disk
+// finishes one the next is picked by the scheduling policy: FIFO,
+// shortest seek first (SSTF), or circular scan (C-SCAN) upward from
+// the current head position.  A request passed over MaxPassOver times
+// is served next regardless, so a busy region cannot starve the rest
+// of the disk.  Requests for the same sector are never reordered.
+//
+// Each request also has the I/O class of the thread that made it (see
+// thread.h).  The policy only chooses among the requests of the most
+// urgent class waiting: a realtime one (a page coming in from swap)
+// is served first, in arrival order, and an idle one (the flusher,
+// read-ahead, defragmenting, checking) only once no foreground one
+// is queued, or after it has been passed over MaxIdlePassOver times,
+// in case a foreground thread is waiting on it.
+//
+// Callers that want to overlap disk latency with other work can use
+// ReadSectorAsync/WriteSectorAsync: they return a DiskRequest handle
+// at once, to be passed to WaitFor later, or call a CallBackObj from
+// the disk interrupt handler when the transfer is done.
+//
+// A request for a sector that already has one waiting is combined
+// with it when that is safe: a write replaces the data of a waiting
+// write (only the newest copy need reach the disk), a read takes its
+// data from a waiting write, and a read shares a waiting read's
+// transfer.  Either way no extra trip to the disk is made.  And when
+// a request goes to the disk, the waiting ones going the same way for
+// the sectors next to it join it, up to MaxTransferSectors: the disk
+// does the run as one transfer (see Disk::ReadRequest), seeking and
+// waiting for the platter once, so a sequential batch costs about its
+// bytes rather than its requests.
+//
+// The sectors can also be striped (RAID-0) across several disks,
+// DISK_<m> to DISK_<m+n-1> for host id m: logical sector s is sector
+// s / n of disk s % n.  Each disk has its own pending queue and head
+// position, so requests for different disks are at the disks at the
+// same time.
+//
+// Sectors the file system has freed are passed on to Discard, in runs:
+// their cached copies are dropped, dirty or not, and the device is
+// told (see Disk::Discard).
+//
+// While a snapshot is held (see snapshot.h), the first write to each
+// sector it froze, cached or not, first reads the old contents and
+// hands them to the snapshot to keep.
 
-class SynchDisk : public CallBackObj {
+#define NumCacheEntries	32		// sectors held in the buffer cache
+#define MaxPassOver	16		// starvation bound for the scheduler
+#define MaxIdlePassOver	(8 * MaxPassOver)	// and for idle requests
+#define FlushHighWater	(NumCacheEntries / 2)	// dirty entries that
+						// wake the flusher early
+#define DefaultFlushWindow 100000	// ticks a sector may stay dirty
+#define MaxDisks	4		// disks the sectors can be striped over
+#define PrefetchQueueSize 8		// read-ahead hints waiting for a worker
+#define MaxTransferSectors SectorsPerTrack	// most adjacent requests
+						// merged into one transfer
+
+enum DiskSchedPolicy { DiskFIFO, DiskSSTF, DiskCSCAN };
+
+class CacheEntry {
+  public:
+    int sector;				// disk sector held here, -1 if free
+    bool valid;				// does data hold the sector yet?
+					// FALSE while it is being read in
+    bool dirty;				// modified since it was read in?
+    bool busy;				// being read or written by the disk;
+					// wait on waiters before changing it
+    Condition *waiters;			// threads waiting for this entry
+    int dirtySince;			// tick it was first dirtied
+    int lastUsed;			// tick of the last access, for LRU
+    char data[SectorSize];		// cached contents of the sector
+};
+
+// A request waiting for the disk.  Returned as the handle of an
+// asynchronous transfer.
+
+class DiskRequest {
   public:
-    SynchDisk();    		        // Initialize a synchronous disk,
+    DiskRequest(int sectorNumber, char* buffer, bool isWrite,
+					CallBackObj *toCall = NULL);
+    ~DiskRequest();
+
+    bool IsDone() { return finished; }	// has the transfer completed?
+
+    int sector;				// sector to transfer
+    char *data;				// where the bytes come from or go
+    bool writing;			// write request?
+    int passedOver;			// times another request went first
+    IOClass ioClass;			// how urgent it is
+    bool finished;			// transfer complete?
+    Semaphore *done;			// V'ed when the transfer is complete
+    CallBackObj *callWhenDone;		// if not NULL, called instead,
+					// and the request is freed
+    DiskRequest *rider;			// next request finished by this
+					// one's transfer, or NULL
+    DiskRequest *adjacent;		// at the disk: the request for the
+    					// next sector of the same transfer,
+					// or NULL
+    int submitted;			// when it was handed to Submit
+};
+
+class SynchDisk;
+
+// One of the disks the sectors are striped across, and the requests
+// waiting for it.  Sector numbers here are the disk's own.
+
+class Spindle : public CallBackObj {
+  public:
+    SynchDisk *owner;			// the SynchDisk it belongs to
+    Disk *disk;				// raw disk device, NULL if offline
+    int imageFd;			// offline: the UNIX file holding
+					// the disk image, else -1
+    char *image;			// offline: the image mapped into
+					// memory, or NULL if it couldn't be
+    List<DiskRequest *> *pending;	// requests waiting for the disk
+    DiskRequest *active;		// request at the disk (the first
+    					// of its transfer), or NULL
+    int headSector;			// sector of the last request sent
+    char buffer[MaxTransferSectors * SectorSize];
+    					// the data of a transfer of more
+					// than one request
+
+    void CallBack();			// Called by the disk interrupt
+					// handler when "active" is done
+};
+
+class SynchDisk {
+  public:
+    SynchDisk(char *policyName = NULL, int window = DefaultFlushWindow,
+		bool offline = FALSE, int disks = 1);
+    					// Initialize a synchronous disk,
 					// by initializing the raw Disk.
+					// "policyName" is "fifo", "sstf"
+					// or "cscan" (the default);
+					// "window" bounds how long a
+					// written sector stays only cached;
+					// "offline" builds a new disk image
+					// with plain UNIX I/O instead;
+					// "disks" stripes the sectors
+					// across that many raw disks
     ~SynchDisk();			// De-allocate the synch disk data
     
     void ReadSector(int sectorNumber, char* data);
@@ -39,17 +200,118 @@ class SynchDisk : public CallBackObj {
     					// Disk::ReadRequest/WriteRequest and
 					// then wait until the request is done.
     void WriteSector(int sectorNumber, char* data);
+
+    void ReadSectors(int *sectorNumbers, int count, char* data);
+    void WriteSectors(int *sectorNumbers, int count, char* data);
+    					// Vectored forms: transfer "count"
+					// sectors to/from consecutive
+					// SectorSize pieces of "data", as
+					// one request (one lock round trip)
+
+    DiskRequest *ReadSectorAsync(int sectorNumber, char* data,
+					CallBackObj *callWhenDone = NULL);
+    DiskRequest *WriteSectorAsync(int sectorNumber, char* data,
+					CallBackObj *callWhenDone = NULL);
+    					// Start a transfer and return at
+					// once.  Without "callWhenDone" the
+					// handle must be given to WaitFor;
+					// with it, NULL is returned and
+					// callWhenDone->CallBack() runs
+					// when the transfer is done
+    void WaitFor(DiskRequest *request);	// Sleep until "request" is done,
+					// then free it
+
+    void Flush();			// Write every dirty cached sector
+					// back to disk
+
+    void CheckFlush();			// Called on each timer interrupt;
+					// wakes the flusher when needed
+
+    void SetJournal(Journal *log);	// Route writes made inside file
+					// system operations through "log"
+    void SetSnapshot(Snapshot *snap);	// Keep the old contents of its
+					// sectors for "snap", or NULL
+
+    void Prefetch(int sectorNumber);	// Read a sector into the cache in
+					// the background; returns at once
+    void Discard(int sectorNumber, int count);
+    					// "count" sectors from sectorNumber
+					// have been freed
     
-    void CallBack();			// Called by the disk device interrupt
-					// handler, to signal that the
-					// current disk operation is complete.
+    void RequestDone(Spindle *spindle);	// Called when a disk finishes
+					// its current request
 
   private:
-    Disk *disk;		  		// Raw disk device
-    Semaphore *semaphore; 		// To synchronize requesting thread 
-					// with the interrupt handler
-    Lock *lock;		  		// Only one read/write request
-					// can be sent to the disk at a time
+    Spindle spindles[MaxDisks];		// the raw disks
+    int numDisks;			// how many are in use
+    bool offline;			// images accessed directly?
+    Lock *lock;		  		// Protects the hash table and the
+					// entries' state; never held at
+					// the disk
+    Condition *entryIdle;		// Signalled when any entry stops
+					// being busy, for a thread that
+					// found them all busy
+
+    DiskSchedPolicy policy;		// how the next request is chosen
+    Journal *journal;			// metadata log, or NULL
+    Snapshot *snapshot;			// snapshot being kept, or NULL
+
+    Spindle *SpindleOf(int sectorNumber)	// disk holding a sector,
+	{ return &spindles[sectorNumber % numDisks]; }
+    int PhysicalSector(int sectorNumber)	// and where on it
+	{ return sectorNumber / numDisks; }
+
+    CacheEntry cache[NumCacheEntries];	// the sector buffer cache
+    OpenHashTable<int, CacheEntry *> *cached;
+    					// the entries in use, by sector
+    int useClock;			// bumped on every cache access
+
+    CacheEntry *FindEntry(int sectorNumber);	// cached copy, or NULL
+    CacheEntry *FindUsable(int sectorNumber, bool writing);
+    					// the same, once it can be read
+					// (or written)
+    void EndTransfer(CacheEntry *entry);	// it is back from the disk
+    CacheEntry *GetFreeEntry();		// evict the LRU entry if needed
+    CacheEntry *GetEntry(int sectorNumber, bool fill);
+    					// entry for the sector, read in
+					// on a miss if "fill"
+    void CachedRead(int sectorNumber, char* data);	// one sector through
+    void CachedWrite(int sectorNumber, char* data);	// the cache, caller
+							// holds lock
+    void KeepOld(int sectorNumber);	// before it is written, for the
+					// snapshot; caller holds lock
+    void DiskRead(int sectorNumber, char* data);	// raw disk I/O; the
+    void DiskWrite(int sectorNumber, char* data);	// caller holds lock,
+							// dropped meanwhile
+    void DiskRequestWait(int sectorNumber, char* data, bool writing);
+    DiskRequest *Submit(DiskRequest *request);	// queue it for the disk
+    DiskRequest *Complete(DiskRequest *request);	// finish without I/O
+    void AcquireLock();			// lock->Acquire, timing the wait
+    bool Combine(Spindle *spindle, DiskRequest *request);
+    					// serve it with a waiting request
+    DiskRequest *NextRequest(Spindle *spindle);
+    					// remove its next request to serve
+    DiskRequest *FirstPending(Spindle *spindle, int sectorNumber);
+    					// oldest request waiting for a sector
+    DiskRequest *Gather(Spindle *spindle, DiskRequest *request,
+			int *count);	// merge its waiting neighbours in
+    void StartRequest(Spindle *spindle, DiskRequest *request);
+    					// hand it to the disk
+    void HostTransfer(Spindle *spindle, DiskRequest *request);
+    					// offline: do it at once
+
+    BoundedSynchList<int> *prefetchQueue;	// sectors waiting to be read
+    						// ahead; a hint is dropped
+						// if it's full
+    static void PrefetchTask(void* data);
+    					// a worker reads the first of them
+
+    int flushWindow;			// ticks before dirty data is flushed
+    bool flushPending;			// flush task already submitted?
+    void WriteDirty();			// one sorted sweep over the dirty
+					// entries; caller holds lock
+    static void FlushTask(void* data);
+    					// a worker writes the dirty sectors
 };
 
 #endif // SYNCHDISK_H
@@ -0,0 +1,241 @@
+// verify.cc
+//	Routines to checksum a tree of Nachos files, several at a time,
+//	and compare them with host files.  See verify.h.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+#ifndef FILESYS_STUB
+
+#include "copyright.h"
+#include "debug.h"
+#include "verify.h"
+#include "openfile.h"
+#include "workpool.h"
+#include "main.h"
+
+static unsigned int crcTable[256];	// CRC-32 of each byte value
+static bool crcTableBuilt = FALSE;
+
+//----------------------------------------------------------------------
+// Crc32
+// 	Return "crc" continued over the "size" bytes of "data": the
+//	reflected CRC-32 of zlib, so Crc32(Crc32(0, a), b) is the CRC of
+//	a followed by b.  The table is built on the first call.
+//----------------------------------------------------------------------
+
+unsigned int
+Crc32(unsigned int crc, char *data, int size)
+{
+    if (!crcTableBuilt) {
+	for (unsigned int i = 0; i < 256; i++) {
+	    unsigned int c = i;
+
+	    for (int k = 0; k < 8; k++)
+		c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+	    crcTable[i] = c;
+	}
+	crcTableBuilt = TRUE;
+    }
+    crc = ~crc;
+    for (int i = 0; i < size; i++)
+	crc = crcTable[(crc ^ (unsigned char) data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+//----------------------------------------------------------------------
+// VerifiedFile::VerifiedFile
+// 	Remember a file found by the walk.  It is read later, by a
+//	worker.
+//
+//	"headerSector" -- where its header is
+//	"treePath" -- its name below the tree, allocated by the caller
+//	"host" -- the host file to compare it with, allocated by the
+//		caller, or NULL
+//----------------------------------------------------------------------
+
+VerifiedFile::VerifiedFile(int headerSector, char *treePath, char *host)
+{
+    sector = headerSector;
+    path = treePath;
+    hostPath = host;
+    crc = 0;
+    length = 0;
+    matched = TRUE;
+    hostMissing = FALSE;
+}
+
+VerifiedFile::~VerifiedFile()
+{
+    delete [] path;
+    delete [] hostPath;
+}
+
+//----------------------------------------------------------------------
+// TreeVerifier::TreeVerifier, TreeVerifier::~TreeVerifier
+// 	Initialize a verifier, with nothing found yet.
+//
+//	"hostDir" -- the host directory the tree was copied from, or
+//		NULL to compare with nothing
+//----------------------------------------------------------------------
+
+TreeVerifier::TreeVerifier(char *hostDir)
+{
+    this->hostDir = hostDir;
+    files = new List<VerifiedFile *>;
+    for (int i = 0; i <= MaxWalkDepth; i++)
+	parent[i] = NULL;
+}
+
+TreeVerifier::~TreeVerifier()
+{
+    while (!files->IsEmpty())
+	delete files->RemoveFront();
+    delete files;
+    for (int i = 0; i <= MaxWalkDepth; i++)
+	delete [] parent[i];
+}
+
+//----------------------------------------------------------------------
+// TreeVerifier::Walk
+// 	Walk the tree below the directory whose header is at "sector",
+//	depth first, and hand each file to the workers as it is found,
+//	so the first ones are being read while the walk goes on.  The
+//	directories are read by the walk itself.
+//----------------------------------------------------------------------
+
+void
+TreeVerifier::Walk(int sector, WaitGroup *group)
+{
+    DirIterator *iter = new DirIterator(TRUE, TRUE);
+    char *path, *host;
+    int depth;
+
+    parent[0] = new char[1];
+    parent[0][0] = '\0';
+    iter->Start(sector);
+    while (iter->Next()) {
+	depth = iter->Depth();
+	path = new char[strlen(parent[depth]) + strlen(iter->Name()) + 2];
+	if (parent[depth][0] == '\0')
+	    strcpy(path, iter->Name());
+	else
+	    sprintf(path, "%s/%s", parent[depth], iter->Name());
+
+	if (iter->Type() == DIR) {
+	    iter->Descend();
+	    delete [] parent[depth + 1];
+	    parent[depth + 1] = path;
+	    continue;
+	}
+	host = NULL;
+	if (hostDir != NULL) {
+	    host = new char[strlen(hostDir) + strlen(path) + 2];
+	    sprintf(host, "%s/%s", hostDir, path);
+	}
+	VerifiedFile *file = new VerifiedFile(iter->Sector(), path, host);
+	files->Append(file);
+	kernel->workers->Submit(TreeVerifier::VerifyTask, file, group);
+    }
+    delete iter;
+}
+
+//----------------------------------------------------------------------
+// TreeVerifier::VerifyTask
+// 	Task submitted by Walk: checksum one file, a batch of sectors at
+//	a time, and the host file it is compared with, if any.  The host
+//	file is read on the host, so it takes no simulated time.
+//----------------------------------------------------------------------
+
+void
+TreeVerifier::VerifyTask(void *data)
+{
+    VerifiedFile *f = (VerifiedFile *) data;
+    OpenFile *file = new OpenFile(f->sector);
+    char *buffer = new char[VerifyBatchSize];
+    unsigned int hostCrc = 0;
+    int amountRead, hostLength = 0, fd;
+
+    while ((amountRead = file->ReadBehind(buffer, VerifyBatchSize)) > 0) {
+	file->WaitReads();
+	f->crc = Crc32(f->crc, buffer, amountRead);
+	f->length += amountRead;
+    }
+    delete file;
+
+    if (f->hostPath != NULL) {
+	if ((fd = OpenForReadWrite(f->hostPath, FALSE)) < 0) {
+	    f->hostMissing = TRUE;
+	    f->matched = FALSE;
+	} else {
+	    while ((amountRead = ReadPartial(fd, buffer, VerifyBatchSize)) > 0) {
+		hostCrc = Crc32(hostCrc, buffer, amountRead);
+		hostLength += amountRead;
+	    }
+	    Close(fd);
+	    f->matched = (hostCrc == f->crc && hostLength == f->length);
+	}
+    }
+    delete [] buffer;
+    DEBUG(dbgFile, "Verified " << f->path << ": " << f->length << " bytes");
+}
+
+//----------------------------------------------------------------------
+// TreeVerifier::Verify
+// 	Checksum every file below the directory "name", whose header is
+//	at "sector", wait for the workers to be done, then print a line
+//	per file, in walk order, and the tree's checksum.  Returns TRUE
+//	if every file matched its host file (always, with no host
+//	directory).
+//----------------------------------------------------------------------
+
+bool
+TreeVerifier::Verify(int sector, char *name)
+{
+    WaitGroup *group = new WaitGroup("verify");
+    int startTicks = kernel->stats->totalTicks;
+    int startReads = kernel->stats->numDiskReads;
+    unsigned int treeCrc = 0;
+    int numFiles = 0, numBad = 0, bytes = 0;
+    ListIterator<VerifiedFile *> *iter;
+
+    Walk(sector, group);
+    group->Wait();
+    delete group;
+
+    iter = new ListIterator<VerifiedFile *>(files);
+    for (; !iter->IsDone(); iter->Next()) {
+	VerifiedFile *f = iter->Item();
+	char word[4];
+
+	printf("%08x %10d %s", f->crc, f->length, f->path);
+	if (f->hostMissing)
+	    printf(": no host file %s", f->hostPath);
+	else if (!f->matched)
+	    printf(": differs from %s", f->hostPath);
+	printf("\n");
+
+	word[0] = (f->crc >> 24) & 0xff;	// the same on any host
+	word[1] = (f->crc >> 16) & 0xff;
+	word[2] = (f->crc >> 8) & 0xff;
+	word[3] = f->crc & 0xff;
+	treeCrc = Crc32(treeCrc, f->path, strlen(f->path) + 1);
+	treeCrc = Crc32(treeCrc, word, 4);
+	numFiles++;
+	bytes += f->length;
+	if (!f->matched)
+	    numBad++;
+    }
+    delete iter;
+
+    printf("Verified %d files in %s, %d bytes, in %d ticks and %d disk "
+	    "reads: tree checksum %08x", numFiles, name, bytes,
+	    kernel->stats->totalTicks - startTicks,
+	    kernel->stats->numDiskReads - startReads, treeCrc);
+    if (hostDir != NULL)
+	printf(", %d not matching %s", numBad, hostDir);
+    printf("\n");
+    return numBad == 0;
+}
+
+#endif // FILESYS_STUB
@@ -0,0 +1,89 @@
+// verify.h
+//	Data structures for checksumming a tree of Nachos files (nachos
+//	-verify), to check that an image matches the host files it was
+//	copied from with -cp or -cpr.
+//
+//	The tree is walked with a DirIterator, and every file found is
+//	handed to the kernel's worker threads (see workpool.h), so that
+//	several files are read at once.  Each file is read in batches of
+//	VerifyBatchSize bytes, every sector of a batch queued to the disk
+//	together (OpenFile::ReadBehind); with the batches of the other
+//	workers in the queue too, the disk scheduler sweeps them in one
+//	pass, and a whole image is read at close to the disk's sequential
+//	rate.  Nothing read is cached, so a verify doesn't push everyone
+//	else's sectors out of the cache.
+//
+//	Each file gets a CRC-32 (the one of zlib and gzip, so a host tool
+//	gives the same value), and the tree one more: the CRC-32 of the
+//	files' names (from the top of the tree) and checksums, in the
+//	order the walk finds them.  Given a host directory, each file is
+//	also compared with the host file of the same name below it; host
+//	files missing from the image are not noticed.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include "copyright.h"
+#include "list.h"
+#include "diriter.h"
+
+#define VerifyBatchSize	(32 * SectorSize)	// bytes read at a time
+
+class WaitGroup;
+
+// A file found by the walk, and what verifying it found.
+
+class VerifiedFile {
+  public:
+    VerifiedFile(int headerSector, char *treePath, char *host);
+    ~VerifiedFile();
+
+    int sector;				// its header sector
+    char *path;				// its name, from the top of the
+    					// tree; we free it
+    char *hostPath;			// host file to compare it with, or
+    					// NULL; we free it
+    unsigned int crc;			// its checksum,
+    int length;				// and its length, once done
+    bool matched;			// same as the host file?
+    bool hostMissing;			// couldn't open the host file
+};
+
+// The following class verifies one tree.
+
+class TreeVerifier {
+  public:
+    TreeVerifier(char *hostDir);	// Compare with the files below
+					// "hostDir", or with nothing if
+					// it is NULL
+    ~TreeVerifier();
+
+    bool Verify(int sector, char *name);
+    					// Checksum the tree below the
+					// directory "name", whose header is
+					// at "sector", and print the
+					// results; TRUE if every file
+					// matched
+
+  private:
+    char *hostDir;			// host directory compared with
+    List<VerifiedFile *> *files;	// files found, in walk order
+    char *parent[MaxWalkDepth + 1];	// the path of the directory the
+					// entries at each depth are in,
+					// during the walk
+
+    void Walk(int sector, WaitGroup *group);
+    					// Find the files, and hand them to
+					// the workers, adding to "group"
+    static void VerifyTask(void *data);	// Checksum one file, for a worker
+};
+
+extern unsigned int Crc32(unsigned int crc, char *data, int size);
+					// "crc" continued over "data"; start
+					// with 0
+
+#endif // VERIFY_H
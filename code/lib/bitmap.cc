@@ -28,11 +28,10 @@ Bitmap::Bitmap(int numItems)
     numWords = divRoundUp(numBits, BitsInWord);
     map = new unsigned int[numWords];
     for (i = 0; i < numWords; i++) {
-	map[i] = 0;		// initialize map to keep Purify happy
-    }
-    for (i = 0; i < numBits; i++) {
-        Clear(i);
+	map[i] = 0;		// every bit starts out clear
     }
+    numClear = numBits;
+    nextFit = 0;
 }
 
 //----------------------------------------------------------------------
@@ -57,6 +56,9 @@ Bitmap::Mark(int which)
 { 
     ASSERT(which >= 0 && which < numBits);
 
+    if (!Test(which)) {
+	numClear--;
+    }
     map[which / BitsInWord] |= 1 << (which % BitsInWord);
 
     ASSERT(Test(which));
@@ -74,6 +76,9 @@ Bitmap::Clear(int which)
 {
     ASSERT(which >= 0 && which < numBits);
 
+    if (Test(which)) {
+	numClear++;
+    }
     map[which / BitsInWord] &= ~(1 << (which % BitsInWord));
 
     ASSERT(!Test(which));
@@ -100,19 +105,32 @@ Bitmap::Test(int which) const
 
 //----------------------------------------------------------------------
 // Bitmap::FindAndSet
-// 	Return the number of the first bit which is clear.
+// 	Return the number of a bit which is clear.
 //	As a side effect, set the bit (mark it as in use).
 //	(In other words, find and allocate a bit.)
 //
+//	The search is next-fit: it starts at the word where the last
+//	search succeeded and wraps around, skipping full words.
+//
 //	If no bits are clear, return -1.
 //----------------------------------------------------------------------
 
 int 
 Bitmap::FindAndSet() 
 {
-    for (int i = 0; i < numBits; i++) {
-	if (!Test(i)) {
+    if (numClear == 0) {
+	return -1;
+    }
+    for (int n = 0; n < numWords; n++) {
+	int w = (nextFit + n) % numWords;
+
+	if (map[w] == ~0u) {
+	    continue;			// word is full
+	}
+	int i = w * BitsInWord + __builtin_ctz(~map[w]);
+	if (i < numBits) {
 	    Mark(i);
+	    nextFit = w;
 	    return i;
 	}
     }
@@ -128,14 +146,88 @@ Bitmap::FindAndSet()
 int 
 Bitmap::NumClear() const
 {
-    int count = 0;
+    return numClear;
+}
 
-    for (int i = 0; i < numBits; i++) {
-	if (!Test(i)) {
-	    count++;
+//----------------------------------------------------------------------
+// Bitmap::Recount
+// 	Recompute the cached clear count with popcount, and restart the
+//	next-fit search at the beginning.  Needed whenever the contents
+//	of "map" are replaced wholesale (for instance, read from disk).
+//----------------------------------------------------------------------
+
+void
+Bitmap::Recount()
+{
+    int set = 0;
+
+    for (int w = 0; w < numWords; w++) {
+	unsigned int word = map[w];
+
+	if (w == numWords - 1 && numBits % BitsInWord != 0) {
+	    word &= (1u << (numBits % BitsInWord)) - 1;	// ignore padding
+	}
+	set += __builtin_popcount(word);
+    }
+    numClear = numBits - set;
+    nextFit = 0;
+}
+
+//----------------------------------------------------------------------
+// Bitmap::FindRun
+// 	Look for "n" consecutive clear bits, starting at bit "start" and
+//	wrapping around to bit 0.  Return the first bit of the first such
+//	run; if there is no run that long, return the first bit of the
+//	longest run there is.  The length of the run returned (at most
+//	"n") is stored in "*length".  No bits are changed.
+//
+//	If no bits are clear, return -1.
+//
+//	"n" is the number of clear bits wanted
+//	"start" is the bit to start looking at
+//	"length" is where to put the length of the run found
+//----------------------------------------------------------------------
+
+int
+Bitmap::FindRun(int n, int start, int *length) const
+{
+    int best = -1, bestLength = 0;
+
+    ASSERT(n > 0);
+    if (start < 0 || start >= numBits) {
+	start = 0;
+    }
+    // two passes: [start, numBits) and then [0, start)
+    for (int pass = 0; pass < 2; pass++) {
+	int from = (pass == 0) ? start : 0;
+	int to = (pass == 0) ? numBits : start;
+	int i = from;
+
+	while (i < to) {
+	    if (i % BitsInWord == 0 && map[i / BitsInWord] == ~0u) {
+		i += BitsInWord;	// skip a full word
+		continue;
+	    }
+	    if (Test(i)) {
+		i++;
+		continue;
+	    }
+	    int runStart = i;
+	    while (i < to && !Test(i) && i - runStart < n) {
+		i++;
+	    }
+	    if (i - runStart == n) {
+		*length = n;
+		return runStart;
+	    }
+	    if (i - runStart > bestLength) {
+		best = runStart;
+		bestLength = i - runStart;
+	    }
 	}
     }
-    return count;
+    *length = bestLength;
+    return best;
 }
 
 //----------------------------------------------------------------------
@@ -185,6 +277,17 @@ Bitmap::SelfTest()
         Mark(i);
     }
     ASSERT(FindAndSet() == -1);		// bitmap should be full!
+    ASSERT(NumClear() == 0);
+    Clear(5);
+    Clear(6);
+    Clear(9);
+    int length;
+    ASSERT(FindRun(2, 0, &length) == 5 && length == 2);
+    ASSERT(FindRun(3, 7, &length) == 5 && length == 2);	// longest, wrapped
+    ASSERT(FindRun(1, 7, &length) == 9 && length == 1);
+    ASSERT(NumClear() == 3);
+    Recount();
+    ASSERT(NumClear() == 3);
     for (i = 0; i < numBits; i++) {
         Clear(i);
     }
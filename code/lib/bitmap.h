@@ -43,17 +43,30 @@ class Bitmap {
 				// effect, set the bit. 
 				// If no bits are clear, return -1.
     int NumClear() const;	// Return the number of clear bits
+    int NumBits() const { return numBits; }
+				// Return the number of bits
+    int FindRun(int n, int start, int *length) const;
+				// Return the first bit of a run of "n"
+				// clear bits, searching from "start"; if
+				// there is none, the longest shorter run.
+				// Its length goes in "*length".  Bits are
+				// not set.  Return -1 if no bits are clear.
 
     void Print() const;		// Print contents of bitmap
     void SelfTest();		// Test whether bitmap is working
     
   protected:
+    void Recount();		// Recompute numClear and reset nextFit,
+				// after "map" is loaded from elsewhere
+
     int numBits;		// number of bits in the bitmap
     int numWords;		// number of words of bitmap storage
 				// (rounded up if numBits is not a
 				//  multiple of the number of bits in
 				//  a word)
     unsigned int *map;		// bit storage
+    int numClear;		// cached count of clear bits
+    int nextFit;		// word where FindAndSet starts looking
 };
 
 #endif // BITMAP_H
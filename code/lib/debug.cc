@@ -24,22 +24,13 @@
 
 Debug::Debug(char *flagList)
 {
-    enableFlags = flagList;
-}
+    bool all = (flagList != NULL && strchr(flagList, dbgAll) != NULL);
 
+    for (int i = 0; i < 256 / FlagsPerWord; i++)
+	enabled[i] = all ? ~0U : 0;
+    for (; flagList != NULL && *flagList != '\0'; flagList++) {
+	unsigned char c = (unsigned char) *flagList;
 
-//----------------------------------------------------------------------
-// Debug::IsEnabled
-//      Return TRUE if DEBUG messages with "flag" are to be printed.
-//----------------------------------------------------------------------
-
-bool
-Debug::IsEnabled(char flag)
-{
-    if (enableFlags != NULL) {
-	return ((strchr(enableFlags, flag) != 0) 
-		|| (strchr(enableFlags, '+') != 0));
-    } else {
-    	return FALSE;
+	enabled[c / FlagsPerWord] |= 1U << (c % FlagsPerWord);
     }
 }
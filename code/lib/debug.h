@@ -6,6 +6,11 @@
 //	passed to Nachos (-d).  You are encouraged to add your own
 //	debugging flags.  Please.... 
 //
+//	The flags are looked up in a bitmap, one bit per character, so
+//	a DEBUG whose flag is off costs a load and a test.  Compiled with
+//	NO_DEBUG, DEBUG and IsEnabled are constant false, and the
+//	compiler drops the messages altogether.
+//
 // Copyright (c) 1992-1996 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
 // of liability and disclaimer of warranty provisions.
@@ -30,14 +35,25 @@ const char dbgAddr = 'a'; 		// address spaces
 const char dbgNet = 'n'; 		// network emulation
 const char dbgSys = 'u';                // systemcall
 
+const int FlagsPerWord = sizeof(unsigned int) * 8;	// bits of the bitmap
+							// in each word
+
 class Debug {
   public:
     Debug(char *flagList);
 
-    bool IsEnabled(char flag);
+#ifdef NO_DEBUG
+    bool IsEnabled(char flag) { return FALSE; }
+#else
+    bool IsEnabled(char flag)
+	{ unsigned char c = (unsigned char) flag;
+	  return (enabled[c / FlagsPerWord] >> (c % FlagsPerWord)) & 1; }
+#endif
 
   private:
-    char *enableFlags;		// controls which DEBUG messages are printed
+    unsigned int enabled[256 / FlagsPerWord];
+    				// controls which DEBUG messages are
+				// printed, a bit for each flag
 };
 
 extern Debug *debug;
@@ -47,10 +63,17 @@ extern Debug *debug;
 // DEBUG
 //      If flag is enabled, print a message.
 //----------------------------------------------------------------------
+#ifdef NO_DEBUG
+#define DEBUG(flag,expr)                                                     \
+    if (TRUE) {} else { 						\
+        cerr << expr << "\n";   				        \
+    }
+#else
 #define DEBUG(flag,expr)                                                     \
     if (!debug->IsEnabled(flag)) {} else { 				\
         cerr << expr << "\n";   				        \
     }
+#endif
 
 
 //----------------------------------------------------------------------
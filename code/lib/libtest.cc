@@ -11,6 +11,7 @@
 #include "bitmap.h"
 #include "list.h"
 #include "hash.h"
+#include "openhash.h"
 #include "sysdep.h"
 
 //----------------------------------------------------------------------
@@ -61,7 +62,7 @@ static char *hashTestVector[] = { "0", "1", "2", "3", "4", "5", "6",
 //----------------------------------------------------------------------
 // LibSelfTest
 //	Run self tests on bitmaps, lists, sorted lists, and 
-//	hash tables.
+//	both kinds of hash tables.
 //----------------------------------------------------------------------
 
 void
@@ -71,15 +72,19 @@ LibSelfTest () {
     SortedList<int> *sortList = new SortedList<int>(IntCompare);
     HashTable<int, char *> *hashTable = 
 	new HashTable<int, char *>(HashKey, HashInt);
+    OpenHashTable<int, char *> *openTable = 
+	new OpenHashTable<int, char *>(HashKey, HashInt);
 	
 		
     map->SelfTest();
     list->SelfTest(listTestVector, sizeof(listTestVector)/sizeof(int));
     sortList->SelfTest(listTestVector, sizeof(listTestVector)/sizeof(int));
     hashTable->SelfTest(hashTestVector, sizeof(hashTestVector)/sizeof(char *));
+    openTable->SelfTest(hashTestVector, sizeof(hashTestVector)/sizeof(char *));
 
     delete map;
     delete list;
     delete sortList;
     delete hashTable;
+    delete openTable;
 }
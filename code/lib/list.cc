@@ -6,7 +6,10 @@
 // 	A "ListElement" is allocated for each item to be put on the
 //	list; it is de-allocated when the item is removed. This means
 //      we don't need to keep a "next" pointer in every object we
-//      want to put on a list.
+//      want to put on a list.  Elements are recycled through a free
+//	list, so this is cheap.  An IntrusiveList instead chains the
+//	items through a pointer they keep themselves, and allocates
+//	nothing at all.
 // 
 //     	NOTE: Mutual exclusion must be provided by the caller.
 //  	If you want a synchronized list, you must use the routines 
@@ -32,6 +35,52 @@ ListElement<T>::ListElement(T itm)
      next = NULL;	// always initialize to something!
 }
 
+template <class T>
+HostThreadLocal ListElement<T> *ListElement<T>::freeList = NULL;
+
+//----------------------------------------------------------------------
+// ListElement<T>::operator new
+// 	Allocate a list element off the free list, first refilling it
+//	with ElementsPerChunk new ones if it is empty.  The chunks are
+//	never given back.
+//----------------------------------------------------------------------
+
+template <class T>
+void *
+ListElement<T>::operator new(size_t size)
+{
+    ListElement<T> *element;
+
+    ASSERT(size == sizeof(ListElement<T>));
+    if (freeList == NULL) {
+	ListElement<T> *chunk = (ListElement<T> *)
+		::operator new(ElementsPerChunk * sizeof(ListElement<T>));
+
+	for (int i = 0; i < ElementsPerChunk; i++) {
+	    chunk[i].next = freeList;
+	    freeList = &chunk[i];
+	}
+    }
+    element = freeList;
+    freeList = element->next;
+    return element;
+}
+
+//----------------------------------------------------------------------
+// ListElement<T>::operator delete
+// 	Put a list element back on the free list.
+//----------------------------------------------------------------------
+
+template <class T>
+void
+ListElement<T>::operator delete(void *p)
+{
+    ListElement<T> *element = (ListElement<T> *) p;
+
+    element->next = freeList;
+    freeList = element;
+}
+
 
 //----------------------------------------------------------------------
 // List<T>::List
@@ -216,15 +265,66 @@ List<T>::Apply(void (*func)(T)) const
 }
 
 
+//----------------------------------------------------------------------
+// SortedList<T>::SortedList, SortedList<T>::~SortedList
+//	Initialize a sorted list, empty, with no towers; or free the
+//	towers of one being deallocated.  As for List, the elements
+//	themselves aren't freed.
+//----------------------------------------------------------------------
+
+template <class T>
+SortedList<T>::SortedList(int (*comp)(T x, T y)) : List<T>()
+{
+    compare = comp;
+    head.element = NULL;
+    head.height = SkipLevels;
+    for (int l = 0; l < SkipLevels; l++)
+	head.next[l] = NULL;
+    seed = 1;
+}
+
+template <class T>
+SortedList<T>::~SortedList()
+{
+    SkipTower<T> *tower, *next;
+
+    for (tower = head.next[0]; tower != NULL; tower = next) {
+	next = tower->next[0];
+	delete tower;
+    }
+}
+
+//----------------------------------------------------------------------
+// SortedList::TowerHeight
+//	Choose the height of the tower for a new element: 0 (no tower)
+//	three times in four, otherwise one more than another choice, up
+//	to SkipLevels.  The list has its own random numbers, so the
+//	simulation's (see RandomNumber) aren't disturbed.
+//----------------------------------------------------------------------
+
+template <class T>
+int
+SortedList<T>::TowerHeight()
+{
+    unsigned bits;
+    int height = 0;
+
+    seed = seed * 1103515245 + 12345;
+    for (bits = seed >> 8; height < SkipLevels && (bits & 3) == 0; bits >>= 2)
+	height++;
+    return height;
+}
+
 //----------------------------------------------------------------------
 // SortedList::Insert
 //      Insert an "item" into a list, so that the list elements are
-//	sorted in increasing order.
+//	sorted in increasing order, after any it compares equal to.
 //      
 //	Allocate a ListElement to keep track of the item.
-//      If the list is empty, then this will be the only element.
-//	Otherwise, walk through the list, one element at a time,
-//	to find where the new item should be placed.
+//	Run down the lanes to the last tower not after the item, then
+//	along the list from its element (or the front) to where the item
+//	goes.  The towers passed on the way down are the ones the new
+//	element's tower, if it has one, is linked in after.
 //
 //	"item" is the thing to put on the list. 
 //----------------------------------------------------------------------
@@ -235,28 +335,121 @@ SortedList<T>::Insert(T item)
 {
     ListElement<T> *element = new ListElement<T>(item);
     ListElement<T> *ptr;		// keep track
+    SkipTower<T> *update[SkipLevels];
+    SkipTower<T> *tower = &head;
+    int height;
+
+    for (int l = SkipLevels - 1; l >= 0; l--) {
+	while (tower->next[l] != NULL
+		&& compare(tower->next[l]->element->item, item) <= 0)
+	    tower = tower->next[l];
+	update[l] = tower;
+    }
 
-    ASSERT(!IsInList(item));
-    if (this->IsEmpty()) {			// if list is empty, put at front
-        this->first = element;
-        this->last = element;
-    } else if (compare(item, this->first->item) < 0) {  // item goes at front 
-	element->next = this->first;
+    ptr = tower->element;
+    if (ptr == NULL && (this->IsEmpty() || compare(item, this->first->item) < 0)) {
+	element->next = this->first;	// item goes at front
 	this->first = element;
-    } else {		// look for first elt in list bigger than item
-        for (ptr = this->first; ptr->next != NULL; ptr = ptr->next) {
-            if (compare(item, ptr->next->item) < 0) {
-		element->next = ptr->next;
-	        ptr->next = element;
-		this->numInList++;
-		return;
-	    }
-	}
-	this->last->next = element;		// item goes at end of list
-	this->last = element;
+	if (this->last == NULL)
+	    this->last = element;
+    } else {		// look for last elt in list not bigger than item
+	if (ptr == NULL)
+	    ptr = this->first;
+	while (ptr->next != NULL && compare(ptr->next->item, item) <= 0)
+	    ptr = ptr->next;
+	element->next = ptr->next;
+	ptr->next = element;
+	if (this->last == ptr)
+	    this->last = element;
     }
     this->numInList++;
-    ASSERT(IsInList(item));
+
+    height = TowerHeight();
+    if (height > 0) {
+	tower = new SkipTower<T>;
+	tower->element = element;
+	tower->height = height;
+	for (int l = 0; l < height; l++) {
+	    tower->next[l] = update[l]->next[l];
+	    update[l]->next[l] = tower;
+	}
+    }
+}
+
+//----------------------------------------------------------------------
+// SortedList::RemoveFront
+//      Remove the first item, and its tower, if it has one: that is
+//	first in every lane it is in.
+//----------------------------------------------------------------------
+
+template <class T>
+T
+SortedList<T>::RemoveFront()
+{
+    SkipTower<T> *tower = head.next[0];
+
+    ASSERT(!this->IsEmpty());
+    if (tower != NULL && tower->element == this->first) {
+	for (int l = 0; l < tower->height; l++)
+	    head.next[l] = tower->next[l];
+	delete tower;
+    }
+    return List<T>::RemoveFront();
+}
+
+//----------------------------------------------------------------------
+// SortedList::Remove
+//      Remove a specific item from the list.  Must be in the list!
+//	Run down the lanes to the last tower before anything equal to
+//	the item, then along the list to the item itself.  If it has a
+//	tower, unlink that from each of its lanes, where it can only be
+//	after towers equal to it.
+//----------------------------------------------------------------------
+
+template <class T>
+void
+SortedList<T>::Remove(T item)
+{
+    SkipTower<T> *update[SkipLevels];
+    SkipTower<T> *tower = &head;
+    ListElement<T> *prev, *ptr;
+
+    for (int l = SkipLevels - 1; l >= 0; l--) {
+	while (tower->next[l] != NULL
+		&& compare(tower->next[l]->element->item, item) < 0)
+	    tower = tower->next[l];
+	update[l] = tower;
+    }
+
+    prev = tower->element;
+    ptr = (prev == NULL) ? this->first : prev->next;
+    for (; ptr != NULL && !(ptr->item == item); prev = ptr, ptr = ptr->next)
+	ASSERT(compare(ptr->item, item) <= 0);
+    ASSERT(ptr != NULL);	// should always find item!
+
+    for (tower = update[0]->next[0]; tower != NULL && tower->element != ptr
+			&& compare(tower->element->item, item) == 0;
+	 tower = tower->next[0])
+	;
+    if (tower != NULL && tower->element == ptr) {
+	for (int l = 0; l < tower->height; l++) {
+	    SkipTower<T> *t = update[l];
+
+	    while (t->next[l] != tower)
+		t = t->next[l];
+	    t->next[l] = tower->next[l];
+	}
+	delete tower;
+    }
+
+    if (prev == NULL)
+	this->first = ptr->next;
+    else
+	prev->next = ptr->next;
+    if (this->last == ptr)
+	this->last = prev;
+    delete ptr;
+    this->numInList--;
 }
 
 //----------------------------------------------------------------------
@@ -309,7 +502,7 @@ List<T>::SelfTest(T *p, int numEntries)
 
     for (i = 0; i < numEntries; i++) {
 	 Append(p[i]);
-	 ASSERT(IsInList(p[i]));
+	 ASSERT(this->IsInList(p[i]));
 	 ASSERT(!IsEmpty());
      }
      SanityCheck();
@@ -328,7 +521,7 @@ List<T>::SelfTest(T *p, int numEntries)
 // SortedList::SanityCheck
 //      Test whether this is still a legal sorted list.
 //
-//	Test: is the list sorted?
+//	Tests: is the list sorted?  are the towers in order?
 //----------------------------------------------------------------------
 
 template <class T>
@@ -344,6 +537,28 @@ SortedList<T>::SanityCheck() const
             ASSERT(compare(prev->item, ptr->item) <= 0);
         }
     }
+
+    // the towers in lane 0 stand on the elements in order; every lane
+    // is a part of the one below
+    ptr = this->first;
+    for (SkipTower<T> *tower = head.next[0]; tower != NULL;
+					tower = tower->next[0]) {
+	ASSERT(tower->height >= 1 && tower->height <= SkipLevels);
+	while (ptr != NULL && ptr != tower->element)
+	    ptr = ptr->next;
+	ASSERT(ptr != NULL);
+    }
+    for (int l = 1; l < SkipLevels; l++) {
+	const SkipTower<T> *below = &head;
+
+	for (SkipTower<T> *tower = head.next[l]; tower != NULL;
+					tower = tower->next[l]) {
+	    ASSERT(tower->height > l);
+	    while (below != NULL && below != tower)
+		below = below->next[l - 1];
+	    ASSERT(below != NULL);
+	}
+    }
 }
 
 //----------------------------------------------------------------------
@@ -362,14 +577,14 @@ SortedList<T>::SelfTest(T *p, int numEntries)
 
     for (i = 0; i < numEntries; i++) {
 	 Insert(p[i]);
-	 ASSERT(IsInList(p[i]));
+	 ASSERT(this->IsInList(p[i]));
      }
      SanityCheck();
 
      // should be able to get out everything we put in
      for (i = 0; i < numEntries; i++) {
 	 q[i] = this->RemoveFront();
-         ASSERT(!IsInList(q[i]));
+         ASSERT(!this->IsInList(q[i]));
      }
      ASSERT(this->IsEmpty());
 
@@ -381,3 +596,164 @@ SortedList<T>::SelfTest(T *p, int numEntries)
 
      delete q;
 }
+
+//----------------------------------------------------------------------
+// IntrusiveList<T>::IntrusiveList
+//	Initialize an intrusive list, empty to start with.
+//
+//	"link" is the field of each item that points to the next.
+//----------------------------------------------------------------------
+
+template <class T>
+IntrusiveList<T>::IntrusiveList(T *T::*link)
+{ 
+    this->link = link;
+    first = last = NULL; 
+    numInList = 0;
+}
+
+//----------------------------------------------------------------------
+// IntrusiveList<T>::Append
+//      Append an "item" to the end of the list.  Nothing is allocated:
+//	the item is chained in through its own link field.
+//----------------------------------------------------------------------
+
+template <class T>
+void
+IntrusiveList<T>::Append(T *item)
+{
+    ASSERT(!IsInList(item));
+    item->*link = NULL;
+    if (IsEmpty()) {		// list is empty
+	first = item;
+	last = item;
+    } else {			// else put it after last
+	last->*link = item;
+	last = item;
+    }
+    numInList++;
+}
+
+//----------------------------------------------------------------------
+// IntrusiveList<T>::Prepend
+//	Same as Append, only put "item" on the front.
+//----------------------------------------------------------------------
+
+template <class T>
+void
+IntrusiveList<T>::Prepend(T *item)
+{
+    ASSERT(!IsInList(item));
+    if (IsEmpty()) {		// list is empty
+	item->*link = NULL;
+	first = item;
+	last = item;
+    } else {			// else put it before first
+	item->*link = first;
+	first = item;
+    }
+    numInList++;
+}
+
+//----------------------------------------------------------------------
+// IntrusiveList<T>::RemoveFront
+//      Remove the first item from the front of the list.
+//	List must not be empty.
+// 
+// Returns:
+//	The removed item.
+//----------------------------------------------------------------------
+
+template <class T>
+T *
+IntrusiveList<T>::RemoveFront()
+{
+    T *item = first;
+
+    ASSERT(!IsEmpty());
+    first = item->*link;
+    if (first == NULL)		// list had one item, now has none 
+	last = NULL;
+    item->*link = NULL;
+    numInList--;
+    return item;
+}
+
+//----------------------------------------------------------------------
+// IntrusiveList<T>::Remove
+//      Remove a specific item from the list.  Must be in the list!
+//----------------------------------------------------------------------
+
+template <class T>
+void
+IntrusiveList<T>::Remove(T *item)
+{
+    T *prev, *ptr;
+
+    ASSERT(IsInList(item));
+    if (item == first) {
+	(void) RemoveFront();
+	return;
+    }
+    prev = first;
+    for (ptr = first->*link; ptr != item; prev = ptr, ptr = ptr->*link)
+	;
+    prev->*link = item->*link;
+    if (last == item)
+	last = prev;
+    item->*link = NULL;
+    numInList--;
+}
+
+//----------------------------------------------------------------------
+// IntrusiveList<T>::IsInList
+//      Return TRUE if the item is in the list.
+//----------------------------------------------------------------------
+
+template <class T>
+bool
+IntrusiveList<T>::IsInList(T *item) const
+{ 
+    for (T *ptr = first; ptr != NULL; ptr = ptr->*link) {
+        if (item == ptr)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+//----------------------------------------------------------------------
+// IntrusiveList<T>::Apply
+//      Apply function to every item on a list.
+//
+//	"func" -- the function to apply
+//----------------------------------------------------------------------
+
+template <class T>
+void
+IntrusiveList<T>::Apply(void (*func)(T *)) const
+{ 
+    for (T *ptr = first; ptr != NULL; ptr = ptr->*link)
+        (*func)(ptr);
+}
+
+//----------------------------------------------------------------------
+// IntrusiveList<T>::SanityCheck
+//      Test whether this is still a legal list.
+//----------------------------------------------------------------------
+
+template <class T>
+void
+IntrusiveList<T>::SanityCheck() const
+{
+    T *ptr, *prev = NULL;
+    int numFound = 0;
+
+    if (first == NULL) {
+	ASSERT((numInList == 0) && (last == NULL));
+	return;
+    }
+    for (ptr = first; ptr != NULL; prev = ptr, ptr = ptr->*link)
+	numFound++;
+    ASSERT(numFound == numInList);
+    ASSERT(last == prev);
+}
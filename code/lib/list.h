@@ -23,6 +23,12 @@
 //
 // This class is private to this module (and classes that inherit
 // from this module). Made public for notational convenience.
+//
+// List elements come and go on every Append and RemoveFront, so they
+// aren't given back to the heap: each type has its own free list of
+// them, which is refilled ElementsPerChunk at a time.
+
+#define ElementsPerChunk 32	// list elements allocated at once
 
 template <class T>
 class ListElement {
@@ -30,6 +36,17 @@ class ListElement {
     ListElement(T itm); 	// initialize a list element
     ListElement *next;	     	// next element on list, NULL if this is last
     T item; 	   	     	// item on the list
+
+    static void *operator new(size_t size);
+    				// Take an element off the free list
+    static void operator delete(void *p);
+    				// Put an element back on the free list
+
+  private:
+    static HostThreadLocal ListElement *freeList;
+    					// elements not on any list,
+    					// chained through "next"; one
+					// per host thread
 };
 
 // The following class defines a "list" -- a singly linked list of
@@ -52,8 +69,8 @@ class List {
     T Front() { return first->item; }
     				// Return first item on list
 				// without removing it
-    T RemoveFront(); 		// Take item off the front of the list
-    void Remove(T item); 	// Remove specific item from list
+    virtual T RemoveFront(); 	// Take item off the front of the list
+    virtual void Remove(T item); // Remove specific item from list
 
     bool IsInList(T item) const;// is the item in the list?
 
@@ -87,14 +104,35 @@ class List {
 //		returns -1 if x < y
 //		returns 0 if x == y
 //		returns 1 if x > y
+//
+// Items that compare equal stay in the order they were inserted.
+//
+// So that Insert and Remove needn't walk the whole list, it is a skip
+// list: some elements also stand on a "tower", and the towers are
+// linked in up to SkipLevels "lanes" above the list, each lane skipping
+// about three quarters of the towers in the one below.  A search runs
+// along the top lane until the next tower is too far, drops a lane,
+// and so on, down to the list itself, in O(log n) steps.
+
+#define SkipLevels	8	// lanes above a sorted list
+
+template <class T>
+class SkipTower {
+  public:
+    ListElement<T> *element;	// the element it stands on
+    int height;			// it is in lanes 0 to height - 1
+    SkipTower *next[SkipLevels];// the next tower in each of them
+};
 
 template <class T>
 class SortedList : public List<T> {
   public:
-    SortedList(int (*comp)(T x, T y)) : List<T>() { compare = comp;};
-    ~SortedList() {};		// base class destructor called automatically
+    SortedList(int (*comp)(T x, T y));
+    ~SortedList();		// free the towers
 
     void Insert(T item); 	// insert an item onto the list in sorted order
+    T RemoveFront();		// Take item off the front of the list
+    void Remove(T item);	// Remove specific item from list
 
     void SanityCheck() const;	// has this list been corrupted?
     void SelfTest(T *p, int numEntries);
@@ -102,6 +140,12 @@ class SortedList : public List<T> {
 
   private:
     int (*compare)(T x, T y);	// function for sorting list elements
+    SkipTower<T> head;		// where each lane starts; stands on
+    				// no element
+    unsigned seed;		// for choosing how tall towers are
+
+    int TowerHeight();		// Height for a new element's tower, 0
+    				// for none
 
     void Prepend(T item) { Insert(item); }  // *pre*pending has no meaning 
 				             //	in a sorted list
@@ -109,6 +153,51 @@ class SortedList : public List<T> {
 
 };
 
+// The following class defines an "intrusive list" -- a singly linked
+// list of the items themselves, each of which keeps the pointer to the
+// next in a field of its own, named when the list is made:
+//	IntrusiveList<Thread> *queue = new IntrusiveList<Thread>(&Thread::next);
+// Putting an item on the list allocates nothing.  But an item can be on
+// only one list chaining through a given field at a time.
+
+template <class T> class IntrusiveIterator;
+
+template <class T>
+class IntrusiveList {
+  public:
+    IntrusiveList(T *T::*link);	// initialize the list
+    ~IntrusiveList() {}		// the items are the caller's
+
+    void Prepend(T *item);	// Put item at the beginning of the list
+    void Append(T *item);	// Put item at the end of the list
+
+    T *Front() { return first; }
+    				// Return first item on list
+				// without removing it
+    T *RemoveFront(); 		// Take item off the front of the list
+    void Remove(T *item); 	// Remove specific item from list
+
+    bool IsInList(T *item) const;// is the item in the list?
+
+    unsigned int NumInList() { return numInList;};
+    				// how many items in the list?
+    bool IsEmpty() { return (numInList == 0); };
+    				// is the list empty? 
+
+    void Apply(void (*f)(T *)) const; 
+    				// apply function to all elements in list
+
+    void SanityCheck() const;	// has this list been corrupted?
+
+  private:
+    T *T::*link;		// field of each item pointing to the next
+    T *first;  			// Head of the list, NULL if list is empty
+    T *last;			// Last item of list
+    int numInList;		// number of items in list
+
+    friend class IntrusiveIterator<T>;
+};
+
 // The following class can be used to step through a list. 
 // Example code:
 //	ListIterator<T> *iter(list); 
@@ -136,6 +225,30 @@ class ListIterator {
     ListElement<T> *current;	// where we are in the list
 };
 
+// The following class can be used to step through an intrusive list,
+// the same way.
+
+template <class T>
+class IntrusiveIterator {
+  public:
+    IntrusiveIterator(IntrusiveList<T> *list)
+	{ link = list->link; current = list->first; }
+				// initialize an iterator
+
+    bool IsDone() { return current == NULL; };
+				// return TRUE if we are at the end of the list
+
+    T *Item() { ASSERT(!IsDone()); return current; };
+				// return current item on list
+
+    void Next() { current = current->*link; };		
+				// update iterator to point to next
+
+  private:
+    T *T::*link;		// field pointing to the next item
+    T *current;			// where we are in the list
+};
+
 #include "list.cc"		// templates are really like macros
 				// so needs to be included in every
 				// file that uses the template
@@ -0,0 +1,63 @@
+// memtrack.cc
+//	Routines for keeping track of the host memory the kernel uses,
+//	by subsystem.  See memtrack.h.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "debug.h"
+#include "memtrack.h"
+
+static HostThreadLocal MemoryUse usage[NumMemTags];
+					// all zero at first; a kernel's own
+
+static char *tagNames[NumMemTags] = {
+    "threads", "stacks", "interrupts", "machine", "userprog", "filesys",
+    "network", "slab free", "other"
+};
+
+//----------------------------------------------------------------------
+// MemoryAllocated, MemoryFreed
+// 	An object of "bytes" bytes, charged to "tag", has been made, or
+//	deleted.
+//----------------------------------------------------------------------
+
+void
+MemoryAllocated(MemTag tag, int bytes)
+{
+    MemoryUse *u = &usage[tag];
+
+    u->bytes += bytes;
+    u->objects++;
+    if (u->bytes > u->peakBytes)
+	u->peakBytes = u->bytes;
+    if (u->objects > u->peakObjects)
+	u->peakObjects = u->objects;
+}
+
+void
+MemoryFreed(MemTag tag, int bytes)
+{
+    usage[tag].bytes -= bytes;
+    usage[tag].objects--;
+    ASSERT(usage[tag].bytes >= 0 && usage[tag].objects >= 0);
+}
+
+//----------------------------------------------------------------------
+// MemoryUsage, MemTagName
+// 	What is known of "tag", and what to call it.
+//----------------------------------------------------------------------
+
+MemoryUse *
+MemoryUsage(MemTag tag)
+{
+    return &usage[tag];
+}
+
+char *
+MemTagName(MemTag tag)
+{
+    return tagNames[tag];
+}
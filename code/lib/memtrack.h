@@ -0,0 +1,53 @@
+// memtrack.h
+//	Routines for keeping track of the host memory the kernel uses,
+//	by subsystem, so that the cost of a new cache or pool shows.
+//
+//	Each kind of kernel object that matters -- threads and their
+//	stacks, pending interrupts, the simulated machine's memory,
+//	address spaces, file system objects, network messages -- is
+//	charged to a tag when it is allocated, and credited when it is
+//	freed, with MemoryAllocated and MemoryFreed.  For each tag, the
+//	bytes and objects live now, and the most there have been, are
+//	kept; they are printed at halt with the other statistics, and
+//	written to the -json file.
+//
+//	Blocks from a SlabCache (see slab.h) are charged to its tag while
+//	they are handed out; the rest of its slabs, held for reuse, are
+//	charged to MemSlabFree, so the tags together add up to what the
+//	kernel took from the host.
+//
+//	Nothing here can be interrupted, so there is no locking.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef MEMTRACK_H
+#define MEMTRACK_H
+
+#include "copyright.h"
+
+// The subsystems memory is charged to.
+
+enum MemTag { MemThreads, MemStacks, MemInterrupts, MemMachine,
+	      MemUserprog, MemFilesys, MemNetwork, MemSlabFree, MemOther,
+	      NumMemTags };
+
+// The following class defines what is known of one tag.
+
+class MemoryUse {
+  public:
+    int bytes;			// live now,
+    int peakBytes;		// and at most
+    int objects;
+    int peakObjects;
+};
+
+extern void MemoryAllocated(MemTag tag, int bytes);
+					// an object of "bytes" was made
+extern void MemoryFreed(MemTag tag, int bytes);
+					// and one was deleted
+extern MemoryUse *MemoryUsage(MemTag tag);	// what "tag" holds
+extern char *MemTagName(MemTag tag);
+
+#endif // MEMTRACK_H
@@ -0,0 +1,328 @@
+// openhash.cc
+//     	Routines to manage a self-expanding hash table of arbitrary things,
+//	kept in one array, using linear probing to resolve hash conflicts.
+//	See openhash.h.
+//
+//     	NOTE: Mutual exclusion must be provided by the caller.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+const int InitialSlots = 16;	// how big a table do we start with
+
+#include "copyright.h"
+
+//----------------------------------------------------------------------
+// OpenHashTable<Key,T>::OpenHashTable
+//	Initialize a hash table, empty to start with.
+//	Elements can now be added to the table.
+//----------------------------------------------------------------------
+
+template <class Key, class T>
+OpenHashTable<Key,T>::OpenHashTable(Key (*get)(T x), unsigned (*hFunc)(Key x))
+{
+    numItems = 0;
+    InitSlots(InitialSlots);
+    getKey = get;
+    hash = hFunc;
+}
+
+//----------------------------------------------------------------------
+// OpenHashTable<Key,T>::InitSlots
+//	Initialize the slot array, every slot empty.
+//	Called by the constructor and by ReHash().
+//----------------------------------------------------------------------
+
+template <class Key, class T>
+void
+OpenHashTable<Key,T>::InitSlots(int sz)
+{
+    numSlots = sz;
+    numRemoved = 0;
+    slots = new OpenHashSlot<Key,T>[numSlots];
+    for (int i = 0; i < sz; i++) {
+    	slots[i].state = SlotEmpty;
+    }
+}
+
+//----------------------------------------------------------------------
+// OpenHashTable<Key,T>::~OpenHashTable
+//	Prepare a hash table for deallocation.
+//----------------------------------------------------------------------
+
+template <class Key, class T>
+OpenHashTable<Key,T>::~OpenHashTable()
+{
+    ASSERT(IsEmpty());		// make sure table is empty
+    delete [] slots;
+}
+
+//----------------------------------------------------------------------
+// OpenHashTable<Key,T>::HashValue
+//      Return the slot a lookup for "key" starts at.  The hash is
+//	scrambled first (Fibonacci hashing), so keys that are close
+//	together, like sector numbers, don't fill runs of slots.
+//----------------------------------------------------------------------
+
+template <class Key, class T>
+int
+OpenHashTable<Key, T>::HashValue(Key key) const
+{
+    unsigned h = (*hash)(key);
+
+    h ^= h >> 16;
+    return (int) ((h * 2654435769u) & (numSlots - 1));
+}
+
+//----------------------------------------------------------------------
+// OpenHashTable<Key,T>::FindSlot
+//      Return the slot holding "key", or -1 if it's not in the table.
+//	Probe from where the key hashes to, past full slots and
+//	tombstones, until the key or an empty slot turns up.
+//----------------------------------------------------------------------
+
+template <class Key, class T>
+int
+OpenHashTable<Key,T>::FindSlot(Key key) const
+{
+    int mask = numSlots - 1;
+
+    for (int i = HashValue(key); ; i = (i + 1) & mask) {
+	if (slots[i].state == SlotEmpty)
+	    return -1;
+	if (slots[i].state == SlotFull && slots[i].key == key)
+	    return i;
+    }
+}
+
+//----------------------------------------------------------------------
+// OpenHashTable<Key,T>::Insert
+//      Put an item into the hashtable, in the first slot that is empty
+//	or a tombstone, probing from where its key hashes to.
+//
+//	Rebuild the table first if that would leave more than half the
+//	slots in use; it only grows if at least a quarter are full,
+//	otherwise rebuilding just clears the tombstones.
+//
+//	"item" is the thing to put in the table.
+//----------------------------------------------------------------------
+
+template <class Key, class T>
+void
+OpenHashTable<Key,T>::Insert(T item)
+{
+    Key key = getKey(item);
+    int mask, i;
+
+    ASSERT(!IsInTable(key));
+
+    if (2 * (numItems + numRemoved + 1) > numSlots) {
+	ReHash((4 * (numItems + 1) > numSlots) ? 2 * numSlots : numSlots);
+    }
+
+    mask = numSlots - 1;
+    for (i = HashValue(key); slots[i].state == SlotFull; i = (i + 1) & mask)
+	;
+    if (slots[i].state == SlotRemoved)
+	numRemoved--;
+    slots[i].key = key;
+    slots[i].item = item;
+    slots[i].state = SlotFull;
+    numItems++;
+
+    ASSERT(IsInTable(key));
+}
+
+//----------------------------------------------------------------------
+// OpenHashTable<Key,T>::ReHash
+//      Rebuild the table with "size" slots, by
+//	  (i) making a new slot array
+//	  (ii) putting all the items in it again
+//	  (iii) deleting the old array
+//	which leaves no tombstones behind.
+//----------------------------------------------------------------------
+
+template <class Key, class T>
+void
+OpenHashTable<Key,T>::ReHash(int size)
+{
+    OpenHashSlot<Key,T> *oldSlots = slots;
+    int oldSize = numSlots;
+    int mask, j;
+
+    SanityCheck();
+    InitSlots(size);
+
+    mask = numSlots - 1;
+    for (int i = 0; i < oldSize; i++) {
+	if (oldSlots[i].state != SlotFull)
+	    continue;
+	for (j = HashValue(oldSlots[i].key); slots[j].state == SlotFull;
+	     j = (j + 1) & mask)
+	    ;
+	slots[j] = oldSlots[i];
+    }
+    delete [] oldSlots;
+    SanityCheck();
+}
+
+//----------------------------------------------------------------------
+// OpenHashTable<Key,T>::Find
+//      Find an item from the hash table.
+//
+// Returns:
+//	Whether item is found, and if found, the item.
+//----------------------------------------------------------------------
+
+template <class Key, class T>
+bool
+OpenHashTable<Key,T>::Find(Key key, T *itemPtr) const
+{
+    int i = FindSlot(key);
+
+    if (i == -1) {
+	*itemPtr = NULL;
+	return FALSE;
+    }
+    *itemPtr = slots[i].item;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// OpenHashTable<Key,T>::Remove
+//      Remove an item from the hash table. The item must be in the table.
+//	Its slot becomes a tombstone, or, if the next slot is empty, so
+//	no probe can go on past it, empty.
+//
+// Returns:
+//	The removed item.
+//----------------------------------------------------------------------
+
+template <class Key, class T>
+T
+OpenHashTable<Key,T>::Remove(Key key)
+{
+    int i = FindSlot(key);
+
+    ASSERT(i != -1);	// item must be in table
+
+    if (slots[(i + 1) & (numSlots - 1)].state == SlotEmpty) {
+	slots[i].state = SlotEmpty;
+    } else {
+	slots[i].state = SlotRemoved;
+	numRemoved++;
+    }
+    numItems--;
+
+    ASSERT(!IsInTable(key));
+    return slots[i].item;
+}
+
+//----------------------------------------------------------------------
+// OpenHashTable<Key,T>::Apply
+//      Apply function to every item in the hash table.
+//
+//	"func" -- the function to apply
+//----------------------------------------------------------------------
+
+template <class Key,class T>
+void
+OpenHashTable<Key,T>::Apply(void (*func)(T)) const
+{
+    for (int i = 0; i < numSlots; i++) {
+	if (slots[i].state == SlotFull)
+	    (*func)(slots[i].item);
+    }
+}
+
+//----------------------------------------------------------------------
+// OpenHashTable<Key,T>::FindNextFullSlot
+//      Find the next slot in the table that holds an item.
+//
+//	"slot" -- where to start looking
+//----------------------------------------------------------------------
+
+template <class Key,class T>
+int
+OpenHashTable<Key,T>::FindNextFullSlot(int slot) const
+{
+    for (; slot < numSlots; slot++) {
+	if (slots[slot].state == SlotFull) {
+	     break;
+	}
+    }
+    return slot;
+}
+
+//----------------------------------------------------------------------
+// OpenHashTable<Key,T>::SanityCheck
+//      Test whether this is still a legal hash table.
+//
+//	Tests: does the table have the right # of items and tombstones?
+//	       is there an empty slot, so probes end?
+//	       does every item have its own key, and can it be found?
+//----------------------------------------------------------------------
+
+template <class Key, class T>
+void
+OpenHashTable<Key,T>::SanityCheck() const
+{
+    int numFound = 0, numTombstones = 0;
+
+    for (int i = 0; i < numSlots; i++) {
+	if (slots[i].state == SlotRemoved) {
+	    numTombstones++;
+	} else if (slots[i].state == SlotFull) {
+	    numFound++;
+	    ASSERT(slots[i].key == getKey(slots[i].item));
+	    ASSERT(FindSlot(slots[i].key) == i);
+	}
+    }
+    ASSERT(numItems == numFound);
+    ASSERT(numRemoved == numTombstones);
+    ASSERT(numItems + numRemoved < numSlots);
+}
+
+//----------------------------------------------------------------------
+// OpenHashTable<Key,T>::SelfTest
+//      Test whether this module is working.
+//----------------------------------------------------------------------
+
+template <class Key, class T>
+void
+OpenHashTable<Key,T>::SelfTest(T *p, int numEntries)
+{
+    int i;
+    OpenHashIterator<Key, T> *iterator = new OpenHashIterator<Key,T>(this);
+
+    SanityCheck();
+    ASSERT(IsEmpty());	// check that table is empty in various ways
+    for (; !iterator->IsDone(); iterator->Next()) {
+	ASSERTNOTREACHED();
+    }
+    delete iterator;
+
+    for (i = 0; i < numEntries; i++) {
+        Insert(p[i]);
+        ASSERT(IsInTable(getKey(p[i])));
+        ASSERT(!IsEmpty());
+    }
+
+    // every other one out and back in again, over the tombstones
+    for (i = 0; i < numEntries; i += 2) {
+        ASSERT(Remove(getKey(p[i])) == p[i]);
+    }
+    for (i = 0; i < numEntries; i += 2) {
+        Insert(p[i]);
+    }
+    SanityCheck();
+
+    // should be able to get out everything we put in
+    for (i = 0; i < numEntries; i++) {
+        ASSERT(Remove(getKey(p[i])) == p[i]);
+    }
+
+    ASSERT(IsEmpty());
+    SanityCheck();
+}
@@ -0,0 +1,126 @@
+// openhash.h
+//      Data structures for a hash table with the same interface as
+//	HashTable (see hash.h), but kept in a single array, using open
+//	addressing instead of chaining.
+//
+//	HashTable keeps a List per bucket, so every Insert allocates a
+//	list element, and every Find follows pointers from one element
+//	to the next.  Here each slot holds the key and item themselves;
+//	a key that hashes to a full slot goes in the next free one after
+//	it (linear probing), so a lookup reads consecutive slots, and
+//	compares keys without touching the items.  A removed item leaves
+//	a "tombstone" behind, so lookups for keys put in after it still
+//	probe past its slot; Insert reuses tombstones, and rebuilding the
+//	table clears them.
+//
+//	As with HashTable, the key must have Hash() defined, the value
+//	must have GetKey() defined, and "==" must work for keys.
+//
+//	The number of slots is always a power of two, and the table is
+//	rebuilt, twice as big if need be, whenever more than half of them
+//	are full or tombstones.
+//
+//	Allocation and deallocation of the items in the table are to
+//	be done by the caller.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef OPENHASH_H
+#define OPENHASH_H
+
+#include "copyright.h"
+#include "debug.h"
+
+// The state of one slot in an OpenHashTable.
+
+enum SlotState { SlotEmpty, SlotFull, SlotRemoved };
+
+// The following class defines one slot of an OpenHashTable.
+
+template <class Key, class T>
+class OpenHashSlot {
+  public:
+    Key key;			// key of the item, if SlotFull
+    T item;			// the item, if SlotFull
+    SlotState state;
+};
+
+template <class Key,class T> class OpenHashIterator;
+
+// The following class defines an open addressing hash table -- same
+// interface as HashTable.
+
+template <class Key, class T>
+class OpenHashTable {
+  public:
+    OpenHashTable(Key (*get)(T x), unsigned (*hFunc)(Key x));
+    				// initialize a hash table
+    ~OpenHashTable();		// deallocate a hash table
+
+    void Insert(T item);	// Put item into hash table
+    T Remove(Key key);		// Remove item from hash table.
+
+    bool Find(Key key, T *itemPtr) const;
+    				// Find an item from its key
+    bool IsInTable(Key key) { T dummy; return Find(key, &dummy); }
+				// Is the item in the table?
+
+    bool IsEmpty() { return numItems == 0; }
+				// does the table have anything in it
+    int NumItems() { return numItems; }
+
+    void Apply(void (*f)(T)) const;
+    				// apply function to all elements in table
+
+    void SanityCheck() const;// is this still a legal hash table?
+    void SelfTest(T *p, int numItems);
+    				// is the module working?
+
+  private:
+    OpenHashSlot<Key,T> *slots;	// the array of slots
+    int numSlots;		// how many, a power of two
+    int numItems;		// slots that are full
+    int numRemoved;		// slots that are tombstones
+
+    Key (*getKey)(T x);		// get Key from value
+    unsigned (*hash)(Key x);	// the hash function
+
+    void InitSlots(int size);	// initialize slot array
+    int HashValue(Key key) const;
+    				// which slot does the key start at?
+    int FindSlot(Key key) const;// slot holding key, or -1
+    void ReHash(int size);	// rebuild the table with "size" slots
+    int FindNextFullSlot(int start) const;
+    				// find next full slot starting from this one
+
+    friend class OpenHashIterator<Key,T>;
+};
+
+// The following class can be used to step through an open hash table
+// -- same interface as HashIterator.
+
+template <class Key,class T>
+class OpenHashIterator {
+  public:
+    OpenHashIterator(OpenHashTable<Key,T> *table)
+	{ this->table = table; slot = table->FindNextFullSlot(0); }
+				// initialize an iterator
+
+    bool IsDone() { return (slot == table->numSlots); };
+				// return TRUE if no more items in table
+    T Item() { ASSERT(!IsDone()); return table->slots[slot].item; };
+				// return current item in table
+    void Next() { slot = table->FindNextFullSlot(slot + 1); }
+    				// update iterator to point to next
+
+  private:
+    OpenHashTable<Key,T> *table;// the hash table we're stepping through
+    int slot;			// current slot we are at
+};
+
+#include "openhash.cc"		// templates are really like macros
+				// so needs to be included in every
+				// file that uses the template
+#endif // OPENHASH_H
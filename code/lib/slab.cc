@@ -0,0 +1,141 @@
+// slab.cc
+//	Routines to allocate small kernel objects from caches of free
+//	blocks.  See slab.h.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "debug.h"
+#include "slab.h"
+
+// Every block is a multiple of this, so anything can be put in one.
+#define SlabAlign	((int) sizeof(double))
+
+//----------------------------------------------------------------------
+// SlabCache::SlabCache
+// 	An empty cache, for blocks of "size" bytes, charged to "tag".
+//	Nothing is taken from the heap until the first Alloc.
+//----------------------------------------------------------------------
+
+SlabCache::SlabCache(int size, MemTag tag)
+{
+    ASSERT(size > 0);
+    blockSize = divRoundUp(max(size, (int) sizeof(void *)), SlabAlign)
+							* SlabAlign;
+    freeList = NULL;
+    this->tag = tag;
+}
+
+//----------------------------------------------------------------------
+// SlabCache::Alloc
+// 	Return a block off the free list.  If the list is empty, take a
+//	new slab from the heap (or, for blocks bigger than a slab, just
+//	one block's worth) and put all its blocks on it first.
+//
+//	"as" -- what the block is charged to
+//----------------------------------------------------------------------
+
+void *
+SlabCache::Alloc(MemTag as)
+{
+    void *block;
+
+    if (freeList == NULL) {
+	int count = max(SlabSize / blockSize, 1);
+	char *slab = new char[count * blockSize];
+
+	for (int i = count - 1; i >= 0; i--)
+	    Push(slab + i * blockSize);
+    }
+    block = freeList;
+    freeList = *(void **) block;
+    MemoryFreed(MemSlabFree, blockSize);
+    MemoryAllocated(as, blockSize);
+    return block;
+}
+
+//----------------------------------------------------------------------
+// SlabCache::Free, SlabCache::Push
+// 	Put a block back on the free list, for the next Alloc.  Free
+//	takes it from "as", which it was charged to.
+//----------------------------------------------------------------------
+
+void
+SlabCache::Free(void *block, MemTag as)
+{
+    MemoryFreed(as, blockSize);
+    Push(block);
+}
+
+void
+SlabCache::Push(void *block)
+{
+    *(void **) block = freeList;
+    freeList = block;
+    MemoryAllocated(MemSlabFree, blockSize);
+}
+
+//----------------------------------------------------------------------
+// SizeClass
+// 	Return which of the caches below blocks of "size" bytes come
+//	from: 0 for MinSlabBlock bytes or less, 1 for up to twice that,
+//	and so on.
+//----------------------------------------------------------------------
+
+#define NumSizeClasses	8	// MinSlabBlock << 7 == MaxSlabBlock
+
+static HostThreadLocal SlabCache *sizeClasses[NumSizeClasses];
+					// each host thread's kernel its own
+
+static int
+SizeClass(int size)
+{
+    int which = 0;
+
+    for (int blockSize = MinSlabBlock; blockSize < size; blockSize *= 2)
+	which++;
+    return which;
+}
+
+//----------------------------------------------------------------------
+// KernelAlloc
+// 	Return a block of at least "size" bytes, from the cache for its
+//	size class, made when first needed, or from the heap if it is
+//	bigger than MaxSlabBlock.  It is charged to "tag".
+//----------------------------------------------------------------------
+
+void *
+KernelAlloc(int size, MemTag tag)
+{
+    int which;
+
+    if (size > MaxSlabBlock) {
+	MemoryAllocated(tag, size);
+	return new char[size];
+    }
+    which = SizeClass(size);
+    if (sizeClasses[which] == NULL)
+	sizeClasses[which] = new SlabCache(MinSlabBlock << which);
+    return sizeClasses[which]->Alloc(tag);
+}
+
+//----------------------------------------------------------------------
+// KernelFree
+// 	Give back a block from KernelAlloc.  "size" must be what was
+//	asked for, and "tag" what it was charged to.
+//----------------------------------------------------------------------
+
+void
+KernelFree(void *block, int size, MemTag tag)
+{
+    if (block == NULL)
+	return;
+    if (size > MaxSlabBlock) {
+	MemoryFreed(tag, size);
+	delete [] (char *) block;
+	return;
+    }
+    sizeClasses[SizeClass(size)]->Free(block, tag);
+}
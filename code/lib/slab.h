@@ -0,0 +1,70 @@
+// slab.h
+//	Data structures for allocating small kernel objects without a
+//	trip to the heap each time.
+//
+//	A SlabCache hands out blocks of a single size.  It takes memory
+//	from the heap a slab (SlabSize bytes) at a time, carves it into
+//	blocks, and keeps the blocks not in use on a free list, chained
+//	through their first word.  Freeing a block just puts it back on
+//	the list; slabs are never given back to the heap.  The objects
+//	the file system makes and deletes on every operation (OpenFile,
+//	FileHeader, Directory) each have an operator new and delete that
+//	use a cache of their own.
+//
+//	KernelAlloc and KernelFree do the same for blocks of any size:
+//	the size is rounded up to a power of two, each with its own
+//	cache, from MinSlabBlock up to MaxSlabBlock bytes; larger blocks
+//	come from the heap.  The caller passes KernelFree the size it
+//	asked KernelAlloc for.
+//
+//	The blocks handed out are charged to the cache's tag, or the one
+//	KernelAlloc is given, and the spare ones to MemSlabFree (see
+//	memtrack.h).
+//
+//	Nothing here can be interrupted, so there is no locking, as with
+//	the elements of a List.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "copyright.h"
+#include "utility.h"
+#include "memtrack.h"
+
+#define SlabSize	8192	// bytes taken from the heap at once
+#define MinSlabBlock	16	// smallest block KernelAlloc hands out
+#define MaxSlabBlock	2048	// largest; bigger come from the heap
+
+// The following class defines a cache of blocks of one size.
+
+class SlabCache {
+  public:
+    SlabCache(int size, MemTag tag = MemOther);
+    				// Blocks will be "size" bytes
+    ~SlabCache() {}		// the slabs are never freed
+
+    void *Alloc() { return Alloc(tag); }
+    				// Take a block off the free list,
+    				// refilling it if need be
+    void Free(void *block) { Free(block, tag); }
+    				// Put a block back on the free list
+    void *Alloc(MemTag as);	// The same, charging the block to "as"
+    void Free(void *block, MemTag as);
+
+  private:
+    int blockSize;		// bytes in each block, rounded up
+    void *freeList;		// blocks not in use
+    MemTag tag;			// what the blocks are charged to
+    void Push(void *block);	// onto the free list
+};
+
+extern void *KernelAlloc(int size, MemTag tag = MemOther);
+					// a block of "size" bytes
+extern void KernelFree(void *block, int size, MemTag tag = MemOther);
+					// give back a block of "size"
+
+#endif // SLAB_H
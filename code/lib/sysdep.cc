@@ -33,6 +33,11 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <cerrno>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <pthread.h>
 
 #ifdef SOLARIS
 // KMS
@@ -132,6 +137,55 @@ Delay(int seconds)
     (void) sleep((unsigned) seconds);
 }
 
+//----------------------------------------------------------------------
+// WallClock
+// 	Return the UNIX time of day in seconds, to measure how long
+//	Nachos itself takes to run something.
+//----------------------------------------------------------------------
+
+double
+WallClock()
+{
+    struct timeval now;
+
+    (void) gettimeofday(&now, NULL);
+    return now.tv_sec + now.tv_usec / 1000000.0;
+}
+
+//----------------------------------------------------------------------
+// StartHostThread
+// 	Start a POSIX thread in the UNIX process running Nachos, calling
+//	func(arg), so that it can run on another host CPU alongside this
+//	one.  Returns the thread, for JoinHostThread.
+//----------------------------------------------------------------------
+
+void *
+StartHostThread(void *(*func)(void *), void *arg)
+{
+    pthread_t *thread = new pthread_t;
+    int error;
+
+    error = pthread_create(thread, NULL, func, arg);
+    ASSERT(error == 0);
+    return (void *) thread;
+}
+
+//----------------------------------------------------------------------
+// JoinHostThread
+// 	Wait for a thread started by StartHostThread to return.
+//----------------------------------------------------------------------
+
+void
+JoinHostThread(void *thread)
+{
+    pthread_t *t = (pthread_t *) thread;
+    int error;
+
+    error = pthread_join(*t, NULL);
+    ASSERT(error == 0);
+    delete t;
+}
+
 //----------------------------------------------------------------------
 // UDelay
 // 	Put the UNIX process running Nachos to sleep for x microseconds,
@@ -296,6 +350,35 @@ PollFile(int fd)
     return TRUE;
 }
 
+//----------------------------------------------------------------------
+// File positions
+//	MP4 MODIFIED
+//	Once a file has been Lseek'ed, we keep its position here rather
+//	than in UNIX, and read and write it with pread and pwrite, so
+//	that a seek followed by a transfer is one system call instead of
+//	two.  The simulated disk does one of those for every sector.
+//	Files that are never Lseek'ed, like the console, are read and
+//	written as usual.
+//----------------------------------------------------------------------
+
+#define MaxPositionedFiles	64
+
+static bool positioned[MaxPositionedFiles];	// position kept here?
+static int position[MaxPositionedFiles];	// the position, if so
+
+static bool
+Positioned(int fd)
+{
+    return fd >= 0 && fd < MaxPositionedFiles && positioned[fd];
+}
+
+static void
+Unposition(int fd)
+{
+    if (fd >= 0 && fd < MaxPositionedFiles)
+	positioned[fd] = FALSE;
+}
+
 //----------------------------------------------------------------------
 // OpenForWrite
 // 	Open a file for writing.  Create it if it doesn't exist; truncate it 
@@ -310,6 +393,7 @@ OpenForWrite(char *name)
     int fd = open(name, O_RDWR|O_CREAT|O_TRUNC, 0666);
 
     ASSERT(fd >= 0); 
+    Unposition(fd);
     return fd;
 }
 
@@ -327,6 +411,26 @@ OpenForReadWrite(char *name, bool crashOnError)
     int fd = open(name, O_RDWR, 0);
 
     ASSERT(!crashOnError || fd >= 0);
+    Unposition(fd);
+    return fd;
+}
+
+//----------------------------------------------------------------------
+// OpenForRead
+// 	Open a file for reading only, so that many processes can share
+//	it knowing none of them changes it.
+//	Return the file descriptor, or error if it doesn't exist.
+//
+//	"name" -- file name
+//----------------------------------------------------------------------
+
+int
+OpenForRead(char *name, bool crashOnError)
+{
+    int fd = open(name, O_RDONLY, 0);
+
+    ASSERT(!crashOnError || fd >= 0);
+    Unposition(fd);
     return fd;
 }
 
@@ -338,7 +442,7 @@ OpenForReadWrite(char *name, bool crashOnError)
 void
 Read(int fd, char *buffer, int nBytes)
 {
-    int retVal = read(fd, buffer, nBytes);
+    int retVal = ReadPartial(fd, buffer, nBytes);
     ASSERT(retVal == nBytes);
 }
 
@@ -351,7 +455,14 @@ Read(int fd, char *buffer, int nBytes)
 int
 ReadPartial(int fd, char *buffer, int nBytes)
 {
-    return read(fd, buffer, nBytes);
+    int retVal;
+
+    if (!Positioned(fd))
+	return read(fd, buffer, nBytes);
+    retVal = pread(fd, buffer, nBytes, position[fd]);
+    if (retVal > 0)
+	position[fd] += retVal;
+    return retVal;
 }
 
 
@@ -363,20 +474,48 @@ ReadPartial(int fd, char *buffer, int nBytes)
 void
 WriteFile(int fd, char *buffer, int nBytes)
 {
-    int retVal = write(fd, buffer, nBytes);
+    int retVal;
+
+    if (Positioned(fd)) {
+	retVal = pwrite(fd, buffer, nBytes, position[fd]);
+	if (retVal > 0)
+	    position[fd] += retVal;
+    } else {
+	retVal = write(fd, buffer, nBytes);
+    }
     ASSERT(retVal == nBytes);
 }
 
 //----------------------------------------------------------------------
 // Lseek
 // 	Change the location within an open file.  Abort on error.
+//	A seek from the start or the current position takes no system
+//	call; see "File positions" above.
 //----------------------------------------------------------------------
 
 void 
 Lseek(int fd, int offset, int whence)
 {
-    int retVal = lseek(fd, offset, whence);
-    ASSERT(retVal >= 0);
+    int retVal;
+
+    if (fd < 0 || fd >= MaxPositionedFiles) {
+	retVal = lseek(fd, offset, whence);
+	ASSERT(retVal >= 0);
+	return;
+    }
+    if (whence == SEEK_CUR && positioned[fd]) {
+	offset += position[fd];
+	whence = SEEK_SET;
+    }
+    if (whence == SEEK_SET) {
+	ASSERT(offset >= 0);
+	retVal = offset;
+    } else {
+	retVal = lseek(fd, offset, whence);
+	ASSERT(retVal >= 0);
+    }
+    positioned[fd] = TRUE;
+    position[fd] = retVal;
 }
 
 //----------------------------------------------------------------------
@@ -387,6 +526,8 @@ Lseek(int fd, int offset, int whence)
 int 
 Tell(int fd)
 {
+    if (Positioned(fd))
+	return position[fd];
 #if defined(BSD) || defined(SOLARIS) || defined(LINUX)
     return lseek(fd,0,SEEK_CUR); // 386BSD doesn't have the tell() system call
                                  // neither do Solaris and Linux  -KMS
@@ -406,9 +547,41 @@ Close(int fd)
 {
     int retVal = close(fd);
     ASSERT(retVal >= 0); 
+    Unposition(fd);
     return retVal;
 }
 
+//----------------------------------------------------------------------
+// MapFile
+//	MP4 MODIFIED
+// 	Map the first "size" bytes of an open file into memory, so it
+//	can be read and written without system calls.  Changes go back
+//	to the file.  Return NULL if the file can't be mapped.
+//----------------------------------------------------------------------
+
+char *
+MapFile(int fd, int size)
+{
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    return (addr == MAP_FAILED) ? NULL : (char *) addr;
+}
+
+//----------------------------------------------------------------------
+// UnmapFile
+//	MP4 MODIFIED
+// 	Write a mapping made by MapFile back to its file, and remove it.
+//----------------------------------------------------------------------
+
+void
+UnmapFile(char *addr, int size)
+{
+    int retVal = msync(addr, size, MS_SYNC);
+
+    ASSERT(retVal == 0);
+    (void) munmap(addr, size);
+}
+
 //----------------------------------------------------------------------
 // Unlink
 // 	Delete a file.
@@ -420,6 +593,62 @@ Unlink(char *name)
     return unlink(name);
 }
 
+//----------------------------------------------------------------------
+// Rename
+// 	Give file "from" the name "to", replacing any file of that name
+//	in one step.  Return TRUE if it worked.
+//----------------------------------------------------------------------
+
+bool
+Rename(char *from, char *to)
+{
+    return rename(from, to) == 0;
+}
+
+//----------------------------------------------------------------------
+// IsDirectory
+// 	Return TRUE if "name" is a UNIX directory.
+//----------------------------------------------------------------------
+
+bool
+IsDirectory(char *name)
+{
+    struct stat info;
+
+    return stat(name, &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+//----------------------------------------------------------------------
+// OpenDirectory, ReadDirectory, CloseDirectory
+// 	Step through the names in a UNIX directory.  ReadDirectory
+//	skips "." and "..", and returns NULL after the last name.
+//	OpenDirectory returns NULL if "name" cannot be opened.
+//----------------------------------------------------------------------
+
+void *
+OpenDirectory(char *name)
+{
+    return (void *) opendir(name);
+}
+
+char *
+ReadDirectory(void *dir)
+{
+    struct dirent *entry;
+
+    while ((entry = readdir((DIR *) dir)) != NULL) {
+	if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+	    return entry->d_name;
+    }
+    return NULL;
+}
+
+void
+CloseDirectory(void *dir)
+{
+    closedir((DIR *) dir);
+}
+
 //----------------------------------------------------------------------
 // OpenSocket
 // 	Open an interprocess communication (IPC) connection.  For now, 
@@ -533,6 +762,50 @@ ReadFromSocket(int sockID, char *buffer, int packetSize)
     ASSERT(retVal == packetSize);
 }
 
+//----------------------------------------------------------------------
+// ReadFromSocketBatch
+// 	Read up to "maxPackets" fixed size packets off the IPC port, into
+//	"buffer" one after another, without waiting for any.  Returns how
+//	many were read.  Where the host can, they are all read with a
+//	single system call (recvmmsg); elsewhere, one at a time while
+//	PollSocket says there are more.
+//----------------------------------------------------------------------
+int
+ReadFromSocketBatch(int sockID, char *buffer, int packetSize, int maxPackets)
+{
+#if defined(LINUX) && defined(MSG_WAITFORONE)
+    const int MaxBatch = 32;
+    struct mmsghdr msgs[MaxBatch];
+    struct iovec iovs[MaxBatch];
+    int retVal;
+
+    maxPackets = min(maxPackets, MaxBatch);
+    bzero(msgs, sizeof(msgs));
+    for (int i = 0; i < maxPackets; i++) {
+	iovs[i].iov_base = buffer + i * packetSize;
+	iovs[i].iov_len = packetSize;
+	msgs[i].msg_hdr.msg_iov = &iovs[i];
+	msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    retVal = recvmmsg(sockID, msgs, maxPackets, MSG_DONTWAIT, NULL);
+    if (retVal < 0) {
+	ASSERT(errno == EAGAIN || errno == EWOULDBLOCK);
+	return 0;			// nothing waiting
+    }
+    for (int i = 0; i < retVal; i++)
+	ASSERT((int) msgs[i].msg_len == packetSize);
+    return retVal;
+#else
+    int count = 0;
+
+    while (count < maxPackets && PollSocket(sockID)) {
+	ReadFromSocket(sockID, buffer + count * packetSize, packetSize);
+	count++;
+    }
+    return count;
+#endif
+}
+
 //----------------------------------------------------------------------
 //    modified by KMS to add retry...
 // SendToSocket
@@ -24,6 +24,14 @@ extern void Abort();
 extern void Exit(int exitCode);
 extern void Delay(int seconds);
 extern void UDelay(unsigned int usec);// rcgood - to avoid spinners.
+extern double WallClock();		// host time of day, in seconds
+
+// Host threads, each able to run a kernel of its own (-hj): a variable
+// declared HostThreadLocal has a separate copy in each
+#define HostThreadLocal __thread
+extern void *StartHostThread(void *(*func)(void *), void *arg);
+					// run func(arg) on a new host thread
+extern void JoinHostThread(void *thread);	// wait for it to return
 
 // Initialize system so that cleanUp routine is called when user hits ctl-C
 extern void CallOnUserAbort(void (*cleanup)(int));
@@ -45,13 +53,23 @@ extern bool PollFile(int fd);
 // For simulating the disk and the console devices.
 extern int OpenForWrite(char *name);
 extern int OpenForReadWrite(char *name, bool crashOnError);
+extern int OpenForRead(char *name, bool crashOnError);
 extern void Read(int fd, char *buffer, int nBytes);
 extern int ReadPartial(int fd, char *buffer, int nBytes);
 extern void WriteFile(int fd, char *buffer, int nBytes);
 extern void Lseek(int fd, int offset, int whence);
 extern int Tell(int fd);
 extern int Close(int fd);
+extern char *MapFile(int fd, int size);	// map a file into memory
+extern void UnmapFile(char *addr, int size);	// write it back, unmap
 extern bool Unlink(char *name);
+extern bool Rename(char *from, char *to);
+
+// Directory operations, for copying a tree of UNIX files into Nachos
+extern bool IsDirectory(char *name);
+extern void *OpenDirectory(char *name);
+extern char *ReadDirectory(void *dir);
+extern void CloseDirectory(void *dir);
 
 // Other C library routines that are used by Nachos.
 // These are assumed to be portable, so we don't include a wrapper.
@@ -70,6 +88,8 @@ extern void AssignNameToSocket(char *socketName, int sockID);
 extern void DeAssignNameToSocket(char *socketName);
 extern bool PollSocket(int sockID);
 extern void ReadFromSocket(int sockID, char *buffer, int packetSize);
+extern int ReadFromSocketBatch(int sockID, char *buffer, int packetSize,
+			       int maxPackets);
 extern void SendToSocket(int sockID, char *buffer, int packetSize,char *toName);
 
 #endif // SYSDEP_H
@@ -7,7 +7,14 @@
 //	Disk operations are asynchronous, so we have to invoke an interrupt
 //	handler when the simulated operation completes.
 //
-//  DO NOT CHANGE -- part of the machine emulation
+//	The UNIX file is mapped into memory when it can be, so a transfer
+//	is a copy rather than a system call; otherwise, and for an overlay,
+//	sectors are read and written with UNIX I/O, which sysdep does with
+//	pread and pwrite (one system call, not a seek and a transfer).
+//
+//  Part of the machine emulation: only the device itself is modelled
+//  here (transfers, overlays, discards and how the UNIX file is
+//  accessed).  What the file system does with it belongs in SynchDisk.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
@@ -17,15 +24,13 @@
 #include "disk.h"
 #include "debug.h"
 #include "sysdep.h"
+#include "latency.h"
 #include "main.h"
 
-// We put a magic number at the front of the UNIX file representing the
-// disk, to make it less likely we will accidentally treat a useful file 
-// as a disk (which would probably trash the file's contents).
+// The image's layout is in disk.h; an overlay's own file has a magic
+// number of its own.
 
-const int MagicNumber = 0x456789ab;
-const int MagicSize = sizeof(int);
-const int DiskSize = (MagicSize + (NumSectors * SectorSize));
+const int DeltaMagicNumber = 0x456789ac;	// marks an overlay's own file
 
 
 //----------------------------------------------------------------------
@@ -46,33 +51,103 @@ Disk::Disk(CallBackObj *toCall)
     callWhenDone = toCall;
     lastSector = 0;
     bufferInit = 0;
+    model = LatencyModel::Create(kernel->diskModel);
+    kernel->stats->diskModel = (model != NULL) ? model->Name() : "hdd";
     
-    sprintf(diskname,"DISK_%d",kernel->hostName);
+    if (kernel->hostJob >= 0) {		// a scratch disk of the host
+	sprintf(diskname, "DISK_%d.%d", kernel->hostName, kernel->hostJob);
+	(void) Unlink(diskname);	// job's own (-hj), new each run
+    } else
+	sprintf(diskname,"DISK_%d",kernel->hostName);
+    baseFileno = -1;
+    inDelta = NULL;
+    image = NULL;
+    if (kernel->diskBase != NULL) {
+	OpenOverlay();
+	active = FALSE;
+	return;
+    }
     fileno = OpenForReadWrite(diskname, FALSE);
     if (fileno >= 0) {		 	// file exists, check magic number 
-	Read(fileno, (char *) &magicNum, MagicSize);
-	ASSERT(magicNum == MagicNumber);
+	Read(fileno, (char *) &magicNum, ImageMagicSize);
+	ASSERT(magicNum == ImageMagicNumber);
     } else {				// file doesn't exist, create it
         fileno = OpenForWrite(diskname);
-	magicNum = MagicNumber;  
-	WriteFile(fileno, (char *) &magicNum, MagicSize); // write magic number
+	magicNum = ImageMagicNumber;  
+	WriteFile(fileno, (char *) &magicNum, ImageMagicSize); // write magic number
 
 	// need to write at end of file, so that reads will not return EOF
-        Lseek(fileno, DiskSize - sizeof(int), 0);	
+        Lseek(fileno, ImageSize - sizeof(int), 0);	
 	WriteFile(fileno, (char *)&tmp, sizeof(int));  
     }
+    image = MapFile(fileno, ImageSize);
+    if (image == NULL)
+	DEBUG(dbgDisk, "Can't map " << diskname << ", using UNIX I/O");
     active = FALSE;
 }
 
 //----------------------------------------------------------------------
 // Disk::~Disk()
 // 	Clean up disk simulation, by closing the UNIX file representing the
-//	disk.
+//	disk.  A mapped file is synced first, so that it is all on the
+//	host's disk by the time Nachos halts.
 //----------------------------------------------------------------------
 
 Disk::~Disk()
 {
+    if (image != NULL)
+	UnmapFile(image, ImageSize);
     Close(fileno);
+    delete model;
+    if (baseFileno >= 0) {
+	Close(baseFileno);
+	delete [] inDelta;
+    }
+    if (kernel->hostJob >= 0)
+	(void) Unlink(diskname);
+}
+
+//----------------------------------------------------------------------
+// Disk::OpenOverlay()
+// 	Set up a copy-on-write disk.  The image of the same name in the
+//	directory kernel->diskBase is opened only for reading.  Sectors
+//	written go to our own DISK_<m> (DISK_<m>.<job> for a host job)
+//	instead, a "delta" file laid out
+//	like an image (so it stays sparse), followed by one byte per
+//	sector saying whether the delta holds that sector; reads look
+//	there to pick the file.  A delta left by an earlier run is
+//	carried on with, otherwise an empty one is made.
+//----------------------------------------------------------------------
+
+void
+Disk::OpenOverlay()
+{
+    char baseName[256];
+    int magicNum;
+    char zero = 0;
+
+    snprintf(baseName, sizeof(baseName), "%s/DISK_%d", kernel->diskBase,
+	     kernel->hostName);
+    DEBUG(dbgDisk, "Reading through to disk image " << baseName);
+    baseFileno = OpenForRead(baseName, TRUE);
+    Read(baseFileno, (char *) &magicNum, ImageMagicSize);
+    ASSERT(magicNum == ImageMagicNumber);
+
+    inDelta = new char[NumSectors];
+    fileno = OpenForReadWrite(diskname, FALSE);
+    if (fileno >= 0) {			// delta exists, check magic number
+	Read(fileno, (char *) &magicNum, ImageMagicSize);
+	ASSERT(magicNum == DeltaMagicNumber);
+	Lseek(fileno, ImageSize, 0);
+	Read(fileno, inDelta, NumSectors);
+    } else {				// nothing written yet
+	fileno = OpenForWrite(diskname);
+	magicNum = DeltaMagicNumber;
+	WriteFile(fileno, (char *) &magicNum, ImageMagicSize);
+	Lseek(fileno, ImageSize + NumSectors - 1, 0);
+	WriteFile(fileno, &zero, 1);
+	bzero(inDelta, NumSectors);
+    }
 }
 
 //----------------------------------------------------------------------
@@ -97,7 +172,7 @@ PrintSector (bool writing, int sector, char *data)
 
 //----------------------------------------------------------------------
 // Disk::ReadRequest/WriteRequest
-// 	Simulate a request to read/write a single disk sector
+// 	Simulate a request to read/write a run of disk sectors
 //	   Do the read/write immediately to the UNIX file
 //	   Set up an interrupt handler to be called later,
 //	      that will notify the caller when the simulator says
@@ -106,50 +181,124 @@ PrintSector (bool writing, int sector, char *data)
 //	Note that a disk only allows an entire sector to be read/written,
 //	not part of a sector.
 //
-//	"sectorNumber" -- the disk sector to read/write
+//	A mapped image is just copied to or from.
+//
+//	An overlay reads a sector from the base image until it has been
+//	written; the first write of a sector also sets its flag in the
+//	delta, after the data, so the flag never claims data that isn't
+//	there.
+//
+//	"sectorNumber" -- the first disk sector to read/write
 //	"data" -- the bytes to be written, the buffer to hold the incoming bytes
+//	"count" -- how many consecutive sectors
 //----------------------------------------------------------------------
 
 void
-Disk::ReadRequest(int sectorNumber, char* data)
+Disk::ReadRequest(int sectorNumber, char* data, int count)
 {
-    int ticks = ComputeLatency(sectorNumber, FALSE);
+    int ticks = ComputeLatency(sectorNumber, FALSE, count);
 
     ASSERT(!active);				// only one request at a time
-    ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
+    ASSERT((sectorNumber >= 0) && (count >= 1) 
+		&& (sectorNumber + count <= NumSectors));
     
-    DEBUG(dbgDisk, "Reading from sector " << sectorNumber);
-    Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
-    Read(fileno, data, SectorSize);
-    if (debug->IsEnabled('d'))
-	PrintSector(FALSE, sectorNumber, data);
+    DEBUG(dbgDisk, "Reading " << count << " sectors from " << sectorNumber);
+    if (image != NULL)
+	bcopy(&image[SectorSize * sectorNumber + ImageMagicSize], data,
+	      count * SectorSize);
+    else if (baseFileno < 0) {
+	Lseek(fileno, SectorSize * sectorNumber + ImageMagicSize, 0);
+	Read(fileno, data, count * SectorSize);
+    } else {
+	for (int i = 0; i < count; i++) {
+	    int s = sectorNumber + i;
+	    int fd = inDelta[s] ? fileno : baseFileno;
+
+	    Lseek(fd, SectorSize * s + ImageMagicSize, 0);
+	    Read(fd, &data[i * SectorSize], SectorSize);
+	}
+    }
+    if (debug->IsEnabled('d')) {
+	for (int i = 0; i < count; i++)
+	    PrintSector(FALSE, sectorNumber + i, &data[i * SectorSize]);
+    }
     
     active = TRUE;
-    UpdateLast(sectorNumber);
+    UpdateLast(sectorNumber, count);
+    if (model != NULL)
+	model->Start(sectorNumber, FALSE, count);
     kernel->stats->numDiskReads++;
     kernel->interrupt->Schedule(this, ticks, DiskInt);
 }
 
 void
-Disk::WriteRequest(int sectorNumber, char* data)
+Disk::WriteRequest(int sectorNumber, char* data, int count)
 {
-    int ticks = ComputeLatency(sectorNumber, TRUE);
+    int ticks = ComputeLatency(sectorNumber, TRUE, count);
 
     ASSERT(!active);
-    ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
+    ASSERT((sectorNumber >= 0) && (count >= 1) 
+		&& (sectorNumber + count <= NumSectors));
     
-    DEBUG(dbgDisk, "Writing to sector " << sectorNumber);
-    Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
-    WriteFile(fileno, data, SectorSize);
-    if (debug->IsEnabled('d'))
-	PrintSector(TRUE, sectorNumber, data);
+    DEBUG(dbgDisk, "Writing " << count << " sectors to " << sectorNumber);
+    if (image != NULL)
+	bcopy(data, &image[SectorSize * sectorNumber + ImageMagicSize],
+	      count * SectorSize);
+    else {
+	Lseek(fileno, SectorSize * sectorNumber + ImageMagicSize, 0);
+	WriteFile(fileno, data, count * SectorSize);
+    }
+    for (int s = sectorNumber; baseFileno >= 0 && s < sectorNumber + count;
+									s++) {
+	if (!inDelta[s]) {
+	    inDelta[s] = 1;
+	    Lseek(fileno, ImageSize + s, 0);
+	    WriteFile(fileno, &inDelta[s], 1);
+	}
+    }
+    if (debug->IsEnabled('d')) {
+	for (int i = 0; i < count; i++)
+	    PrintSector(TRUE, sectorNumber + i, &data[i * SectorSize]);
+    }
     
     active = TRUE;
-    UpdateLast(sectorNumber);
+    UpdateLast(sectorNumber, count);
+    if (model != NULL)
+	model->Start(sectorNumber, TRUE, count);
     kernel->stats->numDiskWrites++;
     kernel->interrupt->Schedule(this, ticks, DiskInt);
 }
 
+//----------------------------------------------------------------------
+// Disk::Discard
+// 	The file system has freed "count" sectors from "sectorNumber";
+//	their contents no longer matter.  An overlay forgets that its
+//	delta holds them, so they are read from the image again (the
+//	data stays in the delta file, which is never shrunk, but is
+//	dead).  A latency model is told too (an SSD's next write to them
+//	is cheaper).  A plain rotating disk has nothing to do.  The head
+//	doesn't move, so this can be done while a request is active.
+//----------------------------------------------------------------------
+
+void
+Disk::Discard(int sectorNumber, int count)
+{
+    ASSERT(sectorNumber >= 0 && sectorNumber + count <= NumSectors);
+    DEBUG(dbgDisk, "Discarding " << count << " sectors from " << sectorNumber);
+    for (int s = sectorNumber; model != NULL && s < sectorNumber + count; s++)
+	model->Discard(s);
+    if (baseFileno < 0)
+	return;
+    for (int s = sectorNumber; s < sectorNumber + count; s++) {
+	if (inDelta[s]) {
+	    inDelta[s] = 0;
+	    Lseek(fileno, ImageSize + s, 0);
+	    WriteFile(fileno, &inDelta[s], 1);
+	    kernel->stats->numDeltaDropped++;
+	}
+    }
+}
+
 //----------------------------------------------------------------------
 // Disk::CallBack()
 // 	Called by the machine simulation when the disk interrupt occurs.
@@ -171,16 +320,19 @@ Disk::CallBack ()
 //	
 //   	Disk seeks at one track per SeekTime ticks (cf. stats.h)
 //   	and rotates at one sector per RotationTime ticks
+//
+//	"fromSector" -- where the head is
+//	"when" -- the time the seek starts
 //----------------------------------------------------------------------
 
 int
-Disk::TimeToSeek(int newSector, int *rotation) 
+Disk::TimeToSeek(int fromSector, int newSector, int when, int *rotation) 
 {
     int newTrack = newSector / SectorsPerTrack;
-    int oldTrack = lastSector / SectorsPerTrack;
+    int oldTrack = fromSector / SectorsPerTrack;
     int seek = abs(newTrack - oldTrack) * SeekTime;
 				// how long will seek take?
-    int over = (kernel->stats->totalTicks + seek) % RotationTime; 
+    int over = (when + seek) % RotationTime; 
 				// will we be in the middle of a sector when
 				// we finish the seek?
 
@@ -205,10 +357,64 @@ Disk::ModuloDiff(int to, int from)
     return ((toOffset - fromOffset) + SectorsPerTrack) % SectorsPerTrack;
 }
 
+//----------------------------------------------------------------------
+// Disk::Sweep()
+// 	Return how long it will take, from now, to transfer "count"
+//	sectors from "newSector" on, ignoring the track buffer.  On each
+//	track the run covers, the head seeks to it, waits for the first
+//	sector of the run there to come round, and then transfers one
+//	sector per RotationTime.  "*settled" is set to when the head
+//	settled on the last of those tracks, where the track buffer
+//	then starts filling.
+//----------------------------------------------------------------------
+
+int
+Disk::Sweep(int newSector, int count, int *settled)
+{
+    int now = kernel->stats->totalTicks;
+    int when = now;
+    int from = lastSector;
+    int last = newSector + count - 1;
+    int first, end, rotation;
+
+    for (first = newSector; first <= last; first = end + 1) {
+	end = min(last, (first / SectorsPerTrack + 1) * SectorsPerTrack - 1);
+	when += TimeToSeek(from, first, when, &rotation) + rotation;
+	*settled = when;
+	when += ModuloDiff(first, when / RotationTime) * RotationTime;
+	when += (end - first + 1) * RotationTime;
+	from = end;
+    }
+    return when - now;
+}
+
+//----------------------------------------------------------------------
+// Disk::InTrackBuffer()
+// 	Return TRUE if every one of the "count" sectors from "newSector"
+//	on is on the current track, and has passed under the head since
+//	the track buffer started being loaded, as of time "when".
+//----------------------------------------------------------------------
+
+bool
+Disk::InTrackBuffer(int newSector, int count, int when)
+{
+    int passed = (when - bufferInit) / RotationTime;
+
+    if (newSector / SectorsPerTrack != lastSector / SectorsPerTrack ||
+	    (newSector + count - 1) / SectorsPerTrack 
+		!= newSector / SectorsPerTrack)
+	return FALSE;
+    for (int s = newSector; s < newSector + count; s++) {
+	if (passed <= ModuloDiff(s, bufferInit / RotationTime))
+	    return FALSE;
+    }
+    return TRUE;
+}
+
 //----------------------------------------------------------------------
 // Disk::ComputeLatency()
-// 	Return how long will it take to read/write a disk sector, from
-//	the current position of the disk head.
+// 	Return how long will it take to read/write "count" disk sectors
+//	from "newSector" on, from the current position of the disk head.
 //
 //   	Latency = seek time + rotational latency + transfer time
 //   	Disk seeks at one track per SeekTime ticks (cf. stats.h)
@@ -224,45 +430,64 @@ Disk::ModuloDiff(int to, int from)
 //   	read requests to the current track to be satisfied more quickly.
 //   	The contents of the track buffer are discarded after every seek to 
 //   	a new track.
+//
+//	A run of sectors pays the seek and the rotational delay once per
+//	track it covers, and RotationTime for each sector (see Sweep); a
+//	run read entirely from the track buffer, RotationTime a sector.
+//
+//	A modelled device (an SSD, say) neither seeks nor rotates: its
+//	model gives the whole latency.
 //----------------------------------------------------------------------
 
 int
-Disk::ComputeLatency(int newSector, bool writing)
+Disk::ComputeLatency(int newSector, bool writing, int count)
 {
-    int rotation;
-    int seek = TimeToSeek(newSector, &rotation);
-    int timeAfter = kernel->stats->totalTicks + seek + rotation;
+    int rotation, settled, latency;
+    int seek, timeAfter;
+
+    if (model != NULL) {
+	latency = model->Latency(newSector, writing, count);
+	DEBUG(dbgDisk, "Request latency = " << latency);
+	return latency;
+    }
+    seek = TimeToSeek(lastSector, newSector, kernel->stats->totalTicks,
+		      &rotation);
+    timeAfter = kernel->stats->totalTicks + seek + rotation;
 
 #ifndef NOTRACKBUF	// turn this on if you don't want the track buffer stuff
     // check if track buffer applies
     if ((writing == FALSE) && (seek == 0) 
-		&& (((timeAfter - bufferInit) / RotationTime) 
-	     		> ModuloDiff(newSector, bufferInit / RotationTime))) {
-        DEBUG(dbgDisk, "Request latency = " << RotationTime);
-	return RotationTime; // time to transfer sector from the track buffer
+		&& InTrackBuffer(newSector, count, timeAfter)) {
+        DEBUG(dbgDisk, "Request latency = " << count * RotationTime);
+	return count * RotationTime; // time to transfer from the track buffer
     }
 #endif
 
-    rotation += ModuloDiff(newSector, timeAfter / RotationTime) * RotationTime;
-
-    DEBUG(dbgDisk, "Request latency = " << (seek + rotation + RotationTime));
-    return(seek + rotation + RotationTime);
+    latency = Sweep(newSector, count, &settled);
+    DEBUG(dbgDisk, "Request latency = " << latency);
+    return latency;
 }
 
 //----------------------------------------------------------------------
 // Disk::UpdateLast
-//   	Keep track of the most recently requested sector.  So we can know
-//	what is in the track buffer.
+//   	Keep track of the most recently requested sector (the last of a
+//	run).  So we can know what is in the track buffer: it starts
+//	loading again whenever the head settles on a new track.
 //----------------------------------------------------------------------
 
 void
-Disk::UpdateLast(int newSector)
+Disk::UpdateLast(int newSector, int count)
 {
-    int rotate;
-    int seek = TimeToSeek(newSector, &rotate);
+    int rotate, settled;
+    int seek = TimeToSeek(lastSector, newSector, kernel->stats->totalTicks,
+			  &rotate);
     
-    if (seek != 0)
+    if (newSector / SectorsPerTrack 
+		!= (newSector + count - 1) / SectorsPerTrack) {
+	(void) Sweep(newSector, count, &settled);
+	bufferInit = settled;		// ran onto another track
+    } else if (seek != 0)
 	bufferInit = kernel->stats->totalTicks + seek + rotate;
-    lastSector = newSector;
+    lastSector = newSector + count - 1;
     DEBUG(dbgDisk, "Updating last sector = " << lastSector << " , " << bufferInit);
 }
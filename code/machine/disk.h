@@ -8,7 +8,8 @@
 //	a file system operation (eg, create a file) is in progress when the 
 //	system shuts down, the file system may be corrupted.
 //
-//  DO NOT CHANGE -- part of the machine emulation
+//  Part of the machine emulation: only the device itself is modelled
+//  here.  What the file system does with it belongs in SynchDisk.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
@@ -21,6 +22,8 @@
 #include "utility.h"
 #include "callback.h"
 
+class LatencyModel;
+
 // The following class defines a physical disk I/O device.  The disk
 // has a single surface, split up into "tracks", and each track split
 // up into "sectors" (the same number of sectors on each track, and each
@@ -33,7 +36,8 @@
 // requests to read or write portions of the disk return immediately,
 // and an interrupt is invoked later to signal that the operation completed.
 //
-// The physical disk is in fact simulated via operations on a UNIX file.
+// The physical disk is in fact simulated via operations on a UNIX file,
+// mapped into memory when the host allows.
 //
 // To make life a little more realistic, the simulated time for
 // each operation reflects a "track buffer" -- RAM to store the contents
@@ -46,6 +50,23 @@
 // disks these days now come with a track buffer.
 //
 // The track buffer simulation can be disabled by compiling with -DNOTRACKBUF
+//
+// A request can be for a run of consecutive sectors: it pays for the
+// seek and the rotation once, and then one RotationTime per sector,
+// and once more for each track it runs onto.
+//
+// The disk can also be a different device (nachos -dm): an SSD or a
+// RAM disk.  A latency model (see latency.h) then says how long each
+// request takes, instead of the seek, rotation and track buffer.
+//
+// The disk can also be a copy-on-write overlay (-db): an image made
+// earlier is only read, and the sectors written go to a sparse "delta"
+// file instead, so any number of runs can start from the same image
+// without copying it.
+//
+// Sectors the file system has freed can be discarded: the device is
+// told their contents no longer matter.  An overlay then reads them
+// through to the image again, so its delta stops holding dead data.
 
 const int SectorSize = 128;		// number of bytes per disk sector
 const int SectorsPerTrack  = 32;	// number of sectors per disk track 
@@ -53,6 +74,14 @@ const int NumTracks = 32;		// number of tracks per disk
 const int NumSectors = (SectorsPerTrack * NumTracks);
 					// total # of sectors per disk
 
+// The UNIX file simulating the disk: a magic number, to make it less
+// likely we will accidentally treat a useful file as a disk (which
+// would probably trash the file's contents), then the sectors in order.
+
+const int ImageMagicNumber = 0x456789ab;
+const int ImageMagicSize = sizeof(int);
+const int ImageSize = (ImageMagicSize + (NumSectors * SectorSize));
+
 class Disk : public CallBackObj {
   public:
     Disk(CallBackObj *toCall);          // Create a simulated disk.  
@@ -60,20 +89,31 @@ class Disk : public CallBackObj {
 					// when each request completes.
     ~Disk();				// Deallocate the disk.
     
-    void ReadRequest(int sectorNumber, char* data);
-    					// Read/write an single disk sector.
+    void ReadRequest(int sectorNumber, char* data, int count = 1);
+    					// Read/write "count" disk sectors,
+					// from sectorNumber on, to or from
+					// consecutive pieces of "data".
 					// These routines send a request to 
     					// the disk and return immediately.
     					// Only one request allowed at a time!
-    void WriteRequest(int sectorNumber, char* data);
+    void WriteRequest(int sectorNumber, char* data, int count = 1);
+    void Discard(int sectorNumber, int count);
+    					// "count" sectors from sectorNumber
+					// are free; done at once, with no
+					// interrupt
 
     void CallBack();			// Invoked when disk request 
 					// finishes. In turn calls, callWhenDone.
 
-    int ComputeLatency(int newSector, bool writing);	
-    					// Return how long a request to 
-					// newSector will take: 
-					// (seek + rotational delay + transfer)
+    int ComputeLatency(int newSector, bool writing, int count = 1);
+    					// Return how long a request for
+					// "count" sectors from newSector
+					// will take: (seek + rotational
+					// delay + transfer), or what the
+					// latency model says
+    bool Rotates() { return model == NULL; }
+    					// Is it a rotating disk, rather
+					// than a modelled device?
 
   private:
     int fileno;				// UNIX file number for simulated disk 
@@ -83,10 +123,25 @@ class Disk : public CallBackObj {
     int lastSector;			// The previous disk request 
     int bufferInit;			// When the track buffer started 
 					// being loaded
+    LatencyModel *model;		// device timing (nachos -dm), or
+					// NULL for a rotating disk
 
-    int TimeToSeek(int newSector, int *rotate); // time to get to the new track
+    int TimeToSeek(int fromSector, int newSector, int when, int *rotate);
+    					// time to get to the new track
     int ModuloDiff(int to, int from);        // # sectors between to and from
-    void UpdateLast(int newSector);
+    int Sweep(int newSector, int count, int *settled);
+    					// time to transfer a run of sectors
+    bool InTrackBuffer(int newSector, int count, int when);
+    					// already read into the buffer?
+    void UpdateLast(int newSector, int count);
+
+    char *image;			// the UNIX file mapped into memory,
+					// or NULL to use UNIX I/O
+    int baseFileno;			// overlay: UNIX file number of the
+					// image read through, or -1
+    char *inDelta;			// overlay: inDelta[s] if sector s
+					// has been written to our own file
+    void OpenOverlay();			// set up the two files
 };
 
 #endif // DISK_H
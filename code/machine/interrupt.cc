@@ -23,6 +23,10 @@
 #include "copyright.h"
 #include "interrupt.h"
 #include "main.h"
+#include "synchdisk.h"
+#include "synchconsole.h"
+#include "kregion.h"
+#include "memtrack.h"
 
 // String definitions for debugging messages
 
@@ -47,19 +51,27 @@ PendingInterrupt::PendingInterrupt(CallBackObj *callOnInt,
     callOnInterrupt = callOnInt;
     when = time;
     type = kind;
+    order = 0;
+    next = NULL;
+    MemoryAllocated(MemInterrupts, sizeof(PendingInterrupt));
+}
+
+PendingInterrupt::~PendingInterrupt()
+{
+    MemoryFreed(MemInterrupts, sizeof(PendingInterrupt));
 }
 
 //----------------------------------------------------------------------
-// PendingCompare
-//	Compare to interrupts based on which should occur first.
+// PendingBefore
+//	Return TRUE if interrupt "x" should occur before "y": it is due
+//	earlier, or at the same time but was scheduled first.
 //----------------------------------------------------------------------
 
-static int
-PendingCompare (PendingInterrupt *x, PendingInterrupt *y)
+static bool
+PendingBefore (PendingInterrupt *x, PendingInterrupt *y)
 {
-    if (x->when < y->when) { return -1; }
-    else if (x->when > y->when) { return 1; }
-    else { return 0; }
+    if (x->when != y->when) { return x->when < y->when; }
+    return x->order < y->order;
 }
 
 //----------------------------------------------------------------------
@@ -72,7 +84,15 @@ PendingCompare (PendingInterrupt *x, PendingInterrupt *y)
 Interrupt::Interrupt()
 {
     level = IntOff;
-    pending = new SortedList<PendingInterrupt *>(PendingCompare);
+    maxPending = PendingHeapSize;
+    pending = new PendingInterrupt *[maxPending];
+    numPending = 0;
+    numScheduled = 0;
+    freePending = NULL;
+    nextDue = NeverDue;
+    onCPU = 0;
+    cpuShare = 1;
+    tickCredit = 0;
     inHandler = FALSE;
     yieldOnReturn = FALSE;
     status = SystemMode;
@@ -85,10 +105,74 @@ Interrupt::Interrupt()
 
 Interrupt::~Interrupt()
 {
-    while (!pending->IsEmpty()) {
-	delete pending->RemoveFront();
+    PendingInterrupt *toFree;
+
+    while (numPending > 0) {
+	delete HeapPop();
+    }
+    delete [] pending;
+    while ((toFree = freePending) != NULL) {
+	freePending = toFree->next;
+	delete toFree;
+    }
+}
+
+//----------------------------------------------------------------------
+// Interrupt::HeapPush
+// 	Add "toOccur" to the heap of pending interrupts, sifting it up
+//	past the ones due after it.  O(log n); the heap grows when full.
+//----------------------------------------------------------------------
+
+void
+Interrupt::HeapPush(PendingInterrupt *toOccur)
+{
+    int i = numPending++;
+
+    if (numPending > maxPending) {
+	PendingInterrupt **bigger = new PendingInterrupt *[maxPending * 2];
+
+	bcopy((char *) pending, (char *) bigger, 
+		maxPending * sizeof(PendingInterrupt *));
+	delete [] pending;
+	pending = bigger;
+	maxPending *= 2;
+    }
+    while (i > 0 && PendingBefore(toOccur, pending[(i - 1) / 2])) {
+	pending[i] = pending[(i - 1) / 2];
+	i = (i - 1) / 2;
+    }
+    pending[i] = toOccur;
+}
+
+//----------------------------------------------------------------------
+// Interrupt::HeapPop
+// 	Remove and return the pending interrupt that is due first,
+//	sifting the last one down into its place.  O(log n).
+//----------------------------------------------------------------------
+
+PendingInterrupt *
+Interrupt::HeapPop()
+{
+    PendingInterrupt *first = pending[0];
+    PendingInterrupt *last = pending[--numPending];
+    int i = 0;
+
+    for (;;) {
+	int child = 2 * i + 1;
+
+	if (child >= numPending)
+	    break;
+	if (child + 1 < numPending && 
+		PendingBefore(pending[child + 1], pending[child]))
+	    child++;
+	if (!PendingBefore(pending[child], last))
+	    break;
+	pending[i] = pending[child];
+	i = child;
     }
-    delete pending;
+    if (numPending > 0)
+	pending[i] = last;
+    return first;
 }
 
 //----------------------------------------------------------------------
@@ -135,6 +219,39 @@ Interrupt::SetLevel(IntStatus now)
     return old;
 }
 
+//----------------------------------------------------------------------
+// Interrupt::InstructionsUntilDue
+// 	Return how many user instructions Machine::Run can execute, and
+//	then call OneTick once for them all, with OneTick doing just
+//	what it would have done had it been called after each one: the
+//	count that brings the clock up to the next pending interrupt,
+//	and no more.  That is at least one, and no more than
+//	MaxInstructionBatch.
+//
+//	A batch is one instruction if a yield is waiting, or if we are
+//	printing every tick.  The clock advances by a CPU's share of
+//	each instruction, so with several CPUs it takes more of them.
+//----------------------------------------------------------------------
+
+int
+Interrupt::InstructionsUntilDue()
+{
+    int span = nextDue - kernel->stats->totalTicks;	// clock ticks
+    int work;
+
+    if (span <= 1 || yieldOnReturn || debug->IsEnabled(dbgInt))
+	return 1;
+    if (span > MaxInstructionBatch)
+	span = MaxInstructionBatch;	// so the sums can't overflow
+    work = (cpuShare > 1) ? span * cpuShare - tickCredit : span;
+    						// work that brings the
+    						// clock to nextDue
+    work = (work + UserTick - 1) / UserTick;	// in instructions
+    if (work > MaxInstructionBatch)
+	return MaxInstructionBatch;
+    return (work < 1) ? 1 : work;
+}
+
 //----------------------------------------------------------------------
 // Interrupt::OneTick
 // 	Advance simulated time and check if there are any pending 
@@ -143,22 +260,48 @@ Interrupt::SetLevel(IntStatus now)
 //	Two things can cause OneTick to be called:
 //		interrupts are re-enabled
 //		a user instruction is executed
+//
+//	This is called very often, so when nothing is due yet (which
+//	nextDue tells us without looking at the pending list) it returns
+//	as soon as the clock is advanced.
+//
+//	With several CPUs busy, they take turns at the Machine, so a
+//	tick of work on one only advances the clock by its share.
+//
+//	"count" -- how many user instructions (or kernel steps) it is
+//		for; the block engine charges a basic block at once
 //----------------------------------------------------------------------
 void
-Interrupt::OneTick()
+Interrupt::OneTick(int count)
 {
     MachineStatus oldStatus = status;
     Statistics *stats = kernel->stats;
+    int work;
 
 // advance simulated time
     if (status == SystemMode) {
-        stats->totalTicks += SystemTick;
-	stats->systemTicks += SystemTick;
+        work = count * SystemTick;
+	stats->systemTicks += work;
+	if (kernel->regions != NULL)
+	    kernel->regions->Charge(kernel->currentThread->region, work);
     } else {
-	stats->totalTicks += UserTick;
-	stats->userTicks += UserTick;
+	work = count * UserTick;
+	stats->userTicks += work;
+    }
+    stats->cpuTicks[onCPU] += work;
+    if (cpuShare > 1) {		// the other CPUs work in the same ticks
+	tickCredit += work;
+	work = tickCredit / cpuShare;
+	tickCredit %= cpuShare;
     }
+    stats->totalTicks += work;
+    if (stats->totalTicks >= stats->nextSample)
+	stats->Sample();		// (-si)
     DEBUG(dbgInt, "== Tick " << stats->totalTicks << " ==");
+    if (stats->totalTicks < nextDue && !yieldOnReturn && 
+		!debug->IsEnabled(dbgInt)) {
+	return;			// nothing to do yet
+    }
 
 // check any pending interrupts are now ready to fire
     ChangeLevel(IntOn, IntOff);	// first, turn off interrupts
@@ -203,6 +346,9 @@ Interrupt::YieldOnReturn()
 //
 //	If there are no pending interrupts, stop.  There's nothing
 //	more for us to do.
+//
+//	The time skipped is counted as idle ticks, and each skip in
+//	numIdleJumps.
 //----------------------------------------------------------------------
 void
 Interrupt::Idle()
@@ -242,6 +388,8 @@ Interrupt::Halt()
     cout << "This is halt\n";
     kernel->stats->Print();
 	*/
+	kernel->synchDisk->Flush();	// don't lose cached disk writes,
+	kernel->synchConsoleOut->Flush();	// or console output
 	delete debug;
 	
     delete kernel;	// Never returns.
@@ -258,7 +406,8 @@ Interrupt::CreateFile(char *filename, int filesize)
 // 	Arrange for the CPU to be interrupted when simulated time
 //	reaches "now + when".
 //
-//	Implementation: just put it on a sorted list.
+//	Implementation: put it on a binary heap ordered by when it is
+//	due, reusing an interrupt from the free pool if there is one.
 //
 //	NOTE: the Nachos kernel should not call this routine directly.
 //	Instead, it is only called by the hardware device simulators.
@@ -272,12 +421,23 @@ void
 Interrupt::Schedule(CallBackObj *toCall, int fromNow, IntType type)
 {
     int when = kernel->stats->totalTicks + fromNow;
-    PendingInterrupt *toOccur = new PendingInterrupt(toCall, when, type);
+    PendingInterrupt *toOccur = freePending;
 
     DEBUG(dbgInt, "Scheduling interrupt handler the " << intTypeNames[type] << " at time = " << when);
     ASSERT(fromNow > 0);
 
-    pending->Insert(toOccur);
+    if (toOccur != NULL) {
+	freePending = toOccur->next;
+	toOccur->callOnInterrupt = toCall;
+	toOccur->when = when;
+	toOccur->type = type;
+    } else {
+	toOccur = new PendingInterrupt(toCall, when, type);
+    }
+    toOccur->order = numScheduled++;
+    HeapPush(toOccur);
+    if (when < nextDue)
+	nextDue = when;
 }
 
 //----------------------------------------------------------------------
@@ -303,10 +463,10 @@ Interrupt::CheckIfDue(bool advanceClock)
     if (debug->IsEnabled(dbgInt)) {
 	DumpState();
     }
-    if (pending->IsEmpty()) {   	// no pending interrupts
+    if (numPending == 0) {   	// no pending interrupts
 	return FALSE;	
     }		
-    next = pending->Front();
+    next = pending[0];
 
     if (next->when > stats->totalTicks) {
         if (!advanceClock) {		// not time yet
@@ -314,7 +474,10 @@ Interrupt::CheckIfDue(bool advanceClock)
         }
         else {      		// advance the clock to next interrupt
 	    stats->idleTicks += (next->when - stats->totalTicks);
+	    stats->numIdleJumps++;
 	    stats->totalTicks = next->when;
+	    if (stats->totalTicks >= stats->nextSample)
+		stats->Sample();
 	    // UDelay(1000L); // rcgood - to stop nachos from spinning.
 	}
     }
@@ -328,11 +491,13 @@ Interrupt::CheckIfDue(bool advanceClock)
 
     inHandler = TRUE;
     do {
-        next = pending->RemoveFront();    // pull interrupt off list
+        next = HeapPop();    		  // pull interrupt off list
         next->callOnInterrupt->CallBack();// call the interrupt handler
-	delete next;
-    } while (!pending->IsEmpty() 
-    		&& (pending->Front()->when <= stats->totalTicks));
+	next->next = freePending;	  // keep it for the next Schedule
+	freePending = next;
+    } while (numPending > 0 
+    		&& (pending[0]->when <= stats->totalTicks));
+    nextDue = (numPending == 0) ? NeverDue : pending[0]->when;
     inHandler = FALSE;
     return TRUE;
 }
@@ -353,7 +518,8 @@ PrintPending (PendingInterrupt *pending)
 //----------------------------------------------------------------------
 // DumpState
 // 	Print the complete interrupt state - the status, and all interrupts
-//	that are scheduled to occur in the future.
+//	that are scheduled to occur in the future (in heap order, so only
+//	the first is sure to be the next due).
 //----------------------------------------------------------------------
 
 void
@@ -362,7 +528,10 @@ Interrupt::DumpState()
     cout << "Time: " << kernel->stats->totalTicks;
     cout << ", interrupts " << intLevelNames[level] << "\n";
     cout << "Pending interrupts:\n";
-    pending->Apply(PrintPending);
+    for (int i = 0; i < numPending; i++) {
+	PrintPending(pending[i]);
+	cout << "\n";
+    }
     cout << "\nEnd of pending interrupts\n";
 }
 
@@ -60,14 +60,29 @@ class PendingInterrupt {
     PendingInterrupt(CallBackObj *callOnInt, int time, IntType kind);
 				// initialize an interrupt that will
 				// occur in the future
+    ~PendingInterrupt();
 
     CallBackObj *callOnInterrupt;// The object (in the hardware device
 				// emulator) to call when the interrupt occurs
     
     int when;			// When the interrupt is supposed to fire
     IntType type;		// for debugging
+    int order;			// Schedule calls before this one, so
+    				// interrupts due at once fire in order
+    PendingInterrupt *next;	// next one in the free pool
 };
 
+// "when" of an empty pending list, later than any real interrupt
+const int NeverDue = 0x7fffffff;
+
+// The most user instructions Machine::Run runs between calls to
+// OneTick, even with nothing due for longer.
+const int MaxInstructionBatch = 4096;
+
+// Room for this many pending interrupts at first; the heap doubles
+// when it fills up.
+const int PendingHeapSize = 64;
+
 // The following class defines the data structures for the simulation
 // of hardware interrupts.  We record whether interrupts are enabled
 // or disabled, and any hardware interrupts that are scheduled to occur
@@ -105,6 +120,9 @@ class Interrupt {
     MachineStatus getStatus() { return status; } 
     void setStatus(MachineStatus st) { status = st; }
         			// idle, kernel, user
+    void SetCPU(int which, int busy) { onCPU = which; cpuShare = busy; }
+    				// Simulating CPU "which", while "busy"
+				// CPUs have threads to run
 
     void DumpState();		// Print interrupt state
     
@@ -119,13 +137,27 @@ class Interrupt {
 				// at time "when".  This is called
     				// by the hardware device simulators.
     
-    void OneTick();       	// Advance simulated time
+    void OneTick(int count = 1);	// Advance simulated time, by "count"
+    					// instructions' worth
+    int InstructionsUntilDue();		// How many user instructions can
+    					// run before OneTick has anything
+					// to do (at least 1)
 
   private:
     IntStatus level;		// are interrupts enabled or disabled?
-    SortedList<PendingInterrupt *> *pending;		
-    				// the list of interrupts scheduled
-				// to occur in the future
+    PendingInterrupt **pending;	// the interrupts scheduled to occur
+    				// in the future, as a binary heap with
+				// the first due at pending[0]
+    int numPending;		// how many there are
+    int maxPending;		// room in "pending"
+    int numScheduled;		// Schedule calls so far
+    PendingInterrupt *freePending;	// pool of unused interrupts, so
+    					// Schedule needn't "new" one
+    int nextDue;		// when the first of them is due, or
+    				// NeverDue if there are none
+
+    void HeapPush(PendingInterrupt *toOccur);	// add to "pending"
+    PendingInterrupt *HeapPop();	// remove the first due
     //int writeFileNo;            //UNIX file emulating the display
     bool inHandler;		// TRUE if we are running an interrupt handler
     //bool putBusy;               // Is a PrintInt operation in progress
@@ -133,6 +165,10 @@ class Interrupt {
     bool yieldOnReturn; 	// TRUE if we are to context switch
 				// on return from the interrupt handler
     MachineStatus status;	// idle, kernel mode, user mode
+    int onCPU;			// CPU being simulated
+    int cpuShare;		// CPUs busy, each getting this share
+    				// of the clock
+    int tickCredit;		// work not yet added to the clock
 
     // these functions are internal to the interrupt simulation code
 
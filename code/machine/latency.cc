@@ -0,0 +1,99 @@
+// latency.cc
+//	Routines for the storage device models.  See latency.h.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "debug.h"
+#include "latency.h"
+#include "main.h"
+
+//----------------------------------------------------------------------
+// LatencyModel::Create
+// 	Return a new model of the device called "name": "ssd" or "ram".
+//	"hdd" (or NULL) is the rotating disk, which needs no model.
+//----------------------------------------------------------------------
+
+LatencyModel *
+LatencyModel::Create(char *name)
+{
+    if (name == NULL || strcmp(name, "hdd") == 0)
+	return NULL;
+    if (strcmp(name, "ssd") == 0)
+	return new SSDModel();
+    ASSERT(strcmp(name, "ram") == 0);
+    return new RAMModel();
+}
+
+//----------------------------------------------------------------------
+// SSDModel::SSDModel
+// 	Initialize an SSD with nothing discarded.
+//----------------------------------------------------------------------
+
+SSDModel::SSDModel()
+{
+    for (int i = 0; i < NumSectors; i++)
+	trimmed[i] = FALSE;
+}
+
+//----------------------------------------------------------------------
+// SSDModel::Latency
+// 	Return how long a request for "count" sectors from "sectorNumber"
+//	on takes: each channel reads or writes its share of the sectors
+//	one after another, at a flat cost per sector (less for a write to
+//	a discarded one), and the channels all work at once.  Where the
+//	sectors are on the device makes no difference.
+//----------------------------------------------------------------------
+
+int
+SSDModel::Latency(int sectorNumber, bool writing, int count)
+{
+    int busy[SSDChannels];
+    int latency = 0;
+
+    for (int i = 0; i < SSDChannels; i++)
+	busy[i] = 0;
+    for (int s = sectorNumber; s < sectorNumber + count; s++) {
+	int channel = s % SSDChannels;
+
+	if (writing && trimmed[s])
+	    busy[channel] += SSDTrimmedWriteTime;
+	else
+	    busy[channel] += writing ? SSDWriteTime : SSDReadTime;
+	if (busy[channel] > latency)
+	    latency = busy[channel];
+    }
+    DEBUG(dbgDisk, "SSD latency = " << latency);
+    return latency;
+}
+
+//----------------------------------------------------------------------
+// SSDModel::Start
+// 	A request for "count" sectors from "sectorNumber" on is starting:
+//	the sectors it writes hold live data again.
+//----------------------------------------------------------------------
+
+void
+SSDModel::Start(int sectorNumber, bool writing, int count)
+{
+    for (int s = sectorNumber; writing && s < sectorNumber + count; s++) {
+	if (trimmed[s]) {
+	    trimmed[s] = FALSE;
+	    kernel->stats->numTrimmedWrites++;
+	}
+    }
+}
+
+//----------------------------------------------------------------------
+// SSDModel::Discard
+// 	The file system has freed "sectorNumber": the next write to it
+//	needn't wait for the old copy to be collected.
+//----------------------------------------------------------------------
+
+void
+SSDModel::Discard(int sectorNumber)
+{
+    trimmed[sectorNumber] = TRUE;
+}
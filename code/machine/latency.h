@@ -0,0 +1,87 @@
+// latency.h
+//	Data structures for modelling storage devices other than the
+//	simulated rotating disk.
+//
+//	The raw Disk is a rotating disk: its latency is seek, rotation
+//	and transfer (see disk.h).  A latency model makes it a different
+//	device: Disk::ComputeLatency asks the model instead how long a
+//	request would take.  The Disk still serves one request at a time,
+//	and SynchDisk schedules and merges requests as for any disk.
+//	Selecting the model at boot (nachos -dm) shows which file system
+//	optimizations matter on which storage; seek ordering does nothing
+//	for flash, for instance.
+//
+//	    hdd -- the rotating disk, with no model (the default)
+//	    ssd -- a flat cost per sector, lower for reads than writes,
+//		and no seeks; sectors are spread over several channels,
+//		which transfer the sectors of a request in parallel.
+//		Writing a sector the file system has discarded is
+//		cheaper: there is no live copy of it for the device's
+//		garbage collection to move
+//	    ram -- a RAM disk; requests finish as soon as they can
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include "copyright.h"
+#include "disk.h"
+
+#define SSDReadTime	50	// ticks to read a sector (a flash page)
+#define SSDWriteTime	200	// ticks to program one
+#define SSDTrimmedWriteTime 120	// and one that was discarded
+#define SSDChannels	4	// sectors the SSD can work on at once
+
+// The following class defines the interface every device model
+// provides.
+
+class LatencyModel {
+  public:
+    virtual ~LatencyModel() {}
+
+    virtual int Latency(int sectorNumber, bool writing, int count) = 0;
+    					// Ticks a request for "count"
+					// sectors started now would take
+					// (> 0)
+    virtual void Start(int sectorNumber, bool writing, int count) {}
+    					// The request is starting
+    virtual const char *Name() = 0;	// what -dm calls it
+    virtual void Discard(int sectorNumber) {}
+    					// The sector's contents no longer
+					// matter
+
+    static LatencyModel *Create(char *name);
+    					// The model "name", or NULL for
+					// the rotating disk ("hdd")
+};
+
+// A solid state disk: sector "s" is on channel s % SSDChannels, and
+// a channel works on one sector at a time, so a request takes as long
+// as its busiest channel.  Until it is discarded, every sector is
+// taken to hold live data, as the device can't tell.
+
+class SSDModel : public LatencyModel {
+  public:
+    SSDModel();
+
+    int Latency(int sectorNumber, bool writing, int count);
+    void Start(int sectorNumber, bool writing, int count);
+    const char *Name() { return "ssd"; }
+    void Discard(int sectorNumber);
+
+  private:
+    bool trimmed[NumSectors];		// discarded since last written?
+};
+
+// A RAM disk: no latency beyond the interrupt that ends the request.
+
+class RAMModel : public LatencyModel {
+  public:
+    int Latency(int sectorNumber, bool writing, int count) { return 1; }
+    const char *Name() { return "ram"; }
+};
+
+#endif // LATENCY_H
@@ -9,7 +9,9 @@
 
 #include "copyright.h"
 #include "machine.h"
+#include "profile.h"
 #include "main.h"
+#include "memtrack.h"
 
 // Textual names of the exceptions that can be generated by user program
 // execution, for debugging.
@@ -50,28 +52,39 @@ void CheckEndian()
 //
 //	"debug" -- if TRUE, drop into the debugger after each user instruction
 //		is executed.
+//	"useBlocks" -- if TRUE, translate and run user code a basic block
+//		at a time (see BlockEngine in mipssim.cc)
 //----------------------------------------------------------------------
 
-Machine::Machine(bool debug)
+Machine::Machine(bool debug, bool useBlocks)
 {
     int i;
 
     for (i = 0; i < NumTotalRegs; i++)
         registers[i] = 0;
     mainMemory = new char[MemorySize];
+    MemoryAllocated(MemMachine, MemorySize);
     for (i = 0; i < MemorySize; i++)
       	mainMemory[i] = 0;
+    tlb = NULL;			// use linear page table, unless
+    pageTable = NULL;		// SetTLB is called
+    tlbSize = tlbWays = tlbSets = 0;
+    tlbTagged = FALSE;
+    tlbASID = NULL;
+    tlbLastUse = NULL;
+    currentASID = 0;
+    tlbUses = 0;
+    profiler = NULL;
 #ifdef USE_TLB
-    tlb = new TranslationEntry[TLBSize];
-    for (i = 0; i < TLBSize; i++)
-	tlb[i].valid = FALSE;
-    pageTable = NULL;
-#else	// use linear page table
-    tlb = NULL;
-    pageTable = NULL;
+    SetTLB(TLBSize, TLBWays, FALSE);
 #endif
 
     singleStep = debug;
+    tracing = FALSE;
+    unticked = 0;
+    addrDebug = ::debug->IsEnabled(dbgAddr);	// (not the argument)
+    FlushTranslations();
+    AllocDecodeCache(useBlocks);
     CheckEndian();
 }
 
@@ -83,8 +96,57 @@ Machine::Machine(bool debug)
 Machine::~Machine()
 {
     delete [] mainMemory;
-    if (tlb != NULL)
+    MemoryFreed(MemMachine, MemorySize);
+    FreeDecodeCache();
+    delete profiler;
+    if (tlb != NULL) {
         delete [] tlb;
+	delete [] tlbASID;
+	delete [] tlbLastUse;
+    }
+}
+
+//----------------------------------------------------------------------
+// Machine::SetTLB
+// 	Give the machine a software-loaded TLB, in place of the page
+//	table (or of the TLB it already has), with every entry invalid.
+//	A virtual page can only be in one set, vpn % (size / ways), so
+//	a miss is found by searching "ways" entries rather than all of
+//	them; with "ways" equal to "size" the TLB is fully associative.
+//
+//	"size" -- number of entries, at most MaxTLBSize
+//	"ways" -- entries per set, which must divide "size"
+//	"tagged" -- if TRUE, each entry is tagged with the address space
+//		it was loaded for, and only matches while currentASID is
+//		that one, so the TLB needn't be flushed on a context switch
+//----------------------------------------------------------------------
+
+void
+Machine::SetTLB(int size, int ways, bool tagged)
+{
+    ASSERT(size > 0 && size <= MaxTLBSize);
+    ASSERT(ways > 0 && size % ways == 0);
+    if (tlb != NULL) {
+	delete [] tlb;
+	delete [] tlbASID;
+	delete [] tlbLastUse;
+    }
+    tlb = new TranslationEntry[size];
+    tlbASID = new int[size];
+    tlbLastUse = new unsigned int[size];
+    for (int i = 0; i < size; i++) {
+	tlb[i].valid = FALSE;
+	tlbASID[i] = 0;
+	tlbLastUse[i] = 0;
+    }
+    tlbSize = size;
+    tlbWays = ways;
+    tlbSets = size / ways;
+    tlbTagged = tagged;
+    pageTable = NULL;
+    FlushTranslations();
+    kernel->stats->tlbEntries = size;
+    kernel->stats->tlbWays = ways;
 }
 
 //----------------------------------------------------------------------
@@ -103,6 +165,12 @@ Machine::RaiseException(ExceptionType which, int badVAddr)
     DEBUG(dbgMach, "Exception: " << exceptionNames[which]);
     registers[BadVAddrReg] = badVAddr;
     DelayedLoad(0, 0);			// finish anything in progress
+    if (unticked > 0) {			// the clock is behind by the
+	int ran = unticked;		// instructions run before this one
+
+	unticked = 0;			// none of them had anything due
+	kernel->interrupt->OneTick(ran);
+    }
     kernel->interrupt->setStatus(SystemMode);
     ExceptionHandler(which);		// interrupts are enabled at this point
     kernel->interrupt->setStatus(UserMode);
@@ -38,7 +38,9 @@ const int PageSize = 128; 		// set the page size equal to
 const int NumPhysPages = 128;
 
 const int MemorySize = (NumPhysPages * PageSize);
-const int TLBSize = 4;			// if there is a TLB, make it small
+const int TLBSize = 4;			// if there is a TLB, make it small,
+const int TLBWays = 4;			// and fully associative, by default
+const int MaxTLBSize = 256;		// the most entries -tlb may ask for
 
 enum ExceptionType { NoException,           // Everything ok!
 		     SyscallException,      // A program executed a system call.
@@ -90,11 +92,30 @@ enum ExceptionType { NoException,           // Everything ok!
 
 class Instruction;
 class Interrupt;
+class BlockEngine;
+class CodeCache;
+class Profiler;
+
+// The kinds of memory access, each with its own last translation
+// cached (see Machine::CachedTranslate).
+
+enum AccessType { FetchAccess, ReadAccess, WriteAccess, NumAccessTypes };
+
+// The following class defines a cached translation: the page table or
+// TLB entry the last access of a kind used.
+
+class LastTranslation {
+  public:
+    unsigned int vpn;		// virtual page it was for
+    TranslationEntry *entry;	// its entry, or NULL if there is none
+};
 
 class Machine {
   public:
-    Machine(bool debug);	// Initialize the simulation of the hardware
-				// for running user programs
+    Machine(bool debug, bool useBlocks = FALSE);
+    				// Initialize the simulation of the hardware
+				// for running user programs; "useBlocks"
+				// runs them a basic block at a time
     ~Machine();			// De-allocate the data structures
 
 // Routines callable by the Nachos kernel
@@ -135,31 +156,83 @@ class Machine {
     TranslationEntry *tlb;		// this pointer should be considered 
 					// "read-only" to Nachos kernel code
 
-    TranslationEntry *pageTable;
-    unsigned int pageTableSize;
+    PageTable *pageTable;		// the running address space's,
+    					// without a TLB
 
     bool ReadMem(int addr, int size, int* value);
     bool WriteMem(int addr, int size, int value);
     				// Read or write 1, 2, or 4 bytes of virtual 
 				// memory (at addr).  Return FALSE if a 
 				// correct translation couldn't be found.
+    void InvalidateCode(int physAddr, int size);
+    				// The kernel has changed mainMemory
+				// directly: forget any instructions
+				// decoded from there
+    void FlushTranslations();	// The page table has changed: forget
+    				// the cached translations
+    void UseCodeCache(char *hostName);
+    				// Keep the code pages decoded in host
+				// file "hostName", from run to run
+    void LoadedCode(int frame);	// The kernel has just read a page of
+    				// code into "frame": take its decoded
+				// instructions from the code cache
+
+    void SetTLB(int size, int ways, bool tagged);
+    				// Use a TLB of "size" entries, in sets
+				// of "ways", instead of the page table;
+				// if "tagged", an entry only matches in
+				// the address space that loaded it
+    int TLBSet(unsigned int vpn) { return (vpn % tlbSets) * tlbWays; }
+    				// First TLB entry of the set "vpn" is
+				// looked for in
+
+// The TLB geometry, and the tags the hardware keeps with each entry.
+// Like "tlb", these should be considered read-only, apart from the
+// contents of "tlbASID", which the kernel fills in as it loads entries.
+
+    int tlbSize;		// entries, or 0 if there is no TLB
+    int tlbWays;		// entries per set
+    int tlbSets;		// tlbSize / tlbWays
+    bool tlbTagged;		// compare tlbASID with currentASID
+    int *tlbASID;		// address space each entry was loaded for
+    unsigned int *tlbLastUse;	// when each entry last matched, for LRU
+    int currentASID;		// address space now running
+
+    Profiler *profiler;		// counts what user programs run, if
+    				// not NULL; deleted with the machine
+
   private:
 
 // Routines internal to the machine simulation -- DO NOT call these directly
     void DelayedLoad(int nextReg, int nextVal);  	
 				// Do a pending delayed load (modifying a reg)
 
-    void OneInstruction(Instruction *instr); 	
-    				// Run one instruction of a user program.
+    bool OneInstruction(Instruction *instr); 	
+    				// Run one instruction of a user program;
+				// FALSE if it trapped
+    bool Fetch(int addr, Instruction *instr);
+    				// Fetch the instruction at virtual "addr",
+				// decoded; FALSE if there was an exception
+    bool Execute(Instruction *instr);
+    				// Run a fetched instruction; FALSE if it
+				// trapped to the kernel
+    void AllocDecodeCache(bool useBlocks);
+    				// Set up the decoded instruction cache,
+    void FreeDecodeCache();	// and the block engine, and free them
     
 
 
-    ExceptionType Translate(int virtAddr, int* physAddr, int size,bool writing);
+    ExceptionType Translate(int virtAddr, int* physAddr, int size,bool writing,
+			    TranslationEntry **entryUsed = NULL);
     				// Translate an address, and check for 
 				// alignment.  Set the use and dirty bits in 
 				// the translation entry appropriately,
     				// and return an exception code if the 
 				// translation couldn't be completed.
+    ExceptionType CachedTranslate(int virtAddr, int* physAddr, int size,
+				  AccessType type);
+    				// The same, reusing the last translation
+				// of this type if it was for the same page
 
     void RaiseException(ExceptionType which, int badVAddr);
 				// Trap to the Nachos kernel, because of a
@@ -177,8 +250,27 @@ class Machine {
 				// simulated instruction
     int runUntilTime;		// drop back into the debugger when simulated
 				// time reaches this value
+    bool tracing;		// debug flag 'm': print each instruction
+    int unticked;		// instructions run since the clock was
+    				// last advanced for them
+    LastTranslation lastTranslation[NumAccessTypes];
+    				// by kind of access
+    bool addrDebug;		// debug flag 'a': translations are printed,
+    				// so none are cached
+    unsigned int tlbUses;	// TLB matches so far, to stamp tlbLastUse
+
+    Instruction *decoded;	// decoded instruction cache: one entry
+    				// per word of mainMemory
+    int *pageVersion;		// bumped when a physical page is written
+    int *wordVersion;		// decoded[i] is up to date if this is
+    				// its page's version
+    BlockEngine *blockEngine;	// runs basic blocks, or NULL
+    CodeCache *codeCache;	// code pages decoded in earlier runs,
+    				// or NULL
 
     friend class Interrupt;		// calls DelayedLoad()    
+    friend class BlockEngine;		// runs instructions
+    friend class SimBench;		// times Translate
 };
 
 extern void ExceptionHandler(ExceptionType which);
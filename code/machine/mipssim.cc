@@ -21,6 +21,7 @@
 #include "machine.h"
 #include "mipssim.h"
 #include "main.h"
+#include "profile.h"
 
 static void Mult(int a, int b, bool signedArith, int* hiPtr, int* loPtr);
 
@@ -44,6 +45,565 @@ class Instruction {
                      // Immediates are sign-extended.
 };
 
+//----------------------------------------------------------------------
+// The block engine.
+//
+// Rather than fetching, decoding and dispatching each instruction as
+// it is executed, the engine translates a basic block of user code
+// the first time it runs -- the instructions from where it starts up
+// to and including the delay slot of the first branch or jump, or a
+// trap, but not past the end of its physical page -- into an array
+// of decoded instructions, each with a pointer to the routine that
+// executes it ("direct-threaded code").  Running the block is then
+// one translation of the PC, and a call per instruction; the clock
+// is advanced once for the whole block.
+//
+// The common arithmetic instructions have routines of their own;
+// the rest, including every load, store and branch, are run by
+// Machine::Execute, so delay slots and delayed loads work as they
+// always do.  Every routine updates the PCs and does the delayed
+// load, so the machine state is exact after each instruction, and a
+// trap (which may switch threads) just ends the block early.
+//----------------------------------------------------------------------
+
+#define MaxBlockLength	32	// instructions in a basic block
+
+typedef bool (*InstrHandler)(Machine *machine, Instruction *instr);
+
+// The following class defines a translated basic block.
+
+class BasicBlock {
+  public:
+    BasicBlock() { version = 0; length = 0; }	// not yet translated
+
+    int version;		// of its page, when it was translated
+    int length;			// instructions in it
+    Instruction instrs[MaxBlockLength];	// decoded,
+    InstrHandler handlers[MaxBlockLength];	// and how to run each
+};
+
+// The following class defines the engine: the translated blocks, by
+// the physical address they start at.
+
+class BlockEngine {
+  public:
+    BlockEngine(Machine *m);
+    ~BlockEngine();
+
+    bool RunBlock(int max);	// Run up to "max" instructions of the
+    				// block at the PC; FALSE if one trapped
+
+  private:
+    Machine *machine;
+    BasicBlock **blocks;	// by physical word of the first instruction
+
+    void Translate(BasicBlock *block, int physAddr);
+
+    static void Advance(Machine *m);	// an instruction is done
+    static bool Generic(Machine *m, Instruction *instr);
+    static bool Addiu(Machine *m, Instruction *instr);
+    static bool Addu(Machine *m, Instruction *instr);
+    static bool Subu(Machine *m, Instruction *instr);
+    static bool And(Machine *m, Instruction *instr);
+    static bool Or(Machine *m, Instruction *instr);
+    static bool Xor(Machine *m, Instruction *instr);
+    static bool Andi(Machine *m, Instruction *instr);
+    static bool Ori(Machine *m, Instruction *instr);
+    static bool Lui(Machine *m, Instruction *instr);
+    static bool Sll(Machine *m, Instruction *instr);
+    static bool Slt(Machine *m, Instruction *instr);
+    static bool Slti(Machine *m, Instruction *instr);
+};
+
+//----------------------------------------------------------------------
+// BlockEngine::BlockEngine, BlockEngine::~BlockEngine
+// 	Start with no blocks translated; free the ones that were.
+//----------------------------------------------------------------------
+
+BlockEngine::BlockEngine(Machine *m)
+{
+    machine = m;
+    blocks = new BasicBlock *[MemorySize / 4];
+    for (int i = 0; i < MemorySize / 4; i++)
+	blocks[i] = NULL;
+}
+
+BlockEngine::~BlockEngine()
+{
+    for (int i = 0; i < MemorySize / 4; i++)
+	delete blocks[i];
+    delete [] blocks;
+}
+
+//----------------------------------------------------------------------
+// IsTransfer
+// 	Is "opCode" a branch or jump, with a delay slot after it?
+//----------------------------------------------------------------------
+
+static bool
+IsTransfer(int opCode)
+{
+    switch (opCode) {
+      case OP_BEQ: case OP_BNE: case OP_BGEZ: case OP_BGEZAL:
+      case OP_BGTZ: case OP_BLEZ: case OP_BLTZ: case OP_BLTZAL:
+      case OP_J: case OP_JAL: case OP_JR: case OP_JALR:
+	return TRUE;
+      default:
+	return FALSE;
+    }
+}
+
+//----------------------------------------------------------------------
+// BlockEngine::Translate
+// 	Decode the basic block starting at "physAddr" into "block", and
+//	choose the routine for each instruction.  Words the machine's
+//	decode cache has up to date (from the code cache, say) are
+//	taken from there.
+//----------------------------------------------------------------------
+
+void
+BlockEngine::Translate(BasicBlock *block, int physAddr)
+{
+    int page = physAddr / PageSize;
+    int pageEnd = (page + 1) * PageSize;
+    bool inDelaySlot = FALSE;
+
+    block->version = machine->pageVersion[page];
+    block->length = 0;
+    for (int addr = physAddr; addr < pageEnd &&
+				block->length < MaxBlockLength; addr += 4) {
+	Instruction *instr = &block->instrs[block->length];
+	InstrHandler handler;
+
+	if (machine->wordVersion[addr / 4] == block->version) {
+	    *instr = machine->decoded[addr / 4];	// decoded already
+	} else {
+	    instr->value =
+		WordToHost(*(unsigned int *) &machine->mainMemory[addr]);
+	    instr->Decode();
+	}
+	switch (instr->opCode) {
+	  case OP_ADDIU:	handler = Addiu; break;
+	  case OP_ADDU:		handler = Addu; break;
+	  case OP_SUBU:		handler = Subu; break;
+	  case OP_AND:		handler = And; break;
+	  case OP_OR:		handler = Or; break;
+	  case OP_XOR:		handler = Xor; break;
+	  case OP_ANDI:		handler = Andi; break;
+	  case OP_ORI:		handler = Ori; break;
+	  case OP_LUI:		handler = Lui; break;
+	  case OP_SLL:		handler = Sll; break;
+	  case OP_SLT:		handler = Slt; break;
+	  case OP_SLTI:		handler = Slti; break;
+	  default:		handler = Generic; break;
+	}
+	block->handlers[block->length++] = handler;
+	if (inDelaySlot || instr->opCode == OP_SYSCALL ||
+		instr->opCode == OP_RES || instr->opCode == OP_UNIMP)
+	    break;			// the block ends here
+	inDelaySlot = IsTransfer(instr->opCode);
+    }
+    DEBUG(dbgMach, "Translated block at " << physAddr << ", "
+		<< block->length << " instructions");
+}
+
+//----------------------------------------------------------------------
+// BlockEngine::RunBlock
+// 	Run the basic block at the user PC, translating it first if it
+//	hasn't been, or its page has been written since.  The block
+//	stops early if an instruction traps, writes to the block's own
+//	page, or leaves the PC somewhere else (as when the block was
+//	entered at a branch's delay slot), and after "max" instructions,
+//	so as not to run past the next interrupt.
+//
+//	Each instruction that finishes is counted in the machine's
+//	"unticked", for the clock.  Returns FALSE if one trapped.
+//----------------------------------------------------------------------
+
+bool
+BlockEngine::RunBlock(int max)
+{
+    int *registers = machine->registers;
+    int pc = registers[PCReg];
+    int physAddr, page, ran;
+    ExceptionType exception;
+    BasicBlock *block;
+
+    exception = machine->CachedTranslate(pc, &physAddr, 4, FetchAccess);
+    if (exception != NoException) {
+	machine->RaiseException(exception, pc);
+	return FALSE;
+    }
+    page = physAddr / PageSize;
+    block = blocks[physAddr / 4];
+    if (block == NULL)
+	block = blocks[physAddr / 4] = new BasicBlock;
+    if (block->version != machine->pageVersion[page])
+	Translate(block, physAddr);	// first time, or overwritten
+
+    for (ran = 0; ran < block->length && ran < max; ran++) {
+	if (registers[PCReg] != pc + ran * 4)
+	    break;			// went somewhere else
+	if (machine->profiler != NULL)
+	    machine->profiler->Count(pc + ran * 4, block->instrs[ran].opCode);
+	if (!(*block->handlers[ran])(machine, &block->instrs[ran]))
+	    return FALSE;		// trapped
+	machine->unticked++;
+	if (block->version != machine->pageVersion[page])
+	    break;			// the block was overwritten
+    }
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// BlockEngine::Advance
+// 	Finish an instruction that isn't a load or a branch, the way
+//	Machine::Execute does: do any delayed load, and move the PCs on.
+//----------------------------------------------------------------------
+
+void
+BlockEngine::Advance(Machine *m)
+{
+    int *registers = m->registers;
+
+    m->DelayedLoad(0, 0);
+    registers[PrevPCReg] = registers[PCReg];
+    registers[PCReg] = registers[NextPCReg];
+    registers[NextPCReg] = registers[PCReg] + 4;
+}
+
+//----------------------------------------------------------------------
+// BlockEngine::Generic, BlockEngine::Addiu, ...
+// 	The routines that run an instruction in a block: any instruction
+//	at all, by Machine::Execute, or one particular opcode.  Each
+//	returns FALSE if the instruction trapped.
+//----------------------------------------------------------------------
+
+bool
+BlockEngine::Generic(Machine *m, Instruction *instr)
+{
+    return m->Execute(instr);
+}
+
+bool
+BlockEngine::Addiu(Machine *m, Instruction *instr)
+{
+    m->registers[instr->rt] = m->registers[instr->rs] + instr->extra;
+    Advance(m);
+    return TRUE;
+}
+
+bool
+BlockEngine::Addu(Machine *m, Instruction *instr)
+{
+    m->registers[instr->rd] = m->registers[instr->rs] + m->registers[instr->rt];
+    Advance(m);
+    return TRUE;
+}
+
+bool
+BlockEngine::Subu(Machine *m, Instruction *instr)
+{
+    m->registers[instr->rd] = m->registers[instr->rs] - m->registers[instr->rt];
+    Advance(m);
+    return TRUE;
+}
+
+bool
+BlockEngine::And(Machine *m, Instruction *instr)
+{
+    m->registers[instr->rd] = m->registers[instr->rs] & m->registers[instr->rt];
+    Advance(m);
+    return TRUE;
+}
+
+bool
+BlockEngine::Or(Machine *m, Instruction *instr)
+{
+    m->registers[instr->rd] = m->registers[instr->rs] | m->registers[instr->rt];
+    Advance(m);
+    return TRUE;
+}
+
+bool
+BlockEngine::Xor(Machine *m, Instruction *instr)
+{
+    m->registers[instr->rd] = m->registers[instr->rs] ^ m->registers[instr->rt];
+    Advance(m);
+    return TRUE;
+}
+
+bool
+BlockEngine::Andi(Machine *m, Instruction *instr)
+{
+    m->registers[instr->rt] = m->registers[instr->rs] & (instr->extra & 0xffff);
+    Advance(m);
+    return TRUE;
+}
+
+bool
+BlockEngine::Ori(Machine *m, Instruction *instr)
+{
+    m->registers[instr->rt] = m->registers[instr->rs] | (instr->extra & 0xffff);
+    Advance(m);
+    return TRUE;
+}
+
+bool
+BlockEngine::Lui(Machine *m, Instruction *instr)
+{
+    m->registers[instr->rt] = instr->extra << 16;
+    Advance(m);
+    return TRUE;
+}
+
+bool
+BlockEngine::Sll(Machine *m, Instruction *instr)
+{
+    m->registers[instr->rd] = m->registers[instr->rt] << instr->extra;
+    Advance(m);
+    return TRUE;
+}
+
+bool
+BlockEngine::Slt(Machine *m, Instruction *instr)
+{
+    m->registers[instr->rd] = (m->registers[instr->rs] < m->registers[instr->rt]);
+    Advance(m);
+    return TRUE;
+}
+
+bool
+BlockEngine::Slti(Machine *m, Instruction *instr)
+{
+    m->registers[instr->rt] = (m->registers[instr->rs] < instr->extra);
+    Advance(m);
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// The code cache.
+//
+// Every run of Nachos decodes the same user programs again, a word at
+// a time as each is first run.  With -dc, the decoded form of each
+// page of code is kept in a host file from one run to the next: when
+// the kernel reads a page of code into a frame (see LoadedCode), it is
+// looked up by its contents, and if an earlier run decoded a page with
+// the same bytes, the instructions are copied into the decode cache
+// as they are; otherwise the page is decoded at once and added.  At
+// halt, the file is rewritten if any page was added.
+//
+// Since a page is found by its bytes, and they are compared in full,
+// a rebuilt program simply has new pages; the pages of the old one
+// stay in the file until it is removed.
+//----------------------------------------------------------------------
+
+#define CodeCacheMagic	0x4e444343	// "NDCC", first word of the file
+#define CodeCacheSize	1024		// pages kept (a power of 2)
+#define WordsPerPage	(PageSize / 4)
+
+// The following class defines a page of code, as bytes and decoded.
+
+class DecodedPage {
+  public:
+    char bytes[PageSize];
+    Instruction instrs[WordsPerPage];
+};
+
+// The following class defines the pages decoded, hashed by their bytes.
+
+class CodeCache {
+  public:
+    CodeCache(char *hostName);	// Read the pages saved in "hostName"
+    ~CodeCache();		// Save them there, if any were added
+
+    Instruction *Find(char *bytes);	// The page with these bytes,
+    					// decoded, or NULL
+    void Add(char *bytes, Instruction *instrs);
+    					// Keep a page just decoded
+
+    int found, added;		// pages looked up that were there, and
+    				// that weren't
+
+  private:
+    char *fileName;
+    DecodedPage **table;	// by hash of the bytes; open addressing
+    int numPages;
+
+    int Slot(char *bytes);	// where page "bytes" is, or would go
+};
+
+//----------------------------------------------------------------------
+// CodeCache::CodeCache
+// 	Read the pages an earlier run saved in "hostName", if there is
+//	such a file, and it is one of ours.
+//----------------------------------------------------------------------
+
+CodeCache::CodeCache(char *hostName)
+{
+    int header[3];
+    int fd;
+
+    fileName = hostName;
+    table = new DecodedPage *[CodeCacheSize];
+    for (int i = 0; i < CodeCacheSize; i++)
+	table[i] = NULL;
+    numPages = found = added = 0;
+
+    fd = OpenForRead(hostName, FALSE);
+    if (fd < 0)
+	return;				// the first run
+    if (ReadPartial(fd, (char *) header, sizeof(header)) == sizeof(header)
+	&& header[0] == CodeCacheMagic
+	&& header[1] == (int) sizeof(DecodedPage)	// the same build
+	&& header[2] <= CodeCacheSize / 2) {
+	for (int i = 0; i < header[2]; i++) {
+	    DecodedPage *page = new DecodedPage;
+
+	    if (ReadPartial(fd, (char *) page, sizeof(DecodedPage))
+		!= sizeof(DecodedPage)) {
+		delete page;		// cut short: keep what we have
+		break;
+	    }
+	    table[Slot(page->bytes)] = page;
+	    numPages++;
+	}
+    }
+    Close(fd);
+    DEBUG(dbgMach, "Code cache " << hostName << ": " << numPages << " pages");
+}
+
+//----------------------------------------------------------------------
+// CodeCache::~CodeCache
+// 	Save the pages, if this run added any, and free them.  The file
+//	is written under another name and then renamed, so a run that
+//	reads it meanwhile (or a -hj job saving its own) sees either the
+//	old file or the new one whole.
+//----------------------------------------------------------------------
+
+CodeCache::~CodeCache()
+{
+    if (added > 0) {
+	char *tmpName = new char[strlen(fileName) + 5];
+	int header[3];
+	int fd;
+
+	sprintf(tmpName, "%s.tmp", fileName);
+	header[0] = CodeCacheMagic;
+	header[1] = sizeof(DecodedPage);
+	header[2] = numPages;
+	fd = OpenForWrite(tmpName);
+	WriteFile(fd, (char *) header, sizeof(header));
+	for (int i = 0; i < CodeCacheSize; i++)
+	    if (table[i] != NULL)
+		WriteFile(fd, (char *) table[i], sizeof(DecodedPage));
+	Close(fd);
+	if (!Rename(tmpName, fileName))
+	    cerr << "Unable to save code cache " << fileName << "\n";
+	delete [] tmpName;
+    }
+    for (int i = 0; i < CodeCacheSize; i++)
+	delete table[i];
+    delete [] table;
+}
+
+//----------------------------------------------------------------------
+// CodeCache::Slot
+// 	Return the slot of the table holding the page whose bytes are
+//	"bytes", or the empty one it would go in: the first, from its
+//	hash on, that is empty or holds it.
+//----------------------------------------------------------------------
+
+int
+CodeCache::Slot(char *bytes)
+{
+    unsigned int hash = 2166136261u;		// FNV-1a
+
+    for (int i = 0; i < PageSize; i++)
+	hash = (hash ^ (unsigned char) bytes[i]) * 16777619u;
+    for (int i = hash & (CodeCacheSize - 1); ; i = (i + 1) & (CodeCacheSize - 1))
+	if (table[i] == NULL || bcmp(table[i]->bytes, bytes, PageSize) == 0)
+	    return i;
+}
+
+//----------------------------------------------------------------------
+// CodeCache::Find, CodeCache::Add
+// 	Look up a page of code by its bytes; and keep one just decoded.
+//	The table is kept at most half full, so lookups stay short;
+//	pages past that are simply decoded each run.
+//----------------------------------------------------------------------
+
+Instruction *
+CodeCache::Find(char *bytes)
+{
+    DecodedPage *page = table[Slot(bytes)];
+
+    if (page == NULL)
+	return NULL;
+    found++;
+    return page->instrs;
+}
+
+void
+CodeCache::Add(char *bytes, Instruction *instrs)
+{
+    int slot = Slot(bytes);
+
+    if (table[slot] != NULL || numPages >= CodeCacheSize / 2)
+	return;
+    table[slot] = new DecodedPage;
+    bcopy(bytes, table[slot]->bytes, PageSize);
+    bcopy((char *) instrs, (char *) table[slot]->instrs,
+	  WordsPerPage * sizeof(Instruction));
+    numPages++;
+    added++;
+}
+
+//----------------------------------------------------------------------
+// Machine::UseCodeCache
+// 	Keep decoded code pages in host file "hostName", across runs.
+//----------------------------------------------------------------------
+
+void
+Machine::UseCodeCache(char *hostName)
+{
+    ASSERT(codeCache == NULL);
+    codeCache = new CodeCache(hostName);
+}
+
+//----------------------------------------------------------------------
+// Machine::LoadedCode
+// 	The kernel has read a page of code into "frame", and called
+//	InvalidateCode for it.  With a code cache, fill the decode cache
+//	for the frame from it, decoding the page first if no run has
+//	yet, so that none of it need be decoded as it runs.
+//----------------------------------------------------------------------
+
+void
+Machine::LoadedCode(int frame)
+{
+    char *bytes = &mainMemory[frame * PageSize];
+    int first = frame * WordsPerPage;
+    Instruction *instrs;
+
+    if (codeCache == NULL)
+	return;
+    instrs = codeCache->Find(bytes);
+    if (instrs != NULL) {
+	bcopy((char *) instrs, (char *) &decoded[first],
+	      WordsPerPage * sizeof(Instruction));
+    } else {
+	for (int i = 0; i < WordsPerPage; i++) {
+	    decoded[first + i].value =
+		WordToHost(*(unsigned int *) &bytes[i * 4]);
+	    decoded[first + i].Decode();
+	}
+	codeCache->Add(bytes, &decoded[first]);
+    }
+    for (int i = 0; i < WordsPerPage; i++)
+	wordVersion[first + i] = pageVersion[frame];
+}
+
 //----------------------------------------------------------------------
 // Machine::Run
 // 	Simulate the execution of a user-level program on Nachos.
@@ -51,6 +611,16 @@ class Instruction {
 //
 //	This routine is re-entrant, in that it can be called multiple
 //	times concurrently -- one for each thread executing user code.
+//
+//	Rather than advancing the clock after every instruction, we run
+//	as many as we can before the next interrupt is due, and then
+//	advance it once for them all (see InstructionsUntilDue in
+//	interrupt.cc); interrupts still happen after exactly the same
+//	instruction.
+//	An instruction that traps ends the batch, and the ones before it
+//	are counted first (see RaiseException), so the kernel sees the
+//	time it would have.  Single-stepping goes an instruction at a
+//	time.
 //----------------------------------------------------------------------
 
 void
@@ -62,9 +632,35 @@ Machine::Run()
         cout << "Starting program in thread: " << kernel->currentThread->getName();
 		cout << ", at time: " << kernel->stats->totalTicks << "\n";
     }
+    tracing = debug->IsEnabled('m');	// the flags are fixed at boot
     kernel->interrupt->setStatus(UserMode);
+    while (!singleStep) {
+	int budget = kernel->interrupt->InstructionsUntilDue();
+	bool trapped = FALSE;
+	int ran;
+
+	if (profiler != NULL && profiler->UntilSample() < budget)
+	    budget = profiler->UntilSample();	// stop for the sample
+
+	unticked = 0;
+	while (unticked < budget && !trapped) {
+	    if (blockEngine != NULL && !tracing)	// a block at a time
+		trapped = !blockEngine->RunBlock(budget - unticked);
+	    else if (OneInstruction(instr))
+		unticked++;
+	    else
+		trapped = TRUE;
+	}
+	ran = unticked + (trapped ? 1 : 0);	// the trap's was left
+	unticked = 0;				// for us
+	if (profiler != NULL)
+	    profiler->Ran(ran, registers[PCReg]);
+	kernel->interrupt->OneTick(ran);
+    }
     for (;;) {
-        OneInstruction(instr);
+        (void) OneInstruction(instr);
+	if (profiler != NULL)
+	    profiler->Ran(1, registers[PCReg]);
 		kernel->interrupt->OneTick();
 		if (singleStep && (runUntilTime <= kernel->stats->totalTicks))
 	  		Debugger();
@@ -94,6 +690,93 @@ TypeToReg(RegType reg, Instruction *instr)
     }
 }
 
+//----------------------------------------------------------------------
+// Machine::AllocDecodeCache, Machine::FreeDecodeCache
+// 	Set up the cache of decoded instructions, with nothing decoded
+//	yet, and the block engine if "useBlocks" is set; and free them.
+//----------------------------------------------------------------------
+
+void
+Machine::AllocDecodeCache(bool useBlocks)
+{
+    decoded = new Instruction[MemorySize / 4];
+    wordVersion = new int[MemorySize / 4];
+    pageVersion = new int[NumPhysPages];
+    for (int i = 0; i < MemorySize / 4; i++)
+	wordVersion[i] = 0;
+    for (int i = 0; i < NumPhysPages; i++)
+	pageVersion[i] = 1;		// so nothing is up to date
+    blockEngine = useBlocks ? new BlockEngine(this) : NULL;
+    codeCache = NULL;
+}
+
+void
+Machine::FreeDecodeCache()
+{
+    delete blockEngine;
+    if (codeCache != NULL) {
+	DEBUG(dbgMach, "Code cache: " << codeCache->found << " pages found, "
+		<< codeCache->added << " added");
+	delete codeCache;		// saving it
+    }
+    delete [] decoded;
+    delete [] wordVersion;
+    delete [] pageVersion;
+}
+
+//----------------------------------------------------------------------
+// Machine::Fetch
+// 	Fetch the instruction at virtual address "addr" into "instr",
+//	decoded.  Each word of physical memory is decoded the first
+//	time it is run, and then kept until the page it is on is
+//	written (see InvalidateCode), so a loop is decoded only once.
+//
+//	Returns FALSE, having raised the exception, if "addr" can't be
+//	translated.
+//----------------------------------------------------------------------
+
+bool
+Machine::Fetch(int addr, Instruction *instr)
+{
+    int physAddr, page, word;
+    ExceptionType exception = CachedTranslate(addr, &physAddr, 4, FetchAccess);
+
+    if (exception != NoException) {
+	RaiseException(exception, addr);
+	return FALSE;
+    }
+    page = physAddr / PageSize;
+    word = physAddr / 4;
+    if (wordVersion[word] != pageVersion[page]) {
+	decoded[word].value =
+		WordToHost(*(unsigned int *) &mainMemory[physAddr]);
+	decoded[word].Decode();
+	wordVersion[word] = pageVersion[page];
+    }
+    *instr = decoded[word];
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Machine::InvalidateCode
+// 	Note that mainMemory[physAddr..physAddr+size-1] has changed, so
+//	instructions decoded (or blocks translated) from the pages it
+//	covers are stale.  Writes through WriteMem do this themselves;
+//	the kernel calls it when it copies into mainMemory directly
+//	(loading a program, say).
+//----------------------------------------------------------------------
+
+void
+Machine::InvalidateCode(int physAddr, int size)
+{
+    if (size <= 0)
+	return;
+    ASSERT(physAddr >= 0 && physAddr + size <= MemorySize);
+    for (int page = physAddr / PageSize;
+	 page <= (physAddr + size - 1) / PageSize; page++)
+	pageVersion[page]++;
+}
+
 //----------------------------------------------------------------------
 // Machine::OneInstruction
 // 	Execute one instruction from a user-level program
@@ -115,27 +798,20 @@ TypeToReg(RegType reg, Instruction *instr)
 //	leaving.  This allows the Nachos kernel to control our behavior
 //	by controlling the contents of memory, the translation table,
 //	and the register set.
+//
+//	Returns FALSE if the instruction trapped to the kernel.
 //----------------------------------------------------------------------
 
-void
+bool
 Machine::OneInstruction(Instruction *instr)
 {
-#ifdef SIM_FIX
-    int byte;       // described in Kane for LWL,LWR,...
-#endif
-
-    int raw;
-    int nextLoadReg = 0; 	
-    int nextLoadValue = 0; 	// record delayed load operation, to apply
-				// in the future
-
-    // Fetch instruction 
-    if (!ReadMem(registers[PCReg], 4, &raw))
-	return;			// exception occurred
-    instr->value = raw;
-    instr->Decode();
+    // Fetch instruction, decoded
+    if (!Fetch(registers[PCReg], instr))
+	return FALSE;		// exception occurred
+    if (profiler != NULL)
+	profiler->Count(registers[PCReg], instr->opCode);
 
-    if (debug->IsEnabled('m')) {
+    if (tracing) {
         struct OpString *str = &opStrings[instr->opCode];
 	char buf[80];
 
@@ -146,6 +822,29 @@ Machine::OneInstruction(Instruction *instr)
         cout << "\t" << buf << "\n";
     }
     
+    return Execute(instr);
+}
+
+//----------------------------------------------------------------------
+// Machine::Execute
+// 	Execute an instruction that has been fetched and decoded, as
+//	OneInstruction describes.
+//
+//	Returns FALSE if it trapped to the kernel (an exception, or a
+//	system call), which may have changed any of the machine state.
+//----------------------------------------------------------------------
+
+bool
+Machine::Execute(Instruction *instr)
+{
+#ifdef SIM_FIX
+    int byte;       // described in Kane for LWL,LWR,...
+#endif
+
+    int nextLoadReg = 0; 	
+    int nextLoadValue = 0; 	// record delayed load operation, to apply
+				// in the future
+
     // Compute next pc, but don't install in case there's an error or branch.
     int pcAfter = registers[NextPCReg] + 4;
     int sum, diff, tmp, value;
@@ -159,7 +858,7 @@ Machine::OneInstruction(Instruction *instr)
 	if (!((registers[instr->rs] ^ registers[instr->rt]) & SIGN_BIT) &&
 	    ((registers[instr->rs] ^ sum) & SIGN_BIT)) {
 	    RaiseException(OverflowException, 0);
-	    return;
+	    return FALSE;
 	}
 	registers[instr->rd] = sum;
 	break;
@@ -169,7 +868,7 @@ Machine::OneInstruction(Instruction *instr)
 	if (!((registers[instr->rs] ^ instr->extra) & SIGN_BIT) &&
 	    ((instr->extra ^ sum) & SIGN_BIT)) {
 	    RaiseException(OverflowException, 0);
-	    return;
+	    return FALSE;
 	}
 	registers[instr->rt] = sum;
 	break;
@@ -264,7 +963,7 @@ Machine::OneInstruction(Instruction *instr)
       case OP_LBU:
 	tmp = registers[instr->rs] + instr->extra;
 	if (!ReadMem(tmp, 1, &value))
-	    return;
+	    return FALSE;
 
 	if ((value & 0x80) && (instr->opCode == OP_LB))
 	    value |= 0xffffff00;
@@ -279,10 +978,10 @@ Machine::OneInstruction(Instruction *instr)
 	tmp = registers[instr->rs] + instr->extra;
 	if (tmp & 0x1) {
 	    RaiseException(AddressErrorException, tmp);
-	    return;
+	    return FALSE;
 	}
 	if (!ReadMem(tmp, 2, &value))
-	    return;
+	    return FALSE;
 
 	if ((value & 0x8000) && (instr->opCode == OP_LH))
 	    value |= 0xffff0000;
@@ -301,10 +1000,10 @@ Machine::OneInstruction(Instruction *instr)
 	tmp = registers[instr->rs] + instr->extra;
 	if (tmp & 0x3) {
 	    RaiseException(AddressErrorException, tmp);
-	    return;
+	    return FALSE;
 	}
 	if (!ReadMem(tmp, 4, &value))
-	    return;
+	    return FALSE;
 	nextLoadReg = instr->rt;
 	nextLoadValue = value;
 	break;
@@ -324,7 +1023,7 @@ Machine::OneInstruction(Instruction *instr)
         // DEBUG('P', "Addr 0x%X\n",tmp-byte);
 
         if (!ReadMem(tmp-byte, 4, &value))
-            return;
+            return FALSE;
 #else
 	// ReadMem assumes all 4 byte requests are aligned on an even 
 	// word boundary.  Also, the little endian/big endian swap code would
@@ -332,7 +1031,7 @@ Machine::OneInstruction(Instruction *instr)
 	ASSERT((tmp & 0x3) == 0);  
 
 	if (!ReadMem(tmp, 4, &value))
-	    return;
+	    return FALSE;
 #endif
 
 	if (registers[LoadReg] == instr->rt)
@@ -376,7 +1075,7 @@ Machine::OneInstruction(Instruction *instr)
         // DEBUG('P', "Addr 0x%X\n",tmp-byte);
 
         if (!ReadMem(tmp-byte, 4, &value))
-            return;
+            return FALSE;
 #else
 	// ReadMem assumes all 4 byte requests are aligned on an even 
 	// word boundary.  Also, the little endian/big endian swap code would
@@ -384,7 +1083,7 @@ Machine::OneInstruction(Instruction *instr)
 	ASSERT((tmp & 0x3) == 0);  
 
 	if (!ReadMem(tmp, 4, &value))
-	    return;
+	    return FALSE;
 #endif
 
 	if (registers[LoadReg] == instr->rt)
@@ -458,13 +1157,13 @@ Machine::OneInstruction(Instruction *instr)
       case OP_SB:
 	if (!WriteMem((unsigned) 
 		(registers[instr->rs] + instr->extra), 1, registers[instr->rt]))
-	    return;
+	    return FALSE;
 	break;
 	
       case OP_SH:
 	if (!WriteMem((unsigned) 
 		(registers[instr->rs] + instr->extra), 2, registers[instr->rt]))
-	    return;
+	    return FALSE;
 	break;
 	
       case OP_SLL:
@@ -534,7 +1233,7 @@ Machine::OneInstruction(Instruction *instr)
 	if (((registers[instr->rs] ^ registers[instr->rt]) & SIGN_BIT) &&
 	    ((registers[instr->rs] ^ diff) & SIGN_BIT)) {
 	    RaiseException(OverflowException, 0);
-	    return;
+	    return FALSE;
 	}
 	registers[instr->rd] = diff;
 	break;
@@ -546,7 +1245,7 @@ Machine::OneInstruction(Instruction *instr)
       case OP_SW:
 	if (!WriteMem((unsigned) 
 		(registers[instr->rs] + instr->extra), 4, registers[instr->rt]))
-	    return;
+	    return FALSE;
 	break;
 	
       case OP_SWL:	  
@@ -562,7 +1261,7 @@ Machine::OneInstruction(Instruction *instr)
         byte = tmp & 0x3;
         // DEBUG('P', "Addr 0x%X\n",tmp-byte);
         if (!ReadMem(tmp-byte, 4, &value))
-            return;
+            return FALSE;
 
         // DEBUG('P', "Value 0x%X\n",value);
 #else
@@ -572,7 +1271,7 @@ Machine::OneInstruction(Instruction *instr)
 	ASSERT((tmp & 0x3) == 0);  
 
 	if (!ReadMem((tmp & ~0x3), 4, &value))
-	    return;
+	    return FALSE;
 #endif
 
 #ifdef SIM_FIX
@@ -599,12 +1298,12 @@ Machine::OneInstruction(Instruction *instr)
 	}
 #ifndef SIM_FIX
         if (!WriteMem((tmp & ~0x3), 4, value))
-            return;
+            return FALSE;
 #else
         // DEBUG('P', "Value 0x%X\n",value);
 
         if (!WriteMem((tmp - byte), 4, value))
-            return;
+            return FALSE;
 #endif // SIM_FIX
 	break;
     	
@@ -617,7 +1316,7 @@ Machine::OneInstruction(Instruction *instr)
         ASSERT((tmp & 0x3) == 0);  
 
         if (!ReadMem((tmp & ~0x3), 4, &value))
-            return;
+            return FALSE;
 #else
         // The only difference between this code and the BIG ENDIAN code
         // is that the ReadMem call is guaranteed an aligned access as 
@@ -630,7 +1329,7 @@ Machine::OneInstruction(Instruction *instr)
         // DEBUG('P', "Addr 0x%X\n",tmp-byte);
 
         if (!ReadMem(tmp-byte, 4, &value))
-            return;
+            return FALSE;
         // DEBUG('P', "Value 0x%X\n",value);
 #endif // SIM_FIX
 
@@ -656,12 +1355,12 @@ Machine::OneInstruction(Instruction *instr)
 
 #ifndef SIM_FIX
         if (!WriteMem((tmp & ~0x3), 4, value))
-            return;
+            return FALSE;
 #else
         // DEBUG('P', "Value 0x%X\n",value);
 
         if (!WriteMem((tmp - byte), 4, value))
-            return;
+            return FALSE;
 #endif // SIM_FIX
 
 
@@ -669,7 +1368,7 @@ Machine::OneInstruction(Instruction *instr)
     	
       case OP_SYSCALL:
 	RaiseException(SyscallException, 0);
-	return; 
+	return FALSE; 
 	
       case OP_XOR:
 	registers[instr->rd] = registers[instr->rs] ^ registers[instr->rt];
@@ -682,7 +1381,7 @@ Machine::OneInstruction(Instruction *instr)
       case OP_RES:
       case OP_UNIMP:
 	RaiseException(IllegalInstrException, 0);
-	return;
+	return FALSE;
 	
       default:
 	ASSERT(FALSE);
@@ -698,6 +1397,7 @@ Machine::OneInstruction(Instruction *instr)
 						// are jumping into lala-land
     registers[PCReg] = registers[NextPCReg];
     registers[NextPCReg] = pcAfter;
+    return TRUE;
 }
 
 //----------------------------------------------------------------------
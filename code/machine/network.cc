@@ -12,6 +12,23 @@
 #include "network.h"
 #include "main.h"
 
+//-----------------------------------------------------------------------
+// ArrivalOrder
+// 	Compare two packets read in, for the order they arrive in: by
+//	when they are due, and, in lock step, by sender, so every run
+//	sees the same order.
+//-----------------------------------------------------------------------
+
+static int
+ArrivalOrder(SocketPacket *x, SocketPacket *y)
+{
+    if (x->when != y->when)
+	return (x->when < y->when) ? -1 : 1;
+    if (kernel->clusterSize == 0)
+	return 0;
+    return ((PacketHeader *)x->wire)->from - ((PacketHeader *)y->wire)->from;
+}
+
 //-----------------------------------------------------------------------
 // NetworkInput::NetworkInput
 // 	Initialize the simulation for the network input
@@ -25,6 +42,15 @@ NetworkInput::NetworkInput(CallBackObj *toCall)
     callWhenAvail = toCall;
     packetAvail = FALSE;
     inHdr.length = 0;
+    arriving = new SortedList<SocketPacket *>(ArrivalOrder);
+    clocks = NULL;
+    if (kernel->clusterSize > 0) {
+	ASSERT(kernel->hostName >= 0 &&
+	       kernel->hostName < kernel->clusterSize);
+	clocks = new int[kernel->clusterSize];
+	for (int i = 0; i < kernel->clusterSize; i++)
+	    clocks[i] = 0;
+    }
     
     sock = OpenSocket();
     sprintf(sockName, "SOCKET_%d", kernel->hostName);
@@ -39,10 +65,19 @@ NetworkInput::NetworkInput(CallBackObj *toCall)
 // NetworkInput::NetworkInput
 // 	Deallocate the simulation for the network input
 //		(basically, deallocate the input mailbox)
+//
+//	In lock step, tell the others not to wait for us any more.
 //-----------------------------------------------------------------------
 
 NetworkInput::~NetworkInput()
 {
+    if (clocks != NULL) {
+	Announce(NeverTime);
+	delete [] clocks;
+    }
+    while (!arriving->IsEmpty())
+	delete arriving->RemoveFront();
+    delete arriving;
     CloseSocket(sock);
     DeAssignNameToSocket(sockName);
 }
@@ -52,31 +87,40 @@ NetworkInput::~NetworkInput()
 //	Simulator calls this when a packet may be available to
 //	be read in from the simulated network.
 //
-//      First check to make sure packet is available & there's space to
-//	pull it in.  Then invoke the "callBack" registered by whoever 
-//	wants the packet.
+//      Every packet waiting on the socket is read in, but they still
+//	arrive one per poll, as before.  In lock step, we first tell the
+//	others our clock, and wait until none of them can still send
+//	anything due by now.  Then check to make sure a packet is due &
+//	there's space to pull it in.  Then invoke the "callBack"
+//	registered by whoever wants the packet.
 //-----------------------------------------------------------------------
 
 void
 NetworkInput::CallBack()
 {
+    int now = kernel->stats->totalTicks;
+    SocketPacket *packet;
+
     // schedule the next time to poll for a packet
     kernel->interrupt->Schedule(this, NetworkTime, NetworkRecvInt);
 
+    ReadSocket(FALSE);
+    if (clocks != NULL) {
+	Announce(now);
+	while (Horizon() < now)
+	    ReadSocket(TRUE);
+    }
+
     if (inHdr.length != 0) 	// do nothing if packet is already buffered
 	return;		
-    if (!PollSocket(sock)) 	// do nothing if no packet to be read
-	return;
-
-    // otherwise, read packet in
-    char *buffer = new char[MaxWireSize];
-    ReadFromSocket(sock, buffer, MaxWireSize);
+    if (arriving->IsEmpty() || arriving->Front()->when > now)
+	return;			// do nothing if no packet is due
 
-    // divide packet into header and data
-    inHdr = *(PacketHeader *)buffer;
-    ASSERT((inHdr.to == kernel->hostName) && (inHdr.length <= MaxPacketSize));
-    bcopy(buffer + sizeof(PacketHeader), inbox, inHdr.length);
-    delete [] buffer ;
+    // divide the next packet into header and data
+    packet = arriving->RemoveFront();
+    inHdr = *(PacketHeader *)packet->wire;
+    bcopy(packet->wire + sizeof(PacketHeader), inbox, inHdr.length);
+    delete packet;
 
     DEBUG(dbgNet, "Network received packet from " << inHdr.from << ", length " << inHdr.length);
     kernel->stats->numPacketsRecvd++;
@@ -85,6 +129,97 @@ NetworkInput::CallBack()
     callWhenAvail->CallBack();
 }
 
+//-----------------------------------------------------------------------
+// NetworkInput::ReadSocket
+// 	Read in the packets waiting on the socket, as many at once as
+//	will fit in "batch" (see ReadFromSocketBatch), and put them in
+//	the order they are to arrive.  If "wait", wait for at least one.
+//
+//	A packet is due as soon as it is read, unless we are in lock
+//	step; then it is due NetworkTime after it was sent, and a tick
+//	more, since the sender may send it the very tick it told us its
+//	clock.  A packet with no data is only the sender's clock.
+//-----------------------------------------------------------------------
+
+void
+NetworkInput::ReadSocket(bool wait)
+{
+    int n = 0;
+
+    if (wait) {
+	ReadFromSocket(sock, (char *) &batch[0], sizeof(SocketPacket));
+	n = 1;
+    }
+    n += ReadFromSocketBatch(sock, (char *) &batch[n], sizeof(SocketPacket),
+			     NetworkQueueSize - n);
+
+    for (int i = 0; i < n; i++) {
+	PacketHeader *hdr = (PacketHeader *) batch[i].wire;
+	SocketPacket *packet;
+
+	ASSERT((hdr->to == kernel->hostName) && (hdr->length <= MaxPacketSize));
+	if (hdr->length == 0) {
+	    ASSERT(clocks != NULL && hdr->from >= 0 &&
+		   hdr->from < kernel->clusterSize);
+	    clocks[hdr->from] = max(clocks[hdr->from], batch[i].when);
+	    continue;
+	}
+	packet = new SocketPacket;
+	*packet = batch[i];
+	if (clocks != NULL)
+	    packet->when += NetworkTime + 1;
+	else
+	    packet->when = kernel->stats->totalTicks;
+	arriving->Insert(packet);
+    }
+}
+
+//-----------------------------------------------------------------------
+// NetworkInput::Announce
+// 	Tell the other machines in lock step that our clock is at "time":
+//	nothing we send from now on is stamped earlier.  Machines that
+//	have halted aren't told.
+//-----------------------------------------------------------------------
+
+void
+NetworkInput::Announce(int time)
+{
+    SocketPacket packet;
+    PacketHeader *hdr = (PacketHeader *) packet.wire;
+    char toName[32];
+
+    packet.when = time;
+    hdr->from = kernel->hostName;
+    hdr->length = 0;
+    for (int i = 0; i < kernel->clusterSize; i++) {
+	if (i == kernel->hostName || clocks[i] == NeverTime)
+	    continue;
+	hdr->to = i;
+	sprintf(toName, "SOCKET_%d", i);
+	SendToSocket(sock, (char *) &packet, sizeof(SocketPacket), toName);
+    }
+}
+
+//-----------------------------------------------------------------------
+// NetworkInput::Horizon
+// 	Return how far our clock can go with every packet due by then
+//	already read in: anything the others have yet to send is due
+//	more than NetworkTime after the slowest of their clocks.
+//-----------------------------------------------------------------------
+
+int
+NetworkInput::Horizon()
+{
+    int slowest = NeverTime;
+
+    for (int i = 0; i < kernel->clusterSize; i++)
+	if (i != kernel->hostName)
+	    slowest = min(slowest, clocks[i]);
+    if (slowest == NeverTime)
+	return NeverTime;
+    return slowest + NetworkTime;
+}
+
 //-----------------------------------------------------------------------
 // NetworkInput::Receive
 // 	Read a packet, if one is buffered
@@ -148,8 +283,8 @@ NetworkOutput::CallBack()
 //-----------------------------------------------------------------------
 // NetworkOutput::Send
 // 	Send a packet into the simulated network, to the destination in hdr.
-// 	Concatenate hdr and data, and schedule an interrupt to tell the user 
-// 	when the next packet can be sent 
+// 	Concatenate hdr and data, stamped with the time, and schedule an
+// 	interrupt to tell the user when the next packet can be sent 
 //
 // 	Note we always pad out a packet to MaxWireSize before putting it into
 // 	the socket, because it's simpler at the receive end.
@@ -174,9 +309,8 @@ NetworkOutput::Send(PacketHeader hdr, char* data)
     }
 
     // concatenate hdr and data into a single buffer, and send it out
-    char *buffer = new char[MaxWireSize];
-    *(PacketHeader *)buffer = hdr;
-    bcopy(data, buffer + sizeof(PacketHeader), hdr.length);
-    SendToSocket(sock, buffer, MaxWireSize, toName);
-    delete [] buffer;
+    outbox.when = kernel->stats->totalTicks;
+    *(PacketHeader *)outbox.wire = hdr;
+    bcopy(data, outbox.wire + sizeof(PacketHeader), hdr.length);
+    SendToSocket(sock, (char *) &outbox, sizeof(SocketPacket), toName);
 }
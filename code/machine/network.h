@@ -6,6 +6,16 @@
 //	You may note that the interface to the network is similar to 
 //	the console device -- both are full duplex channels.
 //
+//	Each machine is a separate UNIX process, with its own simulated
+//	clock, so when a packet arrives depends on how fast the hosts
+//	happen to run.  Given "-cl n", machines 0 to n-1 keep in lock
+//	step instead: every packet is stamped with the simulated time it
+//	was sent, and arrives NetworkTime later, and each machine tells
+//	the others how far its clock has got at every poll.  A machine
+//	goes no further than NetworkTime past the slowest of the others,
+//	so by the time a packet is due, it has been read off the socket,
+//	and every run sees the same packets arrive at the same times.
+//
 //  DO NOT CHANGE -- part of the machine emulation
 //
 // Copyright (c) 1992-1996 The Regents of the University of California.
@@ -18,6 +28,7 @@
 #include "copyright.h"
 #include "utility.h"
 #include "callback.h"
+#include "list.h"
 
 // Network address -- uniquely identifies a machine.  This machine's ID 
 //  is given on the command line.
@@ -41,6 +52,21 @@ class PacketHeader {
 #define MaxWireSize 	64	// largest packet that can go out on the wire
 #define MaxPacketSize 	(MaxWireSize - sizeof(struct PacketHeader))	
 				// data "payload" of the largest packet
+#define NetworkQueueSize 16	// packets read off the socket at once
+#define NeverTime	0x7fffffff
+				// the clock of a machine that has halted
+
+// The following class defines a packet as it goes through the UNIX
+// socket: the packet on the wire, stamped with when it was sent.  A
+// packet with no data (length 0) is only the sender's clock (see
+// NetworkInput::Announce).
+
+class SocketPacket {
+  public:
+    int when;			// totalTicks when sent; once read in,
+    				// when it is to arrive
+    char wire[MaxWireSize];	// PacketHeader, then data
+};
 
 
 // The following two classes defines a physical network device.  The network
@@ -78,6 +104,21 @@ class NetworkInput : public CallBackObj{
 				//   network
     PacketHeader inHdr;		// Information about arrived packet
     char inbox[MaxPacketSize];  // Data for arrived packet
+
+    SocketPacket batch[NetworkQueueSize];
+    				// packets as read off the socket
+    SortedList<SocketPacket *> *arriving;
+    				// packets read off the socket, that
+				// haven't arrived yet, in the order
+				// they are to arrive
+    int *clocks;		// in lock step, how far each machine's
+    				// clock has got, as far as we've heard
+
+    void ReadSocket(bool wait);	// Read in the packets waiting on the
+    				// socket; if "wait", at least one
+    void Announce(int time);	// Tell the others our clock is "time"
+    int Horizon();		// How far our clock can go, before the
+    				// others may send something due earlier
 };
 
 class NetworkOutput : public CallBackObj {
@@ -105,6 +146,7 @@ class NetworkOutput : public CallBackObj {
     CallBackObj *callWhenDone;  // Interrupt handler, signalling next packet 
 				//      can be sent.  
     bool sendBusy;		// Packet is being sent.
+    SocketPacket outbox;	// the packet, as it goes in the socket
 };
 
 #endif // NETWORK_H
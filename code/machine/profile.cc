@@ -0,0 +1,139 @@
+// profile.cc
+//	Routines for profiling user programs.  See profile.h.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "debug.h"
+#include "profile.h"
+#include "mipssim.h"
+
+//----------------------------------------------------------------------
+// Profiler::Profiler
+// 	Start with nothing counted.
+//
+//	"samplePeriod" -- user instructions between PC samples
+//----------------------------------------------------------------------
+
+Profiler::Profiler(int samplePeriod)
+{
+    ASSERT(samplePeriod > 0);
+    period = untilSample = samplePeriod;
+    lastPC = -4;
+    numSamples = 0;
+    for (int i = 0; i < ProfileOpcodes; i++)
+	opCounts[i] = 0;
+    blockCounts = new int[ProfileWords + 1];	// the last is
+    pcSamples = new int[ProfileWords + 1];	// for any higher PC
+    for (int i = 0; i <= ProfileWords; i++)
+	blockCounts[i] = pcSamples[i] = 0;
+}
+
+Profiler::~Profiler()
+{
+    delete [] blockCounts;
+    delete [] pcSamples;
+}
+
+//----------------------------------------------------------------------
+// Profiler::Ran
+// 	Note that "n" user instructions have run since the last call.
+//	The machine never runs past a sample (see UntilSample), so if
+//	one is due, "pc" is where the program was when it fell due.
+//----------------------------------------------------------------------
+
+void
+Profiler::Ran(int n, int pc)
+{
+    untilSample -= n;
+    if (untilSample <= 0) {
+	pcSamples[Slot(pc)]++;
+	numSamples++;
+	untilSample = period;
+    }
+}
+
+//----------------------------------------------------------------------
+// Profiler::PrintTop
+// 	Print the ProfileTop PCs with the highest "counts", highest
+//	first, each with its share of "total".
+//----------------------------------------------------------------------
+
+void
+Profiler::PrintTop(char *title, int *counts, int total)
+{
+    int last = -1;		// index of the last one printed,
+    int lastCount = 0;		// and its count
+    char buf[80];
+
+    cout << title << ":\n";
+    for (int n = 0; n < ProfileTop; n++) {
+	int best = -1;
+
+	// the highest count after the last one printed, ties in order
+	for (int i = 0; i <= ProfileWords; i++) {
+	    if (counts[i] == 0 || (last >= 0 && (counts[i] > lastCount
+		    || (counts[i] == lastCount && i <= last))))
+		continue;
+	    if (best < 0 || counts[i] > counts[best])
+		best = i;
+	}
+	if (best < 0)
+	    break;
+	if (best == ProfileWords)
+	    sprintf(buf, "  >= 0x%08x", ProfileWords * 4);
+	else
+	    sprintf(buf, "  0x%08x", best * 4);
+	cout << buf << " " << counts[best];
+	cout << " (" << (100.0 * counts[best] / total) << "%)\n";
+	last = best;
+	lastCount = counts[best];
+    }
+}
+
+//----------------------------------------------------------------------
+// Profiler::Print
+// 	Print the profile: the instruction mix, most frequent first,
+//	and the PCs sampled and blocks entered most often.
+//----------------------------------------------------------------------
+
+void
+Profiler::Print()
+{
+    int total = 0, numBlocks = 0;
+    bool printed[ProfileOpcodes];
+
+    for (int i = 0; i < ProfileOpcodes; i++) {
+	total += opCounts[i];
+	printed[i] = FALSE;
+    }
+    for (int i = 0; i <= ProfileWords; i++)
+	numBlocks += blockCounts[i];
+    cout << "Profile: " << total << " instructions, " << numBlocks;
+    cout << " block entries, " << numSamples << " samples every ";
+    cout << period << " instructions\n";
+    if (total == 0)
+	return;
+
+    cout << "Instruction mix:\n";
+    for (;;) {
+	int best = -1;
+	char name[20];
+
+	for (int i = 0; i < ProfileOpcodes; i++)
+	    if (!printed[i] && opCounts[i] > 0
+		    && (best < 0 || opCounts[i] > opCounts[best]))
+		best = i;
+	if (best < 0)
+	    break;
+	printed[best] = TRUE;
+	sscanf(opStrings[best].format, "%19s", name);	// just the mnemonic
+	cout << "  " << name << " " << opCounts[best];
+	cout << " (" << (100.0 * opCounts[best] / total) << "%)\n";
+    }
+    if (numSamples > 0)
+	PrintTop("Hot PCs (samples)", pcSamples, numSamples);
+    PrintTop("Hot blocks (entries)", blockCounts, numBlocks);
+}
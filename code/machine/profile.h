@@ -0,0 +1,70 @@
+// profile.h
+//	Data structures for profiling user programs: what instructions
+//	they run, and where they spend their time.
+//
+//	The profiler counts every instruction run by its opcode, and
+//	every entry to a basic block (an instruction reached other than
+//	by falling through from the one before) by its PC.  Every
+//	"period" user instructions, it also samples the PC.  Counting
+//	is cheap enough to leave on for a whole workload, unlike the
+//	'm' debug flag's trace of every instruction.
+//
+//	PCs are virtual addresses, so they can be looked up in the
+//	symbol table of the program's .coff file (user programs are
+//	linked at 0, and coff2noff keeps the addresses).  Every program
+//	run is counted together.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "copyright.h"
+#include "machine.h"
+
+#define ProfileOpcodes	64		// MaxOpcode + 1, see mipssim.h
+#define ProfileWords	(MemorySize / 4)	// PCs counted separately;
+						// any higher are lumped
+#define ProfileTop	20		// PCs and blocks printed
+
+// The following class defines the profile of the user programs run.
+
+class Profiler {
+  public:
+    Profiler(int samplePeriod);		// Sample every "samplePeriod"
+    					// user instructions
+    ~Profiler();
+
+    void Count(int pc, int opCode) {	// The instruction at "pc" is
+	if (pc != lastPC + 4)		// about to run
+	    blockCounts[Slot(pc)]++;
+	lastPC = pc;
+	opCounts[opCode]++;
+    }
+    int UntilSample() { return untilSample; }
+    					// Instructions before the next sample
+    void Ran(int n, int pc);		// "n" instructions have run, and
+    					// the next is at "pc"
+
+    void Print();			// Print the report
+
+  private:
+    int period;				// instructions between samples
+    int untilSample;			// instructions to the next one
+    int lastPC;				// of the last instruction counted
+    int numSamples;			// taken so far
+    int opCounts[ProfileOpcodes];	// instructions run, by opcode
+    int *blockCounts;			// block entries, by PC / 4
+    int *pcSamples;			// samples, by PC / 4
+
+    int Slot(int pc) {			// where "pc" is counted
+	unsigned int word = (unsigned) pc / 4;
+	return (word < ProfileWords) ? word : ProfileWords;
+    }
+    void PrintTop(char *title, int *counts, int total);
+    					// Print the highest "counts"
+};
+
+#endif // PROFILE_H
@@ -10,6 +10,7 @@
 #include "copyright.h"
 #include "debug.h"
 #include "stats.h"
+#include "memtrack.h"
 
 //----------------------------------------------------------------------
 // Statistics::Statistics
@@ -22,6 +23,282 @@ Statistics::Statistics()
     numDiskReads = numDiskWrites = 0;
     numConsoleCharsRead = numConsoleCharsWritten = 0;
     numPageFaults = numPacketsSent = numPacketsRecvd = 0;
+    numTLBHits = numTLBMisses = numTLBEvictions = 0;
+    numPageEvictions = numSwapWrites = numSwapReads = numPagesCleaned = 0;
+    numCopyOnWrites = numZeroFills = numFaultAround = 0;
+    tlbEntries = tlbWays = 0;
+    numCacheHits = numCacheMisses = numCacheEvictions = 0;
+    numCachePrefetches = numSeekTracks = 0;
+    numDiskCombined = 0;
+    numDiscards = numDiscardedSectors = 0;
+    numTrimmedWrites = numDeltaDropped = 0;
+    diskPolicy = "none";
+    diskModel = "hdd";
+    diskSeekTicks = diskRotationTicks = diskTransferTicks = 0;
+    for (int i = 0; i < LatencyBuckets; i++)
+	diskReadLatency[i] = diskWriteLatency[i] = 0;
+    diskLockTicks = 0;
+    diskQueueSum = diskQueueSamples = diskQueueMax = 0;
+    numIdleJumps = 0;
+    numCPUs = 1;
+    for (int i = 0; i < MaxCPUs; i++)
+	cpuTicks[i] = 0;
+    numSteals = 0;
+    numLockUncontended = numLockContended = 0;
+    numSwitches = numVoluntarySwitches = 0;
+    for (int i = 0; i < SwitchRateBuckets; i++)
+	switchRate[i] = 0;
+    switchWindow = windowSwitches = 0;
+    maxReadyWait = 0;
+    sampleInterval = 0;
+    nextSample = NoSample;
+    timeline = NULL;
+    numSamples = 0;
+    numThreadTimes = numOtherThreads = 0;
+}
+
+// The names of the system call codes, as in userprog/syscall.h.
+
+static char *syscallNames[MaxSyscalls] = {
+    "Halt", "Exit", "Exec", "Join", "Create", "Remove", "Open", "Read",
+    "Write", "Seek", "Close", "ThreadFork", "ThreadYield", "ExecV",
+    "ThreadExit", "ThreadJoin", "ThreadStats", "Fork", "Mmap", "Munmap",
+    "PRead", "PWrite", "ReadV", "WriteV", "Submit", "FutexWait",
+    "FutexWake", "Sleep", "OpenAppend", "GetStats"
+};
+
+//----------------------------------------------------------------------
+// SyscallTimes::SyscallTimes
+// 	No calls yet.
+//----------------------------------------------------------------------
+
+SyscallTimes::SyscallTimes()
+{
+    for (int i = 0; i < MaxSyscalls; i++)
+	count[i] = ticks[i] = minTicks[i] = maxTicks[i] = 0;
+}
+
+//----------------------------------------------------------------------
+// SyscallTimes::Record
+// 	Count a system call of "code" that took "t" ticks.
+//----------------------------------------------------------------------
+
+void
+SyscallTimes::Record(int code, int t)
+{
+    if (code < 0 || code >= MaxSyscalls)
+	code = MaxSyscalls - 1;
+    if (count[code] == 0 || t < minTicks[code])
+	minTicks[code] = t;
+    if (t > maxTicks[code])
+	maxTicks[code] = t;
+    count[code]++;
+    ticks[code] += t;
+}
+
+//----------------------------------------------------------------------
+// SyscallTimes::Add
+// 	Add the calls counted in "other" to these.
+//----------------------------------------------------------------------
+
+void
+SyscallTimes::Add(SyscallTimes *other)
+{
+    for (int i = 0; i < MaxSyscalls; i++) {
+	if (other->count[i] == 0)
+	    continue;
+	if (count[i] == 0 || other->minTicks[i] < minTicks[i])
+	    minTicks[i] = other->minTicks[i];
+	if (other->maxTicks[i] > maxTicks[i])
+	    maxTicks[i] = other->maxTicks[i];
+	count[i] += other->count[i];
+	ticks[i] += other->ticks[i];
+    }
+}
+
+//----------------------------------------------------------------------
+// SyscallTimes::Total
+// 	Return how many calls were made, setting "*allTicks" to the
+//	time they took.
+//----------------------------------------------------------------------
+
+int
+SyscallTimes::Total(int *allTicks)
+{
+    int calls = 0;
+
+    *allTicks = 0;
+    for (int i = 0; i < MaxSyscalls; i++) {
+	calls += count[i];
+	*allTicks += ticks[i];
+    }
+    return calls;
+}
+
+//----------------------------------------------------------------------
+// SyscallTimes::Print
+// 	Print a line for each code called: how often, and how long the
+//	calls took, in all and at least and at most.
+//----------------------------------------------------------------------
+
+void
+SyscallTimes::Print(char *indent)
+{
+    for (int i = 0; i < MaxSyscalls; i++) {
+	if (count[i] == 0)
+	    continue;
+	cout << indent;
+	if (i == MaxSyscalls - 1)
+	    cout << "codes " << i << "+";
+	else if (syscallNames[i] != NULL)
+	    cout << syscallNames[i];
+	else
+	    cout << "code " << i;
+	cout << ": " << count[i] << " calls, " << ticks[i] << " ticks";
+		cout << " (min " << minTicks[i] << ", max " << maxTicks[i];
+		cout << ")\n";
+    }
+}
+
+//----------------------------------------------------------------------
+// ThreadTimes::Add
+// 	Add the times and switches of "other" to these.
+//----------------------------------------------------------------------
+
+void
+ThreadTimes::Add(ThreadTimes *other)
+{
+    syscalls.Add(&other->syscalls);
+    runTicks += other->runTicks;
+    readyTicks += other->readyTicks;
+    blockedTicks += other->blockedTicks;
+    userTicks += other->userTicks;
+    systemTicks += other->systemTicks;
+    diskWaitTicks += other->diskWaitTicks;
+    consoleWaitTicks += other->consoleWaitTicks;
+    numVoluntary += other->numVoluntary;
+    numInvoluntary += other->numInvoluntary;
+}
+
+//----------------------------------------------------------------------
+// RateBucket
+// 	Return the switch rate histogram bucket of a window with "n"
+//	switches.
+//----------------------------------------------------------------------
+
+static int
+RateBucket(int n)
+{
+    int bucket = 0;
+
+    while (n > 1 && bucket < SwitchRateBuckets - 1) {
+	n >>= 1;
+	bucket++;
+    }
+    return bucket;
+}
+
+//----------------------------------------------------------------------
+// Statistics::RecordSwitch
+// 	Count a context switch, "voluntary" if the thread switched away
+//	from blocked or finished.  The windows that ended since the
+//	last switch go into the switch rate histogram first -- the one
+//	the last switch was in, and any after it with no switches.
+//----------------------------------------------------------------------
+
+void
+Statistics::RecordSwitch(bool voluntary)
+{
+    int window = totalTicks / SwitchRateWindow;
+
+    if (window > switchWindow) {
+	switchRate[RateBucket(windowSwitches)]++;
+	switchRate[0] += window - switchWindow - 1;
+	switchWindow = window;
+	windowSwitches = 0;
+    }
+    windowSwitches++;
+    numSwitches++;
+    if (voluntary)
+	numVoluntarySwitches++;
+}
+
+//----------------------------------------------------------------------
+// Statistics::RecordThread
+// 	Keep the times of thread "name", which is finishing, for Print.
+//	Only the first MaxThreadTimes threads are kept separately.
+//----------------------------------------------------------------------
+
+void
+Statistics::RecordThread(char *name, ThreadTimes *times)
+{
+    if (numThreadTimes < MaxThreadTimes) {
+	ThreadTimes *t = &threadTimes[numThreadTimes++];
+
+	*t = *times;
+	strncpy(t->name, name, ThreadNameLen - 1);
+	t->name[ThreadNameLen - 1] = '\0';
+    } else {
+	otherThreads.Add(times);
+	numOtherThreads++;
+    }
+}
+
+//----------------------------------------------------------------------
+// PrintThreadTimes
+// 	Print one line of the per-thread accounting.
+//----------------------------------------------------------------------
+
+static void
+PrintThreadTimes(char *name, ThreadTimes *t)
+{
+    cout << "  " << name << ": run " << t->runTicks;
+		cout << " (user " << t->userTicks;
+		cout << ", system " << t->systemTicks << ")";
+		cout << ", ready " << t->readyTicks;
+		cout << ", blocked " << t->blockedTicks;
+		cout << " (disk " << t->diskWaitTicks;
+		cout << ", console " << t->consoleWaitTicks << ")";
+		cout << ", switches " << t->numVoluntary << " voluntary, ";
+		cout << t->numInvoluntary << " involuntary\n";
+    t->syscalls.Print("    ");
+}
+
+//----------------------------------------------------------------------
+// Statistics::RecordDiskLatency
+// 	Count a disk request that took "ticks" from being submitted to
+//	finishing, in the read or write histogram.
+//----------------------------------------------------------------------
+
+void
+Statistics::RecordDiskLatency(bool writing, int ticks)
+{
+    int bucket = 0;
+
+    while (ticks > 1 && bucket < LatencyBuckets - 1) {
+	ticks >>= 1;
+	bucket++;
+    }
+    if (writing)
+	diskWriteLatency[bucket]++;
+    else
+	diskReadLatency[bucket]++;
+}
+
+//----------------------------------------------------------------------
+// PrintHistogram
+// 	Print the non-empty buckets of a disk latency histogram.
+//----------------------------------------------------------------------
+
+static void
+PrintHistogram(char *name, int *histogram)
+{
+    cout << "Disk " << name << " latency:";
+    for (int i = 0; i < LatencyBuckets; i++) {
+	if (histogram[i] > 0)
+	    cout << " " << (i == 0 ? 0 : 1 << i) << "+:" << histogram[i];
+    }
+    cout << "\n";
 }
 
 //----------------------------------------------------------------------
@@ -35,11 +312,357 @@ Statistics::Print()
 {
     cout << "Ticks: total " << totalTicks << ", idle " << idleTicks;
 		cout << ", system " << systemTicks << ", user " << userTicks <<"\n";
+    cout << "Idle: " << numIdleJumps << " jumps to the next interrupt\n";
+    cout << "Locks: acquires uncontended " << numLockUncontended;
+		cout << ", contended " << numLockContended << "\n";
+    cout << "Switches: " << numSwitches << " (voluntary ";
+		cout << numVoluntarySwitches << "), per ";
+		cout << SwitchRateWindow << " ticks:";
+    for (int i = 0; i < SwitchRateBuckets; i++) {
+	int windows = switchRate[i] + (RateBucket(windowSwitches) == i);
+
+	if (windows > 0)			// the current window too
+	    cout << " " << (i == 0 ? 0 : 1 << i) << "+:" << windows;
+    }
+    cout << "\n";
+    cout << "Ready queue: longest wait " << maxReadyWait << " ticks\n";
+    cout << "Threads:\n";
+    for (int i = 0; i < numThreadTimes; i++)
+	PrintThreadTimes(threadTimes[i].name, &threadTimes[i]);
+    if (numOtherThreads > 0) {
+	char others[ThreadNameLen + 16];
+
+	sprintf(others, "%d others", numOtherThreads);
+	PrintThreadTimes(others, &otherThreads);
+    }
+    cout << "Syscalls:\n";
+    syscalls.Print("  ");
+    if (numCPUs > 1) {
+	cout << "CPUs: " << numCPUs << ", steals " << numSteals;
+		cout << ", busy";
+	for (int i = 0; i < numCPUs; i++)
+	    cout << " " << cpuTicks[i];
+	cout << "\n";
+    }
     cout << "Disk I/O: reads " << numDiskReads;
-		cout << ", writes " << numDiskWrites << "\n";
+		cout << ", writes " << numDiskWrites;
+		cout << ", combined " << numDiskCombined << "\n";
+    cout << "Disk discards: " << numDiscards << " (" << numDiscardedSectors;
+		cout << " sectors), trimmed writes " << numTrimmedWrites;
+		cout << ", delta sectors dropped " << numDeltaDropped << "\n";
+    cout << "Disk cache: hits " << numCacheHits;
+		cout << ", misses " << numCacheMisses;
+		cout << ", evictions " << numCacheEvictions;
+		cout << ", prefetches " << numCachePrefetches << "\n";
+    cout << "Disk seeks: " << numSeekTracks << " tracks (";
+		cout << diskPolicy << ", " << diskModel << ")\n";
+    cout << "Disk time: seek " << diskSeekTicks;
+		cout << ", rotation " << diskRotationTicks;
+		cout << ", transfer " << diskTransferTicks;
+		cout << ", lock wait " << diskLockTicks << "\n";
+    PrintHistogram("read", diskReadLatency);
+    PrintHistogram("write", diskWriteLatency);
+    cout << "Disk queue: average ";
+		cout << (diskQueueSamples > 0 ?
+			(double) diskQueueSum / diskQueueSamples : 0.0);
+		cout << ", max " << diskQueueMax << "\n";
 		cout << "Console I/O: reads " << numConsoleCharsRead;
     cout << ", writes " << numConsoleCharsWritten << "\n";
-    cout << "Paging: faults " << numPageFaults << "\n";
+    cout << "Paging: faults " << numPageFaults;
+		cout << ", evictions " << numPageEvictions;
+		cout << ", swap writes " << numSwapWrites;
+		cout << ", swap reads " << numSwapReads;
+		cout << ", cleaned " << numPagesCleaned;
+		cout << ", copy-on-write " << numCopyOnWrites;
+		cout << ", zero-fill " << numZeroFills;
+		cout << ", fault-around " << numFaultAround << "\n";
+    if (tlbEntries > 0) {
+	cout << "TLB: " << tlbEntries << " entries, " << tlbWays;
+		cout << "-way, hits " << numTLBHits;
+		cout << ", misses " << numTLBMisses;
+		cout << ", evictions " << numTLBEvictions << "\n";
+    }
     cout << "Network I/O: packets received " << numPacketsRecvd;
 		cout << ", sent " << numPacketsSent << "\n";
+    cout << "Host memory (bytes/peak, objects/peak):\n";
+    for (int i = 0; i < NumMemTags; i++) {
+	MemoryUse *u = MemoryUsage((MemTag) i);
+
+	if (u->peakObjects == 0)
+	    continue;
+	cout << "  " << MemTagName((MemTag) i) << ": " << u->bytes;
+		cout << "/" << u->peakBytes << ", " << u->objects;
+		cout << "/" << u->peakObjects << "\n";
+    }
+}
+
+//----------------------------------------------------------------------
+// AppendHistogram
+// 	Append a disk latency histogram to "buf" as a JSON array, one
+//	count per bucket.
+//----------------------------------------------------------------------
+
+static void
+AppendHistogram(char *buf, char *name, int *histogram)
+{
+    sprintf(buf + strlen(buf), "  \"%s\": [", name);
+    for (int i = 0; i < LatencyBuckets; i++)
+	sprintf(buf + strlen(buf), "%s%d", i == 0 ? "" : ", ", histogram[i]);
+    strcat(buf, "],\n");
+}
+
+//----------------------------------------------------------------------
+// Statistics::StartTimeline
+// 	Sample the counters every "interval" ticks, so the JSON file
+//	shows how the run went over time, and not only its totals.
+//----------------------------------------------------------------------
+
+void
+Statistics::StartTimeline(int interval)
+{
+    ASSERT(interval > 0);
+    sampleInterval = interval;
+    timeline = new StatsSample[MaxSamples];
+    numSamples = 0;
+    nextSample = (totalTicks / interval + 1) * interval;
+}
+
+//----------------------------------------------------------------------
+// Statistics::Sample
+// 	Note the counters now, at the end of an interval.  The clock is
+//	checked against nextSample as it advances (see Interrupt::OneTick
+//	and CheckIfDue), so this costs nothing between samples; a jump
+//	of the clock over several intervals, when the machine is idle,
+//	gives one sample.  When the timeline is full, every other sample
+//	is dropped, and the interval doubled, so a long run still fits.
+//----------------------------------------------------------------------
+
+void
+Statistics::Sample()
+{
+    if (timeline == NULL)
+	return;
+    if (numSamples == MaxSamples) {
+	for (int i = 0; i < MaxSamples / 2; i++)
+	    timeline[i] = timeline[2 * i + 1];
+	numSamples = MaxSamples / 2;
+	sampleInterval *= 2;
+    }
+    Snapshot(&timeline[numSamples++]);
+    nextSample = (totalTicks / sampleInterval + 1) * sampleInterval;
+}
+
+//----------------------------------------------------------------------
+// Statistics::Snapshot
+// 	Copy the counters a StatsSample holds into "s".
+//----------------------------------------------------------------------
+
+void
+Statistics::Snapshot(StatsSample *s)
+{
+    int callTicks;
+
+    s->tick = totalTicks;
+    s->userTicks = userTicks;
+    s->systemTicks = systemTicks;
+    s->idleTicks = idleTicks;
+    s->diskReads = numDiskReads;
+    s->diskWrites = numDiskWrites;
+    s->cacheHits = numCacheHits;
+    s->cacheMisses = numCacheMisses;
+    s->consoleReads = numConsoleCharsRead;
+    s->consoleWrites = numConsoleCharsWritten;
+    s->pageFaults = numPageFaults;
+    s->packetsSent = numPacketsSent;
+    s->packetsRecvd = numPacketsRecvd;
+    s->switches = numSwitches;
+    s->syscalls = syscalls.Total(&callTicks);
+}
+
+//----------------------------------------------------------------------
+// Statistics::Add
+// 	Add the counters of another run, in "s", to ours, as when the
+//	host jobs of a batch (-hj) are added up.  The system calls are
+//	only in "s" as a total, not by code, so they are left out.
+//----------------------------------------------------------------------
+
+void
+Statistics::Add(StatsSample *s)
+{
+    totalTicks += s->tick;
+    userTicks += s->userTicks;
+    systemTicks += s->systemTicks;
+    idleTicks += s->idleTicks;
+    numDiskReads += s->diskReads;
+    numDiskWrites += s->diskWrites;
+    numCacheHits += s->cacheHits;
+    numCacheMisses += s->cacheMisses;
+    numConsoleCharsRead += s->consoleReads;
+    numConsoleCharsWritten += s->consoleWrites;
+    numPageFaults += s->pageFaults;
+    numPacketsSent += s->packetsSent;
+    numPacketsRecvd += s->packetsRecvd;
+    numSwitches += s->switches;
+}
+
+//----------------------------------------------------------------------
+// WriteTimeline
+// 	Write the samples taken to "fd", as the "timeline" member of the
+//	JSON object: for each interval, when it ended, and how much each
+//	counter changed during it.
+//----------------------------------------------------------------------
+
+static void
+WriteTimeline(int fd, StatsSample *timeline, int numSamples, int interval)
+{
+    StatsSample zero;
+    char buf[512];
+
+    bzero((char *) &zero, sizeof(zero));
+    sprintf(buf, ",\n  \"sampleInterval\": %d,\n  \"timeline\": [", interval);
+    WriteFile(fd, buf, strlen(buf));
+    for (int i = 0; i < numSamples; i++) {
+	StatsSample *s = &timeline[i];
+	StatsSample *p = (i == 0) ? &zero : &timeline[i - 1];
+
+	sprintf(buf, "%s\n    {\"tick\": %d, \"user\": %d, \"system\": %d, "
+		"\"idle\": %d, \"diskReads\": %d, \"diskWrites\": %d, "
+		"\"cacheHits\": %d, \"cacheMisses\": %d, "
+		"\"consoleReads\": %d, \"consoleWrites\": %d, "
+		"\"pageFaults\": %d, \"packetsSent\": %d, "
+		"\"packetsReceived\": %d, \"switches\": %d, \"syscalls\": %d}",
+		i == 0 ? "" : ",", s->tick, s->userTicks - p->userTicks,
+		s->systemTicks - p->systemTicks, s->idleTicks - p->idleTicks,
+		s->diskReads - p->diskReads, s->diskWrites - p->diskWrites,
+		s->cacheHits - p->cacheHits, s->cacheMisses - p->cacheMisses,
+		s->consoleReads - p->consoleReads,
+		s->consoleWrites - p->consoleWrites,
+		s->pageFaults - p->pageFaults, s->packetsSent - p->packetsSent,
+		s->packetsRecvd - p->packetsRecvd, s->switches - p->switches,
+		s->syscalls - p->syscalls);
+	WriteFile(fd, buf, strlen(buf));
+    }
+    WriteFile(fd, "]", 1);
+}
+
+//----------------------------------------------------------------------
+// Statistics::WriteJSON
+// 	Write the performance metrics to "fileName" as one JSON object,
+//	for scripts comparing runs, with the host memory used by each
+//	subsystem (see memtrack.h), and the timeline, if one was kept,
+//	up to now.
+//----------------------------------------------------------------------
+
+void
+Statistics::WriteJSON(char *fileName)
+{
+    char buf[32768];		// room for every thread and system
+    				// call code listed
+    int fd = OpenForWrite(fileName);
+
+    sprintf(buf, "{\n  \"totalTicks\": %d,\n  \"idleTicks\": %d,\n"
+	    "  \"systemTicks\": %d,\n  \"userTicks\": %d,\n"
+	    "  \"idleJumps\": %d,\n",
+	    totalTicks, idleTicks, systemTicks, userTicks, numIdleJumps);
+    sprintf(buf + strlen(buf), "  \"cpus\": %d,\n  \"steals\": %d,\n"
+	    "  \"cpuTicks\": [", numCPUs, numSteals);
+    for (int i = 0; i < numCPUs; i++)
+	sprintf(buf + strlen(buf), "%s%d", i == 0 ? "" : ", ", cpuTicks[i]);
+    strcat(buf, "],\n");
+    sprintf(buf + strlen(buf), "  \"locksUncontended\": %d,\n"
+	    "  \"locksContended\": %d,\n",
+	    numLockUncontended, numLockContended);
+    sprintf(buf + strlen(buf), "  \"switches\": %d,\n"
+	    "  \"voluntarySwitches\": %d,\n  \"maxReadyWait\": %d,\n"
+	    "  \"switchRateWindow\": %d,\n  \"switchRate\": [",
+	    numSwitches, numVoluntarySwitches, maxReadyWait,
+	    SwitchRateWindow);
+    for (int i = 0; i < SwitchRateBuckets; i++)
+	sprintf(buf + strlen(buf), "%s%d", i == 0 ? "" : ", ",
+		switchRate[i] + (RateBucket(windowSwitches) == i));
+    strcat(buf, "],\n  \"threads\": [");
+    for (int i = 0; i < numThreadTimes; i++) {
+	ThreadTimes *t = &threadTimes[i];
+	int calls, callTicks;
+
+	calls = t->syscalls.Total(&callTicks);
+	sprintf(buf + strlen(buf), "%s\n    {\"name\": \"%s\", \"run\": %d, "
+		"\"user\": %d, \"system\": %d, \"ready\": %d, "
+		"\"blocked\": %d, \"diskWait\": %d, \"consoleWait\": %d, "
+		"\"voluntary\": %d, \"involuntary\": %d, \"syscalls\": %d, "
+		"\"syscallTicks\": %d}", i == 0 ? "" : ",", t->name,
+		t->runTicks, t->userTicks, t->systemTicks, t->readyTicks,
+		t->blockedTicks, t->diskWaitTicks, t->consoleWaitTicks,
+		t->numVoluntary, t->numInvoluntary, calls, callTicks);
+    }
+    strcat(buf, "],\n  \"syscalls\": [");
+    for (int i = 0, n = 0; i < MaxSyscalls; i++) {
+	if (syscalls.count[i] == 0)
+	    continue;
+	sprintf(buf + strlen(buf), "%s\n    {\"code\": %d, \"count\": %d, "
+		"\"ticks\": %d, \"min\": %d, \"max\": %d}",
+		n++ == 0 ? "" : ",", i, syscalls.count[i], syscalls.ticks[i],
+		syscalls.minTicks[i], syscalls.maxTicks[i]);
+    }
+    strcat(buf, "],\n");
+    sprintf(buf + strlen(buf), "  \"diskReads\": %d,\n  \"diskWrites\": %d,\n"
+	    "  \"diskCombined\": %d,\n  \"diskPolicy\": \"%s\",\n"
+	    "  \"diskModel\": \"%s\",\n",
+	    numDiskReads, numDiskWrites, numDiskCombined, diskPolicy,
+	    diskModel);
+    sprintf(buf + strlen(buf), "  \"discards\": %d,\n"
+	    "  \"discardedSectors\": %d,\n  \"trimmedWrites\": %d,\n"
+	    "  \"deltaDropped\": %d,\n",
+	    numDiscards, numDiscardedSectors, numTrimmedWrites,
+	    numDeltaDropped);
+    sprintf(buf + strlen(buf), "  \"cacheHits\": %d,\n  \"cacheMisses\": %d,\n"
+	    "  \"cacheEvictions\": %d,\n  \"cachePrefetches\": %d,\n",
+	    numCacheHits, numCacheMisses, numCacheEvictions,
+	    numCachePrefetches);
+    sprintf(buf + strlen(buf), "  \"seekTracks\": %d,\n  \"seekTicks\": %d,\n"
+	    "  \"rotationTicks\": %d,\n  \"transferTicks\": %d,\n"
+	    "  \"lockTicks\": %d,\n",
+	    numSeekTracks, diskSeekTicks, diskRotationTicks,
+	    diskTransferTicks, diskLockTicks);
+    sprintf(buf + strlen(buf), "  \"latencyBuckets\": %d,\n", LatencyBuckets);
+    AppendHistogram(buf, "readLatency", diskReadLatency);
+    AppendHistogram(buf, "writeLatency", diskWriteLatency);
+    sprintf(buf + strlen(buf), "  \"queueAverage\": %.3f,\n"
+	    "  \"queueMax\": %d,\n",
+	    diskQueueSamples > 0 ? (double) diskQueueSum / diskQueueSamples
+				 : 0.0, diskQueueMax);
+    sprintf(buf + strlen(buf), "  \"consoleReads\": %d,\n"
+	    "  \"consoleWrites\": %d,\n  \"pageFaults\": %d,\n"
+	    "  \"pageEvictions\": %d,\n  \"swapWrites\": %d,\n"
+	    "  \"swapReads\": %d,\n  \"pagesCleaned\": %d,\n"
+	    "  \"copyOnWrites\": %d,\n"
+	    "  \"zeroFills\": %d,\n  \"faultAround\": %d,\n"
+	    "  \"tlbEntries\": %d,\n  \"tlbWays\": %d,\n"
+	    "  \"tlbHits\": %d,\n  \"tlbMisses\": %d,\n"
+	    "  \"tlbEvictions\": %d,\n"
+	    "  \"packetsReceived\": %d,\n  \"packetsSent\": %d",
+	    numConsoleCharsRead, numConsoleCharsWritten, numPageFaults,
+	    numPageEvictions, numSwapWrites, numSwapReads, numPagesCleaned,
+	    numCopyOnWrites,
+	    numZeroFills, numFaultAround,
+	    tlbEntries, tlbWays, numTLBHits, numTLBMisses, numTLBEvictions,
+	    numPacketsRecvd, numPacketsSent);
+    strcat(buf, ",\n  \"memory\": {");
+    for (int i = 0; i < NumMemTags; i++) {
+	MemoryUse *u = MemoryUsage((MemTag) i);
+
+	sprintf(buf + strlen(buf), "%s\n    \"%s\": {\"bytes\": %d, "
+		"\"peakBytes\": %d, \"objects\": %d, \"peakObjects\": %d}",
+		i == 0 ? "" : ",", MemTagName((MemTag) i), u->bytes,
+		u->peakBytes, u->objects, u->peakObjects);
+    }
+    strcat(buf, "}");
+    WriteFile(fd, buf, strlen(buf));
+    if (timeline != NULL) {
+	if (numSamples == 0 || timeline[numSamples - 1].tick < totalTicks)
+	    Sample();			// the last, partial, interval
+	WriteTimeline(fd, timeline, numSamples, sampleInterval);
+    }
+    WriteFile(fd, "\n}\n", 3);
+    Close(fd);
 }
@@ -13,6 +13,92 @@
 
 #include "copyright.h"
 
+#define LatencyBuckets	16	// disk latency histogram buckets: bucket
+				// i counts requests of 2^i to 2^(i+1)-1
+				// ticks (bucket 0 also counts 0 ticks)
+#define MaxCPUs		8	// simulated CPUs there can be
+#define SwitchRateWindow 1000	// context switches are counted per window
+				// of this many ticks, and
+#define SwitchRateBuckets 8	// bucket i of the histogram counts the
+				// windows with 2^i to 2^(i+1)-1 switches
+				// (bucket 0 also counts none)
+#define MaxThreadTimes	32	// threads listed by Print; the rest are
+				// summed on one line
+#define ThreadNameLen	24	// of a thread as listed
+#define MaxSyscalls	64	// system call codes counted separately;
+				// any higher are counted as the last
+#define MaxSamples	1024	// timeline samples kept; when they run
+				// out, every other one is dropped and
+				// the interval doubled
+#define NoSample	0x7fffffff	// nextSample without a timeline
+
+// The following class defines how many system calls of each code
+// (see userprog/syscall.h) were made, and how long they took, from
+// the trap to the return to user code, in simulated ticks.  That
+// includes any time the caller spent blocked, waiting for the disk
+// say, while other threads ran.
+
+class SyscallTimes {
+  public:
+    SyscallTimes();
+
+    int count[MaxSyscalls];	// calls made of each code,
+    int ticks[MaxSyscalls];	// the time they took in all,
+    int minTicks[MaxSyscalls];	// the shortest,
+    int maxTicks[MaxSyscalls];	// and the longest
+
+    void Record(int code, int ticks);	// count a call that took "ticks"
+    void Add(SyscallTimes *other);	// add in another's calls
+    int Total(int *allTicks);		// calls of every code, and
+    					// their ticks
+    void Print(char *indent);		// one line per code called
+};
+
+// The following class defines the time a thread spent in each state,
+// and the context switches away from it: voluntary ones when it
+// blocked or finished, involuntary ones when it was still runnable
+// (preempted, or yielding).  The time running is split into user and
+// system ticks as Interrupt::OneTick counted them, and the time
+// blocked on the disk or the console is picked out of the rest.
+
+class ThreadTimes {
+  public:
+    ThreadTimes() { name[0] = '\0'; runTicks = readyTicks = blockedTicks
+		    = userTicks = systemTicks = diskWaitTicks
+		    = consoleWaitTicks = numVoluntary = numInvoluntary = 0; }
+
+    char name[ThreadNameLen];	// filled in when it is recorded
+    int runTicks;		// time running,
+    int readyTicks;		// on a ready queue,
+    int blockedTicks;		// and blocked
+    int userTicks;		// of the time running, ticks of user
+    int systemTicks;		// instructions and of the kernel
+    int diskWaitTicks;		// of the time blocked, waiting for
+    int consoleWaitTicks;	// SynchDisk and for the console
+    int numVoluntary;		// switches when it blocked
+    int numInvoluntary;		// and when it didn't
+    SyscallTimes syscalls;	// system calls it made
+    
+    void Add(ThreadTimes *other);	// add in another thread's times
+};
+
+// The following class defines the counters at one point of a run,
+// for the timeline (see Statistics::Sample).  Each is the total so
+// far; the JSON file gives the change from one sample to the next.
+
+class StatsSample {
+  public:
+    int tick;			// when it was taken
+    int userTicks, systemTicks, idleTicks;
+    int diskReads, diskWrites;
+    int cacheHits, cacheMisses;
+    int consoleReads, consoleWrites;
+    int pageFaults;
+    int packetsSent, packetsRecvd;
+    int switches;
+    int syscalls;
+};
+
 // The following class defines the statistics that are to be kept
 // about Nachos behavior -- how much time (ticks) elapsed, how
 // many user instructions executed, etc.
@@ -33,12 +119,88 @@ class Statistics {
     int numConsoleCharsRead;	// number of characters read from the keyboard
     int numConsoleCharsWritten; // number of characters written to the display
     int numPageFaults;		// number of virtual memory page faults
+    int numPageEvictions;	// pages whose frame was taken for another,
+    int numSwapWrites;		// those written to the swap file,
+    int numSwapReads;		// and pages read back from it
+    int numPagesCleaned;	// dirty pages written out ahead of eviction
+    int numCopyOnWrites;	// pages copied on a write after Fork
+    int numZeroFills;		// pages zeroed on first touch
+    int numFaultAround;		// pages paged in along with a faulting one
+    int numTLBHits;		// translations found in the TLB,
+    int numTLBMisses;		// those that weren't,
+    int numTLBEvictions;	// and entries replaced to load them
+    int tlbEntries;		// TLB size, or 0 if there is none,
+    int tlbWays;		// and its associativity
     int numPacketsSent;		// number of packets sent over the network
     int numPacketsRecvd;	// number of packets received over the network
+    int numCacheHits;		// disk sector cache hits
+    int numCacheMisses;		// disk sector cache misses
+    int numCacheEvictions;	// sectors evicted from the disk cache
+    int numCachePrefetches;	// sectors read ahead into the disk cache
+    int numSeekTracks;		// tracks crossed by the disk head
+    int numDiskCombined;	// requests served by another's transfer
+    int numDiscards;		// runs of freed sectors the disk was told of,
+    int numDiscardedSectors;	// and the sectors in them
+    int numTrimmedWrites;	// ssd writes to a discarded flash page
+    int numDeltaDropped;	// overlay sectors read through to the
+    				// image again once discarded
+    char *diskPolicy;		// disk scheduling policy in use
+    const char *diskModel;	// and the device modelled
+
+    int diskSeekTicks;		// disk time spent moving the head,
+    int diskRotationTicks;	// waiting for the sector to come round,
+    int diskTransferTicks;	// and reading or writing it
+    int diskReadLatency[LatencyBuckets];	// ticks from submitting
+    int diskWriteLatency[LatencyBuckets];	// a request to its end
+    int diskLockTicks;		// time threads waited for the SynchDisk lock
+    int diskQueueSum;		// requests found queued (or at the disk)
+    int diskQueueSamples;	// by each request sent to the disk,
+    int diskQueueMax;		// and the most any one found
+    int numIdleJumps;		// times the clock skipped ahead to the
+    				// next interrupt, for idleTicks in all
+    int numCPUs;		// simulated CPUs; with more than one,
+    				// systemTicks and userTicks are summed
+				// over them all
+    int cpuTicks[MaxCPUs];	// time each CPU spent running threads
+    int numSteals;		// threads taken by an idle CPU
+    int numLockUncontended;	// Lock::Acquire of a free lock
+    int numLockContended;	// and of one that was held
+    int numSwitches;		// context switches,
+    int numVoluntarySwitches;	// those where the thread blocked
+    int switchRate[SwitchRateBuckets];	// windows, by switches in them
+    int switchWindow;		// window now being counted,
+    int windowSwitches;		// and its switches so far
+    int maxReadyWait;		// longest a thread waited on a ready
+    				// queue for the CPU
+    ThreadTimes threadTimes[MaxThreadTimes];	// threads that have
+    int numThreadTimes;		// finished, in order, and then the
+    ThreadTimes otherThreads;	// times of all the rest (numOtherThreads)
+    int numOtherThreads;
+    SyscallTimes syscalls;	// system calls made by every thread
+    int sampleInterval;		// ticks between timeline samples, or
+    				// 0 if there is no timeline
+    int nextSample;		// tick the next one is due, or NoSample
+    StatsSample *timeline;	// the samples, in order
+    int numSamples;
 
     Statistics(); 		// initialize everything to zero
 
+    void StartTimeline(int interval);
+    				// sample the counters every "interval"
+				// ticks from now on
+    void Snapshot(StatsSample *s);	// note the counters in "s"
+    void Add(StatsSample *s);	// add the counters in "s" to these
+    void Sample();		// take a sample; called when the clock
+    				// passes nextSample
+
+    void RecordDiskLatency(bool writing, int ticks);
+    				// add a request to a histogram
+    void RecordSwitch(bool voluntary);	// count a context switch
+    void RecordThread(char *name, ThreadTimes *times);
+    				// keep the times of a finished thread
     void Print();		// print collected statistics
+    void WriteJSON(char *fileName);	// write them to "fileName" as a
+					// JSON object
 };
 
 // Constants used to reflect the relative time an operation would
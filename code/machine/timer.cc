@@ -13,7 +13,7 @@
 //	Remember -- nothing in here is part of Nachos.  It is just
 //	an emulation for the hardware that Nachos is running on top of.
 //
-//  DO NOT CHANGE -- part of the machine emulation
+//  Part of the machine emulation.
 //
 // Copyright (c) 1992-1996 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
@@ -40,25 +40,80 @@ Timer::Timer(bool doRandom, CallBackObj *toCall)
     randomize = doRandom;
     callPeriodically = toCall;
     disable = FALSE;
+    pending = NULL;
+    reprogrammed = FALSE;
     SetInterrupt();
 }
 
 //----------------------------------------------------------------------
-// Timer::CallBack
+// Timer::Fire
 //      Routine called when interrupt is generated by the hardware 
-//	timer device.  Schedule the next interrupt, and invoke the
-//	interrupt handler.
+//	timer device.  Unless a later interrupt has been set since
+//	"shot" was, invoke the interrupt handler, and schedule the next
+//	interrupt, if the handler didn't with SetNext.
 //----------------------------------------------------------------------
+
 void 
-Timer::CallBack() 
+Timer::Fire(TimerShot *shot) 
 {
+    bool current = (shot == pending);
+
+    delete shot;
+    if (!current)
+	return;
+    pending = NULL;
+    reprogrammed = FALSE;
+
     // invoke the Nachos interrupt handler for this device
     callPeriodically->CallBack();
     
-    SetInterrupt();	// do last, to let software interrupt handler
+    if (!reprogrammed)
+	SetInterrupt();	// do last, to let software interrupt handler
     			// decide if it wants to disable future interrupts
 }
 
+//----------------------------------------------------------------------
+// Timer::Enable
+//      Turn the timer back on after Disable.  If its last interrupt
+//	has already happened, schedule another after the usual delay.
+//----------------------------------------------------------------------
+
+void
+Timer::Enable()
+{
+    disable = FALSE;
+    if (pending == NULL)
+	SetInterrupt();
+}
+
+//----------------------------------------------------------------------
+// Timer::SetNext
+//      Program the timer to interrupt "ticks" from now.  An interrupt
+//	set before still happens, but is ignored.  Called from the
+//	interrupt handler, this sets the next interrupt instead of the
+//	usual delay.
+//----------------------------------------------------------------------
+
+void
+Timer::SetNext(int ticks)
+{
+    ASSERT(ticks > 0);
+    reprogrammed = TRUE;
+    Schedule(ticks);
+}
+
+//----------------------------------------------------------------------
+// Timer::NextDue
+//      Return the tick the pending interrupt goes off at, or -1 if
+//	none is pending.
+//----------------------------------------------------------------------
+
+int
+Timer::NextDue()
+{
+    return (pending != NULL) ? pending->at : -1;
+}
+
 //----------------------------------------------------------------------
 // Timer::SetInterrupt
 //      Cause a timer interrupt to occur in the future, unless
@@ -76,6 +131,19 @@ Timer::SetInterrupt()
 	     delay = 1 + (RandomNumber() % (TimerTicks * 2));
         }
        // schedule the next timer device interrupt
-       kernel->interrupt->Schedule(this, delay, TimerInt);
+       Schedule(delay);
     }
 }
+
+//----------------------------------------------------------------------
+// Timer::Schedule
+//      Cause a timer interrupt "ticks" from now, which from then on
+//	is the one that counts.
+//----------------------------------------------------------------------
+
+void
+Timer::Schedule(int ticks)
+{
+    pending = new TimerShot(this, kernel->stats->totalTicks + ticks);
+    kernel->interrupt->Schedule(pending, ticks, TimerInt);
+}
@@ -11,7 +11,13 @@
 //	In order to introduce some randomness into time-slicing, if "doRandom"
 //	is set, then the interrupt comes after a random number of ticks.
 //
-//  DO NOT CHANGE -- part of the machine emulation
+//	Like a real timer, it can be turned off and on again (so an idle
+//	machine needn't be interrupted), and programmed to go off at a
+//	given time rather than the usual interval (a tickless clock).
+//	An interrupt already scheduled can't be taken back, so each one
+//	is a separate TimerShot, and only the latest one set counts.
+//
+//  Part of the machine emulation.
 //
 // Copyright (c) 1992-1996 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
@@ -24,8 +30,10 @@
 #include "utility.h"
 #include "callback.h"
 
+class TimerShot;
+
 // The following class defines a hardware timer. 
-class Timer : public CallBackObj {
+class Timer {
   public:
     Timer(bool doRandom, CallBackObj *toCall);
 				// Initialize the timer, and callback to "toCall"
@@ -35,19 +43,44 @@ class Timer : public CallBackObj {
     void Disable() { disable = TRUE; }
     				// Turn timer device off, so it doesn't
 				// generate any more interrupts.
+    void Enable();		// Turn it on again; if no interrupt is
+				// pending, the next comes after the
+				// usual delay
+    void SetNext(int ticks);	// Make the next interrupt come "ticks"
+				// from now, in place of any pending
+    int NextDue();		// Tick the pending interrupt goes off
+				// at, or -1 if none is
 
   private:
     bool randomize;		// set if we need to use a random timeout delay
     CallBackObj *callPeriodically; // call this every TimerTicks time units 
     bool disable;		// turn off the timer device after next
     				// interrupt.
+    TimerShot *pending;		// the interrupt that counts, or NULL
+    bool reprogrammed;		// SetNext called by the handler?
     
-    void CallBack();		// called internally when the hardware
+    void Fire(TimerShot *shot);	// called internally when the hardware
 				// timer generates an interrupt
 
     void SetInterrupt();  	// cause an interrupt to occur in the
     				// the future after a fixed or random
 				// delay
+    void Schedule(int ticks);	// or after "ticks"
+
+    friend class TimerShot;
+};
+
+// The following class defines one interrupt set by a timer; it is
+// ignored if another has been set since.
+
+class TimerShot : public CallBackObj {
+  public:
+    TimerShot(Timer *t, int when) { timer = t; at = when; }
+    int at;			// tick it goes off at
+
+  private:
+    Timer *timer;
+    void CallBack() { timer->Fire(this); }
 };
 
 #endif // TIMER_H
@@ -6,8 +6,9 @@
 //
 // Two types of translation are supported here.
 //
-//	Linear page table -- the virtual page # is used as an index
-//	into the table, to find the physical page #.
+//	Two-level page table -- the virtual page # picks a chunk in the
+//	directory, and an entry in that chunk's table, which has the
+//	physical page #; a chunk without a table is all invalid.
 //
 //	Translation lookaside buffer -- associative lookup in the table
 //	to find an entry with the same virtual page #.  If found,
@@ -32,6 +33,102 @@
 #include "copyright.h"
 #include "main.h"
 
+//----------------------------------------------------------------------
+// PageTable::PageTable
+// 	A page table for "pages" pages, all invalid: the directory has
+//	no second-level tables yet.
+//----------------------------------------------------------------------
+
+PageTable::PageTable(unsigned int pages)
+{
+    int chunks = divRoundUp(pages, PageTableChunk);
+
+    numPages = pages;
+    directory = new TranslationEntry *[chunks];
+    for (int i = 0; i < chunks; i++)
+	directory[i] = NULL;
+}
+
+PageTable::~PageTable()
+{
+    for (int i = 0; i < (int) divRoundUp(numPages, PageTableChunk); i++)
+	delete [] directory[i];
+    delete [] directory;
+}
+
+//----------------------------------------------------------------------
+// PageTable::InitChunk
+// 	Make the entries of "chunk", whose first page is "first", invalid
+//	from entry "from" on.
+//----------------------------------------------------------------------
+
+void
+PageTable::InitChunk(TranslationEntry *chunk, unsigned int first, int from)
+{
+    for (int i = from; i < PageTableChunk; i++) {
+	chunk[i].virtualPage = first + i;
+	chunk[i].physicalPage = -1;
+	chunk[i].valid = FALSE;
+	chunk[i].readOnly = FALSE;
+	chunk[i].use = FALSE;
+	chunk[i].dirty = FALSE;
+    }
+}
+
+//----------------------------------------------------------------------
+// PageTable::Entry
+// 	Return the entry for page "vpn", giving its chunk a table of
+//	invalid entries if it has none, so that the entry can be filled
+//	in.  Returns NULL if "vpn" is past the end.
+//----------------------------------------------------------------------
+
+TranslationEntry *
+PageTable::Entry(unsigned int vpn)
+{
+    TranslationEntry **chunk;
+
+    if (vpn >= numPages)
+	return NULL;
+    chunk = &directory[vpn / PageTableChunk];
+    if (*chunk == NULL) {
+	*chunk = new TranslationEntry[PageTableChunk];
+	InitChunk(*chunk, vpn - vpn % PageTableChunk, 0);
+    }
+    return &(*chunk)[vpn % PageTableChunk];
+}
+
+//----------------------------------------------------------------------
+// PageTable::Resize
+// 	Make the table cover "pages" pages.  The tables of chunks taken
+//	away are freed; in a chunk cut short, the entries past the end
+//	are made invalid again, so they are as new if it grows back.
+//----------------------------------------------------------------------
+
+void
+PageTable::Resize(unsigned int pages)
+{
+    int oldChunks = divRoundUp(numPages, PageTableChunk);
+    int chunks = divRoundUp(pages, PageTableChunk);
+    TranslationEntry **dir;
+
+    if (pages == numPages)
+	return;
+    dir = new TranslationEntry *[chunks];
+    for (int i = 0; i < max(chunks, oldChunks); i++) {
+	if (i >= chunks)
+	    delete [] directory[i];
+	else
+	    dir[i] = (i < oldChunks) ? directory[i] : NULL;
+    }
+    if (pages < numPages && pages % PageTableChunk != 0
+	&& dir[chunks - 1] != NULL)
+	InitChunk(dir[chunks - 1], (chunks - 1) * PageTableChunk,
+		  pages % PageTableChunk);
+    delete [] directory;
+    directory = dir;
+    numPages = pages;
+}
+
 // Routines for converting Words and Short Words to and from the
 // simulated machine's format of little endian.  These end up
 // being NOPs when the host machine is also little endian (DEC and Intel).
@@ -91,7 +188,7 @@ Machine::ReadMem(int addr, int size, int *value)
     
     DEBUG(dbgAddr, "Reading VA " << addr << ", size " << size);
     
-    exception = Translate(addr, &physicalAddress, size, FALSE);
+    exception = CachedTranslate(addr, &physicalAddress, size, ReadAccess);
     if (exception != NoException) {
 	RaiseException(exception, addr);
 	return FALSE;
@@ -140,7 +237,7 @@ Machine::WriteMem(int addr, int size, int value)
      
     DEBUG(dbgAddr, "Writing VA " << addr << ", size " << size << ", value " << value);
 
-    exception = Translate(addr, &physicalAddress, size, TRUE);
+    exception = CachedTranslate(addr, &physicalAddress, size, WriteAccess);
     if (exception != NoException) {
 	RaiseException(exception, addr);
 	return FALSE;
@@ -162,6 +259,7 @@ Machine::WriteMem(int addr, int size, int value)
 	
       default: ASSERT(FALSE);
     }
+    InvalidateCode(physicalAddress, size);	// in case it's code
     
     return TRUE;
 }
@@ -182,7 +280,8 @@ Machine::WriteMem(int addr, int size, int value)
 //----------------------------------------------------------------------
 
 ExceptionType
-Machine::Translate(int virtAddr, int* physAddr, int size, bool writing)
+Machine::Translate(int virtAddr, int* physAddr, int size, bool writing,
+		   TranslationEntry **entryUsed)
 {
     int i;
     unsigned int vpn, offset;
@@ -205,23 +304,29 @@ Machine::Translate(int virtAddr, int* physAddr, int size, bool writing)
     vpn = (unsigned) virtAddr / PageSize;
     offset = (unsigned) virtAddr % PageSize;
     
-    if (tlb == NULL) {		// => page table => vpn is index into table
-	if (vpn >= pageTableSize) {
+    if (tlb == NULL) {		// => page table => walk its two levels
+	entry = pageTable->Lookup(vpn);
+	if (vpn >= pageTable->Size()) {
 	    DEBUG(dbgAddr, "Illegal virtual page # " << virtAddr);
 	    return AddressErrorException;
-	} else if (!pageTable[vpn].valid) {
+	} else if (entry == NULL || !entry->valid) {
 	    DEBUG(dbgAddr, "Invalid virtual page # " << virtAddr);
 	    return PageFaultException;
 	}
-	entry = &pageTable[vpn];
-    } else {
-        for (entry = NULL, i = 0; i < TLBSize; i++)
-    	    if (tlb[i].valid && (tlb[i].virtualPage == ((int)vpn))) {
+    } else {			// => TLB => search vpn's set
+	int first = TLBSet(vpn);
+
+        for (entry = NULL, i = first; i < first + tlbWays; i++)
+    	    if (tlb[i].valid && (tlb[i].virtualPage == ((int)vpn))
+		    && (!tlbTagged || tlbASID[i] == currentASID)) {
 		entry = &tlb[i];			// FOUND!
+		tlbLastUse[i] = ++tlbUses;
+		kernel->stats->numTLBHits++;
 		break;
 	    }
 	if (entry == NULL) {				// not found
     	    DEBUG(dbgAddr, "Invalid TLB entry for this virtual page!");
+	    kernel->stats->numTLBMisses++;
     	    return PageFaultException;		// really, this is a TLB fault,
 						// the page may be in memory,
 						// but not in the TLB
@@ -246,5 +351,66 @@ Machine::Translate(int virtAddr, int* physAddr, int size, bool writing)
     *physAddr = pageFrame * PageSize + offset;
     ASSERT((*physAddr >= 0) && ((*physAddr + size) <= MemorySize));
     DEBUG(dbgAddr, "phys addr = " << *physAddr);
+    if (entryUsed != NULL)
+	*entryUsed = entry;
     return NoException;
 }
+
+//----------------------------------------------------------------------
+// Machine::CachedTranslate
+// 	Translate an address as Translate does, but first try the entry
+//	the last access of the same kind used.  Loops through an array,
+//	or running straight-line code, go to the same page again and
+//	again, and then need none of Translate's checks and searching:
+//	only that the address is aligned, and that the entry is still
+//	valid, and still for that page (the kernel owns the TLB and the
+//	page table, and may change them at any time).  The use and dirty
+//	bits are set as always.
+//
+//	"type" -- instruction fetch, load or store
+//----------------------------------------------------------------------
+
+ExceptionType
+Machine::CachedTranslate(int virtAddr, int* physAddr, int size,
+			 AccessType type)
+{
+    LastTranslation *last = &lastTranslation[type];
+    TranslationEntry *entry = last->entry;
+    unsigned int vpn = (unsigned) virtAddr / PageSize;
+    ExceptionType exception;
+
+    if (entry != NULL && last->vpn == vpn && (virtAddr & (size - 1)) == 0
+	    && entry->valid && entry->virtualPage == (int) vpn
+	    && !(type == WriteAccess && entry->readOnly)) {
+	if (tlb != NULL) {	// (the entry can't be another space's:
+	    tlbLastUse[entry - tlb] = ++tlbUses;	// switching spaces
+	    kernel->stats->numTLBHits++;	// flushes this cache)
+	}
+	entry->use = TRUE;
+	if (type == WriteAccess)
+	    entry->dirty = TRUE;
+	*physAddr = entry->physicalPage * PageSize
+			+ (unsigned) virtAddr % PageSize;
+	return NoException;
+    }
+    exception = Translate(virtAddr, physAddr, size, type == WriteAccess,
+			  &entry);
+    if (exception == NoException && !addrDebug) {
+	last->vpn = vpn;
+	last->entry = entry;
+    }
+    return exception;
+}
+
+//----------------------------------------------------------------------
+// Machine::FlushTranslations
+// 	Forget the cached translations, because the page table they
+//	point into is being replaced (on a context switch, say).
+//----------------------------------------------------------------------
+
+void
+Machine::FlushTranslations()
+{
+    for (int i = 0; i < NumAccessTypes; i++)
+	lastTranslation[i].entry = NULL;
+}
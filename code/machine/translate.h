@@ -9,6 +9,13 @@
 //	Either way, each entry is of the form:
 //	<virtual page #, physical page #>.
 //
+//	A page table has two levels: a directory with one pointer per
+//	PageTableChunk pages, and a second-level table of entries for
+//	each chunk some page of which has been touched.  Chunks no page
+//	has been touched in have no table, and translate as invalid, so
+//	a large, sparse address space (mapped files, the stack at the
+//	top) costs only a pointer for each chunk it doesn't use.
+//
 // DO NOT CHANGE -- part of the machine emulation
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
@@ -42,4 +49,39 @@ class TranslationEntry {
 			// page is modified.
 };
 
+#define PageTableChunk	32		// pages per second-level table
+
+// The following class defines a two-level page table.
+
+class PageTable {
+  public:
+    PageTable(unsigned int pages);	// "pages" pages, all invalid
+    ~PageTable();
+
+    unsigned int Size() { return numPages; }
+    TranslationEntry *Lookup(unsigned int vpn) {
+	TranslationEntry *chunk;
+
+	if (vpn >= numPages)
+	    return NULL;
+	chunk = directory[vpn / PageTableChunk];
+	return (chunk == NULL) ? NULL : &chunk[vpn % PageTableChunk];
+    }
+    					// Entry for page "vpn", or NULL if
+					// its chunk has no table (it is
+					// invalid) or it is out of range
+    TranslationEntry *Entry(unsigned int vpn);
+    					// The same, making the chunk's table
+					// if need be; NULL if out of range
+    void Resize(unsigned int pages);	// Make it "pages" long; pages taken
+    					// away must be invalid
+
+  private:
+    unsigned int numPages;		// pages it covers
+    TranslationEntry **directory;	// each chunk's table, or NULL
+
+    static void InitChunk(TranslationEntry *chunk, unsigned int first,
+			  int from);	// Entries "from" on invalid
+};
+
 #endif
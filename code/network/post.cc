@@ -18,24 +18,66 @@
 
 #include "copyright.h"
 #include "post.h"
+#include "workpool.h"
+#include "memtrack.h"
 
 //----------------------------------------------------------------------
 // Mail::Mail
-//      Initialize a single mail message, by concatenating the headers to
-//	the data.
+//      Allocate a mail message, with room for the largest message, and
+//	for a MailHeader in front of it, so a packet can be read in
+//	whole with its data in place.
+//----------------------------------------------------------------------
+
+Mail::Mail()
+{
+    buffer = new char[sizeof(MailHeader) + MaxMailSize];
+    data = buffer + sizeof(MailHeader);
+    received = 0;
+    MemoryAllocated(MemNetwork, sizeof(Mail) + sizeof(MailHeader) + MaxMailSize);
+}
+
+Mail::~Mail()
+{
+    delete [] buffer;
+    MemoryFreed(MemNetwork, sizeof(Mail) + sizeof(MailHeader) + MaxMailSize);
+}
+
+//----------------------------------------------------------------------
+// Mail::FirstFragment
+//      A packet has been read into Packet(): take its MailHeader as the
+//	message's, and its fragment, already in place, as the first.
 //
 //	"pktH" -- source, destination machine ID's
-//	"mailH" -- source, destination mailbox ID's
-//	"data" -- payload data
 //----------------------------------------------------------------------
 
-Mail::Mail(PacketHeader pktH, MailHeader mailH, char *msgData)
+void
+Mail::FirstFragment(PacketHeader pktH)
 {
-    ASSERT(mailH.length <= MaxMailSize);
-
     pktHdr = pktH;
-    mailHdr = mailH;
-    bcopy(msgData, data, mailHdr.length);
+    bcopy(Packet(), (char *) &mailHdr, sizeof(MailHeader));
+    received = pktH.length - sizeof(MailHeader);
+}
+
+//----------------------------------------------------------------------
+// Mail::AddFragment
+//      Copy the fragment of the message a packet carried into place.
+//	Fragments are sent in order, and the network keeps them in
+//	order, so one that isn't next means the next was lost.
+//
+//	"mailH" -- the packet's mail header, saying where the fragment goes
+//	"fragment" -- the fragment's data
+//----------------------------------------------------------------------
+
+bool
+Mail::AddFragment(MailHeader mailH, char *fragment)
+{
+    int n = min((int) MaxFragmentSize, (int) (mailHdr.length - mailH.offset));
+
+    if (mailH.length != mailHdr.length || mailH.offset != received)
+	return FALSE;
+    bcopy(fragment, data + received, n);
+    received += n;
+    return TRUE;
 }
 
 //----------------------------------------------------------------------
@@ -50,6 +92,7 @@ Mail::Mail(PacketHeader pktH, MailHeader mailH, char *msgData)
 MailBox::MailBox()
 { 
     messages = new SynchList<Mail *>(); 
+    waiter = NULL;
 }
 
 //----------------------------------------------------------------------
@@ -83,57 +126,53 @@ PrintHeader(PacketHeader pktHdr, MailHeader mailHdr)
 
 //----------------------------------------------------------------------
 // MailBox::Put
-// 	Add a message to the mailbox.  If anyone is waiting for message
-//	arrival, wake them up!
+// 	Add a message, all of whose fragments have arrived, to the
+//	mailbox.  If anyone is waiting for message arrival, wake them up!
 //
-//	We need to reconstruct the Mail message (by concatenating the headers
-//	to the data), to simplify queueing the message on the SynchList.
+//	That includes a thread in PostOfficeInput::Poll, waiting on this
+//	box among others; if it also has a timeout, it is taken out of
+//	the alarm clock, unless the clock has already woken it.
 //
-//	"pktHdr" -- source, destination machine ID's
-//	"mailHdr" -- source, destination mailbox ID's
-//	"data" -- payload message data
+//	"mail" -- the message, headers and data
 //----------------------------------------------------------------------
 
 void 
-MailBox::Put(PacketHeader pktHdr, MailHeader mailHdr, char *data)
+MailBox::Put(Mail *mail)
 { 
-    Mail *mail = new Mail(pktHdr, mailHdr, data); 
-
     messages->Append(mail);		// put on the end of the list of 
 					// arrived messages, and wake up 
 					// any waiters
+
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+    if (waiter != NULL && waiter->thread != NULL) {
+	Thread *thread = waiter->thread;
+
+	waiter->thread = NULL;
+	if (!waiter->timed || kernel->alarm->Cancel(thread))
+	    kernel->scheduler->ReadyToRun(thread);
+    }
+    (void) kernel->interrupt->SetLevel(oldLevel);
 }
 
 //----------------------------------------------------------------------
 // MailBox::Get
-// 	Get a message from a mailbox, parsing it into the packet header,
-//	mailbox header, and data. 
+// 	Get a message from a mailbox.
 //
 //	The calling thread waits if there are no messages in the mailbox.
-//
-//	"pktHdr" -- address to put: source, destination machine ID's
-//	"mailHdr" -- address to put: source, destination mailbox ID's
-//	"data" -- address to put: payload message data
 //----------------------------------------------------------------------
 
-void 
-MailBox::Get(PacketHeader *pktHdr, MailHeader *mailHdr, char *data) 
+Mail * 
+MailBox::Get() 
 { 
     DEBUG(dbgNet, "Waiting for mail in mailbox");
     Mail *mail = messages->RemoveFront();	// remove message from list;
 						// will wait if list is empty
 
-    *pktHdr = mail->pktHdr;
-    *mailHdr = mail->mailHdr;
     if (debug->IsEnabled('n')) {
 	cout << "Got mail from mailbox: ";
-	PrintHeader(*pktHdr, *mailHdr);
+	PrintHeader(mail->pktHdr, mail->mailHdr);
     }
-    bcopy(mail->data, data, mail->mailHdr.length);
-					// copy the message data into
-					// the caller's buffer
-    delete mail;			// we've copied out the stuff we
-					// need, we can now discard the message
+    return mail;
 }
 
 //----------------------------------------------------------------------
@@ -142,49 +181,96 @@ MailBox::Get(PacketHeader *pktHdr, MailHeader *mailHdr, char *data)
 //	Also initialize the network device, to allow post offices
 //	on different machines to deliver messages to one another.
 //
-//      We use a separate thread "the postal worker" to wait for messages 
-//	to arrive, and deliver them to the correct mailbox.  Note that
-//	delivering messages to the mailboxes can't be done directly
-//	by the interrupt handlers, because it requires a Lock.
+//      We have one of the kernel's worker threads deliver each message
+//	that arrives to the correct mailbox.  Note that delivering
+//	messages to the mailboxes can't be done directly by the
+//	interrupt handlers, because it requires a Lock.
 //
 //	"nBoxes" is the number of mail boxes in this Post Office
 //----------------------------------------------------------------------
 
 PostOfficeInput::PostOfficeInput(int nBoxes)
 {
-    messageAvailable = new Semaphore("message available", 0);
-
     numBoxes = nBoxes;
     boxes = new MailBox[nBoxes];
+    handlers = new MailHandler *[nBoxes];
+    for (int i = 0; i < nBoxes; i++)
+	handlers[i] = NULL;
+    partial = new List<Mail *>;
+    pool = new List<Mail *>;
+    for (int i = 0; i < MailPoolSize; i++)
+	pool->Append(new Mail);
 
     network = new NetworkInput(this);
-
-    Thread *t = new Thread("postal worker", 1);
-
-    t->Fork(PostOfficeInput::PostalDelivery, this);
 }
 
 //----------------------------------------------------------------------
 // PostOfficeInput::~PostOfficeInput
 // 	De-allocate the post office data structures.
-//	
-//	Since the postal helper is waiting on the "messageAvail" semaphore,
-//	we don't deallocate it!  This leaves garbage lying about,
-//	but the alternative is worse!
 //----------------------------------------------------------------------
 
 PostOfficeInput::~PostOfficeInput()
 {
     delete network;
     delete [] boxes;
+    delete [] handlers;
+    while (!partial->IsEmpty())
+	delete partial->RemoveFront();
+    delete partial;
+    while (!pool->IsEmpty())
+	delete pool->RemoveFront();
+    delete pool;
+}
+
+//----------------------------------------------------------------------
+// PostOfficeInput::AllocMail, PostOfficeInput::Release
+// 	Take a Mail from the pool, making another if it is empty, or
+//	give one back.
+//----------------------------------------------------------------------
+
+Mail *
+PostOfficeInput::AllocMail()
+{
+    if (pool->IsEmpty())
+	return new Mail;
+    return pool->RemoveFront();
+}
+
+void
+PostOfficeInput::Release(Mail *mail)
+{
+    pool->Prepend(mail);		// (the most recently used first)
+}
+
+//----------------------------------------------------------------------
+// PostOfficeInput::Attach, PostOfficeInput::Detach
+// 	Have "handler" take the mail arriving at "box", or stop it.
+//	Mail already in the box stays there.
+//----------------------------------------------------------------------
+
+void
+PostOfficeInput::Attach(int box, MailHandler *handler)
+{
+    ASSERT((box >= 0) && (box < numBoxes) && handlers[box] == NULL);
+    handlers[box] = handler;
+}
+
+void
+PostOfficeInput::Detach(int box)
+{
+    ASSERT((box >= 0) && (box < numBoxes));
+    handlers[box] = NULL;
 }
 
 //----------------------------------------------------------------------
 // PostOffice::PostalDelivery
-// 	Wait for incoming messages, and put them in the right mailbox.
+// 	Task submitted for each incoming message: put it in the right
+//	mailbox.
 //
 //      Incoming messages have had the PacketHeader stripped off,
 //	but the MailHeader is still tacked on the front of the data.
+//	The packet may be only a fragment of a message; the message goes
+//	in the mailbox once the last of them arrives.
 //----------------------------------------------------------------------
 
 void
@@ -193,26 +279,81 @@ PostOfficeInput::PostalDelivery(void* data)
     PostOfficeInput* _this = (PostOfficeInput*)data;
     PacketHeader pktHdr;
     MailHeader mailHdr;
-    char *buffer = new char[MaxPacketSize];
+    Mail *mail = _this->AllocMail();
 
-    for (;;) {
-        // first, wait for a message
-        _this->messageAvailable->P();	
-        pktHdr = _this->network->Receive(buffer);
+    pktHdr = _this->network->Receive(mail->Packet());
+					// read straight into the Mail
+    mail->FirstFragment(pktHdr);
+    mailHdr = mail->mailHdr;
+    if (debug->IsEnabled('n')) {
+	cout << "Putting mail into mailbox: ";
+	PrintHeader(pktHdr, mailHdr);
+    }
+
+    // check that arriving message is legal!
+    ASSERT(0 <= mailHdr.to && mailHdr.to < _this->numBoxes);
+    ASSERT(mailHdr.length <= MaxMailSize && mailHdr.offset <= mailHdr.length);
+
+    mail = _this->Reassemble(mail);
+    if (mail == NULL)
+	return;				// more to come
+
+    // put into mailbox, or hand to whoever takes its mail
+    if (_this->handlers[mailHdr.to] != NULL) {
+	_this->handlers[mailHdr.to]->Deliver(mail->pktHdr, mail->mailHdr,
+					     mail->data);
+	_this->Release(mail);
+    } else {
+	_this->boxes[mailHdr.to].Put(mail);
+    }
+}
 
-        mailHdr = *(MailHeader *)buffer;
-        if (debug->IsEnabled('n')) {
-	    cout << "Putting mail into mailbox: ";
-	    PrintHeader(pktHdr, mailHdr);
-        }
+//----------------------------------------------------------------------
+// PostOfficeInput::Reassemble
+// 	"arrived" holds a packet just read.  If it starts a message, it
+//	becomes the message; otherwise its fragment is copied into the
+//	message partly arrived from the same mailbox for the same
+//	mailbox, and it goes back to the pool.  A message missing a
+//	fragment is thrown away.  Returns the message if it is now
+//	complete, else NULL.
+//----------------------------------------------------------------------
 
-	// check that arriving message is legal!
-	ASSERT(0 <= mailHdr.to && mailHdr.to < _this->numBoxes);
-	ASSERT(mailHdr.length <= MaxMailSize);
+Mail *
+PostOfficeInput::Reassemble(Mail *arrived)
+{
+    MailHeader mailHdr = arrived->mailHdr;
+    Mail *mail = NULL;
+
+    for (ListIterator<Mail *> it(partial); !it.IsDone(); it.Next())
+	if (it.Item()->pktHdr.from == arrived->pktHdr.from
+		&& it.Item()->mailHdr.from == mailHdr.from
+		&& it.Item()->mailHdr.to == mailHdr.to) {
+	    mail = it.Item();
+	    break;
+	}
+    if (mailHdr.offset == 0) {
+	if (mail != NULL) {		// the rest of it was lost
+	    DEBUG(dbgNet, "Fragment lost, dropping message");
+	    partial->Remove(mail);
+	    Release(mail);
+	}
+	if (arrived->IsComplete())
+	    return arrived;		// the usual case: one packet
+	partial->Append(arrived);
+	return NULL;
+    }
 
-	// put into mailbox
-        _this->boxes[mailHdr.to].Put(pktHdr, mailHdr, buffer + sizeof(MailHeader));
+    if (mail != NULL && !mail->AddFragment(mailHdr, arrived->data)) {
+	DEBUG(dbgNet, "Fragment lost, dropping message");
+	partial->Remove(mail);
+	Release(mail);
+	mail = NULL;
     }
+    Release(arrived);
+    if (mail == NULL || !mail->IsComplete())
+	return NULL;
+    partial->Remove(mail);
+    return mail;
 }
 
 //----------------------------------------------------------------------
@@ -234,23 +375,108 @@ void
 PostOfficeInput::Receive(int box, PacketHeader *pktHdr, 
 				MailHeader *mailHdr, char* data)
 {
+    Mail *mail = ReceiveMail(box);
+
+    *pktHdr = mail->pktHdr;
+    *mailHdr = mail->mailHdr;
+    bcopy(mail->data, data, mail->mailHdr.length);
+					// copy the message data into
+					// the caller's buffer
+    Release(mail);			// we've copied out the stuff we
+					// need, we can now reuse the Mail
+}
+
+//----------------------------------------------------------------------
+// PostOfficeInput::ReceiveMail
+// 	Retrieve a message from a specific box, as Receive does, but
+//	return the Mail itself rather than copying it out.  The caller
+//	must give it back with Release once done with it.
+//
+//	"box" -- mailbox ID in which to look for message
+//----------------------------------------------------------------------
+
+Mail *
+PostOfficeInput::ReceiveMail(int box)
+{
+    Mail *mail;
+
     ASSERT((box >= 0) && (box < numBoxes));
 
-    boxes[box].Get(pktHdr, mailHdr, data);
-    ASSERT(mailHdr->length <= MaxMailSize);
+    mail = boxes[box].Get();
+    ASSERT(mail->mailHdr.length <= MaxMailSize);
+    return mail;
+}
+
+//----------------------------------------------------------------------
+// PostOfficeInput::Poll
+// 	Wait until at least one of a set of mailboxes has a message in
+//	it, so that one thread can serve many boxes, rather than one
+//	thread per box each blocked in Receive.  Nothing is taken out of
+//	the box: the caller then Receives from it, which won't wait,
+//	provided no one else is receiving from the same box.
+//
+//	With interrupts off, the boxes are checked, and if none is ready
+//	the same MailWaiter is left in each of them, so that the first
+//	Put to any of them wakes us.  A timeout is a stay in the alarm
+//	clock, which whoever wakes us first cancels (see MailBox::Put).
+//
+//	Returns the index in "which" of the first box found ready, or -1
+//	if "timeout" ticks went by first.
+//
+//	"which" -- mailbox IDs to wait on
+//	"count" -- how many of them
+//	"timeout" -- ticks to wait at most; 0 only checks, and a
+//		negative timeout waits for as long as it takes
+//----------------------------------------------------------------------
+
+int
+PostOfficeInput::Poll(int *which, int count, int timeout)
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+    MailWaiter waiter;
+    int ready = -1;
+
+    for (int i = 0; i < count; i++)
+	ASSERT((which[i] >= 0) && (which[i] < numBoxes));
+
+    for (int i = 0; i < count && ready == -1; i++)
+	if (boxes[which[i]].IsReady())
+	    ready = i;
+
+    if (ready == -1 && timeout != 0) {
+	waiter.thread = kernel->currentThread;
+	waiter.timed = (timeout > 0);
+	for (int i = 0; i < count; i++)
+	    boxes[which[i]].SetWaiter(&waiter);
+
+	DEBUG(dbgNet, "Polling " << count << " mailboxes");
+	if (waiter.timed)
+	    kernel->alarm->WaitUntil(timeout);
+	else
+	    kernel->currentThread->Sleep(FALSE);
+
+	waiter.thread = NULL;		// in case the clock woke us
+	for (int i = 0; i < count; i++) {
+	    boxes[which[i]].SetWaiter(NULL);
+	    if (ready == -1 && boxes[which[i]].IsReady())
+		ready = i;
+	}
+    }
+    (void) kernel->interrupt->SetLevel(oldLevel);
+    return ready;
 }
 
 //----------------------------------------------------------------------
 // PostOffice::CallBack
 // 	Interrupt handler, called when a packet arrives from the network.
 //
-//	Signal the PostalDelivery routine that it is time to get to work!
+//	Have a worker run PostalDelivery, to get it to its mailbox.
 //----------------------------------------------------------------------
 
 void
 PostOfficeInput::CallBack()
 { 
-    messageAvailable->V(); 
+    kernel->workers->Submit(PostOfficeInput::PostalDelivery, this); 
 }
 
 //----------------------------------------------------------------------
@@ -287,6 +513,9 @@ PostOfficeOutput::~PostOfficeOutput()
 // PostOfficeOutput::Send
 // 	Concatenate the MailHeader to the front of the data, and pass 
 //	the result to the Network for delivery to the destination machine.
+//	A message too long for one packet goes as several, one fragment
+//	of it in each, sent one after another; no other message is sent
+//	in between, so they arrive in order.
 //
 //	Note that the MailHeader + data looks just like normal payload
 //	data to the Network.
@@ -299,8 +528,9 @@ PostOfficeOutput::~PostOfficeOutput()
 void
 PostOfficeOutput::Send(PacketHeader pktHdr, MailHeader mailHdr, char* data)
 {
-    char* buffer = new char[MaxPacketSize];	// space to hold concatenated
-						// mailHdr + data
+    char buffer[MaxPacketSize];		// space to hold concatenated
+					// mailHdr + fragment
+    unsigned offset = 0;
 
     if (debug->IsEnabled('n')) {
 	cout << "Post send: ";
@@ -309,23 +539,27 @@ PostOfficeOutput::Send(PacketHeader pktHdr, MailHeader mailHdr, char* data)
     ASSERT(mailHdr.length <= MaxMailSize);
     ASSERT(0 <= mailHdr.to);
     
-    // fill in pktHdr, for the Network layer
     pktHdr.from = kernel->hostName;
-    pktHdr.length = mailHdr.length + sizeof(MailHeader);
-
-    // concatenate MailHeader and data
-    bcopy((char *)&mailHdr, buffer, sizeof(MailHeader));
-    bcopy(data, buffer + sizeof(MailHeader), mailHdr.length);
 
     sendLock->Acquire();   		// only one message can be sent
 					// to the network at any one time
-    network->Send(pktHdr, buffer);
-    messageSent->P();			// wait for interrupt to tell us
-					// ok to send the next message
+    do {
+	int n = min((int) MaxFragmentSize, (int) (mailHdr.length - offset));
+
+	// fill in pktHdr, for the Network layer
+	pktHdr.length = n + sizeof(MailHeader);
+
+	// concatenate MailHeader and this fragment of the data
+	mailHdr.offset = offset;
+	bcopy((char *)&mailHdr, buffer, sizeof(MailHeader));
+	bcopy(data + offset, buffer + sizeof(MailHeader), n);
+
+	network->Send(pktHdr, buffer);
+	messageSent->P();		// wait for interrupt to tell us
+					// ok to send the next packet
+	offset += n;
+    } while (offset < mailHdr.length);
     sendLock->Release();
-
-    delete [] buffer;			// we've sent the message, so
-					// we can delete our buffer
 }
 
 //----------------------------------------------------------------------
@@ -20,6 +20,19 @@
 //	to which you can send an acknowledgement, if your protocol requires 
 //	this.
 //
+//	A message may be longer than fits in a packet, up to MaxMailSize
+//	bytes: it is sent as a run of fragments of up to MaxFragmentSize
+//	bytes each, back to back, and put back together where it arrives,
+//	directly into the buffer of the Mail that goes in the mailbox.  If
+//	any fragment is lost, the whole message is.
+//
+//	Mail is kept in a pool, and reused, rather than allocated for
+//	each message.  A packet is read off the network straight into a
+//	Mail's buffer, behind room for its MailHeader, so a message that
+//	fits in one packet is never copied again: it is put in the box
+//	as it is, and ReceiveMail hands it to the caller, who gives it
+//	back to the pool (Release) when done with it.
+//
 // Copyright (c) 1992-1996 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
 // of liability and disclaimer of warranty provisions.
@@ -48,12 +61,20 @@ class MailHeader {
     MailBoxAddress from;	// Mail box to reply to
     unsigned length;		// Bytes of message data (excluding the 
 				// mail header)
+    unsigned offset;		// Where in the message this packet's
+    				// fragment of it goes
 };
 
-// Maximum "payload" -- real data -- that can included in a single message
+// Maximum "payload" -- real data -- that can included in a single packet
 // Excluding the MailHeader and the PacketHeader
 
-#define MaxMailSize 	(MaxPacketSize - sizeof(MailHeader))
+#define MaxFragmentSize 	(MaxPacketSize - sizeof(MailHeader))
+
+// Maximum size of a message, sent as several packets if need be
+
+#define MaxMailSize	4096
+
+#define MailPoolSize	16	// Mail made ready at the start
 
 
 // The following class defines the format of an incoming/outgoing 
@@ -64,13 +85,52 @@ class MailHeader {
 
 class Mail {
   public:
-     Mail(PacketHeader pktH, MailHeader mailH, char *msgData);
-				// Initialize a mail message by
-				// concatenating the headers to the data
+     Mail();			// Allocate a mail message, with room
+     				// for MaxMailSize bytes of data
+     ~Mail();
+
+     char *Packet() { return data - sizeof(MailHeader); }
+     				// Where to read a packet into: its
+				// fragment then lands at "data"
+     void FirstFragment(PacketHeader pktH);
+     				// A packet is in: make it the start of
+				// a message
+     bool AddFragment(MailHeader mailH, char *fragment);
+     				// Copy in the next fragment; FALSE if it
+				// isn't the next (one was lost)
+     bool IsComplete() { return received == mailHdr.length; }
 
      PacketHeader pktHdr;	// Header appended by Network
      MailHeader mailHdr;	// Header appended by PostOffice
-     char data[MaxMailSize];	// Payload -- message data
+     char *data;		// Payload -- message data
+     unsigned received;		// how much of it has arrived
+
+  private:
+     char *buffer;		// MailHeader, then data
+};
+
+// The following class defines something that takes the mail arriving
+// at a box itself, as it arrives, rather than leaving it in the box
+// for a thread to Receive (see PostOfficeInput::Attach).  Deliver is
+// called by a kernel worker thread, so it may wait.
+
+class MailHandler {
+  public:
+    virtual ~MailHandler() {}
+    virtual void Deliver(PacketHeader pktHdr, MailHeader mailHdr,
+			 char *data) = 0;
+};
+
+// The following class defines what a thread waiting on several
+// mailboxes at once (see PostOfficeInput::Poll) leaves in each of
+// them, so that mail arriving at any one wakes it up.  A box holds
+// one waiter: only one thread at a time may poll any given box.
+
+class MailWaiter {
+  public:
+    MailWaiter() { thread = NULL; timed = FALSE; }
+    Thread *thread;		// who is waiting, or NULL once woken
+    bool timed;			// it is asleep in the alarm clock too
 };
 
 // The following class defines a single mailbox, or temporary storage
@@ -83,14 +143,17 @@ class MailBox {
     MailBox();			// Allocate and initialize mail box
     ~MailBox();			// De-allocate mail box
 
-    void Put(PacketHeader pktHdr, MailHeader mailHdr, char *data);
-   				// Atomically put a message into the mailbox
-    void Get(PacketHeader *pktHdr, MailHeader *mailHdr, char *data); 
-   				// Atomically get a message out of the 
+    void Put(Mail *mail);	// Atomically put a message into the mailbox
+    Mail *Get();		// Atomically get a message out of the 
 				// mailbox (and wait if there is no message 
 				// to get!)
+    bool IsReady() { return !messages->IsEmpty(); }
+    				// Would Get return at once?
+    void SetWaiter(MailWaiter *w) { waiter = w; }
+    				// Wake "w" when mail arrives (NULL: no one)
   private:
     SynchList<Mail *> *messages; // A mailbox is just a list of arrived messages
+    MailWaiter *waiter;		// who is polling this box, if anyone
 };
 
 // The following two classes defines a "Post Office", or a collection of 
@@ -111,10 +174,22 @@ class PostOfficeInput : public CallBackObj {
 		MailHeader *mailHdr, char *data);
     				// Retrieve a message from "box".  Wait if
 				// there is no message in the box.
+    Mail *ReceiveMail(int box);	// Retrieve it without copying it; the
+    				// caller must Release it
+    int Poll(int *which, int count, int timeout);
+    				// Wait until one of the "count" boxes in
+				// "which" has mail, or "timeout" ticks
+				// pass; return its index, or -1
+    void Release(Mail *mail);	// Give "mail" back to the pool
+
+    void Attach(int box, MailHandler *handler);
+    				// Hand the mail arriving at "box" to
+				// "handler" from now on
+    void Detach(int box);	// Leave it in the box again
 
     static void PostalDelivery(void* data);
-				// Wait for incoming messages, 
-				// and then put them in the correct mailbox
+				// Put an incoming message in the
+				// correct mailbox
 
     void CallBack();		// Called when incoming packet has arrived 
 				// and can be pulled off of network 
@@ -123,8 +198,17 @@ class PostOfficeInput : public CallBackObj {
   private:
     NetworkInput *network;	// Physical network connection
     MailBox *boxes;		// Table of mail boxes to hold incoming mail
+    MailHandler **handlers;	// For each box, what takes its mail, if
+    				// not the box
+    List<Mail *> *partial;	// messages whose fragments are arriving
+    List<Mail *> *pool;		// Mail not in use
+
+    Mail *AllocMail();		// Mail from the pool, or a new one
+    Mail *Reassemble(Mail *arrived);
+    				// Add the fragment "arrived" holds to
+				// its message; returns the message once
+				// it is complete
     int numBoxes;		// Number of mail boxes
-    Semaphore *messageAvailable;// V'ed when message has arrived from network
 };
 
 class PostOfficeOutput : public CallBackObj {
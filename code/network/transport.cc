@@ -0,0 +1,262 @@
+// transport.cc
+//	Routines for sending a stream of bytes reliably, and in order,
+//	over the post office.  See transport.h.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "transport.h"
+#include "workpool.h"
+#include "main.h"
+
+//----------------------------------------------------------------------
+// Connection::Connection
+// 	Start a connection between mailbox "localBox" on this machine and
+//	"farBox" on "farHost", which must make one back to us.  Nothing
+//	is sent until there is data to send.
+//----------------------------------------------------------------------
+
+Connection::Connection(int localBox, NetworkAddress farHost, int farBox)
+{
+    this->localBox = localBox;
+    this->farHost = farHost;
+    this->farBox = farBox;
+    lock = new Lock("connection");
+    changed = new Condition("connection changed");
+    sendBase = 0;
+    nextSeq = 0;
+    lastProgress = 0;
+    timerSet = FALSE;
+    receivedHead = 0;
+    receivedCount = 0;
+    expected = 0;
+    kernel->postOfficeIn->Attach(localBox, this);
+}
+
+//----------------------------------------------------------------------
+// Connection::~Connection
+// 	Wait until everything sent has been acknowledged, and the
+//	retransmit timer has gone off for the last time (it can't be
+//	stopped), then give the mailbox back.
+//----------------------------------------------------------------------
+
+Connection::~Connection()
+{
+    Flush();
+    while (timerSet)
+	kernel->alarm->WaitUntil(RetransmitTime);
+    kernel->postOfficeIn->Detach(localBox);
+    delete lock;
+    delete changed;
+}
+
+//----------------------------------------------------------------------
+// Connection::Send
+// 	Send "length" bytes of "data", a packet at a time, waiting
+//	whenever the window is full for the oldest packet in flight to
+//	be acknowledged.
+//----------------------------------------------------------------------
+
+void
+Connection::Send(char *data, int length)
+{
+    for (int done = 0; done < length; ) {
+	int n = min(length - done, MaxSegmentSize);
+	int seq;
+
+	lock->Acquire();
+	while (nextSeq - sendBase >= WindowSize)
+	    changed->Wait(lock);
+	if (sendBase == nextSeq)	// the timer starts afresh
+	    lastProgress = kernel->stats->totalTicks;
+	seq = nextSeq++;
+	bcopy(data + done, window[seq % WindowSize], n);
+	windowLength[seq % WindowSize] = n;
+	lock->Release();
+
+	Transmit(seq);
+	done += n;
+    }
+}
+
+//----------------------------------------------------------------------
+// Connection::Receive
+// 	Wait until some bytes have arrived, then copy up to "size" of
+//	them into "data".  Returns how many were copied.
+//----------------------------------------------------------------------
+
+int
+Connection::Receive(char *data, int size)
+{
+    int n;
+
+    lock->Acquire();
+    while (receivedCount == 0)
+	changed->Wait(lock);
+    n = min(size, receivedCount);
+    for (int i = 0; i < n; i++)
+	data[i] = received[(receivedHead + i) % ReceiveBufferSize];
+    receivedHead = (receivedHead + n) % ReceiveBufferSize;
+    receivedCount -= n;
+    lock->Release();
+    return n;
+}
+
+//----------------------------------------------------------------------
+// Connection::Flush
+// 	Wait until every packet sent has been acknowledged.
+//----------------------------------------------------------------------
+
+void
+Connection::Flush()
+{
+    lock->Acquire();
+    while (sendBase < nextSeq)
+	changed->Wait(lock);
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// Connection::Deliver
+// 	A packet has arrived from the far end.  Its ack frees the packets
+//	in flight before the one it names.  If it carries data, and is
+//	the next packet expected, the data is kept for Receive, if there
+//	is room for it; either way it is acknowledged, with the number
+//	of the packet now expected.
+//----------------------------------------------------------------------
+
+void
+Connection::Deliver(PacketHeader pktHdr, MailHeader mailHdr, char *data)
+{
+    TransportHeader hdr;
+    int n = mailHdr.length - sizeof(TransportHeader);
+
+    ASSERT(n >= 0 && n <= MaxSegmentSize);
+    bcopy(data, (char *) &hdr, sizeof(TransportHeader));
+    data += sizeof(TransportHeader);
+
+    lock->Acquire();
+    if (hdr.ack > sendBase && hdr.ack <= nextSeq) {
+	DEBUG(dbgNet, "Acked up to packet " << hdr.ack);
+	sendBase = hdr.ack;
+	lastProgress = kernel->stats->totalTicks;
+	changed->Broadcast(lock);
+    }
+    if (hdr.seq == expected && receivedCount + n <= ReceiveBufferSize) {
+	for (int i = 0; i < n; i++)
+	    received[(receivedHead + receivedCount + i) % ReceiveBufferSize]
+		= data[i];
+	receivedCount += n;
+	expected++;
+	changed->Broadcast(lock);
+    }
+    lock->Release();
+    if (hdr.seq >= 0)
+	Transmit(-1);
+}
+
+//----------------------------------------------------------------------
+// Connection::Transmit
+// 	Send packet "seq" from the window, if it is still in flight, or
+//	just an acknowledgement if "seq" is -1.  Either carries the
+//	number of the next packet we expect.  Sending a data packet
+//	starts the retransmit timer, if it isn't already going.
+//----------------------------------------------------------------------
+
+void
+Connection::Transmit(int seq)
+{
+    char buffer[MaxMailSize];
+    TransportHeader hdr;
+    PacketHeader pktHdr;
+    MailHeader mailHdr;
+    int n = 0;
+
+    lock->Acquire();
+    if (seq >= 0 && seq < sendBase) {
+	lock->Release();		// acked meanwhile
+	return;
+    }
+    hdr.seq = seq;
+    hdr.ack = expected;
+    if (seq >= 0) {
+	n = windowLength[seq % WindowSize];
+	bcopy(window[seq % WindowSize], buffer + sizeof(TransportHeader), n);
+    }
+    lock->Release();
+    bcopy((char *) &hdr, buffer, sizeof(TransportHeader));
+
+    pktHdr.to = farHost;
+    mailHdr.to = farBox;
+    mailHdr.from = localBox;
+    mailHdr.length = sizeof(TransportHeader) + n;
+    kernel->postOfficeOut->Send(pktHdr, mailHdr, buffer);
+    if (seq >= 0)
+	SetTimer();
+}
+
+//----------------------------------------------------------------------
+// Connection::SetTimer
+// 	Have CallBack called after RetransmitTime, unless it already is
+//	to be.
+//----------------------------------------------------------------------
+
+void
+Connection::SetTimer()
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+
+    if (!timerSet) {
+	timerSet = TRUE;
+	kernel->interrupt->Schedule(this, RetransmitTime, TimerInt);
+    }
+    (void) kernel->interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// Connection::CallBack
+// 	Interrupt handler for the retransmit timer.  If packets are in
+//	flight and nothing has been acked for RetransmitTime, have a
+//	worker send them again (sending takes a Lock, and waits, which
+//	an interrupt handler can't).  The timer is set again as long as
+//	anything is in flight.
+//----------------------------------------------------------------------
+
+void
+Connection::CallBack()
+{
+    int now = kernel->stats->totalTicks;
+
+    timerSet = FALSE;
+    if (sendBase == nextSeq)
+	return;				// all acked
+    if (now - lastProgress >= RetransmitTime) {
+	DEBUG(dbgNet, "Retransmitting from packet " << sendBase);
+	lastProgress = now;
+	kernel->workers->Submit(Connection::Retransmit, this);
+    }
+    timerSet = TRUE;
+    kernel->interrupt->Schedule(this, RetransmitTime, TimerInt);
+}
+
+//----------------------------------------------------------------------
+// Connection::Retransmit
+// 	Task submitted by the timer: send every packet still in flight
+//	again, oldest first.
+//----------------------------------------------------------------------
+
+void
+Connection::Retransmit(void *data)
+{
+    Connection *_this = (Connection *) data;
+    int first, last;
+
+    _this->lock->Acquire();
+    first = _this->sendBase;
+    last = _this->nextSeq;
+    _this->lock->Release();
+    for (int seq = first; seq < last; seq++)
+	_this->Transmit(seq);
+}
@@ -0,0 +1,102 @@
+// transport.h
+//	Data structures for reliable, ordered delivery of a stream of
+//	bytes between mailboxes on two machines, over the unreliable
+//	post office.
+//
+//	A Connection sends the bytes in numbered packets, and keeps up
+//	to WindowSize of them in flight at once rather than waiting for
+//	each to be acknowledged.  The other end acknowledges them
+//	cumulatively: each packet it sends carries the number of the
+//	next packet it expects, in order, and it acknowledges every
+//	data packet, even one it has already had, so lost acks are
+//	made good by the next.  Packets that arrive out of order are
+//	dropped.  If no acknowledgement comes for RetransmitTime, the
+//	packets still unacknowledged are all sent again (go-back-N).
+//
+//	Both ends use one mailbox for everything; the post office hands
+//	the packets arriving there straight to the Connection (see
+//	PostOfficeInput::Attach).
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "copyright.h"
+#include "post.h"
+#include "stats.h"
+
+#define WindowSize		8	// packets in flight at once
+#define RetransmitTime	(2 * (WindowSize + 1) * NetworkTime)
+					// how long to wait for an ack
+#define ReceiveBufferSize	(4 * WindowSize * MaxSegmentSize)
+					// bytes arrived, not yet Received
+
+// The following class defines the header a Connection puts in front
+// of the data in each packet it sends.
+
+class TransportHeader {
+  public:
+    int seq;			// number of this data packet, or -1 if
+    				// it is only an acknowledgement
+    int ack;			// next data packet expected in return
+};
+
+#define MaxSegmentSize	((int) (MaxFragmentSize - sizeof(TransportHeader)))
+				// data in one packet: a lost packet
+				// costs only its own resending
+
+// The following class defines one end of a connection, between
+// mailbox "localBox" here and "farBox" on machine "farHost".
+
+class Connection : public MailHandler, public CallBackObj {
+  public:
+    Connection(int localBox, NetworkAddress farHost, int farBox);
+    ~Connection();		// Wait for what was sent to be acked
+
+    void Send(char *data, int length);
+    				// Send "length" bytes; returns once the
+				// last of them is in flight
+    int Receive(char *data, int size);
+    				// Wait for bytes to arrive, and copy up
+				// to "size" of them; returns how many
+    void Flush();		// Wait until everything sent is acked
+
+    void Deliver(PacketHeader pktHdr, MailHeader mailHdr, char *data);
+    				// A packet has arrived at "localBox"
+    void CallBack();		// The retransmit timer has gone off
+
+  private:
+    int localBox;
+    NetworkAddress farHost;
+    int farBox;
+
+    Lock *lock;			// held while the state below changes
+    Condition *changed;		// broadcast when packets are acked, or
+    				// bytes arrive
+
+    char window[WindowSize][MaxSegmentSize];
+    int windowLength[WindowSize];
+    				// packets in flight, by number mod
+				// WindowSize
+    int sendBase;		// oldest packet not yet acked
+    int nextSeq;		// number of the next packet sent
+    int lastProgress;		// when a packet was last sent again, or
+    				// acked
+    bool timerSet;		// is CallBack to be called?
+
+    char received[ReceiveBufferSize];
+    				// bytes arrived, in order, a ring
+    int receivedHead;		// the next to Receive
+    int receivedCount;		// how many there are
+    int expected;		// next data packet from the far end
+
+    void Transmit(int seq);	// Send packet "seq" (or, if -1, an ack)
+    void SetTimer();		// Have CallBack called in RetransmitTime
+    static void Retransmit(void *data);
+    				// Send every packet in flight again
+};
+
+#endif // TRANSPORT_H
@@ -1,8 +1,7 @@
 // alarm.cc
 //	Routines to use a hardware timer device to provide a
-//	software alarm clock.  For now, we just provide time-slicing.
-//
-//	Not completely implemented.
+//	software alarm clock: time-slicing, and putting threads to
+//	sleep for a while.
 //
 // Copyright (c) 1992-1996 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
@@ -11,6 +10,21 @@
 #include "copyright.h"
 #include "alarm.h"
 #include "main.h"
+#include "sysdep.h"
+#include "synchdisk.h"
+
+//----------------------------------------------------------------------
+// WakeCompare
+//	Compare two sleeping threads by when they are to wake up.
+//----------------------------------------------------------------------
+
+static int
+WakeCompare(Thread *x, Thread *y)
+{
+    if (x->wakeTime < y->wakeTime) { return -1; }
+    else if (x->wakeTime > y->wakeTime) { return 1; }
+    else { return 0; }
+}
 
 //----------------------------------------------------------------------
 // Alarm::Alarm
@@ -18,11 +32,77 @@
 //
 //      "doRandom" -- if true, arrange for the hardware interrupts to 
 //		occur at random, instead of fixed, intervals.
+//	"isTickless" -- if true, only when something is due (see alarm.h)
 //----------------------------------------------------------------------
 
-Alarm::Alarm(bool doRandom)
+Alarm::Alarm(bool doRandom, bool isTickless)
 {
+    randomize = doRandom;
+    tickless = isTickless;
+    ticking = TRUE;
+    lastTick = 0;
+    sleepers = new SortedList<Thread *>(WakeCompare);
     timer = new Timer(doRandom, this);
+    if (tickless)
+	timer->SetNext(Interval());
+}
+
+//----------------------------------------------------------------------
+// Alarm::~Alarm
+//	Nachos is halting; any thread still asleep is never woken.
+//----------------------------------------------------------------------
+
+Alarm::~Alarm()
+{
+    delete timer;
+    delete sleepers;
+}
+
+//----------------------------------------------------------------------
+// Alarm::Interval
+//      Tickless mode: return how many ticks from now the next timer
+//	interrupt should be: the running thread's quantum (or a random
+//	time averaging it) if another thread is waiting for the CPU,
+//	else the time to the first sleeper's wakeup, but no more than
+//	TicklessMaxTicks.
+//----------------------------------------------------------------------
+
+int
+Alarm::Interval()
+{
+    int quantum, delay;
+
+    if (!kernel->scheduler->NeedsSlice()) {
+	delay = TicklessMaxTicks;
+	if (!sleepers->IsEmpty())
+	    delay = min(delay, sleepers->Front()->wakeTime
+				- kernel->stats->totalTicks);
+	return max(delay, 1);
+    }
+    quantum = TimerTicks * kernel->scheduler->Quantum(kernel->currentThread);
+    if (randomize)
+	return 1 + (RandomNumber() % (quantum * 2));
+    return quantum;
+}
+
+//----------------------------------------------------------------------
+// Alarm::Reprogram
+//      In tickless mode, a thread has become ready, or gone to sleep,
+//	so the clock may be due sooner than it was set for: if so, set
+//	the timer again.  Called with interrupts off.
+//----------------------------------------------------------------------
+
+void
+Alarm::Reprogram()
+{
+    int delay, due;
+
+    if (!tickless || !ticking)
+	return;
+    delay = Interval();
+    due = timer->NextDue();
+    if (due == -1 || kernel->stats->totalTicks + delay < due)
+	timer->SetNext(delay);
 }
 
 //----------------------------------------------------------------------
@@ -32,6 +112,10 @@ Alarm::Alarm(bool doRandom)
 //	This routine is called each time there is a timer interrupt,
 //	with interrupts disabled.
 //
+//	First wake up every sleeping thread whose time has come; they
+//	are at the front of the list, so this costs only the threads
+//	woken.
+//
 //	Note that instead of calling Yield() directly (which would
 //	suspend the interrupt handler, not the interrupted thread
 //	which is what we wanted to context switch), we set a flag
@@ -39,8 +123,12 @@ Alarm::Alarm(bool doRandom)
 //	if the interrupted thread called Yield at the point it is 
 //	was interrupted.
 //
-//	For now, just provide time-slicing.  Only need to time slice 
-//      if we're currently running something (in other words, not idle).
+//	Only need to time slice if we're currently running something
+//	(in other words, not idle), and then only when the scheduler
+//	says the running thread's quantum is up.  In tickless mode,
+//	not if no other thread was waiting for the CPU either; and
+//	the interrupt may stand for several TimerTicks, all of which
+//	are charged to the running thread.
 //----------------------------------------------------------------------
 
 void 
@@ -48,8 +136,105 @@ Alarm::CallBack()
 {
     Interrupt *interrupt = kernel->interrupt;
     MachineStatus status = interrupt->getStatus();
+    int now = kernel->stats->totalTicks;
+    int slices = 1;
     
-    if (status != IdleMode) {
+    if (tickless) {
+	slices = max((now - lastTick) / TimerTicks, 1);
+	if (!kernel->scheduler->NeedsSlice())
+	    status = IdleMode;		// no one to switch to
+    }
+    lastTick = now;
+    while (!sleepers->IsEmpty() && sleepers->Front()->wakeTime <= now) {
+	Thread *thread = sleepers->RemoveFront();
+
+	DEBUG(dbgThread, "Alarm waking thread: " << thread->getName());
+	kernel->scheduler->ReadyToRun(thread);
+    }
+
+    if (status != IdleMode && kernel->scheduler->TimeSlice(slices)) {
 	interrupt->YieldOnReturn();
     }
+
+    // MP4 MODIFIED
+    // give the disk cache's flusher a chance to run
+    kernel->synchDisk->CheckFlush();
+
+    if (tickless && ticking)
+	timer->SetNext(Interval());
+}
+
+//----------------------------------------------------------------------
+// Alarm::WaitUntil
+//	Put the current thread to sleep for at least "x" ticks.  It goes
+//	on the list of sleepers, and the first timer interrupt from then
+//	on puts it back on the ready list.
+//----------------------------------------------------------------------
+
+void
+Alarm::WaitUntil(int x)
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+    Thread *thread = kernel->currentThread;
+
+    ASSERT(x >= 0);
+    thread->wakeTime = kernel->stats->totalTicks + x;
+    DEBUG(dbgThread, "Alarm sleeping thread: " << thread->getName()
+		<< " until " << thread->wakeTime);
+    sleepers->Insert(thread);
+    Resume();				// someone has to wake it up
+    Reprogram();			// and maybe sooner than set for
+    thread->Sleep(FALSE);
+    (void) kernel->interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// Alarm::Cancel
+//	Something other than the clock is waking "thread", which is in
+//	WaitUntil: take it off the list of sleepers, so the clock doesn't
+//	wake it again.  Return FALSE if the clock already has, in which
+//	case the caller mustn't.  Called with interrupts off.
+//----------------------------------------------------------------------
+
+bool
+Alarm::Cancel(Thread *thread)
+{
+    ASSERT(kernel->interrupt->getLevel() == IntOff);
+    if (!sleepers->IsInList(thread))
+	return FALSE;
+    sleepers->Remove(thread);
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Alarm::Disable
+//	Nothing is runnable: stop the clock, so that an idle machine
+//	isn't interrupted for nothing, unless a thread is asleep and
+//	needs the clock to wake it up.  The interrupt already scheduled
+//	still happens, but no more after it.
+//----------------------------------------------------------------------
+
+void
+Alarm::Disable()
+{
+    if (sleepers->IsEmpty()) {
+	ticking = FALSE;
+	timer->Disable();
+    }
+}
+
+//----------------------------------------------------------------------
+// Alarm::Resume
+//	A thread is about to run: start the clock again if it was
+//	stopped, so time-slicing carries on.
+//----------------------------------------------------------------------
+
+void
+Alarm::Resume()
+{
+    if (ticking)
+	return;
+    ticking = TRUE;
+    timer->Enable();
+    Reprogram();			// tickless: maybe sooner
 }
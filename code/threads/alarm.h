@@ -8,7 +8,20 @@
 //	From this, we provide the ability for a thread to be
 //	woken up after a delay; we also provide time-slicing.
 //
-//	NOTE: this abstraction is not completely implemented.
+//	Sleeping threads are kept on a list sorted by when they are to
+//	wake up, so each timer interrupt only looks at the ones that
+//	are due.  When nothing is runnable and nothing is asleep, the
+//	clock stops, so an idle machine isn't interrupted every
+//	TimerTicks; it starts again when a thread next gets the CPU.
+//
+//	In tickless mode ("-tl"), the clock isn't programmed to go off
+//	every TimerTicks, but only when something is due: at the end of
+//	the running thread's quantum (see Scheduler::Quantum), if there
+//	is a thread waiting for the CPU, or else when the first sleeper
+//	is to wake, and at least every TicklessMaxTicks, so the disk
+//	cache still gets flushed.  A thread becoming ready, or going to
+//	sleep, may need the clock sooner than it was set for; the timer
+//	is then set again (see Timer::SetNext).
 //
 // Copyright (c) 1992-1996 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
@@ -20,23 +33,42 @@
 #include "copyright.h"
 #include "utility.h"
 #include "callback.h"
+#include "list.h"
+#include "thread.h"
 #include "timer.h"
 
+#define TicklessMaxTicks	(100 * TimerTicks)
+					// longest the clock is left alone
+					// in tickless mode
+
 // The following class defines a software alarm clock. 
 class Alarm : public CallBackObj {
   public:
-    Alarm(bool doRandomYield);	// Initialize the timer, and callback 
+    Alarm(bool doRandomYield, bool isTickless = FALSE);
+    				// Initialize the timer, and callback 
 				// to "toCall" every time slice.
-    ~Alarm() { delete timer; }
+    ~Alarm();
     
-    void WaitUntil(int x);	// suspend execution until time > now + x
-                                // this method is not yet implemented
+    void WaitUntil(int x);	// suspend execution until time >= now + x
+    bool Cancel(Thread *thread);	// Take "thread" out of WaitUntil early;
+    				// FALSE if it has already been woken
 	
-	void Disable() { timer->Disable(); } //2015.11.25
+	void Disable();		// Stop the clock, unless a thread is
+				// asleep //2015.11.25
+    void Resume();		// Start it again, if it was stopped
+    void Reprogram();		// Tickless: the clock may be due sooner
 
   private:
     Timer *timer;		// the hardware timer device
+    bool randomize;		// interrupt at random intervals
+    bool tickless;		// interrupt only when something is due
+    bool ticking;		// FALSE once the clock has been stopped
+    int lastTick;		// when the timer last went off
+    SortedList<Thread *> *sleepers;	// threads in WaitUntil, the
+    					// first to wake at the front
 
+    int Interval();		// tickless: ticks until the next
+				// timer interrupt should be
     void CallBack();		// called when the hardware
 				// timer generates an interrupt
 };
@@ -0,0 +1,132 @@
+// contention.cc
+//	Routines to count how long threads wait on each kind of lock,
+//	semaphore and condition variable.  See contention.h.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "contention.h"
+#include "debug.h"
+
+static char *kindNames[] = { "semaphore", "lock", "condition" };
+
+//----------------------------------------------------------------------
+// ClearCounts
+// 	Start "c" counting for "name".
+//----------------------------------------------------------------------
+
+static void
+ClearCounts(SynchCounts *c, SynchKind kind, char *name)
+{
+    c->name = name;
+    c->kind = kind;
+    c->acquires = c->contended = c->waitTicks = c->maxWait = 0;
+    c->maxHolder[0] = '\0';
+    c->maxHolder[ThreadNameLen - 1] = '\0';
+}
+
+//----------------------------------------------------------------------
+// SynchCounts::Waited
+// 	Count an acquire that had to wait "ticks", for "holder" ("" if
+//	it isn't a lock).
+//----------------------------------------------------------------------
+
+void
+SynchCounts::Waited(int ticks, const char *holder)
+{
+    contended++;
+    waitTicks += ticks;
+    if (ticks > maxWait) {
+	maxWait = ticks;
+	strncpy(maxHolder, holder, ThreadNameLen - 1);
+    }
+}
+
+//----------------------------------------------------------------------
+// ContentionProfile::ContentionProfile
+// 	No names yet; the last slot counts every name after the table
+//	fills up.
+//----------------------------------------------------------------------
+
+ContentionProfile::ContentionProfile()
+{
+    numCounts = 0;
+    ClearCounts(&counts[MaxContentionNames], SynchSemaphore, "(others)");
+}
+
+//----------------------------------------------------------------------
+// ContentionProfile::Find
+// 	Return the counts for objects of "kind" named "name", starting
+//	them if this is the first.  Called when such an object is made,
+//	so the search is not on any path that waits.
+//----------------------------------------------------------------------
+
+SynchCounts *
+ContentionProfile::Find(SynchKind kind, char *name)
+{
+    if (name == NULL)
+	name = "(unnamed)";
+    for (int i = 0; i < numCounts; i++) {
+	if (counts[i].kind == kind && (counts[i].name == name
+				       || strcmp(counts[i].name, name) == 0))
+	    return &counts[i];
+    }
+    if (numCounts == MaxContentionNames)
+	return &counts[MaxContentionNames];
+    ClearCounts(&counts[numCounts], kind, name);
+    return &counts[numCounts++];
+}
+
+//----------------------------------------------------------------------
+// ContentionProfile::Print
+// 	Print the ContentionTop names waited on the longest, in all, and
+//	how many others were acquired without ever waiting.
+//----------------------------------------------------------------------
+
+void
+ContentionProfile::Print()
+{
+    bool printed[MaxContentionNames + 1];
+    int numWaited = 0;
+    int numFree = 0;
+
+    for (int i = 0; i <= numCounts; i++) {
+	SynchCounts *c = (i == numCounts) ? &counts[MaxContentionNames]
+					 : &counts[i];
+
+	printed[i] = FALSE;
+	if (c->contended > 0)
+	    numWaited++;
+	else if (c->acquires > 0)
+	    numFree++;
+    }
+
+    cout << "Synchronization waits, longest first:\n";
+    for (int n = 0; n < ContentionTop && n < numWaited; n++) {
+	SynchCounts *c = NULL;
+	int best = -1;
+
+	for (int i = 0; i <= numCounts; i++) {
+	    SynchCounts *t = (i == numCounts) ? &counts[MaxContentionNames]
+					     : &counts[i];
+
+	    if (!printed[i] && t->contended > 0
+		&& (c == NULL || t->waitTicks > c->waitTicks)) {
+		c = t;
+		best = i;
+	    }
+	}
+	printed[best] = TRUE;
+	cout << "  " << kindNames[c->kind] << " \"" << c->name << "\": ";
+	cout << c->acquires << " acquires, " << c->contended << " waited, ";
+	cout << c->waitTicks << " ticks (max " << c->maxWait;
+	if (c->maxHolder[0] != '\0')
+	    cout << ", held by " << c->maxHolder;
+	cout << ")\n";
+    }
+    if (numWaited > ContentionTop)
+	cout << "  " << (numWaited - ContentionTop) << " more names waited on\n";
+    cout << "  " << numFree << " names acquired without waiting\n";
+}
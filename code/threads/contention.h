@@ -0,0 +1,72 @@
+// contention.h
+//	Data structures for finding out which locks, semaphores and
+//	condition variables threads wait on, and for how long.
+//
+//	With -lc, each synchronization object counts what happens to it
+//	under its debug name, so that all the objects made with the same
+//	name (every open file's lock, say) are counted together: how
+//	often it was acquired (P, Acquire, or Wait), how often that had
+//	to wait, and the ticks spent waiting, in all and at most.  For a
+//	lock, the thread that held it when the longest wait began is
+//	kept too.  The names are printed at halt, those waited on the
+//	longest first.
+//
+//	An object finds its counts by name once, when it is made;
+//	without -lc, it has none, and counting costs a test of a
+//	pointer.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef CONTENTION_H
+#define CONTENTION_H
+
+#include "copyright.h"
+#include "utility.h"
+#include "stats.h"
+
+#define MaxContentionNames	128	// names counted apart; the rest
+					// are lumped together
+#define ContentionTop		20	// names printed
+
+// What kind of object a name was given to.
+
+enum SynchKind { SynchSemaphore, SynchLock, SynchCondition };
+
+// The following class defines the counts kept for one name.
+
+class SynchCounts {
+  public:
+    char *name;			// the debug name
+    SynchKind kind;
+    int acquires;		// P, Acquire or Wait calls,
+    int contended;		// those that waited,
+    int waitTicks;		// how long they waited in all,
+    int maxWait;		// and at most
+    char maxHolder[ThreadNameLen];	// for a lock, who held it in
+    					// that wait
+
+    void Waited(int ticks, const char *holder);
+    				// A contended acquire, that waited for
+				// "holder", just ended
+};
+
+// The following class defines the counts of every name.
+
+class ContentionProfile {
+  public:
+    ContentionProfile();
+
+    SynchCounts *Find(SynchKind kind, char *name);
+    				// The counts for "name", added the
+				// first time
+    void Print();		// Print the names waited on longest
+
+  private:
+    SynchCounts counts[MaxContentionNames + 1];	// by name, as they
+    						// come, then the rest
+    int numCounts;		// names so far
+};
+
+#endif // CONTENTION_H
@@ -15,8 +15,16 @@
 #include "libtest.h"
 #include "string.h"
 #include "synchdisk.h"
+#include "iotrace.h"
+#include "workpool.h"
 #include "post.h"
 #include "synchconsole.h"
+#include "profile.h"
+#include "pager.h"
+#include "futex.h"
+#include "kregion.h"
+#include "contention.h"
+#include "proctable.h"
 
 //----------------------------------------------------------------------
 // Kernel::Kernel
@@ -27,18 +35,60 @@
 Kernel::Kernel(int argc, char **argv)
 {
     randomSlice = FALSE; 
+    tickless = FALSE;
     debugUserProg = FALSE;
+    blockEngine = FALSE;
+    quietAdd = FALSE;
+    codeCacheName = NULL;      // default is to decode afresh each run
+    tlbEntries = 0;            // default is the page table (or,
+    tlbWays = 0;               // with USE_TLB, a small TLB)
+    tlbTagged = FALSE;
+    tlbClock = FALSE;          // default is LRU replacement
+    faultAround = DefaultFaultAround;
+    profilePeriod = 0;         // default is not to profile
+    profileKernel = FALSE;
+    regions = NULL;
+    profileLocks = FALSE;
+    contention = NULL;
+    checkpointAt = -1;         // default is not to checkpoint
+    checkpointName = NULL;
+    restoreName = NULL;
     consoleIn = NULL;          // default is stdin
     consoleOut = NULL;         // default is stdout
+    diskPolicy = NULL;         // default is C-SCAN
+    diskModel = NULL;          // default is the rotating disk
+    schedPolicy = NULL;        // default is FIFO
+    numWorkers = DefaultWorkers;
+    numCPUs = 1;
+    hostJobs = 1;              // default is to run everything here
+    flushWindow = DefaultFlushWindow;
+    numDisks = 1;              // default is a single disk, DISK_<hostName>
+    diskBase = NULL;           // default is a disk of its own
+    hostJob = -1;
+    job = NULL;
+    numArgs = argc;
+    args = argv;
+    traceName = NULL;          // default is not to trace the disk
+    printStats = FALSE;
+    statsName = NULL;
+    sampleInterval = 0;        // default is totals only
 #ifndef FILESYS_STUB
     formatFlag = FALSE;
+    formatSectors = NumSectors;	// default is the whole disk
+    buildFlag = FALSE;
 #endif
     reliability = 1;            // network reliability, default is 1.0
     hostName = 0;               // machine id, also UNIX socket name
                                 // 0 is the default machine id
+    clusterSize = 0;		// default is not to keep in step
 								
 	// MP4 mod tag
 	execfileNum = 0; // dummy operation to keep valgrind happy
+	execfile = new char *[argc];	// there can't be more -e's
+	execPriority = new int[argc];
+	execIds = new int[argc];
+	for (int i = 0; i < argc; i++)
+		execIds[i] = -1;
 								
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-rs") == 0) {
@@ -49,9 +99,80 @@ Kernel::Kernel(int argc, char **argv)
 	    	i++;
         } else if (strcmp(argv[i], "-s") == 0) {
             debugUserProg = TRUE;
+        } else if (strcmp(argv[i], "-bb") == 0) {
+            blockEngine = TRUE;
+        } else if (strcmp(argv[i], "-dc") == 0) {
+	    ASSERT(i + 1 < argc);
+	    codeCacheName = argv[++i];
+        } else if (strcmp(argv[i], "-tlb") == 0) {
+            ASSERT(i + 2 < argc);
+            tlbEntries = atoi(argv[++i]);
+            tlbWays = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-tlbr") == 0) {
+            ASSERT(i + 1 < argc);
+            i++;
+            ASSERT(strcmp(argv[i], "lru") == 0
+                   || strcmp(argv[i], "clock") == 0);
+            tlbClock = (strcmp(argv[i], "clock") == 0);
+        } else if (strcmp(argv[i], "-asid") == 0) {
+            tlbTagged = TRUE;
+        } else if (strcmp(argv[i], "-fa") == 0) {
+            ASSERT(i + 1 < argc);
+            faultAround = atoi(argv[++i]);
+            ASSERT(faultAround >= 0);
+        } else if (strcmp(argv[i], "-pf") == 0) {
+            ASSERT(i + 1 < argc);
+            profilePeriod = atoi(argv[++i]);
+            ASSERT(profilePeriod > 0);
+        } else if (strcmp(argv[i], "-kp") == 0) {
+            profileKernel = TRUE;
+        } else if (strcmp(argv[i], "-lc") == 0) {
+            profileLocks = TRUE;
+        } else if (strcmp(argv[i], "-ckpt") == 0) {
+	    ASSERT(i + 2 < argc);
+	    checkpointAt = atoi(argv[++i]);
+	    checkpointName = argv[++i];
+        } else if (strcmp(argv[i], "-restore") == 0) {
+	    ASSERT(i + 1 < argc);
+	    restoreName = argv[++i];
 		} else if (strcmp(argv[i], "-e") == 0) {
         	execfile[++execfileNum]= argv[++i];
+        	execPriority[execfileNum] = DefaultPriority;
+			cout << execfile[execfileNum] << "\n";
+		} else if (strcmp(argv[i], "-ep") == 0) {
+	    	ASSERT(i + 2 < argc);
+        	execPriority[++execfileNum] = atoi(argv[++i]);
+	    	ASSERT(execPriority[execfileNum] >= 0 &&
+	    		execPriority[execfileNum] < NumPriorities);
+        	execfile[execfileNum]= argv[++i];
 			cout << execfile[execfileNum] << "\n";
+		} else if (strcmp(argv[i], "-wk") == 0) {
+	    	ASSERT(i + 1 < argc);
+	    	numWorkers = atoi(argv[i + 1]);
+	    	ASSERT(numWorkers >= 1);
+	    	i++;
+		} else if (strcmp(argv[i], "-np") == 0) {
+	    	ASSERT(i + 1 < argc);
+	    	numCPUs = atoi(argv[i + 1]);
+	    	ASSERT(numCPUs >= 1 && numCPUs <= MaxCPUs);
+	    	i++;
+#ifdef FILESYS_STUB
+		} else if (strcmp(argv[i], "-hj") == 0) {
+	    	ASSERT(i + 1 < argc);
+	    	hostJobs = atoi(argv[i + 1]);
+	    	ASSERT(hostJobs >= 1);
+	    	i++;
+#endif
+		} else if (strcmp(argv[i], "-tp") == 0) {
+	    	ASSERT(i + 1 < argc);
+	    	Thread::SetStackPool(atoi(argv[i + 1]));
+	    	i++;
+		} else if (strcmp(argv[i], "-sp") == 0) {
+	    	ASSERT(i + 1 < argc);
+	    	schedPolicy = argv[i + 1];
+	    	i++;
+		} else if (strcmp(argv[i], "-tl") == 0) {
+	    	tickless = TRUE;
 		} else if (strcmp(argv[i], "-ci") == 0) {
 	    	ASSERT(i + 1 < argc);
 	    	consoleIn = argv[i + 1];
@@ -60,9 +181,59 @@ Kernel::Kernel(int argc, char **argv)
 	    	ASSERT(i + 1 < argc);
 	    	consoleOut = argv[i + 1];
 	    	i++;
+		} else if (strcmp(argv[i], "-ds") == 0) {
+	    	ASSERT(i + 1 < argc);
+	    	diskPolicy = argv[i + 1];
+	    	i++;
+		} else if (strcmp(argv[i], "-dm") == 0) {
+	    	ASSERT(i + 1 < argc);
+	    	diskModel = argv[i + 1];
+	    	i++;
+		} else if (strcmp(argv[i], "-fw") == 0) {
+	    	ASSERT(i + 1 < argc);
+	    	flushWindow = atoi(argv[i + 1]);
+	    	i++;
+		} else if (strcmp(argv[i], "-nd") == 0) {
+	    	ASSERT(i + 1 < argc);
+	    	numDisks = atoi(argv[i + 1]);
+	    	ASSERT(numDisks >= 1 && numDisks <= MaxDisks);
+	    	i++;
+		} else if (strcmp(argv[i], "-db") == 0) {
+	    	ASSERT(i + 1 < argc);
+	    	diskBase = argv[i + 1];
+	    	i++;
+		} else if (strcmp(argv[i], "-trace") == 0) {
+	    	ASSERT(i + 1 < argc);
+	    	traceName = argv[i + 1];
+	    	i++;
+		} else if (strcmp(argv[i], "-ps") == 0) {
+	    	printStats = TRUE;
+		} else if (strcmp(argv[i], "-json") == 0) {
+	    	ASSERT(i + 1 < argc);
+	    	statsName = argv[i + 1];
+	    	i++;
+		} else if (strcmp(argv[i], "-stats") == 0) {
+	    	ASSERT(i + 1 < argc);
+	    	ASSERT(strncmp(argv[i + 1], "json:", 5) == 0);
+	    	statsName = argv[i + 1] + 5;	// the only format there is
+	    	i++;
+		} else if (strcmp(argv[i], "-si") == 0) {
+	    	ASSERT(i + 1 < argc);
+	    	sampleInterval = atoi(argv[i + 1]);
+	    	ASSERT(sampleInterval > 0);
+	    	i++;
 #ifndef FILESYS_STUB
 		} else if (strcmp(argv[i], "-f") == 0) {
 	    	formatFlag = TRUE;
+		} else if (strcmp(argv[i], "-fsize") == 0) {
+	    	ASSERT(i + 1 < argc);
+	    	formatSectors = atoi(argv[i + 1]);
+	    	i++;
+		} else if (strcmp(argv[i], "-build") == 0) {
+	    	ASSERT(i + 1 < argc);	// the manifest is main's business
+	    	buildFlag = TRUE;
+	    	formatFlag = TRUE;
+	    	i++;
 #endif
         } else if (strcmp(argv[i], "-n") == 0) {
             ASSERT(i + 1 < argc);   // next argument is float
@@ -72,14 +243,31 @@ Kernel::Kernel(int argc, char **argv)
             ASSERT(i + 1 < argc);   // next argument is int
             hostName = atoi(argv[i + 1]);
             i++;
+        } else if (strcmp(argv[i], "-cl") == 0) {
+            ASSERT(i + 1 < argc);   // next argument is int
+            clusterSize = atoi(argv[i + 1]);
+            i++;
         } else if (strcmp(argv[i], "-u") == 0) {
             cout << "Partial usage: nachos [-rs randomSeed]\n";
-	   		cout << "Partial usage: nachos [-s]\n";
+	   		cout << "Partial usage: nachos [-s] [-bb] [-dc codeCache]\n";
+	    	cout << "Partial usage: nachos [-tlb entries ways] [-tlbr lru|clock] [-asid]\n";
+	    	cout << "Partial usage: nachos [-fa pages] [-pf samplePeriod] [-kp] [-lc]\n";
+	    	cout << "Partial usage: nachos [-sp fifo|priority|mlfq|sjf|srtf] [-np cpus] [-tl]\n";
+	    	cout << "Partial usage: nachos [-ep priority file] [-tp stacks] [-wk workers]\n";
+#ifdef FILESYS_STUB
+	    	cout << "Partial usage: nachos [-hj hostJobs]\n";
+#endif
+	    	cout << "Partial usage: nachos [-ckpt tick hostFile] [-restore hostFile]\n";
             cout << "Partial usage: nachos [-ci consoleIn] [-co consoleOut]\n";
+	    	cout << "Partial usage: nachos [-ds fifo|sstf|cscan] [-fw ticks]\n";
+	    	cout << "Partial usage: nachos [-dm hdd|ssd|ram]\n";
+	    	cout << "Partial usage: nachos [-nd numDisks] [-db baseDir] [-trace traceFile]\n";
+	    	cout << "Partial usage: nachos [-ps] [-json statsFile] [-stats json:statsFile]\n";
+	    	cout << "Partial usage: nachos [-si sampleTicks]\n";
 #ifndef FILESYS_STUB
-	    	cout << "Partial usage: nachos [-nf]\n";
+	    	cout << "Partial usage: nachos [-nf] [-fsize sectors]\n";
 #endif
-            cout << "Partial usage: nachos [-n #] [-m #]\n";
+            cout << "Partial usage: nachos [-n #] [-m #] [-cl #]\n";
 		}
     }
 }
@@ -99,21 +287,60 @@ Kernel::Initialize()
     // object to save its state. 
 
 	
-    currentThread = new Thread("main", threadNum++);		
+    stats = new Statistics();		// collect statistics, first, since
+    					// threads account their time in it
+    if (sampleInterval > 0)
+	stats->StartTimeline(sampleInterval);
+    if (profileKernel)
+	regions = new RegionProfile();
+    if (profileLocks)			// before any lock is made
+	contention = new ContentionProfile();
+    if (hostJobs > 1 && execfileNum > 1 && job == NULL) {
+#ifndef FILESYS_STUB
+	ASSERT(diskBase != NULL);	// each job needs a disk of its own
+#endif
+	if (hostJobs > execfileNum)
+	    hostJobs = execfileNum;
+	StartHostJobs(hostJobs);	// doesn't return
+    }
+    processes = new ProcessTable();	// before any thread has an ID
+    currentThread = new Thread("main", processes->NewID());
     currentThread->setStatus(RUNNING);
+    joinLock = new Lock("join");
+    threadEnded = new Condition("join");
 
-    stats = new Statistics();		// collect statistics
     interrupt = new Interrupt;		// start up interrupt handling
-    scheduler = new Scheduler();	// initialize the ready queue
-    alarm = new Alarm(randomSlice);	// start up time slicing
-    machine = new Machine(debugUserProg);
+    scheduler = new Scheduler(schedPolicy, numCPUs);
+    					// initialize the ready queues
+    alarm = new Alarm(randomSlice, tickless);	// start up time slicing
+    machine = new Machine(debugUserProg, blockEngine);
+    if (tlbEntries > 0 || tlbTagged) {
+	if (tlbEntries == 0) {		// -asid alone tags the default TLB
+	    tlbEntries = TLBSize;
+	    tlbWays = TLBWays;
+	}
+	machine->SetTLB(tlbEntries, tlbWays, tlbTagged);
+    }
+    if (codeCacheName != NULL)
+	machine->UseCodeCache(codeCacheName);
+    if (profilePeriod > 0)
+	machine->profiler = new Profiler(profilePeriod);
+    pager = new Pager();		// user pages are given frames
+    					// as they are touched
+    futexes = new FutexTable();
     synchConsoleIn = new SynchConsoleInput(consoleIn); // input from stdin
     synchConsoleOut = new SynchConsoleOutput(consoleOut); // output to stdout
-    synchDisk = new SynchDisk();    //
+    ioTrace = (traceName != NULL) ? new IOTrace(traceName) : NULL;
+    workers = new WorkerPool(numWorkers);	// before the disk uses them
+#ifdef FILESYS_STUB
+    synchDisk = new SynchDisk(diskPolicy, flushWindow, FALSE, numDisks);
+#else
+    synchDisk = new SynchDisk(diskPolicy, flushWindow, buildFlag, numDisks);
+#endif
 #ifdef FILESYS_STUB
     fileSystem = new FileSystem();
 #else
-    fileSystem = new FileSystem(formatFlag);
+    fileSystem = new FileSystem(formatFlag, formatSectors);
 #endif // FILESYS_STUB
 
 	// MP4 mod tag
@@ -146,15 +373,42 @@ Kernel::PrepareToEnd()
 
 Kernel::~Kernel()
 {
+    // the file system and disk go first, since flushing the disk
+    // cache still needs the interrupt and scheduler machinery; the
+    // pager before them, to remove the swap file
+    delete futexes;
+    delete pager;
+    delete fileSystem;
+    delete synchDisk;
+    delete ioTrace;			// after the last flush
+    currentThread->RecordTimes();	// it won't be deleted
+    if (job != NULL)
+	WriteJobReport();
+    if (printStats)
+	stats->Print();
+    if (statsName != NULL)
+	stats->WriteJSON(statsName);
+    if (machine->profiler != NULL)
+	machine->profiler->Print();
+    if (regions != NULL)
+	regions->Print();
+    delete regions;
+    if (contention != NULL)
+	contention->Print();
     delete stats;
     delete interrupt;
     delete scheduler;
     delete alarm;
     delete machine;
+    delete threadEnded;
+    delete joinLock;
+    delete processes;
+    delete [] execfile;
+    delete [] execPriority;
+    delete [] execIds;
     delete synchConsoleIn;
     delete synchConsoleOut;
-    delete synchDisk;
-    delete fileSystem;
+    Thread::SetStackPool(0);		// free the stacks kept for reuse
 	
 	// Mp4 mod tag
 	/*
@@ -162,6 +416,8 @@ Kernel::~Kernel()
     delete postOfficeOut;
     */
 	
+    if (job != NULL)			// a host job: back to RunHostJob,
+	longjmp(job->halted, 1);	// on its host thread's own stack
     Exit(0);
 }
 
@@ -174,6 +430,7 @@ void
 Kernel::ThreadSelfTest() {
    Semaphore *semaphore;
    SynchList<int> *synchList;
+   BoundedSynchList<int> *boundedList;
    
    LibSelfTest();		// test library routines
    
@@ -189,6 +446,9 @@ Kernel::ThreadSelfTest() {
    synchList = new SynchList<int>;
    synchList->SelfTest(9);
    delete synchList;
+   boundedList = new BoundedSynchList<int>;
+   boundedList->SelfTest(9);
+   delete boundedList;
 
 }
 
@@ -210,6 +470,7 @@ Kernel::ConsoleTest() {
         ch = synchConsoleIn->GetChar();
         if(ch != EOF) synchConsoleOut->PutChar(ch);   // echo it!
     } while (ch != EOF);
+    synchConsoleOut->Flush();
 
     cout << "\n";
 
@@ -284,24 +545,383 @@ void ForkExecute(Thread *t)
 
 }
 
+void ForkRestore(Thread *t)
+{
+    int registers[NumTotalRegs];
+
+    if (!t->space->Restore(t->getName(), registers))
+	return;			// not a checkpoint, or of another program
+    t->space->Resume(registers);
+}
+
 void Kernel::ExecAll()
 {
+	if (restoreName != NULL)
+		Exec(restoreName, DefaultPriority, TRUE);
 	for (int i=1;i<=execfileNum;i++) {
-		int a = Exec(execfile[i]);
+		if (hostJob < 0)
+			Exec(execfile[i], execPriority[i]);
+		else if ((i - 1) % hostJobs == hostJob)	// this job's share,
+			execIds[i] = StartProgram(execfile[i],	// kept for
+				execPriority[i], FALSE, TRUE);	// its report
 	}
 	currentThread->Finish();
     //Kernel::Exec();	
 }
 
 
-int Kernel::Exec(char* name)
+//----------------------------------------------------------------------
+// Kernel::StartHostJobs
+// 	Split the programs to run over "jobs" host threads, so that a
+//	batch of independent programs uses more than one host CPU.  Each
+//	thread runs a kernel of its own, made from the same command line
+//	(see RunHostJob), which runs every jobs'th program (see ExecAll);
+//	"kernel", and the little other state kept outside the kernel, is
+//	HostThreadLocal, so the kernels share nothing, and need no lock.
+//	Their statistics are their own, and go to the -json file with
+//	".<job>" added.  This thread only waits for them all, and reports
+//	on the batch (see ReportHostJobs).
+//
+//	With the stub file system, the programs' files are UNIX files,
+//	shared by all the jobs.  With the Nachos file system, each job
+//	has a disk of its own, a copy-on-write overlay (-db, which it
+//	needs) of the one image, thrown away when the job ends.  The swap
+//	file is the job's own either way.
+//
+//	Called before the disk and swap files are opened, and doesn't
+//	return.
+//----------------------------------------------------------------------
+
+void
+Kernel::StartHostJobs(int jobs)
+{
+	HostJob *batch = new HostJob[jobs];
+	int *state = new int[execfileNum + 1];
+	int *status = new int[execfileNum + 1];
+
+	for (int i = 1; i <= execfileNum; i++) {
+		state[i] = 1;
+		status[i] = 0;
+	}
+	for (int j = 0; j < jobs; j++) {
+		batch[j].index = j;
+		batch[j].count = jobs;
+		batch[j].argc = numArgs;
+		batch[j].argv = args;
+		batch[j].state = state;
+		batch[j].status = status;
+		batch[j].thread = StartHostThread(RunHostJob, &batch[j]);
+	}
+	for (int j = 0; j < jobs; j++)
+		JoinHostThread(batch[j].thread);
+	ReportHostJobs(batch, jobs);
+}
+
+//----------------------------------------------------------------------
+// Kernel::RunHostJob
+// 	Body of the host thread running host job "job": make its kernel,
+//	and run the job's programs, until the kernel halts; ~Kernel then
+//	comes back here.
+//----------------------------------------------------------------------
+
+void *
+Kernel::RunHostJob(void *job)
+{
+	HostJob *me = (HostJob *) job;
+
+	kernel = new Kernel(me->argc, me->argv);
+	kernel->job = me;
+	kernel->hostJob = me->index;
+	kernel->hostJobs = me->count;
+	if (kernel->statsName != NULL) {
+		char *name = new char[strlen(kernel->statsName) + 12];
+
+		sprintf(name, "%s.%d", kernel->statsName, me->index);
+		kernel->statsName = name;
+	}
+	if (setjmp(me->halted) == 0) {
+		kernel->Initialize();
+		kernel->ExecAll();
+		ASSERTNOTREACHED();
+	}
+	return NULL;
+}
+
+//----------------------------------------------------------------------
+// Kernel::WriteJobReport
+// 	A host job is halting: note what it did, for the thread that
+//	started it: its statistics, and, for each of its programs,
+//	whether it finished, and with what status.
+//----------------------------------------------------------------------
+
+void
+Kernel::WriteJobReport()
 {
-	t[threadNum] = new Thread(name, threadNum);
-	t[threadNum]->space = new AddrSpace();
-	t[threadNum]->Fork((VoidFunctionPtr) &ForkExecute, (void *)t[threadNum]);
-	threadNum++;
+	ProcessEntry *entry;
+
+	stats->Snapshot(&job->totals);
+	for (int i = 1; i <= execfileNum; i++) {
+		if (execIds[i] < 0)
+			continue;		// another job's
+		entry = processes->Find(execIds[i]);
+		if (entry != NULL && entry->done) {
+			job->state[i] = 2;
+			job->status[i] = entry->status;
+		}
+	}
+}
+
+//----------------------------------------------------------------------
+// Kernel::ReportHostJobs
+// 	Every host job has ended: print each program's exit status, and
+//	the statistics of the jobs added up (with -ps, and to the -json
+//	file), and exit, with an error if any program failed.  A program
+//	still running when its job halted (it or another called Halt)
+//	isn't counted as failed.
+//----------------------------------------------------------------------
+
+void
+Kernel::ReportHostJobs(HostJob *jobs, int count)
+{
+	int *state = jobs[0].state;
+	int *status = jobs[0].status;
+	int failed = 0;
+
+	for (int j = 0; j < count; j++)
+		stats->Add(&jobs[j].totals);
+
+	printf("%-32s %4s %8s\n", "program", "job", "status");
+	for (int i = 1; i <= execfileNum; i++) {
+		printf("%-32s %4d ", execfile[i], (i - 1) % count);
+		if (state[i] == 1)
+			printf("%8s\n", "halted");
+		else {
+			printf("%8d\n", status[i]);
+			if (status[i] != 0)
+				failed++;
+		}
+	}
+	printf("Batch: %d programs in %d host jobs, %d failed\n",
+	       execfileNum, count, failed);
+	if (printStats)
+		stats->Print();
+	if (statsName != NULL)
+		stats->WriteJSON(statsName);
+	delete [] state;
+	delete [] status;
+	delete [] jobs;
+	Exit((failed > 0) ? 1 : 0);
+}
+
+//----------------------------------------------------------------------
+// ForkResume
+// 	Start thread "t", forked from a user program, where that program
+//	made the Fork system call, but with Fork returning 0.
+//----------------------------------------------------------------------
+
+static void ForkResume(Thread *t)
+{
+	Machine *machine = kernel->machine;
+
+	kernel->scheduler->LoadUserState(t);
+	machine->WriteRegister(2, 0);
+	machine->WriteRegister(PrevPCReg, machine->ReadRegister(PCReg));
+	machine->WriteRegister(PCReg, machine->ReadRegister(PCReg) + 4);
+	machine->WriteRegister(NextPCReg, machine->ReadRegister(PCReg) + 4);
+	machine->Run();
+	ASSERTNOTREACHED();
+}
+
+//----------------------------------------------------------------------
+// Kernel::Fork
+// 	Run the current user program again in a new thread, at the same
+//	priority, in address space "space" (a copy of the program's; see
+//	AddrSpace::Fork), from the registers the program has now: it is
+//	making the Fork system call.  Returns the new thread's ID.
+//----------------------------------------------------------------------
+
+int Kernel::Fork(AddrSpace *space)
+{
+	Thread *child;
+
+	child = new Thread(currentThread->getName(), processes->NewID());
+	child->setPriority(currentThread->getPriority());
+	child->space = space;
+	child->SaveUserState();		// the parent's, in the machine now
+	processes->Add(child, space->ASID(), -1, FALSE);
+	child->Fork((VoidFunctionPtr) &ForkResume, (void *) child);
+	return child->getID();
+}
+
+//----------------------------------------------------------------------
+// ThreadResume
+// 	Start thread "t", forked by a user program's ThreadFork system
+//	call, at the function the program gave: its registers were set
+//	up by Kernel::ThreadFork.
+//----------------------------------------------------------------------
+
+static void ThreadResume(Thread *t)
+{
+	kernel->scheduler->LoadUserState(t);
+	kernel->machine->Run();
+	ASSERTNOTREACHED();
+}
+
+//----------------------------------------------------------------------
+// Kernel::ThreadFork
+// 	Start a thread running user function "func" with argument "arg"
+//	in the current program's address space, at the same priority.
+//	It starts with the registers the program has now, but for the
+//	PC, the argument, and its stack pointer: each thread has a stack
+//	of its own, zero-filled pages mapped above the others (see
+//	AddrSpace::Mmap), and unmapped when it finishes.  The function
+//	should end with ThreadExit; it has nowhere to return to.
+//
+//	Returns the new thread's ID.
+//----------------------------------------------------------------------
+
+int Kernel::ThreadFork(int func, int arg)
+{
+	AddrSpace *space = currentThread->space;
+	Thread *child;
+	int stack;
+
+	stack = space->Mmap(NULL, UserStackSize);
+	child = new Thread(currentThread->getName(), processes->NewID());
+	child->setPriority(currentThread->getPriority());
+	child->space = space;
+	child->userStack = stack;
+	space->AddThread();
+	child->SaveUserState();		// the caller's, in the machine now
+	child->SetUserRegister(PCReg, func);
+	child->SetUserRegister(NextPCReg, func + 4);
+	child->SetUserRegister(4, arg);
+	child->SetUserRegister(StackReg, stack + UserStackSize - 16);
+	child->SetUserRegister(RetAddrReg, 0);	// (returning faults)
+	processes->Add(child, space->ASID(), currentThread->getID(), FALSE);
+	child->Fork((VoidFunctionPtr) &ThreadResume, (void *) child);
+	return child->getID();
+}
+
+//----------------------------------------------------------------------
+// Kernel::ThreadJoin
+// 	Wait until thread "id", running in the same address space as
+//	the current thread, has finished, and return its exit status
+//	(see ThreadDone).  Returns -1 at once if there is no such
+//	thread in the address space, or it is the current thread.
+//----------------------------------------------------------------------
+
+int Kernel::ThreadJoin(int id)
+{
+	ProcessEntry *entry = processes->Find(id);
+
+	if (entry == NULL || id == currentThread->getID()
+	    || entry->asid != currentThread->space->ASID())
+		return -1;
+	return WaitThread(id);
+}
+
+//----------------------------------------------------------------------
+// Kernel::WaitThread
+// 	Wait until user program thread "id" has finished, and return its
+//	exit status, as ThreadJoin does, but from kernel code: a thread
+//	with no address space of its own, waiting for a program it ran
+//	with ExecWait.  The entry is looked up again at each wakeup: the
+//	table may have grown, and moved it.
+//----------------------------------------------------------------------
+
+int Kernel::WaitThread(int id)
+{
+	ProcessEntry *entry;
+	int status;
+
+	if (id == currentThread->getID())
+		return -1;
+	joinLock->Acquire();
+	while ((entry = processes->Find(id)) != NULL && !entry->done)
+		threadEnded->Wait(joinLock);
+	status = (entry == NULL) ? -1 : entry->status;
+	processes->Waited(id);
+	joinLock->Release();
+	return status;
+}
+
+//----------------------------------------------------------------------
+// Kernel::CheckpointDue
+// 	Called at each exception; while -ckpt is pending, once the time
+//	has come, save the program running now to the checkpoint file.
+//	A program that can't be saved yet (see AddrSpace::Checkpoint) is
+//	tried again at its next exception.
+//----------------------------------------------------------------------
+
+void Kernel::CheckpointDue()
+{
+	AddrSpace *space = currentThread->space;
+
+	if (checkpointAt < 0 || stats->totalTicks < checkpointAt
+	    || space == NULL)
+		return;
+	if (space->Checkpoint(checkpointName)) {
+		cout << "Checkpointed " << currentThread->getName() << " to "
+		     << checkpointName << " at tick " << stats->totalTicks << "\n";
+		checkpointAt = -1;
+	}
+}
+
+//----------------------------------------------------------------------
+// Kernel::ThreadDone
+// 	"thread", running a user program, is finishing, with the status
+//	it gave Exit or ThreadExit (-1 if it was killed): wake any thread
+//	joining it.  Its entry in the process table is freed once nothing
+//	can join it any more (see ProcessTable::Finish).
+//----------------------------------------------------------------------
+
+void Kernel::ThreadDone(Thread *thread)
+{
+	joinLock->Acquire();
+	processes->Finish(thread->getID(), thread->exitStatus);
+	threadEnded->Broadcast(joinLock);
+	joinLock->Release();
+}
+
+//----------------------------------------------------------------------
+// Kernel::getThread
+// 	The thread with ID "threadID", or NULL if it has finished.
+//----------------------------------------------------------------------
+
+Thread* Kernel::getThread(int threadID)
+{
+	return processes->Lookup(threadID);
+}
+
+//----------------------------------------------------------------------
+// Kernel::ExecWait
+// 	Run program "name", and wait for it to finish, from kernel code
+//	(see SimBench); returns its exit status.  Unlike a program run
+//	with Exec, its entry is kept after it finishes, for the wait.
+//----------------------------------------------------------------------
+
+int Kernel::ExecWait(char *name)
+{
+	return WaitThread(StartProgram(name, DefaultPriority, FALSE, TRUE));
+}
+
+int Kernel::Exec(char* name, int priority, bool restore)
+{
+	return StartProgram(name, priority, restore, FALSE);
+}
+
+int Kernel::StartProgram(char *name, int priority, bool restore, bool held)
+{
+	Thread *t = new Thread(name, processes->NewID());
+
+	t->setPriority(priority);
+	t->space = new AddrSpace();
+	processes->Add(t, t->space->ASID(), -1, held);
+	t->Fork((VoidFunctionPtr) (restore ? &ForkRestore : &ForkExecute),
+		(void *)t);
 
-	return threadNum-1;
+	return t->getID();
 /*
     cout << "Total threads number is " << execfileNum << endl;
     for (int n=1;n<=execfileNum;n++) {
@@ -18,13 +18,39 @@
 #include "alarm.h"
 #include "filesys.h"
 #include "machine.h"
+#include <setjmp.h>
 
 class PostOfficeInput;
 class PostOfficeOutput;
 class SynchConsoleInput;
 class SynchConsoleOutput;
 class SynchDisk;
-
+class IOTrace;
+class WorkerPool;
+class Pager;
+class FutexTable;
+class RegionProfile;
+class ContentionProfile;
+class Lock;
+class Condition;
+class ProcessTable;
+
+// The following class defines one job of a batch (-hj): a kernel of
+// its own, run on a host thread of its own, and what it did.
+
+class HostJob {
+  public:
+    int index;			// which job, from 0
+    int count;			// of how many
+    int argc;			// the command line, for its kernel
+    char **argv;
+    void *thread;		// the host thread running it
+    jmp_buf halted;		// where its kernel goes at halt
+    StatsSample totals;		// its statistics, at halt
+    int *state;			// by program, for the whole batch: 1
+    int *status;		// if running at halt, 2 if finished,
+    				// and then its exit status
+};
 
 
 class Kernel {
@@ -41,12 +67,34 @@ class Kernel {
 	void PrepareToEnd(); // called before all running programs end
 	
 	void ExecAll();
-	int Exec(char* name);
+	int Exec(char* name, int priority = DefaultPriority,
+		 bool restore = FALSE);
+					// run program "name", or, if
+					// "restore", the one checkpointed
+					// to host file "name"
+	int ExecWait(char *name);	// run program "name", and wait for
+					// it to end (kernel code only)
+	void CheckpointDue();		// save the current program if
+					// -ckpt asks for it by now
+	int Fork(AddrSpace *space);	// run a copy of the current program
+	int ThreadFork(int func, int arg);
+					// run "func"(arg) in another thread
+					// of the current program
+	int ThreadJoin(int id);		// wait for thread "id" of it to end
+	int WaitThread(int id);		// wait for thread "id" of any
+					// program to end (kernel code only)
+	void ThreadDone(Thread *thread);	// "thread" of a user program is
+					// finishing
+	void StartHostJobs(int jobs);	// run the programs on several
+					// host threads
+	void ReportHostJobs(HostJob *jobs, int count);
+					// add up what they did, and exit
+	void WriteJobReport();		// say what this job did
     void ThreadSelfTest();	// self test of threads and synchronization
 	
     void ConsoleTest();         // interactive console self test
     void NetworkTest();         // interactive 2-machine network test
-	Thread* getThread(int threadID){return t[threadID];}    
+	Thread* getThread(int threadID);	// NULL once it has finished
 
 
 	int CreateFile(char* filename, int filesize); // fileSystem call
@@ -61,28 +109,87 @@ class Kernel {
     Statistics *stats;		// performance metrics
     Alarm *alarm;		// the software alarm clock    
     Machine *machine;           // the simulated CPU
+    Pager *pager;		// gives user pages physical memory
+    FutexTable *futexes;	// user threads waiting on words of memory
+    RegionProfile *regions;	// kernel time by region, or NULL
+    ContentionProfile *contention;	// waits by synchronization object,
+    					// or NULL
     SynchConsoleInput *synchConsoleIn;
     SynchConsoleOutput *synchConsoleOut;
+    WorkerPool *workers;	// kernel threads for background work
     SynchDisk *synchDisk;
+    IOTrace *ioTrace;		// every disk request is logged here,
+    				// if not NULL
+    bool tlbClock;		// TLB misses replace by clock, not LRU
+    bool quietAdd;		// don't print the result of each Add
+    				// (set by the simulator benchmark)
+    int faultAround;		// pages paged in after a sequential fault
     FileSystem *fileSystem;     
     PostOfficeInput *postOfficeIn;
     PostOfficeOutput *postOfficeOut;
 
     int hostName;               // machine identifier
+    int clusterSize;		// machines the network is kept in lock
+    				// step with, 0 up, or 0 if it isn't
+    char *diskBase;		// directory of disk images to read
+    				// through to, copy-on-write, or NULL
+    char *diskModel;		// device the disk behaves as (see
+    				// latency.h), or NULL for "hdd"
+    int hostJob;		// host job of a batch (-hj) this kernel
+    				// runs, from 0, or -1 if it isn't one
 
   private:
 
-	Thread* t[10];
-	char*   execfile[10];
+	static void *RunHostJob(void *job);	// body of a job's host
+					// thread
+	HostJob *job;			// the one this kernel runs, or NULL
+	int numArgs;			// the command line, for the jobs'
+	char **args;			// kernels
+	ProcessTable *processes;	// threads running user programs
+	Lock *joinLock;			// protects it, for ThreadJoin to
+	Condition *threadEnded;		// wait on
+	char**  execfile;		// programs to run, from 1,
+	int*    execPriority;		// and the priority of each
+	int*    execIds;		// and, in a host job, its thread
 	int execfileNum;
-	int threadNum;
+	int StartProgram(char *name, int priority, bool restore, bool held);
+					// Exec, for the kernel to wait for
+					// the program if "held"
     bool randomSlice;		// enable pseudo-random time slicing
+    bool tickless;		// set the clock only when something is due
     bool debugUserProg;         // single step user program
+    bool blockEngine;		// run user programs a block at a time
+    char *codeCacheName;	// host file to keep decoded code in
+    int tlbEntries;		// TLB to use instead of the page table,
+    int tlbWays;		// if tlbEntries isn't 0
+    bool tlbTagged;		// tag TLB entries with address space IDs
+    int profilePeriod;		// user instructions between PC samples,
+    				// or 0 not to profile
+    bool profileKernel;		// charge kernel time to regions
+    bool profileLocks;		// count waits on synchronization objects
+    int checkpointAt;		// tick to checkpoint the running program
+    				// at, or -1
+    char *checkpointName;	// host file to checkpoint it to
+    char *restoreName;		// host file to restore a program from
     double reliability;         // likelihood messages are dropped
     char *consoleIn;            // file to read console input from
     char *consoleOut;           // file to send console output to
+    char *diskPolicy;           // disk scheduling policy name
+    char *schedPolicy;          // thread scheduling policy name
+    int numCPUs;                // simulated CPUs
+    int hostJobs;               // host threads to run programs on
+    int numWorkers;             // kernel worker threads
+    int flushWindow;            // ticks a cached write may stay dirty
+    int numDisks;               // disks the sectors are striped across
+    char *traceName;            // file to trace disk requests to
+    bool printStats;            // print the statistics at halt
+    char *statsName;            // file to write them to as JSON
+    int sampleInterval;         // ticks between samples of them in the
+    				// JSON timeline, or 0 for none
 #ifndef FILESYS_STUB
     bool formatFlag;          // format the disk if this is true
+    int formatSectors;        // sectors of the disk a format covers
+    bool buildFlag;           // build a new disk image offline
 #endif
 };
 
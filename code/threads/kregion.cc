@@ -0,0 +1,159 @@
+// kregion.cc
+//	Routines to charge the kernel's time to the regions of code it
+//	is spent in.  See kregion.h.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "kregion.h"
+#include "main.h"
+#include "sysdep.h"
+
+//----------------------------------------------------------------------
+// RegionProfile::RegionProfile
+// 	No region entered yet.
+//----------------------------------------------------------------------
+
+RegionProfile::RegionProfile()
+{
+    root.name = "(no region)";
+    root.parent = root.child = root.sibling = NULL;
+    root.ticks = root.entries = 0;
+    root.hostSeconds = 0;
+    numNodes = 0;
+    numLost = 0;
+}
+
+//----------------------------------------------------------------------
+// RegionProfile::Enter
+// 	Return the path of region "name" entered from path "from",
+//	counting the entry, and adding it to the tree the first time.
+//	Returns NULL if the tree is full; the time is then charged to
+//	"from".
+//----------------------------------------------------------------------
+
+RegionNode *
+RegionProfile::Enter(RegionNode *from, const char *name)
+{
+    RegionNode *node;
+
+    if (from == NULL)
+	from = &root;
+    for (node = from->child; node != NULL; node = node->sibling)
+	if (node->name == name || strcmp(node->name, name) == 0)
+	    break;
+    if (node == NULL) {
+	if (numNodes == MaxRegionNodes) {
+	    numLost++;
+	    return NULL;
+	}
+	node = &nodes[numNodes++];
+	node->name = name;
+	node->parent = from;
+	node->child = NULL;
+	node->sibling = NULL;
+	node->ticks = node->entries = 0;
+	node->hostSeconds = 0;
+
+	RegionNode **last = &from->child;	// keep them in order
+	while (*last != NULL)
+	    last = &(*last)->sibling;
+	*last = node;
+    }
+    node->entries++;
+    return node;
+}
+
+//----------------------------------------------------------------------
+// RegionProfile::Total
+// 	Return the ticks spent in "node", and in every path entered
+//	from it.
+//----------------------------------------------------------------------
+
+int
+RegionProfile::Total(RegionNode *node)
+{
+    int ticks = node->ticks;
+
+    for (RegionNode *c = node->child; c != NULL; c = c->sibling)
+	ticks += Total(c);
+    return ticks;
+}
+
+//----------------------------------------------------------------------
+// RegionProfile::PrintNode
+// 	Print a line for "node", indented by "depth", and then one for
+//	each path entered from it.  "all" is the system time in all.
+//----------------------------------------------------------------------
+
+void
+RegionProfile::PrintNode(RegionNode *node, int depth, int all)
+{
+    int total = Total(node);
+
+    for (int i = 0; i < depth; i++)
+	cout << "  ";
+    cout << node->name << ": " << total << " ticks";
+    if (all > 0)
+	cout << " (" << (100.0 * total / all) << "%)";
+    cout << ", " << node->ticks << " not in a nested region, ";
+    cout << node->entries << " entries, ";
+    cout << (node->hostSeconds * 1000) << " ms host\n";
+    for (RegionNode *c = node->child; c != NULL; c = c->sibling)
+	PrintNode(c, depth + 1, all);
+}
+
+//----------------------------------------------------------------------
+// RegionProfile::Print
+// 	Print the tree of regions, each path with its share of the
+//	system time.
+//----------------------------------------------------------------------
+
+void
+RegionProfile::Print()
+{
+    int all = Total(&root);
+
+    cout << "Kernel time by region: " << all << " system ticks\n";
+    cout << "  " << root.name << ": " << root.ticks << " ticks\n";
+    for (RegionNode *c = root.child; c != NULL; c = c->sibling)
+	PrintNode(c, 1, all);
+    if (numLost > 0)
+	cout << "  " << numLost << " entries charged to the enclosing "
+	     << "region; raise MaxRegionNodes\n";
+}
+
+//----------------------------------------------------------------------
+// KernelRegion::KernelRegion
+// 	The running thread enters region "name": its system time is
+//	charged there until it leaves.  Nothing happens unless the
+//	kernel is profiling regions (-kp).
+//----------------------------------------------------------------------
+
+KernelRegion::KernelRegion(const char *name)
+{
+    node = NULL;
+    if (kernel->regions == NULL)
+	return;
+    outer = kernel->currentThread->region;
+    node = kernel->regions->Enter(outer, name);
+    if (node == NULL)
+	return;
+    kernel->currentThread->region = node;
+    start = WallClock();
+}
+
+//----------------------------------------------------------------------
+// KernelRegion::~KernelRegion
+// 	The thread leaves the region, back to the one it was in.
+//----------------------------------------------------------------------
+
+KernelRegion::~KernelRegion()
+{
+    if (node == NULL)
+	return;
+    node->hostSeconds += WallClock() - start;
+    kernel->currentThread->region = outer;
+}
@@ -0,0 +1,90 @@
+// kregion.h
+//	Data structures for finding out where the kernel spends its time.
+//
+//	Statistics only says how much time went to system code in all
+//	(systemTicks).  With -kp, parts of the kernel mark themselves as
+//	regions -- a system call, a file system operation, a disk
+//	request, a wait on a semaphore -- with a KernelRegion on the
+//	stack:
+//
+//		KernelRegion region("FileSystem::Open");
+//
+//	and every tick of system time is charged to the innermost region
+//	the running thread is in, or to none.  Regions nest, and the same
+//	region entered from two places is counted apart, so the report
+//	printed at halt is a tree: each path of nested regions, with the
+//	ticks spent in it (directly, and with what it called), how often
+//	it was entered, and the host time it took from entry to exit.
+//
+//	Each thread has its own path, so a thread blocked in a region
+//	isn't charged for the threads that run meanwhile; but the host
+//	time of a region does include the time its thread was blocked.
+//	Without -kp, a region costs a test of a pointer.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef KREGION_H
+#define KREGION_H
+
+#include "copyright.h"
+#include "utility.h"
+
+#define MaxRegionNodes	128		// paths of regions told apart;
+					// the rest go to the enclosing one
+
+// The following class defines one path of nested regions, as entered.
+
+class RegionNode {
+  public:
+    const char *name;		// of the innermost region
+    RegionNode *parent;		// the path it was entered from
+    RegionNode *child;		// the first path entered from it
+    RegionNode *sibling;	// the next path entered from its parent
+    int ticks;			// system time in it, but not in a child
+    int entries;		// times it was entered
+    double hostSeconds;		// host time from entry to exit, in all
+};
+
+// The following class defines the tree of regions entered so far.
+
+class RegionProfile {
+  public:
+    RegionProfile();
+
+    RegionNode *Enter(RegionNode *from, const char *name);
+    				// The path "name" entered from "from"
+				// (NULL: from outside every region)
+    void Charge(RegionNode *node, int ticks) {
+    				// "ticks" of system time were spent in
+				// "node" (NULL: outside every region)
+	(node != NULL ? node : &root)->ticks += ticks;
+    }
+    void Print();		// Print the tree
+
+  private:
+    RegionNode root;		// outside every region
+    RegionNode nodes[MaxRegionNodes];	// the paths, as they are entered
+    int numNodes;		// how many are in use
+    int numLost;		// entries of paths that didn't fit
+
+    int Total(RegionNode *node);	// ticks in "node" and its children
+    void PrintNode(RegionNode *node, int depth, int all);
+};
+
+// The following class defines a region of kernel code, from where one
+// is declared to the end of its scope.
+
+class KernelRegion {
+  public:
+    KernelRegion(const char *name);	// The running thread enters it
+    ~KernelRegion();			// and leaves it
+
+  private:
+    RegionNode *node;		// path entered, or NULL if not profiling
+    RegionNode *outer;		// the thread's path before
+    double start;		// host time it was entered
+};
+
+#endif // KREGION_H
@@ -6,29 +6,129 @@
 //              -s -x <nachos file> -ci <consoleIn> -co <consoleOut>
 //              -f -cp <unix file> <nachos file>
 //              -p <nachos file> -r <nachos file> -l -D
-//              -n <network reliability> -m <machine id>
+//              -n <network reliability> -m <machine id> -cl <machines>
 //              -z -K -C -N
 //
 //    -d causes certain debugging messages to be printed (see debug.h)
 //    -rs causes Yield to occur at random (but repeatable) spots
 //    -z prints the copyright message
 //    -s causes user programs to be executed in single-step mode
+//    -bb runs user programs a basic block at a time, translated once
+//	and kept, rather than interpreting every instruction (ignored
+//	with -s, or the 'm' debug flag)
+//    -dc keeps the decoded instructions of each page of user code in a
+//	host file, found by the page's contents, so the next run of the
+//	same programs needn't decode them again
+//    -tlb translates user addresses with a software-loaded TLB of that
+//	many entries (at most 256), in sets of that many ways, instead
+//	of the page table; the kernel loads it on each miss.  -tlbr
+//	picks the entry a miss replaces, lru (default) or clock, and
+//	-asid tags each entry with its address space, so the TLB needn't
+//	be flushed when another program runs
+//    -pf profiles user programs: counts the instructions run by opcode
+//	and the basic blocks entered by PC, and samples the PC every
+//	that many instructions; the report is printed at halt
+//    -fa sets how many pages after a page fault are paged in with it,
+//	when faults come in sequence (0 pages in one at a time)
+//    -kp charges the kernel's time to the regions of kernel code it is
+//	spent in (system calls, file system, disk, scheduler, semaphores),
+//	and prints the tree of regions at halt (see kregion.h)
+//    -lc counts the waits on each lock, semaphore and condition, by
+//	name, and prints those waited on longest at halt
+//    -ckpt checkpoints the running user program to a host file, at the
+//	first system call or page fault from that tick on (see
+//	AddrSpace::Checkpoint); -restore runs a checkpointed program on
+//	from where it was saved, to skip a long warm-up on each run
 //    -x runs a user program
+//    -e runs a user program in its own thread; -ep runs one at the
+//	given priority (0 lowest, 31 highest, 16 by default)
+//    -sp picks the thread scheduling policy: fifo (default),
+//	priority, which runs the highest priority ready thread and
+//	donates priority to the holder of a lock a thread waits for,
+//	mlfq, a multilevel feedback queue that demotes threads using
+//	their whole time slice, or sjf (srtf), which runs the thread
+//	predicted to block soonest, without (with) preempting
+//    -np simulates that many CPUs (up to 8), which take turns at the
+//	machine a time slice at a time, each with its own ready queues;
+//	a CPU with nothing to run steals a thread from the busiest
+//    -tl makes the timer tickless: it goes off at the end of the running
+//	thread's quantum only if another thread is waiting for the CPU,
+//	else only when a sleeping thread is due to wake
+//    -hj runs the -e programs on that many host threads, each with a
+//	kernel of its own, to use more host CPUs for a batch of
+//	independent programs, and prints each one's exit status, and
+//	the jobs' statistics added up; with the
+//	Nachos file system, each job writes to a copy-on-write overlay
+//	of the -db image, which it needs
+//    -wk sets how many kernel worker threads run background work:
+//	disk flushes, read-ahead and network delivery (2 by default)
+//    -tp sets how many stacks of finished threads are kept for new
+//	threads to reuse (16 by default)
 //    -ci specify file for console input (stdin is the default)
 //    -co specify file for console output (stdout is the default)
 //    -n sets the network reliability
 //    -m sets this machine's host id (needed for the network)
+//    -cl runs this machine in lock step with the others, 0 up to one
+//	less than the number given, so packets arrive at the same
+//	simulated time every run (see NetworkInput)
 //    -K run a simple self test of kernel threads and synchronization
+//    -tb runs a thread system benchmark workload (yield, pingpong,
+//	prodcons, convoy, or all) of a thousand threads, and prints the
+//	context switches per host second, the host time per Fork, and
+//	the longest wait on a ready queue
 //    -C run an interactive console test
 //    -N run a two-machine network test (see Kernel::NetworkTest)
 //
 //    Filesystem-related flags:
 //    -f forces the Nachos disk to be formatted
-//    -cp copies a file from UNIX to Nachos
+//    -fsize makes the format cover only the first so many sectors of
+//	the disk
+//    -cp copies a file from UNIX to Nachos; -cpz stores the copy
+//	compressed, for text and logs, which then take fewer sectors
+//    -cpr copies UNIX files and directory trees into a Nachos directory
+//    -dd makes every copy (-cp, -cpr, -build) a deduplicated file, so
+//	copies of the same program or fixture share their sectors
+//    -build formats a new disk image and fills it from a manifest file,
+//	writing the image directly instead of through the simulated disk
 //    -p prints a Nachos file to stdout
 //    -r removes a Nachos file from the file system
 //    -l lists the contents of the Nachos directory
 //    -D prints the contents of the entire file system 
+//    -fsck checks the file system for lost, shared and misallocated
+//	sectors, reading only headers and index sectors
+//    -defrag moves files into contiguous runs, the most used nearest
+//	the start of the disk, in a background thread
+//    -B runs a file system benchmark workload (seqwrite, seqread,
+//	randread, smallfiles, deeppath, tree, or all) and prints the
+//	ticks, disk operations, cache hit rate and host time it took
+//    -ds picks the disk scheduling policy: fifo, sstf or cscan (default)
+//    -dm picks the storage device the disk behaves as: hdd (the
+//	simulated rotating disk, default), ssd or ram; see latency.h
+//    -fw sets how many ticks a cached disk write may wait to be flushed
+//    -nd stripes the disk sectors across that many disks, DISK_<m>
+//	onwards for machine id m (RAID-0), so requests overlap
+//    -db makes each disk DISK_<m> a copy-on-write overlay of the image
+//	of the same name in a directory: that one is only read, and
+//	DISK_<m> holds just the sectors written since, so many runs can
+//	share one populated image
+//    -trace logs every disk request, and the file and kind of sector
+//	it is for, to a binary trace file
+//    -replay issues the disk requests of a trace file again, through
+//	the current cache and scheduling policy, and prints the time
+//	they took; it overwrites the sectors written, so use a scratch
+//	disk
+//    -ps prints the performance statistics at halt: disk time split
+//	into seek, rotation and transfer, latency histograms, time
+//	waited for the disk lock, and the disk queue depth
+//    -json (or -stats json:statsFile) writes the same statistics to a
+//	file as a JSON object; with -si, it has a timeline too, of how
+//	much each counter changed in every interval of that many ticks
+//    -sb runs a simulator benchmark kernel (intloop, memcopy, branches,
+//	syscalls, or all) as a user program, and prints the simulated
+//	MIPS and host time per instruction, and per Translate; -sbo
+//	writes the results to a file as a JSON object ("make simbench")
+//    -mkdir creates a directory; -mkdirb creates one indexed by a B-tree,
+//	for directories that will hold many files
 //
 //  Note: the file system flags are not used if the stub filesystem
 //        is being used
@@ -45,9 +145,14 @@
 #include "filesys.h"
 #include "openfile.h"
 #include "sysdep.h"
+#include "disk.h"
+#include "iotrace.h"
+#include "fsbench.h"
+#include "simbench.h"
+#include "schedbench.h"
 
 // global variables
-Kernel *kernel;
+HostThreadLocal Kernel *kernel;
 Debug *debug;
 
 
@@ -70,20 +175,53 @@ Cleanup(int x)
 //-------------------------------------------------------------------
 static const int TransferSize = 128;
 
+// MP4 MODIFIED: Copy moves data in much bigger blocks, two at a time
+static const int CopyBlockSize = 32 * SectorSize;
+
 
 #ifndef FILESYS_STUB
+// MP4 MODIFIED: set by -dd
+static bool deduplicateCopies = false;
+
+//----------------------------------------------------------------------
+// FillBuffer
+//      Read from the UNIX file "fd" until "buffer" holds "size" bytes
+//	or the file ends, so that every block but the last is whole
+//	sectors.  Return the number of bytes read.
+//----------------------------------------------------------------------
+
+static int
+FillBuffer(int fd, char *buffer, int size)
+{
+    int done = 0, amountRead;
+
+    while (done < size && 
+	    (amountRead = ReadPartial(fd, &buffer[done], size - done)) > 0)
+	done += amountRead;
+    return done;
+}
+
 //----------------------------------------------------------------------
 // Copy
 //      Copy the contents of the UNIX file "from" to the Nachos file "to"
+//
+//	MP4 MODIFIED
+//	The Nachos file gets all its blocks up front, in one run, and the
+//	data goes over in CopyBlockSize blocks through two buffers: while
+//	the disk writes one block (OpenFile::WriteBehind), the next one
+//	is read from the UNIX file.  A "compress"ed file gets its blocks
+//	as each chunk is written instead, and under -dd, a deduplicated
+//	one as each block is, unless it is compressed.
 //----------------------------------------------------------------------
 
 static void
-Copy(char *from, char *to)
+Copy(char *from, char *to, bool compress = FALSE)
 {
     int fd;
     OpenFile* openFile;
     int amountRead, fileLength;
-    char *buffer;
+    char *buffer[2];
+    int current = 0;
 
 // Open UNIX file
     if ((fd = OpenForReadWrite(from,FALSE)) < 0) {       
@@ -98,7 +236,8 @@ Copy(char *from, char *to)
 
 // Create a Nachos file of the same length
     DEBUG('f', "Copying file " << from << " of size " << fileLength <<  " to file " << to);
-    if (!kernel->fileSystem->Create(to, fileLength)) {   // Create Nachos file
+    if (!kernel->fileSystem->Create(to, fileLength,
+		!compress && !deduplicateCopies, compress, deduplicateCopies)) {
         printf("Copy: couldn't create output file %s\n", to);
         Close(fd);
         return;
@@ -107,17 +246,76 @@ Copy(char *from, char *to)
     openFile = kernel->fileSystem->Open(to);
     ASSERT(openFile != NULL);
     
-// Copy the data in TransferSize chunks
-    buffer = new char[TransferSize];
-    while ((amountRead=ReadPartial(fd, buffer, sizeof(char)*TransferSize)) > 0)
-        openFile->Write(buffer, amountRead);    
-    delete [] buffer;
+// Copy the data in CopyBlockSize blocks, reading ahead of the disk
+    buffer[0] = new char[CopyBlockSize];
+    buffer[1] = new char[CopyBlockSize];
+    amountRead = FillBuffer(fd, buffer[current], CopyBlockSize);
+    while (amountRead > 0) {
+        openFile->WriteBehind(buffer[current], amountRead);
+        amountRead = FillBuffer(fd, buffer[1 - current], CopyBlockSize);
+        openFile->WaitWrites();
+        current = 1 - current;
+    }
+    delete [] buffer[0];
+    delete [] buffer[1];
 
 // Close the UNIX and the Nachos files
     delete openFile;
     Close(fd);
 }
 
+//----------------------------------------------------------------------
+// Import
+//	MP4 MODIFIED
+//      Copy the UNIX file or directory tree "from" into the Nachos
+//	directory "toDir", under the same name.
+//----------------------------------------------------------------------
+
+static void
+Import(char *from, char *toDir)
+{
+    int fromLen = strlen(from);
+    char *source = new char[fromLen + 1];
+    char to[PathMaxLen + 1];
+    char *base;
+
+    strcpy(source, from);
+    while (fromLen > 1 && source[fromLen - 1] == '/')
+	source[--fromLen] = '\0';		// "dir/" names "dir"
+    base = strrchr(source, '/');
+    base = (base == NULL) ? source : base + 1;
+
+    if (strlen(toDir) + 1 + strlen(base) > PathMaxLen) {
+	printf("Import: name too long for %s\n", source);
+	delete [] source;
+	return;
+    }
+    sprintf(to, "%s/%s", (strcmp(toDir, "/") == 0) ? "" : toDir, base);
+
+    if (IsDirectory(source)) {
+	void *dir = OpenDirectory(source);
+	char *name;
+
+	if (dir == NULL) {
+	    printf("Import: couldn't open directory %s\n", source);
+	    delete [] source;
+	    return;
+	}
+	kernel->fileSystem->CreateDirectory(to);
+	while ((name = ReadDirectory(dir)) != NULL) {
+	    char *child = new char[fromLen + strlen(name) + 2];
+
+	    sprintf(child, "%s/%s", source, name);
+	    Import(child, to);
+	    delete [] child;
+	}
+	CloseDirectory(dir);
+    } else {
+	Copy(source, to);
+    }
+    delete [] source;
+}
+
 #endif // FILESYS_STUB
 
 //----------------------------------------------------------------------
@@ -154,7 +352,7 @@ Print(char *name)
 //      Create a new directory with "name"
 //----------------------------------------------------------------------
 static void
-CreateDirectory(char *name)
+CreateDirectory(char *name, bool indexed)
 {
     for(int i=0; i<strlen(name); i++){
         if(!(isalnum(name[i]) || name[i]=='/' || name[i]=='-' || name[i]=='_' || name[i]=='.')){
@@ -163,7 +361,100 @@ CreateDirectory(char *name)
         }
     }
 
-    kernel->fileSystem->CreateDirectory(name);
+    kernel->fileSystem->CreateDirectory(name, indexed);
+}
+
+#ifndef FILESYS_STUB
+//----------------------------------------------------------------------
+// BuildImage
+//	MP4 MODIFIED
+//      Fill a freshly formatted disk as the manifest file says, with
+//	one command per line:
+//	    mkdir <nachos dir>
+//	    mkdirb <nachos dir>		(indexed directory)
+//	    cp <unix file> <nachos file>
+//	    cpz <unix file> <nachos file>	(stored compressed)
+//	    cpr <nachos dir> <unix file or dir>...
+//	Blank lines and lines starting with '#' are skipped.  Under -build
+//	the disk is written directly, so this takes no simulated disk time.
+//----------------------------------------------------------------------
+
+static const int MaxManifestWords = 64;
+
+static void
+BuildImage(char *manifest)
+{
+    int fd, length;
+    char *text, *line, *next;
+
+    if ((fd = OpenForReadWrite(manifest, FALSE)) < 0) {
+        printf("Build: couldn't open manifest %s\n", manifest);
+        return;
+    }
+    Lseek(fd, 0, 2);
+    length = Tell(fd);
+    Lseek(fd, 0, 0);
+    text = new char[length + 1];
+    length = FillBuffer(fd, text, length);
+    text[length] = '\0';
+    Close(fd);
+
+    for (line = text; line != NULL; line = next) {
+        char *words[MaxManifestWords];
+        int n = 0;
+
+        next = strchr(line, '\n');
+        if (next != NULL)
+            *next++ = '\0';
+        for (char *w = strtok(line, " \t\r"); w != NULL && n < MaxManifestWords;
+                w = strtok(NULL, " \t\r"))
+            words[n++] = w;
+        if (n == 0 || words[0][0] == '#')
+            continue;
+
+        if (strcmp(words[0], "mkdir") == 0 && n == 2) {
+            CreateDirectory(words[1], false);
+        } else if (strcmp(words[0], "mkdirb") == 0 && n == 2) {
+            CreateDirectory(words[1], true);
+        } else if (strcmp(words[0], "cp") == 0 && n == 3) {
+            Copy(words[1], words[2]);
+        } else if (strcmp(words[0], "cpz") == 0 && n == 3) {
+            Copy(words[1], words[2], true);
+        } else if (strcmp(words[0], "cpr") == 0 && n >= 3) {
+            for (int i = 2; i < n; i++)
+                Import(words[i], words[1]);
+        } else {
+            printf("Build: bad manifest line starting %s\n", words[0]);
+        }
+    }
+    delete [] text;
+}
+
+//----------------------------------------------------------------------
+// Defragment
+//	Body of the thread started by -defrag: defragment the disk in
+//	the background, while the user programs run.  Its disk requests
+//	are idle I/O, served only when theirs are not waiting.
+//----------------------------------------------------------------------
+
+static void
+Defragment(void *unused)
+{
+    (void) kernel->currentThread->SetIOClass(IOIdle);
+    kernel->fileSystem->Defragment();
+}
+#endif // FILESYS_STUB
+
+//----------------------------------------------------------------------
+// Replay
+//	Body of the thread started by -replay, so that the requests are
+//	issued after main has handed the CPU to the other threads.
+//----------------------------------------------------------------------
+
+static void
+Replay(char *traceName)
+{
+    IOTrace::Replay(traceName);
 }
 
 //----------------------------------------------------------------------
@@ -187,20 +478,35 @@ main(int argc, char **argv)
     char *debugArg = "";
     char *userProgName = NULL;        // default is not to execute a user prog
     bool threadTestFlag = false;
+    char *schedBenchName = NULL;      // thread benchmark workload to run
     bool consoleTestFlag = false;
     bool networkTestFlag = false;
+    char *replayName = NULL;          // trace to replay, if any
+    char *simBenchName = NULL;        // simulator benchmark kernel to run
+    char *simBenchOut = NULL;         // and where to write its results
 #ifndef FILESYS_STUB
     char *copyUnixFileName = NULL;    // UNIX file to be copied into Nachos
     char *copyNachosFileName = NULL;  // name of copied file in Nachos
+    bool compressFlag = false;        // store the copy compressed
+    char *importDirName = NULL;       // Nachos directory for -cpr
+    char *buildManifest = NULL;       // manifest for -build
+    char **importNames = NULL;        // UNIX files and trees for -cpr
+    int importCount = 0;
     char *printFileName = NULL; 
     char *removeFileName = NULL;
     bool dirListFlag = false;
     bool removeflag = false;
     bool dumpFlag = false;
+    bool checkFlag = false;
+    char *verifyDirName = NULL;       // Nachos tree for -verify
+    char *verifyHostDir = NULL;       // and the UNIX tree it came from
+    bool defragFlag = false;
+    char *benchName = NULL;           // workload to benchmark, if any
 	// MP4 mod tag
 	char *createDirectoryName = NULL;
 	char *listDirectoryName = NULL;
 	bool mkdirFlag = false;
+	bool indexedDirFlag = false;
 	bool recursiveListFlag = false;
 	bool recursiveRemoveFlag = false;
 #endif //FILESYS_STUB
@@ -225,19 +531,69 @@ main(int argc, char **argv)
 	else if (strcmp(argv[i], "-K") == 0) {
 	    threadTestFlag = TRUE;
 	}
+	else if (strcmp(argv[i], "-tb") == 0) {
+	    ASSERT(i + 1 < argc);
+	    schedBenchName = argv[i + 1];
+	    i++;
+	}
 	else if (strcmp(argv[i], "-C") == 0) {
 	    consoleTestFlag = TRUE;
 	}
 	else if (strcmp(argv[i], "-N") == 0) {
 	    networkTestFlag = TRUE;
 	}
+	else if (strcmp(argv[i], "-trace") == 0) {
+	    ASSERT(i + 1 < argc);	// the kernel opens the trace
+	    i++;
+	}
+	else if (strcmp(argv[i], "-json") == 0 ||
+		 strcmp(argv[i], "-stats") == 0 ||
+		 strcmp(argv[i], "-si") == 0) {
+	    ASSERT(i + 1 < argc);	// the kernel writes the statistics
+	    i++;
+	}
+	else if (strcmp(argv[i], "-replay") == 0) {
+	    ASSERT(i + 1 < argc);
+	    replayName = argv[i + 1];
+	    i++;
+	}
+	else if (strcmp(argv[i], "-sb") == 0) {
+	    ASSERT(i + 1 < argc);
+	    simBenchName = argv[i + 1];
+	    i++;
+	}
+	else if (strcmp(argv[i], "-sbo") == 0) {
+	    ASSERT(i + 1 < argc);
+	    simBenchOut = argv[i + 1];
+	    i++;
+	}
 #ifndef FILESYS_STUB
-	else if (strcmp(argv[i], "-cp") == 0) {
+	else if (strcmp(argv[i], "-cp") == 0 || strcmp(argv[i], "-cpz") == 0) {
 	    ASSERT(i + 2 < argc);
 	    copyUnixFileName = argv[i + 1];
 	    copyNachosFileName = argv[i + 2];
+	    compressFlag = (strcmp(argv[i], "-cpz") == 0);
 	    i += 2;
 	}
+	else if (strcmp(argv[i], "-dd") == 0) {
+	    // MP4 mod tag
+	    deduplicateCopies = true;
+	}
+	else if (strcmp(argv[i], "-build") == 0) {
+	    // MP4 mod tag; the kernel makes the disk offline
+	    ASSERT(i + 1 < argc);
+	    buildManifest = argv[i + 1];
+	    i++;
+	}
+	else if (strcmp(argv[i], "-cpr") == 0) {
+	    // MP4 mod tag
+	    ASSERT(i + 2 < argc);
+	    importDirName = argv[i + 1];
+	    importNames = &argv[i + 2];
+	    for (i += 2; i < argc && argv[i][0] != '-'; i++)
+		importCount++;
+	    i--;
+	}
 	else if (strcmp(argv[i], "-p") == 0) {
 	    ASSERT(i + 1 < argc);
 	    printFileName = argv[i + 1];
@@ -282,18 +638,59 @@ main(int argc, char **argv)
 		mkdirFlag = true;
 		i++;
 	}
+	else if (strcmp(argv[i], "-mkdirb") == 0) {
+		// MP4 mod tag
+		ASSERT(i + 1 < argc);
+		createDirectoryName = argv[i + 1];
+		mkdirFlag = true;
+		indexedDirFlag = true;
+		i++;
+	}
 	else if (strcmp(argv[i], "-D") == 0) {
 	    dumpFlag = true;
 	}
+	else if (strcmp(argv[i], "-fsck") == 0) {
+	    // MP4 mod tag
+	    checkFlag = true;
+	}
+	else if (strcmp(argv[i], "-verify") == 0) {
+	    // MP4 mod tag
+	    ASSERT(i + 1 < argc);
+	    verifyDirName = argv[i + 1];
+	    i++;
+	    if (i + 1 < argc && argv[i + 1][0] != '-') {
+		verifyHostDir = argv[i + 1];
+		i++;
+	    }
+	}
+	else if (strcmp(argv[i], "-defrag") == 0) {
+	    // MP4 mod tag
+	    defragFlag = true;
+	}
+	else if (strcmp(argv[i], "-B") == 0) {
+	    // MP4 mod tag
+	    ASSERT(i + 1 < argc);
+	    benchName = argv[i + 1];
+	    i++;
+	}
 #endif //FILESYS_STUB
 	else if (strcmp(argv[i], "-u") == 0) {
             cout << "Partial usage: nachos [-z -d debugFlags]\n";
             cout << "Partial usage: nachos [-x programName]\n";
 	    cout << "Partial usage: nachos [-K] [-C] [-N]\n";
+	    cout << "Partial usage: nachos [-tb workload|all]\n";
+	    cout << "Partial usage: nachos [-replay traceFile]\n";
+	    cout << "Partial usage: nachos [-sb kernel|all] [-sbo jsonFile]\n";
 #ifndef FILESYS_STUB
             cout << "Partial usage: nachos [-cp UnixFile NachosFile]\n";
+            cout << "Partial usage: nachos [-cpz UnixFile NachosFile]\n";
+            cout << "Partial usage: nachos [-cpr NachosDir UnixFile...]\n";
+            cout << "Partial usage: nachos [-dd]\n";
+            cout << "Partial usage: nachos [-build manifest]\n";
             cout << "Partial usage: nachos [-p fileName] [-r fileName]\n";
-            cout << "Partial usage: nachos [-l] [-D]\n";
+            cout << "Partial usage: nachos [-l] [-D] [-fsck] [-defrag]\n";
+            cout << "Partial usage: nachos [-verify NachosDir [UnixDir]]\n";
+            cout << "Partial usage: nachos [-B workload|all]\n";
 #endif //FILESYS_STUB
 	}
 
@@ -313,34 +710,72 @@ main(int argc, char **argv)
     if (threadTestFlag) {
       kernel->ThreadSelfTest();  // test threads and synchronization
     }
+    if (schedBenchName != NULL) {
+      SchedBench *schedBench = new SchedBench;
+
+      schedBench->Run(schedBenchName);
+      delete schedBench;
+    }
     if (consoleTestFlag) {
       kernel->ConsoleTest();   // interactive test of the synchronized console
     }
     if (networkTestFlag) {
       kernel->NetworkTest();   // two-machine test of the network
     }
+    if (replayName != NULL) {
+      Thread *replayThread = new Thread("replay", 1);
+      replayThread->Fork((VoidFunctionPtr) Replay, (void *) replayName);
+    }
 
 #ifndef FILESYS_STUB
+    if (buildManifest != NULL) {
+		BuildImage(buildManifest);
+    }
     if (removeflag) {
 		kernel->fileSystem->Remove(removeFileName, recursiveRemoveFlag);
     }
     if (copyUnixFileName != NULL && copyNachosFileName != NULL) {
-		Copy(copyUnixFileName,copyNachosFileName);
+		Copy(copyUnixFileName, copyNachosFileName, compressFlag);
+    }
+    for (i = 0; i < importCount; i++) {
+		Import(importNames[i], importDirName);
     }
     if (dumpFlag) {
 		kernel->fileSystem->Print();
     }
+    if (checkFlag) {
+		kernel->fileSystem->Check();
+    }
+    if (verifyDirName != NULL) {
+		kernel->fileSystem->Verify(verifyDirName, verifyHostDir);
+    }
+    if (benchName != NULL) {
+		FileSystemBench *bench = new FileSystemBench;
+
+		bench->Run(benchName);
+		delete bench;
+    }
+    if (defragFlag) {
+		Thread *defragThread = new Thread("defrag", 1);
+		defragThread->Fork((VoidFunctionPtr) Defragment, NULL);
+    }
     if (dirListFlag) {
 		kernel->fileSystem->List(listDirectoryName, recursiveListFlag);
     }
 	if (mkdirFlag) {
 		// MP4 mod tag
-		CreateDirectory(createDirectoryName);
+		CreateDirectory(createDirectoryName, indexedDirFlag);
 	}
     if (printFileName != NULL) {
       Print(printFileName);
     }
 #endif // FILESYS_STUB
+    if (simBenchName != NULL) {
+		SimBench *simBench = new SimBench;
+
+		simBench->Run(simBenchName, simBenchOut);
+		delete simBench;
+    }
 
     // finally, run an initial user program if requested to do so
 
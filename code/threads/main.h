@@ -12,7 +12,7 @@
 #include "debug.h"
 #include "kernel.h"
 
-extern Kernel *kernel;
+extern HostThreadLocal Kernel *kernel;	// this host thread's (see -hj)
 extern Debug *debug;
 
 #endif // MAIN_H
@@ -0,0 +1,228 @@
+// proctable.cc
+//	Routines to keep track of the threads running user programs, by
+//	ID.  See proctable.h.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "debug.h"
+#include "proctable.h"
+#include "thread.h"
+
+//----------------------------------------------------------------------
+// ProcessTable::ProcessTable, ProcessTable::~ProcessTable
+// 	Make an empty table of InitialProcesses entries.
+//----------------------------------------------------------------------
+
+ProcessTable::ProcessTable()
+{
+    capacity = 0;
+    entries = NULL;
+    buckets = NULL;
+    freeList = -1;
+    numEntries = 0;
+    nextID = 0;
+    Grow();
+}
+
+ProcessTable::~ProcessTable()
+{
+    delete [] entries;
+    delete [] buckets;
+}
+
+//----------------------------------------------------------------------
+// ProcessTable::Grow
+// 	Double the number of entries (or make the first ones), and hash
+//	the ones in use again, since the hash depends on the size.  The
+//	new entries go on the free list.
+//----------------------------------------------------------------------
+
+void
+ProcessTable::Grow()
+{
+    int newCapacity = (capacity == 0) ? InitialProcesses : 2 * capacity;
+    ProcessEntry *newEntries = new ProcessEntry[newCapacity];
+
+    for (int i = 0; i < capacity; i++)
+	newEntries[i] = entries[i];
+    for (int i = newCapacity - 1; i >= capacity; i--) {
+	newEntries[i].id = -1;
+	newEntries[i].next = freeList;
+	freeList = i;
+    }
+    delete [] entries;
+    delete [] buckets;
+    entries = newEntries;
+    capacity = newCapacity;
+    buckets = new int[capacity];
+    for (int i = 0; i < capacity; i++)
+	buckets[i] = -1;
+    for (int i = 0; i < capacity; i++) {
+	if (entries[i].id >= 0) {
+	    entries[i].next = buckets[Hash(entries[i].id)];
+	    buckets[Hash(entries[i].id)] = i;
+	}
+    }
+    DEBUG(dbgThread, "Process table grown to " << capacity << " entries");
+}
+
+//----------------------------------------------------------------------
+// ProcessTable::IndexOf, ProcessTable::Find, ProcessTable::Lookup
+// 	Find the entry of thread "id" by its hash.
+//----------------------------------------------------------------------
+
+int
+ProcessTable::IndexOf(int id)
+{
+    if (id < 0)
+	return -1;
+    for (int i = buckets[Hash(id)]; i != -1; i = entries[i].next) {
+	if (entries[i].id == id)
+	    return i;
+    }
+    return -1;
+}
+
+ProcessEntry *
+ProcessTable::Find(int id)
+{
+    int i = IndexOf(id);
+
+    return (i < 0) ? NULL : &entries[i];
+}
+
+Thread *
+ProcessTable::Lookup(int id)
+{
+    ProcessEntry *e = Find(id);
+
+    return (e == NULL || e->done) ? NULL : e->thread;
+}
+
+//----------------------------------------------------------------------
+// ProcessTable::Add
+// 	Make an entry for "thread", growing the table if it is full.
+//
+//	"thread" -- made with the last ID given out by NewID
+//	"asid" -- the address space it runs in
+//	"sharing" -- a thread running in that space already, or -1 if
+//		"thread" is the first, and so leads it
+//	"held" -- for a leader, whether the kernel will wait for it
+//----------------------------------------------------------------------
+
+void
+ProcessTable::Add(Thread *thread, int asid, int sharing, bool held)
+{
+    int i, h;
+    ProcessEntry *e;
+
+    if (freeList == -1)
+	Grow();
+    i = freeList;
+    e = &entries[i];
+    freeList = e->next;
+    e->id = thread->getID();
+    e->thread = thread;
+    e->asid = asid;
+    e->done = FALSE;
+    e->status = 0;
+    e->held = held;
+    e->zombies = -1;
+    if (sharing < 0) {
+	e->leader = i;
+	e->live = 1;
+    } else {
+	ASSERT(IndexOf(sharing) >= 0);
+	e->leader = entries[IndexOf(sharing)].leader;
+	entries[e->leader].live++;
+	e->live = 0;
+    }
+    h = Hash(e->id);
+    e->next = buckets[h];
+    buckets[h] = i;
+    numEntries++;
+}
+
+//----------------------------------------------------------------------
+// ProcessTable::Free
+// 	Take entry "index" out of its hash bucket, and put it on the free
+//	list.
+//----------------------------------------------------------------------
+
+void
+ProcessTable::Free(int index)
+{
+    int *link = &buckets[Hash(entries[index].id)];
+
+    while (*link != index) {
+	ASSERT(*link != -1);
+	link = &entries[*link].next;
+    }
+    *link = entries[index].next;
+    entries[index].id = -1;
+    entries[index].thread = NULL;
+    entries[index].next = freeList;
+    freeList = index;
+    numEntries--;
+}
+
+//----------------------------------------------------------------------
+// ProcessTable::Finish
+// 	Thread "id" has finished with "status".  While other threads run
+//	in its space, one of them may join it, so its entry is kept, on
+//	its leader's list; once the last one finishes, no one can, and
+//	every entry of the space is freed, but for a held leader's.
+//----------------------------------------------------------------------
+
+void
+ProcessTable::Finish(int id, int status)
+{
+    int i = IndexOf(id);
+    int leader, next;
+
+    if (i < 0)
+	return;
+    entries[i].done = TRUE;
+    entries[i].status = status;
+    entries[i].thread = NULL;		// about to be deleted
+    leader = entries[i].leader;
+    if (--entries[leader].live > 0) {
+	if (i != leader) {
+	    entries[i].zombies = entries[leader].zombies;
+	    entries[leader].zombies = i;
+	}
+	return;
+    }
+    for (int z = entries[leader].zombies; z != -1; z = next) {
+	next = entries[z].zombies;
+	Free(z);
+    }
+    entries[leader].zombies = -1;
+    if (i != leader)
+	Free(i);
+    if (!entries[leader].held)
+	Free(leader);
+}
+
+//----------------------------------------------------------------------
+// ProcessTable::Waited
+// 	The kernel has waited for thread "id", and has its status.  Free
+//	a held leader's entry, or, if its space isn't done yet, leave it
+//	to be freed with the rest when it is.
+//----------------------------------------------------------------------
+
+void
+ProcessTable::Waited(int id)
+{
+    int i = IndexOf(id);
+
+    if (i < 0 || !entries[i].held)
+	return;
+    if (entries[i].live == 0)
+	Free(i);
+    else
+	entries[i].held = FALSE;
+}
@@ -0,0 +1,96 @@
+// proctable.h
+//	Data structures for keeping track of the threads that run user
+//	programs, by ID, so that they can be joined.
+//
+//	Each thread gets an ID that is never reused, like an address
+//	space's ASID, and an entry in the table, found from the ID by
+//	hashing.  The table grows as needed, so there is no limit on the
+//	threads running at once, and an entry is freed for reuse as soon
+//	as nothing can wait for its thread any more, so a long run of
+//	short programs doesn't fill it:
+//
+//	  - threads are joined by threads of the same address space, so
+//	    a finished thread's entry is kept, with its exit status, only
+//	    until the last thread of its space has finished;
+//	  - the first thread of a space (its "leader", the one Exec or
+//	    Fork started) keeps the list of those, and frees them all
+//	    when the space ends;
+//	  - a program the kernel will wait for (Kernel::ExecWait) is
+//	    "held": its leader's entry is kept until the wait.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef PROCTABLE_H
+#define PROCTABLE_H
+
+#include "copyright.h"
+#include "utility.h"
+
+#define InitialProcesses	64	// entries at first; doubled when
+					// they run out
+
+class Thread;
+
+// The following class defines the entry for one thread.  Entries are
+// linked by their index in the table, which, unlike their address,
+// stays the same when the table grows.
+
+class ProcessEntry {
+  public:
+    int id;			// the thread's ID, or -1 if free
+    Thread *thread;		// valid until it is done
+    int asid;			// address space it runs in
+    bool done;			// whether it has finished,
+    int status;			// and with what status
+    bool held;			// the kernel will wait for it
+    int leader;			// entry of its space's leader
+    int live;			// for a leader, threads in its space
+    				// not done yet
+    int zombies;		// for a leader, first of the done
+    				// threads of its space; for those, the
+				// next; -1 ends the list
+    int next;			// next entry in the same hash bucket,
+    				// or in the free list
+};
+
+// The following class defines the table.
+
+class ProcessTable {
+  public:
+    ProcessTable();
+    ~ProcessTable();
+
+    int NewID() { return nextID++; }	// ID for a thread being made
+
+    void Add(Thread *thread, int asid, int sharing, bool held);
+    				// Add "thread", running in space "asid";
+				// "sharing" is a thread already running
+				// in it, or -1 if this one leads it
+    ProcessEntry *Find(int id);	// The entry for thread "id", or NULL
+    				// if it isn't in the table
+    Thread *Lookup(int id);	// Thread "id", if it hasn't finished
+    void Finish(int id, int status);
+    				// Thread "id" has finished with "status";
+				// free the entries no one can wait for
+    void Waited(int id);	// The kernel has waited for "id"
+
+    int NumEntries() { return numEntries; }
+
+  private:
+    ProcessEntry *entries;	// the entries, free or not
+    int capacity;		// how many there are
+    int *buckets;		// first entry with each hash, or -1;
+    				// there are "capacity" of them
+    int freeList;		// first free entry, or -1
+    int numEntries;		// entries in use
+    int nextID;			// the next thread ID to give out
+
+    int Hash(int id) { return id & (capacity - 1); }
+    void Grow();		// double the table
+    int IndexOf(int id);	// entry of thread "id", or -1
+    void Free(int index);	// free entry "index"
+};
+
+#endif // PROCTABLE_H
@@ -0,0 +1,255 @@
+// schedbench.cc
+//	Routines to benchmark the thread system with a fixed set of
+//	workloads.  See schedbench.h.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "debug.h"
+#include "sysdep.h"
+#include "schedbench.h"
+#include "synch.h"
+#include "synchlist.h"
+#include "main.h"
+
+static SchedBench *bench;		// the one running, for its threads
+
+//----------------------------------------------------------------------
+// SchedBench::SchedBench, SchedBench::~SchedBench
+// 	Make what the workloads share; nothing is measured until Run.
+//----------------------------------------------------------------------
+
+SchedBench::SchedBench()
+{
+    done = new Semaphore("bench done", 0);
+    pings = new Semaphore *[SchedBenchThreads];
+    for (int i = 0; i < SchedBenchThreads; i++)
+	pings[i] = new Semaphore("bench ping", 0);
+    items = new SynchList<int>;
+    convoyLock = new Lock("bench convoy");
+    name = NULL;
+    startSwitches = savedMaxReady = 0;
+    startTime = 0;
+    numForks = 0;
+    forkSeconds = 0;
+}
+
+SchedBench::~SchedBench()
+{
+    delete done;
+    for (int i = 0; i < SchedBenchThreads; i++)
+	delete pings[i];
+    delete [] pings;
+    delete items;
+    delete convoyLock;
+}
+
+//----------------------------------------------------------------------
+// SchedBench::Run
+// 	Run one workload, or all of them.
+//
+//	"which" -- yield, pingpong, prodcons, convoy, or all
+//----------------------------------------------------------------------
+
+void
+SchedBench::Run(char *which)
+{
+    bool all = (strcmp(which, "all") == 0);
+    bool found = all;
+
+    bench = this;
+    printf("%-10s %8s %9s %9s %10s %8s %9s\n", "workload", "threads",
+		"switches", "host secs", "switches/s", "fork us", "max ready");
+    if (all || strcmp(which, "yield") == 0) {
+	Yields();
+	found = TRUE;
+    }
+    if (all || strcmp(which, "pingpong") == 0) {
+	PingPong();
+	found = TRUE;
+    }
+    if (all || strcmp(which, "prodcons") == 0) {
+	ProdCons();
+	found = TRUE;
+    }
+    if (all || strcmp(which, "convoy") == 0) {
+	Convoy();
+	found = TRUE;
+    }
+    if (!found)
+	printf("Bench: no workload %s\n", which);
+    bench = NULL;
+}
+
+//----------------------------------------------------------------------
+// SchedBench::Start
+// 	Note the counters at the start of "workload".  The longest ready
+//	queue wait is measured from zero, and put back after.
+//----------------------------------------------------------------------
+
+void
+SchedBench::Start(char *workload)
+{
+    name = workload;
+    numForks = 0;
+    forkSeconds = 0;
+    startSwitches = kernel->stats->numSwitches;
+    savedMaxReady = kernel->stats->maxReadyWait;
+    kernel->stats->maxReadyWait = 0;
+    startTime = WallClock();
+}
+
+//----------------------------------------------------------------------
+// SchedBench::Spawn
+// 	Fork a thread of the workload to run "func"("arg"), timing the
+//	Fork.
+//----------------------------------------------------------------------
+
+void
+SchedBench::Spawn(VoidFunctionPtr func, int arg)
+{
+    Thread *t = new Thread("bench", 1);
+    double start = WallClock();
+
+    t->Fork(func, (void *) (long) arg);
+    forkSeconds += WallClock() - start;
+    numForks++;
+}
+
+//----------------------------------------------------------------------
+// SchedBench::Stop
+// 	Wait for every thread of the workload to finish, and print what
+//	it took.
+//----------------------------------------------------------------------
+
+void
+SchedBench::Stop()
+{
+    double seconds;
+    int switches, maxReady;
+
+    for (int i = 0; i < numForks; i++)
+	done->P();
+    seconds = WallClock() - startTime;
+    switches = kernel->stats->numSwitches - startSwitches;
+    maxReady = kernel->stats->maxReadyWait;
+    if (savedMaxReady > maxReady)
+	kernel->stats->maxReadyWait = savedMaxReady;
+    printf("%-10s %8d %9d %9.3f %10.0f %8.2f %9d\n", name, numForks,
+		switches, seconds, seconds > 0 ? switches / seconds : 0.0,
+		numForks > 0 ? forkSeconds * 1e6 / numForks : 0.0, maxReady);
+}
+
+//----------------------------------------------------------------------
+// YieldThread, PingThread, PongThread, ProducerThread, ConsumerThread,
+// ConvoyThread
+// 	The bodies of the workloads' threads.  Each V's "done" as it
+//	ends.
+//----------------------------------------------------------------------
+
+static void
+YieldThread(void *arg)
+{
+    for (int i = 0; i < SchedBenchYields; i++)
+	kernel->currentThread->Yield();
+    bench->done->V();
+}
+
+static void
+PingThread(void *arg)			// even threads of each pair
+{
+    int pair = (int) (long) arg;
+
+    for (int i = 0; i < SchedBenchRounds; i++) {
+	bench->pings[2 * pair + 1]->V();
+	bench->pings[2 * pair]->P();
+    }
+    bench->done->V();
+}
+
+static void
+PongThread(void *arg)			// odd threads
+{
+    int pair = (int) (long) arg;
+
+    for (int i = 0; i < SchedBenchRounds; i++) {
+	bench->pings[2 * pair + 1]->P();
+	bench->pings[2 * pair]->V();
+    }
+    bench->done->V();
+}
+
+static void
+ProducerThread(void *arg)
+{
+    for (int i = 0; i < SchedBenchItems; i++)
+	bench->items->Append(i);
+    bench->done->V();
+}
+
+static void
+ConsumerThread(void *arg)
+{
+    for (int i = 0; i < SchedBenchItems; i++)
+	(void) bench->items->RemoveFront();
+    bench->done->V();
+}
+
+static void
+ConvoyThread(void *arg)
+{
+    for (int i = 0; i < SchedBenchConvoy; i++) {
+	bench->convoyLock->Acquire();
+	kernel->currentThread->Yield();	// so the others pile up
+	bench->convoyLock->Release();
+    }
+    bench->done->V();
+}
+
+//----------------------------------------------------------------------
+// SchedBench::Yields, SchedBench::PingPong, SchedBench::ProdCons,
+// SchedBench::Convoy
+// 	The workloads: fork the threads, and wait for them.
+//----------------------------------------------------------------------
+
+void
+SchedBench::Yields()
+{
+    Start("yield");
+    for (int i = 0; i < SchedBenchThreads; i++)
+	Spawn(YieldThread, i);
+    Stop();
+}
+
+void
+SchedBench::PingPong()
+{
+    Start("pingpong");
+    for (int i = 0; i < SchedBenchThreads / 2; i++) {
+	Spawn(PingThread, i);
+	Spawn(PongThread, i);
+    }
+    Stop();
+}
+
+void
+SchedBench::ProdCons()
+{
+    Start("prodcons");
+    for (int i = 0; i < SchedBenchThreads / 2; i++) {
+	Spawn(ConsumerThread, i);		// waiting before there
+	Spawn(ProducerThread, i);		// is anything to take
+    }
+    Stop();
+}
+
+void
+SchedBench::Convoy()
+{
+    Start("convoy");
+    for (int i = 0; i < SchedBenchThreads; i++)
+	Spawn(ConvoyThread, i);
+    Stop();
+}
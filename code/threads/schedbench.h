@@ -0,0 +1,81 @@
+// schedbench.h
+//	Data structures for benchmarking the thread system at scale with a
+//	fixed set of workloads (nachos -tb), so that changes to the
+//	scheduler, the ready queues, stack pooling or synchronization can
+//	be compared against a baseline.  Thread::SelfTest (-K) only
+//	checks that two threads can take turns.
+//
+//	Each workload forks SchedBenchThreads kernel threads and waits
+//	for them all to finish:
+//
+//		yield		every thread yields, over and over
+//		pingpong	pairs of threads hand a semaphore back and
+//				forth
+//		prodcons	half the threads append to a SynchList, and
+//				the other half take from it
+//		convoy		every thread takes the same lock, and yields
+//				while holding it
+//
+//	and is reported as the context switches it took, switches per
+//	host second, the host time per Thread::Fork, and the longest any
+//	thread waited on a ready queue, in simulated ticks.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef SCHEDBENCH_H
+#define SCHEDBENCH_H
+
+#include "copyright.h"
+#include "utility.h"
+
+#define SchedBenchThreads	1000	// threads forked per workload
+#define SchedBenchYields	20	// yields per thread
+#define SchedBenchRounds	50	// round trips per ping-pong pair
+#define SchedBenchItems		20	// items per producer or consumer
+#define SchedBenchConvoy	10	// lock acquires per thread
+
+class Semaphore;
+class Lock;
+template <class T> class SynchList;
+
+// The following class runs the workloads and prints one line of
+// results for each.
+
+class SchedBench {
+  public:
+    SchedBench();
+    ~SchedBench();
+
+    void Run(char *which);		// Run the workload named "which",
+					// or all of them if "all"
+
+    // What the threads of a workload use; public for them.
+
+    Semaphore *done;			// V'd by each thread as it ends
+    Semaphore **pings;			// two per ping-pong pair
+    SynchList<int> *items;		// the producers' items
+    Lock *convoyLock;			// the lock every convoy thread takes
+
+  private:
+    char *name;				// the workload being measured
+    int startSwitches;			// and the counters when it began
+    int savedMaxReady;
+    double startTime;
+    int numForks;			// Forks made in it,
+    double forkSeconds;			// and the host time they took
+
+    void Start(char *workload);		// Begin measuring a workload
+    void Spawn(VoidFunctionPtr func, int arg);
+    					// Fork a thread of it
+    void Stop();			// Wait for its threads, and print
+    					// what it took
+
+    void Yields();
+    void PingPong();
+    void ProdCons();
+    void Convoy();
+};
+
+#endif // SCHEDBENCH_H
@@ -11,8 +11,11 @@
 //	end up calling FindNextToRun(), and that would put us in an 
 //	infinite loop.
 //
-// 	Very simple implementation -- no priorities, straight FIFO.
-//	Might need to be improved in later assignments.
+// 	By default, straight FIFO; "-sp priority" runs the highest
+//	priority ready thread first, and "-sp mlfq" uses feedback from
+//	the time slices threads use to favor the interactive ones.
+//	"-sp sjf" and "-sp srtf" run the thread expected to block
+//	soonest.  "-np n" simulates n CPUs, each with its own queues.
 //
 // Copyright (c) 1992-1996 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
@@ -22,17 +25,68 @@
 #include "debug.h"
 #include "scheduler.h"
 #include "main.h"
+#include "kregion.h"
+
+//----------------------------------------------------------------------
+// RemainingCompare
+// 	Order threads for the SJF ready queue: by the CPU time they are
+//	expected to use before blocking.  Compare function for SortedList.
+//----------------------------------------------------------------------
+
+static int
+RemainingCompare(Thread *x, Thread *y)
+{
+    int xLeft = x->predictedBurst - x->burstTicks;
+    int yLeft = y->predictedBurst - y->burstTicks;
+
+    if (xLeft < yLeft)
+	return -1;
+    return (xLeft > yLeft) ? 1 : 0;
+}
 
 //----------------------------------------------------------------------
 // Scheduler::Scheduler
 // 	Initialize the list of ready but not running threads.
 //	Initially, no ready threads.
+//
+//	"policyName" -- "fifo", "priority", "mlfq", "sjf" or "srtf";
+//		NULL means "fifo"
+//	"cpus" -- how many CPUs to simulate, 1 to MaxCPUs
 //----------------------------------------------------------------------
 
-Scheduler::Scheduler()
+Scheduler::Scheduler(char *policyName, int cpus)
 { 
-    readyList = new List<Thread *>; 
+    ASSERT(cpus >= 1 && cpus <= MaxCPUs);
+    policy = SchedFIFO;
+    if (policyName != NULL) {
+	if (strcmp(policyName, "priority") == 0)
+	    policy = SchedPriority;
+	else if (strcmp(policyName, "mlfq") == 0)
+	    policy = SchedMLFQ;
+	else if (strcmp(policyName, "sjf") == 0)
+	    policy = SchedSJF;
+	else if (strcmp(policyName, "srtf") == 0)
+	    policy = SchedSRTF;
+	else
+	    ASSERT(strcmp(policyName, "fifo") == 0);
+    }
+    numCPUs = cpus;
+    cpu = nextHome = 0;
+    passing = FALSE;
+    for (int c = 0; c < numCPUs; c++) {
+	for (int i = 0; i < NumPriorities; i++)
+	    readyList[c][i] = new List<Thread *>; 
+	if (policy == SchedSJF || policy == SchedSRTF) {
+	    delete readyList[c][0];
+	    readyList[c][0] = new SortedList<Thread *>(RemainingCompare);
+	}
+	readyLevels[c] = 0;
+	numReady[c] = 0;
+    }
+    kernel->stats->numCPUs = numCPUs;
+    boostEpoch = lastBoost = 0;
     toBeDestroyed = NULL;
+    userOwner = NULL;
 } 
 
 //----------------------------------------------------------------------
@@ -42,7 +96,10 @@ Scheduler::Scheduler()
 
 Scheduler::~Scheduler()
 { 
-    delete readyList; 
+    for (int c = 0; c < numCPUs; c++) {
+	for (int i = 0; i < NumPriorities; i++)
+	    delete readyList[c][i]; 
+    }
 } 
 
 //----------------------------------------------------------------------
@@ -59,14 +116,107 @@ Scheduler::ReadyToRun (Thread *thread)
     ASSERT(kernel->interrupt->getLevel() == IntOff);
     DEBUG(dbgThread, "Putting thread on ready list: " << thread->getName());
 	//cout << "Putting thread on ready list: " << thread->getName() << endl ;
+    if (thread->getStatus() == BLOCKED)
+	thread->sliceUsed = 0;		// it gave up the CPU on its own
+    if (thread->getStatus() == JUST_CREATED) {
+	thread->cpu = nextHome;		// spread new threads over the CPUs
+	nextHome = (nextHome + 1) % numCPUs;
+    }
+    if (thread == kernel->currentThread)
+	Charge(thread);			// yielding, sort by what is left
     thread->setStatus(READY);
-    readyList->Append(thread);
+    if (thread == kernel->currentThread) {
+	Enqueue(thread, passing);
+	passing = FALSE;
+    } else {
+	Enqueue(thread, FALSE);
+    }
+    kernel->alarm->Reprogram();		// tickless: it may need a slice
+}
+
+//----------------------------------------------------------------------
+// Scheduler::Enqueue
+// 	Put "thread" on the right ready queue of its CPU: at the back, or
+//	if "front", at the front, where a thread that only yielded to let
+//	other CPUs have a turn goes, so that it is still the one running
+//	on its CPU.
+//----------------------------------------------------------------------
+
+void
+Scheduler::Enqueue(Thread *thread, bool front)
+{
+    int level = Level(thread);
+
+    if (front)
+	readyList[thread->cpu][level]->Prepend(thread);
+    else
+	readyList[thread->cpu][level]->Append(thread);
+    readyLevels[thread->cpu] |= 1 << level;
+    numReady[thread->cpu]++;
+}
+
+//----------------------------------------------------------------------
+// Scheduler::TakeFrom
+// 	Remove and return the next thread to run from the queues of CPU
+//	"which", or NULL if they are empty.
+//----------------------------------------------------------------------
+
+Thread *
+Scheduler::TakeFrom(int which)
+{
+    int level;
+    Thread *thread;
+
+    if (readyLevels[which] == 0) {
+		return NULL;
+    }
+    level = 31 - __builtin_clz(readyLevels[which]);	// highest non-empty
+    thread = readyList[which][level]->RemoveFront();
+    if (readyList[which][level]->IsEmpty())
+	readyLevels[which] &= ~(1 << level);
+    numReady[which]--;
+    return thread;
+}
+
+//----------------------------------------------------------------------
+// Scheduler::Steal
+// 	The CPU whose turn it is has nothing to run: take a thread from
+//	the CPU with the most, provided that leaves it one to run.  The
+//	thread is the one the other CPU would run next but one, since its
+//	next is, as far as it is concerned, running now.  Returns NULL if
+//	no CPU has a thread to spare.
+//----------------------------------------------------------------------
+
+Thread *
+Scheduler::Steal()
+{
+    int victim = -1;
+    Thread *running, *thread;
+
+    for (int c = 0; c < numCPUs; c++) {
+	if (numReady[c] >= 2 && (victim < 0 || numReady[c] > numReady[victim]))
+	    victim = c;
+    }
+    if (victim < 0)
+	return NULL;
+    running = TakeFrom(victim);
+    thread = TakeFrom(victim);
+    Enqueue(running, TRUE);
+    DEBUG(dbgThread, "CPU " << cpu << " stealing " << thread->getName()
+		<< " from CPU " << victim);
+    kernel->stats->numSteals++;
+    thread->cpu = cpu;
+    return thread;
 }
 
 //----------------------------------------------------------------------
 // Scheduler::FindNextToRun
 // 	Return the next thread to be scheduled onto the CPU.
 //	If there are no ready threads, return NULL.
+//
+//	With several CPUs, it is the next CPU's turn: the first, going
+//	round from the one after this, with a thread of its own to run
+//	or one to steal.
 // Side effect:
 //	Thread is removed from the ready list.
 //----------------------------------------------------------------------
@@ -74,20 +224,234 @@ Scheduler::ReadyToRun (Thread *thread)
 Thread *
 Scheduler::FindNextToRun ()
 {
+    Thread *thread = NULL;
+    int busy = 0;
+
     ASSERT(kernel->interrupt->getLevel() == IntOff);
 
-    if (readyList->IsEmpty()) {
-		return NULL;
-    } else {
-    	return readyList->RemoveFront();
+    if (numCPUs == 1)
+	return TakeFrom(0);
+    for (int i = 0; i < numCPUs && thread == NULL; i++) {
+	cpu = (cpu + 1) % numCPUs;
+	thread = TakeFrom(cpu);
+	if (thread == NULL)
+	    thread = Steal();
+    }
+    if (thread == NULL)
+	return NULL;
+    for (int c = 0; c < numCPUs; c++) {
+	if (c == cpu || numReady[c] > 0)
+	    busy++;
+    }
+    kernel->interrupt->SetCPU(cpu, busy);
+    return thread;
+}
+
+//----------------------------------------------------------------------
+// Scheduler::Level
+// 	Return the ready queue "thread" belongs on.  The bitmap is
+//	searched from the top, so higher numbers run first.
+//----------------------------------------------------------------------
+
+int
+Scheduler::Level(Thread *thread)
+{
+    switch (policy) {
+      case SchedPriority:
+	return thread->getPriority();
+      case SchedMLFQ:
+	if (thread->boostEpoch != boostEpoch) {	// missed a boost
+	    thread->boostEpoch = boostEpoch;
+	    thread->queueLevel = 0;
+	}
+	return MLFQLevels - 1 - thread->queueLevel;
+      default:
+	return 0;
+    }
+}
+
+//----------------------------------------------------------------------
+// Scheduler::TimeSlice
+// 	Called at each timer interrupt.  Return TRUE if the running
+//	thread should give up the CPU: always, except under SchedMLFQ,
+//	where it keeps the CPU until it has used the quantum of its
+//	level, and then drops a level.
+//
+//	"slices" is how many TimerTicks the interrupt stands for; more
+//	than one in tickless mode, where the clock is set to go off
+//	only when the thread's quantum is up (see Quantum).
+//
+//	This is also where MLFQ boosts happen.  A thread that is not
+//	ready is boosted when it next becomes ready (see Level).
+//----------------------------------------------------------------------
+
+bool
+Scheduler::TimeSlice(int slices)
+{
+    bool yield = PolicySlice(slices);
+
+    if (!yield && numCPUs > 1) {
+	passing = TRUE;			// just the next CPU's turn
+	return TRUE;
+    }
+    return yield;
+}
+
+//----------------------------------------------------------------------
+// Scheduler::PolicySlice
+// 	The part of TimeSlice that is up to the scheduling policy: TRUE
+//	if the running thread should give up its CPU to another thread.
+//----------------------------------------------------------------------
+
+bool
+Scheduler::PolicySlice(int slices)
+{
+    Thread *thread = kernel->currentThread;
+
+    if (policy == SchedSJF)
+	return FALSE;			// only blocking ends a burst
+    if (policy == SchedSRTF) {
+	Charge(thread);			// yield only to a shorter job
+	return readyLevels[cpu] != 0 && 
+		RemainingCompare(readyList[cpu][0]->Front(), thread) < 0;
+    }
+    if (policy != SchedMLFQ)
+	return TRUE;
+    if (kernel->stats->totalTicks - lastBoost >= MLFQBoostTicks)
+	Boost();
+    (void) Level(thread);		// catch up with any boost
+    thread->sliceUsed += slices;
+    if (thread->sliceUsed < MLFQQuantum(thread->queueLevel))
+	return FALSE;
+    if (thread->queueLevel < MLFQLevels - 1) {
+	thread->queueLevel++;
+	DEBUG(dbgThread, "Demoting " << thread->getName() << " to level "
+		<< thread->queueLevel);
+    }
+    thread->sliceUsed = 0;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Scheduler::NeedsSlice
+// 	Return TRUE if a timer interrupt now could make the running
+//	thread give up the CPU: if there are other CPUs to take turns
+//	with, or a thread waiting for this one, under a policy that
+//	preempts.  If not, a tickless clock (see Alarm) needn't go off.
+//----------------------------------------------------------------------
+
+bool
+Scheduler::NeedsSlice()
+{
+    return numCPUs > 1 || (policy != SchedSJF && numReady[cpu] > 0);
+}
+
+//----------------------------------------------------------------------
+// Scheduler::Quantum
+// 	Return how many timer interrupts (TimerTicks each) "thread" may
+//	run for before TimeSlice takes the CPU from it: under SchedMLFQ,
+//	what is left of the quantum of its level; under the others, one.
+//----------------------------------------------------------------------
+
+int
+Scheduler::Quantum(Thread *thread)
+{
+    if (policy != SchedMLFQ || numCPUs > 1)
+	return 1;
+    return max(MLFQQuantum(thread->queueLevel) - thread->sliceUsed, 1);
+}
+
+//----------------------------------------------------------------------
+// Scheduler::Charge
+// 	Add the CPU time "thread" has had since it was dispatched to its
+//	current burst.
+//----------------------------------------------------------------------
+
+void
+Scheduler::Charge(Thread *thread)
+{
+    thread->burstTicks += kernel->stats->totalTicks - thread->dispatchedAt;
+    thread->dispatchedAt = kernel->stats->totalTicks;
+}
+
+//----------------------------------------------------------------------
+// Scheduler::Boost
+// 	Move every thread back to the top MLFQ level.  The ready ones
+//	are requeued, in the order they would have run; the others are
+//	moved when they next become ready, since the epoch has changed.
+//----------------------------------------------------------------------
+
+void
+Scheduler::Boost()
+{
+    List<Thread *> ready;
+    Thread *thread;
+
+    DEBUG(dbgThread, "Boosting every thread to the top level");
+    boostEpoch++;
+    lastBoost = kernel->stats->totalTicks;
+    for (int c = 0; c < numCPUs; c++) {
+	while ((thread = TakeFrom(c)) != NULL)
+	    ready.Append(thread);
+	while (!ready.IsEmpty())
+	    Enqueue(ready.RemoveFront(), FALSE);
     }
 }
 
+//----------------------------------------------------------------------
+// Scheduler::ChangePriority
+// 	Set the priority "thread" runs at.  If it is on a ready queue,
+//	it moves to the back of the queue for its new priority.
+//----------------------------------------------------------------------
+
+void
+Scheduler::ChangePriority(Thread *thread, int priority)
+{
+    ASSERT(kernel->interrupt->getLevel() == IntOff);
+
+    if (thread->getStatus() != READY || policy != SchedPriority) {
+	thread->setEffectivePriority(priority);
+	return;
+    }
+    readyList[thread->cpu][Level(thread)]->Remove(thread);
+    if (readyList[thread->cpu][Level(thread)]->IsEmpty())
+	readyLevels[thread->cpu] &= ~(1 << Level(thread));
+    numReady[thread->cpu]--;
+    thread->setEffectivePriority(priority);
+    ReadyToRun(thread);
+}
+
+//----------------------------------------------------------------------
+// Scheduler::TakeWaiter
+// 	Remove and return the thread a semaphore should wake up: the
+//	first to wait, or under SchedPriority the first to wait of the
+//	highest priority.
+//
+//	"waiting" -- the semaphore's queue, which must not be empty
+//----------------------------------------------------------------------
+
+Thread *
+Scheduler::TakeWaiter(IntrusiveList<Thread> *waiting)
+{
+    IntrusiveIterator<Thread> it(waiting);
+    Thread *best = NULL;
+
+    if (policy != SchedPriority)
+	return waiting->RemoveFront();
+    for (; !it.IsDone(); it.Next()) {
+	if (best == NULL || it.Item()->getPriority() > best->getPriority())
+	    best = it.Item();
+    }
+    waiting->Remove(best);
+    return best;
+}
+
 //----------------------------------------------------------------------
 // Scheduler::Run
 // 	Dispatch the CPU to nextThread.  Save the state of the old thread,
 //	and load the state of the new thread, by calling the machine
-//	dependent context switch routine, SWITCH.
+//	dependent context switch routine, SWITCH.  A user program's
+//	registers are switched only when needed (see LoadUserState).
 //
 //      Note: we assume the state of the previously running thread has
 //	already been changed from running to blocked or ready (depending).
@@ -103,7 +467,9 @@ Scheduler::FindNextToRun ()
 void
 Scheduler::Run (Thread *nextThread, bool finishing)
 {
+    KernelRegion region("Scheduler::Run");
     Thread *oldThread = kernel->currentThread;
+    bool voluntary;			// did it give up the CPU itself?
     
     ASSERT(kernel->interrupt->getLevel() == IntOff);
 
@@ -112,14 +478,24 @@ Scheduler::Run (Thread *nextThread, bool finishing)
 	 toBeDestroyed = oldThread;
     }
     
-    if (oldThread->space != NULL) {	// if this thread is a user program,
-        oldThread->SaveUserState(); 	// save the user's CPU registers
-	oldThread->space->SaveState();
-    }
-    
     oldThread->CheckOverflow();		    // check if the old thread
 					    // had an undetected stack overflow
 
+    voluntary = finishing || oldThread->getStatus() == BLOCKED;
+    if (voluntary)
+	oldThread->times.numVoluntary++;
+    else
+	oldThread->times.numInvoluntary++;	// preempted, or yielding
+    kernel->stats->RecordSwitch(voluntary);
+
+    Charge(oldThread);			    // end of its CPU burst if it is
+    if (oldThread->getStatus() == BLOCKED) { // blocking: predict the next
+	oldThread->predictedBurst = 
+		(oldThread->burstTicks + oldThread->predictedBurst) / 2;
+	oldThread->burstTicks = 0;
+    }
+    nextThread->dispatchedAt = kernel->stats->totalTicks;
+
     kernel->currentThread = nextThread;  // switch to the next thread
     nextThread->setStatus(RUNNING);      // nextThread is now running
     
@@ -143,10 +519,34 @@ Scheduler::Run (Thread *nextThread, bool finishing)
 					// before this one has finished
 					// and needs to be cleaned up
     
-    if (oldThread->space != NULL) {	    // if there is an address space
-        oldThread->RestoreUserState();     // to restore, do it.
-	oldThread->space->RestoreState();
+    if (oldThread->space != NULL)	// if there is an address space
+	LoadUserState(oldThread);	// to restore, do it.
+}
+
+//----------------------------------------------------------------------
+// Scheduler::LoadUserState
+// 	Make the user registers and page table in the machine those of
+//	"thread", a user program that is about to run.
+//
+//	The user state is saved lazily: a thread switched away from
+//	leaves its registers in the machine, and they are only saved
+//	when a different user program needs the machine.  Switches to
+//	kernel threads and back, or between a thread and itself, then
+//	copy no registers at all.
+//----------------------------------------------------------------------
+
+void
+Scheduler::LoadUserState(Thread *thread)
+{
+    if (userOwner == thread)
+	return;				// still there
+    if (userOwner != NULL) {		// save the user's CPU registers
+	userOwner->SaveUserState();
+	userOwner->space->SaveState();
     }
+    thread->RestoreUserState();
+    thread->space->RestoreState();
+    userOwner = thread;
 }
 
 //----------------------------------------------------------------------
@@ -161,6 +561,8 @@ void
 Scheduler::CheckToBeDestroyed()
 {
     if (toBeDestroyed != NULL) {
+	if (toBeDestroyed == userOwner)
+	    userOwner = NULL;		// its registers are garbage now
         delete toBeDestroyed;
 	toBeDestroyed = NULL;
     }
@@ -175,5 +577,10 @@ void
 Scheduler::Print()
 {
     cout << "Ready list contents:\n";
-    readyList->Apply(ThreadPrint);
+    for (int c = 0; c < numCPUs; c++) {
+	if (numCPUs > 1)
+	    cout << "CPU " << c << ":\n";
+	for (int i = NumPriorities - 1; i >= 0; i--)
+	    readyList[c][i]->Apply(ThreadPrint);
+    }
 }
@@ -12,33 +12,133 @@
 #include "copyright.h"
 #include "list.h"
 #include "thread.h"
+#include "stats.h"
 
+// How the next thread to run is chosen:
+//	SchedFIFO -- in the order the threads became ready
+//	SchedPriority -- the highest priority ready thread, FIFO among
+//		threads of the same priority
+//	SchedMLFQ -- multilevel feedback queue: a thread that uses up
+//		its quantum drops a level, where the quantum is longer,
+//		and a thread that blocks first (for the disk, say) stays
+//		where it is.  Every MLFQBoostTicks all threads go back
+//		to the top, so long-running ones aren't starved.
+//	SchedSJF -- shortest job first: the thread expected to block
+//		soonest.  A CPU burst runs from when a thread gets the
+//		CPU to when it blocks, and the next one is predicted to
+//		be as long as the average of the last burst and the
+//		last prediction.  A running thread keeps the CPU until
+//		it blocks.
+//	SchedSRTF -- shortest remaining time first: SJF, but at each
+//		time slice the running thread yields to a ready thread
+//		expected to block sooner than it is.
+
+enum SchedPolicy { SchedFIFO, SchedPriority, SchedMLFQ, SchedSJF, 
+		   SchedSRTF };
+
+#define MLFQLevels	4		// queues, 0 the top
+#define MLFQQuantum(level) (1 << (level))	// timer interrupts a
+						// thread at "level" runs
+#define MLFQBoostTicks	20000		// ticks between boosts
+
+// Several simulated CPUs ("-np n", up to MaxCPUs) share the one
+// Machine: each CPU has its own ready queues, and the CPUs take turns
+// at the Machine, one time slice (or until the thread blocks) each.
+// While k CPUs are busy, the clock advances 1/k of a tick per tick of
+// work, so the k time slices of a round take as long as one would;
+// the result is that k busy CPUs get through k times the work in the
+// same simulated time.  Each CPU's registers are those of the thread
+// it is running, saved and restored at each turn as at any context
+// switch, and kernel->currentThread is the running thread of the CPU
+// whose turn it is.
+//
+// A new thread goes on the CPUs' queues round robin.  A CPU whose
+// queue is empty when its turn comes steals a thread from the CPU
+// with the most, if that one has a thread waiting as well as the one
+// it is running, so work spreads out as the CPUs run dry.
 // The following class defines the scheduler/dispatcher abstraction -- 
 // the data structures and operations needed to keep track of which 
 // thread is running, and which threads are ready but not running.
+//
+// Each CPU has a ready queue per priority, and a bitmap of the queues
+// that are not empty, so the highest priority ready thread is found
+// with a single find-last-set, however many threads are ready.  Under
+// SchedFIFO every thread goes on the queue of priority 0; under
+// SchedMLFQ the top MLFQLevels queues are the feedback levels.  Under
+// SchedSJF and SchedSRTF the queue of priority 0 is kept sorted by
+// the time each thread is expected to run before it blocks.
 
 class Scheduler {
   public:
-    Scheduler();		// Initialize list of ready threads 
+    Scheduler(char *policyName = NULL, int cpus = 1);
+    				// Initialize list of ready
+    				// threads; "policyName" is "fifo" (the
+				// default), "priority", "mlfq",
+				// "sjf" or "srtf"; "cpus" is how many
+				// CPUs to simulate
     ~Scheduler();		// De-allocate ready list
 
     void ReadyToRun(Thread* thread);	
     				// Thread can be dispatched.
     Thread* FindNextToRun();	// Dequeue first thread on the ready 
 				// list, if any, and return thread.
+    void ChangePriority(Thread *thread, int priority);
+    				// Set its priority, moving it to its
+				// new ready queue if it is ready
+    Thread *TakeWaiter(IntrusiveList<Thread> *waiting);
+    				// Remove the thread that should be woken
+				// first from a semaphore's queue
+    bool TimeSlice(int slices = 1);
+    				// Charge timer ticks to the running
+    				// thread; TRUE if it should yield, to
+				// another thread or to the next CPU
+    bool NeedsSlice();		// Could TimeSlice make it yield?
+    int Quantum(Thread *thread);	// Timer ticks it may run for
     void Run(Thread* nextThread, bool finishing);
     				// Cause nextThread to start running
     void CheckToBeDestroyed();// Check if thread that had been
     				// running needs to be deleted
+    void LoadUserState(Thread *thread);
+    				// Give the machine's user registers and
+				// page table to this user thread
     void Print();		// Print contents of ready list
+
+    int NumCPUs() { return numCPUs; }
+    int CurrentCPU() { return cpu; }	// whose turn it is
     
     // SelfTest for scheduler is implemented in class Thread
     
   private:
-    List<Thread *> *readyList;  // queue of threads that are ready to run,
-				// but not running
+    SchedPolicy policy;		// how the next thread is chosen
+    int numCPUs;		// simulated CPUs
+    int cpu;			// the one whose turn it is
+    int nextHome;		// CPU the next new thread goes on
+    bool passing;		// the running thread yields only to let
+    				// the next CPU have its turn
+    List<Thread *> *readyList[MaxCPUs][NumPriorities];
+    				// queues of threads that are ready to
+				// run, but not running, by CPU and
+				// priority
+    unsigned int readyLevels[MaxCPUs];	// bit i set if readyList[c][i]
+    					// isn't empty
+    int numReady[MaxCPUs];	// threads on each CPU's queues
+    int boostEpoch;		// MLFQ: boosts done so far
+    int lastBoost;		// and the tick of the last one
+
+    int Level(Thread *thread);	// the queue a thread goes on
+    void Enqueue(Thread *thread, bool front);
+    				// put it on its CPU's queue
+    Thread *TakeFrom(int which);	// remove the next to run from a
+    					// CPU's queues, or NULL
+    Thread *Steal();		// find a thread for an idle CPU
+    bool PolicySlice(int slices);	// TimeSlice, for this CPU alone
+    void Boost();		// MLFQ: everyone back to the top
+    void Charge(Thread *thread);	// SJF: add the CPU time it has
+    					// used since it was dispatched
     Thread *toBeDestroyed;	// finishing thread to be destroyed
     				// by the next thread that runs
+    Thread *userOwner;		// thread whose user state is loaded in
+    				// the machine, or NULL
 };
 
 #endif // SCHEDULER_H
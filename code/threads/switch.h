@@ -130,29 +130,32 @@
 
 #ifdef x86
 
-/* the offsets of the registers from the beginning of the thread object */
+/* The offsets of the registers from the beginning of the thread object.
+ * SWITCH is an ordinary function call, so only the registers the
+ * caller expects to survive one -- the callee-saved ebx, ebp, esi and
+ * edi, and the stack pointer -- need saving; the return address is
+ * on the stack already.  So the thread's initial state must be in
+ * callee-saved registers too.
+ */
 #define _ESP     0
-#define _EAX     4
-#define _EBX     8
-#define _ECX     12
-#define _EDX     16
-#define _EBP     20
-#define _ESI     24
-#define _EDI     28
-#define _PC      32
+#define _EBX     4
+#define _EBP     8
+#define _ESI     12
+#define _EDI     16
+#define _PC      20		/* not used by SWITCH; ThreadRoot is */
+				/* pushed on the new thread's stack */
 
 /* These definitions are used in Thread::AllocateStack(). */
 #define PCState         (_PC/4-1)
-#define FPState         (_EBP/4-1)
 #define InitialPCState  (_ESI/4-1)
-#define InitialArgState (_EDX/4-1)
+#define InitialArgState (_EBP/4-1)
 #define WhenDonePCState (_EDI/4-1)
-#define StartupPCState  (_ECX/4-1)
+#define StartupPCState  (_EBX/4-1)
 
 #define InitialPC       %esi
-#define InitialArg      %edx
+#define InitialArg      %ebp
 #define WhenDonePC      %edi
-#define StartupPC       %ecx
+#define StartupPC       %ebx
 
 #endif // x86
 
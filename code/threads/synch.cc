@@ -28,6 +28,14 @@
 // The implementation of condition variables using semaphores is
 // a bit trickier, as explained below under Condition::Wait.
 //
+// Turning interrupts back on costs a tick and a check for pending
+// interrupts, so the uncontended cases -- P of a positive semaphore no
+// one is waiting on, V with no one waiting, Acquire of a free lock and
+// Release with no one waiting -- are done without touching the
+// interrupt level.  That is still atomic: another thread can only get
+// the CPU at a tick or when this one blocks, and neither can happen
+// in the few statements of a fast path.
+//
 // Copyright (c) 1992-1996 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
 // of liability and disclaimer of warranty provisions.
@@ -35,6 +43,21 @@
 #include "copyright.h"
 #include "synch.h"
 #include "main.h"
+#include "kregion.h"
+
+//----------------------------------------------------------------------
+// CountsFor
+// 	Return the counts an object of "kind" named "name" keeps its
+//	waits in, or NULL if they aren't being counted (see contention.h).
+//----------------------------------------------------------------------
+
+static SynchCounts *
+CountsFor(SynchKind kind, char *name)
+{
+    if (kernel == NULL || kernel->contention == NULL)
+	return NULL;
+    return kernel->contention->Find(kind, name);
+}
 
 //----------------------------------------------------------------------
 // Semaphore::Semaphore
@@ -48,7 +71,8 @@ Semaphore::Semaphore(char* debugName, int initialValue)
 {
     name = debugName;
     value = initialValue;
-    queue = new List<Thread *>;
+    queue = new IntrusiveList<Thread>(&Thread::waitNext);
+    counts = CountsFor(SynchSemaphore, name);
 }
 
 //----------------------------------------------------------------------
@@ -77,14 +101,30 @@ Semaphore::P()
 {
     Interrupt *interrupt = kernel->interrupt;
     Thread *currentThread = kernel->currentThread;
+    IntStatus oldLevel;
+    bool waited = FALSE;
+    int start;
     
+    if (counts != NULL)
+	counts->acquires++;
+    if (value > 0 && queue->IsEmpty()) {	// fast path, see above
+	value--;
+	return;
+    }
+
+    KernelRegion region("Semaphore::P");	// only the slow path
+
     // disable interrupts
-    IntStatus oldLevel = interrupt->SetLevel(IntOff);	
+    oldLevel = interrupt->SetLevel(IntOff);	
     
+    start = kernel->stats->totalTicks;
     while (value == 0) { 		// semaphore not available
 	queue->Append(currentThread);	// so go to sleep
 	currentThread->Sleep(FALSE);
+	waited = TRUE;
     } 
+    if (counts != NULL && waited)
+	counts->Waited(kernel->stats->totalTicks - start, "");
     value--; 			// semaphore available, consume its value
    
     // re-enable interrupts
@@ -103,12 +143,18 @@ void
 Semaphore::V()
 {
     Interrupt *interrupt = kernel->interrupt;
+    IntStatus oldLevel;
     
+    if (queue->IsEmpty()) {		// fast path: no one to wake up
+	value++;
+	return;
+    }
+
     // disable interrupts
-    IntStatus oldLevel = interrupt->SetLevel(IntOff);	
+    oldLevel = interrupt->SetLevel(IntOff);	
     
     if (!queue->IsEmpty()) {  // make thread ready.
-	kernel->scheduler->ReadyToRun(queue->RemoveFront());
+	kernel->scheduler->ReadyToRun(kernel->scheduler->TakeWaiter(queue));
     }
     value++;
     
@@ -160,6 +206,9 @@ Lock::Lock(char* debugName)
     name = debugName;
     semaphore = new Semaphore("lock", 1);  // initially, unlocked
     lockHolder = NULL;
+    waiters = new List<Thread *>;
+    handoffs = new List<CondWaiter *>;
+    counts = CountsFor(SynchLock, name);
 }
 
 //----------------------------------------------------------------------
@@ -169,6 +218,8 @@ Lock::Lock(char* debugName)
 Lock::~Lock()
 {
     delete semaphore;
+    delete waiters;
+    delete handoffs;
 }
 
 //----------------------------------------------------------------------
@@ -176,12 +227,68 @@ Lock::~Lock()
 //	Atomically wait until the lock is free, then set it to busy.
 //	Equivalent to Semaphore::P(), with the semaphore value of 0
 //	equal to busy, and semaphore value of 1 equal to free.
+//
+//	While we wait, the holder runs with our priority if that is
+//	higher than its own, so a lower priority thread can't keep us
+//	waiting by not getting the CPU to release the lock.
 //----------------------------------------------------------------------
 
 void Lock::Acquire()
 {
+    Thread *currentThread = kernel->currentThread;
+    IntStatus oldLevel;
+    const char *holder;
+    int start;
+
+    if (counts != NULL)
+	counts->acquires++;
+    if (lockHolder == NULL && waiters->IsEmpty()) {	// fast path: free,
+	semaphore->P();			// so this can't block, and with no
+	lockHolder = currentThread;	// waiters there is nothing to donate
+	currentThread->locksHeld->Append(this);
+	kernel->stats->numLockUncontended++;
+	return;
+    }
+    kernel->stats->numLockContended++;
+    oldLevel = kernel->interrupt->SetLevel(IntOff);
+    holder = (lockHolder != NULL) ? lockHolder->getName() : "";
+    start = kernel->stats->totalTicks;
+
+    if (lockHolder != NULL) {		// donate while we wait
+	waiters->Append(currentThread);
+	currentThread->waitingFor = this;
+	lockHolder->UpdatePriority();
+    }
     semaphore->P();
-    lockHolder = kernel->currentThread;
+    if (currentThread->waitingFor == this) {
+	waiters->Remove(currentThread);
+	currentThread->waitingFor = NULL;
+    }
+    lockHolder = currentThread;
+    currentThread->locksHeld->Append(this);
+    currentThread->UpdatePriority();	// those still waiting donate to us
+    if (counts != NULL)
+	counts->Waited(kernel->stats->totalTicks - start, holder);
+    (void) kernel->interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// Lock::WaiterPriority
+// 	Return the highest priority of the threads waiting for the lock,
+//	or -1 if there are none.  Called with interrupts off.
+//----------------------------------------------------------------------
+
+int
+Lock::WaiterPriority()
+{
+    ListIterator<Thread *> it(waiters);
+    int highest = -1;
+
+    for (; !it.IsDone(); it.Next()) {
+	if (it.Item()->getPriority() > highest)
+	    highest = it.Item()->getPriority();
+    }
+    return highest;
 }
 
 //----------------------------------------------------------------------
@@ -193,13 +300,63 @@ void Lock::Acquire()
 //
 //	By convention, only the thread that acquired the lock
 // 	may release it.
+//
+//	A thread signalled on a condition while we held the lock gets
+//	it first: it becomes the holder without the lock ever being
+//	free, and is woken up.
 //---------------------------------------------------------------------
 
 void Lock::Release()
 {
+    Thread *currentThread = kernel->currentThread;
+    IntStatus oldLevel;
+
     ASSERT(IsHeldByCurrentThread());
+    if (waiters->IsEmpty()) {		// fast path: no one donated to us
+	lockHolder = NULL;		// through this lock, or needs waking
+	currentThread->locksHeld->Remove(this);
+	semaphore->V();
+	return;
+    }
+    oldLevel = kernel->interrupt->SetLevel(IntOff);
     lockHolder = NULL;
-    semaphore->V();
+    currentThread->locksHeld->Remove(this);
+    currentThread->UpdatePriority();	// give back what was donated
+    if (!handoffs->IsEmpty()) {		// hand it to a signalled thread
+	CondWaiter *waiter = handoffs->RemoveFront();
+
+	waiters->Remove(waiter->thread);
+	waiter->thread->waitingFor = NULL;
+	lockHolder = waiter->thread;
+	lockHolder->locksHeld->Append(this);
+	lockHolder->UpdatePriority();	// the rest now donate to it
+	waiter->wakeup.V();
+    } else {
+	semaphore->V();
+    }
+    (void) kernel->interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// Lock::Morph
+//	Move a thread signalled on a condition to this lock, which the
+//	signaller holds: it waits for the lock from now on, donating its
+//	priority like any other waiter, and Release will hand it the
+//	lock.
+//
+//	"waiter" -- the signalled thread, asleep in Condition::Wait
+//---------------------------------------------------------------------
+
+void Lock::Morph(CondWaiter *waiter)
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+
+    ASSERT(IsHeldByCurrentThread());
+    handoffs->Append(waiter);
+    waiters->Append(waiter->thread);
+    waiter->thread->waitingFor = this;
+    lockHolder->UpdatePriority();
+    (void) kernel->interrupt->SetLevel(oldLevel);
 }
 
 //----------------------------------------------------------------------
@@ -213,7 +370,8 @@ void Lock::Release()
 Condition::Condition(char* debugName)
 {
     name = debugName;
-    waitQueue = new List<Semaphore *>;
+    waitQueue = new List<CondWaiter *>;
+    counts = CountsFor(SynchCondition, name);
 }
 
 //----------------------------------------------------------------------
@@ -236,23 +394,29 @@ Condition::~Condition()
 //	calling P().
 //
 //	Note: we assume Mesa-style semantics, which means that the
-//	waiter must re-acquire the monitor lock when waking up.
+//	waiter must re-acquire the monitor lock when waking up.  Here
+//	the lock is handed to it before it is woken (see Lock::Morph).
 //
 //	"conditionLock" -- lock protecting the use of this condition
 //----------------------------------------------------------------------
 
 void Condition::Wait(Lock* conditionLock) 
 {
-     Semaphore *waiter;
+     CondWaiter *waiter;
+     int start = kernel->stats->totalTicks;
     
      ASSERT(conditionLock->IsHeldByCurrentThread());
 
-     waiter = new Semaphore("condition", 0);
+     waiter = new CondWaiter(kernel->currentThread);
      waitQueue->Append(waiter);
      conditionLock->Release();
-     waiter->P();
-     conditionLock->Acquire();
+     waiter->wakeup.P();
+     ASSERT(conditionLock->IsHeldByCurrentThread());	// handed to us
      delete waiter;
+     if (counts != NULL) {
+	counts->acquires++;
+	counts->Waited(kernel->stats->totalTicks - start, "");
+     }
 }
 
 //----------------------------------------------------------------------
@@ -272,14 +436,28 @@ void Condition::Wait(Lock* conditionLock)
 
 void Condition::Signal(Lock* conditionLock)
 {
-    Semaphore *waiter;
+    (void) SignalN(conditionLock, 1);
+}
+
+//----------------------------------------------------------------------
+// Condition::SignalN
+// 	Wake up to "n" threads waiting on this condition, in the order
+//	they started waiting.  Each is moved to the lock, and gets it in
+//	turn as the lock is released.  Returns how many were signalled.
+//
+//	"conditionLock" -- lock protecting the use of this condition
+//	"n" -- most threads to wake up
+//----------------------------------------------------------------------
+
+int Condition::SignalN(Lock* conditionLock, int n)
+{
+    int woken = 0;
     
     ASSERT(conditionLock->IsHeldByCurrentThread());
     
-    if (!waitQueue->IsEmpty()) {
-        waiter = waitQueue->RemoveFront();
-	waiter->V();
-    }
+    for (; woken < n && !waitQueue->IsEmpty(); woken++)
+	conditionLock->Morph(waitQueue->RemoveFront());
+    return woken;
 }
 
 //----------------------------------------------------------------------
@@ -291,7 +469,94 @@ void Condition::Signal(Lock* conditionLock)
 
 void Condition::Broadcast(Lock* conditionLock) 
 {
-    while (!waitQueue->IsEmpty()) {
-        Signal(conditionLock);
-    }
+    (void) SignalN(conditionLock, waitQueue->NumInList());
+}
+
+//----------------------------------------------------------------------
+// RWLock::RWLock
+// 	Initialize a reader-writer lock, held by no one.
+//
+//	"debugName" is an arbitrary name, useful for debugging.
+//----------------------------------------------------------------------
+
+RWLock::RWLock(char *debugName)
+{
+    name = debugName;
+    lock = new Lock(debugName);
+    readOK = new Condition(debugName);
+    writeOK = new Condition(debugName);
+    numReaders = writersWaiting = 0;
+    writer = NULL;
+}
+
+//----------------------------------------------------------------------
+// RWLock::~RWLock
+// 	Deallocate a reader-writer lock, which no one may hold.
+//----------------------------------------------------------------------
+
+RWLock::~RWLock()
+{
+    ASSERT(numReaders == 0 && writer == NULL);
+    delete lock;
+    delete readOK;
+    delete writeOK;
+}
+
+//----------------------------------------------------------------------
+// RWLock::AcquireRead, RWLock::ReleaseRead
+// 	Hold the lock for reading, waiting while a writer holds it or
+//	wants it; and let go of it.  The last reader out lets a waiting
+//	writer in.
+//----------------------------------------------------------------------
+
+void
+RWLock::AcquireRead()
+{
+    lock->Acquire();
+    while (writer != NULL || writersWaiting > 0)
+	readOK->Wait(lock);
+    numReaders++;
+    lock->Release();
+}
+
+void
+RWLock::ReleaseRead()
+{
+    lock->Acquire();
+    ASSERT(numReaders > 0);
+    if (--numReaders == 0)
+	writeOK->Signal(lock);
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// RWLock::AcquireWrite, RWLock::ReleaseWrite
+// 	Hold the lock for writing, waiting until no one else holds it;
+//	and let go of it, in favor of the next writer if there is one,
+//	else of every waiting reader.
+//----------------------------------------------------------------------
+
+void
+RWLock::AcquireWrite()
+{
+    lock->Acquire();
+    writersWaiting++;
+    while (writer != NULL || numReaders > 0)
+	writeOK->Wait(lock);
+    writersWaiting--;
+    writer = kernel->currentThread;
+    lock->Release();
+}
+
+void
+RWLock::ReleaseWrite()
+{
+    lock->Acquire();
+    ASSERT(writer == kernel->currentThread);
+    writer = NULL;
+    if (writersWaiting > 0)
+	writeOK->Signal(lock);
+    else
+	readOK->Broadcast(lock);
+    lock->Release();
 }
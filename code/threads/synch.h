@@ -21,6 +21,7 @@
 #include "thread.h"
 #include "list.h"
 #include "main.h"
+#include "contention.h"
 
 // The following class defines a "semaphore" whose value is a non-negative
 // integer.  The semaphore has only two operations P() and V():
@@ -50,10 +51,23 @@ class Semaphore {
   private:
     char* name;        // useful for debugging
     int value;         // semaphore value, always >= 0
-    List<Thread *> *queue;     
-		  	// threads waiting in P() for the value to be > 0
+    SynchCounts *counts;	// how it is waited on, if counted (-lc)
+    IntrusiveList<Thread> *queue;     
+		  	// threads waiting in P() for the value to be > 0,
+			// chained through Thread::waitNext
    };
 
+// A thread waiting in Condition::Wait, and the semaphore it sleeps on
+// until it is signalled and handed the lock.
+
+class CondWaiter {
+  public:
+    CondWaiter(Thread *t) : wakeup("condition", 0) { thread = t; }
+
+    Thread *thread;
+    Semaphore wakeup;
+};
+
 // The following class defines a "lock".  A lock can be BUSY or FREE.
 // There are only two operations allowed on a lock: 
 //
@@ -79,6 +93,13 @@ class Lock {
     		return lockHolder == kernel->currentThread; }
     				// return true if the current thread 
 				// holds this lock.
+    Thread *getHolder() { return lockHolder; }
+    int WaiterPriority();	// highest priority of the threads
+    				// waiting in Acquire, -1 if none
+    void Morph(CondWaiter *waiter);
+    				// Condition::Signal: "waiter" is to be
+				// woken holding the lock, when it's next
+				// released
     
     // Note: SelfTest routine provided by SynchList
     
@@ -86,6 +107,12 @@ class Lock {
     char *name;			// debugging assist
     Thread *lockHolder;		// thread currently holding lock
     Semaphore *semaphore;	// we use a semaphore to implement lock
+    List<Thread *> *waiters;	// threads waiting in Acquire, which
+    				// donate their priority to lockHolder
+				// (and those in handoffs)
+    List<CondWaiter *> *handoffs;	// signalled threads, to be given
+    					// the lock before anyone else
+    SynchCounts *counts;	// how it is waited on, if counted (-lc)
 };
 
 // The following class defines a "condition variable".  A condition
@@ -100,6 +127,8 @@ class Lock {
 //
 //	Broadcast() -- wake up all threads waiting on the condition
 //
+//	SignalN(n) -- wake up n of them
+//
 // All operations on a condition variable must be made while
 // the current thread has acquired a lock.  Indeed, all accesses
 // to a given condition variable must be protected by the same lock.
@@ -120,6 +149,13 @@ class Lock {
 // can acquire the lock, and change data structures, before the woken
 // thread gets a chance to run.  The advantage to Mesa-style semantics
 // is that it is a lot easier to implement than Hoare-style.
+//
+// A signalled thread isn't actually woken while the signaller holds the
+// lock -- it would only block again on the lock.  Instead it is moved
+// to the lock ("wait morphing"), which hands it over, and only then
+// wakes it, when it is released.  So a Broadcast to many threads costs
+// one wakeup per thread as it gets its turn with the lock, and no
+// thread is woken just to wait again.
 
 class Condition {
   public:
@@ -135,10 +171,50 @@ class Condition {
     void Signal(Lock *conditionLock);   // conditionLock must be held by
     void Broadcast(Lock *conditionLock);// the currentThread for all of 
 					// these operations
+    int SignalN(Lock *conditionLock, int n);
+    					// Signal up to n waiters; returns
+					// how many there were
     // SelfTest routine provided by SyncLists
 
   private:
     char* name;
-    List<Semaphore *> *waitQueue;	// list of waiting threads
+    List<CondWaiter *> *waitQueue;	// list of waiting threads
+    SynchCounts *counts;	// how it is waited on, if counted (-lc)
+};
+
+// The following class defines a "reader-writer lock".  Any number of
+// threads may hold it for reading at once, or one thread for writing:
+//
+//	AcquireRead -- wait until no thread holds the lock for writing,
+//		or is waiting to, then hold it for reading
+//
+//	AcquireWrite -- wait until no thread holds the lock at all, then
+//		hold it for writing
+//
+// Waiting writers are preferred: once one is waiting, new readers wait
+// behind it, so a steady stream of readers can't keep writers out.
+// The price is that a thread must not AcquireRead a lock it already
+// holds for reading, since a writer may have arrived in between.
+
+class RWLock {
+  public:
+    RWLock(char *debugName);		// initialize lock to be free
+    ~RWLock();
+    char *getName() { return name; }
+
+    void AcquireRead();
+    void ReleaseRead();
+    void AcquireWrite();
+    void ReleaseWrite();
+
+  private:
+    char *name;
+    Lock *lock;				// protects the fields below
+    Condition *readOK;			// readers wait here,
+    Condition *writeOK;			// and writers here
+    int numReaders;			// threads holding it for reading
+    int writersWaiting;			// threads in AcquireWrite
+    Thread *writer;			// thread holding it for writing,
+    					// or NULL
 };
 #endif // SYNCH_H
@@ -128,3 +128,240 @@ SynchList<T>::SelfTest(T val)
     }
     delete selfTestPing;
 }
+
+//----------------------------------------------------------------------
+// BoundedSynchList<T>::BoundedSynchList
+//	Allocate and initialize a bounded synchronized list, with room
+//	for "size" items, empty to start with.
+//----------------------------------------------------------------------
+
+template <class T>
+BoundedSynchList<T>::BoundedSynchList(int size)
+{
+    ASSERT(size > 0);
+    this->size = size;
+    ring = new T[size];
+    head = count = 0;
+    lock = new Lock("bounded list lock");
+    notEmpty = new Condition("bounded list empty cond");
+    notFull = new Condition("bounded list full cond");
+}
+
+//----------------------------------------------------------------------
+// BoundedSynchList<T>::~BoundedSynchList
+//	De-allocate the data structures of a bounded list.
+//----------------------------------------------------------------------
+
+template <class T>
+BoundedSynchList<T>::~BoundedSynchList()
+{
+    delete notFull;
+    delete notEmpty;
+    delete lock;
+    delete [] ring;
+}
+
+//----------------------------------------------------------------------
+// BoundedSynchList<T>::Put
+//	Copy as many of items[0..n-1] onto the end of the ring as there
+//	is room for, and wake up a remover for each.  The lock is held.
+// Returns:
+//	How many were copied.
+//----------------------------------------------------------------------
+
+template <class T>
+int
+BoundedSynchList<T>::Put(T *items, int n)
+{
+    int done;
+
+    for (done = 0; done < n && count < size; done++, count++)
+	ring[(head + count) % size] = items[done];
+    if (done > 0)
+	notEmpty->SignalN(lock, done);
+    return done;
+}
+
+//----------------------------------------------------------------------
+// BoundedSynchList<T>::Take
+//	Copy up to "n" items off the front of the ring into items[], and
+//	wake up an appender for each slot freed.  The lock is held.
+// Returns:
+//	How many were copied.
+//----------------------------------------------------------------------
+
+template <class T>
+int
+BoundedSynchList<T>::Take(T *items, int n)
+{
+    int done;
+
+    for (done = 0; done < n && count > 0; done++, count--) {
+	items[done] = ring[head];
+	head = (head + 1) % size;
+    }
+    if (done > 0)
+	notFull->SignalN(lock, done);
+    return done;
+}
+
+//----------------------------------------------------------------------
+// BoundedSynchList<T>::Append
+//      Append an "item" to the end of the list, waiting for room if
+//	"block" is set.
+// Returns:
+//	FALSE if the list was full and we didn't wait.
+//----------------------------------------------------------------------
+
+template <class T>
+bool
+BoundedSynchList<T>::Append(T item, bool block)
+{
+    return AppendBatch(&item, 1, block) == 1;
+}
+
+//----------------------------------------------------------------------
+// BoundedSynchList<T>::AppendBatch
+//      Append items[0..n-1] to the end of the list, in order.  If
+//	"block" is set, wait for room as often as needed; otherwise
+//	append only what fits now.
+//
+//	Items from one batch may be interleaved with another producer's
+//	if we have to wait part way through.
+// Returns:
+//	How many items were appended.
+//----------------------------------------------------------------------
+
+template <class T>
+int
+BoundedSynchList<T>::AppendBatch(T *items, int n, bool block)
+{
+    int done;
+
+    lock->Acquire();
+    done = Put(items, n);
+    while (block && done < n) {
+	notFull->Wait(lock);		// wait until there's room
+	done += Put(items + done, n - done);
+    }
+    lock->Release();
+    return done;
+}
+
+//----------------------------------------------------------------------
+// BoundedSynchList<T>::RemoveFront
+//      Remove an item from the beginning of the list.  Wait if the
+//	list is empty.
+// Returns:
+//	The removed item.
+//----------------------------------------------------------------------
+
+template <class T>
+T
+BoundedSynchList<T>::RemoveFront()
+{
+    T item;
+
+    (void) RemoveUpTo(&item, 1, TRUE);
+    return item;
+}
+
+//----------------------------------------------------------------------
+// BoundedSynchList<T>::TryRemoveFront
+//      Remove an item from the beginning of the list into "*item",
+//	unless the list is empty.
+// Returns:
+//	FALSE if it was.
+//----------------------------------------------------------------------
+
+template <class T>
+bool
+BoundedSynchList<T>::TryRemoveFront(T *item)
+{
+    return RemoveUpTo(item, 1, FALSE) == 1;
+}
+
+//----------------------------------------------------------------------
+// BoundedSynchList<T>::RemoveUpTo
+//      Remove up to "n" items from the beginning of the list into
+//	items[], in order.  If "block" is set, wait until there is at
+//	least one; we don't wait for all n.
+// Returns:
+//	How many items were removed.
+//----------------------------------------------------------------------
+
+template <class T>
+int
+BoundedSynchList<T>::RemoveUpTo(T *items, int n, bool block)
+{
+    int done;
+
+    lock->Acquire();
+    while (block && count == 0 && n > 0)
+	notEmpty->Wait(lock);		// wait until list isn't empty
+    done = Take(items, n);
+    lock->Release();
+    return done;
+}
+
+//----------------------------------------------------------------------
+// BoundedSynchList<T>::NumInList
+//      Return how many items are on the list; by the time the caller
+//	looks, it may have changed.
+//----------------------------------------------------------------------
+
+template <class T>
+int
+BoundedSynchList<T>::NumInList()
+{
+    int n;
+
+    lock->Acquire();
+    n = count;
+    lock->Release();
+    return n;
+}
+
+//----------------------------------------------------------------------
+// BoundedSynchList<T>::SelfTest, SelfTestHelper
+//	Test the bounded list the same way as SynchList, with the ping
+//	list holding fewer items than are sent, so that the sender has
+//	to wait for room, and the values sent in batches.
+//----------------------------------------------------------------------
+
+template <class T>
+void
+BoundedSynchList<T>::SelfTestHelper (void* data) 
+{
+    BoundedSynchList<T>* _this = (BoundedSynchList<T>*)data;
+    T batch[4];
+
+    for (int i = 0; i < 10; ) {
+	int n = _this->selfTestPing->RemoveUpTo(batch, 4);
+
+	ASSERT(_this->AppendBatch(batch, n) == n);
+	i += n;
+    }
+}
+
+template <class T>
+void
+BoundedSynchList<T>::SelfTest(T val)
+{
+    Thread *helper = new Thread("bounded ping", 1);
+    T batch[10], item;
+
+    ASSERT(NumInList() == 0 && !TryRemoveFront(&item));
+    selfTestPing = new BoundedSynchList<T>(3);
+    for (int i = 0; i < 3; i++)
+	ASSERT(selfTestPing->Append(val, FALSE));
+    ASSERT(!selfTestPing->Append(val, FALSE));	// full
+    ASSERT(selfTestPing->RemoveUpTo(batch, 10) == 3);
+    helper->Fork(BoundedSynchList<T>::SelfTestHelper, this);
+    for (int i = 0; i < 10; i++)
+	batch[i] = val;
+    ASSERT(selfTestPing->AppendBatch(batch, 10) == 10);
+    for (int i = 0; i < 10; i++)
+	ASSERT(val == this->RemoveFront());
+    delete selfTestPing;
+}
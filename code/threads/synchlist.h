@@ -2,6 +2,8 @@
 //	Data structures for synchronized access to a list.
 //
 //	Identical interface to List, except accesses are synchronized.
+//	A bounded version, for queues between producers and consumers,
+//	is below.
 //
 // Copyright (c) 1992-1996 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
@@ -14,6 +16,8 @@
 #include "list.h"
 #include "synch.h"
 
+#define BoundedListSize	32	// default capacity of a BoundedSynchList
+
 // The following class defines a "synchronized list" -- a list for which
 // these constraints hold:
 //	1. Threads trying to remove an item from a list will
@@ -34,6 +38,10 @@ class SynchList {
 
     void Apply(void (*f)(T)); // apply function to all elements in list
 
+    bool IsEmpty() { return list->IsEmpty(); }
+    				// would RemoveFront wait?  Only a hint,
+				// unless interrupts are off
+
     void SelfTest(T value);	// test the SynchList implementation
     
   private:
@@ -46,6 +54,62 @@ class SynchList {
     static void SelfTestHelper(void* data);
 };
 
+// The following class defines a bounded synchronized list, for
+// pipelines between a producer and its consumers: the items are kept
+// in a fixed-size ring buffer, and
+//	1. Threads removing items wait until there is one, as above.
+//	2. Threads appending items wait until there is room, so a
+//	producer can't get arbitrarily far ahead ("back-pressure").
+//	3. AppendBatch and RemoveUpTo move many items for one lock
+//	acquisition and one signal per waiting thread, rather than one
+//	round trip per item.
+// Each operation can instead be non-blocking ("block" FALSE), and
+// does what it can without waiting.
+
+template <class T>
+class BoundedSynchList {
+  public:
+    BoundedSynchList(int size = BoundedListSize);
+    				// initialize, empty, with room for "size"
+    ~BoundedSynchList();	// de-allocate a bounded list
+
+    bool Append(T item, bool block = TRUE);
+    				// append item at the end, waiting for
+				// room; FALSE if non-blocking and full
+    int AppendBatch(T *items, int n, bool block = TRUE);
+    				// append items[0..n-1]; returns how many
+				// (all n, if blocking)
+
+    T RemoveFront();		// remove the first item, waiting if
+				// the list is empty
+    bool TryRemoveFront(T *item); // the same, but FALSE if it's empty
+    int RemoveUpTo(T *items, int n, bool block = TRUE);
+    				// remove up to n items into items[];
+				// returns how many -- at least one, if
+				// blocking
+
+    int NumInList();		// items on the list now
+    int Capacity() { return size; }
+
+    void SelfTest(T value);	// test the BoundedSynchList implementation
+
+  private:
+    T *ring;			// the items, from ring[head], wrapping
+    int size;			// slots in ring
+    int head;			// the first item
+    int count;			// how many items there are
+    Lock *lock;			// enforce mutual exclusive access
+    Condition *notEmpty;	// wait in Remove if the list is empty
+    Condition *notFull;		// wait in Append if it's full
+
+    int Put(T *items, int n);	// copy in what fits; the lock is held
+    int Take(T *items, int n);	// copy out what's there; ditto
+
+    // these are only to assist SelfTest()
+    BoundedSynchList<T> *selfTestPing;
+    static void SelfTestHelper(void* data);
+};
+
 #include "synchlist.cc"
 
 #endif // SYNCHLIST_H
@@ -21,10 +21,24 @@
 #include "switch.h"
 #include "synch.h"
 #include "sysdep.h"
+#include "kregion.h"
+#include "memtrack.h"
 
 // this is put at the top of the execution stack, for detecting stack overflows
 const int STACK_FENCEPOST = 0xdedbeef;
 
+// Stacks of deleted threads, kept with their guard pages for the next
+// threads to be forked, so that Fork doesn't have to map and protect
+// a new one each time.  The pool is a list threaded through the first
+// word of each stack, which StackAllocate overwrites anyway.  Each
+// host thread's kernel (-hj) has a pool of its own.
+
+static HostThreadLocal int *stackPool = NULL;	// the first free stack,
+						// or NULL
+static HostThreadLocal int numPooled = 0;	// stacks in the pool
+static HostThreadLocal int stackPoolCap = DefaultStackPool;
+						// most it may hold
+
 //----------------------------------------------------------------------
 // Thread::Thread
 // 	Initialize a thread control block, so that we can then call
@@ -40,12 +54,29 @@ Thread::Thread(char* threadName, int threadID)
     stackTop = NULL;
     stack = NULL;
     status = JUST_CREATED;
+    statusSince = userSince = systemSince = 0;
+    basePriority = priority = DefaultPriority;
+    waitingFor = NULL;
+    waitNext = NULL;
+    locksHeld = new List<Lock *>;
+    queueLevel = sliceUsed = boostEpoch = 0;
+    dispatchedAt = burstTicks = 0;
+    predictedBurst = SJFInitialBurst;
+    wakeTime = 0;
+    ioClass = IOForeground;
+    waitKind = WaitOther;
+    cpu = 0;
+    fsOps = 0;
+    region = NULL;
     for (int i = 0; i < MachineStateSize; i++) {
 	machineState[i] = NULL;		// not strictly necessary, since
 					// new thread ignores contents 
 					// of machine registers
     }
     space = NULL;
+    userStack = -1;
+    exitStatus = -1;			// (if it is killed)
+    MemoryAllocated(MemThreads, sizeof(Thread));
 }
 
 //----------------------------------------------------------------------
@@ -64,8 +95,180 @@ Thread::~Thread()
 {
     DEBUG(dbgThread, "Deleting thread: " << name);
     ASSERT(this != kernel->currentThread);
-    if (stack != NULL)
+    RecordTimes();
+    if (stack != NULL && numPooled < stackPoolCap) {
+	*(int **) stack = stackPool;	// keep it for the next Fork
+	stackPool = stack;
+	numPooled++;
+    } else if (stack != NULL) {
+	DeallocBoundedArray((char *) stack, StackSize * sizeof(int));
+	MemoryFreed(MemStacks, StackSize * sizeof(int));
+    }
+    delete locksHeld;
+    delete space;			// freeing its frames (if it was the
+    					// last thread in it; see Finish)
+    MemoryFreed(MemThreads, sizeof(Thread));
+}
+
+//----------------------------------------------------------------------
+// Thread::setStatus
+// 	Change the thread's status to "st", adding the time since the
+//	last change to the time spent in the old one, and noting the
+//	longest wait on a ready queue.  A thread that was just created
+//	hasn't been anywhere yet.
+//
+//	The user and system ticks it ran are what the kernel's counters
+//	went up by while it was running: only one thread runs at a time,
+//	so Interrupt::OneTick need not charge each tick to a thread, and
+//	this costs nothing per instruction.  Time blocked is charged to
+//	the device it was waiting for, if any (see WaitScope).
+//----------------------------------------------------------------------
+
+void
+Thread::setStatus(ThreadStatus st)
+{
+    Statistics *stats = kernel->stats;
+    int now = stats->totalTicks;
+
+    switch (status) {
+      case RUNNING:
+	times.runTicks += now - statusSince;
+	times.userTicks += stats->userTicks - userSince;
+	times.systemTicks += stats->systemTicks - systemSince;
+	break;
+      case READY:
+	times.readyTicks += now - statusSince;
+	if (st != READY && now - statusSince > kernel->stats->maxReadyWait)
+	    kernel->stats->maxReadyWait = now - statusSince;
+	break;
+      case BLOCKED:
+	times.blockedTicks += now - statusSince;
+	if (waitKind == WaitDisk)
+	    times.diskWaitTicks += now - statusSince;
+	else if (waitKind == WaitConsole)
+	    times.consoleWaitTicks += now - statusSince;
+	break;
+      default:
+	break;
+    }
+    status = st;
+    statusSince = now;
+    userSince = stats->userTicks;
+    systemSince = stats->systemTicks;
+}
+
+//----------------------------------------------------------------------
+// WaitScope::WaitScope, WaitScope::~WaitScope
+// 	The running thread waits for "kind" until the scope ends, and
+//	then for what it waited for before.
+//----------------------------------------------------------------------
+
+WaitScope::WaitScope(WaitKind kind)
+{
+    outer = kernel->currentThread->SetWaitKind(kind);
+}
+
+WaitScope::~WaitScope()
+{
+    (void) kernel->currentThread->SetWaitKind(outer);
+}
+
+//----------------------------------------------------------------------
+// Thread::GetTimes
+// 	Copy the thread's times into "*t", counting the time in its
+//	present status up to now.
+//----------------------------------------------------------------------
+
+void
+Thread::GetTimes(ThreadTimes *t)
+{
+    setStatus(status);		// charge what's pending, status unchanged
+    *t = times;
+}
+
+//----------------------------------------------------------------------
+// Thread::RecordTimes
+// 	Add the thread's times to the kernel statistics, when it is done;
+//	Statistics::Print lists them.
+//----------------------------------------------------------------------
+
+void
+Thread::RecordTimes()
+{
+    ThreadTimes t;
+
+    GetTimes(&t);
+    kernel->stats->RecordThread(name, &t);
+}
+
+//----------------------------------------------------------------------
+// Thread::SetStackPool
+// 	Keep up to "cap" stacks of deleted threads for reuse, freeing
+//	any beyond that already kept; 0 frees every stack at once.
+//----------------------------------------------------------------------
+
+void
+Thread::SetStackPool(int cap)
+{
+    ASSERT(cap >= 0);
+    stackPoolCap = cap;
+    while (numPooled > stackPoolCap) {
+	int *stack = stackPool;
+
+	stackPool = *(int **) stack;
+	numPooled--;
 	DeallocBoundedArray((char *) stack, StackSize * sizeof(int));
+	MemoryFreed(MemStacks, StackSize * sizeof(int));
+    }
+}
+
+//----------------------------------------------------------------------
+// Thread::setPriority
+// 	Give the thread priority "p", 0 (lowest) to NumPriorities - 1.
+//	It keeps any higher priority donated through the locks it holds.
+//----------------------------------------------------------------------
+
+void
+Thread::setPriority(int p)
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+
+    ASSERT(p >= 0 && p < NumPriorities);
+    basePriority = p;
+    UpdatePriority();
+    (void) kernel->interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// Thread::UpdatePriority
+// 	Recompute the priority the thread runs at: its own, or that of
+//	the highest priority thread waiting for a lock it holds, if that
+//	is higher (priority donation).  If it changes and the thread is
+//	itself waiting for a lock, the holder of that lock is updated in
+//	turn, so donation follows a chain of locks.
+//
+//	Called with interrupts off.
+//----------------------------------------------------------------------
+
+void
+Thread::UpdatePriority()
+{
+    ListIterator<Lock *> it(locksHeld);
+    int p = basePriority;
+
+    ASSERT(kernel->interrupt->getLevel() == IntOff);
+    for (; !it.IsDone(); it.Next()) {
+	int donated = it.Item()->WaiterPriority();
+
+	if (donated > p)
+	    p = donated;
+    }
+    if (p == priority)
+	return;
+    DEBUG(dbgThread, "Priority of " << name << " is now " << p);
+    kernel->scheduler->ChangePriority(this, p);
+    if (waitingFor != NULL && waitingFor->getHolder() != NULL)
+	waitingFor->getHolder()->UpdatePriority();
 }
 
 //----------------------------------------------------------------------
@@ -157,6 +360,11 @@ Thread::Begin ()
 // 	Called by ThreadRoot when a thread is done executing the 
 //	forked procedure.
 //
+//	A thread running a user program lets any thread joining it know
+//	(see Kernel::ThreadDone).  If other threads still run in its
+//	address space, it just unmaps its own stack and leaves the space
+//	to them; the last one out unmaps and closes the files.
+//
 // 	NOTE: we can't immediately de-allocate the thread data structure 
 //	or the execution stack, because we're still running in the thread 
 //	and we're still on the stack!  Instead, we tell the scheduler
@@ -170,10 +378,30 @@ Thread::Begin ()
 void
 Thread::Finish ()
 {
+    if (space != NULL) {
+	kernel->ThreadDone(this);
+	if (space->RemoveThread()) {
+	    space->UnmapAll();			// writing back mapped files
+	    space->CloseAll();			// and closing files blocks,
+	} else {				// so not when the space is
+	    if (userStack >= 0)			// deleted
+		(void) space->Munmap(userStack);
+	    space = NULL;			// not ours to delete
+	}
+    }
     (void) kernel->interrupt->SetLevel(IntOff);		
     ASSERT(this == kernel->currentThread);
     
     DEBUG(dbgThread, "Finishing thread: " << name);
+    if (debug->IsEnabled(dbgThread)) {
+	ThreadTimes t;
+
+	GetTimes(&t);
+	DEBUG(dbgThread, "Thread " << name << " ran " << t.userTicks
+		<< " user, " << t.systemTicks << " system ticks; waited "
+		<< t.diskWaitTicks << " on the disk, " << t.consoleWaitTicks
+		<< " on the console");
+    }
     Sleep(TRUE);				// invokes SWITCH
     // not reached
 }
@@ -200,6 +428,7 @@ Thread::Finish ()
 void
 Thread::Yield ()
 {
+    KernelRegion region("Thread::Yield");
     Thread *nextThread;
     IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
     
@@ -207,11 +436,14 @@ Thread::Yield ()
     
     DEBUG(dbgThread, "Yielding thread: " << name);
     
+    // queue ourselves first, so that under the priority scheduler a
+    // lower priority thread does not get the CPU from us
+    kernel->scheduler->ReadyToRun(this);
     nextThread = kernel->scheduler->FindNextToRun();
-    if (nextThread != NULL) {
-	kernel->scheduler->ReadyToRun(this);
+    if (nextThread != this)
 	kernel->scheduler->Run(nextThread, FALSE);
-    }
+    else
+	setStatus(RUNNING);
     (void) kernel->interrupt->SetLevel(oldLevel);
 }
 
@@ -245,12 +477,13 @@ Thread::Sleep (bool finishing)
     
     DEBUG(dbgThread, "Sleeping thread: " << name);
 
-    status = BLOCKED;
+    setStatus(BLOCKED);
 	//cout << "debug Thread::Sleep " << name << "wait for Idle\n";
     while ((nextThread = kernel->scheduler->FindNextToRun()) == NULL) {
 		kernel->PrepareToEnd();
 		kernel->interrupt->Idle();	// no one to run, wait for an interrupt
 	}    
+    kernel->alarm->Resume();		// in case idling stopped the clock
     // returns when it's time for us to run
     kernel->scheduler->Run(nextThread, finishing); 
 }
@@ -306,7 +539,14 @@ PLabelToAddr(void *plabel)
 void
 Thread::StackAllocate (VoidFunctionPtr func, void *arg)
 {
-    stack = (int *) AllocBoundedArray(StackSize * sizeof(int));
+    if (stackPool != NULL) {		// reuse a dead thread's stack
+	stack = stackPool;
+	stackPool = *(int **) stack;
+	numPooled--;
+    } else {
+	stack = (int *) AllocBoundedArray(StackSize * sizeof(int));
+	MemoryAllocated(MemStacks, StackSize * sizeof(int));
+    }
 
 #ifdef PARISC
     // HP stack works from low addresses to high addresses
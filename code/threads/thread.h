@@ -42,21 +42,52 @@
 #include "sysdep.h"
 #include "machine.h"
 #include "addrspace.h"
+#include "list.h"
+#include "stats.h"
+
+class Lock;
+class RegionNode;
 
 // CPU register state to be saved on context switch.  
 // The x86 needs to save only a few registers, 
 // SPARC and MIPS needs to save 10 registers, 
 // the Snake needs 18,
 // and the RS6000 needs to save 75 (!)
-// For simplicity, I just take the maximum over all architectures.
+// The x86 gets just its callee-saved registers (see switch.h); for
+// simplicity, the others all take the maximum.
 
+#ifdef x86
+#define MachineStateSize 5 
+#else
 #define MachineStateSize 75 
+#endif
 
 
 // Size of the thread's private execution stack.
 // WATCH OUT IF THIS ISN'T BIG ENOUGH!!!!!
 const int StackSize = (8 * 1024);	// in words
 
+// How many stacks of deleted threads are kept for new ones, unless
+// changed with Thread::SetStackPool.
+const int DefaultStackPool = 16;
+
+
+// Thread priorities, for the priority scheduler: 0 is the lowest,
+// NumPriorities - 1 the highest.  One bit per level has to fit in
+// the scheduler's bitmap of non-empty ready queues.
+const int NumPriorities = 32;
+const int DefaultPriority = NumPriorities / 2;
+
+// Disk I/O classes, for SynchDisk's scheduler: a realtime request goes
+// ahead of everything, and an idle one waits until no other is queued.
+enum IOClass { IORealtime, IOForeground, IOIdle };
+
+// What a blocked thread is waiting for, so its time blocked can be
+// charged to the device (see ThreadTimes).
+enum WaitKind { WaitOther, WaitDisk, WaitConsole };
+
+// The CPU burst the SJF scheduler expects of a new thread, in ticks.
+const int SJFInitialBurst = 1000;
 
 // Thread state
 enum ThreadStatus { JUST_CREATED, RUNNING, READY, BLOCKED, ZOMBIE };
@@ -99,14 +130,56 @@ class Thread {
     void Finish();  		// The thread is done executing
     
     void CheckOverflow();   	// Check if thread stack has overflowed
-    void setStatus(ThreadStatus st) { status = st; }
+    void setStatus(ThreadStatus st);	// charging the time in the old
+    					// status to it
     ThreadStatus getStatus() { return (status); }
+
+    int getPriority() { return (priority); }	// with any donation
+    void setPriority(int p);	// Change the thread's own priority
+    void setEffectivePriority(int p) { priority = p; }
+    				// only for the scheduler, which must
+				// move a ready thread to its new queue
+    void UpdatePriority();	// Recompute the donated priority, after
+    				// a change to the locks involved
+
+    Lock *waitingFor;		// lock being waited for, or NULL
+    Thread *waitNext;		// next thread on the semaphore queue
+    				// this one sleeps on (see Semaphore)
+    List<Lock *> *locksHeld;	// locks held, whose waiters donate
+
+    int queueLevel;		// MLFQ: the thread's queue, 0 the top
+    int sliceUsed;		// and timer ticks of its quantum used
+    int boostEpoch;		// last priority boost it has had
+
+    int dispatchedAt;		// SJF: tick it last got the CPU,
+    int burstTicks;		// CPU time in the current burst so far,
+    int predictedBurst;		// and the expected length of the burst
+
+    int wakeTime;		// Alarm::WaitUntil: tick to wake up at
+    IOClass ioClass;		// class of the disk requests it makes
+    IOClass SetIOClass(IOClass c) { IOClass old = ioClass; ioClass = c;
+				return old; }
+    				// change it, returning the old one
+    WaitKind waitKind;		// what it waits for, when it blocks
+    WaitKind SetWaitKind(WaitKind k) { WaitKind old = waitKind;
+				waitKind = k; return old; }
+    int cpu;			// simulated CPU whose queue it is on
+    int fsOps;			// file system operations it has open,
+				// counting nested ones (Journal::Begin)
+
+    ThreadTimes times;		// time spent in each status, and switches
+    RegionNode *region;		// kernel region it is in (see kregion.h)
+    void GetTimes(ThreadTimes *t);	// "times", up to now
+    void RecordTimes();		// Keep them in the kernel statistics
 	char* getName() { return (name); }
     
 	int getID() { return (ID); }
     void Print() { cout << name; }
     void SelfTest();		// test whether thread impl is working
 
+    static void SetStackPool(int cap);	// Keep up to "cap" stacks of
+    					// deleted threads for reuse
+
   private:
     // some of the private data for this class is listed above
     
@@ -114,6 +187,11 @@ class Thread {
 				// NULL if this is the main thread
 				// (If NULL, don't deallocate stack)
     ThreadStatus status;	// ready, running or blocked
+    int statusSince;		// tick it got that status
+    int userSince;		// the user and system ticks counted
+    int systemSince;		// by then
+    int basePriority;		// priority given to the thread
+    int priority;		// basePriority, or higher if donated
     char* name;
 	int   ID;
     void StackAllocate(VoidFunctionPtr func, void *arg);
@@ -129,8 +207,28 @@ class Thread {
   public:
     void SaveUserState();		// save user-level register state
     void RestoreUserState();		// restore user-level register state
+    void SetUserRegister(int num, int value) { userRegisters[num] = value; }
+    					// change one, while it isn't running
+
+    AddrSpace *space;			// User code this thread is running,
+    					// perhaps with other threads
+    int userStack;			// its own stack there, if the kernel
+    					// mapped it one (see ThreadFork),
+					// else -1
+    int exitStatus;			// what it gave Exit or ThreadExit
+};
+
+// The following class marks what the running thread waits for, from
+// its declaration to the end of the scope: SynchDisk and the console
+// declare one around each call that can block.
 
-    AddrSpace *space;			// User code this thread is running.
+class WaitScope {
+  public:
+    WaitScope(WaitKind kind);	// The running thread waits for "kind"
+    ~WaitScope();		// and then for what it did before
+
+  private:
+    WaitKind outer;		// the kind before
 };
 
 // external function, dummy routine whose sole job is to call Thread::Print
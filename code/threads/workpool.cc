@@ -0,0 +1,153 @@
+// workpool.cc
+//	Routines for the pool of kernel worker threads.  See workpool.h.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "debug.h"
+#include "workpool.h"
+#include "main.h"
+
+//----------------------------------------------------------------------
+// WaitGroup::WaitGroup, WaitGroup::~WaitGroup
+// 	A count of tasks not yet done, initially zero.
+//----------------------------------------------------------------------
+
+WaitGroup::WaitGroup(char *debugName)
+{
+    name = debugName;
+    count = 0;
+    numWaiting = 0;
+    finished = new Semaphore(debugName, 0);
+}
+
+WaitGroup::~WaitGroup()
+{
+    ASSERT(count == 0 && numWaiting == 0);
+    delete finished;
+}
+
+//----------------------------------------------------------------------
+// WaitGroup::Add
+// 	Note "n" more tasks to wait for.
+//----------------------------------------------------------------------
+
+void
+WaitGroup::Add(int n)
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+
+    count += n;
+    (void) kernel->interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// WaitGroup::Done
+// 	One task has finished; if it was the last, wake up everyone
+//	waiting.
+//----------------------------------------------------------------------
+
+void
+WaitGroup::Done()
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+
+    ASSERT(count > 0);
+    if (--count == 0) {
+	for (; numWaiting > 0; numWaiting--)
+	    finished->V();
+    }
+    (void) kernel->interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// WaitGroup::Wait
+// 	Wait until every task added has finished.  Returns at once if
+//	there are none.
+//----------------------------------------------------------------------
+
+void
+WaitGroup::Wait()
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+
+    if (count > 0) {
+	numWaiting++;
+	finished->P();
+    }
+    (void) kernel->interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// WorkerPool::WorkerPool
+// 	Create the task queue and fork "numWorkers" threads to serve it.
+//----------------------------------------------------------------------
+
+WorkerPool::WorkerPool(int numWorkers)
+{
+    ASSERT(numWorkers >= 1);
+    tasks = new List<WorkTask *>;
+    available = new Semaphore("work available", 0);
+    for (int i = 0; i < numWorkers; i++) {
+	Thread *t = new Thread("kernel worker", 1);
+
+	t->Fork(WorkerPool::Worker, this);
+    }
+}
+
+//----------------------------------------------------------------------
+// WorkerPool::~WorkerPool
+// 	The workers are waiting on "available", so, as with the other
+//	kernel daemons, the queue is not deallocated.
+//----------------------------------------------------------------------
+
+WorkerPool::~WorkerPool()
+{
+}
+
+//----------------------------------------------------------------------
+// WorkerPool::Submit
+// 	Queue (*func)(arg) for the next free worker.  May be called from
+//	an interrupt handler.
+//----------------------------------------------------------------------
+
+void
+WorkerPool::Submit(VoidFunctionPtr func, void *arg, WaitGroup *group)
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+
+    if (group != NULL)
+	group->Add();
+    tasks->Append(new WorkTask(func, arg, group));
+    available->V();
+    (void) kernel->interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// WorkerPool::Worker
+// 	Body of a worker thread: run tasks from the queue, one at a
+//	time, for ever.
+//----------------------------------------------------------------------
+
+void
+WorkerPool::Worker(void *data)
+{
+    WorkerPool *_this = (WorkerPool *) data;
+
+    for (;;) {
+	IntStatus oldLevel;
+	WorkTask *task;
+
+	_this->available->P();
+	oldLevel = kernel->interrupt->SetLevel(IntOff);
+	task = _this->tasks->RemoveFront();
+	(void) kernel->interrupt->SetLevel(oldLevel);
+
+	(*task->func)(task->arg);
+	if (task->group != NULL)
+	    task->group->Done();
+	delete task;
+    }
+}
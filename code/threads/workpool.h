@@ -0,0 +1,83 @@
+// workpool.h
+//	Data structures for a pool of kernel worker threads, which run
+//	short pieces of background work ("tasks") handed to them, so that
+//	each kind of background work doesn't need a thread of its own.
+//
+//	A task is a function and an argument, like the arguments to
+//	Thread::Fork.  Tasks are run in the order they are submitted, by
+//	whichever worker is free; more than one may be running at once,
+//	so a task must do its own synchronization.  A task may block (on
+//	the disk, say), but it should not wait for another task, since
+//	every worker might be waiting.
+//
+//	Tasks can be submitted from interrupt handlers: the queue is
+//	protected by turning interrupts off, not by a Lock.  A WaitGroup
+//	lets a thread wait until a batch of tasks is done.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include "copyright.h"
+#include "utility.h"
+#include "list.h"
+#include "synch.h"
+
+#define DefaultWorkers	2		// kernel worker threads
+
+// The following class counts outstanding tasks, and lets threads
+// wait for the count to reach zero.
+
+class WaitGroup {
+  public:
+    WaitGroup(char *debugName);
+    ~WaitGroup();
+
+    void Add(int n = 1);		// n more tasks to wait for
+    void Done();			// one of them has finished
+    void Wait();			// Wait until all of them have
+
+  private:
+    char *name;
+    int count;				// tasks not yet done
+    int numWaiting;			// threads in Wait
+    Semaphore *finished;		// V'ed for each, when count is 0
+};
+
+// A task waiting for a worker.
+
+class WorkTask {
+  public:
+    WorkTask(VoidFunctionPtr f, void *a, WaitGroup *g)
+	{ func = f; arg = a; group = g; }
+
+    VoidFunctionPtr func;		// run (*func)(arg)
+    void *arg;
+    WaitGroup *group;			// told when it is done, or NULL
+};
+
+// The following class defines the pool of workers and their queue.
+
+class WorkerPool {
+  public:
+    WorkerPool(int numWorkers);		// Fork the workers
+    ~WorkerPool();			// Workers still waiting for work
+    					// are left asleep
+
+    void Submit(VoidFunctionPtr func, void *arg, WaitGroup *group = NULL);
+    					// Have a worker run (*func)(arg);
+					// returns at once.  If "group" is
+					// not NULL, it is Add'ed to now and
+					// Done'd when the task has run
+
+  private:
+    List<WorkTask *> *tasks;		// tasks waiting for a worker
+    Semaphore *available;		// one V per task in "tasks"
+
+    static void Worker(void *data);	// body of each worker thread
+};
+
+#endif // WORKPOOL_H
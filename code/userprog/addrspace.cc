@@ -19,7 +19,13 @@
 #include "main.h"
 #include "addrspace.h"
 #include "machine.h"
-#include "noff.h"
+#include "pager.h"
+#include "memtrack.h"
+
+static HostThreadLocal int nextASID = 1;	// address space IDs are never
+					// reused, so a dead space's TLB
+					// entries can't be taken for a
+					// new one's; one series per kernel
 
 //----------------------------------------------------------------------
 // SwapHeader
@@ -59,45 +65,85 @@ SwapHeader (NoffHeader *noffH)
 
 //----------------------------------------------------------------------
 // AddrSpace::AddrSpace
-// 	Create an address space to run a user program.
-//	Set up the translation from program memory to physical 
-//	memory.  For now, this is really simple (1:1), since we are
-//	only uniprogramming, and we have a single unsegmented page table
+// 	Create an address space to run a user program.  It is empty
+//	until a program is loaded into it.
 //----------------------------------------------------------------------
 
 AddrSpace::AddrSpace()
 {
-    pageTable = new TranslationEntry[NumPhysPages];
-    for (int i = 0; i < NumPhysPages; i++) {
-	pageTable[i].virtualPage = i;	// for now, virt page # = phys page #
-	pageTable[i].physicalPage = i;
-	pageTable[i].valid = TRUE;
-	pageTable[i].use = FALSE;
-	pageTable[i].dirty = FALSE;
-	pageTable[i].readOnly = FALSE;  
-    }
-    
-    // zero out the entire address space
-    bzero(kernel->machine->mainMemory, MemorySize);
+    pageTable = NULL;
+    numPages = 0;
+    executable = NULL;
+    fileName = NULL;
+    swapSlot = NULL;
+    code = NULL;
+    image.size = 0;
+    alignedImage = FALSE;
+    codePages = 0;
+    filePages = 0;
+    basePages = 0;
+    lastFault = -1;
+    numThreads = 1;
+    mappings = new List<MappedFile *>;
+    files = new FileTable;
+    asid = nextASID++;
+    MemoryAllocated(MemUserprog, sizeof(AddrSpace));
 }
 
 //----------------------------------------------------------------------
 // AddrSpace::~AddrSpace
-// 	Dealloate an address space.
+// 	Dealloate an address space, freeing the frames its pages were
+//	in, and their swap slots.  Shared code pages, and pages shared
+//	copy-on-write, are only freed once no other address space maps
+//	them (see Pager::DetachCode and Pager::ReleaseFrame).
 //----------------------------------------------------------------------
 
 AddrSpace::~AddrSpace()
 {
+   Machine *machine = kernel->machine;
+
+   for (int i = 0; i < machine->tlbSize; i++)	// free its TLB entries
+	if (machine->tlbASID[i] == asid)
+	    machine->tlb[i].valid = FALSE;
+   for (unsigned int vpn = codePages; vpn < numPages; vpn++) {
+	TranslationEntry *page = pageTable->Lookup(vpn);
+
+	if (page != NULL && page->valid)
+	    kernel->pager->ReleaseFrame(page->physicalPage, this);
+	if (swapSlot[vpn] >= 0)
+	    kernel->pager->FreeSlot(swapSlot[vpn]);
+   }
+   if (code != NULL)
+	kernel->pager->DetachCode(code, this);
+   while (!mappings->IsEmpty())		// (normally gone, with UnmapAll)
+	delete mappings->RemoveFront();
+   delete mappings;
+   delete files;			// (normally empty, with CloseAll)
    delete pageTable;
+   delete [] swapSlot;
+   delete [] fileName;
+   delete executable;
+   MemoryFreed(MemUserprog, sizeof(AddrSpace));
 }
 
 
 //----------------------------------------------------------------------
 // AddrSpace::Load
-// 	Load a user program into memory from a file.
+// 	Load a user program from a file: set up its page table, with
+//	every page to be read in on demand.  The file is kept open until
+//	the address space is deleted, for PageIn to read.
+//
+//	The leading pages that hold only code and read-only data are
+//	shared with every other address space running the same file,
+//	and are mapped read-only.  The pages past the last one holding
+//	part of the file (uninitialized data and the stack) are zero-
+//	fill: they are never read, only zeroed when first touched.
+//
+//	If another address space is already running the file, its
+//	header is taken from the shared code entry rather than read and
+//	parsed again.
 //
-//	Assumes that the page table has been initialized, and that
-//	the object code file is in NOFF format.
+//	Assumes that the object code file is in NOFF format.
 //
 //	"fileName" is the file containing the object code to load into memory
 //----------------------------------------------------------------------
@@ -106,19 +152,34 @@ bool
 AddrSpace::Load(char *fileName) 
 {
     OpenFile *executable = kernel->fileSystem->Open(fileName);
-    NoffHeader noffH;
+    char *codeName;			// how the pager knows the file
+    int codeSector;
+    SharedCode *running;
     unsigned int size;
 
     if (executable == NULL) {
 	cerr << "Unable to open file " << fileName << "\n";
 	return FALSE;
     }
+#ifdef FILESYS_STUB
+    codeName = fileName;
+    codeSector = -1;
+#else
+    codeName = NULL;
+    codeSector = executable->HeaderSector();
+#endif
 
-    executable->ReadAt((char *)&noffH, sizeof(noffH), 0);
-    if ((noffH.noffMagic != NOFFMAGIC) && 
-		(WordToHost(noffH.noffMagic) == NOFFMAGIC))
-    	SwapHeader(&noffH);
-    ASSERT(noffH.noffMagic == NOFFMAGIC);
+    running = kernel->pager->FindCode(codeName, codeSector);
+    if (running != NULL) {
+	noffH = running->noffH;		// already parsed
+    } else {
+	executable->ReadAt((char *)&noffH, sizeof(noffH), 0);
+	if ((noffH.noffMagic != NOFFMAGIC) && (noffH.noffMagic != NOFFMAGIC2) &&
+		(WordToHost(noffH.noffMagic) == NOFFMAGIC ||
+		 WordToHost(noffH.noffMagic) == NOFFMAGIC2))
+	    SwapHeader(&noffH);
+	ASSERT(noffH.noffMagic == NOFFMAGIC || noffH.noffMagic == NOFFMAGIC2);
+    }
 
 #ifdef RDATA
 // how big is address space?
@@ -133,44 +194,1073 @@ AddrSpace::Load(char *fileName)
 						// to leave room for the stack
 #endif
     numPages = divRoundUp(size, PageSize);
+    basePages = numPages;
     size = numPages * PageSize;
-
-    ASSERT(numPages <= NumPhysPages);		// check we're not trying
-						// to run anything too big --
-						// at least until we have
-						// virtual memory
+    codePages = SharedPages(size);
+    filePages = FilePages();
+    FindImage();
 
     DEBUG(dbgAddr, "Initializing address space: " << numPages << ", " << size);
 
-// then, copy in the code and data segments into memory
-// Note: this code assumes that virtual address = physical address
-    if (noffH.code.size > 0) {
-        DEBUG(dbgAddr, "Initializing code segment.");
-	DEBUG(dbgAddr, noffH.code.virtualAddr << ", " << noffH.code.size);
-        executable->ReadAt(
-		&(kernel->machine->mainMemory[noffH.code.virtualAddr]), 
-			noffH.code.size, noffH.code.inFileAddr);
+// then, make every page invalid: each is read in when it is first
+// touched (see PageIn)
+    pageTable = new PageTable(numPages);
+    swapSlot = new int[numPages];
+    for (unsigned int i = 0; i < numPages; i++)
+	swapSlot[i] = -1;
+    this->executable = executable;	// kept open, for PageIn
+    this->fileName = new char[strlen(fileName) + 1];
+    strcpy(this->fileName, fileName);	// and for Fork to open again
+    if (codePages > 0)
+	code = kernel->pager->AttachCode(codeName, codeSector, &noffH,
+					 codePages, this);
+    return TRUE;			// success
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::SharedPages
+// 	Return how many pages, from the start of an address space of
+//	"size" bytes, hold nothing the program may write: code and
+//	read-only data, up to the first page of data or stack.  Code is
+//	assumed to start at virtual address zero.
+//----------------------------------------------------------------------
+
+unsigned int
+AddrSpace::SharedPages(unsigned int size)
+{
+    unsigned int end = noffH.code.virtualAddr + noffH.code.size;
+
+    if (noffH.code.size <= 0 || noffH.code.virtualAddr != 0)
+	return 0;
+#ifdef RDATA
+    if (noffH.readonlyData.size > 0)
+	end = max(end, (unsigned) (noffH.readonlyData.virtualAddr
+				   + noffH.readonlyData.size));
+#endif
+    if (noffH.initData.size > 0)
+	end = min(end, (unsigned) noffH.initData.virtualAddr);
+    if (noffH.uninitData.size > 0)
+	end = min(end, (unsigned) noffH.uninitData.virtualAddr);
+    end = min(end, size - UserStackSize);
+    return end / PageSize;		// a partial page is written too
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::FilePages
+// 	Return how many pages, from the start of the address space, hold
+//	some part of the executable: code, initialized data and read-only
+//	data.  The rest are all zeros to begin with.
+//----------------------------------------------------------------------
+
+unsigned int
+AddrSpace::FilePages()
+{
+    unsigned int end = 0;
+
+    if (noffH.code.size > 0)
+	end = max(end, (unsigned) (noffH.code.virtualAddr + noffH.code.size));
+    if (noffH.initData.size > 0)
+	end = max(end, (unsigned) (noffH.initData.virtualAddr
+				   + noffH.initData.size));
+#ifdef RDATA
+    if (noffH.readonlyData.size > 0)
+	end = max(end, (unsigned) (noffH.readonlyData.virtualAddr
+				   + noffH.readonlyData.size));
+#endif
+    return min(divRoundUp(end, PageSize), numPages);
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::FindImage
+// 	See whether the code and data segments lie end to end, both in
+//	the address space and, in the same order and with no gap, in the
+//	executable (as coff2noff lays them out).  If they do, "image" is
+//	made the one segment covering them all, so a page holding parts
+//	of several is filled with a single read; otherwise its size is 0
+//	and each segment is read separately.
+//
+//	A version 2 executable (see noff.h) that is laid out as it says
+//	is an "alignedImage": "image" then covers every file page, from
+//	virtual address 0, and starts on a page boundary in the file.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::FindImage()
+{
+    Segment *segs[3];
+    int n = 0;
+
+    image.size = 0;
+    alignedImage = FALSE;
+    if (noffH.noffMagic == NOFFMAGIC2) {
+	int delta = noffH.code.inFileAddr - noffH.code.virtualAddr;
+
+	segs[n++] = &noffH.initData;
+#ifdef RDATA
+	segs[n++] = &noffH.readonlyData;
+#endif
+	for (int i = 0; i < n; i++)
+	    if (segs[i]->size > 0 &&
+		    segs[i]->inFileAddr - segs[i]->virtualAddr != delta)
+		delta = -1;
+	if (delta >= 0 && delta % PageSize == 0) {
+	    image.virtualAddr = 0;
+	    image.inFileAddr = delta;
+	    image.size = filePages * PageSize;
+	    alignedImage = TRUE;
+	    return;
+	}
+	DEBUG(dbgAddr, "NOFF version 2 file not page aligned, read as version 1");
+	n = 0;
     }
-    if (noffH.initData.size > 0) {
-        DEBUG(dbgAddr, "Initializing data segment.");
-	DEBUG(dbgAddr, noffH.initData.virtualAddr << ", " << noffH.initData.size);
-        executable->ReadAt(
-		&(kernel->machine->mainMemory[noffH.initData.virtualAddr]),
-			noffH.initData.size, noffH.initData.inFileAddr);
+    if (noffH.code.size > 0)
+	segs[n++] = &noffH.code;
+    if (noffH.initData.size > 0)
+	segs[n++] = &noffH.initData;
+#ifdef RDATA
+    if (noffH.readonlyData.size > 0)
+	segs[n++] = &noffH.readonlyData;
+#endif
+    if (n == 0)
+	return;
+    for (int i = 1; i < n; i++)		// in address order
+	for (int j = i; j > 0 && segs[j]->virtualAddr < segs[j-1]->virtualAddr;
+		j--) {
+	    Segment *t = segs[j];
+
+	    segs[j] = segs[j-1];
+	    segs[j-1] = t;
+	}
+    for (int i = 1; i < n; i++)
+	if (segs[i]->virtualAddr != segs[i-1]->virtualAddr + segs[i-1]->size
+		|| segs[i]->inFileAddr != segs[i-1]->inFileAddr
+					  + segs[i-1]->size)
+	    return;			// a gap: read them one by one
+    image.virtualAddr = segs[0]->virtualAddr;
+    image.inFileAddr = segs[0]->inFileAddr;
+    image.size = segs[n-1]->virtualAddr + segs[n-1]->size
+		 - segs[0]->virtualAddr;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::Fork
+// 	Return a copy of this address space, for a child process to run
+//	the same program: a page table like ours, mapping the same frames
+//	and swap slots.  Nothing is copied; the resident pages become
+//	read-only in both, and whichever writes one first gets a copy of
+//	its own then (see CopyOnWrite).  Code pages are simply shared.
+//
+//	The child reads pages neither of us has touched yet from its own
+//	open file of the executable.  It doesn't inherit mapped files.
+//	Returns NULL if the executable can't be opened.
+//----------------------------------------------------------------------
+
+AddrSpace *
+AddrSpace::Fork()
+{
+    Pager *pager = kernel->pager;
+    AddrSpace *child = new AddrSpace();
+
+#ifdef FILESYS_STUB
+    child->executable = kernel->fileSystem->Open(fileName);
+#else
+    child->executable = new OpenFile(executable->HeaderSector());
+#endif
+    if (child->executable == NULL) {
+	delete child;
+	return NULL;
     }
+    child->fileName = new char[strlen(fileName) + 1];
+    strcpy(child->fileName, fileName);
+    child->noffH = noffH;
+    child->image = image;
+    child->alignedImage = alignedImage;
+    child->numPages = basePages;
+    child->basePages = basePages;
+    child->codePages = codePages;
+    child->filePages = filePages;
+    child->pageTable = new PageTable(basePages);
+    child->swapSlot = new int[basePages];
 
-#ifdef RDATA
-    if (noffH.readonlyData.size > 0) {
-        DEBUG(dbgAddr, "Initializing read only data segment.");
-	DEBUG(dbgAddr, noffH.readonlyData.virtualAddr << ", " << noffH.readonlyData.size);
-        executable->ReadAt(
-		&(kernel->machine->mainMemory[noffH.readonlyData.virtualAddr]),
-			noffH.readonlyData.size, noffH.readonlyData.inFileAddr);
+    pager->lock->Acquire();		// no page may move meanwhile
+    if (code != NULL)
+	child->code = pager->AttachCode(code->name, code->sector, &noffH,
+					codePages, child);
+    for (unsigned int vpn = 0; vpn < basePages; vpn++) {
+	TranslationEntry *page = pageTable->Lookup(vpn);
+
+	if (page != NULL && page->valid) {
+	    if (vpn >= codePages) {
+		SyncTLB(vpn, TRUE);	// we can't write it any more
+		page->readOnly = TRUE;
+		pager->ShareFrame(page->physicalPage, child);
+	    }
+	    *child->PageEntry(vpn) = *page;
+	    child->PageEntry(vpn)->use = FALSE;
+	}
+	child->swapSlot[vpn] = swapSlot[vpn];
+	if (swapSlot[vpn] >= 0)
+	    pager->ShareSlot(swapSlot[vpn]);
+    }
+    pager->lock->Release();
+    DEBUG(dbgAddr, "Forked address space " << asid << " as " << child->asid);
+    return child;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::PageIn
+// 	Page fault: give virtual page "vpn" a frame (see Pager::AllocFrame),
+//	and fill it: from the swap file, if the page was written there,
+//	or else with the page's part of the code and data segments, and
+//	zero elsewhere (uninitialized data and the stack).
+//
+//	A shared code page is mapped to the frame it is already in, if
+//	another address space running the program has paged it in;
+//	otherwise it is read into a frame that belongs to the shared
+//	code rather than to this address space.
+//
+//	When faults come in sequence -- this page follows the one last
+//	paged in -- the program is likely scanning its code or data, so
+//	the pages after it that are read from the same place, in the
+//	same order, are paged in too, up to kernel->faultAround of them,
+//	with one read for them all (see ClusterPages).  They only get
+//	frames that are free; no page is evicted for them.
+//
+//	Reading the page may block, so the pager's lock is held
+//	throughout; another thread may have paged it in by the time we
+//	have the lock.
+//
+//	Returns FALSE if "vpn" isn't in the address space, or if no
+//	frame could be had.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::PageIn(unsigned int vpn)
+{
+    TranslationEntry *page = PageEntry(vpn);
+    Pager *pager = kernel->pager;
+    int frame, *frames;
+    unsigned int count, n;
+    bool sequential;
+
+    if (page == NULL || (vpn >= basePages && MappingOf(vpn) == NULL))
+	return FALSE;			// (not mapped)
+    if (page->valid)
+	return TRUE;			// already in
+    pager->lock->Acquire();
+    if (page->valid) {
+	pager->lock->Release();
+	return TRUE;
+    }
+    sequential = ((int) vpn == lastFault + 1);
+    lastFault = vpn;
+    if (vpn < codePages && code->frames[vpn] >= 0) {
+	DEBUG(dbgAddr, "Mapping shared page " << vpn << " in frame "
+		       << code->frames[vpn]);
+	page->physicalPage = code->frames[vpn];
+	page->use = FALSE;
+	page->dirty = FALSE;
+	page->readOnly = TRUE;
+	page->valid = TRUE;
+	pager->lock->Release();
+	return TRUE;
+    }
+    if (vpn < codePages)
+	frame = pager->AllocFrame(NULL, code, vpn);
+    else
+	frame = pager->AllocFrame(this, NULL, vpn);
+    if (frame < 0) {
+	pager->lock->Release();
+	cerr << "Out of physical memory and swap, paging in page " << vpn
+	     << "\n";
+	return FALSE;
+    }
+    count = sequential ? ClusterPages(vpn) : 1;
+    frames = new int[count];
+    frames[0] = frame;
+    for (n = 1; n < count; n++) {
+	unsigned int v = vpn + n;
+
+	if (v < codePages)
+	    frames[n] = pager->AllocFrame(NULL, code, v, FALSE);
+	else
+	    frames[n] = pager->AllocFrame(this, NULL, v, FALSE);
+	if (frames[n] < 0)
+	    break;			// no more free frames
+    }
+    DEBUG(dbgAddr, "Paging in page " << vpn << " to frame " << frame
+		   << ", with " << n - 1 << " after it");
+    FillCluster(vpn, frames, n);
+    for (unsigned int i = 0; i < n; i++) {
+	page = PageEntry(vpn + i);
+	if (vpn + i < codePages) {
+	    code->frames[vpn + i] = frames[i];
+	    kernel->machine->LoadedCode(frames[i]);	// (-dc)
+	}
+	page->physicalPage = frames[i];
+	page->use = FALSE;
+	page->dirty = FALSE;		// the same as its copy, if any
+	page->readOnly = (vpn + i < codePages);
+					// (a copy-on-write page's own now)
+	page->valid = TRUE;
+    }
+    kernel->stats->numFaultAround += n - 1;
+    lastFault = vpn + n - 1;		// the next in sequence is after them
+    delete [] frames;
+    pager->lock->Release();
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::ClusterPages
+// 	Return how many pages, from page "vpn" on and up to
+//	kernel->faultAround after it, can be paged in with the one read
+//	that fills "vpn": those in consecutive swap slots, if "vpn" is in
+//	swap, or else, for an aligned image, those next in the file.  The
+//	run ends at a page that is already in, or comes from elsewhere.
+//	Always at least 1.  The pager's lock is held.
+//----------------------------------------------------------------------
+
+unsigned int
+AddrSpace::ClusterPages(unsigned int vpn)
+{
+    unsigned int n;
+
+    for (n = 1; n <= (unsigned int) kernel->faultAround; n++) {
+	unsigned int v = vpn + n;
+	TranslationEntry *page = pageTable->Lookup(v);
+
+	if (v >= basePages || (page != NULL && page->valid)
+	    || (v < codePages && code->frames[v] >= 0))
+	    break;			// not to be read
+	if (swapSlot[vpn] >= 0) {
+	    if (swapSlot[v] != swapSlot[vpn] + (int) n)
+		break;
+	} else if (!alignedImage || v >= filePages || swapSlot[v] >= 0) {
+	    break;
+	}
+    }
+    return n;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::FillCluster
+// 	Read the "count" pages from "vpn" on into "frames", as
+//	ClusterPages found they could be: with one read of the swap file
+//	or of the executable, into a buffer, and copied from there into
+//	each frame, since the frames needn't be next to each other.  A
+//	single page is just read by FillFrame.  The pager's lock is held.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::FillCluster(unsigned int vpn, int *frames, int count)
+{
+    char *buf;
+
+    if (count == 1) {
+	FillFrame(vpn, frames[0]);
+	return;
+    }
+    buf = new char[count * PageSize];
+    if (swapSlot[vpn] >= 0) {
+	kernel->pager->ReadSlots(swapSlot[vpn], count, buf);
+    } else {
+	int n = executable->ReadAt(buf, count * PageSize,
+				   image.inFileAddr + vpn * PageSize);
+
+	bzero(buf + n, count * PageSize - n);	// past the end of the file
+    }
+    for (int i = 0; i < count; i++) {
+	bcopy(buf + i * PageSize,
+	      &kernel->machine->mainMemory[frames[i] * PageSize], PageSize);
+	kernel->machine->InvalidateCode(frames[i] * PageSize, PageSize);
     }
+    delete [] buf;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::FillFrame
+// 	Read page "vpn" into "frame": from the swap file, if the page
+//	was written there, or else with the page's part of the code and
+//	data segments (see FindImage), and zero elsewhere; from an
+//	aligned image, that is one read of the whole page, with only
+//	what lies past the end of the file zeroed.  A zero-fill page that has
+//	never been written out is just zeroed, and a page of a mapped
+//	file is read from the file (zeros past its end).  The pager's
+//	lock is held.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::FillFrame(unsigned int vpn, int frame)
+{
+    MappedFile *m = (vpn >= basePages) ? MappingOf(vpn) : NULL;
+
+    if (m != NULL && m->file != NULL) {
+	int offset = (vpn - m->firstPage) * PageSize;
+
+	bzero(&kernel->machine->mainMemory[frame * PageSize], PageSize);
+	m->file->ReadAt(&kernel->machine->mainMemory[frame * PageSize],
+			min(PageSize, m->length - offset), offset);
+	kernel->machine->InvalidateCode(frame * PageSize, PageSize);
+	return;
+    }
+    if (swapSlot[vpn] >= 0) {
+	kernel->pager->ReadSlot(swapSlot[vpn], frame);
+    } else if (vpn >= filePages) {
+	bzero(&kernel->machine->mainMemory[frame * PageSize], PageSize);
+	kernel->stats->numZeroFills++;
+    } else if (alignedImage) {
+	char *into = &kernel->machine->mainMemory[frame * PageSize];
+	int n = executable->ReadAt(into, PageSize,
+				   image.inFileAddr + vpn * PageSize);
+
+	bzero(into + n, PageSize - n);
+    } else {
+	bzero(&kernel->machine->mainMemory[frame * PageSize], PageSize);
+	if (image.size > 0) {
+	    ReadSegment(&image, vpn, frame);	// all of it in one read
+	} else {
+	    ReadSegment(&noffH.code, vpn, frame);
+	    ReadSegment(&noffH.initData, vpn, frame);
+#ifdef RDATA
+	    ReadSegment(&noffH.readonlyData, vpn, frame);
 #endif
+	}
+    }
+    kernel->machine->InvalidateCode(frame * PageSize, PageSize);
+    					// another page's code may
+					// have been decoded there
+}
 
-    delete executable;			// close file
-    return TRUE;			// success
+//----------------------------------------------------------------------
+// AddrSpace::CopyOnWrite
+// 	Write fault: the program wrote read-only page "vpn".  If the page
+//	is shared copy-on-write, give it a frame of its own, and copy the
+//	shared one into it; if the others sharing it have all gone, just
+//	make it writable again.  If the pager took the shared frame
+//	while we waited for the lock, or to find us a frame, the page is
+//	read back into ours as PageIn would.
+//
+//	Returns FALSE if the page is really read-only (code), or isn't
+//	in the address space, or no frame could be had.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::CopyOnWrite(unsigned int vpn)
+{
+    TranslationEntry *page = PageEntry(vpn);
+    Pager *pager = kernel->pager;
+    int old, frame;
+
+    if (page == NULL || vpn < codePages)
+	return FALSE;
+    pager->lock->Acquire();
+    if (!page->valid) {
+	pager->lock->Release();
+	return PageIn(vpn);		// writable when it comes back
+    }
+    SyncTLB(vpn, TRUE);			// its entries are read-only
+    if (!page->readOnly || !pager->FrameShared(page->physicalPage)) {
+	page->readOnly = FALSE;
+	pager->lock->Release();
+	return TRUE;
+    }
+    old = page->physicalPage;
+    frame = pager->AllocFrame(this, NULL, vpn);
+    if (frame < 0) {
+	pager->lock->Release();
+	cerr << "Out of physical memory and swap, copying page " << vpn
+	     << "\n";
+	return FALSE;
+    }
+    if (page->valid) {			// still sharing "old"
+	DEBUG(dbgAddr, "Copying page " << vpn << " from frame " << old
+		       << " to frame " << frame);
+	bcopy(&kernel->machine->mainMemory[old * PageSize],
+	      &kernel->machine->mainMemory[frame * PageSize], PageSize);
+	kernel->machine->InvalidateCode(frame * PageSize, PageSize);
+	pager->ReleaseFrame(old, this);
+    } else {
+	FillFrame(vpn, frame);
+	page->dirty = FALSE;
+    }
+    kernel->stats->numCopyOnWrites++;
+    page->physicalPage = frame;
+    page->use = FALSE;
+    page->readOnly = FALSE;
+    page->valid = TRUE;
+    pager->lock->Release();
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::PageOut
+// 	The pager is taking resident page "vpn"'s frame.  If the page is
+//	dirty, write it to its swap slot, allocating one if it has none,
+//	or if other address spaces' pages are in it too (see Fork); a
+//	clean page is the same as where it would be read from again.
+//	A dirty page of a mapped file is written back to the file; one
+//	of a thread's stack goes to swap like any other.
+//	The page is invalid before the write starts, so the program
+//	can't change it meanwhile: it would fault, and wait for the
+//	pager's lock.
+//
+//	Returns FALSE, keeping the page, if it needs a slot and the swap
+//	file is full.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::PageOut(unsigned int vpn)
+{
+    TranslationEntry *page = PageEntry(vpn);
+    MappedFile *m = (vpn >= basePages) ? MappingOf(vpn) : NULL;
+
+    ASSERT(page->valid);
+    SyncTLB(vpn, TRUE);
+    if (m != NULL && m->file != NULL) {	// a mapped file's
+	int offset = (vpn - m->firstPage) * PageSize;
+
+	page->valid = FALSE;
+	if (page->dirty) {
+	    DEBUG(dbgAddr, "Writing page " << vpn << " back to its file");
+	    m->file->WriteAt(
+		    &kernel->machine->mainMemory[page->physicalPage * PageSize],
+		    min(PageSize, m->length - offset), offset);
+	    page->dirty = FALSE;
+	}
+	return TRUE;
+    }
+    if (page->dirty && (swapSlot[vpn] < 0
+			|| kernel->pager->SlotShared(swapSlot[vpn]))) {
+	int slot = kernel->pager->AllocSlot();
+
+	if (slot < 0)
+	    return FALSE;
+	if (swapSlot[vpn] >= 0)
+	    kernel->pager->FreeSlot(swapSlot[vpn]);
+	swapSlot[vpn] = slot;
+    }
+    page->valid = FALSE;
+    if (page->dirty) {
+	DEBUG(dbgAddr, "Writing page " << vpn << " to swap slot "
+		       << swapSlot[vpn]);
+	kernel->pager->WriteSlot(swapSlot[vpn], page->physicalPage);
+	page->dirty = FALSE;
+    }
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::Cleanable
+// 	Return whether the pager should clean resident page "vpn" ahead
+//	of evicting it (see Pager::Clean): it goes to swap, it is dirty,
+//	and it hasn't been used since the clock hand last passed.  The
+//	use bit is left as it is.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::Cleanable(unsigned int vpn)
+{
+    TranslationEntry *page = PageEntry(vpn);
+
+    if (vpn >= basePages || !page->valid)
+	return FALSE;			// (a mapped file's go back to it)
+    SyncTLB(vpn, FALSE);
+    return page->dirty && !page->use;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::CleanPage
+// 	The pager is writing resident page "vpn" to swap "slot", a slot
+//	of its own, along with other pages; copy the page into "into",
+//	for the write, and from now on it is clean, with "slot" its
+//	copy.  Its TLB entries are invalidated, so that the next store
+//	marks it dirty again, in the page table.  The page stays valid:
+//	the pager's lock is held until the write is done, so it can't be
+//	evicted and read back from "slot" before then.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::CleanPage(unsigned int vpn, int slot, char *into)
+{
+    TranslationEntry *page = PageEntry(vpn);
+
+    SyncTLB(vpn, TRUE);
+    bcopy(&kernel->machine->mainMemory[page->physicalPage * PageSize],
+	  into, PageSize);
+    if (swapSlot[vpn] >= 0)
+	kernel->pager->FreeSlot(swapSlot[vpn]);
+    swapSlot[vpn] = slot;
+    page->dirty = FALSE;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::Mmap
+// 	Map the first "length" bytes of "file", open in the program, into
+//	the address space, above the stack and any other mapping, at a
+//	page boundary.  None of it is read until it is touched; stores
+//	into it go back to the file when the page is evicted, or the
+//	file unmapped.  "file" must stay open until then.
+//
+//	If "file" is NULL, the pages are zero-filled instead, and go to
+//	swap like the stack's; that is how a thread the program forks
+//	gets a stack of its own (see Kernel::ThreadFork).
+//
+//	Returns the virtual address the file is mapped at, or -1 if
+//	"length" isn't positive.
+//----------------------------------------------------------------------
+
+int
+AddrSpace::Mmap(OpenFile *file, int length)
+{
+    Pager *pager = kernel->pager;
+    MappedFile *m;
+
+    if (length <= 0)
+	return -1;
+    m = new MappedFile;
+    m->file = file;
+    m->length = length;
+    m->numPages = divRoundUp(length, PageSize);
+    pager->lock->Acquire();		// (the pager reads the page table)
+    m->firstPage = numPages;
+    Resize(numPages + m->numPages);
+    mappings->Append(m);
+    pager->lock->Release();
+    DEBUG(dbgAddr, "Mapped " << length << " bytes at page " << m->firstPage);
+    return m->firstPage * PageSize;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::Munmap, AddrSpace::UnmapAll
+// 	Unmap the file mapped at "vaddr", or every mapped file, writing
+//	back the pages that were stored into.  Munmap returns FALSE if
+//	no file is mapped at "vaddr".
+//
+//	UnmapAll is for a program that is finishing: the writes block,
+//	so they can't wait until its address space is deleted.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::Munmap(int vaddr)
+{
+    ListIterator<MappedFile *> it(mappings);
+
+    if (vaddr < 0 || vaddr % PageSize != 0)
+	return FALSE;
+    for (; !it.IsDone(); it.Next())
+	if (it.Item()->firstPage == (unsigned) vaddr / PageSize) {
+	    Unmap(it.Item());
+	    return TRUE;
+	}
+    return FALSE;
+}
+
+void
+AddrSpace::UnmapAll()
+{
+    while (!mappings->IsEmpty())
+	Unmap(mappings->Front());
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::Close, AddrSpace::CloseAll
+// 	Close the open file "id", or every open file, unmapping any
+//	mapping of it first (its pages are read and written through
+//	it).  Close returns FALSE if there is no file "id".
+//
+//	CloseAll, like UnmapAll, is for a program that is finishing:
+//	closing a file may wait for its writes.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::Close(int id)
+{
+    OpenFile *file = files->Remove(id);
+    ListIterator<MappedFile *> it(mappings);
+
+    if (file == NULL)
+	return FALSE;
+    while (!it.IsDone()) {
+	MappedFile *m = it.Item();
+
+	it.Next();			// (before "m" goes)
+	if (m->file == file)
+	    Unmap(m);
+    }
+    delete file;
+    return TRUE;
+}
+
+void
+AddrSpace::CloseAll()
+{
+    delete files;
+    files = new FileTable;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::Unmap
+// 	Write back the dirty pages of mapping "m" (unless it is zero-
+//	filled memory: those are just dropped, with their swap slots),
+//	free the frames of those that are resident, and forget it.  The page table shrinks
+//	to the top of the highest mapping left.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::Unmap(MappedFile *m)
+{
+    Pager *pager = kernel->pager;
+    unsigned int top = basePages;
+
+    pager->lock->Acquire();
+    for (unsigned int vpn = m->firstPage;
+	    vpn < m->firstPage + m->numPages; vpn++) {
+	TranslationEntry *page = pageTable->Lookup(vpn);
+
+	if (page != NULL && page->valid) {
+	    int frame = page->physicalPage;
+
+	    if (m->file != NULL) {
+		(void) PageOut(vpn);	// to the file: can't fail
+	    } else {
+		SyncTLB(vpn, TRUE);	// a stack: nothing to keep
+		page->valid = FALSE;
+	    }
+	    pager->ReleaseFrame(frame, this);
+	}
+	if (swapSlot[vpn] >= 0) {	// (only a stack's go to swap)
+	    pager->FreeSlot(swapSlot[vpn]);
+	    swapSlot[vpn] = -1;
+	}
+    }
+    mappings->Remove(m);
+    delete m;
+    for (ListIterator<MappedFile *> it(mappings); !it.IsDone(); it.Next())
+	top = max(top, it.Item()->firstPage + it.Item()->numPages);
+    Resize(top);
+    pager->lock->Release();
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::MappingOf
+// 	Return the mapped file page "vpn" is in, or NULL if none is.
+//----------------------------------------------------------------------
+
+MappedFile *
+AddrSpace::MappingOf(unsigned int vpn)
+{
+    for (ListIterator<MappedFile *> it(mappings); !it.IsDone(); it.Next())
+	if (vpn >= it.Item()->firstPage
+		&& vpn < it.Item()->firstPage + it.Item()->numPages)
+	    return it.Item();
+    return NULL;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::Resize
+// 	Make the page table "pages" long.  Pages added are invalid, with
+//	no swap slot; pages taken away must have no frame, and the
+//	tables of their chunks are freed.  Translations the machine has
+//	cached may point into those, so they are flushed if it is using
+//	this table.  The pager's lock is held, since the pager looks at
+//	the table.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::Resize(unsigned int pages)
+{
+    Machine *machine = kernel->machine;
+    int *slots;
+
+    if (pages == numPages)
+	return;
+    slots = new int[pages];
+    for (unsigned int i = 0; i < pages; i++)
+	slots[i] = (i < numPages) ? swapSlot[i] : -1;
+    pageTable->Resize(pages);
+    if (machine->pageTable == pageTable)
+	machine->FlushTranslations();	// (some may be into freed tables)
+    delete [] swapSlot;
+    swapSlot = slots;
+    numPages = pages;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::UnmapCopy
+// 	The pager is taking the frame that page "vpn" shares copy-on-
+//	write, and its owner has written it out, if need be, to "slot"
+//	(-1 if it is still as in the executable).  The page is now read
+//	from there when next touched.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::UnmapCopy(unsigned int vpn, int slot)
+{
+    TranslationEntry *page = PageEntry(vpn);
+
+    ASSERT(page->valid);
+    SyncTLB(vpn, TRUE);
+    page->valid = FALSE;
+    page->dirty = FALSE;
+    if (swapSlot[vpn] != slot) {
+	if (slot >= 0)
+	    kernel->pager->ShareSlot(slot);
+	if (swapSlot[vpn] >= 0)
+	    kernel->pager->FreeSlot(swapSlot[vpn]);
+	swapSlot[vpn] = slot;
+    }
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::Referenced
+// 	Return whether resident page "vpn" has been used since the last
+//	call, and clear its use bit.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::Referenced(unsigned int vpn)
+{
+    TranslationEntry *page = PageEntry(vpn);
+    bool used;
+
+    SyncTLB(vpn, FALSE);
+    used = page->use;
+    page->use = FALSE;
+    return used;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::SyncTLB
+// 	Copy the use and dirty bits of any TLB entry this address space
+//	loaded for page "vpn" into the page table, so that the page
+//	table's are up to date, and clear the entry's use bit.  If
+//	"invalidate", the entry is invalidated as well.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::SyncTLB(unsigned int vpn, bool invalidate)
+{
+    Machine *machine = kernel->machine;
+    TranslationEntry *page = PageEntry(vpn);
+
+    for (int i = 0; i < machine->tlbSize; i++) {
+	TranslationEntry *entry = &machine->tlb[i];
+
+	if (entry->valid && machine->tlbASID[i] == asid
+		&& entry->virtualPage == (int) vpn) {
+	    page->use = page->use || entry->use;
+	    page->dirty = page->dirty || entry->dirty;
+	    entry->use = FALSE;
+	    if (invalidate)
+		entry->valid = FALSE;
+	}
+    }
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::ReadSegment
+// 	Read the part of segment "seg" that is in virtual page "vpn",
+//	if any, from the executable into the same place in "frame".
+//----------------------------------------------------------------------
+
+void
+AddrSpace::ReadSegment(Segment *seg, int vpn, int frame)
+{
+    int pageStart = vpn * PageSize;
+    int start = max(seg->virtualAddr, pageStart);
+    int end = min(seg->virtualAddr + seg->size, pageStart + PageSize);
+
+    if (seg->size <= 0 || start >= end)
+	return;
+    DEBUG(dbgAddr, "Reading " << end - start << " bytes at " << start);
+    executable->ReadAt(
+	    &(kernel->machine->mainMemory[frame * PageSize + start - pageStart]),
+	    end - start, seg->inFileAddr + start - seg->virtualAddr);
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::UserAddress
+// 	Return where user virtual address "vaddr" is in mainMemory,
+//	paging it in if need be, and noting the page used (and written,
+//	if "writing").  Writing a page shared copy-on-write copies it
+//	first.  Returns NULL if "vaddr" is outside the address space, or
+//	can't be paged in, or if "writing" to a read-only (code) page.
+//
+//	The kernel uses this to reach user memory itself, rather than
+//	through the machine's translation.
+//----------------------------------------------------------------------
+
+char *
+AddrSpace::UserAddress(int vaddr, bool writing)
+{
+    unsigned int vpn = (unsigned) vaddr / PageSize;
+    TranslationEntry *page = PageEntry(vpn);
+
+    if (vaddr < 0 || page == NULL || !PageIn(vpn))
+	return NULL;
+    if (writing && page->readOnly && !CopyOnWrite(vpn))
+	return NULL;
+    page->use = TRUE;
+    if (writing)
+	page->dirty = TRUE;
+    return &(kernel->machine->mainMemory[page->physicalPage * PageSize
+					 + vaddr % PageSize]);
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::UserRun
+// 	Return how many of the "size" bytes of user memory at "vaddr"
+//	are in consecutive frames, setting "*addr" to where they start
+//	in mainMemory, and noting them used (and written, if "writing";
+//	see UserAddress).  Only the first page is paged in: paging in a
+//	later one could take the frame of one already in the run, so
+//	the run ends at the first page that isn't resident.  Returns 0
+//	if "vaddr" can't be reached.
+//----------------------------------------------------------------------
+
+int
+AddrSpace::UserRun(int vaddr, int size, bool writing, char **addr)
+{
+    int n = min(size, PageSize - vaddr % PageSize);
+
+    *addr = UserAddress(vaddr, writing);
+    if (*addr == NULL)
+	return 0;
+    for (unsigned int vpn = (unsigned) (vaddr + n) / PageSize; n < size;
+	    vpn++) {
+	TranslationEntry *page = PageEntry(vpn);
+
+	if (page == NULL || !page->valid
+		|| page->physicalPage != PageEntry(vpn - 1)->physicalPage + 1
+		|| (writing && page->readOnly))
+	    break;
+	page->use = TRUE;
+	if (writing)
+	    page->dirty = TRUE;
+	n += min(size - n, PageSize);
+    }
+    return n;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::CopyIn, AddrSpace::CopyOut
+// 	Copy "size" bytes between user memory at "vaddr" and the kernel
+//	buffer "buf", a run of consecutive frames at a time (see
+//	UserRun), since consecutive virtual pages needn't be in
+//	consecutive frames.  Returns FALSE if some of the user memory is
+//	outside the address space (some of the copy may have been done).
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::CopyIn(int vaddr, char *buf, int size)
+{
+    while (size > 0) {
+	char *from;
+	int n = UserRun(vaddr, size, FALSE, &from);
+
+	if (n == 0)
+	    return FALSE;
+	bcopy(from, buf, n);
+	vaddr += n;
+	buf += n;
+	size -= n;
+    }
+    return TRUE;
+}
+
+bool
+AddrSpace::CopyOut(int vaddr, char *buf, int size)
+{
+    while (size > 0) {
+	char *to;
+	int n = UserRun(vaddr, size, TRUE, &to);
+
+	if (n == 0)
+	    return FALSE;
+	bcopy(buf, to, n);
+	kernel->machine->InvalidateCode(to - kernel->machine->mainMemory, n);
+	vaddr += n;
+	buf += n;
+	size -= n;
+    }
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::CopyInString
+// 	Copy the null-terminated string at user address "vaddr" into
+//	"buf", which has room for "size" bytes, a run of frames at a
+//	time, as CopyIn does.  Returns FALSE if the string is outside
+//	the address space, or doesn't fit.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::CopyInString(int vaddr, char *buf, int size)
+{
+    while (size > 0) {
+	char *from, *end;
+	int n = UserRun(vaddr, size, FALSE, &from);
+
+	if (n == 0)
+	    return FALSE;
+	end = (char *) memchr(from, '\0', n);
+	if (end != NULL) {
+	    bcopy(from, buf, end - from + 1);
+	    return TRUE;
+	}
+	bcopy(from, buf, n);
+	vaddr += n;
+	buf += n;
+	size -= n;
+    }
+    return FALSE;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::PinRun
+// 	Page in user memory at "vaddr", and return how many of the
+//	"size" bytes there are in consecutive frames, as UserRun does;
+//	but pin the frames, so that a system call can read or write a
+//	file straight into or out of them, without a kernel buffer.  The
+//	pager can't take them while the I/O blocks.  "writing" is TRUE
+//	if the I/O will store into them.  UnpinRun lets them go.
+//
+//	The pager may take the first page again while we wait for its
+//	lock, so we retry until it is still in with the lock held.
+//	Returns 0 if "vaddr" can't be reached.
+//----------------------------------------------------------------------
+
+int
+AddrSpace::PinRun(int vaddr, int size, bool writing, char **addr)
+{
+    Pager *pager = kernel->pager;
+    TranslationEntry *page;
+    int n;
+
+    for (;;) {
+	if (UserAddress(vaddr, writing) == NULL)
+	    return 0;
+	page = PageEntry((unsigned) vaddr / PageSize);
+	pager->lock->Acquire();
+	if (page->valid && !(writing && page->readOnly))
+	    break;
+	pager->lock->Release();
+    }
+    n = UserRun(vaddr, size, writing, addr);	// (won't page anything in)
+    for (unsigned int vpn = (unsigned) vaddr / PageSize;
+	    vpn <= (unsigned) (vaddr + n - 1) / PageSize; vpn++)
+	pager->Pin(PageEntry(vpn)->physicalPage);
+    pager->lock->Release();
+    return n;
+}
+
+void
+AddrSpace::UnpinRun(int vaddr, int size)
+{
+    for (unsigned int vpn = (unsigned) vaddr / PageSize;
+	    vpn <= (unsigned) (vaddr + size - 1) / PageSize; vpn++)
+	kernel->pager->Unpin(PageEntry(vpn)->physicalPage);
 }
 
 //----------------------------------------------------------------------
@@ -188,9 +1278,16 @@ AddrSpace::Execute(char* fileName)
 
     kernel->currentThread->space = this;
 
+    kernel->scheduler->LoadUserState(kernel->currentThread);
+    					// take the machine from whichever
+					// program's registers are in it
     this->InitRegisters();		// set the initial register values
     this->RestoreState();		// load page table register
 
+    (void) PageIn(0);			// the first page of code and of
+    (void) PageIn(basePages - 1);	// stack are certain to be touched
+    					// at once: save their faults
+
     kernel->machine->Run();		// jump to the user progam
 
     ASSERTNOTREACHED();			// machine->Run never returns;
@@ -199,6 +1296,142 @@ AddrSpace::Execute(char* fileName)
 }
 
 
+//----------------------------------------------------------------------
+// AddrSpace::Checkpoint
+// 	Save the program running in this address space to the host file
+//	"hostName", so that Restore can start it again from here: a
+//	header with the executable's name and the registers, which the
+//	program is using now (we are handling an exception of its), and
+//	then each page past the shared code that has been touched --
+//	that is resident, or in swap -- with a word for each page saying
+//	whether it is there.  Pages never touched are left to be read
+//	from the executable, or zeroed, when the restored program first
+//	touches them.
+//
+//	The registers are those at the exception, so the restored
+//	program first runs the instruction that caused it again: the
+//	same system call, or the access that faulted.
+//
+//	Returns FALSE, saving nothing, if the program has more than one
+//	thread, open files or mapped memory, none of which can be saved.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::Checkpoint(char *hostName)
+{
+    int header[3];
+    int registers[NumTotalRegs];
+    char name[MaxCheckpointName];
+    char page[PageSize];
+    int fd;
+
+    if (numThreads > 1 || !files->IsEmpty() || !mappings->IsEmpty()
+	|| strlen(fileName) >= MaxCheckpointName)
+	return FALSE;
+
+    header[0] = CheckpointMagic;
+    header[1] = basePages;
+    header[2] = codePages;
+    bzero(name, MaxCheckpointName);
+    strcpy(name, fileName);
+    for (int i = 0; i < NumTotalRegs; i++)
+	registers[i] = kernel->machine->ReadRegister(i);
+
+    fd = OpenForWrite(hostName);
+    WriteFile(fd, (char *) header, sizeof(header));
+    WriteFile(fd, name, MaxCheckpointName);
+    WriteFile(fd, (char *) registers, sizeof(registers));
+    for (unsigned int vpn = codePages; vpn < basePages; vpn++) {
+	TranslationEntry *entry = pageTable->Lookup(vpn);
+	int touched = (entry != NULL && entry->valid) || swapSlot[vpn] >= 0;
+
+	WriteFile(fd, (char *) &touched, sizeof(int));
+	if (touched) {
+	    (void) CopyIn(vpn * PageSize, page, PageSize);
+	    WriteFile(fd, page, PageSize);
+	}
+    }
+    Close(fd);
+    DEBUG(dbgAddr, "Checkpointed " << fileName << " to " << hostName);
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::Restore
+// 	Load the program saved in host file "hostName" by Checkpoint into
+//	this (empty) address space: the executable named there, as Load
+//	does, and then the pages saved written over it.  Its registers
+//	are put in "registers", for Resume.  Returns FALSE if the file
+//	isn't a checkpoint, or the executable isn't the one it was made
+//	from.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::Restore(char *hostName, int *registers)
+{
+    int header[3];
+    char name[MaxCheckpointName];
+    char page[PageSize];
+    int fd = OpenForRead(hostName, FALSE);
+
+    if (fd < 0) {
+	cerr << "Unable to open checkpoint " << hostName << "\n";
+	return FALSE;
+    }
+    if (ReadPartial(fd, (char *) header, sizeof(header)) != sizeof(header)
+	|| header[0] != CheckpointMagic) {
+	cerr << hostName << " is not a checkpoint\n";
+	Close(fd);
+	return FALSE;
+    }
+    Read(fd, name, MaxCheckpointName);
+    name[MaxCheckpointName - 1] = '\0';
+    Read(fd, (char *) registers, NumTotalRegs * sizeof(int));
+    if (!Load(name)) {
+	Close(fd);
+	return FALSE;
+    }
+    if (basePages != (unsigned) header[1] || codePages != (unsigned) header[2]) {
+	cerr << name << " has changed since " << hostName << " was made\n";
+	Close(fd);
+	return FALSE;
+    }
+
+    for (unsigned int vpn = codePages; vpn < basePages; vpn++) {
+	int touched;
+
+	Read(fd, (char *) &touched, sizeof(int));
+	if (touched) {
+	    Read(fd, page, PageSize);
+	    (void) CopyOut(vpn * PageSize, page, PageSize);
+	}
+    }
+    Close(fd);
+    DEBUG(dbgAddr, "Restored " << name << " from " << hostName);
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::Resume
+// 	Run a restored program on from "registers", as Execute runs one
+//	from the start.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::Resume(int *registers)
+{
+    kernel->currentThread->space = this;
+
+    kernel->scheduler->LoadUserState(kernel->currentThread);
+    for (int i = 0; i < NumTotalRegs; i++)
+	kernel->machine->WriteRegister(i, registers[i]);
+    this->RestoreState();		// load page table register
+
+    kernel->machine->Run();		// jump back into the program
+
+    ASSERTNOTREACHED();
+}
+
 //----------------------------------------------------------------------
 // AddrSpace::InitRegisters
 // 	Set the initial values for the user-level register set.
@@ -206,7 +1439,8 @@ AddrSpace::Execute(char* fileName)
 // 	We write these directly into the "machine" registers, so
 //	that we can immediately jump to user code.  Note that these
 //	will be saved/restored into the currentThread->userRegisters
-//	when this thread is context switched out.
+//	when another user program needs the machine (see
+//	Scheduler::LoadUserState).
 //----------------------------------------------------------------------
 
 void
@@ -231,8 +1465,8 @@ AddrSpace::InitRegisters()
    // Set the stack register to the end of the address space, where we
    // allocated the stack; but subtract off a bit, to make sure we don't
    // accidentally reference off the end!
-    machine->WriteRegister(StackReg, numPages * PageSize - 16);
-    DEBUG(dbgAddr, "Initializing stack pointer: " << numPages * PageSize - 16);
+    machine->WriteRegister(StackReg, basePages * PageSize - 16);
+    DEBUG(dbgAddr, "Initializing stack pointer: " << basePages * PageSize - 16);
 }
 
 //----------------------------------------------------------------------
@@ -240,24 +1474,53 @@ AddrSpace::InitRegisters()
 // 	On a context switch, save any machine state, specific
 //	to this address space, that needs saving.
 //
-//	For now, don't need to save anything!
+//	With a TLB, the only state is the use and dirty bits the
+//	hardware has set in this space's entries: copy them back to the
+//	page table.  The entries themselves are left alone (see
+//	RestoreState).
 //----------------------------------------------------------------------
 
 void AddrSpace::SaveState() 
-{}
+{
+    Machine *machine = kernel->machine;
+
+    for (int i = 0; i < machine->tlbSize; i++) {
+	TranslationEntry *entry = &machine->tlb[i];
+
+	if (entry->valid && machine->tlbASID[i] == asid) {
+	    TranslationEntry *page = PageEntry(entry->virtualPage);
+
+	    page->use = page->use || entry->use;
+	    page->dirty = page->dirty || entry->dirty;
+	}
+    }
+}
 
 //----------------------------------------------------------------------
 // AddrSpace::RestoreState
 // 	On a context switch, restore the machine state so that
 //	this address space can run.
 //
-//      For now, tell the machine where to find the page table.
+//      Without a TLB, tell the machine where to find the page table.
+//	With one, tell it which address space is running; unless its
+//	entries are tagged with that, the entries other spaces loaded
+//	have to be flushed.  The TLB is refilled a miss at a time (see
+//	HandlePageFault in exception.cc).
 //----------------------------------------------------------------------
 
 void AddrSpace::RestoreState() 
 {
-    kernel->machine->pageTable = pageTable;
-    kernel->machine->pageTableSize = numPages;
+    Machine *machine = kernel->machine;
+
+    if (machine->tlb == NULL) {
+	machine->pageTable = pageTable;
+    } else {
+	machine->currentASID = asid;
+	for (int i = 0; !machine->tlbTagged && i < machine->tlbSize; i++)
+	    if (machine->tlbASID[i] != asid)
+		machine->tlb[i].valid = FALSE;
+    }
+    machine->FlushTranslations();	// they were into the old one
 }
 
 
@@ -281,7 +1544,11 @@ AddrSpace::Translate(unsigned int vaddr, unsigned int *paddr, int isReadWrite)
         return AddressErrorException;
     }
 
-    pte = &pageTable[vpn];
+    pte = pageTable->Lookup(vpn);
+
+    if(pte == NULL || !pte->valid) {
+        return PageFaultException;	// not paged in yet
+    }
 
     if(isReadWrite && pte->readOnly) {
         return ReadOnlyException;
@@ -2,10 +2,47 @@
 //	Data structures to keep track of executing user programs 
 //	(address spaces).
 //
-//	For now, we don't keep any information about address spaces.
+//	Each address space has its own page table.  Pages are loaded
+//	on demand: none are in memory when the program starts, and each
+//	is given a physical page (a "frame", from the kernel's Pager)
+//	and read from the executable, or zeroed (uninitialized data and
+//	the stack), the first time the program touches it.  The Pager
+//	may later take the frame back for another page, writing the page
+//	to the swap file first if it is dirty; it is then read back from
+//	there when next touched.  The frames and swap slots are freed
+//	when the address space is deleted.
+//
+//	Pages of code and read-only data are shared, read-only, with the
+//	other address spaces running the same executable (see pager.h).
+//	A forked address space starts out sharing its parent's other
+//	pages copy-on-write.
+//
+//	An open file may be mapped into the address space (see Mmap),
+//	above the stack.  Its pages are paged in from the file, and
+//	written back to it rather than to swap, when they are evicted,
+//	when the file is unmapped, or when the program finishes.
+//
+//	Each address space has its own open files (see filetable.h),
+//	closed when the program finishes.  A forked address space starts
+//	out with none open.
+//
+//	A program may run more than one thread in its address space (see
+//	Kernel::ThreadFork), each with a stack of its own, mapped above
+//	the others as zero-filled memory.  The address space is deleted
+//	with the last of them.
+//
 //	The user level CPU state is saved and restored in the thread
 //	executing the user program (see thread.h).
 //
+//	A running program can be checkpointed to a host file (see
+//	Checkpoint): its registers, and every page it has touched apart
+//	from the shared code.  Restore starts it again from there, in
+//	a fresh address space, with the executable loaded as usual and
+//	the pages written over it.  Only a program with one thread, no
+//	open files and nothing mapped can be checkpointed, since the
+//	kernel's own state isn't saved: it must be run against the same
+//	executable, and the disk as it is then.
+//
 // Copyright (c) 1992-1996 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
 // of liability and disclaimer of warranty provisions.
@@ -15,8 +52,28 @@
 
 #include "copyright.h"
 #include "filesys.h"
+#include "noff.h"
+#include "list.h"
+#include "filetable.h"
 
 #define UserStackSize		1024 	// increase this as necessary!
+#define CheckpointMagic		0x434b5054	// "CKPT", first word of a
+						// checkpoint
+#define MaxCheckpointName	64	// room for the executable's name
+
+class SharedCode;
+
+// The following class defines a file mapped into an address space:
+// "length" bytes from the start of "file", at pages "firstPage" on.
+// With no file, the pages are zero-filled memory (a thread's stack).
+
+class MappedFile {
+  public:
+    OpenFile *file;			// the program's open file, or NULL
+    unsigned int firstPage;
+    unsigned int numPages;
+    int length;
+};
 
 class AddrSpace {
   public:
@@ -26,10 +83,44 @@ class AddrSpace {
     bool Load(char *fileName);		// Load a program into addr space from
                                         // a file
 					// return false if not found
+    AddrSpace *Fork();			// A copy of this address space,
+    					// sharing its pages copy-on-write;
+					// NULL if it can't be made
+
+    int Mmap(OpenFile *file, int length);
+    					// Map "length" bytes of "file";
+					// returns where, or -1
+    bool Munmap(int vaddr);		// Write back and unmap the file
+    					// mapped at "vaddr"; FALSE if none
+    void UnmapAll();			// Unmap every file, as the program
+    					// finishes
+
+    int Open(OpenFile *file) { return files->Add(file); }
+    					// Give open "file" an id
+    OpenFile *FileOf(int id) { return files->Get(id); }
+    					// The open file "id", or NULL
+    bool Close(int id);			// Close file "id", unmapping it
+    					// first if it is mapped; FALSE if
+					// there is no such file
+    void CloseAll();			// Close every file, as the program
+    					// finishes
+
+    void AddThread() { numThreads++; }	// Another thread runs in it
+    bool RemoveThread() { return --numThreads == 0; }
+    					// One less does; TRUE if it was the
+					// last
+    int NumThreads() { return numThreads; }
 
     void Execute(char *fileName);             	// Run a program
 					// assumes the program has already
                                         // been loaded
+    bool Checkpoint(char *hostName);	// Save the running program to
+    					// host file "hostName"; FALSE if
+					// it can't be saved now
+    bool Restore(char *hostName, int *registers);
+    					// Load the program saved there,
+					// and its registers; FALSE if not
+    void Resume(int *registers);	// Run it on from "registers"
 
     void SaveState();			// Save/restore address space-specific
     void RestoreState();		// info on a context switch 
@@ -39,11 +130,112 @@ class AddrSpace {
     // is 0 for Read, 1 for Write.
     ExceptionType Translate(unsigned int vaddr, unsigned int *paddr, int mode);
 
+    TranslationEntry *PageEntry(unsigned int vpn)
+	{ return pageTable->Entry(vpn); }
+    				// Page table entry for virtual page
+				// "vpn", or NULL if it is out of range
+    int ASID() { return asid; }	// tag for this space's TLB entries
+
+    bool PageIn(unsigned int vpn);	// Give virtual page "vpn" a frame,
+    					// and fill it; FALSE if there is no
+					// page "vpn", or no frame to be had
+    bool PageOut(unsigned int vpn);	// Give up resident page "vpn"'s
+    					// frame, saving it if it is dirty;
+					// FALSE if the swap file is full
+    bool CopyOnWrite(unsigned int vpn);	// Give page "vpn", shared copy-on-
+    					// write, a frame of its own; FALSE
+					// if it is really read-only
+    void UnmapCopy(unsigned int vpn, int slot);
+    					// The pager took the frame page
+					// "vpn" shared; it is now in swap
+					// "slot" (or the executable, if -1)
+    int SwapSlot(unsigned int vpn) { return swapSlot[vpn]; }
+    bool Cleanable(unsigned int vpn);	// Is resident page "vpn" dirty, and
+    					// not used since the clock passed?
+    void CleanPage(unsigned int vpn, int slot, char *into);
+    					// Copy it into "into", to be written
+					// to swap "slot", and call it clean
+    bool Referenced(unsigned int vpn);	// Has resident page "vpn" been used
+    					// since the last call?  (for the
+					// Pager's clock)
+
+    bool CopyIn(int vaddr, char *buf, int size);
+    bool CopyOut(int vaddr, char *buf, int size);
+    					// Copy "size" bytes from or to user
+					// memory at "vaddr", paging it in
+					// as need be; FALSE if any of it is
+					// outside the address space
+    bool CopyInString(int vaddr, char *buf, int size);
+    					// Copy a null-terminated string of
+					// up to "size" bytes, with the null;
+					// FALSE if it doesn't end by then
+    int PinRun(int vaddr, int size, bool writing, char **addr);
+    					// Page in and pin as much of "size"
+					// bytes at "vaddr" as is in
+					// consecutive frames, from "*addr",
+					// for I/O; 0 if it can't be reached
+    void UnpinRun(int vaddr, int size);	// The I/O is done
+
   private:
-    TranslationEntry *pageTable;	// Assume linear page table translation
-					// for now!
+    PageTable *pageTable;		// two levels, so untouched parts of
+    					// the address space take no entries
     unsigned int numPages;		// Number of pages in the virtual 
 					// address space
+    int asid;				// unique to this address space
+    OpenFile *executable;		// pages are read from here,
+    char *fileName;			// (which is this file)
+    NoffHeader noffH;			// as its header says,
+    Segment image;			// (all its segments, if they lie
+    					// end to end; else of size 0)
+    bool alignedImage;			// and is "image" a page aligned
+    					// memory image (NOFF version 2)?
+    int *swapSlot;			// or, for each page that has one,
+    					// from this swap slot (else -1)
+    SharedCode *code;			// the first "codePages" pages are
+    unsigned int codePages;		// these, shared with others running
+    					// the same executable
+    unsigned int filePages;		// pages from here on are zero-fill,
+    unsigned int basePages;		// up to the top of the stack; pages
+    List<MappedFile *> *mappings;	// above are in these, if anywhere
+    FileTable *files;			// the files the program has open
+    int numThreads;			// threads running in it
+    int lastFault;			// page last paged in, to tell when
+    					// faults come in sequence (or -1)
+    
+    char *UserAddress(int vaddr, bool writing);
+    					// Where "vaddr" is in mainMemory,
+					// paging it in; NULL if it's not in
+					// the address space
+    int UserRun(int vaddr, int size, bool writing, char **addr);
+    					// How much of "size" bytes at
+					// "vaddr" is in consecutive frames,
+					// from "*addr"
+    unsigned int SharedPages(unsigned int size);
+    					// How many leading pages are only
+					// code and read-only data
+    unsigned int FilePages();		// How many leading pages are
+    					// read from the executable
+    MappedFile *MappingOf(unsigned int vpn);
+    					// The mapping page "vpn" is in, or
+					// NULL
+    void Unmap(MappedFile *m);		// Write back and unmap "m"
+    void Resize(unsigned int pages);	// Grow or shrink the page table
+    void FillFrame(unsigned int vpn, int frame);
+    					// Read page "vpn" into "frame"
+    unsigned int ClusterPages(unsigned int vpn);
+    					// How many pages from "vpn" on can
+					// be read in one request
+    void FillCluster(unsigned int vpn, int *frames, int count);
+    					// Read "count" pages from "vpn" on
+					// into "frames"
+    void FindImage();			// Set "image" and "alignedImage"
+    void ReadSegment(Segment *seg, int vpn, int frame);
+    					// Fill "frame" with what "seg" has
+					// in page "vpn", if anything
+    void SyncTLB(unsigned int vpn, bool invalidate);
+    					// Copy the use and dirty bits of
+					// TLB entries for "vpn" into the
+					// page table
 
     void InitRegisters();		// Initialize user-level CPU registers,
 					// before jumping to user code
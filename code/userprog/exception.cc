@@ -25,41 +25,117 @@
 #include "main.h"
 #include "syscall.h"
 #include "ksyscall.h"
+#include "kregion.h"
+
+static HostThreadLocal int clockHand[MaxTLBSize];
+					// per TLB set, the way the clock
+					// looks at next
+
 //----------------------------------------------------------------------
-// ExceptionHandler
-// 	Entry point into the Nachos kernel.  Called when a user program
-//	is executing, and either does a syscall, or generates an addressing
-//	or arithmetic exception.
-//
-// 	For system calls, the following is the calling convention:
-//
-// 	system call code -- r2
-//		arg1 -- r4
-//		arg2 -- r5
-//		arg3 -- r6
-//		arg4 -- r7
-//
-//	The result of the system call, if any, must be put back into r2. 
-//
-// If you are handling a system call, don't forget to increment the pc
-// before returning. (Or else you'll loop making the same system call forever!)
+// HandlePageFault
+// 	The machine found no valid translation for "badVAddr".  If the
+//	page isn't in memory yet, page it in (see AddrSpace::PageIn).
+//	Then, if there is a TLB, load it with the running address
+//	space's translation for the page.  The TLB entry replaced is an invalid one in the page's set if there is one;
+//	otherwise, the least recently used one in the set, or with
+//	-tlbr clock, the first the set's clock hand finds not used since
+//	the hand last passed it.  The use and dirty bits of an entry
+//	the running space loaded are copied back to its page table
+//	before it is replaced; another space's were copied back when
+//	it was switched out (see AddrSpace::SaveState).
 //
-//	"which" is the kind of exception.  The list of possible exceptions 
-//	is in machine.h.
+//	Returns FALSE if the page isn't in the address space, or can't
+//	be paged in: a real fault.  Otherwise the instruction that
+//	faulted is simply run again, so the PC is not advanced.
 //----------------------------------------------------------------------
 
-void
-ExceptionHandler(ExceptionType which)
+static bool
+HandlePageFault(int badVAddr)
+{
+    Machine *machine = kernel->machine;
+    AddrSpace *space = kernel->currentThread->space;
+    unsigned int vpn = (unsigned) badVAddr / PageSize;
+    TranslationEntry *page, *entry;
+    int first, way, victim = -1;
+
+    if (space == NULL || (page = space->PageEntry(vpn)) == NULL)
+	return FALSE;
+    if (!page->valid) {
+	if (!space->PageIn(vpn))
+	    return FALSE;
+	kernel->stats->numPageFaults++;
+    }
+    if (machine->tlb == NULL)
+	return TRUE;			// the page table has it now
+    first = machine->TLBSet(vpn);
+    for (way = 0; way < machine->tlbWays && victim < 0; way++)
+	if (!machine->tlb[first + way].valid)
+	    victim = first + way;
+    if (victim < 0 && kernel->tlbClock) {
+	int *hand = &clockHand[first / machine->tlbWays];
+
+	while (machine->tlb[first + *hand].use) {	// second chance
+	    machine->tlb[first + *hand].use = FALSE;
+	    *hand = (*hand + 1) % machine->tlbWays;
+	}
+	victim = first + *hand;
+	*hand = (*hand + 1) % machine->tlbWays;
+    } else if (victim < 0) {
+	victim = first;
+	for (way = 1; way < machine->tlbWays; way++)
+	    if (machine->tlbLastUse[first + way] < machine->tlbLastUse[victim])
+		victim = first + way;
+    }
+
+    entry = &machine->tlb[victim];
+    if (entry->valid) {
+	kernel->stats->numTLBEvictions++;
+	if (machine->tlbASID[victim] == space->ASID()) {
+	    TranslationEntry *old = space->PageEntry(entry->virtualPage);
+
+	    old->use = old->use || entry->use;
+	    old->dirty = old->dirty || entry->dirty;
+	}
+    }
+    *entry = *page;
+    machine->tlbASID[victim] = space->ASID();
+    DEBUG(dbgAddr, "TLB miss on page " << vpn << ", loaded into entry "
+		   << victim);
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// RecordSyscall
+// 	Count a system call of "type", made at tick "start" and now
+//	returning, for the whole kernel and for the thread making it.
+//----------------------------------------------------------------------
+
+static void
+RecordSyscall(int type, int start)
+{
+    int ticks = kernel->stats->totalTicks - start;
+
+    kernel->stats->syscalls.Record(type, ticks);
+    kernel->currentThread->times.syscalls.Record(type, ticks);
+}
+
+//----------------------------------------------------------------------
+// HandleSyscall
+// 	Do system call "type", made at tick "start", and return to
+//	ExceptionHandler, with the PC advanced, when it is done.  Halt
+//	and Exit don't return, and so count themselves.
+//----------------------------------------------------------------------
+
+static void
+HandleSyscall(int type, int start)
 {
-    int type = kernel->machine->ReadRegister(2);
 	int val;
-    int status, exit, threadID, programID;
-	DEBUG(dbgSys, "Received Exception " << which << " type: " << type << "\n");
-    switch (which) {
-    case SyscallException:
+    int status;
+
       	switch(type) {
       	case SC_Halt:
 			DEBUG(dbgSys, "Shutdown, initiated by user program.\n");
+			RecordSyscall(type, start);	// it doesn't return
 			SysHalt();
                         cout<<"in exception\n";
 			ASSERTNOTREACHED();
@@ -68,18 +144,23 @@ ExceptionHandler(ExceptionType which)
 			DEBUG(dbgSys, "Message received.\n");
 			val = kernel->machine->ReadRegister(4);
 			{
-			char *msg = &(kernel->machine->mainMemory[val]);
-			cout << msg << endl;
+			char msg[MaxStringArg];
+			if (kernel->currentThread->space->CopyInString(val, msg, MaxStringArg))
+				cout << msg << endl;
 			}
+			RecordSyscall(type, start);
 			SysHalt();
 			ASSERTNOTREACHED();
 			break;
         case SC_Open:
+        case SC_OpenAppend:
 			val = kernel->machine->ReadRegister(4);
 			{
-			char *filename = &(kernel->machine->mainMemory[val]);
-			//cout << filename << endl;
-			status = SysOpen(filename);
+			char filename[MaxStringArg];
+			if (!kernel->currentThread->space->CopyInString(val, filename, MaxStringArg))
+				status = -1;
+			else
+				status = SysOpen(filename, type == SC_OpenAppend);
 			kernel->machine->WriteRegister(2, (int) status);
 			}
 			kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
@@ -91,10 +172,12 @@ ExceptionHandler(ExceptionType which)
 		case SC_Create:
 			val = kernel->machine->ReadRegister(4);
 			{
-			char *filename = &(kernel->machine->mainMemory[val]);
-			//cout << filename << endl;
+			char filename[MaxStringArg];
 			int filesize = kernel->machine->ReadRegister(5);
-			status = SysCreate(filename, filesize);
+			if (!kernel->currentThread->space->CopyInString(val, filename, MaxStringArg))
+				status = 0;
+			else
+				status = SysCreate(filename, filesize);
 			kernel->machine->WriteRegister(2, (int) status);
 			}
 			kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
@@ -108,8 +191,7 @@ ExceptionHandler(ExceptionType which)
             int val_ch = kernel->machine->ReadRegister(4);
             int val_len = kernel->machine->ReadRegister(5);
             int val_fid = kernel->machine->ReadRegister(6);
-            char *ch = &(kernel->machine->mainMemory[val_ch]);
-            status = SysWrite(ch, val_len, val_fid);
+            status = (val_len < 0) ? -1 : SysWrite(val_ch, val_len, val_fid);
             kernel->machine->WriteRegister(2, (int) status);
             }
             kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
@@ -123,8 +205,7 @@ ExceptionHandler(ExceptionType which)
             int val_ch = kernel->machine->ReadRegister(4);
             int val_len = kernel->machine->ReadRegister(5);
             int val_fid = kernel->machine->ReadRegister(6);
-            char *ch = &(kernel->machine->mainMemory[val_ch]);
-            status = SysRead(ch, val_len, val_fid);
+            status = (val_len < 0) ? -1 : SysRead(val_ch, val_len, val_fid);
             kernel->machine->WriteRegister(2, (int) status);
             }
             kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
@@ -134,6 +215,62 @@ ExceptionHandler(ExceptionType which)
             ASSERTNOTREACHED();
             break;
 
+        case SC_Seek:
+            status = SysSeek(kernel->machine->ReadRegister(4),
+                             kernel->machine->ReadRegister(5));
+            kernel->machine->WriteRegister(2, (int) status);
+            kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+            kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+            kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg)+4);
+            return;
+            ASSERTNOTREACHED();
+            break;
+        case SC_PRead:
+        case SC_PWrite:
+            {
+            int val_buf = kernel->machine->ReadRegister(4);
+            int val_len = kernel->machine->ReadRegister(5);
+            int val_pos = kernel->machine->ReadRegister(6);
+            int val_fid = kernel->machine->ReadRegister(7);
+            if (val_len < 0)
+                status = -1;
+            else if (type == SC_PRead)
+                status = SysPRead(val_buf, val_len, val_pos, val_fid);
+            else
+                status = SysPWrite(val_buf, val_len, val_pos, val_fid);
+            }
+            kernel->machine->WriteRegister(2, (int) status);
+            kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+            kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+            kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg)+4);
+            return;
+            ASSERTNOTREACHED();
+            break;
+        case SC_ReadV:
+        case SC_WriteV:
+            status = SysIOV(kernel->machine->ReadRegister(4),
+                            kernel->machine->ReadRegister(5),
+                            kernel->machine->ReadRegister(6),
+                            type == SC_ReadV);
+            kernel->machine->WriteRegister(2, (int) status);
+            kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+            kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+            kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg)+4);
+            return;
+            ASSERTNOTREACHED();
+            break;
+
+        case SC_Submit:
+            status = SysSubmit(kernel->machine->ReadRegister(4),
+                               kernel->machine->ReadRegister(5));
+            kernel->machine->WriteRegister(2, (int) status);
+            kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+            kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+            kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg)+4);
+            return;
+            ASSERTNOTREACHED();
+            break;
+
         case SC_Close:
             {
             val = kernel->machine->ReadRegister(4);
@@ -167,20 +304,194 @@ ExceptionHandler(ExceptionType which)
 	 		/* set next programm counter for brach execution */
 	 		kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg)+4);
 			}
-			cout << "result is " << result << "\n";	
+			if (!kernel->quietAdd)
+				cout << "result is " << result << "\n";	
 			return;	
 			ASSERTNOTREACHED();
             break;
+        case SC_Exec:
+			val = kernel->machine->ReadRegister(4);
+			{
+			char filename[MaxStringArg];
+			if (!kernel->currentThread->space->CopyInString(val, filename, MaxStringArg))
+				status = -1;
+			else
+				status = SysExec(filename);
+			kernel->machine->WriteRegister(2, (int) status);
+			}
+			kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+			kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+			kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg)+4);
+			return;
+			ASSERTNOTREACHED();
+            break;
+        case SC_Fork:
+            status = SysFork();		// the child starts past the call
+            kernel->machine->WriteRegister(2, (int) status);
+            kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+            kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+            kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg)+4);
+            return;
+            ASSERTNOTREACHED();
+            break;
+        case SC_ThreadFork:
+            status = SysThreadFork(kernel->machine->ReadRegister(4),
+                                   kernel->machine->ReadRegister(5));
+            kernel->machine->WriteRegister(2, (int) status);
+            kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+            kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+            kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg)+4);
+            return;
+            ASSERTNOTREACHED();
+            break;
+        case SC_ThreadJoin:
+            status = SysThreadJoin(kernel->machine->ReadRegister(4));
+            kernel->machine->WriteRegister(2, (int) status);
+            kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+            kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+            kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg)+4);
+            return;
+            ASSERTNOTREACHED();
+            break;
+        case SC_ThreadExit:
+            RecordSyscall(type, start);
+            SysThreadExit(kernel->machine->ReadRegister(4));
+            ASSERTNOTREACHED();
+            break;
+        case SC_ThreadYield:
+        case SC_Sleep:
+            if (type == SC_Sleep)
+                SysSleep(kernel->machine->ReadRegister(4));
+            else
+                SysThreadYield();
+            kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+            kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+            kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg)+4);
+            return;
+            ASSERTNOTREACHED();
+            break;
+        case SC_FutexWait:
+        case SC_FutexWake:
+            if (type == SC_FutexWait)
+                status = SysFutexWait(kernel->machine->ReadRegister(4),
+                                      kernel->machine->ReadRegister(5));
+            else
+                status = SysFutexWake(kernel->machine->ReadRegister(4),
+                                      kernel->machine->ReadRegister(5));
+            kernel->machine->WriteRegister(2, (int) status);
+            kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+            kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+            kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg)+4);
+            return;
+            ASSERTNOTREACHED();
+            break;
+        case SC_Mmap:
+            status = SysMmap(kernel->machine->ReadRegister(4),
+                             kernel->machine->ReadRegister(5));
+            kernel->machine->WriteRegister(2, (int) status);
+            kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+            kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+            kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg)+4);
+            return;
+            ASSERTNOTREACHED();
+            break;
+        case SC_Munmap:
+            status = SysMunmap(kernel->machine->ReadRegister(4));
+            kernel->machine->WriteRegister(2, (int) status);
+            kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+            kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+            kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg)+4);
+            return;
+            ASSERTNOTREACHED();
+            break;
+        case SC_ThreadStats:
+            val = kernel->machine->ReadRegister(4);
+            status = SysThreadStats(val);
+            kernel->machine->WriteRegister(2, (int) status);
+            kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+            kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+            kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg)+4);
+            return;
+            ASSERTNOTREACHED();
+            break;
+        case SC_GetStats:
+            val = kernel->machine->ReadRegister(4);
+            status = SysGetStats(val, kernel->machine->ReadRegister(5));
+            kernel->machine->WriteRegister(2, (int) status);
+            kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+            kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+            kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg)+4);
+            return;
+            ASSERTNOTREACHED();
+            break;
 		case SC_Exit:
 			DEBUG(dbgAddr, "Program exit\n");
             val=kernel->machine->ReadRegister(4);
             cout << "return value:" << val << endl;
+			RecordSyscall(type, start);
+			kernel->currentThread->exitStatus = val;
 			kernel->currentThread->Finish();
             break;
       	default:
 			cerr << "Unexpected system call " << type << "\n";
+			ASSERTNOTREACHED();
 			break;
 		}
+}
+
+//----------------------------------------------------------------------
+// ExceptionHandler
+// 	Entry point into the Nachos kernel.  Called when a user program
+//	is executing, and either does a syscall, or generates an addressing
+//	or arithmetic exception.
+//
+// 	For system calls, the following is the calling convention:
+//
+// 	system call code -- r2
+//		arg1 -- r4
+//		arg2 -- r5
+//		arg3 -- r6
+//		arg4 -- r7
+//
+//	The result of the system call, if any, must be put back into r2. 
+//
+// If you are handling a system call, don't forget to increment the pc
+// before returning. (Or else you'll loop making the same system call forever!)
+//
+//	"which" is the kind of exception.  The list of possible exceptions 
+//	is in machine.h.
+//----------------------------------------------------------------------
+
+void
+ExceptionHandler(ExceptionType which)
+{
+    KernelRegion region("ExceptionHandler");
+    int type = kernel->machine->ReadRegister(2);
+    int start;
+	DEBUG(dbgSys, "Received Exception " << which << " type: " << type << "\n");
+    kernel->CheckpointDue();		// -ckpt: before the exception
+					// changes anything
+    switch (which) {
+    case SyscallException:
+		start = kernel->stats->totalTicks;
+		HandleSyscall(type, start);
+		RecordSyscall(type, start);
+		return;
+	case PageFaultException:
+		if (HandlePageFault(kernel->machine->ReadRegister(BadVAddrReg)))
+			return;		// run the instruction again
+		cerr << "Page fault at " << kernel->machine->ReadRegister(BadVAddrReg);
+		cerr << ", killing " << kernel->currentThread->getName() << "\n";
+		kernel->currentThread->Finish();
+		break;
+	case ReadOnlyException:
+		if (kernel->currentThread->space != NULL
+		    && kernel->currentThread->space->CopyOnWrite(
+			(unsigned) kernel->machine->ReadRegister(BadVAddrReg) / PageSize))
+			return;		// run the instruction again
+		cerr << "Write to read-only page at " << kernel->machine->ReadRegister(BadVAddrReg);
+		cerr << ", killing " << kernel->currentThread->getName() << "\n";
+		kernel->currentThread->Finish();
 		break;
 	default:
 		cerr << "Unexpected user mode exception " << (int)which << "\n";
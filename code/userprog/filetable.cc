@@ -0,0 +1,119 @@
+// filetable.cc
+//	Routines for managing the files a user program has open.  See
+//	filetable.h.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "debug.h"
+#include "filetable.h"
+
+//----------------------------------------------------------------------
+// FileTable::FileTable
+// 	An empty table, with room for InitialFiles files.  The free ids
+//	are stacked highest first, so the lowest is handed out first.
+//----------------------------------------------------------------------
+
+FileTable::FileTable()
+{
+    size = InitialFiles;
+    files = new OpenFile *[size];
+    freeIds = new int[size];
+    numFree = 0;
+    for (int i = 0; i < size; i++)
+	files[i] = NULL;
+    for (int id = size; id >= 1; id--)
+	freeIds[numFree++] = id;
+}
+
+//----------------------------------------------------------------------
+// FileTable::~FileTable
+// 	Close every file still in the table.
+//----------------------------------------------------------------------
+
+FileTable::~FileTable()
+{
+    for (int i = 0; i < size; i++)
+	delete files[i];
+    delete [] files;
+    delete [] freeIds;
+}
+
+//----------------------------------------------------------------------
+// FileTable::Add
+// 	Put "file" in the table, under the id on top of the free stack,
+//	doubling the table first if there is none.  Returns the id.
+//----------------------------------------------------------------------
+
+int
+FileTable::Add(OpenFile *file)
+{
+    int id;
+
+    ASSERT(file != NULL);
+    if (numFree == 0)
+	Grow();
+    id = freeIds[--numFree];
+    files[id - 1] = file;
+    return id;
+}
+
+//----------------------------------------------------------------------
+// FileTable::Get
+// 	Return the file with id "id", or NULL if there is none.
+//----------------------------------------------------------------------
+
+OpenFile *
+FileTable::Get(int id)
+{
+    if (id < 1 || id > size)
+	return NULL;
+    return files[id - 1];
+}
+
+//----------------------------------------------------------------------
+// FileTable::Remove
+// 	Take the file with id "id" out of the table, and push "id" on
+//	the free stack.  Returns the file, which the caller closes, or
+//	NULL if there is none.
+//----------------------------------------------------------------------
+
+OpenFile *
+FileTable::Remove(int id)
+{
+    OpenFile *file = Get(id);
+
+    if (file == NULL)
+	return NULL;
+    files[id - 1] = NULL;
+    freeIds[numFree++] = id;
+    return file;
+}
+
+//----------------------------------------------------------------------
+// FileTable::Grow
+// 	Double the table.  Only done when no id is free, so the new ids
+//	are the only ones on the free stack.
+//----------------------------------------------------------------------
+
+void
+FileTable::Grow()
+{
+    int newSize = 2 * size;
+    OpenFile **newFiles = new OpenFile *[newSize];
+
+    ASSERT(numFree == 0);
+    for (int i = 0; i < size; i++)
+	newFiles[i] = files[i];
+    for (int i = size; i < newSize; i++)
+	newFiles[i] = NULL;
+    delete [] files;
+    delete [] freeIds;
+    files = newFiles;
+    freeIds = new int[newSize];
+    for (int id = newSize; id > size; id--)
+	freeIds[numFree++] = id;
+    size = newSize;
+}
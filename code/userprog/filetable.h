@@ -0,0 +1,50 @@
+// filetable.h
+//	Data structures for the files a user program has open.
+//
+//	Each address space has its own table of open files, indexed by
+//	the ids the Open system call hands out (1 up; 0 and -1 are never
+//	a file).  The table grows as need be, doubling, so a program may
+//	have any number of files open; the ids given back by Close are
+//	kept on a stack, and the next Open takes the top one, so neither
+//	needs to search the table.
+//
+//	The files themselves share the file system's in-core headers
+//	(see FileHeader::Acquire), so two programs with the same file
+//	open still see each other's writes.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef FILETABLE_H
+#define FILETABLE_H
+
+#include "copyright.h"
+#include "openfile.h"
+
+#define InitialFiles	8		// ids a table starts out with
+
+// The following class defines the open files of an address space.
+
+class FileTable {
+  public:
+    FileTable();
+    ~FileTable();			// Close the files still open
+
+    int Add(OpenFile *file);		// Give "file" an id, and return it
+    OpenFile *Get(int id);		// The file with id "id", or NULL
+    OpenFile *Remove(int id);		// Take back "id"; returns its file,
+    					// for the caller to close, or NULL
+    bool IsEmpty() { return numFree == size; }
+    					// Is no file open?
+
+  private:
+    OpenFile **files;			// the file with each id, or NULL
+    int size;				// ids 1 to "size" are in the table
+    int *freeIds;			// the ids not in use, a stack
+    int numFree;			// how many it holds
+
+    void Grow();			// Double the table
+};
+
+#endif // FILETABLE_H
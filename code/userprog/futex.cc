@@ -0,0 +1,110 @@
+// futex.cc
+//	Routines to put user threads to sleep on words of user memory,
+//	and wake them up.  See futex.h.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "futex.h"
+#include "addrspace.h"
+#include "machine.h"
+#include "main.h"
+
+//----------------------------------------------------------------------
+// FutexTable::FutexTable
+// 	Start with every wait queue empty.
+//----------------------------------------------------------------------
+
+FutexTable::FutexTable()
+{
+    for (int i = 0; i < FutexBuckets; i++)
+	buckets[i] = new List<FutexWaiter *>;
+}
+
+FutexTable::~FutexTable()
+{
+    for (int i = 0; i < FutexBuckets; i++) {
+	while (!buckets[i]->IsEmpty())	// (threads still asleep at halt)
+	    delete buckets[i]->RemoveFront();
+	delete buckets[i];
+    }
+}
+
+//----------------------------------------------------------------------
+// FutexTable::Wait
+// 	If the word at "vaddr" in "space" holds "expected", put the
+//	current thread to sleep on it until another thread calls Wake;
+//	otherwise return at once, since whoever changed it may already
+//	have called Wake.  The word's frame is pinned meanwhile.
+//
+//	Returns 0 once woken, 1 if the word didn't hold "expected", or
+//	-1 if "vaddr" isn't an aligned word of the address space.
+//----------------------------------------------------------------------
+
+int
+FutexTable::Wait(AddrSpace *space, int vaddr, int expected)
+{
+    Interrupt *interrupt = kernel->interrupt;
+    FutexWaiter waiter;
+    IntStatus oldLevel;
+    char *word;
+    int result = 0;
+
+    if (vaddr % sizeof(int) != 0
+	|| space->PinRun(vaddr, sizeof(int), FALSE, &word) < (int) sizeof(int))
+	return -1;
+    waiter.paddr = word - kernel->machine->mainMemory;
+    waiter.thread = kernel->currentThread;
+    oldLevel = interrupt->SetLevel(IntOff);
+    if ((int) WordToHost(*(unsigned int *) word) != expected) {
+	result = 1;
+    } else {
+	Bucket(waiter.paddr)->Append(&waiter);
+	kernel->currentThread->Sleep(FALSE);
+    }
+    (void) interrupt->SetLevel(oldLevel);
+    space->UnpinRun(vaddr, sizeof(int));
+    return result;
+}
+
+//----------------------------------------------------------------------
+// FutexTable::Wake
+// 	Wake up to "count" of the threads sleeping on the word at
+//	"vaddr" in "space" (or on the same word in another address space
+//	sharing its frame), in the order they went to sleep.
+//
+//	Returns how many were woken, or -1 if "vaddr" isn't an aligned
+//	word of the address space.
+//----------------------------------------------------------------------
+
+int
+FutexTable::Wake(AddrSpace *space, int vaddr, int count)
+{
+    Interrupt *interrupt = kernel->interrupt;
+    List<FutexWaiter *> *bucket;
+    IntStatus oldLevel;
+    char *word;
+    int paddr, woken = 0;
+
+    if (vaddr % sizeof(int) != 0
+	|| space->PinRun(vaddr, sizeof(int), FALSE, &word) < (int) sizeof(int))
+	return -1;
+    paddr = word - kernel->machine->mainMemory;
+    bucket = Bucket(paddr);
+    oldLevel = interrupt->SetLevel(IntOff);
+    for (ListIterator<FutexWaiter *> it(bucket); !it.IsDone() && woken < count;) {
+	FutexWaiter *w = it.Item();
+
+	it.Next();			// (before "w" goes)
+	if (w->paddr == paddr) {
+	    bucket->Remove(w);
+	    kernel->scheduler->ReadyToRun(w->thread);
+	    woken++;
+	}
+    }
+    (void) interrupt->SetLevel(oldLevel);
+    space->UnpinRun(vaddr, sizeof(int));
+    return woken;
+}
@@ -0,0 +1,61 @@
+// futex.h
+//	Data structures for the FutexWait and FutexWake system calls,
+//	with which user programs build their own locks: a lock is a word
+//	of user memory, taken and released in user mode while no one
+//	contends for it; a thread that finds it taken waits in the
+//	kernel, on the word, until the holder wakes it.
+//
+//	Waiters are kept in a hash table of wait queues, keyed by the
+//	physical address of the word, so that threads of one program, or
+//	programs sharing the page, wait on the same queue.  The frame of
+//	a word that is waited on is pinned (see Pager::Pin), so its
+//	physical address stays the same until the waiter is woken.
+//
+//	A wait must check the word and go to sleep with nothing in
+//	between, or it could miss the wake-up; as in Semaphore::P, that
+//	is done with interrupts off.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include "copyright.h"
+#include "list.h"
+#include "thread.h"
+
+#define FutexBuckets	64		// wait queues in the hash table
+
+// A thread waiting on the word at physical address "paddr".
+
+class FutexWaiter {
+  public:
+    int paddr;
+    Thread *thread;
+};
+
+// The following class defines the wait queues.
+
+class FutexTable {
+  public:
+    FutexTable();
+    ~FutexTable();
+
+    int Wait(AddrSpace *space, int vaddr, int expected);
+    					// Sleep on the word at "vaddr", if
+					// it still holds "expected"
+    int Wake(AddrSpace *space, int vaddr, int count);
+    					// Wake up to "count" threads
+					// sleeping on it
+
+  private:
+    List<FutexWaiter *> *buckets[FutexBuckets];
+    					// waiters, by hash of the address
+
+    List<FutexWaiter *> *Bucket(int paddr)
+	{ return buckets[(paddr / sizeof(int)) % FutexBuckets]; }
+};
+
+#endif // FUTEX_H
@@ -1,74 +1,350 @@
-/**************************************************************
- *
- * userprog/ksyscall.h
- *
- * Kernel interface for systemcalls 
- *
- * by Marcus Voelp  (c) Universitaet Karlsruhe
- *
- **************************************************************/
-
-#ifndef __USERPROG_KSYSCALL_H__ 
-#define __USERPROG_KSYSCALL_H__ 
-
-#include "kernel.h"
-
-#include "synchconsole.h"
-
-
-void SysHalt()
-{
-  kernel->interrupt->Halt();
-}
-
-int SysAdd(int op1, int op2)
-{
-  return op1 + op2;
-}
-
-int SysCreate(char *filename, int filesize)
-{
-	// return value
-	// 1: success
-	// 0: failed
-	return kernel->interrupt->CreateFile(filename, filesize);
-}
-
-int SysOpen(char *filename)
-{
-	// return value
-	// return ID
-	// return -1 if failed
-	OpenFile *file;
-	file = kernel->fileSystem->Open(filename);
-	int position = -1;
-	int i;	
-	for(i=0; i<20; i++){
-		if(kernel->fileSystem->fileDescriptorTable[i] == NULL){
-			position = i;
-			break;
-		}	
-	}
-	if(position>=0 && position<20){
-		kernel->fileSystem->fileDescriptorTable[i] = file;
-		return position+1;
-	}
-	else{
-		return -1;
-	}
-	
-}
-
-int SysWrite(char *buf, int len, int id){
-	return kernel->fileSystem->Write(buf,len,id);
-}
-
-int SysRead(char *buf, int len, int id){
-	return kernel->fileSystem->Read(buf,len,id);
-}
-
-int SysClose(int id){
-	return kernel->fileSystem->Close(id);
-}
-
-#endif /* ! __USERPROG_KSYSCALL_H__ */
+/**************************************************************
+ *
+ * userprog/ksyscall.h
+ *
+ * Kernel interface for systemcalls 
+ *
+ * by Marcus Voelp  (c) Universitaet Karlsruhe
+ *
+ **************************************************************/
+
+#ifndef __USERPROG_KSYSCALL_H__ 
+#define __USERPROG_KSYSCALL_H__ 
+
+#include "kernel.h"
+
+#include "synchconsole.h"
+#include "futex.h"
+
+#define MaxStringArg	256		// longest file name or message a
+					// system call takes, with the null
+
+void SysHalt()
+{
+  kernel->interrupt->Halt();
+}
+
+int SysAdd(int op1, int op2)
+{
+  return op1 + op2;
+}
+
+int SysCreate(char *filename, int filesize)
+{
+	// return value
+	// 1: success
+	// 0: failed
+	return kernel->interrupt->CreateFile(filename, filesize);
+}
+
+int SysOpen(char *filename, bool append = FALSE)
+{
+	// return value
+	// return ID
+	// return -1 if failed
+	OpenFile *file = kernel->fileSystem->Open(filename);
+
+	if (file == NULL)
+		return -1;
+	if (append)
+		file->SetAppend();	// Write goes at the end
+	return kernel->currentThread->space->Open(file);
+}
+
+// Read or write "len" bytes at user address "addr" straight into or out
+// of the frames they are in, a run of consecutive frames at a time (see
+// AddrSpace::PinRun), rather than through a kernel buffer.  The file is
+// read or written at "position", or at its seek position if that is -1.
+// Returns the bytes done, or -1 if the buffer is outside the address
+// space or there is no file "id".
+
+int SysIO(int addr, int len, int position, int id, bool reading){
+	AddrSpace *space = kernel->currentThread->space;
+	OpenFile *file = space->FileOf(id);
+	int done = 0;
+
+	if (file == NULL)
+		return -1;
+	while (done < len) {
+		char *mem;
+		int n = space->PinRun(addr + done, len - done, reading, &mem);
+		int moved;
+
+		if (n == 0)
+			return -1;
+		if (reading && position < 0)
+			moved = file->Read(mem, n);
+		else if (reading)
+			moved = file->ReadAt(mem, n, position + done);
+		else if (position < 0)
+			moved = file->Write(mem, n);
+		else
+			moved = file->WriteAt(mem, n, position + done);
+		if (reading)
+			kernel->machine->InvalidateCode(mem - kernel->machine->mainMemory, n);
+		space->UnpinRun(addr + done, n);
+		if (moved < 0)
+			return (done > 0) ? done : moved;
+		done += moved;
+		if (moved < n)
+			break;		// the end of the file
+	}
+	return done;
+}
+
+int SysWrite(int addr, int len, int id){
+	return SysIO(addr, len, -1, id, FALSE);
+}
+
+// Reading the console (id SysConsoleInput) gets at most one line, which
+// the console has already put together, into the frames it is read into
+// as SysIO does; it only waits if no whole line has been typed yet.
+
+int SysReadConsole(int addr, int len){
+	AddrSpace *space = kernel->currentThread->space;
+	int done = 0;
+
+	while (done < len) {
+		char *mem;
+		int n = space->PinRun(addr + done, len - done, TRUE, &mem);
+		int moved;
+		bool lineEnd;
+
+		if (n == 0)
+			return -1;
+		moved = kernel->synchConsoleIn->Read(mem, n);
+		lineEnd = (moved < n || mem[moved - 1] == '\n');
+		kernel->machine->InvalidateCode(mem - kernel->machine->mainMemory, moved);
+		space->UnpinRun(addr + done, n);
+		done += moved;
+		if (lineEnd)
+			break;		// the end of the line, or of the input
+	}
+	return done;
+}
+
+int SysRead(int addr, int len, int id){
+	if (id == SysConsoleInput)
+		return SysReadConsole(addr, len);
+	return SysIO(addr, len, -1, id, TRUE);
+}
+
+int SysPWrite(int addr, int len, int position, int id){
+	return (position < 0) ? -1 : SysIO(addr, len, position, id, FALSE);
+}
+
+int SysPRead(int addr, int len, int position, int id){
+	return (position < 0) ? -1 : SysIO(addr, len, position, id, TRUE);
+}
+
+// ReadV and WriteV: the "count" IOVecs at user address "iovAddr" are
+// copied in, and each buffer read or written in turn, stopping at the
+// first that isn't done in full (the end of the file).
+
+int SysIOV(int iovAddr, int count, int id, bool reading){
+	int iov[2 * MaxIOVecs];		// base and len of each
+	int done = 0;
+
+	if (count < 0 || count > MaxIOVecs
+	    || !kernel->currentThread->space->CopyIn(iovAddr, (char *) iov,
+						     count * 2 * sizeof(int)))
+		return -1;
+	for (int i = 0; i < count; i++) {
+		int base = WordToHost(iov[2 * i]);
+		int len = WordToHost(iov[2 * i + 1]);
+		int moved;
+
+		if (len < 0)
+			return (done > 0) ? done : -1;
+		moved = SysIO(base, len, -1, id, reading);
+		if (moved < 0)
+			return (done > 0) ? done : moved;
+		done += moved;
+		if (moved < len)
+			break;
+	}
+	return done;
+}
+
+int SysSeek(int position, int id){
+	OpenFile *file = kernel->currentThread->space->FileOf(id);
+
+	if (file == NULL || position < 0)
+		return -1;
+	file->Seek(position);
+	return 1;
+}
+
+int SysClose(int id){
+	return kernel->currentThread->space->Close(id) ? 1 : 0;
+}
+
+// Submit: the "count" entries at user address "addr" are copied in,
+// done in order, and copied back out with their results.  An entry
+// with a bad op, or an Open whose name can't be read, gets -1.
+
+#define SubmitEntryWords	6	// a SubmitEntry, in the user program
+
+int SysSubmit(int addr, int count){
+	AddrSpace *space = kernel->currentThread->space;
+	int e[MaxSubmits * SubmitEntryWords];
+
+	if (count < 0 || count > MaxSubmits
+	    || !space->CopyIn(addr, (char *) e, count * SubmitEntryWords * sizeof(int)))
+		return -1;
+	for (int i = 0; i < count; i++) {
+		int *entry = &e[i * SubmitEntryWords];
+		int op = WordToHost(entry[0]);
+		int id = WordToHost(entry[1]);
+		int buf = WordToHost(entry[2]);
+		int len = WordToHost(entry[3]);
+		int position = WordToHost(entry[4]);
+		int result = -1;
+		char name[MaxStringArg];
+
+		switch (op) {
+		case SubmitOpen:
+			if (space->CopyInString(buf, name, MaxStringArg))
+				result = SysOpen(name);
+			break;
+		case SubmitClose:
+			result = SysClose(id);
+			break;
+		case SubmitRead:
+		case SubmitWrite:
+			if (len >= 0)
+				result = SysIO(buf, len, -1, id, op == SubmitRead);
+			break;
+		case SubmitPRead:
+		case SubmitPWrite:
+			if (len >= 0 && position >= 0)
+				result = SysIO(buf, len, position, id, op == SubmitPRead);
+			break;
+		case SubmitSeek:
+			result = SysSeek(position, id);
+			break;
+		}
+		entry[5] = WordToMachine(result);
+	}
+	if (!space->CopyOut(addr, (char *) e, count * SubmitEntryWords * sizeof(int)))
+		return -1;
+	return count;
+}
+
+int SysExec(char *name)
+{
+  char *copy = new char[strlen(name) + 1];	// the thread's name, for good
+
+  strcpy(copy, name);
+  return kernel->Exec(copy);
+}
+
+int SysFork()
+{
+  AddrSpace *space;
+  int id;
+
+  if (kernel->currentThread->space->NumThreads() > 1)
+    return -1;				// (the others' stacks aren't copied)
+  space = kernel->currentThread->space->Fork();
+  if (space == NULL)
+    return -1;
+  id = kernel->Fork(space);
+  if (id < 0)
+    delete space;
+  return id;
+}
+
+int SysThreadFork(int func, int arg)
+{
+  return kernel->ThreadFork(func, arg);
+}
+
+int SysThreadJoin(int id)
+{
+  return kernel->ThreadJoin(id);
+}
+
+void SysThreadExit(int status)
+{
+  kernel->currentThread->exitStatus = status;
+  kernel->currentThread->Finish();
+}
+
+void SysThreadYield()
+{
+  kernel->currentThread->Yield();
+}
+
+void SysSleep(int ticks)
+{
+  if (ticks > 0)
+    kernel->alarm->WaitUntil(ticks);	// on the sleepers, by wake time
+}
+
+int SysFutexWait(int addr, int expected)
+{
+  return kernel->futexes->Wait(kernel->currentThread->space, addr, expected);
+}
+
+int SysFutexWake(int addr, int count)
+{
+  return kernel->futexes->Wake(kernel->currentThread->space, addr, count);
+}
+
+int SysMmap(int id, int length)
+{
+  AddrSpace *space = kernel->currentThread->space;
+
+  if (space->FileOf(id) == NULL)
+    return -1;
+  return space->Mmap(space->FileOf(id), length);
+}
+
+int SysMunmap(int addr)
+{
+  return kernel->currentThread->space->Munmap(addr) ? 1 : 0;
+}
+
+int SysThreadStats(int addr)
+{
+  ThreadTimes t;
+  int stats[ThreadStatsSize];
+
+  kernel->currentThread->GetTimes(&t);
+  stats[0] = t.runTicks;
+  stats[1] = t.readyTicks;
+  stats[2] = t.blockedTicks;
+  stats[3] = t.numVoluntary;
+  stats[4] = t.numInvoluntary;
+  for (int i = 0; i < ThreadStatsSize; i++)
+    stats[i] = WordToMachine(stats[i]);
+  if (!kernel->currentThread->space->CopyOut(addr, (char *) stats,
+					     sizeof(stats)))
+    return -1;
+  return 0;
+}
+
+int SysGetStats(int addr, int count)
+{
+  ThreadTimes t;
+  int stats[GetStatsSize];
+
+  if (count < 0)
+    return -1;
+  if (count > GetStatsSize)
+    count = GetStatsSize;
+  kernel->currentThread->GetTimes(&t);
+  stats[0] = t.userTicks;
+  stats[1] = t.systemTicks;
+  stats[2] = t.diskWaitTicks;
+  stats[3] = t.consoleWaitTicks;
+  for (int i = 0; i < count; i++)
+    stats[i] = WordToMachine(stats[i]);
+  if (!kernel->currentThread->space->CopyOut(addr, (char *) stats,
+					     count * sizeof(int)))
+    return -1;
+  return count;
+}
+
+#endif /* ! __USERPROG_KSYSCALL_H__ */
@@ -3,11 +3,25 @@
  *
  *     Basically, we only know about three types of segments:
  *	code (read-only), initialized data, and unitialized data
+ *
+ *     MP4 MODIFIED
+ *     A version 2 file (NOFFMAGIC2) has the same header, but its
+ *	segments are laid out as a memory image: every segment is at
+ *	the same distance from its virtual address in the file, and
+ *	that distance is a multiple of PageSize, with any gap between
+ *	segments filled with zeros.  So virtual page n of the code and
+ *	data is file page n plus a fixed number, and is paged in with
+ *	one whole-page read, which is one whole disk sector.  A file
+ *	that claims version 2 but isn't laid out so is read as version 1.
  */
 
+#ifndef NOFF_H
+#define NOFF_H
+
 #define NOFFMAGIC	0xbadfad 	/* magic number denoting Nachos 
 					 * object code file 
 					 */
+#define NOFFMAGIC2	0xbadfae	/* the same, page aligned (version 2) */
 
 typedef struct segment {
   int virtualAddr;		/* location of segment in virt addr space */
@@ -26,3 +40,5 @@ typedef struct noffHeader {
 				 * should be zero'ed before use 
 				 */
 } NoffHeader;
+
+#endif /* NOFF_H */
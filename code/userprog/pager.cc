@@ -0,0 +1,538 @@
+// pager.cc
+//	Routines for managing physical memory and the swap file.  See
+//	pager.h.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "debug.h"
+#include "pager.h"
+#include "addrspace.h"
+#include "workpool.h"
+#include "main.h"
+
+//----------------------------------------------------------------------
+// SharedCode::SharedCode
+// 	The shared code of the executable "fileName" (with the stub file
+//	system), or the one whose header is "hdrSector": "pages" pages,
+//	none of them in memory yet.  "hdr" is its NOFF header.
+//----------------------------------------------------------------------
+
+SharedCode::SharedCode(char *fileName, int hdrSector, NoffHeader *hdr,
+		       int pages)
+{
+    name = NULL;
+    if (fileName != NULL) {
+	name = new char[strlen(fileName) + 1];
+	strcpy(name, fileName);
+    }
+    sector = hdrSector;
+    noffH = *hdr;
+    numPages = pages;
+    frames = new int[pages];
+    for (int i = 0; i < pages; i++)
+	frames[i] = -1;
+    users = new List<AddrSpace *>;
+}
+
+SharedCode::~SharedCode()
+{
+    ASSERT(users->IsEmpty());
+    delete [] name;
+    delete [] frames;
+    delete users;
+}
+
+//----------------------------------------------------------------------
+// SharedCode::Matches
+// 	Is this the code of the executable "fileName", or "hdrSector"?
+//----------------------------------------------------------------------
+
+bool
+SharedCode::Matches(char *fileName, int hdrSector)
+{
+    if (fileName != NULL)
+	return name != NULL && strcmp(name, fileName) == 0;
+    return name == NULL && sector == hdrSector;
+}
+
+//----------------------------------------------------------------------
+// Pager::Pager
+// 	Start with every frame and swap slot free.  The swap file isn't
+//	created until a page has to be written to it.
+//----------------------------------------------------------------------
+
+Pager::Pager()
+{
+    lock = new Lock("pager");
+    freeFrames = new Bitmap(NumPhysPages);
+    for (int i = 0; i < NumPhysPages; i++) {
+	frames[i].space = NULL;
+	frames[i].shared = NULL;
+	frames[i].copies = NULL;
+	frames[i].pins = 0;
+    }
+    hand = 0;
+    swapMap = new Bitmap(SwapPages);
+    swapFile = NULL;
+    if (kernel->hostJob >= 0)		// the stub's swap file is a UNIX
+	sprintf(swapName, "%s.%d", SwapFileName, kernel->hostJob);
+    else				// file, one per host job
+	strcpy(swapName, SwapFileName);
+    codeCache = new List<SharedCode *>;
+    cleanPending = FALSE;
+}
+
+//----------------------------------------------------------------------
+// Pager::~Pager
+// 	Nachos is halting: the swap file's pages belong to programs
+//	that won't run again, so remove it.
+//----------------------------------------------------------------------
+
+Pager::~Pager()
+{
+    if (swapFile != NULL) {
+	delete swapFile;
+#ifdef FILESYS_STUB
+	kernel->fileSystem->Remove(swapName);
+#else
+	kernel->fileSystem->Remove(swapName, FALSE);
+#endif
+    }
+    delete codeCache;			// (the programs' address spaces
+    					// aren't deleted at halt)
+    delete swapMap;
+    delete freeFrames;
+    delete lock;
+}
+
+//----------------------------------------------------------------------
+// Pager::AllocFrame
+// 	Return a frame for page "vpn" of "space", or of the shared code
+//	"shared", to be read into: a free one if there is one, or else
+//	one taken from another page (see Evict).  The page isn't valid until the caller has filled the
+//	frame.  Returns -1 if no page could give up its frame, or if
+//	none is free and "evict" is FALSE (a page paged in only because
+//	it is near one that faulted shouldn't push out one in use).
+//	If that leaves few frames free, a worker is asked to clean the
+//	pages the hand will come to (see Clean).
+//----------------------------------------------------------------------
+
+int
+Pager::AllocFrame(AddrSpace *space, SharedCode *shared, unsigned int vpn,
+		  bool evict)
+{
+    int frame;
+
+    ASSERT(lock->IsHeldByCurrentThread());
+    frame = freeFrames->FindAndSet();
+    if (frame < 0 && evict)
+	frame = Evict();		// still marked in use, for us
+    if (frame >= 0) {
+	frames[frame].space = space;
+	frames[frame].shared = shared;
+	frames[frame].vpn = vpn;
+	frames[frame].pins = 0;
+    }
+    CheckClean();
+    return frame;
+}
+
+//----------------------------------------------------------------------
+// Pager::FreeFrame
+// 	The page in "frame" has gone, with its address space (or the
+//	last address space sharing it).
+//----------------------------------------------------------------------
+
+void
+Pager::FreeFrame(int frame)
+{
+    ASSERT(frames[frame].space != NULL || frames[frame].shared != NULL);
+    ASSERT(frames[frame].copies == NULL);
+    frames[frame].space = NULL;
+    frames[frame].shared = NULL;
+    freeFrames->Clear(frame);
+}
+
+//----------------------------------------------------------------------
+// Pager::ShareFrame
+// 	"space", forked from the address space whose page is in "frame",
+//	maps the frame too, at the same page, copy-on-write.
+//----------------------------------------------------------------------
+
+void
+Pager::ShareFrame(int frame, AddrSpace *space)
+{
+    FrameEntry *f = &frames[frame];
+
+    ASSERT(f->space != NULL);
+    if (f->copies == NULL)
+	f->copies = new List<AddrSpace *>;
+    f->copies->Append(space);
+}
+
+//----------------------------------------------------------------------
+// Pager::ReleaseFrame
+// 	"space" no longer maps "frame": it has a copy of its own now, or
+//	it is being deleted.  If it owned the frame, one of the copies
+//	takes it over; if there are none, the frame is free.
+//----------------------------------------------------------------------
+
+void
+Pager::ReleaseFrame(int frame, AddrSpace *space)
+{
+    FrameEntry *f = &frames[frame];
+
+    if (f->copies == NULL) {
+	ASSERT(f->space == space);
+	FreeFrame(frame);
+	return;
+    }
+    if (f->space == space)
+	f->space = f->copies->RemoveFront();
+    else
+	f->copies->Remove(space);
+    if (f->copies->IsEmpty()) {
+	delete f->copies;
+	f->copies = NULL;
+    }
+}
+
+//----------------------------------------------------------------------
+// Pager::Evict
+// 	Take a frame from the page in it, by the clock algorithm: step
+//	the hand round the frames, clearing the use bit of each page
+//	that has been used since the hand last passed it, until one
+//	hasn't.  After one turn every use bit is clear, so the search
+//	ends in the second, unless pages are dirty and the swap file is
+//	full; then it gives up after the third.
+//
+//	A pinned frame is passed over, as if its page had been used.
+//
+//	A shared code page has been used if any address space mapping
+//	it has used it, and is evicted by unmapping it from them all;
+//	it is never dirty.  So is a page shared copy-on-write (see
+//	EvictCopies), but that may have to be written out first.
+//
+//	Returns the frame, or -1.
+//----------------------------------------------------------------------
+
+int
+Pager::Evict()
+{
+    for (int n = 0; n < 3 * NumPhysPages; n++) {
+	int frame = hand;
+	FrameEntry *f = &frames[frame];
+
+	hand = (hand + 1) % NumPhysPages;
+	if (f->pins > 0)
+	    continue;			// a system call's I/O is using it
+	if (f->shared != NULL) {
+	    ListIterator<AddrSpace *> it(f->shared->users);
+	    ListIterator<AddrSpace *> out(f->shared->users);
+	    bool used = FALSE;
+
+	    for (; !it.IsDone(); it.Next())
+		if (it.Item()->PageEntry(f->vpn)->valid
+			&& it.Item()->Referenced(f->vpn))
+		    used = TRUE;	// (every use bit is cleared)
+	    if (used)
+		continue;
+	    for (; !out.IsDone(); out.Next())
+		if (out.Item()->PageEntry(f->vpn)->valid)
+		    (void) out.Item()->PageOut(f->vpn);	// clean: can't fail
+	    DEBUG(dbgAddr, "Evicted shared page " << f->vpn << " from frame "
+			   << frame);
+	    kernel->stats->numPageEvictions++;
+	    f->shared->frames[f->vpn] = -1;
+	    f->shared = NULL;
+	    return frame;
+	}
+	if (f->copies != NULL) {
+	    if (EvictCopies(f)) {
+		DEBUG(dbgAddr, "Evicted shared copy of page " << f->vpn
+			       << " from frame " << frame);
+		kernel->stats->numPageEvictions++;
+		f->space = NULL;
+		return frame;
+	    }
+	    continue;
+	}
+	if (f->space->Referenced(f->vpn))
+	    continue;			// second chance
+	if (f->space->PageOut(f->vpn)) {
+	    DEBUG(dbgAddr, "Evicted page " << f->vpn << " from frame "
+			   << frame);
+	    kernel->stats->numPageEvictions++;
+	    f->space = NULL;
+	    return frame;
+	}
+    }
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// Pager::CheckClean
+// 	Have a worker clean pages ahead of the clock hand, if fewer than
+//	CleanLowWater frames are free and it isn't about to already.
+//----------------------------------------------------------------------
+
+void
+Pager::CheckClean()
+{
+    if (cleanPending || freeFrames->NumClear() >= CleanLowWater)
+	return;
+    cleanPending = TRUE;
+    kernel->workers->Submit(Pager::CleanTask, this);
+}
+
+//----------------------------------------------------------------------
+// Pager::CleanTask
+// 	Task submitted by CheckClean: clean pages, holding the lock.
+//----------------------------------------------------------------------
+
+void
+Pager::CleanTask(void *data)
+{
+    Pager *_this = (Pager *) data;
+
+    _this->lock->Acquire();
+    _this->Clean();
+    _this->cleanPending = FALSE;
+    _this->lock->Release();
+}
+
+//----------------------------------------------------------------------
+// Pager::Clean
+// 	Look at the frames in the order the hand will come to them, for
+//	up to CleanBatch pages of one address space each that are dirty
+//	and haven't been used since the hand last passed -- the ones
+//	Evict would otherwise have to write out, one at a time, as it
+//	took their frames.  Give them consecutive swap slots, in that
+//	order, and write them all out with one write (see
+//	AddrSpace::CleanPage); they stay in their frames, clean.
+//
+//	Use bits aren't cleared, so the clock is left as it was.  If the
+//	swap file has no run of free slots as long, fewer pages are
+//	cleaned; Evict still writes the rest itself.  The lock is held
+//	throughout, so no page cleaned can be evicted or paged in again
+//	before the write is done.
+//----------------------------------------------------------------------
+
+void
+Pager::Clean()
+{
+    int victims[CleanBatch];
+    int count = 0, slot, length;
+    char *buf;
+
+    ASSERT(lock->IsHeldByCurrentThread());
+    for (int n = 0; n < NumPhysPages && count < CleanBatch; n++) {
+	int frame = (hand + n) % NumPhysPages;
+	FrameEntry *f = &frames[frame];
+
+	if (f->space != NULL && f->shared == NULL && f->copies == NULL
+	    && f->pins == 0 && f->space->Cleanable(f->vpn))
+	    victims[count++] = frame;
+    }
+    if (count == 0)
+	return;
+    slot = swapMap->FindRun(count, 0, &length);
+    if (slot < 0)
+	return;				// the swap file is full
+    count = length;
+    buf = new char[count * PageSize];
+    for (int i = 0; i < count; i++) {
+	FrameEntry *f = &frames[victims[i]];
+
+	swapMap->Mark(slot + i);
+	slotRefs[slot + i] = 1;
+	f->space->CleanPage(f->vpn, slot + i, buf + i * PageSize);
+    }
+    DEBUG(dbgAddr, "Cleaning " << count << " pages to swap slots " << slot
+		   << " on");
+    kernel->stats->numPagesCleaned += count;
+    WriteSlots(slot, count, buf);
+    delete [] buf;
+}
+
+//----------------------------------------------------------------------
+// Pager::EvictCopies
+// 	Take the copy-on-write frame "f" from its owner and copies,
+//	unless any of them has used it since the hand last passed (all
+//	their use bits are cleared).  The owner writes it out, if it is
+//	dirty, and the copies are then left with the same swap slot, or
+//	with none if the page is still as it was in the executable.
+//
+//	Returns FALSE, leaving the frame mapped, if it was used, or
+//	needs a slot and the swap file is full.
+//----------------------------------------------------------------------
+
+bool
+Pager::EvictCopies(FrameEntry *f)
+{
+    ListIterator<AddrSpace *> it(f->copies);
+    ListIterator<AddrSpace *> out(f->copies);
+    bool used = f->space->Referenced(f->vpn);
+    int slot;
+
+    for (; !it.IsDone(); it.Next())
+	if (it.Item()->Referenced(f->vpn))
+	    used = TRUE;
+    if (used || !f->space->PageOut(f->vpn))
+	return FALSE;
+    slot = f->space->SwapSlot(f->vpn);
+    for (; !out.IsDone(); out.Next())
+	out.Item()->UnmapCopy(f->vpn, slot);
+    delete f->copies;
+    f->copies = NULL;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Pager::AllocSlot, Pager::ShareSlot, Pager::FreeSlot
+// 	Allocate and free slots of the swap file.  A slot may hold a page
+//	of several address spaces, forked from one another, and is only
+//	free when the last of them lets it go.  AllocSlot returns -1 if
+//	the swap file is full.
+//----------------------------------------------------------------------
+
+int
+Pager::AllocSlot()
+{
+    int slot = swapMap->FindAndSet();
+
+    if (slot >= 0)
+	slotRefs[slot] = 1;
+    return slot;
+}
+
+void
+Pager::ShareSlot(int slot)
+{
+    ASSERT(slotRefs[slot] > 0);
+    slotRefs[slot]++;
+}
+
+void
+Pager::FreeSlot(int slot)
+{
+    ASSERT(slotRefs[slot] > 0);
+    if (--slotRefs[slot] == 0)
+	swapMap->Clear(slot);
+}
+
+//----------------------------------------------------------------------
+// Pager::FindCode
+// 	Return the shared code pages of the executable "fileName" (with
+//	the stub file system) or with its header at "hdrSector", or NULL
+//	if no address space is running it.
+//----------------------------------------------------------------------
+
+SharedCode *
+Pager::FindCode(char *fileName, int hdrSector)
+{
+    for (ListIterator<SharedCode *> it(codeCache); !it.IsDone(); it.Next())
+	if (it.Item()->Matches(fileName, hdrSector))
+	    return it.Item();
+    return NULL;
+}
+
+//----------------------------------------------------------------------
+// Pager::AttachCode
+// 	Return the shared code pages of the executable "fileName" (with
+//	the stub file system) or with its header at "hdrSector", starting
+//	a cache entry of "pages", with header "hdr", if no address space
+//	is running it yet.  "space" becomes one of its users.
+//----------------------------------------------------------------------
+
+SharedCode *
+Pager::AttachCode(char *fileName, int hdrSector, NoffHeader *hdr, int pages,
+		  AddrSpace *space)
+{
+    SharedCode *code = FindCode(fileName, hdrSector);
+
+    if (code == NULL) {
+	code = new SharedCode(fileName, hdrSector, hdr, pages);
+	codeCache->Append(code);
+    }
+    ASSERT(code->numPages == pages);
+    code->users->Append(space);
+    return code;
+}
+
+//----------------------------------------------------------------------
+// Pager::DetachCode
+// 	"space" is being deleted, and no longer maps "code"; if it was the
+//	last to, free its frames, and forget it.
+//----------------------------------------------------------------------
+
+void
+Pager::DetachCode(SharedCode *code, AddrSpace *space)
+{
+    code->users->Remove(space);
+    if (!code->users->IsEmpty())
+	return;
+    for (int i = 0; i < code->numPages; i++)
+	if (code->frames[i] >= 0)
+	    FreeFrame(code->frames[i]);
+    codeCache->Remove(code);
+    delete code;
+}
+
+//----------------------------------------------------------------------
+// Pager::ReadSlot, Pager::WriteSlot
+// 	Read the page in swap "slot" into "frame", or write it out.  The
+//	swap file is created at the first write.  The faulting program
+//	can't go on until the page is in, so the read is realtime I/O.
+//----------------------------------------------------------------------
+
+void
+Pager::ReadSlot(int slot, int frame)
+{
+    ReadSlots(slot, 1, &kernel->machine->mainMemory[frame * PageSize]);
+}
+
+void
+Pager::WriteSlot(int slot, int frame)
+{
+    WriteSlots(slot, 1, &kernel->machine->mainMemory[frame * PageSize]);
+}
+
+//----------------------------------------------------------------------
+// Pager::ReadSlots, Pager::WriteSlots
+// 	Read the "count" pages in swap slots "slot" onwards into "into",
+//	with one read of the swap file, for a page fault and the pages
+//	after it (see AddrSpace::PageIn); or write them from "from",
+//	for pages cleaned together (see Clean).
+//----------------------------------------------------------------------
+
+void
+Pager::ReadSlots(int slot, int count, char *into)
+{
+    IOClass old = kernel->currentThread->SetIOClass(IORealtime);
+
+    ASSERT(swapFile != NULL);
+    kernel->stats->numSwapReads += count;
+    swapFile->ReadAt(into, count * PageSize, slot * PageSize);
+    (void) kernel->currentThread->SetIOClass(old);
+}
+
+void
+Pager::WriteSlots(int slot, int count, char *from)
+{
+    if (swapFile == NULL) {
+#ifdef FILESYS_STUB
+	(void) kernel->fileSystem->Create(swapName);
+#else
+	(void) kernel->fileSystem->Create(swapName, SwapPages * PageSize,
+					  TRUE);	// (or it is left over)
+#endif
+	swapFile = kernel->fileSystem->Open(swapName);
+	ASSERT(swapFile != NULL);
+    }
+    kernel->stats->numSwapWrites += count;
+    swapFile->WriteAt(from, count * PageSize, slot * PageSize);
+}
@@ -0,0 +1,179 @@
+// pager.h
+//	Data structures for managing physical memory on behalf of the
+//	address spaces: which page is in each frame, and where pages go
+//	when their frame is needed for another.
+//
+//	Pages are paged in on demand (see AddrSpace::PageIn).  When no
+//	frame is free, one is taken from a resident page, chosen by the
+//	clock algorithm: a hand sweeps the frames, giving each page
+//	whose use bit is set a second chance (and clearing the bit), and
+//	takes the first page that hasn't been used since the hand last
+//	passed.  A page that is dirty is written to the swap file first;
+//	a clean one is simply dropped, since it can be read again from
+//	wherever it came from -- the executable, the swap file, or
+//	nowhere, if it is still all zeros.
+//
+//	The swap file holds SwapPages pages, at one page per slot; a page
+//	keeps its slot until its address space is deleted, so a clean
+//	page read back from swap needn't be written again.  A Lock
+//	serializes all paging, since reading and writing pages blocks.
+//
+//	Code is shared: every address space running the same executable
+//	(the same file header sector, or, with the stub file system,
+//	the same file name) maps the same read-only frames for the pages
+//	holding nothing but code and read-only data.  Each is read the
+//	first time any of them touches it, and the frames belong to the
+//	executable's SharedCode entry rather than to one address space;
+//	evicting one unmaps it from every address space using it.  The
+//	entry goes once the last of them is deleted.  It also keeps the
+//	executable's NOFF header, so another address space loading the
+//	same file needn't read and parse it again.
+//
+//	Other pages are shared copy-on-write after a Fork: the child maps
+//	the parent's frames, read-only in both, and the first to write a
+//	page gets a copy of its own (see AddrSpace::CopyOnWrite).  A frame
+//	so shared has one owner and a list of copies; evicting it writes
+//	it out once, if it is dirty, and unmaps it from them all, and
+//	they then share the swap slot.  Swap slots are counted, and a
+//	page written out while its slot is shared gets a slot of its own.
+//
+//	So that evicting seldom has to wait for a write, a worker cleans
+//	pages ahead of the clock hand once few frames are free (see
+//	Clean): the dirty pages the hand will come to next are given
+//	consecutive swap slots and written out together, with one write
+//	in slot order, and are then clean for Evict to drop.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef PAGER_H
+#define PAGER_H
+
+#include "copyright.h"
+#include "machine.h"
+#include "bitmap.h"
+#include "synch.h"
+#include "openfile.h"
+#include "list.h"
+#include "noff.h"
+
+#define SwapPages	1024		// pages the swap file holds
+#define SwapFileName	"SWAP"		// created on the first page out
+#define DefaultFaultAround 8		// pages paged in after a fault
+#define CleanLowWater	(NumPhysPages / 8)
+					// free frames below which dirty
+					// pages are cleaned ahead of Evict,
+#define CleanBatch	16		// this many at most at a time
+
+class AddrSpace;
+
+// The following class defines the shared code pages of an executable.
+
+class SharedCode {
+  public:
+    SharedCode(char *fileName, int hdrSector, NoffHeader *hdr, int pages);
+    ~SharedCode();
+
+    char *name;				// the executable, with the stub
+    					// file system,
+    int sector;				// or its header sector
+    NoffHeader noffH;			// its NOFF header, as parsed
+    int numPages;			// pages it has to share
+    int *frames;			// frame each is in, or -1
+    List<AddrSpace *> *users;		// address spaces mapping them
+
+    bool Matches(char *fileName, int hdrSector);
+};
+
+// The following class defines what is in a frame: page "vpn" of
+// "space" (and of "copies", if it is shared copy-on-write), or shared
+// code page "vpn" of "shared", or nothing if both are NULL.
+
+class FrameEntry {
+  public:
+    AddrSpace *space;
+    SharedCode *shared;
+    unsigned int vpn;
+    List<AddrSpace *> *copies;		// or NULL, if not shared
+    int pins;				// I/O going on into or out of it:
+    					// it can't be evicted
+};
+
+// The following class defines the pager.
+
+class Pager {
+  public:
+    Pager();
+    ~Pager();				// Remove the swap file
+
+    Lock *lock;				// held by anyone paging in or out
+
+    int AllocFrame(AddrSpace *space, SharedCode *shared, unsigned int vpn,
+		   bool evict = TRUE);
+    					// A frame for page "vpn" of "space"
+					// (or of "shared"), evicting a page
+					// if none is free (and "evict");
+					// -1 if none can be (the swap file
+					// is full).  The lock must be held
+    void FreeFrame(int frame);		// "frame" is no longer in use
+    void ShareFrame(int frame, AddrSpace *space);
+    					// "space" maps "frame" too, copy-on-
+					// write
+    void ReleaseFrame(int frame, AddrSpace *space);
+    					// "space" no longer maps "frame";
+					// free it if nothing else does
+    bool FrameShared(int frame)		// Is "frame" mapped copy-on-write?
+	{ return frames[frame].copies != NULL; }
+    void Pin(int frame) { frames[frame].pins++; }
+    void Unpin(int frame) { frames[frame].pins--; }
+    					// Keep "frame" where it is, while
+					// a device reads or writes it
+
+    int AllocSlot();			// A free swap slot, or -1
+    void ShareSlot(int slot);		// Another page is in "slot" too
+    void FreeSlot(int slot);		// One less page is in "slot"
+    bool SlotShared(int slot) { return slotRefs[slot] > 1; }
+    void ReadSlot(int slot, int frame);	// Read a page from swap into
+    void WriteSlot(int slot, int frame);	// "frame", or write one
+    void ReadSlots(int slot, int count, char *into);
+    void WriteSlots(int slot, int count, char *from);
+    					// Read or write "count" pages of
+					// swap, from "slot" on, in one
+					// request
+
+    SharedCode *FindCode(char *fileName, int hdrSector);
+    					// The shared code of an executable,
+					// if something is running it
+    SharedCode *AttachCode(char *fileName, int hdrSector, NoffHeader *hdr,
+			   int pages, AddrSpace *space);
+    					// The shared code of an executable,
+					// with "space" added to its users
+    void DetachCode(SharedCode *code, AddrSpace *space);
+    					// "space" is done with it
+
+  private:
+    Bitmap *freeFrames;			// frames not in use
+    FrameEntry frames[NumPhysPages];	// what is in the rest
+    int hand;				// the clock hand: next frame looked at
+    Bitmap *swapMap;			// swap slots in use,
+    int slotRefs[SwapPages];		// and by how many pages
+    OpenFile *swapFile;			// or NULL, until a page goes out
+    char swapName[16];			// SwapFileName, with ".<job>" for
+    					// a host job (-hj)
+    List<SharedCode *> *codeCache;	// executables being run
+    bool cleanPending;			// is a worker about to Clean?
+
+    void CheckClean();			// Have a worker Clean, if few
+    					// frames are free
+    static void CleanTask(void *data);	// (the task it runs)
+    void Clean();			// Write out the dirty pages ahead
+    					// of the hand, in one sweep
+    int Evict();			// Free a frame by the clock; -1 if
+    					// no page can give up its frame
+    bool EvictCopies(FrameEntry *f);	// Unmap a copy-on-write frame from
+    					// everything mapping it; FALSE if
+					// it is used, or can't be saved
+};
+
+#endif // PAGER_H
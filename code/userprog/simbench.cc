@@ -0,0 +1,447 @@
+// simbench.cc
+//	Routines to measure how fast the machine emulation runs user
+//	code, with a fixed set of MIPS kernels.  See simbench.h.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "debug.h"
+#include "sysdep.h"
+#include "simbench.h"
+#include "machine.h"
+#include "noff.h"
+#include "syscall.h"
+#include "filesys.h"
+#include "openfile.h"
+#include "main.h"
+
+#ifdef FILESYS_STUB
+#define BenchPrefix	"simbench."	// where the kernels are written
+#else
+#define BenchPrefix	"/simbench."
+#endif
+#define BenchCodeSize	(MaxBenchCode * 4)	// code segment, padded; the
+						// data begins here
+
+// MIPS instruction encodings: opcodes, and the function codes of the
+// SPECIAL opcode.
+
+enum { OpJal = 3, OpBeq = 4, OpBne = 5, OpAddiu = 9,
+       OpAndi = 12, OpOri = 13, OpLui = 15, OpLw = 35, OpSw = 43 };
+enum { FnSll = 0, FnJr = 8, FnSyscall = 12, FnAddu = 33, FnSubu = 35,
+       FnXor = 38, FnSlt = 42 };
+
+// The registers the kernels use.
+
+enum { R0 = 0, V0 = 2, A0 = 4, A1 = 5, T0 = 8, T1, T2, T3, T4, T5,
+       RA = 31 };
+
+#define Nop	0			// sll r0, r0, 0
+
+//----------------------------------------------------------------------
+// RType, IType, JType
+// 	Encode an instruction of each format.
+//----------------------------------------------------------------------
+
+static unsigned int
+RType(int funct, int rs, int rt, int rd, int shamt = 0)
+{
+    return (rs << 21) | (rt << 16) | (rd << 11) | (shamt << 6) | funct;
+}
+
+static unsigned int
+IType(int op, int rs, int rt, int imm)
+{
+    return (op << 26) | (rs << 21) | (rt << 16) | (imm & 0xffff);
+}
+
+static unsigned int
+JType(int op, int target)
+{
+    return (op << 26) | ((target >> 2) & 0x3ffffff);
+}
+
+//----------------------------------------------------------------------
+// BranchTo
+// 	Encode a branch at instruction "from" to instruction "to".
+//----------------------------------------------------------------------
+
+static unsigned int
+BranchTo(int op, int rs, int rt, int from, int to)
+{
+    return IType(op, rs, rt, to - (from + 1));
+}
+
+//----------------------------------------------------------------------
+// BenchProgram::Emit, BenchProgram::LoadConst, BenchProgram::Branch,
+// BenchProgram::DataAddr
+// 	Assemble a kernel an instruction at a time.
+//----------------------------------------------------------------------
+
+int
+BenchProgram::Emit(unsigned int instr)
+{
+    ASSERT(length < MaxBenchCode);
+    code[length] = instr;
+    return length++;
+}
+
+void
+BenchProgram::LoadConst(int reg, int value)
+{
+    Emit(IType(OpLui, R0, reg, (value >> 16) & 0xffff));
+    Emit(IType(OpOri, reg, reg, value & 0xffff));
+}
+
+void
+BenchProgram::Branch(int op, int rs, int rt, int to)
+{
+    Emit(BranchTo(op, rs, rt, length, to));
+}
+
+int
+BenchProgram::DataAddr()
+{
+    return BenchCodeSize;
+}
+
+//----------------------------------------------------------------------
+// EmitExit
+// 	End a kernel: Exit(0).
+//----------------------------------------------------------------------
+
+static void
+EmitExit(BenchProgram *p)
+{
+    p->Emit(IType(OpAddiu, R0, A0, 0));
+    p->Emit(IType(OpAddiu, R0, V0, SC_Exit));
+    p->Emit(RType(FnSyscall, R0, R0, R0));
+}
+
+//----------------------------------------------------------------------
+// SimBench::SimBench
+// 	Initialize the benchmark; nothing is measured until Run.
+//----------------------------------------------------------------------
+
+SimBench::SimBench()
+{
+    numResults = 0;
+    translateNs = -1;
+}
+
+//----------------------------------------------------------------------
+// SimBench::Run
+// 	Run one kernel, or all of them, time Translate, and report.
+//
+//	"which" -- intloop, memcopy, branches, syscalls, or all
+//	"jsonName" -- file to write the results to, or NULL
+//----------------------------------------------------------------------
+
+void
+SimBench::Run(char *which, char *jsonName)
+{
+    bool all = (strcmp(which, "all") == 0);
+    BenchProgram *p;
+
+    if (all || strcmp(which, "intloop") == 0) {
+	p = new BenchProgram;
+	IntLoop(p);
+	RunKernel("intloop", p);
+	delete p;
+    }
+    if (all || strcmp(which, "memcopy") == 0) {
+	p = new BenchProgram;
+	MemCopy(p);
+	RunKernel("memcopy", p);
+	delete p;
+    }
+    if (all || strcmp(which, "branches") == 0) {
+	p = new BenchProgram;
+	Branches(p);
+	RunKernel("branches", p);
+	delete p;
+    }
+    if (all || strcmp(which, "syscalls") == 0) {
+	p = new BenchProgram;
+	Syscalls(p);
+	kernel->quietAdd = TRUE;	// time the trap, not the terminal
+	RunKernel("syscalls", p);
+	kernel->quietAdd = FALSE;
+	delete p;
+    }
+    if (numResults == 0 && !all)
+	printf("Simbench: no kernel %s\n", which);
+    TimeTranslate();
+    Print();
+    if (jsonName != NULL)
+	WriteJSON(jsonName);
+}
+
+//----------------------------------------------------------------------
+// SimBench::RunKernel
+// 	Write "program" out as a NOFF file, with its data as zero-fill
+//	pages after the code, run it as a user program, and wait for it
+//	to exit.  What it took is kept under "name".
+//----------------------------------------------------------------------
+
+void
+SimBench::RunKernel(char *name, BenchProgram *program)
+{
+    BenchResult *r = &results[numResults];
+    char *fileName = new char[strlen(BenchPrefix) + strlen(name) + 1];
+    NoffHeader noffH;
+    OpenFile *file;
+    bool created;
+    int startInstrs;
+    double startTime;
+
+    ASSERT(numResults < MaxBenchKernels);
+    sprintf(fileName, "%s%s", BenchPrefix, name);
+    bzero((char *) &noffH, sizeof(noffH));
+    noffH.noffMagic = NOFFMAGIC;
+    noffH.code.virtualAddr = 0;
+    noffH.code.inFileAddr = sizeof(noffH);
+    noffH.code.size = BenchCodeSize;
+    noffH.uninitData.virtualAddr = BenchCodeSize;
+    noffH.uninitData.size = program->dataSize;
+    for (int i = 0; i < MaxBenchCode; i++)
+	program->code[i] = WordToHost(i < program->length ? program->code[i]
+						       : Nop);
+#ifdef FILESYS_STUB
+    created = kernel->fileSystem->Create(fileName);
+#else
+    created = kernel->fileSystem->Create(fileName,
+					 sizeof(noffH) + BenchCodeSize);
+#endif
+    file = created ? kernel->fileSystem->Open(fileName) : NULL;
+    if (file == NULL) {
+	printf("Simbench: unable to write %s\n", fileName);
+	delete [] fileName;
+	return;
+    }
+    file->WriteAt((char *) &noffH, sizeof(noffH), 0);
+    file->WriteAt((char *) program->code, BenchCodeSize, sizeof(noffH));
+    delete file;
+
+    startInstrs = kernel->stats->userTicks;
+    startTime = WallClock();
+    (void) kernel->ExecWait(fileName);
+    r->name = name;
+    r->hostSeconds = WallClock() - startTime;
+    r->instructions = kernel->stats->userTicks - startInstrs;
+    numResults++;
+
+#ifdef FILESYS_STUB
+    (void) kernel->fileSystem->Remove(fileName);
+#else
+    (void) kernel->fileSystem->Remove(fileName, FALSE);
+#endif
+    // fileName is the program's thread's name, and so is kept
+}
+
+//----------------------------------------------------------------------
+// SimBench::TimeTranslate
+// 	Time Machine::Translate on its own: a page table of one chunk of
+//	pages, all valid, put in place of the running one (there is
+//	none, between kernels), and read addresses spread over them.
+//	Not done with a TLB, which only the kernel's miss handler fills.
+//----------------------------------------------------------------------
+
+void
+SimBench::TimeTranslate()
+{
+    Machine *machine = kernel->machine;
+    PageTable *table, *saved;
+    int physAddr;
+    double start;
+
+    if (machine->tlb != NULL)
+	return;
+    table = new PageTable(PageTableChunk);
+    for (int vpn = 0; vpn < PageTableChunk; vpn++) {
+	TranslationEntry *entry = table->Entry(vpn);
+
+	entry->physicalPage = vpn;
+	entry->valid = TRUE;
+	entry->readOnly = FALSE;
+    }
+    saved = machine->pageTable;
+    machine->pageTable = table;
+    start = WallClock();
+    for (int i = 0; i < BenchTranslations; i++)
+	(void) machine->Translate((i * 36) % (PageTableChunk * PageSize),
+				  &physAddr, 4, FALSE);
+    translateNs = (WallClock() - start) * 1e9 / BenchTranslations;
+    machine->pageTable = saved;
+    delete table;
+}
+
+//----------------------------------------------------------------------
+// SimBench::Print
+// 	Print a line for each kernel run, and the time per Translate.
+//----------------------------------------------------------------------
+
+void
+SimBench::Print()
+{
+    printf("%-10s %12s %9s %8s %9s\n", "kernel", "instrs", "host secs",
+		"MIPS", "ns/instr");
+    for (int i = 0; i < numResults; i++) {
+	BenchResult *r = &results[i];
+
+	printf("%-10s %12d %9.3f %8.2f %9.1f\n", r->name, r->instructions,
+		r->hostSeconds,
+		r->hostSeconds > 0 ? r->instructions / r->hostSeconds / 1e6 : 0,
+		r->instructions > 0 ? r->hostSeconds * 1e9 / r->instructions
+				    : 0);
+    }
+    if (translateNs >= 0)
+	printf("Translate: %.1f ns\n", translateNs);
+}
+
+//----------------------------------------------------------------------
+// SimBench::WriteJSON
+// 	Write the results to "jsonName" as a JSON object, for scripts to
+//	compare one build against another.
+//----------------------------------------------------------------------
+
+void
+SimBench::WriteJSON(char *jsonName)
+{
+    char buf[4096];
+    int fd = OpenForWrite(jsonName);
+
+    sprintf(buf, "{\n  \"tlbEntries\": %d,\n  \"translateNs\": %.2f,\n"
+	    "  \"kernels\": [", kernel->stats->tlbEntries, translateNs);
+    for (int i = 0; i < numResults; i++) {
+	BenchResult *r = &results[i];
+
+	sprintf(buf + strlen(buf), "%s\n    {\"name\": \"%s\", "
+		"\"instructions\": %d, \"hostSeconds\": %.6f, "
+		"\"mips\": %.3f, \"nsPerInstruction\": %.2f}",
+		i == 0 ? "" : ",", r->name, r->instructions, r->hostSeconds,
+		r->hostSeconds > 0 ? r->instructions / r->hostSeconds / 1e6 : 0,
+		r->instructions > 0 ? r->hostSeconds * 1e9 / r->instructions
+				    : 0);
+    }
+    strcat(buf, "\n  ]\n}\n");
+    WriteFile(fd, buf, strlen(buf));
+    Close(fd);
+}
+
+//----------------------------------------------------------------------
+// SimBench::IntLoop
+// 	Register arithmetic: add, xor, shift and subtract, BenchLoops
+//	times.
+//----------------------------------------------------------------------
+
+void
+SimBench::IntLoop(BenchProgram *p)
+{
+    int loop;
+
+    p->LoadConst(T0, BenchLoops);
+    p->Emit(IType(OpAddiu, R0, T1, 0));
+    loop = p->length;
+    p->Emit(RType(FnAddu, T1, T0, T1));
+    p->Emit(RType(FnXor, T1, T0, T2));
+    p->Emit(RType(FnSll, R0, T2, T3, 3));
+    p->Emit(RType(FnSubu, T1, T3, T1));
+    p->Emit(IType(OpAddiu, T0, T0, -1));
+    p->Branch(OpBne, T0, R0, loop);
+    p->Emit(Nop);
+    EmitExit(p);
+}
+
+//----------------------------------------------------------------------
+// SimBench::MemCopy
+// 	Loads and stores: copy BenchCopyWords words from one half of the
+//	data to the other, BenchCopyRounds times.
+//----------------------------------------------------------------------
+
+void
+SimBench::MemCopy(BenchProgram *p)
+{
+    int outer, inner;
+
+    p->dataSize = 2 * BenchCopyWords * 4;
+    p->LoadConst(T5, BenchCopyRounds);
+    outer = p->length;
+    p->LoadConst(T0, p->DataAddr());
+    p->LoadConst(T1, p->DataAddr() + BenchCopyWords * 4);
+    p->Emit(IType(OpAddiu, R0, T2, BenchCopyWords));
+    inner = p->length;
+    p->Emit(IType(OpLw, T0, T3, 0));
+    p->Emit(IType(OpAddiu, T0, T0, 4));	// (the load delay slot)
+    p->Emit(IType(OpSw, T1, T3, 0));
+    p->Emit(IType(OpAddiu, T2, T2, -1));
+    p->Branch(OpBne, T2, R0, inner);
+    p->Emit(IType(OpAddiu, T1, T1, 4));	// (the branch delay slot)
+    p->Emit(IType(OpAddiu, T5, T5, -1));
+    p->Branch(OpBne, T5, R0, outer);
+    p->Emit(Nop);
+    EmitExit(p);
+}
+
+//----------------------------------------------------------------------
+// SimBench::Branches
+// 	Control flow: step a pseudo-random sequence, BenchLoops times,
+//	and take a branch or make a call depending on its bits.
+//----------------------------------------------------------------------
+
+void
+SimBench::Branches(BenchProgram *p)
+{
+    int loop, skipAdd, skipCall, call, func;
+
+    p->LoadConst(T0, BenchLoops);
+    p->LoadConst(T1, 12345);
+    p->Emit(IType(OpAddiu, R0, T2, 0));
+    loop = p->length;
+    p->Emit(RType(FnSll, R0, T1, T3, 2));	// T1 = 5 * T1 + 1
+    p->Emit(RType(FnAddu, T1, T3, T1));
+    p->Emit(IType(OpAddiu, T1, T1, 1));
+    p->Emit(IType(OpAndi, T1, T4, 0x100));
+    skipAdd = p->Emit(Nop);			// if bit 8 is set,
+    p->Emit(Nop);
+    p->Emit(IType(OpAddiu, T2, T2, 1));	// count it
+    p->Patch(skipAdd, BranchTo(OpBeq, T4, R0, skipAdd, p->length));
+    p->Emit(RType(FnSlt, T1, R0, T4));
+    skipCall = p->Emit(Nop);			// if T1 < 0,
+    p->Emit(Nop);
+    call = p->Emit(Nop);			// call the function
+    p->Emit(Nop);
+    p->Patch(skipCall, BranchTo(OpBeq, T4, R0, skipCall, p->length));
+    p->Emit(IType(OpAddiu, T0, T0, -1));
+    p->Branch(OpBne, T0, R0, loop);
+    p->Emit(Nop);
+    EmitExit(p);
+    func = p->length;				// the function: T2 += 3
+    p->Emit(RType(FnJr, RA, R0, R0));
+    p->Emit(IType(OpAddiu, T2, T2, 3));
+    p->Patch(call, JType(OpJal, func * 4));
+}
+
+//----------------------------------------------------------------------
+// SimBench::Syscalls
+// 	Traps: BenchSyscalls calls of Add, the cheapest system call.
+//----------------------------------------------------------------------
+
+void
+SimBench::Syscalls(BenchProgram *p)
+{
+    int loop;
+
+    p->LoadConst(T0, BenchSyscalls);
+    loop = p->length;
+    p->Emit(IType(OpAddiu, R0, V0, SC_Add));
+    p->Emit(RType(FnAddu, T0, R0, A0));
+    p->Emit(IType(OpAddiu, R0, A1, 1));
+    p->Emit(RType(FnSyscall, R0, R0, R0));
+    p->Emit(IType(OpAddiu, T0, T0, -1));
+    p->Branch(OpBne, T0, R0, loop);
+    p->Emit(Nop);
+    EmitExit(p);
+}
@@ -0,0 +1,96 @@
+// simbench.h
+//	Data structures for measuring how fast the machine emulation runs
+//	user code (nachos -sb, or "make simbench"), so that changes to
+//	the interpreter, the block engine, the TLB or the batching of
+//	clock ticks can be compared against a baseline.
+//
+//	Each kernel is a small CPU-bound MIPS program, assembled here
+//	into a NOFF file, so the benchmark needs no cross-compiler: an
+//	integer loop, a memory copy, a loop of data-dependent branches
+//	and calls, and a loop of system calls.  Each is run as a user
+//	program on its own, and reported as the user instructions it ran,
+//	the host time that took, simulated MIPS (millions of instructions
+//	per host second) and host nanoseconds per instruction.  The host
+//	time per Machine::Translate is timed apart, with a page table
+//	made for the purpose.
+//
+//	The results are printed as a table, and, with -sbo, written to a
+//	file as a JSON object, to be kept and compared.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef SIMBENCH_H
+#define SIMBENCH_H
+
+#include "copyright.h"
+
+#define MaxBenchCode		256	// instructions in a kernel
+#define MaxBenchKernels		4
+#define BenchLoops		200000	// iterations of the loop kernels
+#define BenchCopyWords		512	// words copied per round,
+#define BenchCopyRounds		200	// this many times
+#define BenchSyscalls		20000	// system calls made
+#define BenchTranslations	1000000	// Translate calls timed
+
+// The following class defines a kernel as it is assembled.
+
+class BenchProgram {
+  public:
+    BenchProgram() { length = 0; dataSize = 0; }
+
+    unsigned int code[MaxBenchCode];
+    int length;				// instructions so far
+    int dataSize;			// bytes of zeroed data after the
+    					// code (a page boundary)
+
+    int Emit(unsigned int instr);	// Append "instr"; returns where
+    void Patch(int at, unsigned int instr) { code[at] = instr; }
+    void LoadConst(int reg, int value);	// "reg" = "value" (lui, ori)
+    void Branch(int op, int rs, int rt, int to);
+    					// branch to instruction "to"
+    int DataAddr();			// virtual address of the data
+};
+
+// The following class defines the results of one kernel.
+
+class BenchResult {
+  public:
+    char *name;
+    int instructions;			// user instructions it ran
+    double hostSeconds;			// host time it took
+};
+
+// The following class runs the kernels and reports on them.
+
+class SimBench {
+  public:
+    SimBench();
+
+    void Run(char *which, char *jsonName);
+    					// Run the kernel named "which", or
+					// all of them if "all", and write
+					// the results to "jsonName" if it
+					// isn't NULL
+
+  private:
+    BenchResult results[MaxBenchKernels];
+    int numResults;
+    double translateNs;			// host time per Translate, or < 0
+    					// if there is a TLB
+
+    void RunKernel(char *name, BenchProgram *program);
+    					// Write "program" as a NOFF file,
+					// run it, and note what it took
+    void TimeTranslate();
+    void Print();
+    void WriteJSON(char *jsonName);
+
+    void IntLoop(BenchProgram *p);	// the kernels
+    void MemCopy(BenchProgram *p);
+    void Branches(BenchProgram *p);
+    void Syscalls(BenchProgram *p);
+};
+
+#endif // SIMBENCH_H
@@ -8,6 +8,7 @@
 
 #include "copyright.h"
 #include "synchconsole.h"
+#include "main.h"
 
 //----------------------------------------------------------------------
 // SynchConsoleInput::SynchConsoleInput
@@ -22,6 +23,11 @@ SynchConsoleInput::SynchConsoleInput(char *inputFile)
     consoleInput = new ConsoleInput(inputFile, this);
     lock = new Lock("console in");
     waitFor = new Semaphore("console in", 0);
+    head = 0;
+    ready = 0;
+    count = 0;
+    waiting = FALSE;
+    atEnd = FALSE;
 }
 
 //----------------------------------------------------------------------
@@ -38,7 +44,9 @@ SynchConsoleInput::~SynchConsoleInput()
 
 //----------------------------------------------------------------------
 // SynchConsoleInput::GetChar
-//      Read a character typed at the keyboard, waiting if necessary.
+//      Read a character typed at the keyboard, waiting if necessary
+//	for a whole line to be typed.  Returns EOF once the input has
+//	run out.
 //----------------------------------------------------------------------
 
 char
@@ -46,23 +54,105 @@ SynchConsoleInput::GetChar()
 {
     char ch;
 
+    return (Read(&ch, 1) == 1) ? ch : EOF;
+}
+
+//----------------------------------------------------------------------
+// SynchConsoleInput::Read
+//      Read up to "n" characters typed at the keyboard into "buf",
+//	waiting until a whole line has been typed, if none has.  Stops
+//	after the newline, so one call never returns more than one
+//	line.  Returns how many were read, or 0 once the input has run
+//	out.
+//----------------------------------------------------------------------
+
+int
+SynchConsoleInput::Read(char *buf, int n)
+{
+    IntStatus oldLevel;
+    int done = 0;
+    WaitScope wait(WaitConsole);
+
     lock->Acquire();
-    waitFor->P();	// wait for EOF or a char to be available.
-    ch = consoleInput->GetChar();
+    oldLevel = kernel->interrupt->SetLevel(IntOff);
+    Wait();
+    while (done < n && ready > 0) {
+	char ch = buffer[head];
+
+	buf[done++] = ch;
+	head = (head + 1) % ConsoleInputSize;
+	ready--;
+	count--;
+	if (ch == '\n')
+	    break;
+    }
+    (void) kernel->interrupt->SetLevel(oldLevel);
     lock->Release();
-    return ch;
+    return done;
+}
+
+//----------------------------------------------------------------------
+// SynchConsoleInput::Wait
+//      Wait until there is a whole line to read, or the input has run
+//	out.  Interrupts are off.
+//----------------------------------------------------------------------
+
+void
+SynchConsoleInput::Wait()
+{
+    while (ready == 0 && !atEnd) {
+	waiting = TRUE;
+	waitFor->P();
+    }
+}
+
+//----------------------------------------------------------------------
+// SynchConsoleInput::Cooked
+//      Add the character just typed to the line being typed: a
+//	backspace takes back the last one, and a newline hands the line
+//	over to readers.  So does a full ring, or the line could never
+//	be read.  Interrupts are off.
+//----------------------------------------------------------------------
+
+void
+SynchConsoleInput::Cooked(char ch)
+{
+    if (ch == '\b' || ch == 127) {
+	if (count > ready)
+	    count--;
+	return;
+    }
+    buffer[(head + count) % ConsoleInputSize] = ch;
+    count++;
+    if (ch == '\n' || count == ConsoleInputSize)
+	ready = count;
 }
 
 //----------------------------------------------------------------------
 // SynchConsoleInput::CallBack
-//      Interrupt handler called when keystroke is hit; wake up
-//	anyone waiting.
+//      Interrupt handler called when keystroke is hit: take it from
+//	the keyboard, so the next can come, and wake up any reader if a
+//	line is now complete.  When the input runs out, the rest of the
+//	line is handed over too.
+//
+//	A keystroke that finds the ring full is dropped.
 //----------------------------------------------------------------------
 
 void
 SynchConsoleInput::CallBack()
 {
-    waitFor->V();
+    char ch = consoleInput->GetChar();
+
+    if (ch == EOF) {
+	atEnd = TRUE;
+	ready = count;
+    } else if (count < ConsoleInputSize) {
+	Cooked(ch);
+    }
+    if (waiting && (ready > 0 || atEnd)) {
+	waiting = FALSE;
+	waitFor->V();
+    }
 }
 
 //----------------------------------------------------------------------
@@ -77,7 +167,12 @@ SynchConsoleOutput::SynchConsoleOutput(char *outputFile)
 {
     consoleOutput = new ConsoleOutput(outputFile, this);
     lock = new Lock("console out");
-    waitFor = new Semaphore("console out", 0);
+    room = new Semaphore("console out", ConsoleBufferSize);
+    drained = new Semaphore("console drained", 0);
+    head = 0;
+    count = 0;
+    busy = FALSE;
+    flushing = FALSE;
 }
 
 //----------------------------------------------------------------------
@@ -89,31 +184,107 @@ SynchConsoleOutput::~SynchConsoleOutput()
 { 
     delete consoleOutput; 
     delete lock; 
-    delete waitFor;
+    delete room;
+    delete drained;
 }
 
 //----------------------------------------------------------------------
-// SynchConsoleOutput::PutChar
-//      Write a character to the console display, waiting if necessary.
+// SynchConsoleOutput::PutChar, SynchConsoleOutput::PutString
+//      Write a character, or a string, to the console display.
 //----------------------------------------------------------------------
 
 void
 SynchConsoleOutput::PutChar(char ch)
 {
+    Write(&ch, 1);
+}
+
+void
+SynchConsoleOutput::PutString(char *str)
+{
+    Write(str, strlen(str));
+}
+
+//----------------------------------------------------------------------
+// SynchConsoleOutput::Write
+//      Queue "n" characters from "buf" for the console display,
+//	waiting only while the queue is full.  If the display is idle,
+//	it is started on the first.
+//----------------------------------------------------------------------
+
+void
+SynchConsoleOutput::Write(char *buf, int n)
+{
+    IntStatus oldLevel;
+    WaitScope wait(WaitConsole);
+
     lock->Acquire();
-    consoleOutput->PutChar(ch);
-    waitFor->P();
+    for (int i = 0; i < n; i++) {
+	room->P();
+	oldLevel = kernel->interrupt->SetLevel(IntOff);
+	buffer[(head + count) % ConsoleBufferSize] = buf[i];
+	count++;
+	if (!busy)
+	    Start();
+	(void) kernel->interrupt->SetLevel(oldLevel);
+    }
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchConsoleOutput::Flush
+//      Wait until every character queued has been displayed.
+//----------------------------------------------------------------------
+
+void
+SynchConsoleOutput::Flush()
+{
+    IntStatus oldLevel;
+    WaitScope wait(WaitConsole);
+
+    lock->Acquire();
+    oldLevel = kernel->interrupt->SetLevel(IntOff);
+    if (busy) {
+	flushing = TRUE;
+	drained->P();
+    }
+    (void) kernel->interrupt->SetLevel(oldLevel);
     lock->Release();
 }
 
+//----------------------------------------------------------------------
+// SynchConsoleOutput::Start
+//      Give the display the next character queued.  Interrupts are
+//	off.
+//----------------------------------------------------------------------
+
+void
+SynchConsoleOutput::Start()
+{
+    char ch = buffer[head];
+
+    head = (head + 1) % ConsoleBufferSize;
+    count--;
+    busy = TRUE;
+    consoleOutput->PutChar(ch);
+    room->V();
+}
+
 //----------------------------------------------------------------------
 // SynchConsoleOutput::CallBack
 //      Interrupt handler called when it's safe to send the next 
-//	character can be sent to the display.
+//	character can be sent to the display: send it, if there is
+//	one, or else wake up Flush, if it is waiting.
 //----------------------------------------------------------------------
 
 void
 SynchConsoleOutput::CallBack()
 {
-    waitFor->V();
+    busy = FALSE;
+    if (count > 0) {
+	Start();
+    } else if (flushing) {
+	flushing = FALSE;
+	drained->V();
+    }
 }
@@ -4,6 +4,20 @@
 //
 //	NOTE: this abstraction is not completely implemented.
 //
+//	Output is buffered: characters written are queued, and fed to
+//	the display one at a time, as it finishes each, by its
+//	interrupt handler.  A writer only waits when the queue is full,
+//	or when it asks to (Flush).  The display is kept busy as long as
+//	anything is queued, so nothing is held back for a newline.
+//
+//	Input is cooked: each keystroke is taken from the keyboard by
+//	its interrupt handler, as it arrives, into a ring of characters,
+//	where the line being typed can still be edited (backspace).
+//	Readers only see whole lines: once a newline (or the end of the
+//	input) arrives, the line is theirs, and Read hands out as much
+//	of it as fits at once, so a program reading a line at a time
+//	makes one system call per line, not one per character.
+//
 // Copyright (c) 1992-1996 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
 // of liability and disclaimer of warranty provisions.
@@ -17,6 +31,10 @@
 #include "console.h"
 #include "synch.h"
 
+#define ConsoleBufferSize	256	// characters queued for the display
+#define ConsoleInputSize	256	// characters typed but not yet read;
+					// a longer line is handed out in parts
+
 // The following two classes define synchronized input and output to
 // a console device
 
@@ -28,12 +46,22 @@ class SynchConsoleInput : public CallBackObj {
 	void Disable() { consoleInput->Disable(); }// 2015.11.25
 
     char GetChar();		// Read a character, waiting if necessary
+    int Read(char *buf, int n);	// Read up to "n" characters of a line,
+    				// waiting for one; 0 at the end of input
     
   private:
     ConsoleInput *consoleInput;	// the hardware keyboard
     Lock *lock;			// only one reader at a time
-    Semaphore *waitFor;		// wait for callBack
+    Semaphore *waitFor;		// wait for a line
+    char buffer[ConsoleInputSize];	// characters typed, a ring
+    int head;			// the next one to read
+    int ready;			// how many of them are in whole lines
+    int count;			// how many, with the line being typed
+    bool waiting;		// is a reader waiting for a line?
+    bool atEnd;			// has the input run out?
 
+    void Wait();		// Wait for a line, or the end
+    void Cooked(char ch);	// Add "ch" to the line being typed
     void CallBack();		// called when a keystroke is available
 };
 
@@ -43,12 +71,22 @@ class SynchConsoleOutput : public CallBackObj {
     ~SynchConsoleOutput();
 
     void PutChar(char ch);	// Write a character, waiting if necessary
+    void PutString(char *str);	// Write a null-terminated string
+    void Write(char *buf, int n);	// Write "n" characters
+    void Flush();		// Wait until all written is displayed
    
   private:
     ConsoleOutput *consoleOutput;// the hardware display
     Lock *lock;			// only one writer at a time
-    Semaphore *waitFor;		// wait for callBack
+    Semaphore *room;		// free places in "buffer"
+    Semaphore *drained;		// for Flush to wait on
+    char buffer[ConsoleBufferSize];	// characters queued, a ring
+    int head;			// the next one to display
+    int count;			// how many are queued
+    bool busy;			// is the display writing one?
+    bool flushing;		// is Flush waiting?
 
+    void Start();		// Give the display the next character
     void CallBack();		// called when more data can be written
 };
 
@@ -34,6 +34,20 @@
 #define SC_ExecV	13
 #define SC_ThreadExit   14
 #define SC_ThreadJoin   15
+#define SC_ThreadStats	16
+#define SC_Fork		17
+#define SC_Mmap		18
+#define SC_Munmap	19
+#define SC_PRead	20
+#define SC_PWrite	21
+#define SC_ReadV	22
+#define SC_WriteV	23
+#define SC_Submit	24
+#define SC_FutexWait	25
+#define SC_FutexWake	26
+#define SC_Sleep	27
+#define SC_OpenAppend	28
+#define SC_GetStats	29
 #define SC_Add		42
 #define SC_MSG		100
 
@@ -84,6 +98,14 @@ SpaceId Exec(char* exec_name);
  */
 SpaceId ExecV(int argc, char* argv[]);
  
+/* Start a copy of this user program, running on from here in an address
+ * space that starts out the same as this one (its pages are copied only
+ * when one of the two writes them).  Returns the copy's identifier, or
+ * -1 if it can't be made, or if the program is running more than one
+ * thread (see ThreadFork); returns 0 in the copy.
+ */
+SpaceId Fork();
+
 /* Only return once the user program "id" has finished.  
  * Return the exit status.
  */
@@ -124,6 +146,12 @@ int Remove(char *name);
  */
 OpenFileId Open(char *name);
 
+/* Open the Nachos file "name" for appending, as Open does, but every
+ * Write to it goes at the end of the file, wherever Seek last left the
+ * position.  Meant for logs: small appends are cheap.
+ */
+OpenFileId OpenAppend(char *name);
+
 /* Write "size" bytes from "buffer" to the open file. 
  * Return the number of bytes actually read on success.
  * On failure, a negative error code is returned.
@@ -135,19 +163,82 @@ int Write(char *buffer, int size, OpenFileId id);
  * long enough, or if it is an I/O device, and there aren't enough 
  * characters to read, return whatever is available (for I/O devices, 
  * you should always wait until you can return at least one character).
+ * The console (SysConsoleInput) is read a line at a time: Read waits
+ * for a whole line to be typed, and returns no more than that line,
+ * newline included; 0 once the input has run out.
  */
 int Read(char *buffer, int size, OpenFileId id);
 
 /* Set the seek position of the open file "id"
  * to the byte "position".
+ * Return 1 on success, -1 on failure
  */
 int Seek(int position, OpenFileId id);
 
-/* Close the file, we're done reading and writing to it.
- * Return 1 on success, negative error code on failure
+/* Read or write "size" bytes at byte "position" of the open file "id",
+ * leaving its seek position where it was.  Return the number of bytes
+ * actually read or written, or -1 on failure.
+ */
+int PRead(char *buffer, int size, int position, OpenFileId id);
+int PWrite(char *buffer, int size, int position, OpenFileId id);
+
+/* Read into, or write from, "count" buffers in turn, as one Read or
+ * Write would with them laid end to end.  Return the total number of
+ * bytes read or written, or -1 on failure.
+ */
+#define MaxIOVecs 16
+typedef struct {
+    char *base;
+    int len;
+} IOVec;
+int ReadV(IOVec *iov, int count, OpenFileId id);
+int WriteV(IOVec *iov, int count, OpenFileId id);
+
+/* Map the first "length" bytes of the open file "id" into memory, above
+ * the stack.  Return the address it is mapped at, or -1 on failure.
+ * Stores into the mapping are written back to the file when it is
+ * unmapped, when the file is closed, or when the program exits.
+ */
+int Mmap(OpenFileId id, int length);
+
+/* Unmap the file mapped at "addr" by Mmap, writing back what was
+ * stored into it.  Return 1 on success, 0 if nothing is mapped there.
+ */
+int Munmap(int addr);
+
+/* Close the file, we're done reading and writing to it.  Any mapping
+ * of it is unmapped first.  Files still open when the program exits
+ * are closed then.
+ * Return 1 on success, 0 if "id" isn't an open file
  */
 int Close(OpenFileId id);
 
+/* Do a batch of "count" file operations with one system call, rather
+ * than one each.  They are done in order, each as the system call
+ * "op" would do it, and what that would return is put in its "result".
+ * Open takes the name in "buf"; Seek takes "position"; PRead and
+ * PWrite take "buf", "len" and "position"; Read and Write "buf" and
+ * "len"; all but Open take "id".  Return how many were done, or -1 if
+ * the batch can't be read.
+ */
+#define SubmitOpen	0
+#define SubmitClose	1
+#define SubmitRead	2
+#define SubmitWrite	3
+#define SubmitPRead	4
+#define SubmitPWrite	5
+#define SubmitSeek	6
+#define MaxSubmits	32
+typedef struct {
+    int op;
+    OpenFileId id;
+    char *buf;
+    int len;
+    int position;
+    int result;
+} SubmitEntry;
+int Submit(SubmitEntry *entries, int count);
+
 
 /* User-level thread operations: Fork and Yield.  To allow multiple
  * threads to run within a user program. 
@@ -155,20 +246,27 @@ int Close(OpenFileId id);
  * Could define other operations, such as LockAcquire, LockRelease, etc.
  */
 
-/* Fork a thread to run a procedure ("func") in the *same* address space 
- * as the current thread.
+/* Fork a thread to run a procedure ("func"), passed "arg", in the *same*
+ * address space as the current thread, on a stack of its own.  "func"
+ * must end by calling ThreadExit; it has nowhere to return to.
  * Return a positive ThreadId on success, negative error code on failure
  */
-ThreadId ThreadFork(void (*func)());
+ThreadId ThreadFork(void (*func)(int), int arg);
 
 /* Yield the CPU to another runnable thread, whether in this address space 
  * or not. 
  */
 void ThreadYield();	
 
+/* Block for at least "ticks" ticks of simulated time, using no CPU
+ * meanwhile, rather than polling.  A negative count doesn't block.
+ */
+void Sleep(int ticks);
+
 /*
  * Blocks current thread until lokal thread ThreadID exits with ThreadExit.
- * Function returns the ExitCode of ThreadExit() of the exiting thread.
+ * Function returns the ExitCode of ThreadExit() of the exiting thread,
+ * or -1 if it isn't a thread of this program.
  */
 int ThreadJoin(ThreadId id);
 
@@ -177,6 +275,40 @@ int ThreadJoin(ThreadId id);
  */
 void ThreadExit(int ExitCode);	
 
+/* Locks and condition variables are built in user mode on a word of
+ * memory, and only call the kernel when a thread has to wait.
+ *
+ * FutexWait sleeps until a FutexWake on the word at "addr", if it still
+ * holds "expected" (checking and going to sleep can't be split by a
+ * FutexWake).  Return 0 once woken, 1 if the word held something else,
+ * or -1 if "addr" isn't an aligned word of the program.
+ *
+ * FutexWake wakes up to "count" threads waiting on the word at "addr",
+ * first come first woken, and returns how many it woke, or -1.
+ */
+int FutexWait(int *addr, int expected);
+int FutexWake(int *addr, int count);
+
+/*
+ * Copy the calling thread's scheduling accounting, in ticks and
+ * context switches so far, into stats[0..ThreadStatsSize-1]:
+ * time running, waiting on a ready queue, and blocked; then the
+ * switches where it blocked and those where it was still runnable
+ * (preempted or yielding).  Returns 0, or -1 if "stats" is bad.
+ */
+#define ThreadStatsSize 5
+int ThreadStats(int *stats);
+
+/*
+ * Copy where the calling thread's time has gone so far, in ticks,
+ * into stats[0..count-1]: user instructions, kernel work on its
+ * behalf, and time blocked waiting for the disk and for the console.
+ * Only the first GetStatsSize are kept, so a program built for fewer
+ * still works.  Returns how many were copied, or -1 if "stats" is bad.
+ */
+#define GetStatsSize 4
+int GetStats(int *stats, int count);
+
 #endif /* IN_ASM */
 
 #endif /* SYSCALL_H */